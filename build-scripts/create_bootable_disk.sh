@@ -480,5 +480,15 @@ EOF
 
 chmod +x "${OUTDIR}/qemu.sh"
 
+# Same, but with the disk on QEmu's AHCI controller, which supports NCQ.
+# The kernel prints "NCQ enabled, queue depth N" when it finds the disk.
+# As with VirtualBox (see README.md), the root device in /boot/grub/grub.cfg
+# and /etc/fstab needs to be changed to /dev/sda4 to boot from this disk.
+cat << EOF > "${OUTDIR}/qemu-ahci.sh"
+qemu-system-${QEMU_ARCH} -accel tcg,thread=single -cpu core2duo -m 2048 -M pc -no-reboot -no-shutdown -drive format=raw,file=${IMAGE},if=none,id=disk0 -device ahci,id=ahci0 -device ide-hd,drive=disk0,bus=ahci0.0 -boot c -serial stdio -smp 1 -usb -vga std -net nic,model=ne2k_pci -net tap,ifname=tap0,script=no,downscript=no,id=net0 -device intel-hda,debug=4 -device hda-duplex -audiodev id=pa,driver=pa,server=/run/user/1000/pulse/native
+EOF
+
+chmod +x "${OUTDIR}/qemu-ahci.sh"
+
 echo "Done!"
 
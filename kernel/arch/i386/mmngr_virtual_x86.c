@@ -208,6 +208,9 @@ void vmmngr_initialize(void)
     size_t frames = pmmngr_get_block_count();
     frame_shares = (unsigned char *)kmalloc(frames);
     A_memset((void *)frame_shares, 0, frames);
+
+    printk("Initializing buddy allocator..\n");
+    pmmngr_init_buddy();
    
     printk("Initializing VESA BIOS Extensions (VBE)..\n");
     vbe_init();
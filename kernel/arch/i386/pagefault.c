@@ -205,6 +205,7 @@ int page_fault(struct regs *r, int arg)
         
         memregion_higher->addr -= PAGE_SIZE;
         memregion_higher->size++;
+        memregion_tree_update(ct->mem, memregion_higher);
         
         if(align_down(ct->end_stack) == (memregion_higher->addr + PAGE_SIZE))
         {
@@ -338,6 +338,9 @@ void vmmngr_initialize(/* multiboot_info_t *mbd */)
     frame_shares = (unsigned char *)kmalloc(frames);
     A_memset((void *)frame_shares, 0, frames);
 
+    printk("Initializing buddy allocator..\n");
+    pmmngr_init_buddy();
+
     if(!using_ega())
     //if(has_vbe)
     {
@@ -120,6 +120,8 @@ static int map_stack_page(volatile struct memregion_t *memregion,
             
         memregion->addr = aligned_faulting_address;
         memregion->size = (end - aligned_faulting_address) / PAGE_SIZE;
+        memregion_tree_update(this_core->cur_task->mem,
+                              (struct memregion_t *)memregion);
         this_core->cur_task->end_stack = aligned_faulting_address;
     }
 
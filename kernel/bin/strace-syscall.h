@@ -206,6 +206,7 @@ const char *syscall_names[] =
     [__NR_getcwd            ] = "getcwd",                   // 183
 
     [__NR_signalstack       ] = "signalstack",              // 186
+    [__NR_sendfile          ] = "sendfile",                 // 187
 
     [__NR_vfork             ] = "vfork",                    // 190
 
@@ -230,12 +231,21 @@ const char *syscall_names[] =
     [__NR_mincore           ] = "mincore",                  // 218
 
     [__NR_gettid            ] = "gettid",                   // 224
+    [__NR_readahead         ] = "readahead",                // 225
+
+    [__NR_futex             ] = "futex",                    // 240
 
     [__NR_set_thread_area   ] = "set_thread_area",          // 243
     [__NR_get_thread_area   ] = "get_thread_area",          // 244
 
+    [__NR_fadvise64         ] = "fadvise64",                // 250
+
     [__NR_exit_group        ] = "exit_group",               // 252
 
+    [__NR_epoll_create      ] = "epoll_create",             // 254
+    [__NR_epoll_ctl         ] = "epoll_ctl",
+    [__NR_epoll_wait        ] = "epoll_wait",               // 256
+
     [__NR_timer_create      ] = "timer_create",             // 259
     [__NR_timer_settime     ] = "timer_settime",
     [__NR_timer_gettime     ] = "timer_gettime",
@@ -267,6 +277,22 @@ const char *syscall_names[] =
     [__NR_pselect           ] = "pselect",
     [__NR_ppoll             ] = "ppoll",                    // 309
 
+    [__NR_splice            ] = "splice",                   // 313
+
+    [__NR_tee               ] = "tee",                      // 315
+    [__NR_vmsplice          ] = "vmsplice",                 // 316
+
+    [__NR_epoll_pwait       ] = "epoll_pwait",              // 319
+
+    [__NR_signalfd          ] = "signalfd",                 // 321
+    [__NR_timerfd_create    ] = "timerfd_create",
+    [__NR_eventfd           ] = "eventfd",
+
+    [__NR_timerfd_settime   ] = "timerfd_settime",          // 325
+    [__NR_timerfd_gettime   ] = "timerfd_gettime",
+    [__NR_signalfd4         ] = "signalfd4",
+    [__NR_eventfd2          ] = "eventfd2",
+    [__NR_epoll_create1     ] = "epoll_create1",            // 329
     [__NR_dup3              ] = "dup3",	                    // 330
     [__NR_pipe2             ] = "pipe2",	                // 331
 
@@ -508,6 +534,7 @@ char syscall_mask[] =
     [__NR_getcwd            ] = 1,                      // 183
 
     [__NR_signalstack       ] = 1,                      // 186
+    [__NR_sendfile          ] = 1,                      // 187
 
     [__NR_vfork             ] = 1,                      // 190
 
@@ -532,12 +559,21 @@ char syscall_mask[] =
     [__NR_mincore           ] = 1,                      // 218
 
     [__NR_gettid            ] = 1,                      // 224
+    [__NR_readahead         ] = 1,                      // 225
+
+    [__NR_futex             ] = 1,                      // 240
 
     [__NR_set_thread_area   ] = 1,                      // 243
     [__NR_get_thread_area   ] = 1,                      // 244
 
+    [__NR_fadvise64         ] = 1,                      // 250
+
     [__NR_exit_group        ] = 1,                      // 252
 
+    [__NR_epoll_create      ] = 1,                      // 254
+    [__NR_epoll_ctl         ] = 1,
+    [__NR_epoll_wait        ] = 1,                      // 256
+
     [__NR_timer_create      ] = 1,                      // 259
     [__NR_timer_settime     ] = 1,
     [__NR_timer_gettime     ] = 1,
@@ -569,6 +605,22 @@ char syscall_mask[] =
     [__NR_pselect           ] = 1,
     [__NR_ppoll             ] = 1,                      // 309
 
+    [__NR_splice            ] = 1,                      // 313
+
+    [__NR_tee               ] = 1,                      // 315
+    [__NR_vmsplice          ] = 1,                      // 316
+
+    [__NR_epoll_pwait       ] = 1,                      // 319
+
+    [__NR_signalfd          ] = 1,                      // 321
+    [__NR_timerfd_create    ] = 1,
+    [__NR_eventfd           ] = 1,
+
+    [__NR_timerfd_settime   ] = 1,                      // 325
+    [__NR_timerfd_gettime   ] = 1,
+    [__NR_signalfd4         ] = 1,
+    [__NR_eventfd2          ] = 1,
+    [__NR_epoll_create1     ] = 1,                      // 329
     [__NR_dup3              ] = 1,	                    // 330
     [__NR_pipe2             ] = 1,	                    // 331
 
@@ -671,7 +723,11 @@ extern int syscall_mask_count;
     __NR_fdatasync, __NR_poll, __NR_pread, __NR_pwrite,             \
     __NR_fchown32, __NR_fchownat, __NR_futimesat, __NR_fstatat,     \
     __NR_fchmodat, __NR_faccessat, __NR_pselect, __NR_ppoll,        \
-    __NR_dup3, __NR_pipe2, __NR_preadv, __NR_pwritev, __NR_syncfs
+    __NR_dup3, __NR_pipe2, __NR_preadv, __NR_pwritev, __NR_syncfs,  \
+    __NR_epoll_create, __NR_epoll_ctl, __NR_epoll_wait,             \
+    __NR_epoll_pwait, __NR_epoll_create1, __NR_signalfd,           \
+    __NR_timerfd_settime, __NR_timerfd_gettime, __NR_signalfd4,     \
+    __NR_sendfile, __NR_splice, __NR_tee, __NR_vmsplice
 
 
 #define MEMORY_SYSCALL_LIST                                         \
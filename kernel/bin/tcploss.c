@@ -0,0 +1,348 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: tcploss.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file tcploss.c
+ *
+ *  A program to test TCP loss recovery and congestion control. It sets the
+ *  loopback interface's drop rate, sends data over a TCP connection on the
+ *  loopback interface, checks that all of it arrived, and prints the
+ *  connection's congestion control state from /proc/net/tcpstat.
+ *
+ *  For example, to send 8MiB using NewReno with 2% of packets dropped:
+ *
+ *      tcploss -r 20 -s 8192 -c newreno
+ *
+ *  The run is good if the receiver gets all the data, and the Retrans,
+ *  FastRetr and Timeouts columns show the losses were recovered mostly by
+ *  fast retransmit rather than timeouts. Setting the drop rate needs root.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifndef TCP_CONGESTION
+#define TCP_CONGESTION          13
+#endif
+
+#define BUFSZ                   8192
+
+char *ver = "1.0";
+
+int drop_rate = 10;                 // packets dropped per 1000
+size_t kbytes = 4096;               // KiB to send
+unsigned short port = 5001;
+char *cong = NULL;
+
+
+void parse_line_args(int argc, char **argv)
+{
+    int c;
+    static struct option long_options[] =
+    {
+        {"help",    no_argument,       0, 'h'},
+        {"version", no_argument,       0, 'v'},
+        {"cong",    required_argument, 0, 'c'},
+        {"port",    required_argument, 0, 'p'},
+        {"rate",    required_argument, 0, 'r'},
+        {"size",    required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+
+    while((c = getopt_long(argc, argv, "hvc:p:r:s:", long_options, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 0:
+                break;
+
+            case 'c':
+                cong = optarg;
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 'r':
+                drop_rate = atoi(optarg);
+
+                if(drop_rate < 0 || drop_rate > 1000)
+                {
+                    fprintf(stderr, "%s: drop rate must be 0-1000\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                break;
+
+            case 's':
+                kbytes = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'v':
+                printf("%s\n", ver);
+                exit(EXIT_SUCCESS);
+                break;
+
+            case 'h':
+                printf("tcploss utility for LaylaOS, Version %s\n\n", ver);
+                printf("Usage: %s [options]\n\n"
+                       "Options:\n"
+                       "  -c, --cong ALG    Use congestion control algorithm ALG\n"
+                       "                      (default: the system default)\n"
+                       "  -h, --help        Show this help and exit\n"
+                       "  -p, --port N      Use TCP port N (default: 5001)\n"
+                       "  -r, --rate N      Drop N out of every 1000 loopback "
+                                            "packets (default: 10)\n"
+                       "  -s, --size N      Send N KiB (default: 4096)\n"
+                       "  -v, --version     Print version and exit\n"
+                       "\n", argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+
+            case '?':
+                break;
+
+            default:
+                abort();
+        }
+    }
+}
+
+
+int set_drop_rate(int rate, int *oldrate)
+{
+    int mib[2] = { CTL_NET, NET_LOOPBACK_DROP };
+    size_t oldlen = sizeof(int);
+
+    return sysctl(mib, 2, oldrate, oldrate ? &oldlen : NULL,
+                  &rate, sizeof(int));
+}
+
+
+/*
+ * Print the header and our connection's lines from /proc/net/tcpstat.
+ */
+void print_tcpstat(unsigned short lport)
+{
+    FILE *f;
+    char buf[256], pat[16];
+    int first = 1;
+
+    if(!(f = fopen("/proc/net/tcpstat", "r")))
+    {
+        perror("Failed to open /proc/net/tcpstat");
+        return;
+    }
+
+    // addresses and ports are printed in hex, in network byte order
+    sprintf(pat, "7f000001:%04x", lport);
+
+    while(fgets(buf, sizeof(buf), f))
+    {
+        if(first || strstr(buf, pat))
+        {
+            fputs(buf, stdout);
+        }
+
+        first = 0;
+    }
+
+    fclose(f);
+}
+
+
+/*
+ * Receive until the sender closes the connection, and return the number
+ * of bytes received.
+ */
+size_t receiver(int lfd)
+{
+    char buf[BUFSZ];
+    size_t total = 0;
+    ssize_t n;
+    int fd;
+
+    if((fd = accept(lfd, NULL, NULL)) < 0)
+    {
+        perror("Failed to accept connection");
+        return 0;
+    }
+
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        total += n;
+    }
+
+    close(fd);
+
+    return total;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    struct timespec start, end;
+    socklen_t addrlen = sizeof(addr);
+    char buf[BUFSZ];
+    size_t total, sent = 0, got;
+    ssize_t n;
+    pid_t pid;
+    int lfd, fd, pfd[2], oldrate = 0, status, res = EXIT_FAILURE;
+    double secs;
+
+    parse_line_args(argc, argv);
+    total = kbytes * 1024;
+    memset(buf, 'x', sizeof(buf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+       bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(lfd, 1) < 0)
+    {
+        perror("Failed to create listening socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // the receiver tells us how much it got through a pipe
+    if(pipe(pfd) < 0)
+    {
+        perror("Failed to create pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    if((pid = fork()) < 0)
+    {
+        perror("Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if(pid == 0)
+    {
+        close(pfd[0]);
+        got = receiver(lfd);
+        write(pfd[1], &got, sizeof(got));
+        exit(EXIT_SUCCESS);
+    }
+
+    close(pfd[1]);
+    close(lfd);
+
+    if(set_drop_rate(drop_rate, &oldrate) < 0)
+    {
+        perror("Failed to set loopback drop rate");
+        kill(pid, SIGKILL);
+        exit(EXIT_FAILURE);
+    }
+
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("Failed to create socket");
+        goto fin;
+    }
+
+    if(cong && setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION,
+                          cong, strlen(cong) + 1) < 0)
+    {
+        perror("Failed to set congestion control algorithm");
+        goto fin;
+    }
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Failed to connect");
+        goto fin;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(sent < total)
+    {
+        n = (total - sent > sizeof(buf)) ? sizeof(buf) : total - sent;
+
+        if((n = write(fd, buf, n)) < 0)
+        {
+            perror("Failed to send");
+            goto fin;
+        }
+
+        sent += n;
+    }
+
+    // wait for the receiver to get everything before we look at the stats
+    shutdown(fd, SHUT_WR);
+
+    if(read(pfd[0], &got, sizeof(got)) != sizeof(got))
+    {
+        got = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    getsockname(fd, (struct sockaddr *)&addr, &addrlen);
+    print_tcpstat(ntohs(addr.sin_port));
+    close(fd);
+
+    secs = (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+    printf("\nDrop rate %d/1000: sent %zu bytes, received %zu bytes "
+           "in %.2f secs (%.1f KiB/s)\n",
+           drop_rate, sent, got, secs, secs > 0 ? got / 1024 / secs : 0);
+
+    res = (got == total) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if(res != EXIT_SUCCESS)
+    {
+        printf("Data was lost!\n");
+    }
+
+fin:
+
+    set_drop_rate(oldrate, NULL);
+
+    // don't leave the receiver waiting if we failed early
+    if(res != EXIT_SUCCESS)
+    {
+        kill(pid, SIGKILL);
+    }
+
+    waitpid(pid, &status, 0);
+
+    exit(res);
+}
@@ -0,0 +1,528 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: blk_queue.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file blk_queue.c
+ *
+ *  Block device request queues. Disk requests are queued per device, where
+ *  adjacent requests are merged (for drivers that can transfer a merged
+ *  request in one go), and dispatched by a deadline elevator: requests are
+ *  sent to the driver in disk order, unless one has waited for too long.
+ *
+ *  There is no dispatch thread. Tasks waiting for their requests dispatch
+ *  queued requests (theirs or others') whenever the device has room for
+ *  more, and go to sleep otherwise. As strategy functions run synchronously,
+ *  up to BLK_MAX_IN_FLIGHT tasks can be in the driver at the same time.
+ */
+
+#include <errno.h>
+#include <kernel/laylaos.h>
+#include <kernel/task.h>
+#include <kernel/dev.h>
+#include <kernel/blk_queue.h>
+#include <mm/kheap.h>
+
+struct blk_queue_t *blk_queues[BLK_QUEUE_HASH_SIZE] = { 0, };
+volatile struct kernel_mutex_t blk_queues_lock = { 0, };
+
+#define blk_hash(dev)       (((dev) ^ ((dev) >> 8)) & (BLK_QUEUE_HASH_SIZE - 1))
+#define blk_dir(req)        ((req)->write ? BLK_WRITE : BLK_READ)
+
+
+/*
+ * Get the device's request queue, creating it if needed.
+ */
+static struct blk_queue_t *blk_get_queue(dev_t dev)
+{
+    struct blk_queue_t *q;
+    int h = blk_hash(dev);
+
+    kernel_mutex_lock(&blk_queues_lock);
+
+    for(q = blk_queues[h]; q != NULL; q = q->next)
+    {
+        if(q->dev == dev)
+        {
+            kernel_mutex_unlock(&blk_queues_lock);
+            return q;
+        }
+    }
+
+    if((q = kmalloc(sizeof(struct blk_queue_t))))
+    {
+        A_memset(q, 0, sizeof(struct blk_queue_t));
+        q->dev = dev;
+        init_kernel_mutex(&q->lock);
+        q->next = blk_queues[h];
+        blk_queues[h] = q;
+    }
+
+    kernel_mutex_unlock(&blk_queues_lock);
+
+    return q;
+}
+
+
+/*
+ * The functions below must be called with the queue lock held.
+ */
+
+static void blk_list_remove(struct blk_queue_t *q, struct disk_req_t *rq)
+{
+    int dir = blk_dir(rq);
+
+    if(rq->sort_prev)
+    {
+        rq->sort_prev->sort_next = rq->sort_next;
+    }
+    else
+    {
+        q->sort_head[dir] = rq->sort_next;
+    }
+
+    if(rq->sort_next)
+    {
+        rq->sort_next->sort_prev = rq->sort_prev;
+    }
+
+    if(rq->fifo_prev)
+    {
+        rq->fifo_prev->fifo_next = rq->fifo_next;
+    }
+    else
+    {
+        q->fifo_head[dir] = rq->fifo_next;
+    }
+
+    if(rq->fifo_next)
+    {
+        rq->fifo_next->fifo_prev = rq->fifo_prev;
+    }
+    else
+    {
+        q->fifo_tail[dir] = rq->fifo_prev;
+    }
+
+    rq->sort_prev = NULL;
+    rq->sort_next = NULL;
+    rq->fifo_prev = NULL;
+    rq->fifo_next = NULL;
+    q->queued[dir]--;
+}
+
+
+// put req in old's place in both lists
+static void blk_list_replace(struct blk_queue_t *q, struct disk_req_t *old,
+                             struct disk_req_t *req)
+{
+    int dir = blk_dir(req);
+
+    req->sort_prev = old->sort_prev;
+    req->sort_next = old->sort_next;
+    req->fifo_prev = old->fifo_prev;
+    req->fifo_next = old->fifo_next;
+
+    if(req->sort_prev)
+    {
+        req->sort_prev->sort_next = req;
+    }
+    else
+    {
+        q->sort_head[dir] = req;
+    }
+
+    if(req->sort_next)
+    {
+        req->sort_next->sort_prev = req;
+    }
+
+    if(req->fifo_prev)
+    {
+        req->fifo_prev->fifo_next = req;
+    }
+    else
+    {
+        q->fifo_head[dir] = req;
+    }
+
+    if(req->fifo_next)
+    {
+        req->fifo_next->fifo_prev = req;
+    }
+    else
+    {
+        q->fifo_tail[dir] = req;
+    }
+
+    old->sort_prev = NULL;
+    old->sort_next = NULL;
+    old->fifo_prev = NULL;
+    old->fifo_next = NULL;
+}
+
+
+// append the segments of rq to those of req
+static inline void blk_chain(struct disk_req_t *req, struct disk_req_t *rq)
+{
+    req->tail->next = rq;
+    req->tail = rq->tail;
+    req->nbytes += rq->nbytes;
+}
+
+
+static inline int blk_can_merge(struct disk_req_t *req, struct disk_req_t *rq)
+{
+    return (req->pos + req->nbytes == rq->pos &&
+            req->nbytes + rq->nbytes <= BLK_MAX_MERGE_BYTES);
+}
+
+
+static void blk_insert(struct blk_queue_t *q, struct disk_req_t *req)
+{
+    struct disk_req_t *prev = NULL, *next;
+    int dir = blk_dir(req);
+    int merge = (bdev_tab[MAJOR(q->dev)].flags & BDEV_FLAG_MERGE);
+
+    q->stats.reqs[dir]++;
+
+    for(next = q->sort_head[dir];
+        next != NULL && next->pos <= req->pos;
+        next = next->sort_next)
+    {
+        prev = next;
+    }
+
+    // back merge, which might fill the gap to the next request
+    if(merge && prev && blk_can_merge(prev, req))
+    {
+        blk_chain(prev, req);
+        q->stats.merges[dir]++;
+
+        if(next && blk_can_merge(prev, next))
+        {
+            blk_list_remove(q, next);
+            blk_chain(prev, next);
+        }
+
+        return;
+    }
+
+    // front merge
+    if(merge && next && blk_can_merge(req, next))
+    {
+        req->deadline = next->deadline;
+        blk_list_replace(q, next, req);
+        blk_chain(req, next);
+        q->stats.merges[dir]++;
+        return;
+    }
+
+    req->deadline = ticks + (req->write ? BLK_WRITE_EXPIRE : BLK_READ_EXPIRE);
+
+    req->sort_prev = prev;
+    req->sort_next = next;
+
+    if(prev)
+    {
+        prev->sort_next = req;
+    }
+    else
+    {
+        q->sort_head[dir] = req;
+    }
+
+    if(next)
+    {
+        next->sort_prev = req;
+    }
+
+    req->fifo_prev = q->fifo_tail[dir];
+    req->fifo_next = NULL;
+
+    if(q->fifo_tail[dir])
+    {
+        q->fifo_tail[dir]->fifo_next = req;
+    }
+    else
+    {
+        q->fifo_head[dir] = req;
+    }
+
+    q->fifo_tail[dir] = req;
+    q->queued[dir]++;
+}
+
+
+// first request at or after the disk head, wrapping around to the start
+static struct disk_req_t *blk_sorted_next(struct blk_queue_t *q, int dir)
+{
+    struct disk_req_t *rq;
+
+    for(rq = q->sort_head[dir]; rq != NULL; rq = rq->sort_next)
+    {
+        if(rq->pos >= q->head_pos)
+        {
+            return rq;
+        }
+    }
+
+    return q->sort_head[dir];
+}
+
+
+static struct disk_req_t *blk_next_req(struct blk_queue_t *q)
+{
+    struct disk_req_t *rq;
+    int dir;
+
+    if(q->batch && q->queued[q->batch_dir])
+    {
+        dir = q->batch_dir;
+        rq = blk_sorted_next(q, dir);
+        q->batch--;
+    }
+    else
+    {
+        // start a new batch, preferring reads unless writes are starved
+        if(q->queued[BLK_READ] && q->queued[BLK_WRITE])
+        {
+            if(q->starved >= BLK_WRITES_STARVED)
+            {
+                dir = BLK_WRITE;
+                q->starved = 0;
+            }
+            else
+            {
+                dir = BLK_READ;
+                q->starved++;
+            }
+        }
+        else if(q->queued[BLK_READ])
+        {
+            dir = BLK_READ;
+        }
+        else if(q->queued[BLK_WRITE])
+        {
+            dir = BLK_WRITE;
+            q->starved = 0;
+        }
+        else
+        {
+            return NULL;
+        }
+
+        q->batch_dir = dir;
+        q->batch = BLK_FIFO_BATCH - 1;
+        rq = q->fifo_head[dir];
+
+        if(rq->deadline <= ticks)
+        {
+            q->stats.expired[dir]++;
+        }
+        else
+        {
+            rq = blk_sorted_next(q, dir);
+        }
+    }
+
+    blk_list_remove(q, rq);
+    q->head_pos = rq->pos + rq->nbytes;
+    q->stats.dispatched[dir]++;
+
+    return rq;
+}
+
+
+static void blk_complete(struct blk_queue_t *q, struct disk_req_t *rq,
+                         long res)
+{
+    struct disk_req_t *seg, *next;
+    int dir = blk_dir(rq);
+
+    if(res < 0)
+    {
+        q->stats.errors[dir]++;
+    }
+    else
+    {
+        q->stats.bytes[dir] += rq->nbytes;
+    }
+
+    // a request that was not merged gets the driver's result as-is
+    if(!rq->next)
+    {
+        rq->res = res;
+        rq->done = 1;
+        return;
+    }
+
+    // the owner of a segment can reuse it as soon as it sees it done
+    for(seg = rq; seg != NULL; seg = next)
+    {
+        next = seg->next;
+        seg->res = (res < 0) ? res : (long)seg->datasz;
+        seg->next = NULL;
+        seg->tail = seg;
+        seg->done = 1;
+    }
+}
+
+
+static void blk_queue_req(struct disk_req_t *req)
+{
+    struct blk_queue_t *q;
+    int maj = MAJOR(req->dev);
+
+    req->next = NULL;
+    req->tail = req;
+    req->sort_prev = NULL;
+    req->sort_next = NULL;
+    req->fifo_prev = NULL;
+    req->fifo_next = NULL;
+    req->queue = NULL;
+    req->pos = (unsigned long long)req->blockno * req->fs_blocksz;
+    req->nbytes = req->datasz;
+    req->deadline = 0;
+    req->res = 0;
+    req->done = 0;
+
+    if(!bdev_tab[maj].strategy)
+    {
+        req->res = -ENODEV;
+        req->done = 1;
+        return;
+    }
+
+    // if we can't get a queue, do the I/O now
+    if(!(q = blk_get_queue(req->dev)))
+    {
+        req->res = bdev_tab[maj].strategy(req);
+        req->done = 1;
+        return;
+    }
+
+    req->queue = q;
+    kernel_mutex_lock(&q->lock);
+    blk_insert(q, req);
+    kernel_mutex_unlock(&q->lock);
+}
+
+
+/*
+ * Wait for a request, dispatching queued requests while we wait.
+ */
+long blk_wait_req(struct disk_req_t *req)
+{
+    struct blk_queue_t *q = req->queue;
+    struct disk_req_t *rq;
+    long res;
+
+    if(!q)
+    {
+        return req->res;
+    }
+
+    kernel_mutex_lock(&q->lock);
+
+    while(!req->done)
+    {
+        if(q->in_flight < BLK_MAX_IN_FLIGHT && (rq = blk_next_req(q)))
+        {
+            q->in_flight++;
+            kernel_mutex_unlock(&q->lock);
+
+            res = bdev_tab[MAJOR(q->dev)].strategy(rq);
+
+            kernel_mutex_lock(&q->lock);
+            q->in_flight--;
+            blk_complete(q, rq, res);
+            unblock_tasks(q);
+            continue;
+        }
+
+        // our request is in the driver, or the device is busy
+        block_task_and_unlock(q, 0, &q->lock);
+        kernel_mutex_lock(&q->lock);
+    }
+
+    kernel_mutex_unlock(&q->lock);
+
+    return req->res;
+}
+
+
+/*
+ * Submit a disk request and wait for it.
+ */
+long blk_submit(struct disk_req_t *req)
+{
+    blk_queue_req(req);
+
+    return blk_wait_req(req);
+}
+
+
+/*
+ * Start a plug.
+ */
+void blk_start_plug(struct blk_plug_t *plug)
+{
+    plug->head = NULL;
+    plug->tail = NULL;
+}
+
+
+/*
+ * Add a request to a plug.
+ */
+void blk_plug_req(struct blk_plug_t *plug, struct disk_req_t *req)
+{
+    req->fifo_next = NULL;
+
+    if(plug->tail)
+    {
+        plug->tail->fifo_next = req;
+    }
+    else
+    {
+        plug->head = req;
+    }
+
+    plug->tail = req;
+}
+
+
+/*
+ * Queue the plugged requests.
+ */
+void blk_finish_plug(struct blk_plug_t *plug)
+{
+    struct disk_req_t *req, *next;
+
+    for(req = plug->head; req != NULL; req = next)
+    {
+        next = req->fifo_next;
+        blk_queue_req(req);
+    }
+
+    plug->head = NULL;
+    plug->tail = NULL;
+}
@@ -29,6 +29,7 @@
 #include <kernel/vfs.h>
 #include <kernel/user.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <kernel/pcache.h>
 #include <mm/kheap.h>
 
@@ -90,7 +91,7 @@ ssize_t block_write(struct file_t *f, off_t *pos,
         req.blockno = blockno;
         req.write = 0;
 
-        if((res = bdev_tab[maj].strategy(&req)) < 0)
+        if((res = blk_submit(&req)) < 0)
         {
             kfree(tmpbuf);
             return done ? (ssize_t)done : res;
@@ -110,7 +111,7 @@ ssize_t block_write(struct file_t *f, off_t *pos,
 
         req.write = 1;
 
-        if((res = bdev_tab[maj].strategy(&req)) < 0)
+        if((res = blk_submit(&req)) < 0)
         {
             kfree(tmpbuf);
             return done ? (ssize_t)done : res;
@@ -222,7 +223,7 @@ ssize_t block_read(struct file_t *f, off_t *pos,
     {
         req.blockno = blockno;
 
-        if((res = bdev_tab[maj].strategy(&req)) < 0)
+        if((res = blk_submit(&req)) < 0)
         {
             kfree(tmpbuf);
             return done ? (ssize_t)done : res;
@@ -33,6 +33,7 @@
 #include <kernel/vfs.h>
 #include <kernel/ata.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <kernel/task.h>
 #include <kernel/ahci.h>
 #include <kernel/cdrom.h>
@@ -820,7 +821,7 @@ static long cdrom_command(struct ata_dev_s *dev, dev_t devid,
     /*
      * TODO: we should get sense info for failed transfers
      */
-    if((res = ahci_strategy(&req)) < 0)
+    if((res = blk_submit(&req)) < 0)
     {
         ((scsireq_t *)arg)->retsts = SCCMD_UNKNOWN;
     }
@@ -621,7 +621,7 @@ int disk_openers(struct file_t *f)
 
         elevated_priority_unlock(&task_table_lock);
 
-        for(fd = 0; fd < NR_OPEN; fd++)
+        for(fd = 0; *t && fd < (*t)->ofiles->max_fds; fd++)
         {
             if(*t && (*t)->ofiles->ofile[fd] == f)
             {
@@ -77,12 +77,14 @@ struct bdev_ops_t bdev_tab[NR_DEV] =
     { lodev_strategy, NULL, NULL, lodev_ioctl, NULL, NULL, ZDIRENT, ZCACHE },
 
     /* 8 = sda, ... sdp */
-    { ahci_strategy, NULL, NULL, ahci_ioctl, NULL, NULL, ZDIRENT, ZCACHE },
+    { ahci_strategy, NULL, NULL, ahci_ioctl, NULL, NULL, ZDIRENT, ZCACHE
+      BDEV_FLAG_MERGE },
     ZDEV_ENTRY,
     ZDEV_ENTRY,
 
     /* 11 = scd0, ... */
-    { ahci_strategy, NULL, NULL, ahci_cdrom_ioctl, NULL, NULL, ZDIRENT, ZCACHE },
+    { ahci_strategy, NULL, NULL, ahci_cdrom_ioctl, NULL, NULL, ZDIRENT, ZCACHE
+      BDEV_FLAG_MERGE },
     ZDEV_ENTRY,
     ZDEV_ENTRY,
     ZDEV_ENTRY,
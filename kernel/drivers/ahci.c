@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <sys/hdreg.h>
 #include <kernel/laylaos.h>
+#include <kernel/asm.h>
 #include <kernel/timer.h>
 #include <kernel/ata.h>
 #include <kernel/ahci.h>
@@ -79,10 +80,36 @@
 #define PORT_CMD_SUD            4
 
 #define HBA_PORT_IS_TFES        (1 << 30)
+#define HBA_PORT_IS_HBFS        (1 << 29)
+#define HBA_PORT_IS_HBDS        (1 << 28)
+#define HBA_PORT_IS_IFS         (1 << 27)
+#define HBA_PORT_IS_ERR         (HBA_PORT_IS_TFES | HBA_PORT_IS_HBFS | \
+                                 HBA_PORT_IS_HBDS | HBA_PORT_IS_IFS)
 #define HBA_PORT_CMD_ICC        (0xf << 28)
 #define HBA_PORT_CMD_ICC_ACTIVE (1 << 28)
 
-#define CMD_SLOTS(hba)          (((hba)->cap >> 8) & 0xff)
+#define HBA_CAP_SNCQ            (1 << 30)
+#define CMD_SLOTS(hba)          ((((hba)->cap >> 8) & 0x1f) + 1)
+
+/* NCQ commands */
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED  0x61
+
+/* IDENTIFY fields for NCQ support (words 75 and 76) */
+#define ATA_IDENT_QUEUE_DEPTH   150
+#define ATA_IDENT_SATA_CAP      152
+#define SATA_CAP_NCQ            (1 << 8)
+
+/* Max bytes per PRDT entry */
+#define PRDT_MAX_BYTES          (4 * 1024 * 1024)
+
+/*
+ * Tasks waiting for a command wake up every AHCI_POLL_TICKS to reap
+ * completions in case an IRQ was missed, and give up on a command that
+ * takes longer than AHCI_CMD_TIMEOUT ticks.
+ */
+#define AHCI_POLL_TICKS         (PIT_FREQUENCY / 10)
+#define AHCI_CMD_TIMEOUT        (PIT_FREQUENCY * 30)
 
 #define IS_CDROM(dev)           (MAJOR(dev) == AHCI_CDROM_MAJ)
 
@@ -98,12 +125,9 @@ struct parttab_s *ahci_disk_part[MAX_AHCI_DEVICES];
 int ahci_intr(struct regs *r, int unit);
 long ahci_sata_read(struct ata_dev_s *dev, size_t lba, int __sectors,
                                            uintptr_t phys_buf);
-long ahci_sata_write(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                            uintptr_t phys_buf);
-long ahci_satapi_read(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                             uintptr_t phys_buf);
-long ahci_satapi_write(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                              uintptr_t phys_buf);
+int ahci_satapi_read_capacity(struct ata_dev_s *dev);
+static long ahci_rw(struct ata_dev_s *dev, size_t lba,
+                    struct disk_req_t *req, size_t len, int write);
 void ahci_read_mbr(struct ata_dev_s *dev, uintptr_t phys_buf,
                                           uintptr_t virt_buf);
 
@@ -142,9 +166,8 @@ STATIC_INLINE struct parttab_s *AHCI_PART(dev_t dev)
  */
 long ahci_strategy(struct disk_req_t *req)
 {
-    size_t block;
-    long res = 0;
-    int sectors_per_block, sectors_to_read;
+    size_t block, sectors, sectors_per_block, datasz;
+    struct disk_req_t *seg;
     struct ata_dev_s *dev = AHCI_DEV(req->dev);
     struct parttab_s *part = AHCI_PART(req->dev);
 
@@ -162,60 +185,52 @@ long ahci_strategy(struct disk_req_t *req)
 
     //printk("ahci_strategy - dev 0x%x, lba 0x%x, block_no 0x%x, bps 0x%x\n", req->dev, part ? part->lba : 0, req->blockno, dev->bytes_per_sector);
 
-    sectors_to_read = req->datasz / dev->bytes_per_sector;
-    sectors_per_block = req->fs_blocksz / dev->bytes_per_sector;
-    block = req->blockno * sectors_per_block;
-
-    block += part ? part->lba : 0;
-
-    //printk("ahci_strategy - sectors_to_read 0x%x, block 0x%x, lba 0x%x, block_no 0x%x, linear_addr 0x%x\n", sectors_to_read, block, part ? part->lba : 0, req->blockno, block * dev->bytes_per_sector);
-    //__asm__ __volatile__("xchg %%bx, %%bx"::);
-
-    // The page cache layer passes us virtual buffer addresses, but we need
-    // to convert these to physical memory addresses in order to pass them to
-    // the disk driver. We know how big a physical page is, and we can find
-    // out how many disk sectors fit in one page. We can then read a bunch of
-    // sectors at a time (a memory page worth of them), and continue doing this
-    // (in the for-loop below) until we have sectors that do not fill a memory
-    // page, which we read in the if-block after the loop.
-    int sectors_per_page = PAGE_SIZE / dev->bytes_per_sector;
-    int pages = sectors_to_read / sectors_per_page;
-    int i;
-    long (*func)(struct ata_dev_s *, size_t, int, uintptr_t);
-    uintptr_t virt = req->data;
-
-    if(!req->write)
+    if(dev->type != IDE_SATA)
     {
-        func = (dev->type == IDE_SATA) ? ahci_sata_read : ahci_satapi_read;
+        if(req->write)
+        {
+            return -EROFS;
+        }
+
+        // make sure we have the device capacity
+        if(dev->size == 0)
+        {
+            if(ahci_satapi_read_capacity(dev) != 0)
+            {
+                printk("ahci: failed to read SATAPI device capacity\n");
+                printk("ahci: assuming default sector size of 2048 bytes\n");
+            }
+        }
     }
-    else
+
+    // merged requests are transferred as one (see blk_queue.c)
+    for(datasz = 0, seg = req; seg; seg = seg->next)
     {
-        func = (dev->type == IDE_SATA) ? ahci_sata_write : ahci_satapi_write;
+        datasz += seg->datasz;
     }
 
-    for(i = 0; i < pages; i++, block += sectors_per_page, virt += PAGE_SIZE)
-    {
-        //printk("ahci_strategy: i %d/%d\n", i, pages);
-        uintptr_t phys = get_phys_addr(virt) + (virt - align_down(virt));
+    sectors = datasz / dev->bytes_per_sector;
+    sectors_per_block = req->fs_blocksz / dev->bytes_per_sector;
+    block = req->blockno * sectors_per_block;
 
-        if((res = func(dev, block, sectors_per_page, phys)) != 0)
-        {
-            break;
-        }
+    block += part ? part->lba : 0;
 
-        sectors_to_read -= sectors_per_page;
+    // The page cache layer passes us virtual buffer addresses. ahci_rw()
+    // maps these (for all the segments of a merged request) to a
+    // scatter/gather list of physical pages, and issues the whole request
+    // in as few commands as possible.
+    if(sectors == 0)
+    {
+        return 0;
     }
 
-    if(res == 0 && sectors_to_read)
+    if(ahci_rw(dev, block, req,
+               sectors * dev->bytes_per_sector, req->write) != 0)
     {
-        //printk("ahci_strategy: last page\n");
-        uintptr_t phys = get_phys_addr(virt) + (virt - align_down(virt));
-
-        res = func(dev, block, sectors_to_read, phys);
+        return -EIO;
     }
 
-    //printk("ahci_strategy: done\n");
-    return res ? -EIO : (long)(sectors_to_read * dev->bytes_per_sector);
+    return (long)(sectors * dev->bytes_per_sector);
 }
 
 
@@ -386,26 +401,273 @@ int find_cmdslot(HBA_PORT *port)
 }
 
 
-static inline int lock_and_find_cmdslot(struct ahci_dev_t *ahci, HBA_PORT *port, int port_index)
+/*
+ * Lock/unlock a port's command queue. The queue is used by the IRQ handler,
+ * so we spin with interrupts disabled instead of using a kernel mutex.
+ */
+static inline uintptr_t lock_port(struct ahci_port_t *ap)
+{
+    uintptr_t s = int_off();
+
+    while(!__sync_bool_compare_and_swap(&ap->holding_cpu, -1,
+                                        this_core->cpuid))
+    {
+        __asm__ __volatile__("pause":::"memory");
+    }
+
+    return s;
+}
+
+static inline void unlock_port(struct ahci_port_t *ap, uintptr_t s)
 {
-    volatile int slot;
+    __sync_bool_compare_and_swap(&ap->holding_cpu, this_core->cpuid, -1);
+    int_on(s);
+}
 
-    kernel_mutex_lock(&ahci->port_lock[port_index]);
-    
-    while((slot = find_cmdslot(port)) == -1)
+
+/*
+ * Wakeup conditions, checked by block_task2_unless() once we are on the
+ * port's wait queue, so a completion that comes in between checking the
+ * queue and going to sleep is not lost.
+ */
+struct ahci_wait_t
+{
+    struct ahci_port_t *ap;
+    uint32_t slots;
+};
+
+static int ahci_slots_free(void *arg)
+{
+    struct ahci_port_t *ap = (struct ahci_port_t *)arg;
+
+    return !!(ap->slot_mask & ~ap->busy);
+}
+
+static int ahci_slots_done(void *arg)
+{
+    struct ahci_wait_t *w = (struct ahci_wait_t *)arg;
+
+    return !(w->ap->issued & w->slots);
+}
+
+
+/*
+ * Claim up to 'want' free command slots, sleeping until at least one is
+ * free. Returns a bitmask of the claimed slots.
+ */
+static uint32_t claim_cmdslots(struct ahci_port_t *ap, int want)
+{
+    uint32_t free, claimed;
+    uintptr_t s;
+    int i;
+
+    while(1)
+    {
+        claimed = 0;
+        s = lock_port(ap);
+        free = ap->slot_mask & ~ap->busy;
+
+        for(i = 0; i < 32 && want && free; i++)
+        {
+            if(free & (1U << i))
+            {
+                free &= ~(1U << i);
+                claimed |= (1U << i);
+                want--;
+            }
+        }
+
+        ap->busy |= claimed;
+        unlock_port(ap, s);
+
+        if(claimed)
+        {
+            return claimed;
+        }
+
+        block_task2_unless(ap, AHCI_POLL_TICKS, ahci_slots_free, ap);
+    }
+}
+
+
+static inline int claim_cmdslot(struct ahci_port_t *ap)
+{
+    return __builtin_ctz(claim_cmdslots(ap, 1));
+}
+
+
+/*
+ * Release completed command slots and wake up tasks waiting for a slot.
+ */
+static void release_cmdslots(struct ahci_port_t *ap, uint32_t slots)
+{
+    uintptr_t s = lock_port(ap);
+
+    ap->busy &= ~slots;
+    ap->failed &= ~slots;
+    unlock_port(ap, s);
+    unblock_tasks(ap);
+}
+
+
+/*
+ * Restart the command engine after a fatal port error. Clearing ST makes
+ * the HBA clear PxCI and PxSACT, which drops all outstanding commands.
+ * Must be called with the port queue locked.
+ */
+static void ahci_port_recover(HBA_PORT *port)
+{
+    int spin = 0;
+
+    port->cmd &= ~HBA_PORT_CMD_ST;
+
+    while((port->cmd & HBA_PORT_CMD_CR) && spin < 1000000)
+    {
+        spin++;
+    }
+
+    port->serr = port->serr;
+    port->is = port->is;
+    port->cmd |= HBA_PORT_CMD_ST;
+}
+
+
+/*
+ * Reap completed commands on the given port. A command is complete when
+ * its bit is clear in both PxCI and PxSACT (the latter is only used for
+ * NCQ commands). On error, every command still outstanding is failed and
+ * the port is restarted. This is called from the IRQ handler, as well as
+ * by waiting tasks in case an IRQ was missed.
+ */
+static void ahci_port_complete(struct ahci_dev_t *ahci, int port_index)
+{
+    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
+    HBA_PORT *port = &hba->ports[port_index];
+    struct ahci_port_t *ap = &ahci->portq[port_index];
+    uint32_t pisr, active, done;
+    uintptr_t s;
+
+    s = lock_port(ap);
+    pisr = port->is;
+    port->is = pisr;
+    active = port->ci | port->sact;
+    done = ap->issued & ~active;
+
+    if(pisr & HBA_PORT_IS_ERR)
+    {
+        printk("ahci: port %d error (is 0x%x, tfd 0x%x, serr 0x%x)\n",
+               port_index, pisr, port->tfd, port->serr);
+        ap->failed |= (ap->issued & active);
+        done = ap->issued;
+        ahci_port_recover(port);
+    }
+
+    ap->issued &= ~done;
+    unlock_port(ap, s);
+
+    if(done)
     {
-        kernel_mutex_unlock(&ahci->port_lock[port_index]);
-        block_task2((void *)port, 5000);
-        kernel_mutex_lock(&ahci->port_lock[port_index]);
+        unblock_tasks(ap);
     }
+}
+
 
-    return slot;
+/*
+ * Fail all outstanding commands on a port that stopped responding.
+ */
+static void ahci_port_abort(struct ahci_dev_t *ahci, int port_index)
+{
+    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
+    struct ahci_port_t *ap = &ahci->portq[port_index];
+    uintptr_t s;
+
+    printk("ahci: port %d command timeout\n", port_index);
+
+    s = lock_port(ap);
+    ap->failed |= ap->issued;
+    ap->issued = 0;
+    ahci_port_recover(&hba->ports[port_index]);
+    unlock_port(ap, s);
+    unblock_tasks(ap);
+}
+
+
+/*
+ * Issue the commands in the given (claimed and set up) slots, and sleep
+ * until the IRQ handler has completed all of them. The slots are released
+ * before we return.
+ */
+static long ahci_exec_cmdslots(struct ahci_dev_t *ahci, int port_index,
+                               uint32_t slots)
+{
+    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
+    HBA_PORT *port = &hba->ports[port_index];
+    struct ahci_port_t *ap = &ahci->portq[port_index];
+    struct ahci_wait_t w = { ap, slots };
+    unsigned long long start = ticks;
+    int spin = 0;       // Spin lock timeout counter
+    uintptr_t s;
+    long res;
+
+    s = lock_port(ap);
+
+    // if the port is idle, make sure the device is ready
+    if(!ap->issued)
+    {
+        while((port->tfd & (ATA_SR_BUSY | ATA_SR_DRQ)) && spin < 1000000)
+        {
+            spin++;
+        }
+
+        if(spin == 1000000)
+        {
+            unlock_port(ap, s);
+            release_cmdslots(ap, slots);
+            printk("ahci: port hung\n");
+            return -EIO;
+        }
+    }
+
+    // issue the commands
+    ap->issued |= slots;
+
+    if(ap->ncq)
+    {
+        port->sact = slots;
+    }
+
+    port->ci = slots;
+    unlock_port(ap, s);
+
+    // and wait for them to complete
+    while(ap->issued & slots)
+    {
+        block_task2_unless(ap, AHCI_POLL_TICKS, ahci_slots_done, &w);
+
+        if(!(ap->issued & slots))
+        {
+            break;
+        }
+
+        ahci_port_complete(ahci, port_index);
+
+        if((ap->issued & slots) && ticks - start > AHCI_CMD_TIMEOUT)
+        {
+            ahci_port_abort(ahci, port_index);
+        }
+    }
+
+    res = (ap->failed & slots) ? -EIO : 0;
+    release_cmdslots(ap, slots);
+
+    return res;
 }
 
 
 static inline void setup_fis(FIS_REG_H2D *fis, uint8_t command,
                                                size_t lba, int sectors)
 {
+    A_memset(fis, 0, sizeof(FIS_REG_H2D));
     fis->fis_type = FIS_TYPE_REG_H2D;
     fis->c = 1;
     fis->command = command;
@@ -421,6 +683,50 @@ static inline void setup_fis(FIS_REG_H2D *fis, uint8_t command,
 }
 
 
+/*
+ * Set up a SATA read/write command. NCQ commands pass the sector count in
+ * the feature register and the command slot (the NCQ tag) in the count
+ * register.
+ */
+static inline void setup_rw_fis(struct ahci_port_t *ap, FIS_REG_H2D *fis,
+                                int write, size_t lba, int sectors, int slot)
+{
+    if(ap->ncq)
+    {
+        setup_fis(fis, write ? ATA_CMD_WRITE_FPDMA_QUEUED :
+                               ATA_CMD_READ_FPDMA_QUEUED, lba, 0);
+        fis->featurel = (sectors & 0xff);
+        fis->featureh = (sectors >> 8) & 0xff;
+        fis->countl = (slot << 3);
+    }
+    else
+    {
+        setup_fis(fis, write ? ATA_CMD_WRITE_DMA_EXT :
+                               ATA_CMD_READ_DMA_EXT, lba, sectors);
+    }
+}
+
+
+/*
+ * Set up a SATAPI READ (12) packet command.
+ */
+static inline void setup_atapi_read(HBA_CMD_TBL *table, size_t lba,
+                                                         int sectors)
+{
+    setup_fis((FIS_REG_H2D *)table->cfis, ATA_CMD_PACKET, lba, sectors);
+    A_memset(table->acmd, 0, sizeof(table->acmd));
+    table->acmd[0] = ATAPI_CMD_READ;
+    table->acmd[2] = (lba >> 24) & 0xFF;
+    table->acmd[3] = (lba >> 16) & 0xFF;
+    table->acmd[4] = (lba >>  8) & 0xFF;
+    table->acmd[5] = (lba >>  0) & 0xFF;
+    table->acmd[6] = (sectors >> 24) & 0xFF;
+    table->acmd[7] = (sectors >> 16) & 0xFF;
+    table->acmd[8] = (sectors >>  8) & 0xFF;
+    table->acmd[9] = (sectors >>  0) & 0xFF;
+}
+
+
 static inline void setup_cmd_hdr(HBA_CMD_HEADER *cmd_hdr, int write, int atapi, uint16_t prdtl)
 {
     // Command FIS size
@@ -434,6 +740,9 @@ static inline void setup_cmd_hdr(HBA_CMD_HEADER *cmd_hdr, int write, int atapi,
 
     // ATAPI
     cmd_hdr->a = atapi ? 1 : 0;
+
+    // Bytes transferred
+    cmd_hdr->prdbc = 0;
 }
 
 
@@ -462,89 +771,239 @@ static inline void setup_prdt(HBA_CMD_HEADER *cmd_hdr, HBA_CMD_TBL *table,
 }
 
 
-long wait_for_port(HBA_PORT *port, int slot, volatile struct kernel_mutex_t *mutex)
+/*
+ * Cursor for walking the buffers of the segments of a (possibly merged)
+ * disk request.
+ */
+struct ahci_buf_t
 {
-    int spin = 0;       // Spin lock timeout counter
+    struct disk_req_t *seg;
+    size_t off;
+};
 
-    while((port->tfd & (ATA_SR_BUSY  | ATA_SR_DRQ)) && spin < 1000000)
-    {
-        spin++;
-    }
-    
-    if(spin == 1000000)
+static void ahci_buf_advance(struct ahci_buf_t *buf, size_t bytes)
+{
+    size_t n;
+
+    while(bytes && buf->seg)
     {
-        kernel_mutex_unlock(mutex);
-        printk("ahci: port hung\n");
-        return -EIO;
+        if((n = buf->seg->datasz - buf->off) > bytes)
+        {
+            buf->off += bytes;
+            return;
+        }
+
+        bytes -= n;
+        buf->seg = buf->seg->next;
+        buf->off = 0;
     }
-    
-    // issue command
-    port->ci = (1 << slot);
+}
 
-    kernel_mutex_unlock(mutex);
-    
-    while(1)
+
+/*
+ * Set up the PRDT to cover the physical pages backing the buffers at the
+ * given cursor, merging physically contiguous pages into one entry. If the
+ * buffers do not fit in the PRDT, the part that fits is rounded down to
+ * a whole number of sectors. The cursor is advanced past the bytes covered,
+ * and the number of bytes is returned.
+ */
+static size_t setup_prdt_virt(HBA_CMD_HEADER *cmd_hdr, HBA_CMD_TBL *table,
+                              struct ahci_buf_t *buf, size_t len,
+                              size_t sectorsz)
+{
+    HBA_PRDT_ENTRY *ent = table->prdt_entry;
+    struct disk_req_t *seg = buf->seg;
+    uintptr_t virt, phys, next_phys = 0;
+    size_t off = buf->off;
+    size_t bytes = 0, chunk, excess;
+    int n = 0;
+
+    while(bytes < len && seg)
     {
-        if((port->ci & (1 << slot)) == 0)
+        if(off >= seg->datasz)
         {
-            //printk("slot done %d\n", slot);
-            break;
+            seg = seg->next;
+            off = 0;
+            continue;
         }
-        
-        if(port->is & HBA_PORT_IS_TFES)    // task file error
+
+        virt = seg->data + off;
+        chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+
+        if(chunk > seg->datasz - off)
         {
-            printk("ahci: disk read error\n");
-            return -EIO;
+            chunk = seg->datasz - off;
+        }
+
+        if(chunk > len - bytes)
+        {
+            chunk = len - bytes;
         }
+
+        phys = get_phys_addr(virt) + (virt - align_down(virt));
+
+        if(n && phys == next_phys &&
+           ent[n - 1].dbc + 1 + chunk <= PRDT_MAX_BYTES)
+        {
+            ent[n - 1].dbc += chunk;
+        }
+        else
+        {
+            if(n == AHCI_PRDT_ENTRIES)
+            {
+                break;
+            }
+
+            ent[n].dba = (phys & 0xffffffff);
+            ent[n].dbau = (phys >> 32);
+            ent[n].rsv0 = 0;
+            ent[n].dbc = chunk - 1;
+            ent[n].i = 0;
+            n++;
+        }
+
+        next_phys = phys + chunk;
+        off += chunk;
+        bytes += chunk;
     }
-    
-    if(port->is & HBA_PORT_IS_TFES)    // task file error
+
+    // don't split a sector between two commands
+    if(bytes < len && (excess = bytes % sectorsz))
     {
-        printk("ahci: disk read error\n");
-        return -EIO;
+        bytes -= excess;
+
+        while(excess)
+        {
+            chunk = ent[n - 1].dbc + 1;
+
+            if(chunk <= excess)
+            {
+                excess -= chunk;
+                n--;
+            }
+            else
+            {
+                ent[n - 1].dbc -= excess;
+                excess = 0;
+            }
+        }
     }
 
-    // wakeup any sleepers
-    unblock_tasks((void *)port);
-    
-    return 0;
+    cmd_hdr->prdtl = (uint16_t)n;
+    ahci_buf_advance(buf, bytes);
+
+    return bytes;
 }
 
 
 /*
- * Read sectors from a SATA disk
+ * Read or write len bytes (whole sectors) using the buffers of the request
+ * and its merged segments. The transfer is split into as few commands as
+ * the PRDT size allows, and all of them are issued together (using as many
+ * free command slots as we can get). We sleep until the IRQ handler tells
+ * us the commands are done.
+ */
+static long ahci_rw(struct ata_dev_s *dev, size_t lba,
+                    struct disk_req_t *req, size_t len, int write)
+{
+    struct ahci_dev_t *ahci = dev->ahci;
+    int port_index = dev->port_index;
+    struct ahci_port_t *ap = &ahci->portq[port_index];
+    HBA_CMD_HEADER *cmd_list = (HBA_CMD_HEADER *)ahci->port_clb[port_index];
+    HBA_CMD_TBL *table;
+    size_t bps = dev->bytes_per_sector;
+    size_t bytes, sectors;
+    uint32_t slots, issue;
+    int slot, atapi = (dev->type != IDE_SATA);
+    struct ahci_buf_t buf = { req, 0 };
+    long res = 0;
+
+    while(len && res == 0)
+    {
+        slots = claim_cmdslots(ap, 
+                        (len / (AHCI_PRDT_ENTRIES * PAGE_SIZE)) + 1);
+        issue = 0;
+
+        for(slot = 0; slot < 32 && len; slot++)
+        {
+            if(!(slots & (1U << slot)))
+            {
+                continue;
+            }
+
+            table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] +
+                                        (AHCI_CMD_TBL_SIZE * slot));
+            setup_cmd_hdr(&cmd_list[slot], write, atapi, 0);
+            bytes = setup_prdt_virt(&cmd_list[slot], table, &buf, len, bps);
+            sectors = bytes / bps;
+
+            // the request buffers are shorter than we were told
+            if(sectors == 0)
+            {
+                len = 0;
+                res = -EIO;
+                break;
+            }
+
+            if(atapi)
+            {
+                setup_atapi_read(table, lba, sectors);
+            }
+            else
+            {
+                setup_rw_fis(ap, (FIS_REG_H2D *)table->cfis,
+                             write, lba, sectors, slot);
+            }
+
+            issue |= (1U << slot);
+            lba += sectors;
+            len -= bytes;
+        }
+
+        // give back the slots we did not need
+        if(slots & ~issue)
+        {
+            release_cmdslots(ap, slots & ~issue);
+        }
+
+        if(issue)
+        {
+            res = ahci_exec_cmdslots(ahci, port_index, issue);
+        }
+    }
+
+    return res;
+}
+
+
+/*
+ * Read sectors from a SATA disk into a physically contiguous buffer.
  */
 long ahci_sata_read(struct ata_dev_s *dev, size_t lba, int __sectors,
                                            uintptr_t phys_buf)
 {
-    //int spin = 0;       // Spin lock timeout counter
     int slot;
     int sectors = __sectors;
     struct ahci_dev_t *ahci = dev->ahci;
     int port_index = dev->port_index;
-    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
-    HBA_PORT *port = &hba->ports[port_index];
+    struct ahci_port_t *ap = &ahci->portq[port_index];
     HBA_CMD_HEADER *cmd_hdr = (HBA_CMD_HEADER *)ahci->port_clb[port_index];
     HBA_CMD_TBL *table;
-    //FIS_REG_H2D *fis;
 
-    // Clear pending interrupt bits
-    ////port->is = (uint32_t)-1;
-    
-    slot = lock_and_find_cmdslot(ahci, port, port_index);
+    slot = claim_cmdslot(ap);
     cmd_hdr += slot;
     setup_cmd_hdr(cmd_hdr, 0, 0, (uint16_t)((sectors - 1) >> 4) + 1);
     
     // Set up the PRDT
     // for each entry (except the last), we can read upto 8kb (or 16 sectors)
-    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + (256 * slot));
+    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + 
+                                (AHCI_CMD_TBL_SIZE * slot));
     setup_prdt(cmd_hdr, table, phys_buf, sectors, 512);
 
     // set up the command
-    setup_fis((FIS_REG_H2D *)table->cfis, ATA_CMD_READ_DMA_EXT,
-                                          lba, __sectors);
+    setup_rw_fis(ap, (FIS_REG_H2D *)table->cfis, 0, lba, __sectors, slot);
     
-    return wait_for_port(port, slot, &ahci->port_lock[port_index]);
+    return ahci_exec_cmdslots(ahci, port_index, (1U << slot));
 }
 
 
@@ -560,20 +1019,16 @@ long achi_satapi_read_packet(struct ata_dev_s *dev,
     int slot;
     struct ahci_dev_t *ahci = dev->ahci;
     int port_index = dev->port_index;
-    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
-    HBA_PORT *port = &hba->ports[port_index];
     HBA_CMD_HEADER *cmd_hdr = (HBA_CMD_HEADER *)ahci->port_clb[port_index];
     HBA_CMD_TBL *table;
 
-    // Clear pending interrupt bits
-    //port->is = (uint32_t)-1;
-
-    slot = lock_and_find_cmdslot(ahci, port, port_index);
+    slot = claim_cmdslot(&ahci->portq[port_index]);
     cmd_hdr += slot;
     setup_cmd_hdr(cmd_hdr, 0, 1, 
                     sectors ? ((uint16_t)((sectors - 1) >> 2) + 1) : (uint16_t)1);
 
-    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + (256 * slot));
+    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + 
+                                (AHCI_CMD_TBL_SIZE * slot));
 
     // Set up the PRDT
     if(sectors == 0)
@@ -598,9 +1053,7 @@ long achi_satapi_read_packet(struct ata_dev_s *dev,
         table->acmd[i] = packet[i];
     }
 
-    i = wait_for_port(port, slot, &ahci->port_lock[port_index]);
-
-    return i;
+    return ahci_exec_cmdslots(ahci, port_index, (1U << slot));
 }
 
 
@@ -740,130 +1193,6 @@ int ahci_satapi_read_capacity(struct ata_dev_s *dev)
 }
 
 
-/*
- * Read sectors from a SATAPI disk
- */
-long ahci_satapi_read(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                             uintptr_t phys_buf)
-{
-    unsigned char packet[12];
-
-    // make sure we have the device capacity
-    if(dev->size == 0)
-    {
-        if(ahci_satapi_read_capacity(dev) != 0)
-        {
-            printk("ahci: failed to read SATAPI device capacity\n");
-            printk("ahci: assuming default sector size of 2048 bytes\n");
-        }
-    }
-
-    // set up the command
-    packet[0 ] = ATAPI_CMD_READ;
-    packet[1 ] = 0;
-    packet[2 ] = (lba >> 24) & 0xFF;
-    packet[3 ] = (lba >> 16) & 0xFF;
-    packet[4 ] = (lba >>  8) & 0xFF;
-    packet[5 ] = (lba >>  0) & 0xFF;
-    packet[6 ] = 0;
-    packet[7 ] = 0;
-    packet[8 ] = 0;
-    packet[9 ] = __sectors;
-    packet[10] = 0;
-    packet[11] = 0;
-
-    return achi_satapi_read_packet(dev, phys_buf, 0, lba, __sectors, packet);
-
-#if 0
-    //int spin = 0;       // Spin lock timeout counter
-    int slot, i;
-    int sectors = __sectors;
-    struct ahci_dev_t *ahci = dev->ahci;
-    int port_index = dev->port_index;
-    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
-    HBA_PORT *port = &hba->ports[port_index];
-    HBA_CMD_HEADER *cmd_hdr = (HBA_CMD_HEADER *)ahci->port_clb[port_index];
-    HBA_CMD_TBL *table;
-
-    // Clear pending interrupt bits
-    //port->is = (uint32_t)-1;
-
-    // make sure we have the device capacity
-    if(dev->size == 0)
-    {
-        if(ahci_satapi_read_capacity(dev) != 0)
-        {
-            printk("ahci: failed to read SATAPI device capacity\n");
-        }
-    }
-    
-    slot = lock_and_find_cmdslot(port, port_index);
-    cmd_hdr += slot;
-    setup_cmd_hdr(cmd_hdr, 0, 1, (uint16_t)((sectors - 1) >> 2) + 1);
-    
-    // Set up the PRDT
-    // for each entry (except the last), we can read upto 8kb (or 16 sectors)
-    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + (256 * slot));
-    setup_prdt(cmd_hdr, table, phys_buf, sectors, 2048);
-
-    setup_fis((FIS_REG_H2D *)table->cfis, ATA_CMD_PACKET, lba, __sectors);
-
-    // set up the command
-    table->acmd[0 ] = ATAPI_CMD_READ;
-    table->acmd[1 ] = 0;
-    table->acmd[2 ] = (lba >> 24) & 0xFF;
-    table->acmd[3 ] = (lba >> 16) & 0xFF;
-    table->acmd[4 ] = (lba >>  8) & 0xFF;
-    table->acmd[5 ] = (lba >>  0) & 0xFF;
-    table->acmd[6 ] = 0;
-    table->acmd[7 ] = 0;
-    table->acmd[8 ] = 0;
-    table->acmd[9 ] = __sectors;
-    table->acmd[10] = 0;
-    table->acmd[11] = 0;
-    
-    return wait_for_port(port, slot, &ahci->port_lock[port_index]);
-#endif
-}
-
-
-/*
- * Write sectors to a SATA disk
- */
-long ahci_sata_write(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                            uintptr_t phys_buf)
-{
-    //int spin = 0;       // Spin lock timeout counter
-    int slot;
-    int sectors = __sectors;
-    struct ahci_dev_t *ahci = dev->ahci;
-    int port_index = dev->port_index;
-    HBA_MEM *hba = (HBA_MEM *)ahci->iobase;
-    HBA_PORT *port = &hba->ports[port_index];
-    HBA_CMD_HEADER *cmd_hdr = (HBA_CMD_HEADER *)ahci->port_clb[port_index];
-    HBA_CMD_TBL *table;
-    //FIS_REG_H2D *fis;
-
-    // Clear pending interrupt bits
-    ////port->is = (uint32_t)-1;
-
-    slot = lock_and_find_cmdslot(ahci, port, port_index);
-    cmd_hdr += slot;
-    setup_cmd_hdr(cmd_hdr, 1, 0, (uint16_t)((sectors - 1) >> 4) + 1);
-
-    // Set up the PRDT
-    // for each entry (except the last), we can read upto 8kb (or 16 sectors)
-    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + (256 * slot));
-    setup_prdt(cmd_hdr, table, phys_buf, sectors, 512);
-
-    // set up the command
-    setup_fis((FIS_REG_H2D *)table->cfis, ATA_CMD_WRITE_DMA_EXT,
-                                          lba, __sectors);
-
-    return wait_for_port(port, slot, &ahci->port_lock[port_index]);
-}
-
-
 long achi_satapi_write_packet_virt(struct ata_dev_s *dev,
                                    uintptr_t virt_buf, size_t bufsz,
                                    size_t lba, int sectors, unsigned char *packet)
@@ -879,21 +1208,6 @@ long achi_satapi_write_packet_virt(struct ata_dev_s *dev,
 }
 
 
-/*
- * Write sectors to a SATAPI disk
- */
-long ahci_satapi_write(struct ata_dev_s *dev, size_t lba, int __sectors,
-                                              uintptr_t phys_buf)
-{
-    UNUSED(dev);
-    UNUSED(__sectors);
-    UNUSED(lba);
-    UNUSED(phys_buf);
-    
-    return -EROFS;
-}
-
-
 void ahci_register_dev(struct ata_dev_s *dev, struct parttab_s *part, int n)
 {
     /*
@@ -1193,7 +1507,8 @@ int ahci_sata_identify(struct ahci_dev_t *ahci, int port_index,
     cmd_hdr->prdtl = (uint16_t)1;
     
     // Set up the PRDT
-    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + (256 * slot));
+    table = (HBA_CMD_TBL *)(ahci->port_ctba[port_index] + 
+                                (AHCI_CMD_TBL_SIZE * slot));
     table->prdt_entry[0].dba = (phys_buf & 0xffffffff);
     table->prdt_entry[0].dbau = (phys_buf >> 32);
     table->prdt_entry[0].dbc = 511;
@@ -1264,10 +1579,10 @@ void ahci_sata_init(struct ahci_dev_t *ahci, int port_index, int type)
 #define PAGE_FLAGS      (PTE_FLAGS_PW | I86_PTE_NOT_CACHEABLE)
 
     /*
-     * We allocate 2 pages for the command table
+     * We allocate 32 command tables, one per command slot
      * See below for details on the command table size calculation
      */
-    ctb_virt = vmmngr_alloc_and_map(PAGE_SIZE * 2, 1, PAGE_FLAGS,
+    ctb_virt = vmmngr_alloc_and_map(AHCI_CMD_TBL_SIZE * 32, 1, PAGE_FLAGS,
                                     &ctb_phys, REGION_DMA);
 
     if(!ctb_virt)
@@ -1286,7 +1601,7 @@ void ahci_sata_init(struct ahci_dev_t *ahci, int port_index, int type)
     }
 
     A_memset((void *)clb_virt, 0, PAGE_SIZE);
-    A_memset((void *)ctb_virt, 0, PAGE_SIZE * 2);
+    A_memset((void *)ctb_virt, 0, AHCI_CMD_TBL_SIZE * 32);
 
 #undef PAGE_FLAGS
     
@@ -1310,23 +1625,30 @@ void ahci_sata_init(struct ahci_dev_t *ahci, int port_index, int type)
     //fis_dev = (HBA_FIS *)(clb_virt + 1024);
 
     /*
-     * 256 bytes per command table
-     * 32 entries per command table
-     * Command table size = 256 * 32 = 8K per port
+     * 0x80 bytes for the command FIS and ATAPI command, followed by
+     * AHCI_PRDT_ENTRIES prdt entries of 16 bytes each
+     * Command table size = AHCI_CMD_TBL_SIZE * 32 = 32K per port
      */
     ahci->port_ctba[port_index] = ctb_virt;
 
     for(i = 0; i < 32; i++)
     {
-        // 8 prdt entries per command table
-        cmd_list[i].prdtl = 8;
+        cmd_list[i].prdtl = AHCI_PRDT_ENTRIES;
         cmd_list[i].ctba = (ctb_phys & 0xffffffff);
         cmd_list[i].ctbau = (ctb_phys >> 32);
         cmd_list[i].p = 1;
         cmd_list[i].cfl = 0x10;
-        ctb_phys += 256;
+        ctb_phys += AHCI_CMD_TBL_SIZE;
     }
 
+    /*
+     * Use all the HBA's command slots until we know whether the device
+     * supports NCQ (see below).
+     */
+    ahci->portq[port_index].slot_mask = (CMD_SLOTS(hba) == 32) ? 0xffffffff :
+                                            ((1U << CMD_SLOTS(hba)) - 1);
+    ahci->portq[port_index].ncq = 0;
+
     port->serr = 0xffffffff;
     port->cmd &= ~HBA_PORT_CMD_ICC;
     // power-up, spin-up, activate link
@@ -1421,6 +1743,22 @@ void ahci_sata_init(struct ahci_dev_t *ahci, int port_index, int type)
         }
 
         dev->size *= dev->bytes_per_sector;
+
+        // use native command queueing if both the HBA and the disk support
+        // it, in which case we cannot use more slots than the disk's
+        // queue depth, as the slot number is used as the NCQ tag
+        if((hba->cap & HBA_CAP_SNCQ) &&
+           (U16(ide_buf, ATA_IDENT_SATA_CAP) & SATA_CAP_NCQ))
+        {
+            l = (U16(ide_buf, ATA_IDENT_QUEUE_DEPTH) & 0x1f) + 1;
+
+            if(l < CMD_SLOTS(hba))
+            {
+                ahci->portq[port_index].slot_mask = (1U << l) - 1;
+            }
+
+            ahci->portq[port_index].ncq = 1;
+        }
     }
     else
     {
@@ -1444,6 +1782,12 @@ void ahci_sata_init(struct ahci_dev_t *ahci, int port_index, int type)
     {
         printk("    Capacity = %luMB\n", dev->size / 1024 / 1024);
 
+        if(ahci->portq[port_index].ncq)
+        {
+            printk("    NCQ enabled, queue depth %d\n",
+                   __builtin_popcount(ahci->portq[port_index].slot_mask));
+        }
+
         // add the new SATA device and read the MBR
         ahci_register_dev(dev, NULL, 0);
         ahci_read_mbr(dev, tmp_phys, tmp_virt);
@@ -1522,6 +1866,11 @@ void ahci_init(struct pci_dev_t *pci)
     }
     
     A_memset(ahci, 0, sizeof(struct ahci_dev_t));
+
+    for(i = 0; i < 32; i++)
+    {
+        ahci->portq[i].holding_cpu = -1;
+    }
     
     printk("ahci: found an AHCI device controller\n");
 
@@ -1688,16 +2037,15 @@ int ahci_intr(struct regs *r, int unit)
         return 0;
     }
 
+    // reap completed commands and wake up their waiters
     for(i = 0; i < 32; i++)
     {
-        if((hba->is & hba->pi & (1 << i)))
+        if((isr & hba->pi & (1U << i)))
         {
-            uint32_t pisr = hba->ports[i].is;
-            
-            KDEBUG("ahci: IRQ from port %d: status 0x%x\n", i, pisr);
+            KDEBUG("ahci: IRQ from port %d: status 0x%x\n", i, 
+                   hba->ports[i].is);
             
-            hba->ports[i].is = pisr;
-            //break;
+            ahci_port_complete(ahci, i);
         }
     }
     
@@ -35,13 +35,24 @@
 #include <kernel/dev.h>
 #include <kernel/task.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
 #include <fs/dentry.h>
 
+static struct kmem_cache_t *dentry_cache = NULL;
+
 
 void init_dentries(void)
 {
     struct bdev_ops_t *dev, *ldev = &bdev_tab[NR_DEV];
     int sz = NR_DEV * sizeof(struct dentry_list_t);
+
+    if(!(dentry_cache = kmem_cache_create("dentry",
+                                          sizeof(struct dentry_t), 0, NULL)))
+    {
+        kpanic("Failed to create dentry cache\n");
+    }
+
+    init_namecache();
     
     for(dev = bdev_tab; dev < ldev; dev++)
     {
@@ -80,7 +91,7 @@ void init_dentries(void)
 
 struct dentry_t *alloc_dentry(struct fs_node_t *node, char *path)
 {
-    struct dentry_t *ent = (struct dentry_t *)kmalloc(sizeof(struct dentry_t));
+    struct dentry_t *ent = (struct dentry_t *)kmem_cache_alloc(dentry_cache);
     
     if(ent)
     {
@@ -100,7 +111,7 @@ struct dentry_t *alloc_dentry(struct fs_node_t *node, char *path)
 void free_dentry(struct dentry_t *ent)
 {
     kfree(ent->path);
-    kfree(ent);
+    kmem_cache_free(dentry_cache, ent);
 }
 
 
@@ -413,6 +424,8 @@ void invalidate_dev_dentries(dev_t dev)
     struct dentry_list_t *list;
     //register struct task_t *ct = get_cur_task();
     
+    invalidate_dev_names(dev);
+
     maj = MAJOR(dev);
     min = MINOR(dev);
     
@@ -0,0 +1,545 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: namecache.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file namecache.c
+ *
+ *  The name cache maps (parent directory, filename) pairs to inode numbers,
+ *  so that path walking does not need to call the filesystem's finddir
+ *  function for every path component. Failed lookups are also cached (as
+ *  negative entries), which speeds up things like searching $PATH.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <kernel/vfs.h>
+#include <kernel/dev.h>
+#include <kernel/task.h>
+#include <mm/kheap.h>
+#include <mm/slab.h>
+#include <fs/dentry.h>
+
+/*
+ * Entries are hashed by (dev, parent inode, name). Each bucket has its own
+ * lock, which is taken before the LRU lock. The shrinker walks the LRU list
+ * while holding the LRU lock, so it only uses trylock on buckets.
+ *
+ * Each bucket has a sequence number that is bumped whenever a name in the
+ * bucket is added or removed from a directory. A lookup that misses the
+ * cache records the sequence number before calling the filesystem, and the
+ * result is only cached if the number is unchanged, so we never cache a
+ * stale result when racing with a create or an unlink.
+ *
+ * Cache hits only mark the entry as referenced, instead of moving it on the
+ * LRU list. The shrinker gives referenced entries a second chance.
+ */
+
+// names longer than this are not cached
+#define NAMECACHE_NAMELEN       40
+
+struct name_bucket_t;
+
+struct name_entry_t
+{
+    dev_t dev;                  /* device id */
+    ino_t dir;                  /* parent directory's inode number */
+    ino_t ino;                  /* file's inode number, 0 if negative */
+    unsigned long hash;
+    int referenced;
+    unsigned long long last_accessed;
+    struct name_bucket_t *bucket;
+    struct name_entry_t *hnext, **hpprev;
+    struct name_entry_t *lru_next, *lru_prev;
+    char name[NAMECACHE_NAMELEN];
+};
+
+struct name_bucket_t
+{
+    struct name_entry_t *head;
+    volatile unsigned int seq;
+    volatile struct kernel_mutex_t lock;
+};
+
+static struct name_bucket_t name_hash[NR_NAMECACHE_HASH];
+
+// all entries, most recently added first
+static struct name_entry_t *name_lru_head = NULL;
+static struct name_entry_t *name_lru_tail = NULL;
+static volatile struct kernel_mutex_t name_lru_lock = { 0, };
+
+volatile unsigned long nr_names = 0;
+volatile unsigned long nr_negative_names = 0;
+
+static struct kmem_cache_t *name_cache = NULL;
+
+
+void init_namecache(void)
+{
+    if(!(name_cache = kmem_cache_create("namecache",
+                                        sizeof(struct name_entry_t), 0, NULL)))
+    {
+        kpanic("Failed to create name cache\n");
+    }
+}
+
+
+STATIC_INLINE unsigned long name_hashfn(dev_t dev, ino_t dir, char *name,
+                                        size_t *len)
+{
+    unsigned long h = 2166136261UL;
+    char *p;
+
+    for(p = name; *p; p++)
+    {
+        h ^= (unsigned char)*p;
+        h *= 16777619UL;
+    }
+
+    *len = p - name;
+    h ^= ((unsigned long)dev * 0x9e3779b1UL) ^
+         ((unsigned long)dir * 0x45d9f3bUL);
+
+    return h ^ (h >> 16);
+}
+
+
+/*
+ * We don't cache '.' and '..' (the filesystem knows where they point to,
+ * and '..' changes when a directory is moved), or very long names.
+ */
+STATIC_INLINE int name_is_cacheable(struct fs_node_t *dir, char *name,
+                                    size_t len)
+{
+    if(!dir->dev || !dir->inode || len == 0 || len >= NAMECACHE_NAMELEN)
+    {
+        return 0;
+    }
+
+    if(name[0] == '.' && (name[1] == '\0' ||
+                          (name[1] == '.' && name[2] == '\0')))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Check whether we can cache names on the directory's filesystem. This is
+ * only called when adding entries, lookups on these filesystems simply
+ * never hit the cache.
+ */
+static int fs_is_cacheable(struct fs_node_t *dir)
+{
+    struct mount_info_t *dinfo;
+
+    if(!(dinfo = node_mount_info(dir)) || !dinfo->fs)
+    {
+        return 0;
+    }
+
+    return !(dinfo->fs->flags & (FSINFO_FLAG_NOCACHE | FSINFO_FLAG_NODCACHE));
+}
+
+
+/*
+ * Find an entry. The bucket must be locked.
+ */
+static struct name_entry_t *name_find(struct name_bucket_t *bucket,
+                                      dev_t dev, ino_t dir, char *name,
+                                      unsigned long hash)
+{
+    struct name_entry_t *ent;
+
+    for(ent = bucket->head; ent != NULL; ent = ent->hnext)
+    {
+        if(ent->hash == hash && ent->dir == dir && ent->dev == dev &&
+           strcmp(ent->name, name) == 0)
+        {
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+
+STATIC_INLINE void name_lru_unlink(struct name_entry_t *ent)
+{
+    if(ent->lru_prev)
+    {
+        ent->lru_prev->lru_next = ent->lru_next;
+    }
+    else
+    {
+        name_lru_head = ent->lru_next;
+    }
+
+    if(ent->lru_next)
+    {
+        ent->lru_next->lru_prev = ent->lru_prev;
+    }
+    else
+    {
+        name_lru_tail = ent->lru_prev;
+    }
+}
+
+
+STATIC_INLINE void name_lru_link(struct name_entry_t *ent)
+{
+    ent->lru_prev = NULL;
+
+    if((ent->lru_next = name_lru_head))
+    {
+        name_lru_head->lru_prev = ent;
+    }
+    else
+    {
+        name_lru_tail = ent;
+    }
+
+    name_lru_head = ent;
+}
+
+
+/*
+ * Remove an entry and free it. Both the bucket and the LRU list must be
+ * locked.
+ */
+static void name_free(struct name_entry_t *ent)
+{
+    if((*ent->hpprev = ent->hnext))
+    {
+        ent->hnext->hpprev = ent->hpprev;
+    }
+
+    name_lru_unlink(ent);
+
+    if(!ent->ino)
+    {
+        __sync_fetch_and_sub(&nr_negative_names, 1);
+    }
+
+    __sync_fetch_and_sub(&nr_names, 1);
+    kmem_cache_free(name_cache, ent);
+}
+
+
+/*
+ * Add an entry, or update it if it exists. The bucket must be locked.
+ */
+static void name_insert(struct name_bucket_t *bucket, struct fs_node_t *dir,
+                        char *name, size_t len, unsigned long hash, ino_t ino)
+{
+    struct name_entry_t *ent;
+
+    if((ent = name_find(bucket, dir->dev, dir->inode, name, hash)))
+    {
+        if(!ent->ino && ino)
+        {
+            __sync_fetch_and_sub(&nr_negative_names, 1);
+        }
+        else if(ent->ino && !ino)
+        {
+            __sync_fetch_and_add(&nr_negative_names, 1);
+        }
+
+        ent->ino = ino;
+        ent->last_accessed = ticks;
+        return;
+    }
+
+    if(!(ent = (struct name_entry_t *)kmem_cache_alloc(name_cache)))
+    {
+        return;
+    }
+
+    A_memset(ent, 0, sizeof(struct name_entry_t));
+    A_memcpy(ent->name, name, len + 1);
+    ent->dev = dir->dev;
+    ent->dir = dir->inode;
+    ent->ino = ino;
+    ent->hash = hash;
+    ent->last_accessed = ticks;
+    ent->bucket = bucket;
+
+    if((ent->hnext = bucket->head))
+    {
+        ent->hnext->hpprev = &ent->hnext;
+    }
+
+    bucket->head = ent;
+    ent->hpprev = &bucket->head;
+
+    kernel_mutex_lock(&name_lru_lock);
+    name_lru_link(ent);
+    kernel_mutex_unlock(&name_lru_lock);
+
+    if(!ino)
+    {
+        __sync_fetch_and_add(&nr_negative_names, 1);
+    }
+
+    __sync_fetch_and_add(&nr_names, 1);
+}
+
+
+int namecache_lookup(struct fs_node_t *dir, char *name, ino_t *ino,
+                     unsigned int *seq)
+{
+    struct name_bucket_t *bucket;
+    struct name_entry_t *ent;
+    unsigned long hash;
+    size_t len;
+
+    *seq = 0;
+    hash = name_hashfn(dir->dev, dir->inode, name, &len);
+
+    if(!name_is_cacheable(dir, name, len))
+    {
+        return 0;
+    }
+
+    bucket = &name_hash[hash & (NR_NAMECACHE_HASH - 1)];
+    kernel_mutex_lock(&bucket->lock);
+
+    if((ent = name_find(bucket, dir->dev, dir->inode, name, hash)))
+    {
+        ent->referenced = 1;
+        ent->last_accessed = ticks;
+        *ino = ent->ino;
+        kernel_mutex_unlock(&bucket->lock);
+        return 1;
+    }
+
+    *seq = bucket->seq;
+    kernel_mutex_unlock(&bucket->lock);
+
+    return 0;
+}
+
+
+void namecache_enter(struct fs_node_t *dir, char *name, ino_t ino,
+                     unsigned int seq)
+{
+    struct name_bucket_t *bucket;
+    unsigned long hash;
+    size_t len;
+
+    hash = name_hashfn(dir->dev, dir->inode, name, &len);
+
+    if(!name_is_cacheable(dir, name, len) || !fs_is_cacheable(dir))
+    {
+        return;
+    }
+
+    bucket = &name_hash[hash & (NR_NAMECACHE_HASH - 1)];
+    kernel_mutex_lock(&bucket->lock);
+
+    // someone changed the directory while we were looking
+    if(bucket->seq != seq)
+    {
+        kernel_mutex_unlock(&bucket->lock);
+        return;
+    }
+
+    name_insert(bucket, dir, name, len, hash, ino);
+    kernel_mutex_unlock(&bucket->lock);
+
+    if(nr_names > NR_NAMECACHE)
+    {
+        shrink_namecache(NR_NAMECACHE / 8);
+    }
+}
+
+
+void namecache_update(struct fs_node_t *dir, char *name, ino_t ino)
+{
+    struct name_bucket_t *bucket;
+    unsigned long hash;
+    size_t len;
+
+    hash = name_hashfn(dir->dev, dir->inode, name, &len);
+
+    if(!name_is_cacheable(dir, name, len) || !fs_is_cacheable(dir))
+    {
+        return;
+    }
+
+    bucket = &name_hash[hash & (NR_NAMECACHE_HASH - 1)];
+    kernel_mutex_lock(&bucket->lock);
+    bucket->seq++;
+    name_insert(bucket, dir, name, len, hash, ino);
+    kernel_mutex_unlock(&bucket->lock);
+}
+
+
+/*
+ * Remove all entries on the given device, or only the entries under the
+ * given directory if dir is non-zero.
+ */
+static void name_purge(dev_t dev, ino_t dir)
+{
+    struct name_bucket_t *bucket, *lbucket = &name_hash[NR_NAMECACHE_HASH];
+    struct name_entry_t *ent, *next;
+
+    for(bucket = name_hash; bucket < lbucket; bucket++)
+    {
+        if(!bucket->head)
+        {
+            continue;
+        }
+
+        kernel_mutex_lock(&bucket->lock);
+        bucket->seq++;
+
+        for(ent = bucket->head; ent != NULL; ent = next)
+        {
+            next = ent->hnext;
+
+            if(ent->dev != dev || (dir && ent->dir != dir))
+            {
+                continue;
+            }
+
+            kernel_mutex_lock(&name_lru_lock);
+            name_free(ent);
+            kernel_mutex_unlock(&name_lru_lock);
+        }
+
+        kernel_mutex_unlock(&bucket->lock);
+    }
+}
+
+
+void namecache_purge_dir(dev_t dev, ino_t dir)
+{
+    if(dev && dir)
+    {
+        name_purge(dev, dir);
+    }
+}
+
+
+void invalidate_dev_names(dev_t dev)
+{
+    if(dev)
+    {
+        name_purge(dev, 0);
+    }
+}
+
+
+/*
+ * Free up to count entries, oldest first. This is called when memory is
+ * running low, so we do not wait on any locks.
+ *
+ * Returns the number of entries freed.
+ */
+size_t shrink_namecache(size_t count)
+{
+    struct name_entry_t *ent, *prev;
+    struct name_bucket_t *bucket;
+    size_t freed = 0;
+    unsigned long scan;
+
+    if(kernel_mutex_trylock(&name_lru_lock))
+    {
+        return 0;
+    }
+
+    for(scan = nr_names, ent = name_lru_tail;
+        ent && scan && freed < count;
+        ent = prev, scan--)
+    {
+        prev = ent->lru_prev;
+        bucket = ent->bucket;
+
+        if(kernel_mutex_trylock(&bucket->lock))
+        {
+            continue;
+        }
+
+        // used since we last looked, give it another chance
+        if(ent->referenced)
+        {
+            ent->referenced = 0;
+            name_lru_unlink(ent);
+            name_lru_link(ent);
+        }
+        else
+        {
+            name_free(ent);
+            freed++;
+        }
+
+        kernel_mutex_unlock(&bucket->lock);
+    }
+
+    kernel_mutex_unlock(&name_lru_lock);
+
+    return freed;
+}
+
+
+void remove_old_names(unsigned long long older_than_ticks)
+{
+    struct name_entry_t *ent, *prev;
+    struct name_bucket_t *bucket;
+    unsigned long long older_than = ticks - older_than_ticks;
+
+    // check that the given time have passed since booting
+    if(ticks <= older_than_ticks)
+    {
+        return;
+    }
+
+    kernel_mutex_lock(&name_lru_lock);
+
+    for(ent = name_lru_tail; ent != NULL; ent = prev)
+    {
+        prev = ent->lru_prev;
+        bucket = ent->bucket;
+
+        if(ent->last_accessed >= older_than ||
+           kernel_mutex_trylock(&bucket->lock))
+        {
+            continue;
+        }
+
+        name_free(ent);
+        kernel_mutex_unlock(&bucket->lock);
+    }
+
+    kernel_mutex_unlock(&name_lru_lock);
+}
+
+
+void namecache_stats(unsigned long *total, unsigned long *negative,
+                     size_t *itemsz)
+{
+    *total = nr_names;
+    *negative = nr_negative_names;
+    *itemsz = sizeof(struct name_entry_t);
+}
+
@@ -99,7 +99,14 @@ static int last_node_num = 2;
  */
 void devfs_init(void)
 {
-    fs_register("devfs", &devfs_ops);
+    struct fs_info_t *fs;
+
+    // device nodes are added without going through vfs_addir()
+    if((fs = fs_register("devfs", &devfs_ops)))
+    {
+        fs->flags |= FSINFO_FLAG_NODCACHE;
+    }
+
     init_kernel_mutex(&dev_lock);
     
     // this will allow us to mount devfs on /dev
@@ -156,6 +163,7 @@ struct fs_node_t *devfs_create(void)
 
     // use one of the reserved dev ids
     devfs_root->dev = DEV_DEVID;
+    hash_node(devfs_root);
     
     dev_init();
     inited = 1;
@@ -123,6 +123,7 @@ void devpts_init(void)
     // make sure devfs is init'ed only once
     static int inited = 0;
     //struct pty_t *dev;
+    struct fs_info_t *fs;
     time_t t = now();
     
     if(inited)
@@ -133,7 +134,12 @@ void devpts_init(void)
     
     memset(pty_slaves, 0, sizeof(pty_slaves));
     init_kernel_mutex(&pty_lock);
-    fs_register("devpts", &devpts_ops);
+
+    // pty nodes come and go, so don't cache them
+    if((fs = fs_register("devpts", &devpts_ops)))
+    {
+        fs->flags |= FSINFO_FLAG_NOCACHE;
+    }
 
     if(!(devpts_root = get_empty_node()))
     {
@@ -152,6 +158,7 @@ void devpts_init(void)
 
     // use one of the reserved dev ids
     devpts_root->dev = DEVPTS_DEVID;
+    hash_node(devpts_root);
 
     inited = 1;
 }
@@ -40,6 +40,7 @@
 #include <kernel/tty.h>
 #include <kernel/rtc.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <kernel/pcache.h>
 #include <kernel/clock.h>
 #include <kernel/user.h>
@@ -227,7 +228,7 @@ long ext2_read_super(dev_t dev, struct mount_info_t *d, size_t bytes_per_sector)
         kfree(super);   \
         return err;
 
-    if(bdev_tab[maj].strategy(&req) < 0)
+    if(blk_submit(&req) < 0)
     {
         printk("ext2: failed to read from disk -- aborting mount\n");
         BAIL_OUT(-EIO);
@@ -351,7 +352,7 @@ long ext2_read_super(dev_t dev, struct mount_info_t *d, size_t bytes_per_sector)
 
     printk("ext2: reading block group descriptor table\n");
 
-    if(bdev_tab[maj].strategy(&req) < 0)
+    if(blk_submit(&req) < 0)
     {
         printk("ext2: failed to read from disk -- aborting mount\n");
         vmmngr_free_pages(super->privdata, super->privdata + align_up(bgd_size));
@@ -414,13 +415,13 @@ static int __ext2_write_super(/* struct ext2_superblock_t *super, */
                               struct disk_req_t *req, 
                               dev_t dev /* , size_t block_size */)
 {
-    return bdev_tab[MAJOR(dev)].strategy(req);
+    return blk_submit(req);
     /*
     int res;
     int off = !!(block_size == 1024);
 
     // write the superblock
-    if((res = bdev_tab[MAJOR(dev)].strategy(req)) < 0)
+    if((res = blk_submit(req)) < 0)
     {
         return res;
     }
@@ -429,7 +430,7 @@ static int __ext2_write_super(/* struct ext2_superblock_t *super, */
     req->blockno = super->blocks_per_group + off;
 
     return (req->blockno < super->total_blocks) ?
-            bdev_tab[MAJOR(dev)].strategy(req) : 0;
+            blk_submit(req) : 0;
     */
 }
 
@@ -437,13 +438,13 @@ static int __ext2_write_bgd(/* struct ext2_superblock_t *super, */
                             struct disk_req_t *req, 
                             dev_t dev /* , size_t block_size */)
 {
-    return bdev_tab[MAJOR(dev)].strategy(req);
+    return blk_submit(req);
     /*
     int res;
     int off = !!(block_size == 1024);
 
     // write the block group descriptor
-    if((res = bdev_tab[MAJOR(dev)].strategy(req)) < 0)
+    if((res = blk_submit(req)) < 0)
     {
         return res;
     }
@@ -452,7 +453,7 @@ static int __ext2_write_bgd(/* struct ext2_superblock_t *super, */
     req->blockno = super->blocks_per_group + off + 1;
 
     return (req->blockno < super->total_blocks) ?
-            bdev_tab[MAJOR(dev)].strategy(req) : 0;
+            blk_submit(req) : 0;
     */
 }
 
@@ -1047,7 +1048,7 @@ STATIC_INLINE void bmap_may_create_block(struct fs_node_t *node,
             req.blockno = *block;
             req.write = 1;
 
-            bdev_tab[MAJOR(node->dev)].strategy(&req);
+            blk_submit(&req);
 
             inc_node_disk_blocks(node, block_size);
             node->ctime = now();
@@ -33,6 +33,7 @@
 #include <kernel/laylaos.h>
 #include <kernel/vfs.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <fs/fatfs.h>
 #include <fs/magic.h>
 #include <mm/kheap.h>
@@ -41,6 +42,8 @@ extern time_t timegm(struct tm *tm);
 extern char *utf16_to_utf8_char(uint16_t *str);
 
 static size_t get_next_cluster(struct fat_private_t *priv, size_t cur_cluster);
+static size_t write_next_cluster(struct fat_private_t *priv, 
+                                 size_t cur_cluster, size_t next_cluster);
 static size_t count_free_clusters(struct fat_private_t *priv);
 
 /*
@@ -218,13 +221,17 @@ static void node_to_dirent(volatile struct fat_dirent_t *dent, struct fs_node_t
 }
 
 
+#define cacheent_hashfn(cluster)    ((cluster) % FAT_CACHEENT_HASH)
+
 static int get_cacheent(struct fat_private_t *priv, size_t cluster, size_t *pc)
 {
     struct fat_cacheent_t *cent;
 
     kernel_mutex_lock(&priv->lock);
 
-    for(cent = priv->cacheent; cent != NULL; cent = cent->next)
+    for(cent = priv->cacheent[cacheent_hashfn(cluster)];
+        cent != NULL;
+        cent = cent->next)
     {
         if(cent->child_cluster != cluster)
         {
@@ -244,10 +251,11 @@ static int get_cacheent(struct fat_private_t *priv, size_t cluster, size_t *pc)
 static void remove_cacheent(struct fat_private_t *priv, size_t cluster)
 {
     struct fat_cacheent_t *cent, *prev = NULL;
+    struct fat_cacheent_t **bucket = &priv->cacheent[cacheent_hashfn(cluster)];
 
     kernel_mutex_lock(&priv->lock);
 
-    for(cent = priv->cacheent; cent != NULL; cent = cent->next)
+    for(cent = *bucket; cent != NULL; cent = cent->next)
     {
         if(cent->child_cluster != cluster)
         {
@@ -261,7 +269,7 @@ static void remove_cacheent(struct fat_private_t *priv, size_t cluster)
         }
         else
         {
-            priv->cacheent = cent->next;
+            *bucket = cent->next;
         }
 
         kernel_mutex_unlock(&priv->lock);
@@ -295,6 +303,7 @@ static int add_cacheent(struct fat_private_t *priv,
                         size_t child_cluster, size_t parent_cluster)
 {
     struct fat_cacheent_t *cent;
+    struct fat_cacheent_t **bucket;
     
     // an entry with first cluster == 0 refers to the root directory on
     // FAT12/16, and is an empty file/dir on FAT32. In either case, we
@@ -311,10 +320,11 @@ static int add_cacheent(struct fat_private_t *priv,
         return 0;
     }
 
+    bucket = &priv->cacheent[cacheent_hashfn(child_cluster)];
     kernel_mutex_lock(&priv->lock);
 
     // find out if this lba is already cached
-    for(cent = priv->cacheent; cent != NULL; cent = cent->next)
+    for(cent = *bucket; cent != NULL; cent = cent->next)
     {
         if(cent->child_cluster == child_cluster)
         {
@@ -332,19 +342,322 @@ static int add_cacheent(struct fat_private_t *priv,
         return -ENOMEM;
     }
 
-    cent->next = priv->cacheent;
-    priv->cacheent = cent;
+    cent->next = *bucket;
+    *bucket = cent;
     kernel_mutex_unlock(&priv->lock);
     return 0;
 }
 
 
+#define extcache_hashfn(cluster)    ((cluster) % FAT_EXTCACHE_HASH)
+
+/*
+ * Helper functions to add/remove an extent cache to/from the LRU list.
+ * Must be called with priv->lock held.
+ */
+static void extcache_lru_remove(struct fat_private_t *priv,
+                                struct fat_extcache_t *ec)
+{
+    if(ec->lru_prev)
+    {
+        ec->lru_prev->lru_next = ec->lru_next;
+    }
+    else
+    {
+        priv->ext_lru_head = ec->lru_next;
+    }
+
+    if(ec->lru_next)
+    {
+        ec->lru_next->lru_prev = ec->lru_prev;
+    }
+    else
+    {
+        priv->ext_lru_tail = ec->lru_prev;
+    }
+
+    ec->lru_next = NULL;
+    ec->lru_prev = NULL;
+}
+
+
+static void extcache_lru_add(struct fat_private_t *priv,
+                             struct fat_extcache_t *ec)
+{
+    ec->lru_prev = NULL;
+    ec->lru_next = priv->ext_lru_head;
+
+    if(priv->ext_lru_head)
+    {
+        priv->ext_lru_head->lru_prev = ec;
+    }
+    else
+    {
+        priv->ext_lru_tail = ec;
+    }
+
+    priv->ext_lru_head = ec;
+}
+
+
+/*
+ * Remove an extent cache from its hash bucket.
+ * Must be called with priv->lock held.
+ */
+static void extcache_unhash(struct fat_private_t *priv,
+                            struct fat_extcache_t *ec)
+{
+    struct fat_extcache_t **pec;
+
+    for(pec = &priv->extcache[extcache_hashfn(ec->first_cluster)];
+        *pec != NULL;
+        pec = &((*pec)->hnext))
+    {
+        if(*pec == ec)
+        {
+            *pec = ec->hnext;
+            break;
+        }
+    }
+
+    ec->hnext = NULL;
+}
+
+
+/*
+ * Find a file's extent cache, and move it to the head of the LRU list.
+ * If create is set and the file has no cache, we add one (recycling the
+ * least recently used cache if we have too many).
+ * Must be called with priv->lock held.
+ */
+static struct fat_extcache_t *extcache_get(struct fat_private_t *priv,
+                                           size_t first_cluster, int create)
+{
+    struct fat_extcache_t *ec;
+    struct fat_extcache_t **bucket =
+                        &priv->extcache[extcache_hashfn(first_cluster)];
+
+    for(ec = *bucket; ec != NULL; ec = ec->hnext)
+    {
+        if(ec->first_cluster == first_cluster)
+        {
+            if(priv->ext_lru_head != ec)
+            {
+                extcache_lru_remove(priv, ec);
+                extcache_lru_add(priv, ec);
+            }
+
+            return ec;
+        }
+    }
+
+    if(!create)
+    {
+        return NULL;
+    }
+
+    if(priv->nextcache >= FAT_MAX_EXTCACHE && priv->ext_lru_tail)
+    {
+        // recycle the least recently used cache
+        ec = priv->ext_lru_tail;
+        extcache_unhash(priv, ec);
+        extcache_lru_remove(priv, ec);
+    }
+    else
+    {
+        if(!(ec = kmalloc(sizeof(struct fat_extcache_t))))
+        {
+            return NULL;
+        }
+
+        priv->nextcache++;
+    }
+
+    A_memset(ec, 0, sizeof(struct fat_extcache_t));
+
+    // the first run starts with the file's first cluster
+    ec->first_cluster = first_cluster;
+    ec->nextents = 1;
+    ec->extents[0].lcluster = 0;
+    ec->extents[0].pcluster = first_cluster;
+    ec->extents[0].count = 1;
+
+    ec->hnext = *bucket;
+    *bucket = ec;
+    extcache_lru_add(priv, ec);
+
+    return ec;
+}
+
+
+/*
+ * Forget the cached extents of the file starting at the given cluster.
+ * Called when the file's cluster chain is shortened or freed.
+ */
+static void extcache_invalidate(struct fat_private_t *priv,
+                                size_t first_cluster)
+{
+    struct fat_extcache_t *ec;
+
+    kernel_mutex_lock(&priv->lock);
+
+    for(ec = priv->extcache[extcache_hashfn(first_cluster)];
+        ec != NULL;
+        ec = ec->hnext)
+    {
+        if(ec->first_cluster == first_cluster)
+        {
+            extcache_unhash(priv, ec);
+            extcache_lru_remove(priv, ec);
+            priv->nextcache--;
+            kfree(ec);
+            break;
+        }
+    }
+
+    kernel_mutex_unlock(&priv->lock);
+}
+
+
+/*
+ * Record that logical cluster lcluster of the file is at physical cluster
+ * pcluster. Called as we walk the cluster chain, so lcluster is always
+ * one past the last cluster we know about.
+ */
+static void extcache_record(struct fat_private_t *priv, size_t first_cluster,
+                            size_t lcluster, size_t pcluster)
+{
+    struct fat_extcache_t *ec;
+    struct fat_extent_t *ext;
+
+    kernel_mutex_lock(&priv->lock);
+
+    if(!(ec = extcache_get(priv, first_cluster, 0)))
+    {
+        kernel_mutex_unlock(&priv->lock);
+        return;
+    }
+
+    ext = &ec->extents[ec->nextents - 1];
+
+    if(lcluster == ext->lcluster + ext->count)
+    {
+        if(pcluster == ext->pcluster + ext->count)
+        {
+            // extends the last run
+            ext->count++;
+            kernel_mutex_unlock(&priv->lock);
+            return;
+        }
+
+        if(ec->nextents < FAT_EXTENTS)
+        {
+            // starts a new run
+            ext++;
+            ext->lcluster = lcluster;
+            ext->pcluster = pcluster;
+            ext->count = 1;
+            ec->nextents++;
+            kernel_mutex_unlock(&priv->lock);
+            return;
+        }
+    }
+
+    if(lcluster >= ext->lcluster + ext->count)
+    {
+        ec->last_lcluster = lcluster;
+        ec->last_pcluster = pcluster;
+    }
+
+    kernel_mutex_unlock(&priv->lock);
+}
+
+
+/*
+ * Find the physical cluster holding the given logical cluster of the file
+ * starting at first_cluster. If the chain is shorter than that, we return
+ * the chain's last cluster. In both cases, *reached is set to the logical
+ * number of the cluster we return.
+ *
+ * Returns 0 if the chain has a bad or free cluster.
+ */
+static size_t extcache_map(struct fat_private_t *priv, size_t first_cluster,
+                           size_t lcluster, size_t *reached)
+{
+    struct fat_extcache_t *ec;
+    struct fat_extent_t *ext;
+    size_t lcl = 0, pcl = first_cluster, next;
+    int i;
+
+    kernel_mutex_lock(&priv->lock);
+
+    if((ec = extcache_get(priv, first_cluster, 1)))
+    {
+        for(i = 0, ext = ec->extents; i < ec->nextents; i++, ext++)
+        {
+            if(lcluster >= ext->lcluster &&
+               lcluster < ext->lcluster + ext->count)
+            {
+                pcl = ext->pcluster + (lcluster - ext->lcluster);
+                kernel_mutex_unlock(&priv->lock);
+                *reached = lcluster;
+                return pcl;
+            }
+        }
+
+        // start from the end of the cached runs, or from the last cluster
+        // we found if that is nearer
+        ext = &ec->extents[ec->nextents - 1];
+        lcl = ext->lcluster + ext->count - 1;
+        pcl = ext->pcluster + ext->count - 1;
+
+        if(ec->last_lcluster > lcl && ec->last_lcluster <= lcluster)
+        {
+            lcl = ec->last_lcluster;
+            pcl = ec->last_pcluster;
+        }
+    }
+
+    kernel_mutex_unlock(&priv->lock);
+
+    // walk the rest of the chain (reading the FAT might sleep, so we
+    // don't hold the lock here)
+    while(lcl < lcluster)
+    {
+        next = get_next_cluster(priv, pcl);
+
+        if(next >= end_of_chain[priv->fattype])
+        {
+            break;
+        }
+
+        if(next == bad_cluster[priv->fattype] || next < 2)
+        {
+            return 0;
+        }
+
+        lcl++;
+        pcl = next;
+        extcache_record(priv, first_cluster, lcl, pcl);
+    }
+
+    *reached = lcl;
+    return pcl;
+}
+
+
 /*
  * Initialise and register the FAT filesystem.
  */
 void fatfs_init(void)
 {
-    fs_register("vfat", &fatfs_ops);
+    struct fs_info_t *fs;
+
+    // names are case-insensitive, so the name cache can't be used
+    if((fs = fs_register("vfat", &fatfs_ops)))
+    {
+        fs->flags |= FSINFO_FLAG_NODCACHE;
+    }
 }
 
 
@@ -433,7 +746,7 @@ long fatfs_read_super(dev_t dev, struct mount_info_t *d, size_t bytes_per_sector
         kfree(super);   \
         return err;
 
-    if(bdev_tab[maj].strategy(&req) < 0)
+    if(blk_submit(&req) < 0)
     {
         printk("vfat: failed to read from disk -- aborting mount\n");
         BAIL_OUT(-EIO);
@@ -574,6 +887,8 @@ void fatfs_put_super(dev_t dev, struct superblock_t *super)
 
     struct fat_private_t *priv;
     struct fat_cacheent_t *cent, *next;
+    struct fat_extcache_t *ec, *ecnext;
+    int i;
 
     if(!super || !super->data)
     {
@@ -587,11 +902,26 @@ void fatfs_put_super(dev_t dev, struct superblock_t *super)
     {
         kernel_mutex_lock(&priv->lock);
 
-        for(cent = priv->cacheent; cent != NULL; )
+        for(i = 0; i < FAT_CACHEENT_HASH; i++)
+        {
+            for(cent = priv->cacheent[i]; cent != NULL; )
+            {
+                next = cent->next;
+                kfree(cent);
+                cent = next;
+            }
+        }
+
+        for(ec = priv->ext_lru_head; ec != NULL; )
+        {
+            ecnext = ec->lru_next;
+            kfree(ec);
+            ec = ecnext;
+        }
+
+        if(priv->free_map)
         {
-            next = cent->next;
-            kfree(cent);
-            cent = next;
+            kfree(priv->free_map);
         }
 
         super->privdata = 0;
@@ -1160,80 +1490,124 @@ long fatfs_write_inode(struct fs_node_t *node)
 }
 
 
+#define FREEMAP_BITS            (sizeof(unsigned long) * 8)
+#define FREEMAP_LONGS(n)        (((n) + FREEMAP_BITS - 1) / FREEMAP_BITS)
+
+STATIC_INLINE void freemap_set(struct fat_private_t *priv, size_t cluster)
+{
+    if(priv->free_map)
+    {
+        priv->free_map[cluster / FREEMAP_BITS] |=
+                                        (1UL << (cluster % FREEMAP_BITS));
+    }
+}
+
+
+STATIC_INLINE void freemap_clear(struct fat_private_t *priv, size_t cluster)
+{
+    if(priv->free_map)
+    {
+        priv->free_map[cluster / FREEMAP_BITS] &=
+                                        ~(1UL << (cluster % FREEMAP_BITS));
+    }
+}
+
+
+/*
+ * Count the free clusters and build the in-memory bitmap of used clusters,
+ * which we use to find free clusters without reading the FAT. If we can't
+ * get memory for the bitmap, alloc_cluster() reads the FAT instead.
+ */
 static size_t count_free_clusters(struct fat_private_t *priv)
 {
     struct cached_page_t *blk;
     struct fs_node_header_t tmpnode;
-    volatile size_t fat_sector, i, count = 0;
-    size_t steps;
+    size_t nclusters = priv->total_clusters + 2;
+    size_t fat_sector, i, ent, steps, cluster, count = 0;
 
     tmpnode.inode = PCACHE_NOINODE;
     tmpnode.dev = priv->dev;
 
     printk("count_free_clusters: dev 0x%x\n", priv->dev);
 
-    for(fat_sector = priv->first_fat_sector;
-        fat_sector < priv->first_fat_sector + priv->fat_size;
-        fat_sector++)
+    if((priv->free_map = kmalloc(FREEMAP_LONGS(nclusters) * 
+                                        sizeof(unsigned long))))
     {
-        if(!(blk = get_cached_page((struct fs_node_t *)&tmpnode, fat_sector, 0)))
-        {
-            continue;
-        }
+        A_memset(priv->free_map, 0, 
+                    FREEMAP_LONGS(nclusters) * sizeof(unsigned long));
+    }
 
-        if(priv->fattype == FAT_32 || priv->fattype == FAT_EX)
-        {
-            uint32_t *fat_table = (uint32_t *)blk->virt;
+    // clusters 0 and 1 are reserved
+    freemap_set(priv, 0);
+    freemap_set(priv, 1);
+    priv->next_free = 2;
 
-            for(i = 0, steps = priv->blocksz / 4; i < steps; i++)
+    if(priv->fattype == FAT_12)
+    {
+        // FAT12 entries can cross sector boundaries, and the FAT is small
+        // anyway, so read it one entry at a time
+        for(cluster = 2; cluster < nclusters; cluster++)
+        {
+            if(get_next_cluster(priv, cluster) == 0)
             {
-                if(fat_table[i] == 0)
-                {
-                    count++;
-                }
+                count++;
+            }
+            else
+            {
+                freemap_set(priv, cluster);
             }
         }
-        else if(priv->fattype == FAT_16)
-        {
-            uint16_t *fat_table = (uint16_t *)blk->virt;
+    }
+    else
+    {
+        steps = priv->blocksz / ((priv->fattype == FAT_16) ? 2 : 4);
 
-            for(i = 0, steps = priv->blocksz / 2; i < steps; i++)
+        for(fat_sector = priv->first_fat_sector, cluster = 0;
+            fat_sector < priv->first_fat_sector + priv->fat_size &&
+                cluster < nclusters;
+            fat_sector++)
+        {
+            if(!(blk = get_cached_page((struct fs_node_t *)&tmpnode, fat_sector, 0)))
             {
-                if(fat_table[i] == 0)
+                // we can't tell, so don't use these clusters
+                for(i = 0; i < steps && cluster < nclusters; i++, cluster++)
                 {
-                    count++;
+                    freemap_set(priv, cluster);
                 }
+
+                continue;
             }
-        }
-        else
-        {
-            uint8_t *fat_table = (uint8_t *)blk->virt;
 
-            for(i = 0; i < priv->blocksz; i += 3)
+            for(i = 0; i < steps && cluster < nclusters; i++, cluster++)
             {
-                // ignore the case where the entry is at sector boundary
-                // TODO: although this misses only a few entries, we should
-                //       find a cleaner solution
-                if(i == priv->blocksz - 1)
+                if(priv->fattype == FAT_16)
                 {
-                    break;
+                    ent = ((uint16_t *)blk->virt)[i];
                 }
-
-                // check the low 12 bits
-                if(fat_table[i] == 0 && (fat_table[i + 1] & 0x0F) == 0)
+                else
                 {
-                    count++;
+                    // FAT32 uses only 28 bits
+                    ent = ((uint32_t *)blk->virt)[i] & 0x0FFFFFFF;
                 }
 
-                // check the high 12 bits
-                if((fat_table[i] & 0xF0) == 0 && fat_table[i + 1] == 0)
+                if(ent == 0 && cluster >= 2)
                 {
                     count++;
                 }
+                else
+                {
+                    freemap_set(priv, cluster);
+                }
             }
+
+            release_cached_page(blk);
         }
 
-        release_cached_page(blk);
+        // in case the FAT is too small for the disk
+        for( ; cluster < nclusters; cluster++)
+        {
+            freemap_set(priv, cluster);
+        }
     }
 
     printk("count_free_clusters: dev 0x%x -- count %ld\n", priv->dev, count);
@@ -1242,113 +1616,85 @@ static size_t count_free_clusters(struct fat_private_t *priv)
 }
 
 
+/*
+ * Find a free cluster and mark it as the end of a cluster chain.
+ *
+ * Returns the cluster number, 0 if the disk is full.
+ */
 static size_t alloc_cluster(struct fat_private_t *priv)
 {
-    struct cached_page_t *blk;
-    struct fs_node_header_t tmpnode;
-    volatile size_t fat_sector, i;
-    size_t steps;
+    size_t nclusters = priv->total_clusters + 2;
+    size_t cluster = 0, i;
+    unsigned long bits;
 
-    tmpnode.inode = PCACHE_NOINODE;
-    tmpnode.dev = priv->dev;
+    kernel_mutex_lock(&priv->lock);
 
-    for(fat_sector = priv->first_fat_sector;
-        fat_sector < priv->first_fat_sector + priv->fat_size;
-        fat_sector++)
+    if(priv->free_map)
     {
-        if(!(blk = get_cached_page((struct fs_node_t *)&tmpnode, fat_sector, 0)))
-        {
-            continue;
-        }
-
-        if(priv->fattype == FAT_32 || priv->fattype == FAT_EX)
+        // there are no free clusters below next_free
+        for(i = priv->next_free / FREEMAP_BITS;
+            i < FREEMAP_LONGS(nclusters);
+            i++)
         {
-            uint32_t *fat_table = (uint32_t *)blk->virt;
-
-            for(i = 0, steps = priv->blocksz / 4; i < steps; i++)
+            if((bits = ~priv->free_map[i]))
             {
-                if(fat_table[i] == 0 &&
-                   (fat_sector != priv->first_fat_sector || i > 2))
-                {
-                    fat_table[i] = 0x0FFFFFFF;
-                    __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
-                    priv->free_clusters--;
-                    __asm__ __volatile__("":::"memory");
-                    release_cached_page(blk);
-                    return i + ((fat_sector - priv->first_fat_sector) * steps);
-                }
+                cluster = (i * FREEMAP_BITS) + __builtin_ctzl(bits);
+                break;
             }
         }
-        else if(priv->fattype == FAT_16)
+
+        if(cluster < 2 || cluster >= nclusters)
         {
-            uint16_t *fat_table = (uint16_t *)blk->virt;
+            kernel_mutex_unlock(&priv->lock);
+            return 0;
+        }
 
-            for(i = 0, steps = priv->blocksz / 2; i < steps; i++)
+        freemap_set(priv, cluster);
+    }
+    else
+    {
+        for(cluster = priv->next_free; cluster < nclusters; cluster++)
+        {
+            if(get_next_cluster(priv, cluster) == 0)
             {
-                if(fat_table[i] == 0 &&
-                   (fat_sector != priv->first_fat_sector || i > 2))
-                {
-                    fat_table[i] = 0xFFFF;
-                    __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
-                    priv->free_clusters--;
-                    __asm__ __volatile__("":::"memory");
-                    release_cached_page(blk);
-                    return i + ((fat_sector - priv->first_fat_sector) * steps);
-                }
+                break;
             }
         }
-        else
+
+        if(cluster >= nclusters)
         {
-            uint8_t *fat_table = (uint8_t *)blk->virt;
+            kernel_mutex_unlock(&priv->lock);
+            return 0;
+        }
+    }
 
-            // TODO: not sure if this gives the right offset for use in the
-            //       calculations below
-            steps = (priv->blocksz * 2) / 3;
+    priv->next_free = cluster + 1;
+    priv->free_clusters--;
+    kernel_mutex_unlock(&priv->lock);
 
-            for(i = 0; i < priv->blocksz; i += 3)
-            {
-                // ignore the case where the entry is at sector boundary
-                // TODO: although this wastes only a few entries, we should
-                //       find a cleaner solution
-                if(i == priv->blocksz - 1)
-                {
-                    break;
-                }
+    write_next_cluster(priv, cluster, end_of_chain[priv->fattype]);
 
-                // check the low 12 bits
-                if(fat_table[i] == 0 && (fat_table[i + 1] & 0x0F) == 0 &&
-                   (fat_sector != priv->first_fat_sector || i > 3))
-                {
-                    fat_table[i] = 0xFF;
-                    fat_table[i + 1] |= 0x0F;
-                    __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
-                    priv->free_clusters--;
-                    __asm__ __volatile__("":::"memory");
-                    release_cached_page(blk);
-                    return ((i * 2) / 3) +
-                            ((fat_sector - priv->first_fat_sector) * steps);
-                }
+    return cluster;
+}
 
-                // check the high 12 bits
-                if((fat_table[i] & 0xF0) == 0 && fat_table[i + 1] == 0 &&
-                   (fat_sector != priv->first_fat_sector || i > 3))
-                {
-                    fat_table[i] |= 0xF0;
-                    fat_table[i + 1] = 0xFF;
-                    __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
-                    priv->free_clusters--;
-                    __asm__ __volatile__("":::"memory");
-                    release_cached_page(blk);
-                    return (((i * 2) / 3) + 1) +
-                            ((fat_sector - priv->first_fat_sector) * steps);
-                }
-            }
-        }
 
-        release_cached_page(blk);
+/*
+ * Mark a cluster as free in the FAT and in the free cluster bitmap.
+ */
+static void free_cluster(struct fat_private_t *priv, size_t cluster)
+{
+    write_next_cluster(priv, cluster, 0);
+
+    kernel_mutex_lock(&priv->lock);
+    freemap_clear(priv, cluster);
+
+    if(cluster < priv->next_free)
+    {
+        priv->next_free = cluster;
     }
 
-    return 0;
+    priv->free_clusters++;
+    kernel_mutex_unlock(&priv->lock);
 }
 
 
@@ -1425,7 +1771,9 @@ static size_t __next_cluster(struct fat_private_t *priv,
     }
     else
     {
-        uint16_t low, hi;
+        struct cached_page_t *blk2 = NULL;
+        uint8_t *hi_byte;
+        uint16_t word;
 
         fat_offset = cur_cluster + (cur_cluster / 2);   // multiply by 1.5
         fat_sector = priv->first_fat_sector + (fat_offset / priv->blocksz);
@@ -1438,54 +1786,56 @@ static size_t __next_cluster(struct fat_private_t *priv,
 
         fat_table = (uint8_t *)blk->virt;
 
-        if(write)
+        // special case where the entry is at sector boundary
+        // the upper byte of the entry is the first byte of the next sector
+        if(ent_offset == priv->blocksz - 1)
         {
-            // special case where the entry is at sector boundary
-            // write the lower byte here and the upper byte below
-            if(ent_offset == priv->blocksz - 1)
-            {
-                fat_table[ent_offset] = (uint8_t)(next_cluster & 0xFF);
-            }
-            else
+            if(!(blk2 = get_cached_page((struct fs_node_t *)&tmpnode, fat_sector + 1, 0)))
             {
-                *(uint16_t *)&fat_table[ent_offset] = (uint16_t)next_cluster;
+                release_cached_page(blk);
+                return 0;
             }
 
-            __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
+            hi_byte = (uint8_t *)blk2->virt;
+        }
+        else
+        {
+            hi_byte = &fat_table[ent_offset + 1];
         }
 
-        low = *(uint16_t *)&fat_table[ent_offset];
-        release_cached_page(blk);
+        word = fat_table[ent_offset] | (*hi_byte << 8);
 
-        // special case where the entry is at sector boundary
-        // we have to read the next sector to get the upper half of the entry
-        if(ent_offset == priv->blocksz - 1)
+        if(write)
         {
-            if(!(blk = get_cached_page((struct fs_node_t *)&tmpnode, ++fat_sector, 0)))
+            // odd clusters use the upper 12 bits, even clusters the lower
+            // 12 bits, we must not touch the other entry's 4 bits
+            if(cur_cluster & 1)
             {
-                return 0;
+                word = (word & 0x000F) | ((next_cluster & 0x0FFF) << 4);
+            }
+            else
+            {
+                word = (word & 0xF000) | (next_cluster & 0x0FFF);
             }
 
-            fat_table = (uint8_t *)blk->virt;
+            fat_table[ent_offset] = (uint8_t)(word & 0xFF);
+            *hi_byte = (uint8_t)(word >> 8);
+            __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
 
-            if(write)
+            if(blk2)
             {
-                // special case where the entry is at sector boundary
-                // write the upper byte here and the lower byte above
-                fat_table[0] &= ~0x0F;
-                fat_table[0] |= (uint8_t)((next_cluster >> 8) & 0x0F);
-                __sync_or_and_fetch(&blk->flags, PCACHE_FLAG_DIRTY);
+                __sync_or_and_fetch(&blk2->flags, PCACHE_FLAG_DIRTY);
             }
-
-            hi = *(uint16_t *)&fat_table[0];
-            low &= 0xFF;
-            low |= (hi << 8);
-            release_cached_page(blk);
         }
 
-        low = (cur_cluster & 1) ? low >> 4 : low & 0xFFF;
+        release_cached_page(blk);
+
+        if(blk2)
+        {
+            release_cached_page(blk2);
+        }
 
-        return low;
+        return (cur_cluster & 1) ? (word >> 4) : (word & 0xFFF);
     }
 }
 
@@ -1523,7 +1873,8 @@ size_t fatfs_bmap(struct fs_node_t *node, size_t lblock,
     UNUSED(block_size);
 
     struct fat_private_t *priv;
-    size_t cur_cluster, next_cluster;
+    size_t cur_cluster, next_cluster, first_cluster;
+    size_t lcluster, reached;
     int create = (flags & BMAP_FLAG_CREATE);
     int free = (flags & BMAP_FLAG_FREE);
 
@@ -1565,7 +1916,6 @@ size_t fatfs_bmap(struct fs_node_t *node, size_t lblock,
     }
 
     //printk("fatfs_bmap: cur_cluster 0x%lx\n", cur_cluster);
-    next_cluster = 0;
 
     if(lblock == 0)
     {
@@ -1579,41 +1929,35 @@ size_t fatfs_bmap(struct fs_node_t *node, size_t lblock,
         return first_sector_of_cluster(priv, cur_cluster) + lblock;
     }
 
-    while(lblock >= priv->sectors_per_cluster)
-    {
-        next_cluster = get_next_cluster(priv, cur_cluster);
-        lblock -= priv->sectors_per_cluster;
-
-        //printk("fatfs_bmap: loop -- cur_cluster 0x%lx, next_cluster 0x%lx, lblock 0x%lx\n", cur_cluster, next_cluster, lblock);
+    first_cluster = cur_cluster;
+    lcluster = lblock / priv->sectors_per_cluster;
+    lblock %= priv->sectors_per_cluster;
 
-        if(next_cluster >= end_of_chain[priv->fattype])
-        {
-            break;
-        }
+    if(!(cur_cluster = extcache_map(priv, first_cluster, lcluster, &reached)))
+    {
+        return 0;
+    }
 
-        if(next_cluster == bad_cluster[priv->fattype] ||
-           next_cluster < 2)
+    if(reached < lcluster)
+    {
+        // the file is shorter than the block we want, extend it
+        if(!create)
         {
             return 0;
         }
 
-        cur_cluster = next_cluster;
-    }
-
-    //printk("fatfs_bmap: cur_cluster 0x%lx, next_cluster 0x%lx\n", cur_cluster, next_cluster);
-
-    if(next_cluster >= end_of_chain[priv->fattype])
-    {
-        if(create && (next_cluster = alloc_cluster(priv)))
+        while(reached < lcluster)
         {
+            if(!(next_cluster = alloc_cluster(priv)))
+            {
+                return 0;
+            }
+
             //printk("fatfs_bmap: create cur_cluster 0x%lx, next_cluster 0x%lx\n", cur_cluster, next_cluster);
             write_next_cluster(priv, cur_cluster, next_cluster);
+            extcache_record(priv, first_cluster, ++reached, next_cluster);
             cur_cluster = next_cluster;
         }
-        else
-        {
-            return 0;
-        }
     }
     else if(free)
     {
@@ -1625,12 +1969,11 @@ size_t fatfs_bmap(struct fs_node_t *node, size_t lblock,
             if(next_cluster < bad_cluster[priv->fattype] &&
                next_cluster >= 2)
             {
-                write_next_cluster(priv, next_cluster, 0);
-                priv->free_clusters++;
-                __asm__ __volatile__("":::"memory");
+                free_cluster(priv, next_cluster);
             }
 
             write_next_cluster(priv, cur_cluster, end_of_chain[priv->fattype]);
+            extcache_invalidate(priv, first_cluster);
         }
 
         return 0;
@@ -1872,12 +2215,11 @@ long fatfs_free_inode(struct fs_node_t *node)
     //       cluster, and if not raise an error?
     if(first_cluster)
     {
-        write_next_cluster(priv, first_cluster, 0);
-        priv->free_clusters++;
-        __asm__ __volatile__("":::"memory");
+        free_cluster(priv, first_cluster);
     }
 
     remove_cacheent(priv, first_cluster);
+    extcache_invalidate(priv, first_cluster);
 
     return 0;
 
@@ -1963,6 +2305,9 @@ long fatfs_alloc_inode(struct fs_node_t *new_node)
     new_node->inode = first_cluster;
     A_memset(new_node->blocks, 0, sizeof(new_node->blocks));
 
+    // in case the cluster was used by a file we didn't clean up after
+    extcache_invalidate(priv, first_cluster);
+
     return 0;
 }
 
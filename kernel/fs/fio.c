@@ -26,15 +26,250 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <kernel/vfs.h>
 #include <kernel/task.h>
+#include <kernel/epoll.h>
+#include <kernel/eventfd.h>
+#include <kernel/timerfd.h>
+#include <kernel/signalfd.h>
 //#include <fs/sockfs.h>
 #include <kernel/loop_internal.h>
 #include <fs/devpts.h>
+#include <fs/dummy.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
 #include <kernel/net/socket.h>
 
 
+// slab cache for file structs
+static struct kmem_cache_t *file_cache = NULL;
+
+// all allocated file structs
+static struct file_t *file_list = NULL;
+static volatile struct kernel_mutex_t file_list_lock = { 0, };
+
+volatile unsigned long nr_files = 0;
+
+
+/*
+ * Initialise the file struct slab cache.
+ */
+void init_files(void)
+{
+    if(!(file_cache = kmem_cache_create("file",
+                                        sizeof(struct file_t), 0, NULL)))
+    {
+        kpanic("Failed to create file slab cache\n");
+    }
+}
+
+
+/*
+ * Allocate a new file struct with a reference count of 1.
+ */
+struct file_t *file_alloc(void)
+{
+    struct file_t *f;
+
+    if(!(f = (struct file_t *)kmem_cache_alloc(file_cache)))
+    {
+        return NULL;
+    }
+
+    A_memset(f, 0, sizeof(struct file_t));
+    f->refs = 1;
+
+    kernel_mutex_lock(&file_list_lock);
+
+    if((f->next = file_list))
+    {
+        file_list->prev = f;
+    }
+
+    file_list = f;
+    kernel_mutex_unlock(&file_list_lock);
+    __sync_fetch_and_add(&nr_files, 1);
+
+    return f;
+}
+
+
+/*
+ * Free a file struct that is not referenced anymore.
+ */
+void file_free(struct file_t *f)
+{
+    kernel_mutex_lock(&file_list_lock);
+
+    if(f->prev)
+    {
+        f->prev->next = f->next;
+    }
+    else
+    {
+        file_list = f->next;
+    }
+
+    if(f->next)
+    {
+        f->next->prev = f->prev;
+    }
+
+    kernel_mutex_unlock(&file_list_lock);
+    __sync_fetch_and_sub(&nr_files, 1);
+    kmem_cache_free(file_cache, f);
+}
+
+
+/*
+ * Call func for each allocated file struct, with the file list locked,
+ * until it returns non-zero.
+ *
+ * Returns the file for which func returned non-zero, NULL otherwise.
+ */
+struct file_t *for_each_file(int (*func)(struct file_t *, void *), void *arg)
+{
+    struct file_t *f;
+
+    kernel_mutex_lock(&file_list_lock);
+
+    for(f = file_list; f != NULL; f = f->next)
+    {
+        if(func(f, arg))
+        {
+            break;
+        }
+    }
+
+    kernel_mutex_unlock(&file_list_lock);
+
+    return f;
+}
+
+
+void task_files_init(struct task_files_t *files)
+{
+    A_memset(files, 0, sizeof(struct task_files_t));
+    files->ofile = files->ofile_init;
+    files->open_fds = files->open_fds_init;
+    files->cloexec_fds = files->cloexec_init;
+    files->max_fds = NR_OPEN_DEFAULT;
+    init_kernel_mutex(&files->mutex);
+}
+
+
+/*
+ * Expand the file table to hold at least nr slots.
+ * The caller must hold the table's lock.
+ */
+static long task_files_expand(struct task_files_t *files, int nr)
+{
+    int newmax = files->max_fds;
+    size_t longs, oldlongs, sz;
+    struct file_t **ofile;
+    unsigned long *open_fds;
+    char *tables;
+
+    while(newmax < nr)
+    {
+        newmax *= 2;
+    }
+
+    if(newmax > NR_OPEN)
+    {
+        newmax = NR_OPEN;
+    }
+
+    if(newmax <= files->max_fds)
+    {
+        return -EMFILE;
+    }
+
+    longs = FD_BITMAP_LONGS(newmax);
+    oldlongs = FD_BITMAP_LONGS(files->max_fds);
+
+    // the first word is used to link old tables together
+    sz = sizeof(void *) + (newmax * sizeof(struct file_t *)) +
+         (2 * longs * sizeof(unsigned long));
+
+    if(!(tables = kmalloc(sz)))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(tables, 0, sz);
+    ofile = (struct file_t **)(tables + sizeof(void *));
+    open_fds = (unsigned long *)(ofile + newmax);
+
+    A_memcpy(ofile, files->ofile, files->max_fds * sizeof(struct file_t *));
+    A_memcpy(open_fds, files->open_fds, oldlongs * sizeof(unsigned long));
+    A_memcpy(open_fds + longs, files->cloexec_fds,
+             oldlongs * sizeof(unsigned long));
+
+    if(files->tables)
+    {
+        *(void **)files->tables = files->old_tables;
+        files->old_tables = files->tables;
+    }
+
+    files->tables = tables;
+    files->ofile = ofile;
+    files->open_fds = open_fds;
+    files->cloexec_fds = open_fds + longs;
+
+    // make sure the new tables are visible before the new size
+    __sync_synchronize();
+    files->max_fds = newmax;
+
+    return 0;
+}
+
+
+long task_files_copy(struct task_files_t *dest, struct task_files_t *src)
+{
+    long res = 0;
+    int max;
+
+    task_files_init(dest);
+    kernel_mutex_lock(&src->mutex);
+    max = src->max_fds;
+
+    if(max > dest->max_fds && (res = task_files_expand(dest, max)) != 0)
+    {
+        kernel_mutex_unlock(&src->mutex);
+        return res;
+    }
+
+    A_memcpy(dest->ofile, src->ofile, max * sizeof(struct file_t *));
+    A_memcpy(dest->open_fds, src->open_fds,
+             FD_BITMAP_LONGS(max) * sizeof(unsigned long));
+    A_memcpy(dest->cloexec_fds, src->cloexec_fds,
+             FD_BITMAP_LONGS(max) * sizeof(unsigned long));
+    dest->next_fd = src->next_fd;
+    kernel_mutex_unlock(&src->mutex);
+
+    return 0;
+}
+
+
+void task_files_free(struct task_files_t *files)
+{
+    void *tables, *next;
+
+    kfree(files->tables);
+
+    for(tables = files->old_tables; tables != NULL; tables = next)
+    {
+        next = *(void **)tables;
+        kfree(tables);
+    }
+
+    files->tables = NULL;
+    files->old_tables = NULL;
+}
+
+
 long fdnode(int fd, struct task_t *t, struct file_t **f, struct fs_node_t **node)
 {
     *f = NULL;
@@ -45,7 +280,7 @@ long fdnode(int fd, struct task_t *t, struct file_t **f, struct fs_node_t **node
         return -EBADF;
     }
 
-    if(fd < 0 || fd >= NR_OPEN ||
+    if(fd < 0 || fd >= t->ofiles->max_fds ||
        !(*f = t->ofiles->ofile[fd]) || !(*node = (*f)->node))
     {
         return -EBADF;
@@ -55,27 +290,142 @@ long fdnode(int fd, struct task_t *t, struct file_t **f, struct fs_node_t **node
 }
 
 
-static long fdalloc(int *res)
+STATIC_INLINE int fd_limit(volatile struct task_t *t)
 {
-    int fd;
-	volatile struct task_t *ct = this_core->cur_task;
+    rlim_t max = t->task_rlimits[RLIMIT_NOFILE].rlim_cur;
+
+    return (max > NR_OPEN) ? NR_OPEN : (int)max;
+}
+
+
+/*
+ * Find the first free fd in the given bitmap, starting at start.
+ * Returns max if there are no free fds.
+ */
+STATIC_INLINE int find_free_fd(unsigned long *bitmap, int start, int max)
+{
+    int i = start / FD_BITS_PER_LONG;
+    int last = FD_BITMAP_LONGS(max);
+    unsigned long bits;
+
+    if(start >= max)
+    {
+        return max;
+    }
+
+    // ignore the fds below start in the first word
+    bits = ~bitmap[i] & (~0UL << (start % FD_BITS_PER_LONG));
+
+    while(1)
+    {
+        if(bits)
+        {
+            start = (i * FD_BITS_PER_LONG) + __builtin_ctzl(bits);
+            return (start < max) ? start : max;
+        }
+
+        if(++i >= last)
+        {
+            return max;
+        }
+
+        bits = ~bitmap[i];
+    }
+}
+
+
+long fdalloc(int start, int *res)
+{
+    struct task_files_t *files = this_core->cur_task->ofiles;
+    int fd, limit = fd_limit(this_core->cur_task);
+    long err;
     
     *res = -1;
-    
-	// find an empty slot in the task's file table
-	for(fd = 0; fd < NR_OPEN; fd++)
+
+    if(start >= limit)
+    {
+        return -EMFILE;
+    }
+
+    kernel_mutex_lock(&files->mutex);
+
+    if(start < files->next_fd)
+    {
+        start = files->next_fd;
+    }
+
+	// find an empty slot in the task's file table, and expand the table
+	// if it is full
+	if((fd = find_free_fd(files->open_fds, start, files->max_fds)) >=
+	                                                        files->max_fds)
 	{
-		if(ct->ofiles->ofile[fd] == NULL)
-		{
-        	// clear the close-on-exec flag
-        	cloexec_clear(ct, fd);
-		    *res = fd;
-		    return 0;
+	    fd = (start > files->max_fds) ? start : files->max_fds;
+
+	    if(fd >= limit)
+	    {
+            kernel_mutex_unlock(&files->mutex);
+            return -EMFILE;
+	    }
+
+	    if((err = task_files_expand(files, fd + 1)) != 0)
+	    {
+            kernel_mutex_unlock(&files->mutex);
+            return err;
 	    }
 	}
-	
-	// task's file table is full
-	return -ENFILE;
+
+	if(fd >= limit)
+	{
+        kernel_mutex_unlock(&files->mutex);
+        return -EMFILE;
+	}
+
+    files->open_fds[fd / FD_BITS_PER_LONG] |= (1UL << (fd % FD_BITS_PER_LONG));
+
+    // clear the close-on-exec flag
+    files->cloexec_fds[fd / FD_BITS_PER_LONG] &=
+                                        ~(1UL << (fd % FD_BITS_PER_LONG));
+
+    if(fd == files->next_fd)
+    {
+        files->next_fd = fd + 1;
+    }
+
+    kernel_mutex_unlock(&files->mutex);
+    *res = fd;
+
+    return 0;
+}
+
+
+void fdassign(int fd, struct file_t *f)
+{
+    struct task_files_t *files = this_core->cur_task->ofiles;
+
+    kernel_mutex_lock(&files->mutex);
+    files->ofile[fd] = f;
+    kernel_mutex_unlock(&files->mutex);
+}
+
+
+void fdfree(int fd)
+{
+    struct task_files_t *files = this_core->cur_task->ofiles;
+
+    kernel_mutex_lock(&files->mutex);
+
+    files->ofile[fd] = NULL;
+    files->open_fds[fd / FD_BITS_PER_LONG] &=
+                                        ~(1UL << (fd % FD_BITS_PER_LONG));
+    files->cloexec_fds[fd / FD_BITS_PER_LONG] &=
+                                        ~(1UL << (fd % FD_BITS_PER_LONG));
+
+    if(fd < files->next_fd)
+    {
+        files->next_fd = fd;
+    }
+
+    kernel_mutex_unlock(&files->mutex);
 }
 
 
@@ -84,52 +434,33 @@ static long fdalloc(int *res)
  * pointing at the struct.
  *
  * Output:
- *    *_fd => file descriptor in the range 0..NR_OPEN
- *    *_f => pointer to file struct in the master file table
+ *    *_fd => file descriptor in the range 0..RLIMIT_NOFILE
+ *    *_f => pointer to the new file struct
  *
  * Returns:
  *    0 on success, -errno on failure.
  */
 long falloc(int *_fd, struct file_t **_f)
 {
-	struct file_t *f, *lf;
+	struct file_t *f;
 	int fd;
-	volatile struct task_t *ct = this_core->cur_task;
+	long res;
 
 	*_f = NULL;
 	*_fd = -1;
 
-    if(fdalloc(&fd) != 0)
+    if((res = fdalloc(0, &fd)) != 0)
     {
-    	return -ENFILE;
+    	return res;
     }
 
-    if(fd < 0)
+    if(!(f = file_alloc()))
     {
-    	return -ENFILE;
+        fdfree(fd);
+        return -ENFILE;
     }
     
-	// find an empty slot in the master file table
-	for(f = ftab, lf = &ftab[NR_FILE]; f < lf; f++)
-	{
-    	kernel_mutex_lock(&f->lock);
-		if(!f->refs)
-		{
-        	//f->refs++;
-            __sync_fetch_and_add(&(f->refs), 1);
-        	kernel_mutex_unlock(&f->lock);
-		    break;
-		}
-    	kernel_mutex_unlock(&f->lock);
-    }
-    
-	// master file table is full
-	if(f >= lf)
-	{
-		return -EMFILE;
-	}
-	
-	ct->ofiles->ofile[fd] = f;
+	fdassign(fd, f);
 	*_f = f;
 	*_fd = fd;
 	
@@ -137,6 +468,87 @@ long falloc(int *_fd, struct file_t **_f)
 }
 
 
+/*
+ * Allocate a user file descriptor, a file struct and an incore node for a
+ * pseudo-file (epoll, eventfd, timerfd, signalfd).
+ */
+long falloc_pseudo(int *_fd, struct file_t **_f, struct fs_node_t **_node,
+                   int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    volatile struct task_t *ct = this_core->cur_task;
+    long res;
+    int fd;
+
+    *_node = NULL;
+
+	if((res = falloc(&fd, &f)) != 0)
+	{
+	    return res;
+	}
+
+    if(!(node = get_empty_node()))
+    {
+    	fdfree(fd);
+    	file_free(f);
+    	return -ENOSPC;
+    }
+
+    node->mode = 0600;
+    node->uid = ct->euid;
+    node->gid = ct->egid;
+    node->read = dummyfs_read;
+    node->write = dummyfs_write;
+
+    // set the close-on-exec flag
+    if(flags & O_CLOEXEC)
+    {
+        cloexec_set(ct, fd);
+    }
+
+    f->mode = O_RDWR;
+    f->flags = O_RDWR | (flags & O_NONBLOCK);
+    f->refs = 1;
+    f->node = node;
+    f->pos = 0;
+
+    *_fd = fd;
+    *_f = f;
+    *_node = node;
+
+    return 0;
+}
+
+
+/*
+ * Install an open file in the first free slot of the current task's file
+ * table. The caller's reference on the file is handed over to the new
+ * descriptor (used to receive files passed over Unix sockets).
+ */
+long fdinstall(struct file_t *f, int flags)
+{
+    volatile struct task_t *ct = this_core->cur_task;
+    int fd;
+    long res;
+
+    if((res = fdalloc(0, &fd)) != 0)
+    {
+        return res;
+    }
+
+    fdassign(fd, f);
+
+    // set the close-on-exec flag
+    if(flags & O_CLOEXEC)
+    {
+        cloexec_set(ct, fd);
+    }
+
+    return fd;
+}
+
+
 long closef(struct file_t *f)
 {
     if(!f)
@@ -168,6 +580,12 @@ long closef(struct file_t *f)
 	{
         struct fs_node_t *node = f->node;
 
+        // remove the file from any epoll interest lists
+        if(f->epitems)
+        {
+            epoll_release_file(f);
+        }
+
         f->node = NULL;
 
 	    if(IS_SOCKET(node))
@@ -177,6 +595,22 @@ long closef(struct file_t *f)
             node->data = 0;
             node->links = 0;
 	    }
+	    else if(IS_EPOLL(node))
+	    {
+	        epoll_close(node);
+	    }
+	    else if(IS_EVENTFD(node))
+	    {
+	        eventfd_close(node);
+	    }
+	    else if(IS_TIMERFD(node))
+	    {
+	        timerfd_close(node);
+	    }
+	    else if(IS_SIGNALFD(node))
+	    {
+	        signalfd_close(node);
+	    }
 	    else if(S_ISCHR(node->mode))
 	    {
             if(MAJOR(node->blocks[0]) == PTY_SLAVE_MAJ)
@@ -216,6 +650,8 @@ long closef(struct file_t *f)
 
     	release_node(node);
 	}
+
+	file_free(f);
 	
 	return 0;
 }
@@ -59,6 +59,7 @@ static void update_function(void *arg)
         block_task2(&update_task, PIT_FREQUENCY * 30);
         update(NODEV);
         remove_old_dentries(TWO_MINUTES);
+        remove_old_names(FIVE_MINUTES);
     }
 }
 
@@ -70,8 +71,6 @@ void init_fstab(void)
 {
     memset(fstab, 0, sizeof(fstab));
     memset(mounttab, 0, sizeof(struct mount_info_t) * NR_SUPER);
-    memset(node_table, 0, sizeof(struct fs_node_t *) * NR_INODE);
-    memset(ftab, 0, sizeof(struct file_t) * NR_FILE);
     
     // we need to register this first in order to read initrd
     fs_register("ext2", &ext2fs_ops);
@@ -40,6 +40,7 @@
 #include <kernel/user.h>
 #include <kernel/clock.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <fs/iso9660fs.h>
 #include <fs/ext2.h>
 #include <fs/procfs.h>      // ALIGN_WORD
@@ -462,7 +463,7 @@ read:
         kfree(super);   \
         return err;
 
-    if(bdev_tab[maj].strategy(&req) < 0)
+    if(blk_submit(&req) < 0)
     {
         KDEBUG("iso9660fs_read_super: failed\n");
 
@@ -516,6 +516,12 @@ err:
 }
 
 
+static int file_on_dev(struct file_t *f, void *arg)
+{
+    return (f->node && f->node->dev == *(dev_t *)arg);
+}
+
+
 /*
  * Unmount the given device.
  *
@@ -531,7 +537,7 @@ err:
 long vfs_umount(dev_t dev, int flags)
 {
     struct mount_info_t *d;
-    struct file_t *f, *lf;
+    struct file_t *f;
     int fd;
     int force = (flags & MNT_FORCE /* MS_FORCE */);
 
@@ -547,47 +553,40 @@ long vfs_umount(dev_t dev, int flags)
     }
 
     // check for open files
-    for(f = ftab, lf = &ftab[NR_FILE]; f < lf; f++)
+    if(for_each_file(file_on_dev, &dev))
     {
-        kernel_mutex_lock(&f->lock);
-        
-        if(f->node && f->node->dev == dev)
+        if(!force)
         {
-            if(!force)
-            {
-            	kernel_mutex_unlock(&f->lock);
-			    return -EBUSY;
-			}
-			
-			// find the task that has this file open and screw it
-			// (you asked for forced unmount, didn't you?)
+            return -EBUSY;
+        }
+
+        // find the tasks that have files open on this device and screw them
+        // (you asked for forced unmount, didn't you?)
 
-            elevated_priority_lock(&task_table_lock);
+        elevated_priority_lock(&task_table_lock);
 
-            for_each_taskptr(t)
+        for_each_taskptr(t)
+        {
+            if(!*t)
             {
-                if(!*t)
+                continue;
+            }
+
+            elevated_priority_unlock(&task_table_lock);
+            
+            for(fd = 0; *t && fd < (*t)->ofiles->max_fds; fd++)
+            {
+                if((f = (*t)->ofiles->ofile[fd]) && f->node &&
+                   f->node->dev == dev)
                 {
-                    continue;
+                    syscall_close(fd);
                 }
-
-                elevated_priority_unlock(&task_table_lock);
-                
-            	for(fd = 0; fd < NR_OPEN; fd++)
-            	{
-            		if(*t && (*t)->ofiles->ofile[fd] == f)
-		            {
-			            syscall_close(fd);
-	                }
-	            }
-
-                elevated_priority_relock(&task_table_lock);
             }
 
-            elevated_priority_unlock(&task_table_lock);
-	    }
-	    
-	    kernel_mutex_unlock(&f->lock);
+            elevated_priority_relock(&task_table_lock);
+        }
+
+        elevated_priority_unlock(&task_table_lock);
     }
 
 
@@ -596,41 +595,10 @@ long vfs_umount(dev_t dev, int flags)
 
 
     // check for outstanding inodes
-    extern volatile struct kernel_mutex_t list_lock;
-    struct fs_node_t **node;
-    struct fs_node_t **llnode = &node_table[NR_INODE];
-
-    kernel_mutex_lock(&list_lock);
-
-    for(node = node_table; node < llnode; node++)
+    if(release_dev_nodes(dev, d->root, force) != 0)
     {
-        if(!*node)
-        {
-            continue;
-        }
-
-        kernel_mutex_lock(&(*node)->lock);
-        kernel_mutex_unlock(&(*node)->lock);
-
-        if((*node) &&
-           (*node)->refs &&        // if the node is being used ..
-           (*node)->inode != 0 &&  // and is a valid inode ..
-           (*node)->dev == dev &&  // and is from the same device ..
-           (*node) != d->root)     // and is not the root node, then release it
-        {
-            kernel_mutex_unlock(&list_lock);
-
-            if(!force)
-            {
-			    return -EBUSY;
-			}
-			
-			release_node(*node);
-            kernel_mutex_lock(&list_lock);
-	    }
-	}
-
-    kernel_mutex_unlock(&list_lock);
+        return -EBUSY;
+    }
 
 
     invalidate_dev_dentries(dev);
@@ -690,25 +658,9 @@ long vfs_umount(dev_t dev, int flags)
 
     remove_cached_disk_pages(dev);
 
-    // once again, ensure all refs to this device's mount info are invalidated
-    kernel_mutex_lock(&list_lock);
-
-    for(node = node_table; node < llnode; node++)
-    {
-        if(*node)
-        {
-            kernel_mutex_lock(&(*node)->lock);
-
-            if((*node)->dev == dev)
-            {
-                (*node)->minfo = NULL;
-    	    }
-
-            kernel_mutex_unlock(&(*node)->lock);
-	    }
-	}
-
-    kernel_mutex_unlock(&list_lock);
+    // once again, ensure all refs to this device's mount info are 
+    // invalidated, and drop the device's unused nodes from the cache
+    invalidate_dev_nodes(dev);
 
     return 0;
 }
@@ -22,7 +22,7 @@
 /**
  *  \file node.c
  *
- *  This file contains the master file node table, along with different 
+ *  This file contains the incore node cache, along with different 
  *  functions to read, write, update, and truncate file nodes.
  */
 
@@ -40,17 +40,349 @@
 #include <kernel/tty.h>
 #include <kernel/asm.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
 #include <fs/sockfs.h>
 #include <fs/pipefs.h>
 #include <fs/dentry.h>
 
-// file node table
-//struct fs_node_t node_table[NR_INODE];
-//static struct fs_node_t *last_alloc_node = node_table;
+/*
+ * The incore node cache.
+ *
+ * Nodes are hashed by (dev, inode). Nodes with no inode number yet (pipes,
+ * sockets, pseudo-files and nodes being created) live on a separate
+ * anonymous list. Each bucket has its own lock, which is taken before a
+ * node's lock.
+ *
+ * When the last reference to an on-disk node is released, the node is
+ * written out and kept in the cache on an LRU list of unused nodes, so
+ * the next lookup does not need to read it from disk again. Unused nodes
+ * are freed, oldest first, when there are more than NR_UNUSED_INODE of
+ * them, when we fail to allocate a new node, and when memory is low (see
+ * shrink_node_cache()). The LRU lock is taken after the bucket and node
+ * locks, so the shrinker only uses trylock to take those.
+ */
+struct node_bucket_t
+{
+    struct fs_node_t *head;
+    volatile struct kernel_mutex_t lock;
+};
+
+static struct node_bucket_t node_hash[NR_INODE_HASH];
+static struct node_bucket_t node_anon = { 0, };
+
+// unused nodes, most recently released first
+static struct fs_node_t *node_lru_head = NULL;
+static struct fs_node_t *node_lru_tail = NULL;
+static volatile struct kernel_mutex_t node_lru_lock = { 0, };
+
+volatile unsigned long nr_nodes = 0;
+volatile unsigned long nr_unused_nodes = 0;
+
+// slab cache for node structs
+static struct kmem_cache_t *fs_node_cache = NULL;
+
+
+/*
+ * Initialise the node slab cache.
+ */
+void init_nodes(void)
+{
+    if(!(fs_node_cache = kmem_cache_create("fs_node",
+                                           sizeof(struct fs_node_t), 0, NULL)))
+    {
+        kpanic("Failed to create node slab cache\n");
+    }
+}
+
+
+STATIC_INLINE struct node_bucket_t *node_bucket(dev_t dev, ino_t n)
+{
+    unsigned long h;
+
+    if(!dev || !n)
+    {
+        return &node_anon;
+    }
+
+    h = ((unsigned long)dev * 0x9e3779b1UL) ^ (unsigned long)n;
+    h ^= (h >> 16);
+    h *= 0x45d9f3bUL;
+    h ^= (h >> 16);
 
-struct fs_node_t *node_table[NR_INODE];
-//struct fs_node_t first_node = { 0, };
-volatile struct kernel_mutex_t list_lock = { 0, };
+    return &node_hash[h & (NR_INODE_HASH - 1)];
+}
+
+
+/*
+ * Add/remove a node to/from a hash bucket. The bucket must be locked.
+ */
+static void node_link(struct node_bucket_t *bucket, struct fs_node_t *node)
+{
+    if((node->hnext = bucket->head))
+    {
+        node->hnext->hpprev = &node->hnext;
+    }
+
+    bucket->head = node;
+    node->hpprev = &bucket->head;
+    node->hbucket = bucket;
+}
+
+
+static void node_unlink(struct fs_node_t *node)
+{
+    if((*node->hpprev = node->hnext))
+    {
+        node->hnext->hpprev = node->hpprev;
+    }
+
+    node->hnext = NULL;
+    node->hpprev = NULL;
+    node->hbucket = NULL;
+}
+
+
+/*
+ * Take a node off the unused LRU list. The node's bucket must be locked.
+ */
+static void node_lru_del(struct fs_node_t *node)
+{
+    if(!(node->flags & FS_NODE_UNUSED))
+    {
+        return;
+    }
+
+    kernel_mutex_lock(&node_lru_lock);
+
+    if(node->lru_prev)
+    {
+        node->lru_prev->lru_next = node->lru_next;
+    }
+    else
+    {
+        node_lru_head = node->lru_next;
+    }
+
+    if(node->lru_next)
+    {
+        node->lru_next->lru_prev = node->lru_prev;
+    }
+    else
+    {
+        node_lru_tail = node->lru_prev;
+    }
+
+    node->lru_next = NULL;
+    node->lru_prev = NULL;
+    __sync_and_and_fetch(&node->flags, ~FS_NODE_UNUSED);
+    __sync_fetch_and_sub(&nr_unused_nodes, 1);
+
+    kernel_mutex_unlock(&node_lru_lock);
+}
+
+
+/*
+ * Free an unused node. Its bucket must be locked.
+ */
+static void node_evict(struct fs_node_t *node)
+{
+    node_lru_del(node);
+    node_unlink(node);
+    __sync_fetch_and_sub(&nr_nodes, 1);
+    kmem_cache_free(fs_node_cache, node);
+}
+
+
+/*
+ * Add the node to the node hash table, once its dev and inode fields have
+ * been set by the caller (e.g. new nodes, and filesystem root nodes that
+ * are created using get_empty_node() and never read from disk).
+ */
+void hash_node(struct fs_node_t *node)
+{
+    struct node_bucket_t *bucket = node_bucket(node->dev, node->inode);
+    struct node_bucket_t *old;
+    struct fs_node_t *tmp, *next;
+
+    if((old = node->hbucket) == bucket)
+    {
+        return;
+    }
+
+    if(old)
+    {
+        kernel_mutex_lock(&old->lock);
+        node_unlink(node);
+        kernel_mutex_unlock(&old->lock);
+    }
+
+    kernel_mutex_lock(&bucket->lock);
+
+    // an unused node with the same number belongs to a deleted file whose
+    // inode number has been reused
+    for(tmp = bucket->head; tmp != NULL; tmp = next)
+    {
+        next = tmp->hnext;
+
+        if(tmp->dev == node->dev && tmp->inode == node->inode &&
+           !tmp->refs && (tmp->flags & FS_NODE_UNUSED) &&
+           !(tmp->flags & FS_NODE_KEEP_INCORE))
+        {
+            node_evict(tmp);
+        }
+    }
+
+    node_link(bucket, node);
+    kernel_mutex_unlock(&bucket->lock);
+}
+
+
+/*
+ * Free up to count unused nodes, oldest first. This is called when memory
+ * is running low, so we do not wait on any locks that might be held by
+ * someone who is waiting for memory.
+ *
+ * Returns the number of nodes freed.
+ */
+size_t shrink_node_cache(size_t count)
+{
+    struct fs_node_t *node, *prev;
+    struct node_bucket_t *bucket;
+    size_t freed = 0;
+
+    if(kernel_mutex_trylock(&node_lru_lock))
+    {
+        return 0;
+    }
+
+    for(node = node_lru_tail; node && freed < count; node = prev)
+    {
+        prev = node->lru_prev;
+        bucket = node->hbucket;
+
+        if(kernel_mutex_trylock(&bucket->lock))
+        {
+            continue;
+        }
+
+        if(node->refs || (node->flags & FS_NODE_KEEP_INCORE) ||
+           kernel_mutex_trylock(&node->lock))
+        {
+            kernel_mutex_unlock(&bucket->lock);
+            continue;
+        }
+
+        // take it off the LRU list here as we already hold the LRU lock
+        if(node->lru_prev)
+        {
+            node->lru_prev->lru_next = node->lru_next;
+        }
+        else
+        {
+            node_lru_head = node->lru_next;
+        }
+
+        if(node->lru_next)
+        {
+            node->lru_next->lru_prev = node->lru_prev;
+        }
+        else
+        {
+            node_lru_tail = node->lru_prev;
+        }
+
+        __sync_and_and_fetch(&node->flags, ~FS_NODE_UNUSED);
+        __sync_fetch_and_sub(&nr_unused_nodes, 1);
+
+        node_unlink(node);
+        kernel_mutex_unlock(&node->lock);
+        kernel_mutex_unlock(&bucket->lock);
+
+        __sync_fetch_and_sub(&nr_nodes, 1);
+        kmem_cache_free(fs_node_cache, node);
+        freed++;
+    }
+
+    kernel_mutex_unlock(&node_lru_lock);
+
+    return freed;
+}
+
+
+/*
+ * Keep a released node in the cache. Called when the last reference to
+ * an on-disk node is released, after the node has been written out.
+ */
+static void node_cache_unused(struct fs_node_t *node)
+{
+    struct node_bucket_t *bucket = node->hbucket;
+
+    kernel_mutex_lock(&bucket->lock);
+    kernel_mutex_lock(&node_lru_lock);
+
+    node->lru_prev = NULL;
+
+    if((node->lru_next = node_lru_head))
+    {
+        node->lru_next->lru_prev = node;
+    }
+    else
+    {
+        node_lru_tail = node;
+    }
+
+    node_lru_head = node;
+    __sync_or_and_fetch(&node->flags, FS_NODE_UNUSED);
+    __sync_fetch_and_add(&nr_unused_nodes, 1);
+
+    kernel_mutex_unlock(&node_lru_lock);
+
+    // now it can be found again
+    __sync_and_and_fetch(&node->flags, ~FS_NODE_STALE);
+    kernel_mutex_unlock(&bucket->lock);
+
+    if(nr_unused_nodes > NR_UNUSED_INODE)
+    {
+        shrink_node_cache(nr_unused_nodes - NR_UNUSED_INODE);
+    }
+}
+
+
+/*
+ * Check if released nodes of this device can be kept in the cache.
+ */
+static int node_is_cacheable(struct fs_node_t *node)
+{
+    struct mount_info_t *dinfo;
+
+    if(!node->dev || !node->inode || !node->hbucket ||
+       node->hbucket == &node_anon)
+    {
+        return 0;
+    }
+
+    if(!(dinfo = get_mount_info(node->dev)) || !dinfo->fs)
+    {
+        return 0;
+    }
+
+    return !(dinfo->fs->flags & FSINFO_FLAG_NOCACHE);
+}
+
+
+static void wait_for_node_update(struct fs_node_t *node,
+                                 struct node_bucket_t *bucket)
+{
+    volatile unsigned int flags = node->flags;
+
+    while(flags & FS_NODE_KEEP_INCORE)
+    {
+        kernel_mutex_unlock(&bucket->lock);
+        scheduler();
+        kernel_mutex_lock(&bucket->lock);
+        flags = node->flags;
+    }
+}
 
 
 /*
@@ -58,60 +390,215 @@ volatile struct kernel_mutex_t list_lock = { 0, };
  */
 void sync_nodes(dev_t dev)
 {
-    struct fs_node_t **node;
-    struct fs_node_t **llnode = &node_table[NR_INODE];
+    struct node_bucket_t *bucket, *lbucket = &node_hash[NR_INODE_HASH];
+    struct fs_node_t *node;
 
-    kernel_mutex_lock(&list_lock);
-    
-    for(node = node_table; node < llnode; node++)
+    for(bucket = node_hash; bucket < lbucket; bucket++)
     {
-        if(!(*node))
+        if(!bucket->head)
         {
             continue;
         }
 
-        //kernel_mutex_lock(&(*node)->lock);
+        kernel_mutex_lock(&bucket->lock);
 
-        if(dev != NODEV && (*node)->dev != dev)
+        for(node = bucket->head; node != NULL; node = node->hnext)
         {
-            //kernel_mutex_unlock(&(*node)->lock);
-            continue;
+            if(dev != NODEV && node->dev != dev)
+            {
+                continue;
+            }
+
+            // unused nodes were written out when they were released
+            if(!node->refs && !(node->flags & FS_NODE_DIRTY))
+            {
+                continue;
+            }
+
+            // this stops the node from being removed from the bucket
+            __sync_or_and_fetch(&node->flags, FS_NODE_KEEP_INCORE);
+            kernel_mutex_unlock(&bucket->lock);
+            kernel_mutex_lock(&node->lock);
+
+            if(node->dev && /* (node->flags & FS_NODE_DIRTY) && */ 
+                !IS_PIPE(node) && !(node->flags & FS_NODE_STALE))
+            {
+                KDEBUG("sync_nodes: dev 0x%x, n 0x%x\n", node->dev, node->inode);
+                write_node(node);
+            }
+
+            __sync_and_and_fetch(&node->flags, ~FS_NODE_KEEP_INCORE);
+            kernel_mutex_unlock(&node->lock);
+            kernel_mutex_lock(&bucket->lock);
         }
 
-        __sync_or_and_fetch(&(*node)->flags, FS_NODE_KEEP_INCORE);
-        kernel_mutex_unlock(&list_lock);
-        kernel_mutex_lock(&(*node)->lock);
+        kernel_mutex_unlock(&bucket->lock);
+    }
+}
+
+
+/*
+ * Release all the nodes of a device that are still in use (except for the
+ * given root node). Called when unmounting a filesystem. If force is zero,
+ * we bail out with -EBUSY instead.
+ */
+long release_dev_nodes(dev_t dev, struct fs_node_t *root, int force)
+{
+    struct node_bucket_t *bucket, *lbucket = &node_hash[NR_INODE_HASH];
+    struct fs_node_t *node, **done = NULL, **tmp;
+    size_t i, ndone = 0, maxdone = 0;
+
+    for(bucket = node_hash; bucket < lbucket; bucket++)
+    {
+
+loop:
+
+        kernel_mutex_lock(&bucket->lock);
 
-        if((*node)->dev && /* ((*node)->flags & FS_NODE_DIRTY) && */ 
-            !IS_PIPE((*node)) && !((*node)->flags & FS_NODE_STALE))
+        for(node = bucket->head; node != NULL; node = node->hnext)
         {
-            KDEBUG("sync_nodes: dev 0x%x, n 0x%x\n", (*node)->dev, (*node)->inode);
-			write_node((*node));
-	    }
+            if(!node->refs ||           // if the node is being used ..
+               node->dev != dev ||      // and is from the same device ..
+               node == root)            // and is not the root node
+            {
+                continue;
+            }
 
-        __sync_and_and_fetch(&(*node)->flags, ~FS_NODE_KEEP_INCORE);
-        kernel_mutex_unlock(&(*node)->lock);
-        kernel_mutex_lock(&list_lock);
-	}
+            // release each node once (it might still be referenced
+            // afterwards, e.g. by the page cache)
+            for(i = 0; i < ndone; i++)
+            {
+                if(done[i] == node)
+                {
+                    break;
+                }
+            }
+
+            if(i < ndone)
+            {
+                continue;
+            }
+
+            kernel_mutex_unlock(&bucket->lock);
+
+            if(!force)
+            {
+                return -EBUSY;
+            }
+
+            if(ndone == maxdone)
+            {
+                maxdone = maxdone ? maxdone * 2 : 64;
+
+                if(!(tmp = krealloc(done, maxdone * sizeof(*done))))
+                {
+                    kfree(done);
+                    return -ENOMEM;
+                }
 
-    kernel_mutex_unlock(&list_lock);
+                done = tmp;
+            }
+
+            done[ndone++] = node;
+
+            // the node might be gone after this, so start over
+            release_node(node);
+            goto loop;
+        }
+
+        kernel_mutex_unlock(&bucket->lock);
+    }
+
+    if(done)
+    {
+        kfree(done);
+    }
+
+    return 0;
 }
 
 
-long files_referencing_node(struct fs_node_t *node)
+/*
+ * Free the unused nodes of an unmounted device and invalidate the mount
+ * info of the remaining ones.
+ */
+void invalidate_dev_nodes(dev_t dev)
 {
-    struct file_t *f, *lf;
-    long refs = 0;
+    struct node_bucket_t *bucket, *lbucket = &node_hash[NR_INODE_HASH];
+    struct fs_node_t *node, *next;
 
-    for(f = ftab, lf = &ftab[NR_FILE]; f < lf; f++)
+    for(bucket = node_hash; bucket < lbucket; bucket++)
     {
-        if(f->node == node)
+        if(!bucket->head)
         {
-            refs++;
+            continue;
         }
+
+        kernel_mutex_lock(&bucket->lock);
+
+        for(node = bucket->head; node != NULL; node = next)
+        {
+            next = node->hnext;
+
+            if(node->dev != dev)
+            {
+                continue;
+            }
+
+            if(!node->refs && (node->flags & FS_NODE_UNUSED) &&
+               !(node->flags & FS_NODE_KEEP_INCORE))
+            {
+                node_evict(node);
+                continue;
+            }
+
+            kernel_mutex_lock(&node->lock);
+            node->minfo = NULL;
+            kernel_mutex_unlock(&node->lock);
+        }
+
+        kernel_mutex_unlock(&bucket->lock);
     }
+}
 
-    return refs;
+
+/*
+ * Get the number of nodes in the cache and how many of them are in use.
+ */
+void node_cache_stats(unsigned long *total, unsigned long *active)
+{
+    *total = nr_nodes;
+    *active = nr_nodes - nr_unused_nodes;
+}
+
+
+struct node_files_t
+{
+    struct fs_node_t *node;
+    long refs;
+};
+
+
+static int count_node_files(struct file_t *f, void *arg)
+{
+    struct node_files_t *nf = (struct node_files_t *)arg;
+
+    if(f->node == nf->node)
+    {
+        nf->refs++;
+    }
+
+    return 0;
+}
+
+
+long files_referencing_node(struct fs_node_t *node)
+{
+    struct node_files_t nf = { node, 0 };
+
+    for_each_file(count_node_files, &nf);
+
+    return nf.refs;
 }
 
 
@@ -152,57 +639,34 @@ static void zero_out_node(struct fs_node_t *node)
 }
 
 
-static void wait_for_node_update(struct fs_node_t *node)
+static void remove_from_list(struct fs_node_t *node)
 {
-    volatile unsigned int flags = node->flags;
+    struct node_bucket_t *bucket;
 
-    while(flags & FS_NODE_KEEP_INCORE)
+    if(!(bucket = node->hbucket))
     {
-        kernel_mutex_unlock(&list_lock);
-        scheduler();
-        kernel_mutex_lock(&list_lock);
-        flags = node->flags;
+        switch_tty(1);
+        printk("\n\n*** dev 0x%x, node 0x%x, refs %d, flags 0x%x, links %d\n", node->dev, node->inode, node->refs, node->flags, node->links);
+        printk("*** pipe %d, sock %d\n", IS_PIPE(node), IS_SOCKET(node));
+        printk("*** select 0x%lx, poll 0x%lx, read 0x%lx, write 0x%lx\n", node->select, node->poll, node->read, node->write);
+        kpanic("\n\n*** node not found in table!!!!\n\n");
     }
-}
-
 
-static void remove_from_list(struct fs_node_t *node)
-{
-    struct fs_node_t **tmp;
-    struct fs_node_t **llnode = &node_table[NR_INODE];
-
-    kernel_mutex_lock(&list_lock);
+    kernel_mutex_lock(&bucket->lock);
+    wait_for_node_update(node, bucket);
+    node_lru_del(node);
+    node_unlink(node);
+    kernel_mutex_unlock(&bucket->lock);
 
-    for(tmp = node_table; tmp < llnode; tmp++)
+    if(node->refs != 0)
     {
-        if(*tmp == node)
-        {
-            //kpanic("\n\n*** freeing node!!!!\n\n");
-            wait_for_node_update(*tmp);
-            *tmp = NULL;
-            kernel_mutex_unlock(&list_lock);
-
-            if(node->refs != 0)
-            {
-                switch_tty(1);
-                printk("\n\n*** dev 0x%x, node 0x%x, refs %d, flags 0x%x, links %d\n\n", node->dev, node->inode, node->refs, node->flags, node->links);
-                kpanic("*** invalid node\n");
-            }
-
-            kfree(node);
-            return;
-        }
+        switch_tty(1);
+        printk("\n\n*** dev 0x%x, node 0x%x, refs %d, flags 0x%x, links %d\n\n", node->dev, node->inode, node->refs, node->flags, node->links);
+        kpanic("*** invalid node\n");
     }
 
-    kernel_mutex_unlock(&list_lock);
-
-    switch_tty(1);
-    printk("\n\n*** dev 0x%x, node 0x%x, refs %d, flags 0x%x, links %d\n", node->dev, node->inode, node->refs, node->flags, node->links);
-    printk("*** pipe %d, sock %d\n", IS_PIPE(node), IS_SOCKET(node));
-    printk("*** select 0x%lx, poll 0x%lx, read 0x%lx, write 0x%lx\n", node->select, node->poll, node->read, node->write);
-    //printk("*** sig %c%c%c%c\n\n", node->sig[0], node->sig[1], node->sig[2], node->sig[3]);
-    kpanic("\n\n*** node not found in table!!!!\n\n");
-
+    __sync_fetch_and_sub(&nr_nodes, 1);
+    kmem_cache_free(fs_node_cache, node);
 }
 
 
@@ -233,7 +697,7 @@ void release_node(struct fs_node_t *node)
     if(IS_PIPE(node))
     {
         kernel_mutex_unlock(&node->lock);
-        selwakeup(&node->select_channel);   // wakeup readers/writers
+        pipefs_hangup(node);                // wakeup readers/writers
 
         if(node->refs == 0)
         {
@@ -244,6 +708,20 @@ void release_node(struct fs_node_t *node)
         return;
     }
 
+    // pseudo-file nodes are not on disk, their data is freed on last close
+    // (see closef())
+    if(IS_PSEUDO_NODE(node))
+    {
+        kernel_mutex_unlock(&node->lock);
+
+        if(node->refs == 0)
+        {
+            remove_from_list(node);
+        }
+
+        return;
+    }
+
     if(IS_SOCKET(node))
     {
         if(!(node->flags & FS_NODE_SOCKET_ONDISK))
@@ -330,6 +808,14 @@ void release_node(struct fs_node_t *node)
             KDEBUG("%s: dev 0x%x, ino 0x%x\n", __func__, node->dev, node->inode);
             write_node(node);
         }
+
+        // keep it around in case someone wants it again soon
+        if(node_is_cacheable(node))
+        {
+            disk_updater_enable();
+            node_cache_unused(node);
+            return;
+        }
     }
 
     disk_updater_enable();
@@ -342,190 +828,179 @@ void release_node(struct fs_node_t *node)
  */
 int node_is_incore(dev_t dev, ino_t n)
 {
-    struct fs_node_t **node;
-    struct fs_node_t **llnode = &node_table[NR_INODE];
+    struct node_bucket_t *bucket = node_bucket(dev, n);
+    struct fs_node_t *node;
 
-    kernel_mutex_lock(&list_lock);
+    kernel_mutex_lock(&bucket->lock);
     
-    for(node = node_table; node < llnode; node++)
+    for(node = bucket->head; node != NULL; node = node->hnext)
     {
-        if((*node) && (*node)->refs && (*node)->inode == n && (*node)->dev == dev)
+        if(node->refs && node->inode == n && node->dev == dev)
         {
-            kernel_mutex_unlock(&list_lock);
+            kernel_mutex_unlock(&bucket->lock);
             return 1;
 	    }
 	}
 	
-    kernel_mutex_unlock(&list_lock);
+    kernel_mutex_unlock(&bucket->lock);
 	return 0;
 }
 
 
-struct fs_node_t *get_empty_node(void)
+static struct fs_node_t *alloc_node(void)
 {
     struct fs_node_t *node;
-    struct fs_node_t **tmp;
-    struct fs_node_t **llnode = &node_table[NR_INODE];
-    volatile unsigned long long older_than_ticks = TWO_MINUTES;
 
-    if(!(node = kmalloc(sizeof(struct fs_node_t))))
+    if(!(node = kmem_cache_alloc(fs_node_cache)))
     {
-        return NULL;
-    }
-
-    A_memset(node, 0, sizeof(struct fs_node_t));
-    __lock_xchg_int(&node->refs, 1);
-    //node->refs = 1;
-
-try:
-
-    kernel_mutex_lock(&list_lock);
-
-    for(tmp = node_table; tmp < llnode; tmp++)
-    {
-        if(!(*tmp))
-        {
-            *tmp = node;
-            kernel_mutex_unlock(&list_lock);
-            return node;
-        }
-    }
-
-    kernel_mutex_unlock(&list_lock);
-
-    if(older_than_ticks != 0)
-    {
-        //if(older_than_ticks == TWO_MINUTES)
+        // try to free some unused nodes and try again
+        if(shrink_node_cache(NR_UNUSED_INODE / 4) == 0)
         {
             flush_cached_pages(NODEV);
+            remove_unreferenced_cached_pages(NULL);
+            remove_old_cached_pages(-1, TWO_MINUTES);
         }
 
-        remove_unreferenced_cached_pages(NULL);
-        remove_old_cached_pages(-1, older_than_ticks);
-        older_than_ticks = 0;
-
-        /*
-        if(older_than_ticks > ONE_MINUTE)
+        if(!(node = kmem_cache_alloc(fs_node_cache)))
         {
-            older_than_ticks -= ONE_MINUTE;
-        }
-        else
-        {
-            older_than_ticks -= 15 * PIT_FREQUENCY;
+            return NULL;
         }
-        */
-
-        goto try;
     }
 
+    A_memset(node, 0, sizeof(struct fs_node_t));
+    __lock_xchg_int(&node->refs, 1);
+    //node->refs = 1;
+    __sync_fetch_and_add(&nr_nodes, 1);
+
+    return node;
+}
+
 
+struct fs_node_t *get_empty_node(void)
+{
+    struct fs_node_t *node;
 
-    switch_tty(1);
-    printk("\n");
-    for(tmp = node_table; tmp < llnode; tmp++)
+    if(!(node = alloc_node()))
     {
-        if(*tmp) printk("%x:%x,", (*tmp)->dev, (*tmp)->inode);
-        else printk("0:0,");
+        return NULL;
     }
-    print_cache_stats();
-    kpanic("*** get_node()\n");
-
 
+    kernel_mutex_lock(&node_anon.lock);
+    node_link(&node_anon, node);
+    kernel_mutex_unlock(&node_anon.lock);
 
-    kfree(node);
-    return NULL;
+    return node;
 }
 
 
 struct fs_node_t *get_node(dev_t dev, ino_t n, int flags)
 {
     int follow_mpoints = (flags & GETNODE_FOLLOW_MPOINTS);
+    struct node_bucket_t *bucket;
+    struct fs_node_t *res, *node, *newnode = NULL;
 
     if(!dev || !n)
     {
         return NULL;
     }
 
-    struct fs_node_t *res, **node = node_table;
-    struct fs_node_t **lnode = &node_table[NR_INODE];
+    bucket = node_bucket(dev, n);
 
-    kernel_mutex_lock(&list_lock);
+loop:
 
-    while(node < lnode)
+    kernel_mutex_lock(&bucket->lock);
+
+    for(node = bucket->head; node != NULL; node = node->hnext)
     {
         // not the node we want
-        if(*node == NULL || (*node)->dev != dev || (*node)->inode != n)
+        if(node->dev != dev || node->inode != n)
         {
-            node++;
             continue;
         }
         
         // we found it! wait until it is unlocked
-        //__sync_or_and_fetch(&node->flags, FS_NODE_WANTED);
-        kernel_mutex_lock(&(*node)->lock);
+        kernel_mutex_lock(&node->lock);
 
-        if((*node)->flags & FS_NODE_STALE)
+        if(node->flags & FS_NODE_STALE)
         {
-            kernel_mutex_unlock(&(*node)->lock);
-            kernel_mutex_unlock(&list_lock);
+            kernel_mutex_unlock(&node->lock);
+            kernel_mutex_unlock(&bucket->lock);
 
             if(flags & GETNODE_IGNORE_STALE)
             {
+                if(newnode)
+                {
+                    __sync_fetch_and_sub(&nr_nodes, 1);
+                    kmem_cache_free(fs_node_cache, newnode);
+                }
+
                 return NULL;
             }
 
             scheduler();
-
-            kernel_mutex_lock(&list_lock);
-            node = node_table;
-            continue;
+            goto loop;
         }
         
         // make sure no one changed it while we slept
-        if((*node)->dev != dev || (*node)->inode != n)
+        if(node->dev != dev || node->inode != n)
         {
             // shit! start again from the top
-            kernel_mutex_unlock(&(*node)->lock);
-            node = node_table;
-            continue;
+            kernel_mutex_unlock(&node->lock);
+            kernel_mutex_unlock(&bucket->lock);
+            goto loop;
         }
+
+        // it is in use again
+        node_lru_del(node);
         
         // is it a mount point?
-        if(((*node)->flags & FS_NODE_MOUNTPOINT) && follow_mpoints)
+        if((node->flags & FS_NODE_MOUNTPOINT) && follow_mpoints)
         {
-            res = (*node)->ptr;
-            kernel_mutex_unlock(&(*node)->lock);
+            res = node->ptr;
+            kernel_mutex_unlock(&node->lock);
             
-            if(!res)
+            if(res)
             {
-                kernel_mutex_unlock(&list_lock);
-                return NULL;
+                //res->refs++;
+                __sync_fetch_and_add(&res->refs, 1);
             }
-
-            //res->refs++;
-            __sync_fetch_and_add(&res->refs, 1);
         }
         else
         {
-            res = (*node);
+            res = node;
             //res->refs++;
             __sync_fetch_and_add(&res->refs, 1);
-            kernel_mutex_unlock(&(*node)->lock);
+            kernel_mutex_unlock(&node->lock);
         }
         
-        kernel_mutex_unlock(&list_lock);
+        kernel_mutex_unlock(&bucket->lock);
+
+        // someone else read the node while we were allocating ours
+        if(newnode)
+        {
+            __sync_fetch_and_sub(&nr_nodes, 1);
+            kmem_cache_free(fs_node_cache, newnode);
+        }
+
         return res;
     }
 
-    kernel_mutex_unlock(&list_lock);
-    
-    // node not found - get an empty node
-    if(!(res = get_empty_node()))
+    // node not found - get an empty node and search again, as someone might
+    // have added the node while we slept
+    if(!newnode)
     {
-        kpanic("\nget_node - 1!!\n");
-        return NULL;
+        kernel_mutex_unlock(&bucket->lock);
+
+        if(!(newnode = alloc_node()))
+        {
+            printk("get_node: failed to alloc node\n");
+            return NULL;
+        }
+
+        goto loop;
     }
-    
+
+    res = newnode;
     kernel_mutex_lock(&res->lock);
 
     //printk("get_node: 1 lock 0x%lx, me 0x%lx, holder 0x%lx\n", &res->lock, this_core->cur_task, res->lock.holder);
@@ -534,30 +1009,23 @@ struct fs_node_t *get_node(dev_t dev, ino_t n, int flags)
     res->inode = n;
     // make it stale for now so no one can use it until we read it from disk
     __sync_or_and_fetch(&res->flags, FS_NODE_STALE);
-    KDEBUG("get_node - trying to read node: dev 0x%x, node 0x%x\n", node->dev, node->inode);
+    node_link(bucket, res);
+    kernel_mutex_unlock(&bucket->lock);
+
+    KDEBUG("get_node - trying to read node: dev 0x%x, node 0x%x\n", res->dev, res->inode);
 
     // read the node from disk
     if(read_node(res) < 0)
     {
-        res->dev = 0;
-        res->inode = 0;
         kpanic("get_node - 2!!\n");
-        kernel_mutex_unlock(&res->lock);
-
-        kernel_mutex_lock(&list_lock);
 
-        for(node = node_table; node < lnode; node++)
-        {
-            if(*node == res)
-            {
-                wait_for_node_update(*node);
-                *node = NULL;
-                kfree(res);
-                break;
-            }
-        }
+        kernel_mutex_lock(&bucket->lock);
+        node_unlink(res);
+        kernel_mutex_unlock(&bucket->lock);
 
-        kernel_mutex_unlock(&list_lock);
+        kernel_mutex_unlock(&res->lock);
+        __sync_fetch_and_sub(&nr_nodes, 1);
+        kmem_cache_free(fs_node_cache, res);
 
         return NULL;
     }
@@ -584,6 +1052,12 @@ long read_node(struct fs_node_t *node)
     
     //struct mount_info_t *dinfo = node_mount_info(node);
     struct mount_info_t *dinfo = get_mount_info(node->dev);
+
+    // a new dir might reuse this inode number
+    if(S_ISDIR(node->mode))
+    {
+        namecache_purge_dir(node->dev, node->inode);
+    }
     long res;
 
     if(!dinfo)
@@ -778,6 +1252,10 @@ struct fs_node_t *new_node(dev_t dev)
 
     KDEBUG("new_node: res = %d\n", res);
     __lock_xchg_int(&node->refs, 1);
+
+    // the filesystem has given the node an inode number
+    hash_node(node);
+
     //node->refs = 1;
     node->links = 1;
     time_t t = now();
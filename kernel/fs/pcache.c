@@ -33,23 +33,94 @@
 #include <kernel/pcache.h>
 #include <kernel/mutex.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <kernel/task.h>
+#include <kernel/vfs.h>
 #include <mm/kheap.h>
 #include <mm/kstack.h>
+#include <mm/slab.h>
 
 #include "../kernel/task_funcs.c"
 
 
-#define INIT_HASHSZ             2048
-struct hashtab_t *pcachetab = NULL;
-volatile struct kernel_mutex_t pcachetab_lock = { 0, };
+// slab cache for page cache entries
+static struct kmem_cache_t *cached_page_cache = NULL;
 
 #include "pcache_internal.h"
 
-#define FILL_ZEROES(k, s)             \
-{                                     \
-    uint8_t i, *a = (uint8_t *)k;     \
-    for(i = 0; i < s; i++) a[i] = 0;  \
+/*
+ * Initialise the pcache table.
+ */
+void init_pcache(void)
+{
+    int i;
+
+    for(i = 0; i < PCACHE_SHARDS; i++)
+    {
+        if(!(pcache_shards[i].buckets = 
+                kmalloc(PCACHE_INIT_BUCKETS * sizeof(struct cached_page_t *))))
+        {
+            kpanic("Failed to initialise kernel page cache table\n");
+        }
+
+        A_memset(pcache_shards[i].buckets, 0, 
+                 PCACHE_INIT_BUCKETS * sizeof(struct cached_page_t *));
+        pcache_shards[i].nbuckets = PCACHE_INIT_BUCKETS;
+        init_kernel_mutex(&pcache_shards[i].lock);
+    }
+
+    if(!(cached_page_cache = kmem_cache_create("cached_page",
+                                    sizeof(struct cached_page_t), 0, NULL)))
+    {
+        kpanic("Failed to create page cache slab caches\n");
+    }
+}
+
+
+/*
+ * Double the size of a shard's hash table. We allocate the new table before
+ * locking the shard, as allocating memory might make us reclaim cached pages.
+ */
+static void pcache_grow_shard(struct pcache_shard_t *shard)
+{
+    struct cached_page_t **buckets, **old, *pcache, *next;
+    unsigned long i, j, nbuckets = shard->nbuckets * 2;
+    uint32_t hash;
+
+    if(!(buckets = kmalloc(nbuckets * sizeof(struct cached_page_t *))))
+    {
+        return;
+    }
+
+    A_memset(buckets, 0, nbuckets * sizeof(struct cached_page_t *));
+    kernel_mutex_lock(&shard->lock);
+
+    // someone else has already done it
+    if(shard->nbuckets >= nbuckets)
+    {
+        kernel_mutex_unlock(&shard->lock);
+        kfree(buckets);
+        return;
+    }
+
+    old = shard->buckets;
+
+    for(i = 0; i < shard->nbuckets; i++)
+    {
+        for(pcache = old[i]; pcache != NULL; pcache = next)
+        {
+            next = pcache->next;
+            pcache_shard(pcache->dev, pcache->ino, pcache->offset, &hash);
+            j = (hash >> PCACHE_SHARD_BITS) & (nbuckets - 1);
+            pcache->next = buckets[j];
+            buckets[j] = pcache;
+        }
+    }
+
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+    kernel_mutex_unlock(&shard->lock);
+    kfree(old);
 }
 
 
@@ -66,8 +137,17 @@ static inline void release_page_memory(struct cached_page_t *pcache)
             kpanic("pcache: infinite loop\n");
         }
 
+        pt_entry *e = get_page_entry((void *) pcache->virt);
+
         dec_frame_shares(pcache->phys);
-        vmmngr_free_page(get_page_entry((void *) pcache->virt));
+
+        // evicted pages are cold, so they should be the last to be reused
+        if(e)
+        {
+            pmmngr_free_block_cold((void *)PTE_FRAME(*e));
+            *e = 0;
+        }
+
         vmmngr_flush_tlb_entry(pcache->virt);
     }
 
@@ -94,32 +174,67 @@ static inline void release_page_memory(struct cached_page_t *pcache)
     }
     
     A_memset(pcache, 0, sizeof(struct cached_page_t));
-    kfree(pcache);
+    kmem_cache_free(cached_page_cache, pcache);
     __asm__ __volatile__("":::"memory");
 }
 
 
-void free_cached_page(struct pcache_key_t *pkey, struct cached_page_t *pcache)
+
+/*
+ * Release the pages on the given list (linked by their next fields). The
+ * pages must have been unlinked from the cache by calling pcache_unlink().
+ */
+static void release_page_list(struct cached_page_t *pcache)
+{
+    struct cached_page_t *next;
+
+    for( ; pcache != NULL; pcache = next)
+    {
+        next = pcache->next;
+        release_page_memory(pcache);
+    }
+}
+
+
+void free_cached_page(struct cached_page_t *pcache)
 {
-    kernel_mutex_lock(&pcachetab_lock);
+    struct pcache_shard_t *shard = pcache_shard_of(pcache);
+
+    kernel_mutex_lock(&shard->lock);
 
     if(get_frame_shares(pcache->phys) > 1)
     {
         __sync_and_and_fetch(&pcache->flags, ~PCACHE_FLAG_BUSY);
-        kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
         printk("pcache: postponing page removal\n");
         return;
     }
 
-    pcache_remove(pcachetab, pkey);
-    kfree(pkey);
+    pcache_unlink(shard, pcache);
+    kernel_mutex_unlock(&shard->lock);
     release_page_memory(pcache);
-    kernel_mutex_unlock(&pcachetab_lock);
+}
+
+
+void wakeup_cached_page_waiters(struct cached_page_t *pcache)
+{
+    struct pcache_shard_t *shard = pcache_shard_of(pcache);
+    int wanted = (pcache->flags & PCACHE_FLAG_WANTED);
+
+    kernel_mutex_lock(&shard->lock);
+    __sync_and_and_fetch(&pcache->flags, ~(PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED));
+    kernel_mutex_unlock(&shard->lock);
+
+    if(wanted)
+    {
+        unblock_tasks(pcache);
+    }
 }
 
 
 void release_cached_page(struct cached_page_t *pcache)
 {
+    struct pcache_shard_t *shard;
     int wanted;
 
     if(!pcache)
@@ -134,55 +249,73 @@ void release_cached_page(struct cached_page_t *pcache)
         return;
     }
 
-    kernel_mutex_lock(&pcachetab_lock);
+    shard = pcache_shard_of(pcache);
+    kernel_mutex_lock(&shard->lock);
     __sync_and_and_fetch(&pcache->flags, ~(PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED));
     dec_frame_shares(pcache->phys);
-    kernel_mutex_unlock(&pcachetab_lock);
+    kernel_mutex_unlock(&shard->lock);
     __asm__ __volatile__("":::"memory");
 
     if(wanted)
     {
         unblock_tasks(pcache);
     }
-    /*
-    else if(get_frame_shares(pcache->phys) <= 1)
+}
+
+
+/*
+ * Take a reference to a cached page's frame so it can be held (e.g. by a
+ * pipe) after the page is released. Returns NULL if the page cannot be read.
+ */
+struct cached_page_t *get_cached_page_ref(struct fs_node_t *node, off_t offset)
+{
+    struct cached_page_t *pcache;
+
+    if(!(pcache = get_cached_page(node, offset, 0)))
     {
-        // This might not be the best idea as it involves re-reading pages
-        // if they are needed after they are released. Here we release the 
-        // page once the last reference is removed to free memory and ensure
-        // changes are flushed to disk
-        volatile struct hashtab_item_t *hitem;
-        struct pcache_key_t key, *pkey;
+        return NULL;
+    }
 
-        if(pcache->flags & (PCACHE_FLAG_ALWAYS_DIRTY | PCACHE_FLAG_DIRTY))
-        {
-            __sync_and_and_fetch(&pcache->flags, ~PCACHE_FLAG_DIRTY);
-            sync_cached_page(pcache);
-        }
+    // keep our frame share but let others use the page
+    wakeup_cached_page_waiters(pcache);
 
-        if(!(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED | PCACHE_FLAG_DIRTY)))
-        {
-            FILL_ZEROES(&key, sizeof(struct pcache_key_t));
-            key.dev = pcache->dev;
-            key.ino = pcache->ino;
-            key.offset = pcache->offset;
+    return pcache;
+}
 
-            kernel_mutex_lock(&pcachetab_lock);
-            hitem = pcache_lookup(pcachetab, &key);
 
-            if(hitem)
-            {
-                pkey = hitem->key;
-                pcache_remove(pcachetab, pkey);
-                kfree(pkey);
-                release_page_memory(pcache);
-            }
+/*
+ * Take another reference to a page we already hold a reference to.
+ */
+int dup_cached_page_ref(struct cached_page_t *pcache)
+{
+    struct pcache_shard_t *shard = pcache_shard_of(pcache);
 
-            kernel_mutex_unlock(&pcachetab_lock);
-            __asm__ __volatile__("":::"memory");
-        }
+    kernel_mutex_lock(&shard->lock);
+
+    // the share count is 8-bit wide, leave some room for mmap and others
+    if(get_frame_shares(pcache->phys) >= PCACHE_MAX_REFS)
+    {
+        kernel_mutex_unlock(&shard->lock);
+        return -EOVERFLOW;
     }
-    */
+
+    inc_frame_shares(pcache->phys);
+    kernel_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+
+/*
+ * Drop a reference taken by get_cached_page_ref() or dup_cached_page_ref().
+ */
+void put_cached_page_ref(struct cached_page_t *pcache)
+{
+    struct pcache_shard_t *shard = pcache_shard_of(pcache);
+
+    kernel_mutex_lock(&shard->lock);
+    dec_frame_shares(pcache->phys);
+    kernel_mutex_unlock(&shard->lock);
 }
 
 
@@ -201,17 +334,131 @@ void release_cached_page(struct cached_page_t *pcache)
 */
 
 
+/*
+ * A batch of disk requests that are queued together, so the block layer
+ * can merge and sort them before they go to the disk.
+ */
+struct pcache_io_t
+{
+    struct blk_plug_t plug;
+    struct disk_req_t *reqs;
+    int nreqs, maxreqs;
+    int err;
+};
+
+// the most requests one page can need (one per disk block)
+#define PCACHE_PAGE_MAXREQS     (PAGE_SIZE / 512)
+
+// dirty pages written out together by flush_dirty_pages()
+#define PCACHE_FLUSH_BATCH      32
+
+
+static inline void pcache_start_io(struct pcache_io_t *io,
+                                   struct disk_req_t *reqs, int maxreqs)
+{
+    blk_start_plug(&io->plug);
+    io->reqs = reqs;
+    io->nreqs = 0;
+    io->maxreqs = maxreqs;
+    io->err = 0;
+}
+
+
+/*
+ * Queue the batched requests and wait for all of them. The result of each
+ * request is left in its res field. Returns -EIO if any request failed.
+ */
+static int pcache_wait_io(struct pcache_io_t *io)
+{
+    int i;
+
+    blk_finish_plug(&io->plug);
+
+    for(i = 0; i < io->nreqs; i++)
+    {
+        if(blk_wait_req(&io->reqs[i]) < 0)
+        {
+            io->err = -EIO;
+        }
+    }
+
+    return io->err;
+}
+
+
+static void pcache_queue_req(struct pcache_io_t *io, dev_t dev,
+                             size_t blockno, size_t blocksz,
+                             virtual_addr virt, size_t len, int write)
+{
+    struct disk_req_t *req;
+
+    // batch is full, get it out of the way
+    if(io->nreqs == io->maxreqs)
+    {
+        pcache_wait_io(io);
+        blk_start_plug(&io->plug);
+        io->nreqs = 0;
+    }
+
+    req = &io->reqs[io->nreqs++];
+    req->dev = dev;
+    req->data = virt;
+    req->datasz = len;
+    req->fs_blocksz = blocksz;
+    req->blockno = blockno;
+    req->write = write;
+    blk_plug_req(&io->plug, req);
+}
+
+
+/*
+ * Queue one request for each run of consecutive disk blocks backing the
+ * buffer at virt. Holes (zero block numbers) are skipped when writing, and
+ * read as zeroes.
+ */
+static void pcache_queue_blocks(struct pcache_io_t *io, dev_t dev,
+                                size_t *disk_block, int nblocks,
+                                size_t blocksz, virtual_addr virt, int write)
+{
+    int i, j;
+
+    for(i = 0; i < nblocks; i = j)
+    {
+        if(!disk_block[i])
+        {
+            if(!write)
+            {
+                A_memset((void *)(virt + (i * blocksz)), 0, blocksz);
+            }
+
+            j = i + 1;
+            continue;
+        }
+
+        for(j = i + 1; j < nblocks; j++)
+        {
+            if(disk_block[j] != disk_block[j - 1] + 1)
+            {
+                break;
+            }
+        }
+
+        pcache_queue_req(io, dev, disk_block[i], blocksz,
+                         virt + (i * blocksz), (j - i) * blocksz, write);
+    }
+}
+
+
 struct cached_page_t *get_cached_page(struct fs_node_t *node, 
                                       off_t offset, int flags)
 {
-    struct cached_page_t *pcache;
+    struct cached_page_t *pcache, *newpage = NULL;
+    struct pcache_shard_t *shard;
     struct mount_info_t *d;
     struct disk_req_t req;
     struct ustat ubuf;
-    int maj = MAJOR(node->dev);
-    int res;
-    volatile struct hashtab_item_t *hitem;
-    struct pcache_key_t key, *pkey;
+    int res, grow;
+    uint32_t hash;
     volatile int tries = 0;
 
     if(node->dev == PROCFS_DEVID)
@@ -221,37 +468,33 @@ struct cached_page_t *get_cached_page(struct fs_node_t *node,
 
     //printk("get_cached_page: dev 0x%x, node 0x%x\n", node->dev, node->inode);
 
-    FILL_ZEROES(&key, sizeof(struct pcache_key_t));
-    key.dev = node->dev;
-    key.ino = node->inode;
-    key.offset = offset;
+    shard = pcache_shard(node->dev, node->inode, offset, &hash);
 
 loop:
 
-    // lock the array so no one adds/removes anything while we search
-    kernel_mutex_lock(&pcachetab_lock);
+    // lock the shard so no one adds/removes anything while we search
+    kernel_mutex_lock(&shard->lock);
 
     // first, try to find the page in the page cache
-    if((hitem = pcache_lookup(pcachetab, &key)))
+    if((pcache = pcache_lookup(shard, hash, node->dev, node->inode, offset)))
     {
-        pcache = hitem->val;
-
         if(pcache->flags & PCACHE_FLAG_STALE)
         {
             //__asm__ __volatile__("xchg %%bx, %%bx":::);
-            kernel_mutex_unlock(&pcachetab_lock);
+            kernel_mutex_unlock(&shard->lock);
             //remove_unreferenced_cached_pages();
             remove_stale_cached_pages();
 
             if(flags & PCACHE_IGNORE_STALE)
             {
+                kmem_cache_free(cached_page_cache, newpage);
                 return NULL;
             }
 
             if(++tries >= 50)
             {
                 switch_tty(1);
-                printk("pcache: stale page dev 0x%x, ino 0x%x, flags 0x%x, pid %d, curpid %d\n", key.dev, key.ino, pcache->flags, pcache->pid, this_core->cur_task ? this_core->cur_task->pid : 0);
+                printk("pcache: stale page dev 0x%x, ino 0x%x, flags 0x%x, pid %d, curpid %d\n", node->dev, node->inode, pcache->flags, pcache->pid, this_core->cur_task ? this_core->cur_task->pid : 0);
                 printk("pcache: refs %d\n", get_frame_shares(pcache->phys));
                 //printk("pcache: holding task 0x%lx\n", pcache->pid ? get_task_by_id(pcache->pid) : NULL);
                 kpanic("pcache: infinite loop\n");
@@ -265,12 +508,12 @@ loop:
         if(pcache->flags & PCACHE_FLAG_BUSY)
         {
             __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_WANTED);
-            kernel_mutex_unlock(&pcachetab_lock);
+            kernel_mutex_unlock(&shard->lock);
 
             if(++tries >= 500000)
             {
                 switch_tty(1);
-                printk("pcache: busy page dev 0x%x, ino 0x%x, flags 0x%x, pid %d, curpid %d\n", key.dev, key.ino, pcache->flags, pcache->pid, this_core->cur_task ? this_core->cur_task->pid : 0);
+                printk("pcache: busy page dev 0x%x, ino 0x%x, flags 0x%x, pid %d, curpid %d\n", node->dev, node->inode, pcache->flags, pcache->pid, this_core->cur_task ? this_core->cur_task->pid : 0);
                 printk("pcache: refs %d\n", get_frame_shares(pcache->phys));
                 //printk("pcache: holding task 0x%lx\n", pcache->pid ? get_task_by_id(pcache->pid) : NULL);
                 kpanic("pcache: infinite loop\n");
@@ -285,29 +528,40 @@ loop:
         inc_frame_shares(pcache->phys);
         pcache->last_accessed = ticks;
         pcache->pid = this_core->cur_task ? this_core->cur_task->pid : 0;
-        kernel_mutex_unlock(&pcachetab_lock);
+        lru_touch(shard, pcache);
+        kernel_mutex_unlock(&shard->lock);
         __asm__ __volatile__("":::"memory");
 
+        // someone else added the page while we were allocating ours
+        kmem_cache_free(cached_page_cache, newpage);
+
         return pcache;
     }
 
     if(flags & PCACHE_PEEK_ONLY)
     {
-        kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
+        kmem_cache_free(cached_page_cache, newpage);
         return NULL;
     }
 
-    // page not found, allocate a new page cache entry
-    if(!(pcache = kmalloc(sizeof(struct cached_page_t))) ||
-       !(pkey = kmalloc(sizeof(struct pcache_key_t))))
+    // page not found, allocate a new page cache entry without holding the
+    // lock (we might need to reclaim memory), then search again
+    if(!newpage)
     {
-        kpanic("Cannot allocate page cache entry (1)\n");
+        kernel_mutex_unlock(&shard->lock);
+
+        if(!(newpage = kmem_cache_alloc(cached_page_cache)))
+        {
+            kpanic("Cannot allocate page cache entry (1)\n");
+        }
+
+        goto loop;
     }
+
+    pcache = newpage;
     
-    //A_memset(pcache, 0, sizeof(struct cached_page_t));
-    //A_memset(pkey, 0, sizeof(struct pcache_key_t));
-    FILL_ZEROES(pcache, sizeof(struct cached_page_t));
-    FILL_ZEROES(pkey, sizeof(struct pcache_key_t));
+    A_memset(pcache, 0, sizeof(struct cached_page_t));
 
     // The node passed to us might be a struct fs_node_header_t, which is
     // not a complete node. So get the node struct in all cases to ensure
@@ -333,18 +587,14 @@ loop:
     __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_BUSY);
     pcache->pid = this_core->cur_task ? this_core->cur_task->pid : 0;
 
-    pkey->dev = node->dev;
-    pkey->ino = node->inode;
-    pkey->offset = offset;
+    grow = pcache_insert(shard, hash, pcache);
+    kernel_mutex_unlock(&shard->lock);
 
-    if(!(hitem = pcache_alloc_hitem(pkey, pcache)))
+    if(grow)
     {
-        kpanic("Cannot allocate page cache entry (2)\n");
+        pcache_grow_shard(shard);
     }
 
-    pcache_add_hitem(pcachetab, pkey, (struct hashtab_item_t *)hitem);
-    kernel_mutex_unlock(&pcachetab_lock);
-
     // get a physical page and map it to kernel virtual space
     while(get_next_addr(&pcache->phys, &pcache->virt, 
                         PTE_FLAGS_PW, REGION_PCACHE) != 0)
@@ -362,7 +612,7 @@ loop:
 
     if((d = get_mount_info(node->dev)) == NULL)
     {
-        free_cached_page(pkey, pcache);
+        free_cached_page(pcache);
         printk("pcache: reading from unmounted device!\n");
         return NULL;
     }
@@ -393,7 +643,7 @@ loop:
     {
         if(ubuf.f_tfree < (PAGE_SIZE / d->block_size))
         {
-            free_cached_page(pkey, pcache);
+            free_cached_page(pcache);
             __asm__ __volatile__("xchg %%bx, %%bx":::);
             printk("pcache: device has no space left (dev 0x%x, free %d)!\n", 
                     node->dev, ubuf.f_tfree);
@@ -413,9 +663,9 @@ loop:
         req.blockno = offset;
         req.write = 0;
 
-        if((res = bdev_tab[maj].strategy(&req)) < 0)
+        if((res = blk_submit(&req)) < 0)
         {
-            free_cached_page(pkey, pcache);
+            free_cached_page(pcache);
             return NULL;
         }
 
@@ -427,11 +677,10 @@ loop:
         int i, n = PAGE_SIZE / d->block_size;
         int bmap_flag = (flags & PCACHE_AUTO_ALLOC) ? BMAP_FLAG_CREATE :
                                                       BMAP_FLAG_NONE;
-        virtual_addr p = pcache->virt;
+        struct disk_req_t reqs[PCACHE_PAGE_MAXREQS];
+        struct pcache_io_t io;
         size_t disk_block[n];
-        int how_many = 1;
 
-        res = 0;
         //MAY_LOCK(&pcache->node->lock);
         kernel_mutex_lock(&pcache->node->lock);
 
@@ -454,85 +703,19 @@ loop:
         //printk("get_cached_page: 2 lock 0x%lx, me 0x%lx, holder 0x%lx\n", &pcache->node->lock, this_core->cur_task, pcache->node->lock.holder);
 
         // To try and reduce disk access requests (and IRQs and the resultant
-        // delays), find out the maximum amount of sectors we can read in 
-        // one go. We do this by checking consecutive block numbers, which are
-        // going to be laid out consecutively on disk. We read that much
-        // sectors, then read the non-consecutive rest in the loop below.
-        for(i = 1; i < n; i++)
-        {
-            if(disk_block[i] == disk_block[i - 1] + 1)
-            {
-                how_many++;
-            }
-            else
-            {
-                break;
-            }
-        }
-
-        i = 0;
-
-        // Read as much as we can
-        if(how_many > 1)
-        {
-            //printk("get_cached_page: how_many %d\n", how_many);
-            req.dev = node->dev;
-            req.data = p;
-            req.datasz = d->block_size * how_many;
-            req.fs_blocksz = d->block_size;
-            req.blockno = disk_block[0];
-            req.write = 0;
-
-            if(bdev_tab[maj].strategy(&req) < 0)
-            {
-                free_cached_page(pkey, pcache);
-                return NULL;
-            }
-
-            n -= how_many;
-            i = how_many;
-            p += d->block_size * how_many;
-            res += d->block_size * how_many;
-        }
-
-        // Read the rest of the sectors (or all the sectors if we could
-        // not find consecutive sectors above)
-        while(n--)
-        {
-            if(!disk_block[i])
-            //if(!(i = d->fs->ops->bmap(node, block, d->block_size, bmap_flag)))
-            {
-                A_memset((void *)p, 0, d->block_size);
-            }
-            else
-            {
-                req.dev = node->dev;
-                req.data = p;
-                //req.blocksz = d->block_size;
-                req.datasz = d->block_size;
-                req.fs_blocksz = d->block_size;
-                //req.blockno = i;
-                req.blockno = disk_block[i];
-                req.write = 0;
-
-                if(bdev_tab[maj].strategy(&req) < 0)
-                {
-                    break;
-                }
-            }
-
-            p += d->block_size;
-            res += d->block_size;
-            //block++;
-            i++;
-        }
+        // delays), we read each run of consecutive disk blocks with one
+        // request, and queue all the requests together
+        pcache_start_io(&io, reqs, PCACHE_PAGE_MAXREQS);
+        pcache_queue_blocks(&io, node->dev, disk_block, n, d->block_size,
+                            pcache->virt, 0);
 
-        if(res == 0)
+        if(pcache_wait_io(&io) < 0)
         {
-            free_cached_page(pkey, pcache);
+            free_cached_page(pcache);
             return NULL;
         }
 
+        res = PAGE_SIZE;
         pcache->len = PAGE_SIZE;
     }
 
@@ -550,22 +733,19 @@ loop:
 }
 
 
-int sync_cached_page(struct cached_page_t *pcache)
+/*
+ * Queue the disk writes needed to sync the given page. Returns the number
+ * of bytes queued, zero if there is nothing to write, or -(errno). If
+ * nowait is set, we return -EAGAIN instead of waiting for the node lock
+ * (the caller has other pages busy, which the lock holder might want).
+ */
+static int queue_page_sync(struct cached_page_t *pcache,
+                           struct pcache_io_t *io, int nowait)
 {
     struct mount_info_t *d;
-    struct disk_req_t req;
-    int maj = MAJOR(pcache->dev);
-    int res = 0;
 
     KDEBUG("sync_cached_page: dev 0x%x, inode 0x%x, offset %lx (task %d)\n", pcache->dev, pcache->ino, pcache->offset, pcache->pid);
 
-    /*
-    if(pcache->flags & PCACHE_FLAG_STALE)
-    {
-        return -EIO;
-    }
-    */
-
     if((d = get_mount_info(pcache->dev)) == NULL)
     {
         printk("pcache: writing to unmounted device!\n");
@@ -586,29 +766,15 @@ int sync_cached_page(struct cached_page_t *pcache)
             return -EIO;
         }
 
-        req.dev = pcache->dev;
-        req.data = pcache->virt;
-
-        //req.blocksz = pcache->len; // d->block_size;
-        req.datasz = pcache->len;
-        req.fs_blocksz = pcache->len;
-
-        req.blockno = pcache->offset;
-        req.write = 1;
+        pcache_queue_req(io, pcache->dev, pcache->offset, pcache->len,
+                         pcache->virt, pcache->len, 1);
 
-        if(bdev_tab[maj].strategy(&req) < 0)
-        {
-            return -EIO;
-        }
-
-        res = pcache->len;
+        return pcache->len;
     }
     else
     {
-        //struct fs_node_t *node;
         size_t block;
         int i, n;
-        virtual_addr p;
 
         if(pcache->node == NULL /* || pcache->node->links == 0 */)
         {
@@ -623,18 +789,6 @@ int sync_cached_page(struct cached_page_t *pcache)
                     pcache->node->flags, pcache->node);
             kpanic("\n\n*** pcache with 0 node refs!\n\n");
         }
-#if 0
-        if(!(node = get_node(pcache->dev, pcache->ino, 
-                               GETNODE_FOLLOW_MPOINTS /* | GETNODE_IGNORE_STALE */)))
-        {
-            /*
-            printk("sync_cached_page: dev 0x%x, inode 0x%x\n", pcache->dev, pcache->ino);
-            printk("sync_cached_page: len 0x%x, flags 0x%x\n", pcache->len, pcache->flags);
-            kpanic("\nsync_cached_page: invalid inode\n\n");
-            */
-            return -EIO;
-        }
-#endif
 
         // before we lock the node and call bmap, make sure we are not
         // trying to recursively lock the node
@@ -645,16 +799,24 @@ int sync_cached_page(struct cached_page_t *pcache)
 
         block = pcache->offset / d->block_size;
         n = pcache->len /* PAGE_SIZE */ / d->block_size;
-        p = pcache->virt;
 
         size_t disk_block[n];
         size_t off = pcache->offset;
-        int bmap_flag, how_many = 1;
+        int bmap_flag;
 
-        //MAY_LOCK(&pcache->node->lock);
-        kernel_mutex_lock(&pcache->node->lock);
+        if(nowait)
+        {
+            if(kernel_mutex_trylock(&pcache->node->lock))
+            {
+                return -EAGAIN;
+            }
+        }
+        else
+        {
+            kernel_mutex_lock(&pcache->node->lock);
+        }
 
-        // Find out the mapping of the logical sectors we need to read
+        // Find out the mapping of the logical sectors we need to write
         for(i = 0; i < n; i++)
         {
             bmap_flag = (off < pcache->node->size) ? BMAP_FLAG_CREATE :
@@ -662,116 +824,53 @@ int sync_cached_page(struct cached_page_t *pcache)
             disk_block[i] = d->fs->ops->bmap(pcache->node, block + i, 
                                              d->block_size, bmap_flag);
             off += d->block_size;
-            //printk("sync_cached_page: [%d] %d\n", i, disk_block[i]);
         }
 
         //MAY_UNLOCK(&pcache->node->lock);
         kernel_mutex_unlock(&pcache->node->lock);
 
         // To try and reduce disk access requests (and IRQs and the resultant
-        // delays), find out the maximum amount of sectors we can write in 
-        // one go. We do this by checking consecutive block numbers, which are
-        // going to be laid out consecutively on disk. We write that much
-        // sectors, then write the non-consecutive rest in the loop below.
-        for(i = 1; i < n; i++)
-        {
-            if(disk_block[i] == disk_block[i - 1] + 1)
-            {
-                how_many++;
-            }
-            else
-            {
-                break;
-            }
-        }
+        // delays), we write each run of consecutive disk blocks with one
+        // request. Unmapped blocks are not written.
+        pcache_queue_blocks(io, pcache->dev, disk_block, n, d->block_size,
+                            pcache->virt, 1);
 
-        i = 0;
-
-        // Read as much as we can
-        if(how_many > 1)
-        {
-            //printk("sync_cached_page: how_many %d\n", how_many);
-            req.dev = pcache->dev;
-            req.data = p;
-            req.datasz = d->block_size * how_many;
-            req.fs_blocksz = d->block_size;
-            req.blockno = disk_block[0];
-            req.write = 1;
-
-            if(bdev_tab[maj].strategy(&req) < 0)
-            {
-                //release_node(node);
-                return 0;
-            }
-
-            n -= how_many;
-            i = how_many;
-            p += d->block_size * how_many;
-            res += d->block_size * how_many;
-        }
-
-        // Read the rest of the sectors (or all the sectors if we could
-        // not find consecutive sectors above)
-
-        while(n--)
-        {
-            if(disk_block[i])
-            //if((i = d->fs->ops->bmap(node, block, d->block_size, BMAP_FLAG_NONE)))
-            {
-                req.dev = pcache->dev;
-                req.data = p;
-
-                //req.blocksz = d->block_size;
-                req.datasz = d->block_size;
-                req.fs_blocksz = d->block_size;
+        return n * d->block_size;
+    }
+}
 
-                //req.blockno = i;
-                req.blockno = disk_block[i];
-                req.write = 1;
 
-                if(bdev_tab[maj].strategy(&req) < 0)
-                {
-                    break;
-                }
-            }
+int sync_cached_page(struct cached_page_t *pcache)
+{
+    struct disk_req_t reqs[PCACHE_PAGE_MAXREQS];
+    struct pcache_io_t io;
+    int res;
 
-            p += d->block_size;
-            res += d->block_size;
-            //block++;
-            i++;
-        }
+    pcache_start_io(&io, reqs, PCACHE_PAGE_MAXREQS);
 
-        //release_node(node);
+    if((res = queue_page_sync(pcache, &io, 0)) <= 0)
+    {
+        return res;
     }
 
-    return res;
+    return (pcache_wait_io(&io) < 0) ? -EIO : res;
 }
 
 
 static void mark_dirty_pages(int maj)
 {
+    struct pcache_shard_t *shard;
     struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem;
-    volatile int i;
+    unsigned long i;
 
-    if(!pcachetab)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
-        return;
-    }
+        kernel_mutex_lock(&shard->lock);
 
-    kernel_mutex_lock(&pcachetab_lock);
-    
-    for(i = 0; i < pcachetab->count; i++)
-    {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
+        for_each_shard_page(shard, i, pcache)
         {
-            pcache = hitem->val;
-
             if(maj != -1 && (int)MAJOR(pcache->dev) != maj)
             {
-                hitem = hitem->next;
                 continue;
             }
 
@@ -779,80 +878,39 @@ static void mark_dirty_pages(int maj)
             {
                 __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_DIRTY);
             }
-
-            hitem = hitem->next;
         }
-    }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
+    }
 }
 
 
-static inline void release_pcache_internal(volatile struct hashtab_item_t *hitem,
-                                           volatile struct hashtab_item_t *prev, int i)
-{
-    struct cached_page_t *pcache = hitem->val;
-
-    /*
-    if(get_frame_shares(pcache->phys) > 1)
-    {
-        //__asm__ __volatile__("xchg %%bx, %%bx":::);
-        printk("pcache: trying to release page with %d refs\n", get_frame_shares(pcache->phys));
-        return;
-    }
-    */
-
-    if(prev)
-    {
-        prev->next = hitem->next;
-    }
-    else
-    {
-        pcachetab->items[i] = hitem->next;
-    }
-
-    kfree(hitem->key);
-    kfree((void *)hitem);
-    kernel_mutex_unlock(&pcachetab_lock);
-    release_page_memory(pcache);
-    kernel_mutex_lock(&pcachetab_lock);
-    __asm__ __volatile__("":::"memory");
-}
-
-
-static void flush_dirty_pages(int maj)
+static void flush_shard_dirty_pages(struct pcache_shard_t *shard, int maj)
 {
     struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem /* , *prev */;
     int res, wanted;
-    volatile int i;
+    volatile unsigned long i;
 
-    kernel_mutex_lock(&pcachetab_lock);
+    kernel_mutex_lock(&shard->lock);
     
-    for(i = 0; i < pcachetab->count; i++)
+    for(i = 0; i < shard->nbuckets; i++)
     {
 
 loop:
 
-        hitem = pcachetab->items[i];
-        //prev = NULL;
+        pcache = shard->buckets[i];
         
-        while(hitem)
+        while(pcache)
         {
-            pcache = hitem->val;
-
             if(maj != -1 && (int)MAJOR(pcache->dev) != maj)
             {
-                //prev = hitem;
-                hitem = hitem->next;
+                pcache = pcache->next;
                 continue;
             }
 
-            if(!(pcache->flags & PCACHE_FLAG_DIRTY) /* ||
-               (pcache->flags & PCACHE_FLAG_STALE) */)
+            if(!(pcache->flags & PCACHE_FLAG_DIRTY))
             {
-                //prev = hitem;
-                hitem = hitem->next;
+                pcache = pcache->next;
                 continue;
             }
 
@@ -860,11 +918,17 @@ loop:
                pcache->pid != this_core->cur_task->pid)
             {
                 __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_WANTED);
-                kernel_mutex_unlock(&pcachetab_lock);
+                kernel_mutex_unlock(&shard->lock);
                 block_task2(pcache, 30);
-                kernel_mutex_lock(&pcachetab_lock);
-                hitem = pcachetab->items[i];
-                //prev = NULL;
+                kernel_mutex_lock(&shard->lock);
+
+                // the table might have grown while we slept
+                if(i >= shard->nbuckets)
+                {
+                    break;
+                }
+
+                pcache = shard->buckets[i];
                 continue;
             }
 
@@ -873,13 +937,13 @@ loop:
             pcache->pid = -1; //this_core->cur_task->pid;
             pcache->last_accessed = ticks;
 
-            kernel_mutex_unlock(&pcachetab_lock);
+            kernel_mutex_unlock(&shard->lock);
             res = sync_cached_page(pcache);
-            kernel_mutex_lock(&pcachetab_lock);
+            kernel_mutex_lock(&shard->lock);
 
             wanted = (pcache->flags & PCACHE_FLAG_WANTED);
             __sync_and_and_fetch(&pcache->flags, 
-                    ~(PCACHE_FLAG_BUSY /* | PCACHE_FLAG_DIRTY */ | PCACHE_FLAG_WANTED));
+                    ~(PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED));
 
             // If the node is locked, sync_cached_page() returns -EAGAIN so
             // we can flush the page the next round. If we turn the 
@@ -906,20 +970,168 @@ loop:
                 unblock_tasks(pcache);
             }
 
+            if(i >= shard->nbuckets)
+            {
+                break;
+            }
+
             goto loop;
         }
     }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+    kernel_mutex_unlock(&shard->lock);
 }
 
 
-void remove_old_cached_pages(int maj, unsigned long long older_than_ticks)
+/*
+ * Dirty pages written out together, with the requests needed to write them.
+ */
+struct pcache_flush_t
+{
+    struct cached_page_t *pages[PCACHE_FLUSH_BATCH];
+    int first[PCACHE_FLUSH_BATCH + 1];  // first request of each page
+    int res[PCACHE_FLUSH_BATCH];
+    struct disk_req_t reqs[PCACHE_FLUSH_BATCH * PCACHE_PAGE_MAXREQS];
+};
+
+
+/*
+ * Write out a batch of busy pages. All the requests are queued together,
+ * so the block layer can merge adjacent pages and sort the writes.
+ */
+static void flush_page_batch(struct pcache_flush_t *fl, int n)
 {
+    struct pcache_shard_t *shard;
     struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem, *prev;
+    struct pcache_io_t io;
+    int i, j, res, wanted;
+
+    pcache_start_io(&io, fl->reqs, PCACHE_FLUSH_BATCH * PCACHE_PAGE_MAXREQS);
+
+    for(i = 0; i < n; i++)
+    {
+        fl->first[i] = io.nreqs;
+        fl->res[i] = queue_page_sync(fl->pages[i], &io, (i != 0));
+    }
+
+    fl->first[n] = io.nreqs;
+    pcache_wait_io(&io);
+
+    for(i = 0; i < n; i++)
+    {
+        pcache = fl->pages[i];
+        res = fl->res[i];
+
+        for(j = fl->first[i]; res > 0 && j < fl->first[i + 1]; j++)
+        {
+            if(fl->reqs[j].res < 0)
+            {
+                res = -EIO;
+            }
+        }
+
+        shard = pcache_shard_of(pcache);
+        kernel_mutex_lock(&shard->lock);
+
+        wanted = (pcache->flags & PCACHE_FLAG_WANTED);
+        __sync_and_and_fetch(&pcache->flags, 
+                    ~(PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED));
+
+        // leave it for flush_shard_dirty_pages()
+        if(res == -EAGAIN)
+        {
+            __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_DIRTY);
+        }
+        else if(res < 0)
+        {
+            __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_STALE);
+        }
+
+        kernel_mutex_unlock(&shard->lock);
+
+        if(wanted)
+        {
+            unblock_tasks(pcache);
+        }
+    }
+}
+
+
+static void flush_dirty_pages(int maj)
+{
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache;
+    struct pcache_flush_t *fl;
+    unsigned long j;
+    int i, n = 0;
+
+    // Write dirty pages in batches, skipping busy pages. If we can't get
+    // memory for a batch, the loop at the end writes one page at a time.
+    if((fl = kmalloc(sizeof(struct pcache_flush_t))))
+    {
+        for(i = 0; i < PCACHE_SHARDS; i++)
+        {
+            shard = &pcache_shards[i];
+            j = 0;
+
+again:
+
+            kernel_mutex_lock(&shard->lock);
+
+            for( ; j < shard->nbuckets && n < PCACHE_FLUSH_BATCH; j++)
+            {
+                for(pcache = shard->buckets[j];
+                    pcache != NULL && n < PCACHE_FLUSH_BATCH;
+                    pcache = pcache->next)
+                {
+                    if((maj != -1 && (int)MAJOR(pcache->dev) != maj) ||
+                       !(pcache->flags & PCACHE_FLAG_DIRTY) ||
+                       (pcache->flags & PCACHE_FLAG_BUSY))
+                    {
+                        continue;
+                    }
+
+                    __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_BUSY);
+                    __sync_and_and_fetch(&pcache->flags, ~PCACHE_FLAG_DIRTY);
+                    pcache->pid = -1;
+                    pcache->last_accessed = ticks;
+                    fl->pages[n++] = pcache;
+                }
+            }
+
+            kernel_mutex_unlock(&shard->lock);
+
+            // Batch is full, write it and carry on from the next bucket.
+            // Pages we skip here are picked up by the loop below.
+            if(n == PCACHE_FLUSH_BATCH)
+            {
+                flush_page_batch(fl, n);
+                n = 0;
+                goto again;
+            }
+        }
+
+        if(n)
+        {
+            flush_page_batch(fl, n);
+        }
+
+        kfree(fl);
+    }
+
+    // now the pages that were busy or had their node locked
+    for(i = 0; i < PCACHE_SHARDS; i++)
+    {
+        flush_shard_dirty_pages(&pcache_shards[i], maj);
+    }
+}
+
+
+void remove_old_cached_pages(int maj, unsigned long long older_than_ticks)
+{
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *prev, *victims;
     unsigned long long older_than = ticks - older_than_ticks;
-    volatile int i;
 
     // First, get a list of all the dirty pages and mark them as both
     // dirty and busy, so no one else can claim them.
@@ -933,132 +1145,146 @@ void remove_old_cached_pages(int maj, unsigned long long older_than_ticks)
         return;
     }
 
-    kernel_mutex_lock(&pcachetab_lock);
-
-    for(i = 0; i < pcachetab->count; i++)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
+        victims = NULL;
+        kernel_mutex_lock(&shard->lock);
 
-loop:
+        // active pages that have not been used for a while are not
+        // active anymore
+        while((pcache = shard->active_tail) &&
+              pcache->last_accessed < older_than)
+        {
+            lru_del(shard, pcache);
+            lru_add_tail(&shard->inactive, &shard->inactive_tail, pcache);
+            shard->nr_inactive++;
+        }
 
-        hitem = pcachetab->items[i];
-        prev = NULL;
-        
-        while(hitem)
+        // now reclaim old pages, starting with the least recently used
+        for(pcache = shard->inactive_tail; pcache != NULL; pcache = prev)
         {
-            pcache = hitem->val;
+            prev = pcache->lru_prev;
 
             if(maj != -1 && (int)MAJOR(pcache->dev) != maj)
             {
-                prev = hitem;
-                hitem = hitem->next;
                 continue;
             }
 
             // remove the page if it is old and no one is using it and it is
             // not dirty (although it should not be dirty for 5 mins as the
             // periodic updater should have flushed it to disk earlier)
-            if((pcache->last_accessed < older_than) &&
-               !(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED | PCACHE_FLAG_DIRTY)))
+            if(pcache->last_accessed < older_than &&
+               PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED |
+                                        PCACHE_FLAG_DIRTY))
             {
-                if(get_frame_shares(pcache->phys) <= 1)
-                {
-                    release_pcache_internal(hitem, prev, i);
-                    goto loop;
-                }
+                pcache_unlink(shard, pcache);
+                pcache->next = victims;
+                victims = pcache;
             }
-
-            prev = hitem;
-            hitem = hitem->next;
         }
-    }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
+        release_page_list(victims);
+    }
 }
 
 
 void remove_stale_cached_pages(void)
 {
-    struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem, *prev;
-    volatile int i;
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *next, *victims;
+    unsigned long i;
 
-    kernel_mutex_lock(&pcachetab_lock);
-
-    for(i = 0; i < pcachetab->count; i++)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
+        victims = NULL;
+        kernel_mutex_lock(&shard->lock);
 
-loop:
-
-        hitem = pcachetab->items[i];
-        prev = NULL;
-        
-        while(hitem)
+        for(i = 0; i < shard->nbuckets; i++)
         {
-            pcache = hitem->val;
-
-            if((pcache->flags & PCACHE_FLAG_STALE) &&
-               !(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED)))
+            for(pcache = shard->buckets[i]; pcache != NULL; pcache = next)
             {
-                //__asm__ __volatile__("xchg %%bx, %%bx":::);
-                if(get_frame_shares(pcache->phys) <= 1)
+                next = pcache->next;
+
+                if((pcache->flags & PCACHE_FLAG_STALE) &&
+                   PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED))
                 {
-                    release_pcache_internal(hitem, prev, i);
-                    goto loop;
+                    pcache_unlink(shard, pcache);
+                    pcache->next = victims;
+                    victims = pcache;
                 }
             }
-
-            prev = hitem;
-            hitem = hitem->next;
         }
-    }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
+        release_page_list(victims);
+    }
 }
 
 
 void remove_unreferenced_cached_pages(struct fs_node_t *node)
 {
-    struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem, *prev;
-    volatile int i;
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *next, *victims = NULL;
+    uint32_t hash;
+    unsigned long i;
 
     mark_dirty_pages(-1);
     flush_dirty_pages(-1);
 
-    kernel_mutex_lock(&pcachetab_lock);
-
-    for(i = 0; i < pcachetab->count; i++)
+    // remove the pages if no one is using them and they are not dirty
+    if(node)
     {
+        if(node->inode == PCACHE_NOINODE)
+        {
+            return;
+        }
 
-loop:
+        shard = pcache_shard(node->dev, node->inode, 0, &hash);
+        kernel_mutex_lock(&shard->lock);
 
-        hitem = pcachetab->items[i];
-        prev = NULL;
-        
-        while(hitem)
+        for(pcache = node->cached_pages; pcache != NULL; pcache = next)
         {
-            pcache = hitem->val;
+            next = pcache->node_next;
+
+            if(PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED |
+                                        PCACHE_FLAG_DIRTY))
+            {
+                pcache_unlink(shard, pcache);
+                pcache->next = victims;
+                victims = pcache;
+            }
+        }
+
+        kernel_mutex_unlock(&shard->lock);
+        release_page_list(victims);
+        return;
+    }
+
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
+    {
+        victims = NULL;
+        kernel_mutex_lock(&shard->lock);
 
-            if(node == NULL ||
-               (pcache->dev == node->dev && pcache->ino == node->inode))
+        for(i = 0; i < shard->nbuckets; i++)
+        {
+            for(pcache = shard->buckets[i]; pcache != NULL; pcache = next)
             {
-                // remove the page if no one is using it and it is not dirty
-                if(!(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED | PCACHE_FLAG_DIRTY)))
+                next = pcache->next;
+
+                if(PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED |
+                                            PCACHE_FLAG_DIRTY))
                 {
-                    if(get_frame_shares(pcache->phys) <= 1)
-                    {
-                        release_pcache_internal(hitem, prev, i);
-                        goto loop;
-                    }
+                    pcache_unlink(shard, pcache);
+                    pcache->next = victims;
+                    victims = pcache;
                 }
             }
-
-            prev = hitem;
-            hitem = hitem->next;
         }
-    }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+        kernel_mutex_unlock(&shard->lock);
+        release_page_list(victims);
+    }
 }
 
 
@@ -1082,57 +1308,55 @@ void flush_cached_pages(dev_t dev)
 
 int remove_cached_disk_pages(dev_t dev)
 {
-    struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem, *prev;
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *next, *victims;
+    unsigned long i;
     int res = 0;
-    volatile int i;
-
-    kernel_mutex_lock(&pcachetab_lock);
 
-    for(i = 0; i < pcachetab->count; i++)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
+        victims = NULL;
+        kernel_mutex_lock(&shard->lock);
 
-loop:
-
-        hitem = pcachetab->items[i];
-        prev = NULL;
-        
-        while(hitem)
+        for(i = 0; i < shard->nbuckets; i++)
         {
-            pcache = hitem->val;
-
-            if(pcache->dev == dev)
+            for(pcache = shard->buckets[i]; pcache != NULL; pcache = next)
             {
+                next = pcache->next;
+
+                if(pcache->dev != dev)
+                {
+                    continue;
+                }
+
                 __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_STALE);
 
                 // remove the page if no one is using it
-                if(!(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED)))
+                if(PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED))
                 {
-                    if(get_frame_shares(pcache->phys) <= 1)
-                    {
-                        release_pcache_internal(hitem, prev, i);
-                        goto loop;
-                    }
+                    pcache_unlink(shard, pcache);
+                    pcache->next = victims;
+                    victims = pcache;
+                    continue;
                 }
 
                 res = -EBUSY;
             }
-
-            prev = hitem;
-            hitem = hitem->next;
         }
+
+        kernel_mutex_unlock(&shard->lock);
+        release_page_list(victims);
     }
 
-    kernel_mutex_unlock(&pcachetab_lock);
     return res;
 }
 
 
 int remove_cached_node_pages(struct fs_node_t *node)
 {
-    struct cached_page_t *pcache;
-    volatile struct hashtab_item_t *hitem, *prev;
-    volatile int i;
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *next, *victims = NULL;
+    uint32_t hash;
     int res = 0;
 
     if(!node || node->dev == 0 || node->inode == 0)
@@ -1140,119 +1364,88 @@ int remove_cached_node_pages(struct fs_node_t *node)
         return -EINVAL;
     }
 
-    kernel_mutex_lock(&pcachetab_lock);
+    shard = pcache_shard(node->dev, node->inode, 0, &hash);
+    kernel_mutex_lock(&shard->lock);
 
-    for(i = 0; i < pcachetab->count; i++)
+    for(pcache = node->cached_pages; pcache != NULL; pcache = next)
     {
-
-loop:
-
-        hitem = pcachetab->items[i];
-        prev = NULL;
-        
-        while(hitem)
+        next = pcache->node_next;
+        __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_STALE);
+
+        // As the node is getting deleted, we need to remove all its
+        // cached pages. If a page is being used, we have to wait until
+        // it is released then we remove it. If no one is using it,
+        // remove the page immediately
+        if(PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED))
         {
-            pcache = hitem->val;
-
-            if(pcache->dev == node->dev && pcache->ino == node->inode)
-            {
-                __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_STALE);
-
-                // As the node is getting deleted, we need to remove all its
-                // cached pages. If a page is being used, we have to wait until
-                // it is released then we remove it. If no one is using it,
-                // remove the page immediately
-                if(!(pcache->flags & (PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED)))
-                {
-                    if(get_frame_shares(pcache->phys) <= 1)
-                    {
-                        release_pcache_internal(hitem, prev, i);
-                        goto loop;
-                    }
-                    //else printk("cannot remove page: 0x%x:0x%x: shares %d, flags 0x%x (1)\n", pcache->dev, pcache->ino, get_frame_shares(pcache->phys), pcache->flags);
-                }
-                //else printk("cannot remove page: 0x%x:0x%x: shares %d, flags 0x%x (2)\n", pcache->dev, pcache->ino, get_frame_shares(pcache->phys), pcache->flags);
-
-                res = -EBUSY;
-            }
-
-            prev = hitem;
-            hitem = hitem->next;
+            pcache_unlink(shard, pcache);
+            pcache->next = victims;
+            victims = pcache;
+            continue;
         }
+
+        res = -EBUSY;
     }
 
-    kernel_mutex_unlock(&pcachetab_lock);
+    kernel_mutex_unlock(&shard->lock);
+    release_page_list(victims);
+
     return res;
-    //return 0;
 }
 
 
 /*
- * Get cached page count (pages with backing file nodes).
+ * Count the cached pages with all the given flags set. If noinode is 1,
+ * only pages with no backing file nodes are counted. If it is 0, only
+ * pages with backing file nodes are counted. If it is -1, all pages are
+ * counted.
  */
-size_t get_cached_page_count(void)
+static size_t count_cached_pages(int flags, int noinode)
 {
+    struct pcache_shard_t *shard;
     struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
+    unsigned long i;
     size_t count = 0;
-    int i;
-
-    kernel_mutex_lock(&pcachetab_lock);
 
-    for(i = 0; i < pcachetab->count; i++)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
+        kernel_mutex_lock(&shard->lock);
+
+        for_each_shard_page(shard, i, pcache)
         {
-            pcache = hitem->val;
+            if(noinode != -1 && (pcache->ino == PCACHE_NOINODE) != noinode)
+            {
+                continue;
+            }
 
-            if(pcache->ino != PCACHE_NOINODE)
+            if((pcache->flags & flags) == flags)
             {
                 count++;
             }
-
-            hitem = hitem->next;
         }
+
+        kernel_mutex_unlock(&shard->lock);
     }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
+
     return count;
 }
 
 
 /*
- * Similar to the above, but returns only busy pages.
+ * Get cached page count (pages with backing file nodes).
  */
-size_t get_busy_cached_page_count(void)
+size_t get_cached_page_count(void)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t count = 0;
-    int i;
+    return count_cached_pages(0, 0);
+}
 
-    kernel_mutex_lock(&pcachetab_lock);
 
-    for(i = 0; i < pcachetab->count; i++)
-    {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
-
-            if((pcache->ino != PCACHE_NOINODE) &&
-               (pcache->flags & PCACHE_FLAG_BUSY))
-            {
-                count++;
-            }
-
-            hitem = hitem->next;
-        }
-    }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return count;
+/*
+ * Similar to the above, but returns only busy pages.
+ */
+size_t get_busy_cached_page_count(void)
+{
+    return count_cached_pages(PCACHE_FLAG_BUSY, 0);
 }
 
 
@@ -1261,32 +1454,7 @@ size_t get_busy_cached_page_count(void)
  */
 size_t get_cached_block_count(void)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t count = 0;
-    int i;
-
-    kernel_mutex_lock(&pcachetab_lock);
-
-    for(i = 0; i < pcachetab->count; i++)
-    {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
-
-            if(pcache->ino == PCACHE_NOINODE)
-            {
-                count++;
-            }
-
-            hitem = hitem->next;
-        }
-    }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return count;
+    return count_cached_pages(0, 1);
 }
 
 
@@ -1295,179 +1463,304 @@ size_t get_cached_block_count(void)
  */
 size_t get_busy_cached_block_count(void)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t count = 0;
-    int i;
+    return count_cached_pages(PCACHE_FLAG_BUSY, 1);
+}
 
-    kernel_mutex_lock(&pcachetab_lock);
 
-    for(i = 0; i < pcachetab->count; i++)
-    {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
+size_t get_wanted_cached_block_count(void)
+{
+    return count_cached_pages(PCACHE_FLAG_WANTED, -1);
+}
 
-            if((pcache->ino == PCACHE_NOINODE) &&
-               (pcache->flags & PCACHE_FLAG_BUSY))
-            {
-                count++;
-            }
 
-            hitem = hitem->next;
-        }
-    }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return count;
+size_t get_dirty_cached_block_count(void)
+{
+    return count_cached_pages(PCACHE_FLAG_DIRTY, -1);
 }
 
 
-size_t get_wanted_cached_block_count(void)
+void print_cache_stats(void)
 {
+    struct pcache_shard_t *shard;
     struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t count = 0;
-    int i;
-
-    kernel_mutex_lock(&pcachetab_lock);
+    size_t total = 0, busy = 0, unref = 0, dirty = 0, wanted = 0;
+    size_t active = 0;
+    unsigned long i;
 
-    for(i = 0; i < pcachetab->count; i++)
+    for(shard = pcache_shards; shard < &pcache_shards[PCACHE_SHARDS]; shard++)
     {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
+        kernel_mutex_lock(&shard->lock);
+
+        for_each_shard_page(shard, i, pcache)
         {
-            pcache = hitem->val;
+            if((pcache->flags & PCACHE_FLAG_DIRTY))
+            {
+                dirty++;
+            }
+
+            if((pcache->flags & PCACHE_FLAG_BUSY))
+            {
+                busy++;
+            }
 
             if((pcache->flags & PCACHE_FLAG_WANTED))
             {
-                count++;
+                wanted++;
             }
 
-            hitem = hitem->next;
+            if(get_frame_shares(pcache->phys) <= 1)
+            {
+                unref++;
+            }
+
+            total++;
         }
+
+        active += shard->nr_active;
+        kernel_mutex_unlock(&shard->lock);
     }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return count;
+
+    printk("\ntotal %ld, dirty %ld, busy %ld, unref %ld, wanted %ld, active %ld\n", total, dirty, busy, unref, wanted, active);
 }
 
 
-size_t get_dirty_cached_block_count(void)
+long node_has_cached_pages(struct fs_node_t *node)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t count = 0;
-    int i;
+    struct pcache_shard_t *shard;
+    uint32_t hash;
+    long refs;
+
+    if(!node || node->inode == PCACHE_NOINODE)
+    {
+        return 0;
+    }
+
+    shard = pcache_shard(node->dev, node->inode, 0, &hash);
+    kernel_mutex_lock(&shard->lock);
+    refs = node->nr_cached_pages;
+    kernel_mutex_unlock(&shard->lock);
+
+    return refs;
+}
 
-    kernel_mutex_lock(&pcachetab_lock);
 
-    for(i = 0; i < pcachetab->count; i++)
+/*
+ * Read the pages in the given batch from disk. The pages are consecutive
+ * pages of the same file, and are mapped to consecutive virtual addresses,
+ * so that runs of consecutive disk blocks can be read with one request.
+ * The pages are busy, so no one can use them until we are done.
+ */
+static int read_page_batch(struct fs_node_t *node, struct mount_info_t *d,
+                           struct cached_page_t **batch, int n)
+{
+    struct disk_req_t reqs[PCACHE_PAGE_MAXREQS];
+    struct pcache_io_t io;
+    size_t *disk_block, block = batch[0]->offset / d->block_size;
+    int i, per_page = PAGE_SIZE / d->block_size, nblocks = n * per_page;
+    virtual_addr virt;
+
+    if(!(disk_block = kmalloc(nblocks * sizeof(size_t))))
     {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
+        return -ENOMEM;
+    }
 
-            if((pcache->flags & PCACHE_FLAG_DIRTY))
-            {
-                count++;
-            }
+    if(!(virt = vmmngr_alloc_and_map(n * PAGE_SIZE, 0, PTE_FLAGS_PW, NULL,
+                                     REGION_PCACHE)))
+    {
+        kfree(disk_block);
+        return -ENOMEM;
+    }
 
-            hitem = hitem->next;
-        }
+    for(i = 0; i < n; i++)
+    {
+        batch[i]->virt = virt + (i * PAGE_SIZE);
+        batch[i]->phys = get_phys_addr(batch[i]->virt);
+        batch[i]->len = PAGE_SIZE;
+        inc_frame_shares(batch[i]->phys);
     }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return count;
+
+    kernel_mutex_lock(&node->lock);
+
+    for(i = 0; i < nblocks; i++)
+    {
+        disk_block[i] = d->fs->ops->bmap(node, block + i, d->block_size,
+                                         BMAP_FLAG_NONE);
+    }
+
+    kernel_mutex_unlock(&node->lock);
+
+    // one request for each run of consecutive blocks, queued together
+    pcache_start_io(&io, reqs, PCACHE_PAGE_MAXREQS);
+    pcache_queue_blocks(&io, node->dev, disk_block, nblocks, d->block_size,
+                        virt, 0);
+
+    if(pcache_wait_io(&io) < 0)
+    {
+        kfree(disk_block);
+        return -EIO;
+    }
+
+    kfree(disk_block);
+    return 0;
 }
 
 
-void print_cache_stats(void)
+/*
+ * Read (at most) count pages from the given file into the page cache,
+ * starting at the given offset. Pages that are already in the cache are
+ * skipped, and the missing pages are read in batches of consecutive pages.
+ */
+long readahead_cached_pages(struct fs_node_t *node, off_t offset, size_t count)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    size_t total = 0, busy = 0, unref = 0, dirty = 0, wanted = 0;
-    int i;
+    struct cached_page_t *batch[PCACHE_READAHEAD_MAX];
+    struct cached_page_t *pcache, *newpage = NULL;
+    struct pcache_shard_t *shard;
+    struct mount_info_t *d;
+    struct ustat ubuf;
+    off_t end;
+    uint32_t hash;
+    int i, n = 0, grow, res;
+    long total = 0;
+
+    if(!node || node->inode == PCACHE_NOINODE || node->dev == PROCFS_DEVID ||
+       !(d = get_mount_info(node->dev)) ||
+       d->block_size == 0 || d->block_size > PAGE_SIZE ||
+       !d->fs || !d->fs->ops || !d->fs->ops->bmap ||
+       !bdev_tab[MAJOR(node->dev)].strategy)
+    {
+        return 0;
+    }
+
+    // see the comment in get_cached_page() about checking for free space
+    if(!(d->mountflags & MS_RDONLY) &&
+       d->fs->ops->ustat && d->fs->ops->ustat(d, &ubuf) == 0 &&
+       ubuf.f_tfree < (PAGE_SIZE / d->block_size))
+    {
+        return 0;
+    }
 
-    kernel_mutex_lock(&pcachetab_lock);
+    offset &= ~(PAGE_SIZE - 1);
+    end = offset + (count * PAGE_SIZE);
 
-    for(i = 0; i < pcachetab->count; i++)
+    if(end > (off_t)node->size)
     {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
+        end = node->size;
+    }
 
-            if((pcache->flags & PCACHE_FLAG_DIRTY))
+    while(offset < end)
+    {
+        // collect a run of consecutive pages that are not in the cache
+        for(n = 0; n < PCACHE_READAHEAD_MAX && offset < end; offset += PAGE_SIZE)
+        {
+            if(!newpage && !(newpage = kmem_cache_alloc(cached_page_cache)))
             {
-                dirty++;
+                end = offset;
+                break;
             }
 
-            if((pcache->flags & PCACHE_FLAG_BUSY))
+            shard = pcache_shard(node->dev, node->inode, offset, &hash);
+            kernel_mutex_lock(&shard->lock);
+
+            if(pcache_lookup(shard, hash, node->dev, node->inode, offset))
             {
-                busy++;
+                kernel_mutex_unlock(&shard->lock);
+
+                if(n)
+                {
+                    break;
+                }
+
+                continue;
             }
 
-            if((pcache->flags & PCACHE_FLAG_WANTED))
+            pcache = newpage;
+            newpage = NULL;
+            A_memset(pcache, 0, sizeof(struct cached_page_t));
+            pcache->node = node;
+            __sync_fetch_and_add(&node->refs, 1);
+            pcache->dev = node->dev;
+            pcache->ino = node->inode;
+            pcache->offset = offset;
+            pcache->flags = PCACHE_FLAG_BUSY;
+            pcache->pid = this_core->cur_task ? this_core->cur_task->pid : 0;
+            pcache->last_accessed = ticks;
+
+            grow = pcache_insert(shard, hash, pcache);
+            kernel_mutex_unlock(&shard->lock);
+
+            if(grow)
             {
-                wanted++;
+                pcache_grow_shard(shard);
             }
 
-            if(get_frame_shares(pcache->phys) <= 1)
+            batch[n++] = pcache;
+        }
+
+        if(n == 0)
+        {
+            break;
+        }
+
+        res = read_page_batch(node, d, batch, n);
+
+        for(i = 0; i < n; i++)
+        {
+            // stale pages are removed by whoever finds them next
+            if(res < 0)
             {
-                unref++;
+                __sync_or_and_fetch(&batch[i]->flags, PCACHE_FLAG_STALE);
             }
 
-            total++;
-            hitem = hitem->next;
+            wakeup_cached_page_waiters(batch[i]);
+        }
+
+        if(res < 0)
+        {
+            break;
         }
+
+        total += n;
     }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
 
-    printk("\ntotal %ld, dirty %ld, busy %ld, unref %ld, wanted %ld\n", total, dirty, busy, unref, wanted);
+    kmem_cache_free(cached_page_cache, newpage);
+
+    return total;
 }
 
 
-long node_has_cached_pages(struct fs_node_t *node)
+/*
+ * Remove the clean, unused pages of the given file that fall in the
+ * given range from the page cache.
+ */
+void drop_cached_node_pages(struct fs_node_t *node, off_t start, off_t end)
 {
-    struct cached_page_t *pcache;
-    struct hashtab_item_t *hitem;
-    long i, refs = 0;
+    struct pcache_shard_t *shard;
+    struct cached_page_t *pcache, *next, *victims = NULL;
+    uint32_t hash;
 
-    if(!node)
+    if(!node || node->inode == PCACHE_NOINODE)
     {
-        return 0;
+        return;
     }
 
-    kernel_mutex_lock(&pcachetab_lock);
+    shard = pcache_shard(node->dev, node->inode, 0, &hash);
+    kernel_mutex_lock(&shard->lock);
 
-    for(i = 0; i < pcachetab->count; i++)
+    for(pcache = node->cached_pages; pcache != NULL; pcache = next)
     {
-        hitem = pcachetab->items[i];
-        
-        while(hitem)
-        {
-            pcache = hitem->val;
-
-            if(pcache->dev == node->dev && pcache->ino == node->inode)
-            {
-                //kernel_mutex_unlock(&pcachetab_lock);
-                //return 1;
-                refs++;
-            }
+        next = pcache->node_next;
 
-            hitem = hitem->next;
+        if(pcache->offset >= start && pcache->offset < end &&
+           PCACHE_REMOVABLE(pcache, PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED |
+                                    PCACHE_FLAG_DIRTY | PCACHE_FLAG_ALWAYS_DIRTY))
+        {
+            pcache_unlink(shard, pcache);
+            pcache->next = victims;
+            victims = pcache;
         }
     }
-    
-    kernel_mutex_unlock(&pcachetab_lock);
-    return refs;
+
+    kernel_mutex_unlock(&shard->lock);
+    release_page_list(victims);
 }
 
@@ -1,6 +1,6 @@
 /* 
  *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
- *    Copyright 2022, 2023, 2024 (c)
+ *    Copyright 2022, 2023, 2024, 2025 (c)
  * 
  *    file: pcache_internal.h
  *    This file is part of LaylaOS.
@@ -23,89 +23,329 @@
  *  \file pcache_internal.h
  *
  *  Internal functions for the page cache use.
+ *
+ *  The page cache is split into PCACHE_SHARDS shards, each with its own
+ *  lock, hash table and active/inactive LRU lists. All the pages of a file
+ *  live in the same shard (which protects the file's page list), while
+ *  disk metadata blocks are spread over all the shards.
  */
 
-#define CALC_HASH_FUNC          calc_hash_for_pcache
-#define KEY_COMPARE_FUNC        pcache_key_compare
 #include <stdint.h>
-#include <sys/hash_inline.h>
 
-// define these so we do not have to rewrite our pcache code
-#define pcache_lookup           hashtab_fast_lookup
-#define pcache_add_hitem        hashtab_fast_add_hitem
-#define pcache_remove           hashtab_fast_remove
-#define pcache_alloc_hitem      hashtab_fast_alloc_hitem
+#define PCACHE_SHARD_BITS       6
+#define PCACHE_SHARDS           (1 << PCACHE_SHARD_BITS)
+
+// each shard's hash table starts with this many buckets, and is doubled
+// when it has more than PCACHE_MAX_LOAD pages per bucket
+#define PCACHE_INIT_BUCKETS     64
+#define PCACHE_MAX_BUCKETS      65536
+#define PCACHE_MAX_LOAD         2
+
+struct pcache_shard_t
+{
+    volatile struct kernel_mutex_t lock;    // protects everything below
+    struct cached_page_t **buckets;         // hash table
+    unsigned long nbuckets;                 // always a power of 2
+    unsigned long count;                    // pages in the shard
+
+    // recently used pages are at the head of each list
+    struct cached_page_t *active, *active_tail;
+    struct cached_page_t *inactive, *inactive_tail;
+    unsigned long nr_active, nr_inactive;
+};
+
+static struct pcache_shard_t pcache_shards[PCACHE_SHARDS];
 
 
 /*
- * We will use FNV-1a hashing. The following variables and functions implement
- * this hashing function. These are the default values recommended by:
- * http://isthe.com/chongo/tech/comp/fnv/.
+ * Mix two 64-bit words into a 32-bit hash (based on the finalizer of
+ * splitmix64). This works on whole words, unlike the byte-wise FNV-1a we
+ * used to use.
  */
-static const uint32_t fnv1a_prime = 0x01000193; /* 16777619 */
-static const uint32_t fnv1a_seed  = 0x811C9DC5; /* 2166136261 */
+STATIC_INLINE uint32_t pcache_mix(uint64_t a, uint64_t b)
+{
+    uint64_t h = a ^ (b * 0x9E3779B97F4A7C15ULL);
+
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+
+    return (uint32_t)(h ^ (h >> 31) ^ (h >> 32));
+}
 
 
 /*
- * The FNV-1a hasing function.
- * Returns a 32-bit hash index.
+ * Calculate the hash of the given page, and return the shard it belongs to.
+ * The low bits of the hash select the shard, the rest select the bucket.
  */
-STATIC_INLINE uint32_t fnv1a_internal(void *__key, uint32_t hash)
+STATIC_INLINE struct pcache_shard_t *pcache_shard(dev_t dev, ino_t ino,
+                                                  off_t offset, uint32_t *hash)
 {
-    struct pcache_key_t *key = (struct pcache_key_t *)__key;
-    uint8_t *p = (uint8_t *)key;
-    uint8_t *lp = p + sizeof(struct pcache_key_t) /* 24 */;
+    uint32_t ihash = pcache_mix((uint64_t)dev, (uint64_t)ino);
+
+    *hash = pcache_mix((uint64_t)ihash, (uint64_t)offset);
 
-    while(p < lp)
+    // keep all the pages of a file in the same shard
+    if(ino != PCACHE_NOINODE)
     {
-        hash = (*p++ ^ hash) * fnv1a_prime;
+        return &pcache_shards[ihash & (PCACHE_SHARDS - 1)];
     }
 
-    return hash;
+    return &pcache_shards[*hash & (PCACHE_SHARDS - 1)];
+}
+
+#define PCACHE_BUCKET(shard, hash)      \
+    (((hash) >> PCACHE_SHARD_BITS) & ((shard)->nbuckets - 1))
+
+STATIC_INLINE struct pcache_shard_t *pcache_shard_of(struct cached_page_t *pcache)
+{
+    uint32_t hash;
+
+    return pcache_shard(pcache->dev, pcache->ino, pcache->offset, &hash);
 }
 
 
 /*
- * Calculate and return the hash index of the given key.
- * 
- * TODO: If you want to use another hashing algorithm, change the
- *       function call to fnv1a() to any other function.
+ * The functions below must be called with the shard lock held.
+ */
+
+STATIC_INLINE struct cached_page_t *pcache_lookup(struct pcache_shard_t *shard,
+                                                  uint32_t hash, dev_t dev,
+                                                  ino_t ino, off_t offset)
+{
+    struct cached_page_t *pcache = shard->buckets[PCACHE_BUCKET(shard, hash)];
+
+    for( ; pcache != NULL; pcache = pcache->next)
+    {
+        if(pcache->dev == dev && pcache->ino == ino && pcache->offset == offset)
+        {
+            return pcache;
+        }
+    }
+
+    return NULL;
+}
+
+
+STATIC_INLINE void lru_add(struct cached_page_t **head,
+                           struct cached_page_t **tail,
+                           struct cached_page_t *pcache)
+{
+    pcache->lru_prev = NULL;
+    pcache->lru_next = *head;
+
+    if(*head)
+    {
+        (*head)->lru_prev = pcache;
+    }
+    else
+    {
+        *tail = pcache;
+    }
+
+    *head = pcache;
+}
+
+
+STATIC_INLINE void lru_add_tail(struct cached_page_t **head,
+                                struct cached_page_t **tail,
+                                struct cached_page_t *pcache)
+{
+    pcache->lru_next = NULL;
+    pcache->lru_prev = *tail;
+
+    if(*tail)
+    {
+        (*tail)->lru_next = pcache;
+    }
+    else
+    {
+        *head = pcache;
+    }
+
+    *tail = pcache;
+}
+
+
+STATIC_INLINE void lru_remove(struct cached_page_t **head,
+                              struct cached_page_t **tail,
+                              struct cached_page_t *pcache)
+{
+    if(pcache->lru_prev)
+    {
+        pcache->lru_prev->lru_next = pcache->lru_next;
+    }
+    else
+    {
+        *head = pcache->lru_next;
+    }
+
+    if(pcache->lru_next)
+    {
+        pcache->lru_next->lru_prev = pcache->lru_prev;
+    }
+    else
+    {
+        *tail = pcache->lru_prev;
+    }
+
+    pcache->lru_prev = NULL;
+    pcache->lru_next = NULL;
+}
+
+
+STATIC_INLINE void lru_del(struct pcache_shard_t *shard,
+                           struct cached_page_t *pcache)
+{
+    if(pcache->flags & PCACHE_FLAG_ACTIVE)
+    {
+        lru_remove(&shard->active, &shard->active_tail, pcache);
+        __sync_and_and_fetch(&pcache->flags, ~PCACHE_FLAG_ACTIVE);
+        shard->nr_active--;
+    }
+    else
+    {
+        lru_remove(&shard->inactive, &shard->inactive_tail, pcache);
+        shard->nr_inactive--;
+    }
+}
+
+
+/*
+ * Move the given page to the head of the active list, and keep the active
+ * list no longer than the inactive list by moving the least recently used
+ * active pages to the inactive list.
  */
-STATIC_INLINE uint32_t calc_hash_for_pcache(struct hashtab_t *h, void *key)
+STATIC_INLINE void lru_touch(struct pcache_shard_t *shard,
+                             struct cached_page_t *pcache)
+{
+    struct cached_page_t *tmp;
+
+    lru_del(shard, pcache);
+    lru_add(&shard->active, &shard->active_tail, pcache);
+    __sync_or_and_fetch(&pcache->flags, PCACHE_FLAG_ACTIVE);
+    shard->nr_active++;
+
+    while(shard->nr_active > shard->nr_inactive &&
+          (tmp = shard->active_tail) && tmp != pcache)
+    {
+        lru_del(shard, tmp);
+        lru_add(&shard->inactive, &shard->inactive_tail, tmp);
+        shard->nr_inactive++;
+    }
+}
+
+
+STATIC_INLINE void node_page_add(struct fs_node_t *node,
+                                 struct cached_page_t *pcache)
 {
-    if(!h || !key)
+    pcache->node_prev = NULL;
+    pcache->node_next = node->cached_pages;
+
+    if(node->cached_pages)
     {
-        return 0;
+        node->cached_pages->node_prev = pcache;
     }
 
-    return fnv1a_internal(key, fnv1a_seed) % h->count;
+    node->cached_pages = pcache;
+    node->nr_cached_pages++;
+}
+
+
+STATIC_INLINE void node_page_remove(struct fs_node_t *node,
+                                    struct cached_page_t *pcache)
+{
+    if(pcache->node_prev)
+    {
+        pcache->node_prev->node_next = pcache->node_next;
+    }
+    else
+    {
+        node->cached_pages = pcache->node_next;
+    }
+
+    if(pcache->node_next)
+    {
+        pcache->node_next->node_prev = pcache->node_prev;
+    }
+
+    pcache->node_prev = NULL;
+    pcache->node_next = NULL;
+    node->nr_cached_pages--;
 }
 
 
 /*
- * Compare two keys (used to compare hash keys).
- *
- * Returns 0 if the two pointers are equal (similar to strcmp(), which we use
- * to compare string hash keys).
+ * Add a new page to the hash table, the inactive list and its file's list.
+ * Returns non-zero if the shard's hash table needs to grow.
  */
-STATIC_INLINE int pcache_key_compare(void *p1, void *p2)
+STATIC_INLINE int pcache_insert(struct pcache_shard_t *shard, uint32_t hash,
+                                struct cached_page_t *pcache)
 {
-    struct pcache_key_t *k1 = (struct pcache_key_t *)p1;
-    struct pcache_key_t *k2 = (struct pcache_key_t *)p2;
+    unsigned long i = PCACHE_BUCKET(shard, hash);
+
+    pcache->next = shard->buckets[i];
+    shard->buckets[i] = pcache;
+    shard->count++;
+
+    lru_add(&shard->inactive, &shard->inactive_tail, pcache);
+    shard->nr_inactive++;
+
+    if(pcache->node)
+    {
+        node_page_add(pcache->node, pcache);
+    }
 
-    return !(k1->dev == k2->dev && k1->ino == k2->ino && k1->offset == k2->offset);
+    return (shard->count > shard->nbuckets * PCACHE_MAX_LOAD &&
+            shard->nbuckets < PCACHE_MAX_BUCKETS);
 }
 
 
 /*
- * Initialise the pcache table.
+ * Remove a page from the hash table and the lists it is on. After this,
+ * no one can find the page, and the caller can release it after unlocking
+ * the shard. The page's next field is free for the caller to use.
  */
-void init_pcache(void)
+STATIC_INLINE void pcache_unlink(struct pcache_shard_t *shard,
+                                 struct cached_page_t *pcache)
 {
-    if(!(pcachetab = hashtab_create(INIT_HASHSZ, calc_hash_for_pcache, 
-                                    pcache_key_compare)))
+    struct cached_page_t **p;
+    uint32_t hash;
+
+    pcache_shard(pcache->dev, pcache->ino, pcache->offset, &hash);
+
+    for(p = &shard->buckets[PCACHE_BUCKET(shard, hash)]; *p; p = &(*p)->next)
     {
-        kpanic("Failed to initialise kernel page cache table\n");
+        if(*p == pcache)
+        {
+            *p = pcache->next;
+            break;
+        }
+    }
+
+    pcache->next = NULL;
+    shard->count--;
+    lru_del(shard, pcache);
+
+    if(pcache->node)
+    {
+        node_page_remove(pcache->node, pcache);
     }
 }
 
+
+/*
+ * Can the given page be removed from the cache right now?
+ */
+#define PCACHE_REMOVABLE(pcache, busy_flags)                    \
+    (!((pcache)->flags & (busy_flags)) &&                       \
+     get_frame_shares((pcache)->phys) <= 1)
+
+/*
+ * Walk all the pages in a shard (the shard lock must be held). The loop
+ * body must not unlink pages.
+ */
+#define for_each_shard_page(shard, i, pcache)                           \
+    for(i = 0; i < (shard)->nbuckets; i++)                              \
+        for(pcache = (shard)->buckets[i]; pcache != NULL;               \
+            pcache = pcache->next)
+
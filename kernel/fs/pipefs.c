@@ -34,18 +34,418 @@
 #include <kernel/ksignal.h>
 #include <kernel/user.h>
 #include <kernel/fcntl.h>
+#include <kernel/pcache.h>
 #include <mm/mmngr_phys.h>
+#include <mm/mmngr_virtual.h>
 #include <mm/kstack.h>
+#include <mm/kheap.h>
 #include <fs/pipefs.h>
 
 
-#define PIPE_SIZE               (PAGE_SIZE * 2)
+#define PIPE_BUF_AT(pipe, i)    \
+    (&(pipe)->bufs[((pipe)->head + (i)) & ((pipe)->nbufs - 1)])
 
-#define EMPTY_PIPE(head, tail)  ((head) == (tail))
-#define FULL_PIPE(head, tail)   ((((tail) + 1) & (PIPE_SIZE - 1)) == (head))
+#define PIPE_FULL(pipe)         ((pipe)->count == (pipe)->nbufs)
 
-#define PIPE_USED(head, tail)   ((tail + PIPE_SIZE - head) & (PIPE_SIZE - 1))
-#define PIPE_SPACE_FOR(head, tail, n)   ((PIPE_SIZE - PIPE_USED(head, tail)) >= n)
+
+/*
+ * Get a page to copy data into, using our spare page if we have one.
+ */
+static unsigned char *pipe_get_page(struct pipe_t *pipe)
+{
+    physical_addr phys;
+    virtual_addr virt;
+
+    if(pipe->spare)
+    {
+        unsigned char *page = pipe->spare;
+
+        pipe->spare = NULL;
+        return page;
+    }
+
+    if(get_next_addr(&phys, &virt, PTE_FLAGS_PW, REGION_PIPE) != 0)
+    {
+        return NULL;
+    }
+
+    return (unsigned char *)virt;
+}
+
+
+/*
+ * Free a page, or keep it as our spare page if we don't have one.
+ */
+static void pipe_put_page(struct pipe_t *pipe, unsigned char *page)
+{
+    if(!pipe->spare)
+    {
+        pipe->spare = page;
+        return;
+    }
+
+    vmmngr_free_pages((virtual_addr)page, PAGE_SIZE);
+}
+
+
+/*
+ * Get the next free buffer in the pipe. The caller must make sure the pipe
+ * is not full.
+ */
+static inline struct pipe_buf_t *pipe_new_buf(struct pipe_t *pipe)
+{
+    struct pipe_buf_t *pb = PIPE_BUF_AT(pipe, pipe->count);
+
+    pb->pcache = NULL;
+    pb->page = NULL;
+    pb->offset = 0;
+    pb->len = 0;
+
+    // empty -> non-empty
+    if(pipe->count++ == 0)
+    {
+        pipe->wake |= PIPE_WAKE_READERS;
+    }
+
+    return pb;
+}
+
+
+/*
+ * Release a buffer, dropping our reference to its page if it was spliced
+ * from the page cache, or freeing the page if it is ours.
+ */
+static inline void pipe_buf_release(struct pipe_t *pipe, struct pipe_buf_t *pb)
+{
+    if(pb->pcache)
+    {
+        put_cached_page_ref(pb->pcache);
+        pb->pcache = NULL;
+    }
+    else if(pb->page)
+    {
+        pipe_put_page(pipe, pb->page);
+    }
+
+    pb->page = NULL;
+    pb->offset = 0;
+    pb->len = 0;
+}
+
+
+/*
+ * Remove the first buffer from the pipe.
+ */
+static inline void pipe_pop_buf(struct pipe_t *pipe)
+{
+    pipe_buf_release(pipe, PIPE_BUF_AT(pipe, 0));
+    pipe->head = (pipe->head + 1) & (pipe->nbufs - 1);
+
+    // full -> non-full
+    if(pipe->count-- == pipe->nbufs)
+    {
+        pipe->wake |= PIPE_WAKE_WRITERS;
+    }
+}
+
+
+/*
+ * Wake up whoever is waiting for the changes we made to the pipe. Called
+ * with the pipe locked.
+ */
+static void pipe_kick(struct fs_node_t *node, struct pipe_t *pipe)
+{
+    int wake = pipe->wake;
+
+    if(!wake)
+    {
+        return;
+    }
+
+    pipe->wake = 0;
+
+    if((wake & PIPE_WAKE_READERS) && pipe->rd_waiting)
+    {
+        unblock_all_tasks(&pipe->rd_waiting);
+    }
+
+    if((wake & PIPE_WAKE_WRITERS) && pipe->wr_waiting)
+    {
+        unblock_all_tasks(&pipe->wr_waiting);
+    }
+
+    selwakeup(&node->select_channel);
+}
+
+
+/*
+ * Unlock the pipe, waking up whoever is waiting for the changes we made.
+ */
+static inline void pipe_unlock(struct fs_node_t *node, struct pipe_t *pipe)
+{
+    pipe_kick(node, pipe);
+    kernel_mutex_unlock(&pipe->lock);
+}
+
+
+/*
+ * Remove the given number of bytes from the front of the pipe.
+ */
+static void pipe_consume(struct pipe_t *pipe, size_t count)
+{
+    struct pipe_buf_t *pb;
+    size_t n;
+
+    while(count != 0 && pipe->count != 0)
+    {
+        pb = PIPE_BUF_AT(pipe, 0);
+        n = (pb->len < count) ? pb->len : count;
+        pb->offset += n;
+        pb->len -= n;
+        pipe->bytes -= n;
+        count -= n;
+
+        if(pb->len == 0)
+        {
+            pipe_pop_buf(pipe);
+        }
+    }
+}
+
+
+/*
+ * How many bytes can be copied into the pipe without waiting.
+ *
+ * NOTE: A writer waiting for up to PIPE_BUF (i.e. PAGE_SIZE) bytes can only
+ *       be short of space if all the buffers are in use, which is why waking
+ *       writers on full -> non-full transitions is enough.
+ */
+static inline size_t pipe_space(struct pipe_t *pipe)
+{
+    size_t space = (pipe->nbufs - pipe->count) * PAGE_SIZE;
+    struct pipe_buf_t *pb;
+
+    // we can append to the last buffer if it is one of our own pages
+    if(pipe->count != 0)
+    {
+        pb = PIPE_BUF_AT(pipe, pipe->count - 1);
+
+        if(!pb->pcache)
+        {
+            space += PAGE_SIZE - (pb->offset + pb->len);
+        }
+    }
+
+    return space;
+}
+
+
+/*
+ * Copy data into the pipe's own pages. Called with the pipe locked.
+ * Returns the number of bytes copied, which can be less than count if the
+ * pipe fills up. If nothing is copied because we fault on a user address or
+ * run out of memory, -(errno) is returned.
+ */
+static ssize_t pipe_fill(struct pipe_t *pipe, unsigned char *buf,
+                         size_t count, int kernel)
+{
+    struct pipe_buf_t *pb;
+    unsigned char *page;
+    size_t done = 0, n, off;
+    ssize_t err = 0;
+
+    while(done < count)
+    {
+        pb = pipe->count ? PIPE_BUF_AT(pipe, pipe->count - 1) : NULL;
+
+        if(!pb || pb->pcache || pb->offset + pb->len == PAGE_SIZE)
+        {
+            if(PIPE_FULL(pipe))
+            {
+                break;
+            }
+
+            if(!(page = pipe_get_page(pipe)))
+            {
+                err = -ENOMEM;
+                break;
+            }
+
+            pb = pipe_new_buf(pipe);
+            pb->page = page;
+        }
+
+        off = pb->offset + pb->len;
+        n = PAGE_SIZE - off;
+
+        if(n > count - done)
+        {
+            n = count - done;
+        }
+
+        if(kernel)
+        {
+            A_memcpy(pb->page + off, buf + done, n);
+        }
+        else if(copy_from_user(pb->page + off, buf + done, n) != 0)
+        {
+            // don't leave an empty buffer behind
+            if(pb->len == 0)
+            {
+                pipe_buf_release(pipe, pb);
+                pipe->count--;
+            }
+
+            err = -EFAULT;
+            break;
+        }
+
+        pb->len += n;
+        pipe->bytes += n;
+        done += n;
+    }
+
+    return done ? (ssize_t)done : err;
+}
+
+
+/*
+ * Copy data out of the pipe. Called with the pipe locked.
+ */
+static size_t pipe_drain(struct pipe_t *pipe, unsigned char *buf,
+                         size_t count, int kernel)
+{
+    struct pipe_buf_t *pb;
+    size_t done = 0, n;
+
+    while(done < count && pipe->count != 0)
+    {
+        pb = PIPE_BUF_AT(pipe, 0);
+        n = (pb->len < count - done) ? pb->len : count - done;
+
+        if(kernel)
+        {
+            A_memcpy(buf + done, pb->page + pb->offset, n);
+        }
+        else if(copy_to_user(buf + done, pb->page + pb->offset, n) != 0)
+        {
+            break;
+        }
+
+        pipe_consume(pipe, n);
+        done += n;
+    }
+
+    return done;
+}
+
+
+/*
+ * Sleep until the other end of the pipe does something. Called with the pipe
+ * locked, and returns with it locked. Before sleeping, the other end is
+ * woken up if it is waiting for what we have done so far.
+ */
+static int pipe_sleep(struct fs_node_t *node, struct pipe_t *pipe,
+                      int *waiting)
+{
+    int res;
+
+    pipe_kick(node, pipe);
+
+    (*waiting)++;
+    res = block_task2_and_unlock(waiting, 0, &pipe->lock);
+    kernel_mutex_lock(&pipe->lock);
+    (*waiting)--;
+
+    return (res == EINTR) ? -EINTR : 0;
+}
+
+
+/*
+ * Wait for data in the pipe. Called with the pipe locked, and returns with
+ * it locked. Returns 0 if there is data, 1 if the pipe is empty and there
+ * are no writers, -(errno) on failure.
+ */
+static int pipe_wait_data(struct fs_node_t *node, struct pipe_t *pipe,
+                          int nonblock)
+{
+    int res;
+
+    while(pipe->count == 0)
+    {
+        if(node->refs < 2)     // no more writers
+        {
+            return 1;
+        }
+
+        if(nonblock)
+        {
+            return -EAGAIN;
+        }
+
+        if((res = pipe_sleep(node, pipe, &pipe->rd_waiting)) < 0)
+        {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Wait for room in the pipe. If need is non-zero, we wait until need bytes
+ * can be copied into the pipe, otherwise we wait for a free buffer. Called
+ * with the pipe locked, and returns with it locked. Returns 0 if there is
+ * room, -(errno) on failure.
+ */
+static int pipe_wait_space(struct fs_node_t *node, struct pipe_t *pipe,
+                           size_t need, int nonblock)
+{
+    int res;
+
+    while(1)
+    {
+        if(node->refs < 2)     // no readers
+        {
+            return -EPIPE;
+        }
+
+        if(need ? (pipe_space(pipe) >= need) : !PIPE_FULL(pipe))
+        {
+            return 0;
+        }
+
+        if(nonblock)
+        {
+            return -EAGAIN;
+        }
+
+        if((res = pipe_sleep(node, pipe, &pipe->wr_waiting)) < 0)
+        {
+            return res;
+        }
+    }
+}
+
+
+/*
+ * Lock two pipes in a fixed order so two tasks splicing in opposite
+ * directions don't deadlock.
+ */
+static inline void pipe_lock_two(struct pipe_t *p1, struct pipe_t *p2)
+{
+    if(p1 < p2)
+    {
+        kernel_mutex_lock(&p1->lock);
+        kernel_mutex_lock(&p2->lock);
+    }
+    else
+    {
+        kernel_mutex_lock(&p2->lock);
+        kernel_mutex_lock(&p1->lock);
+    }
+}
 
 
 /*
@@ -53,12 +453,27 @@
  */
 void pipefs_free_node(struct fs_node_t *node)
 {
-    vmmngr_free_pages((virtual_addr)node->size, PIPE_SIZE);
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
 
+    if(pipe)
+    {
+        while(pipe->count != 0)
+        {
+            pipe_pop_buf(pipe);
+        }
+
+        if(pipe->spare)
+        {
+            vmmngr_free_pages((virtual_addr)pipe->spare, PAGE_SIZE);
+        }
+
+        kfree(pipe->bufs);
+        kfree(pipe);
+    }
+
+    node->data = NULL;
     node->size = 0;
     node->refs = 0;
-    node->blocks[0] = 0;    // pipe head pointer
-    node->blocks[1] = 0;    // pipe tail pointer
 }
 
 
@@ -68,28 +483,36 @@ void pipefs_free_node(struct fs_node_t *node)
 struct fs_node_t *pipefs_get_node(void)
 {
     struct fs_node_t *node;
-    physical_addr phys;
-    int flags = (this_core->cur_task->user ? I86_PTE_USER : 0) |
-                  I86_PTE_PRESENT | I86_PTE_WRITABLE;
+    struct pipe_t *pipe;
 
-    // get a free node
-    if((node = get_empty_node()) == NULL)
+    if(!(pipe = kmalloc(sizeof(struct pipe_t))))
     {
         return NULL;
     }
-    
-    if((node->size = vmmngr_alloc_and_map(PIPE_SIZE, 0,
-                                          flags, &phys, 
-                                          REGION_PIPE)) == 0)
+
+    A_memset(pipe, 0, sizeof(struct pipe_t));
+    pipe->nbufs = PIPE_BUFFERS;
+
+    if(!(pipe->bufs = kmalloc(pipe->nbufs * sizeof(struct pipe_buf_t))))
+    {
+        kfree(pipe);
+        return NULL;
+    }
+
+    A_memset(pipe->bufs, 0, pipe->nbufs * sizeof(struct pipe_buf_t));
+
+    // get a free node
+    if((node = get_empty_node()) == NULL)
     {
-        node->refs = 0;
+        kfree(pipe->bufs);
+        kfree(pipe);
         return NULL;
     }
 
     // exactly 2 = reader + writer
     node->refs = 2;
-    node->blocks[0] = 0;    // pipe head pointer
-    node->blocks[1] = 0;    // pipe tail pointer
+    node->size = 0;
+    node->data = pipe;
     node->mode = S_IFIFO;
     node->flags |= FS_NODE_PIPE;
 
@@ -104,16 +527,15 @@ struct fs_node_t *pipefs_get_node(void)
 
 
 /*
- * Read from a pipe.
+ * Copy data out of a pipe.
  */
-ssize_t pipefs_read(struct file_t *f, off_t *pos,
-                    unsigned char *buf, size_t _count, int kernel)
+ssize_t pipefs_copy_out(struct file_t *f, unsigned char *buf, size_t count,
+                        int kernel, int nonblock)
 {
-    UNUSED(pos);
-
     struct fs_node_t *node = f->node;
-    volatile size_t count = _count;
-    volatile unsigned long head, tail;
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+    size_t done;
+    int res;
 
     if(!(f->mode & PREAD_MODE))
     {
@@ -134,75 +556,40 @@ ssize_t pipefs_read(struct file_t *f, off_t *pos,
         return 0;
     }
 
-    // now read
-    unsigned char *d = buf;
-    unsigned char *s = (unsigned char *)node->size;
-    head = node->blocks[1];
-    tail = node->blocks[0];
-
-    if(node->size == 0)
+    if(!pipe)
     {
         kpanic("pipefs: reading from a deallocated pipe\n");
     }
 
+    kernel_mutex_lock(&pipe->lock);
+
     // if the pipe is empty:
     //   - return 0 if the writing end is closed
     //   - return -EAGAIN if this is a non-blocking file descriptor
     //   - sleep and wait for input otherwise
-    while(EMPTY_PIPE(head, tail))
+    if((res = pipe_wait_data(node, pipe, nonblock)) != 0)
     {
-        selwakeup(&node->select_channel);   // wakeup writers
-
-        if(node->refs < 2)     // no more writers
-        {
-            return 0;
-        }
-
-        if(f->flags & O_NONBLOCK)
-        {
-            return -EAGAIN;
-        }
-
-        selrecord(&node->select_channel);
-
-        // wait for writers
-        if(block_task2(&node->select_channel, PIT_FREQUENCY * 3) == EINTR)
-        {
-            return -EINTR;
-        }
-
-        head = node->blocks[1];
-        tail = node->blocks[0];
+        kernel_mutex_unlock(&pipe->lock);
+        return (res > 0) ? 0 : res;
     }
 
-    while(count != 0 && !EMPTY_PIPE(head, tail))
-    {
-        count--;
-
-        *d = s[head];
-        d++;
+    done = pipe_drain(pipe, buf, count, kernel);
+    pipe_unlock(node, pipe);
 
-        head = (head + 1) & (PIPE_SIZE - 1);
-        node->blocks[1] = head;
-        tail = node->blocks[0];
-    }
-
-    selwakeup(&node->select_channel);   // wakeup writers
-    return d - buf;
+    return done ? (ssize_t)done : -EFAULT;
 }
 
 
 /*
- * Write to a pipe.
+ * Copy data into a pipe.
  */
-ssize_t pipefs_write(struct file_t *f, off_t *pos,
-                     unsigned char *buf, size_t _count, int kernel)
+ssize_t pipefs_copy_in(struct file_t *f, unsigned char *buf, size_t count,
+                       int kernel, int nonblock)
 {
-    UNUSED(pos);
-
     struct fs_node_t *node = f->node;
-    volatile size_t count = _count;
-    volatile unsigned long head, tail;
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+    size_t done = 0;
+    ssize_t res = 0;
 
     if(!(f->mode & PWRITE_MODE))
     {
@@ -229,13 +616,7 @@ ssize_t pipefs_write(struct file_t *f, off_t *pos,
         return 0;
     }
 
-    // now write
-    unsigned char *d = buf;
-    unsigned char *s = (unsigned char *)node->size;
-    head = node->blocks[1];
-    tail = node->blocks[0];
-
-    if(node->size == 0)
+    if(!pipe)
     {
         kpanic("pipefs: writing to a deallocated pipe\n");
     }
@@ -267,55 +648,378 @@ ssize_t pipefs_write(struct file_t *f, off_t *pos,
      *        with writes by other processes.
      */
 
-    if((f->flags & O_NONBLOCK) && !PIPE_SPACE_FOR(head, tail, count))
+    kernel_mutex_lock(&pipe->lock);
+
+    while(done < count)
     {
-        if(count <= PIPE_BUF || FULL_PIPE(head, tail))
+        if((res = pipe_wait_space(node, pipe, (count <= PIPE_BUF) ? count : 1,
+                                  nonblock)) < 0)
         {
-            return -EAGAIN;
+            break;
+        }
+
+        if((res = pipe_fill(pipe, buf + done, count - done, kernel)) <= 0)
+        {
+            break;
         }
+
+        done += res;
+    }
+
+    pipe_unlock(node, pipe);
+
+    if(done)
+    {
+        return done;
+    }
+
+    if(res == -EPIPE)
+    {
+        user_add_task_signal(this_core->cur_task, SIGPIPE, 1);
+    }
+
+    return res;
+}
+
+
+/*
+ * Read from a pipe.
+ */
+ssize_t pipefs_read(struct file_t *f, off_t *pos,
+                    unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    return pipefs_copy_out(f, buf, count, kernel, (f->flags & O_NONBLOCK));
+}
+
+
+/*
+ * Write to a pipe.
+ */
+ssize_t pipefs_write(struct file_t *f, off_t *pos,
+                     unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    return pipefs_copy_in(f, buf, count, kernel, (f->flags & O_NONBLOCK));
+}
+
+
+/*
+ * Splice a cached page into a pipe.
+ */
+ssize_t pipefs_splice_page(struct file_t *f, struct cached_page_t *pcache,
+                           size_t offset, size_t len, int nonblock)
+{
+    struct fs_node_t *node = f->node;
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+    struct pipe_buf_t *pb;
+    int res;
+
+    if(!(f->mode & PWRITE_MODE))
+    {
+        return -EINVAL;
+    }
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    kernel_mutex_lock(&pipe->lock);
+
+    if((res = pipe_wait_space(node, pipe, 0, nonblock)) == 0)
+    {
+        pb = pipe_new_buf(pipe);
+        pb->pcache = pcache;
+        pb->page = (unsigned char *)pcache->virt;
+        pb->offset = offset;
+        pb->len = len;
+        pipe->bytes += len;
+    }
+
+    pipe_unlock(node, pipe);
+
+    if(res == 0)
+    {
+        return len;
+    }
+
+    if(res == -EPIPE)
+    {
+        user_add_task_signal(this_core->cur_task, SIGPIPE, 1);
+    }
+
+    return res;
+}
+
+
+/*
+ * Splice data out of a pipe.
+ */
+ssize_t pipefs_splice_read(struct file_t *f, size_t count, int nonblock,
+                           pipe_actor_t actor, void *arg)
+{
+    struct fs_node_t *node = f->node;
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+    struct pipe_buf_t *pb;
+    size_t done = 0, n;
+    ssize_t res;
+
+    if(!(f->mode & PREAD_MODE))
+    {
+        return -EINVAL;
+    }
+
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    kernel_mutex_lock(&pipe->lock);
+
+    if((res = pipe_wait_data(node, pipe, nonblock)) != 0)
+    {
+        kernel_mutex_unlock(&pipe->lock);
+        return (res > 0) ? 0 : res;
     }
 
-    while(count != 0)
+    while(done < count && pipe->count != 0)
     {
-        count--;
+        pb = PIPE_BUF_AT(pipe, 0);
+        n = (pb->len < count - done) ? pb->len : count - done;
 
-        while(FULL_PIPE(head, tail))
+        if((res = actor(arg, pb->page + pb->offset, n)) <= 0)
         {
-            selwakeup(&node->select_channel);   // wakeup readers
+            break;
+        }
 
-            if(node->refs < 2)     // no readers
-            {
-                user_add_task_signal(this_core->cur_task, SIGPIPE, 1);
-                return -EPIPE;
-            }
+        pipe_consume(pipe, res);
+        done += res;
+
+        if((size_t)res < n)
+        {
+            break;
+        }
+    }
 
-            if((f->flags & O_NONBLOCK) && _count > PIPE_BUF)
+    pipe_unlock(node, pipe);
+
+    return done ? (ssize_t)done : res;
+}
+
+
+/*
+ * Duplicate data from one pipe into another. Called with both pipes locked.
+ */
+static size_t pipe_dup(struct pipe_t *ipipe, struct pipe_t *opipe,
+                       size_t count, int move)
+{
+    struct pipe_buf_t *ib, *ob;
+    size_t done = 0, n;
+    ssize_t copied;
+    int i;
+
+    for(i = 0; i < ipipe->count && done < count; i++)
+    {
+        ib = PIPE_BUF_AT(ipipe, i);
+        n = (ib->len < count - done) ? ib->len : count - done;
+
+        // pass page cache pages by reference, moving our reference if the
+        // whole buffer is consumed, or taking a new one otherwise
+        if(ib->pcache && !PIPE_FULL(opipe) &&
+           ((move && n == ib->len) || dup_cached_page_ref(ib->pcache) == 0))
+        {
+            ob = pipe_new_buf(opipe);
+            ob->pcache = ib->pcache;
+            ob->page = ib->page;
+            ob->offset = ib->offset;
+            ob->len = n;
+            opipe->bytes += n;
+            copied = n;
+
+            if(move && n == ib->len)
             {
-                return d - buf;
+                ib->pcache = NULL;
+                ib->page = NULL;
             }
+        }
+        else if((copied = pipe_fill(opipe, ib->page + ib->offset, n, 1)) < 0)
+        {
+            break;
+        }
+
+        done += copied;
+
+        if((size_t)copied < n)
+        {
+            break;
+        }
+    }
+
+    if(move)
+    {
+        pipe_consume(ipipe, done);
+    }
+
+    return done;
+}
+
 
-            selrecord(&node->select_channel);
+/*
+ * Splice data between two pipes.
+ */
+ssize_t pipefs_splice_pipe(struct file_t *in, struct file_t *out,
+                           size_t count, int nonblock, int move)
+{
+    struct fs_node_t *inode = in->node, *onode = out->node;
+    struct pipe_t *ipipe = (struct pipe_t *)inode->data;
+    struct pipe_t *opipe = (struct pipe_t *)onode->data;
+    size_t done;
+    int res;
+
+    if(!(in->mode & PREAD_MODE) || !(out->mode & PWRITE_MODE) ||
+       ipipe == opipe)
+    {
+        return -EINVAL;
+    }
+
+    if(count == 0)
+    {
+        return 0;
+    }
 
-            // wait for readers
-            if(block_task2(&node->select_channel, PIT_FREQUENCY * 3) == EINTR)
+    while(1)
+    {
+        kernel_mutex_lock(&ipipe->lock);
+        res = pipe_wait_data(inode, ipipe, nonblock);
+        kernel_mutex_unlock(&ipipe->lock);
+
+        if(res != 0)
+        {
+            return (res > 0) ? 0 : res;
+        }
+
+        kernel_mutex_lock(&opipe->lock);
+        res = pipe_wait_space(onode, opipe, 1, nonblock);
+        kernel_mutex_unlock(&opipe->lock);
+
+        if(res != 0)
+        {
+            if(res == -EPIPE)
             {
-                return -EINTR;
+                user_add_task_signal(this_core->cur_task, SIGPIPE, 1);
             }
 
-            head = node->blocks[1];
-            tail = node->blocks[0];
+            return res;
         }
 
-        s[tail] = *d++;
+        pipe_lock_two(ipipe, opipe);
+        done = pipe_dup(ipipe, opipe, count, move);
+        pipe_unlock(onode, opipe);
+        pipe_unlock(inode, ipipe);
+
+        // someone else got there first, try again
+        if(done == 0)
+        {
+            continue;
+        }
+
+        return done;
+    }
+}
+
+
+/*
+ * Wake up a pipe's sleepers when one end is closed.
+ */
+void pipefs_hangup(struct fs_node_t *node)
+{
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+
+    if(!pipe)
+    {
+        return;
+    }
+
+    kernel_mutex_lock(&pipe->lock);
+    pipe->wake |= (PIPE_WAKE_READERS | PIPE_WAKE_WRITERS);
+    pipe_unlock(node, pipe);
+}
+
+
+/*
+ * Get a pipe's capacity.
+ */
+long pipefs_get_size(struct fs_node_t *node)
+{
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+
+    return pipe->nbufs * PAGE_SIZE;
+}
+
+
+/*
+ * Set a pipe's capacity.
+ */
+long pipefs_set_size(struct fs_node_t *node, int size)
+{
+    struct pipe_t *pipe = (struct pipe_t *)node->data;
+    struct pipe_buf_t *bufs;
+    int i, nbufs = 1;
+
+    if(size <= 0)
+    {
+        return -EINVAL;
+    }
+
+    if(size > PIPE_MAX_SIZE && !suser(this_core->cur_task))
+    {
+        return -EPERM;
+    }
+
+    // round up to a power of 2 number of pages
+    while(nbufs * PAGE_SIZE < (size_t)size)
+    {
+        nbufs <<= 1;
+    }
+
+    if(!(bufs = kmalloc(nbufs * sizeof(struct pipe_buf_t))))
+    {
+        return -ENOMEM;
+    }
 
-        tail = (tail + 1) & (PIPE_SIZE - 1);
-        node->blocks[0] = tail;
-        head = node->blocks[1];
+    A_memset(bufs, 0, nbufs * sizeof(struct pipe_buf_t));
+    kernel_mutex_lock(&pipe->lock);
+
+    // we can't drop the data already in the pipe
+    if(pipe->count > nbufs)
+    {
+        kernel_mutex_unlock(&pipe->lock);
+        kfree(bufs);
+        return -EBUSY;
+    }
+
+    for(i = 0; i < pipe->count; i++)
+    {
+        bufs[i] = *PIPE_BUF_AT(pipe, i);
+    }
+
+    kfree(pipe->bufs);
+
+    // full -> non-full
+    if(pipe->count == pipe->nbufs && nbufs > pipe->nbufs)
+    {
+        pipe->wake |= PIPE_WAKE_WRITERS;
     }
 
-    selwakeup(&node->select_channel);   // wakeup readers
+    pipe->bufs = bufs;
+    pipe->nbufs = nbufs;
+    pipe->head = 0;
+    pipe_unlock(node, pipe);
 
-    return d - buf;
+    return nbufs * PAGE_SIZE;
 }
 
 
@@ -324,33 +1028,30 @@ ssize_t pipefs_write(struct file_t *f, off_t *pos,
  */
 long pipefs_select(struct file_t *f, int which)
 {
+    struct pipe_t *pipe = (struct pipe_t *)f->node->data;
+    long res = 0;
+
+    kernel_mutex_lock(&pipe->lock);
+
 	switch(which)
 	{
     	case FREAD:
-            if(!EMPTY_PIPE(f->node->blocks[1], f->node->blocks[0]))
-    		{
-    			return 1;
-    		}
-
             // if there are no writers, wakeup readers so they can read EOF
-            if(f->node->refs != 2)
+            if(pipe->count != 0 || f->node->refs != 2)
     		{
-    			return 1;
+    			res = 1;
+    			break;
     		}
     		
     		selrecord(&f->node->select_channel);
     		break;
 
     	case FWRITE:
-            if(!FULL_PIPE(f->node->blocks[1], f->node->blocks[0]))
-    		{
-    			return 1;
-    		}
-
             // if there are no readers, wakeup writers so they can get SIGPIPE
-            if(f->node->refs != 2)
+            if(pipe_space(pipe) != 0 || f->node->refs != 2)
     		{
-    			return 1;
+    			res = 1;
+    			break;
     		}
 		    
     		selrecord(&f->node->select_channel);
@@ -360,13 +1061,15 @@ long pipefs_select(struct file_t *f, int which)
     	    // TODO: (we should be handling exceptions)
             if(f->node->refs != 2)
     		{
-    			return 1;
+    			res = 1;
     		}
 
     		break;
 	}
 
-	return 0;
+    kernel_mutex_unlock(&pipe->lock);
+
+	return res;
 }
 
 
@@ -375,12 +1078,14 @@ long pipefs_select(struct file_t *f, int which)
  */
 long pipefs_poll(struct file_t *f, struct pollfd *pfd)
 {
+    struct pipe_t *pipe = (struct pipe_t *)f->node->data;
     long res = 0;
 
+    kernel_mutex_lock(&pipe->lock);
+
     if(pfd->events & POLLIN)
     {
-        if(!EMPTY_PIPE(f->node->blocks[1], f->node->blocks[0]) ||
-           f->node->refs != 2)
+        if(pipe->count != 0 || f->node->refs != 2)
         {
             pfd->revents |= POLLIN;
             res = 1;
@@ -393,8 +1098,7 @@ long pipefs_poll(struct file_t *f, struct pollfd *pfd)
 
     if(pfd->events & POLLOUT)
     {
-        if(!FULL_PIPE(f->node->blocks[1], f->node->blocks[0]) ||
-           f->node->refs != 2)
+        if(pipe_space(pipe) != 0 || f->node->refs != 2)
         {
             pfd->revents |= POLLOUT;
             res = 1;
@@ -405,6 +1109,8 @@ long pipefs_poll(struct file_t *f, struct pollfd *pfd)
         }
     }
 
+    kernel_mutex_unlock(&pipe->lock);
+
     // one end of the pipe has been closed
     if(f->node->refs != 2)
     {
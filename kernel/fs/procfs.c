@@ -68,7 +68,9 @@
  * refers to, so that reads (and in the future, writes) lead to the right
  * file. An inode number is generated using the following formula:
  *
- *     inode = (((file) << 16) | ((subdir) << 8) | (dir))
+ *     inode = (((file) << 17) | ((subdir) << 4) | (dir))
+ *
+ * which gives 4 bits for dir, 13 bits for subdir and 15 bits for file.
  *
  * The inode number consists of the following fields, which are interpreted
  * according to the file/directory the inode refers to:
@@ -97,11 +99,11 @@
  *
  * The task-index field is the task index within the global task table, when
  * it is accessed as an array. So the first task in the array has a task-index
- * of 0, and the last of NR_TASKS - 1. Note that a task's task-index is not
- * the same as its pid, as it refers to the task's slot in the task table, not
- * its identity. This was chosen as the task table is of finite and limited
- * size, currently 1024, which can be represented in 2 bytes, whereas pids can
- * reach high numbers and need more storage space (pid_t is 4-bytes long on x86).
+ * of 0, and the last of task_table_size - 1. Note that a task's task-index is
+ * not the same as its pid, as it refers to the task's slot in the task table,
+ * not its identity. This was chosen as the task table can't grow beyond
+ * MAX_NR_TASKS, which fits in the 13 subdir bits, whereas pids can reach
+ * higher numbers.
  */
 
 // defined in drivers/pci.c
@@ -231,6 +233,14 @@ struct procfs_entry_t procfs_root_entries[] =
     { "self"            , PROCFS_LINK_MODE, 0, 0, 0, NULL, },
 #define PROC_THREAD_SELF    25
     { "thread-self"     , PROCFS_LINK_MODE, 0, 0, 0, NULL, },
+#define PROC_SCHEDSTAT      26
+    { "schedstat"       , PROCFS_FILE_MODE, 0, 0, 0, get_schedstat, },
+#define PROC_BUDDYINFO      27
+    { "buddyinfo"       , PROCFS_FILE_MODE, 0, 0, 0, get_buddyinfo, },
+#define PROC_SLABINFO       28
+    { "slabinfo"        , PROCFS_FILE_MODE, 0, 0, 0, get_slabinfo, },
+#define PROC_DISKSTATS      29
+    { "diskstats"       , PROCFS_FILE_MODE, 0, 0, 0, get_diskstats, },
 };
 
 #define procfs_root_entry_count     arr_count(procfs_root_entries)
@@ -272,6 +282,8 @@ struct procfs_entry_t procfs_net_entries[] =
     { "raw"             , PROCFS_FILE_MODE, 0, 0, 0, get_net_raw, },
 #define PROC_NET_RESOLV         8
     { "resolv.conf"     , PROCFS_FILE_MODE, 0, 0, 0, get_dns_list, },
+#define PROC_NET_TCPSTAT        9
+    { "tcpstat"         , PROCFS_FILE_MODE, 0, 0, 0, get_net_tcpstat, },
 };
 
 #define procfs_net_entry_count      arr_count(procfs_net_entries)
@@ -334,7 +346,14 @@ struct procfs_pid_entry_t procfs_pid_entries[] =
  */
 void procfs_init(void)
 {
-    fs_register("procfs", &procfs_ops);
+    struct fs_info_t *fs;
+
+    // procfs nodes describe volatile kernel state, so don't cache them
+    if((fs = fs_register("procfs", &procfs_ops)))
+    {
+        fs->flags |= FSINFO_FLAG_NOCACHE;
+    }
+
     //procfs_create();
     
     int maj = MAJOR(PROCFS_DEVID);
@@ -384,10 +403,11 @@ struct fs_node_t *procfs_create(void)
     // the root directory gets all the entries they need (we use an average of
     // 8 chars per entry name just for approximation).
     procfs_root->size = (sizeof(struct dirent) + 8) *
-                            (procfs_root_entry_count + NR_TASKS);
+                            (procfs_root_entry_count + MAX_NR_TASKS);
 
     // use one of the reserved dev ids
     procfs_root->dev = PROCFS_DEVID;
+    hash_node(procfs_root);
     
 #define set_times(entries, count, t)        \
     for(i = 0; i < count; i++)              \
@@ -523,12 +543,17 @@ void copy_pid_node_attribs(struct fs_node_t *node,
 
 volatile struct task_t *get_task_by_index(int i)
 {
-    if(i < 0 || i >= NR_TASKS)
+    // read the size before the table (see for_each_taskptr)
+    int n = __atomic_load_n(&task_table_size, __ATOMIC_ACQUIRE);
+    volatile struct task_t **tab = (volatile struct task_t **)
+                            __atomic_load_n(&task_table, __ATOMIC_ACQUIRE);
+
+    if(i < 0 || i >= n)
     {
         return NULL;
     }
     
-    return task_table[i];
+    return tab[i];
 }
 
 int get_index_for_task(volatile struct task_t *task)
@@ -537,7 +562,7 @@ int get_index_for_task(volatile struct task_t *task)
     {
         if(*t && (*t)->pid == task->pid)
         {
-            return t - task_table;
+            return t - ft;
         }
     }
     
@@ -725,10 +750,9 @@ long procfs_read_inode(struct fs_node_t *node)
             {
                 file -= procfs_root_entry_count;
                 
-                if(file < NR_TASKS && task_table[file])
+                if((task = get_task_by_index(file)))
                 {
-                    copy_pid_node_attribs(node, task_table[file],
-                                            PROCFS_DIR_MODE);
+                    copy_pid_node_attribs(node, task, PROCFS_DIR_MODE);
                     return 0;
                 }
             }
@@ -968,13 +992,13 @@ long procfs_finddir(struct fs_node_t *dirnode, char *filename,
                     if(*t && tgid(*t) == i && (*t)->pid == tgid(*t))
                     {
                         KDEBUG("%s: found pid %d\n", __func__, i);
-                        ino = MAKE_PROCFS_INODE(DIR_PID, t - task_table, 0);
+                        ino = MAKE_PROCFS_INODE(DIR_PID, t - ft, 0);
                         //sprintf(tmp, "%d", tgid(*t));
                         ksprintf(tmp, sizeof(tmp), "%d", tgid(*t));
                         *entry = procfs_entry_to_dirent(ino,
                                         PROCFS_DIR_MODE,
                                         tmp, procfs_root_entry_count + 
-                                                (t - task_table));
+                                                (t - ft));
                         return *entry ? 0 : -ENOMEM;
                     }
                 }
@@ -1114,7 +1138,7 @@ long procfs_finddir(struct fs_node_t *dirnode, char *filename,
             break;
 
         case DIR_PID:
-            if(subdir < 0 || subdir >= NR_TASKS)
+            if(subdir < 0 || subdir >= MAX_NR_TASKS)
             {
                 break;
             }
@@ -1158,7 +1182,8 @@ long procfs_finddir(struct fs_node_t *dirnode, char *filename,
             }
             else
             {
-                for(ino = 0, i = 0; i < NR_OPEN; i++)
+                for(ino = 0, i = 0;
+                    task->ofiles && i < task->ofiles->max_fds; i++)
                 {
                     if(!task->ofiles->ofile[i])
                     {
@@ -1344,12 +1369,10 @@ long procfs_finddir_by_inode(struct fs_node_t *dirnode, struct fs_node_t *node,
                     break;
                 }
 
-                if(child_subdir >= 0 && child_subdir < NR_TASKS &&
-                   task_table[child_subdir])
+                if((task = get_task_by_index(child_subdir)))
                 {
                     //sprintf(tmp, "%d", tgid(task_table[i]));
-                    ksprintf(tmp, sizeof(tmp), "%d",
-                                tgid(task_table[child_subdir]));
+                    ksprintf(tmp, sizeof(tmp), "%d", tgid(task));
                     *entry = procfs_entry_to_dirent(node->inode,
                                                     PROCFS_DIR_MODE, tmp,
                                                     procfs_root_entry_count + 
@@ -1503,7 +1526,7 @@ long procfs_finddir_by_inode(struct fs_node_t *dirnode, struct fs_node_t *node,
             break;
 
         case DIR_PID:
-            if(subdir < 0 || subdir >= NR_TASKS)
+            if(subdir < 0 || subdir >= MAX_NR_TASKS)
             {
                 break;
             }
@@ -1566,7 +1589,7 @@ long procfs_finddir_by_inode(struct fs_node_t *dirnode, struct fs_node_t *node,
                 return *entry ? 0 : -ENOMEM;
             }
             
-            if(i > NR_OPEN)
+            if(!task->ofiles || i > task->ofiles->max_fds)
             {
                 break;
             }
@@ -1765,8 +1788,7 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
 
                         if(i-- == 0)
                         {
-                            ino = MAKE_PROCFS_INODE(DIR_PID,
-                                                    t - task_table, 0);
+                            ino = MAKE_PROCFS_INODE(DIR_PID, t - ft, 0);
                             //sprintf(tmp, "%d", tgid(*t));
                             ksprintf(tmp, sizeof(tmp), "%d", tgid(*t));
                             mode = PROCFS_DIR_MODE;
@@ -1913,7 +1935,7 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
             return count;
 
         case DIR_PID:
-            if(subdir < 0 || subdir >= NR_TASKS)
+            if(subdir < 0 || subdir >= MAX_NR_TASKS)
             {
                 return -ENOENT;
             }
@@ -1940,7 +1962,7 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
 
             assert_not_bigger_than(file, 1, ENOTDIR);
 
-            while(offset < NR_OPEN + 2)
+            while(task->ofiles && offset < task->ofiles->max_fds + 2)
             {
                 if(offset == 0)
                 {
@@ -1958,12 +1980,12 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
                 }
                 else
                 {
-                    if(!task_table[subdir] || !task_table[subdir]->ofiles)
+                    if(!task->ofiles)
                     {
                         break;
                     }
                     
-                    if(!task_table[subdir]->ofiles->ofile[offset - 2])
+                    if(!task->ofiles->ofile[offset - 2])
                     {
                         offset++;
                         continue;
@@ -2016,9 +2038,8 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
                         break;
                     }
 
-                    ino = MAKE_PROCFS_INODE(DIR_PROC,
-                                        procfs_root_entry_count +
-                                            get_index_for_task(thread), 0);
+                    ino = MAKE_PROCFS_INODE(DIR_PID,
+                                        get_index_for_task(thread), 0);
                     //sprintf(tmp, "%d", thread->pid);
                     ksprintf(tmp, sizeof(tmp), "%d", thread->pid);
                 }
@@ -2029,9 +2050,8 @@ long procfs_getdents(struct fs_node_t *dirnode, off_t *pos,
                         break;
                     }
 
-                    ino = MAKE_PROCFS_INODE(DIR_PROC,
-                                        procfs_root_entry_count +
-                                            get_index_for_task(thread), 0);
+                    ino = MAKE_PROCFS_INODE(DIR_PID,
+                                        get_index_for_task(thread), 0);
                     //sprintf(tmp, "%d", thread->pid);
                     ksprintf(tmp, sizeof(tmp), "%d", thread->pid);
                 }
@@ -2357,7 +2377,7 @@ long procfs_read_symlink(struct fs_node_t *link, char *buf,
             }
 
             /* /proc/[pid]/fd/[0]..[NR_OPEN-1] */
-            if(!(task->ofiles) ||
+            if(!(task->ofiles) || file > task->ofiles->max_fds ||
                !(f = task->ofiles->ofile[file - 1]) ||
                !(node = f->node))
             {
@@ -2549,6 +2569,10 @@ ssize_t procfs_read_file(struct fs_node_t *node, off_t *pos,
                 case PROC_VERSION    :   /* /proc/version     */
                 case PROC_VMSTAT     :   /* /proc/vmstat      */
                 case PROC_SYSCALLS   :   /* /proc/syscalls    */
+                case PROC_SCHEDSTAT  :   /* /proc/schedstat   */
+                case PROC_BUDDYINFO  :   /* /proc/buddyinfo   */
+                case PROC_SLABINFO   :   /* /proc/slabinfo    */
+                case PROC_DISKSTATS  :   /* /proc/diskstats   */
                     buflen = procfs_root_entries[file].read_file(&procbuf);
                     break;
 
@@ -2727,6 +2751,7 @@ ssize_t procfs_read_file(struct fs_node_t *node, off_t *pos,
                     case PROC_NET_UDP:     /* /proc/net/udp */
                     case PROC_NET_UNIX:    /* /proc/net/unix */
                     case PROC_NET_RAW:     /* /proc/net/raw */
+                    case PROC_NET_TCPSTAT: /* /proc/net/tcpstat */
                         buflen = procfs_net_entries[file].read_file(&procbuf);
                         break;
                 }
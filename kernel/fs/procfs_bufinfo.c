@@ -46,6 +46,7 @@ static void sock_getinfo(int i);
 static void pcache_getinfo(int i);
 static void superblocks_getinfo(int i);
 static void dentries_getinfo(int i);
+static void names_getinfo(int i);
 
 
 struct
@@ -64,50 +65,29 @@ struct
     { "page_cache", 0, 0, 0, 0, pcache_getinfo, },
     { "superblocks", 0, 0, 0, 0, superblocks_getinfo },
     { "dentry", 0, 0, 0, 0, dentries_getinfo },
+    { "namecache", 0, 0, 0, 0, names_getinfo },
     { NULL, 0, 0, 0, 0, NULL, },
 };
 
 
 static void inodeentry_getinfo(int i)
 {
-    struct fs_node_t **node;
-    struct fs_node_t **lnode = &node_table[NR_INODE];
-    extern volatile struct kernel_mutex_t list_lock;
+    unsigned long total, active;
 
-    //proc_bufinfo[i].active = 0;
-    proc_bufinfo[i].num = NR_INODE;
+    node_cache_stats(&total, &active);
+    proc_bufinfo[i].num = total;
+    proc_bufinfo[i].active = active;
     proc_bufinfo[i].itemsz = sizeof(struct fs_node_t);
-    proc_bufinfo[i].totalsz = NR_INODE * sizeof(struct fs_node_t);
-
-    kernel_mutex_lock(&list_lock);
-
-    for(node = node_table; node < lnode; node++)
-    {
-        if(*node && (*node)->refs)
-        {
-            proc_bufinfo[i].active++;
-        }
-    }
-
-    kernel_mutex_unlock(&list_lock);
+    proc_bufinfo[i].totalsz = total * sizeof(struct fs_node_t);
 }
 
 
 static void taskentry_getinfo(int i)
 {
-    int j;
-
-    for(j = 0; j < NR_TASKS; j++)
-    {
-        if(task_table[j] != NULL)
-        {
-            proc_bufinfo[i].active++;
-        }
-    }
-
-    proc_bufinfo[i].num = NR_TASKS;
+    proc_bufinfo[i].num = task_table_size;
+    proc_bufinfo[i].active = total_tasks;
     proc_bufinfo[i].itemsz = sizeof(struct task_t);
-    proc_bufinfo[i].totalsz = NR_TASKS * sizeof(struct task_t);
+    proc_bufinfo[i].totalsz = total_tasks * sizeof(struct task_t);
 }
 
 
@@ -230,6 +210,22 @@ static void dentries_getinfo(int i)
 }
 
 
+/*
+ * NOTE: the active count we report here is the number of positive entries
+ */
+static void names_getinfo(int i)
+{
+    unsigned long total, negative;
+    size_t itemsz;
+
+    namecache_stats(&total, &negative, &itemsz);
+    proc_bufinfo[i].num = total;
+    proc_bufinfo[i].active = total - negative;
+    proc_bufinfo[i].itemsz = itemsz;
+    proc_bufinfo[i].totalsz = total * itemsz;
+}
+
+
 /*
  * Read /proc/buffers.
  */
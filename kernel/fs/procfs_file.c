@@ -45,6 +45,7 @@
 #include <kernel/modules.h>
 #include <kernel/softint.h>
 #include <kernel/pcache.h>
+#include <kernel/blk_queue.h>
 #include <kernel/ipc.h>
 #include <kernel/net/dhcp.h>
 #include <kernel/ksymtab.h>
@@ -52,6 +53,7 @@
 #include <mm/mmngr_virtual.h>
 #include <mm/kheap.h>
 #include <mm/kstack.h>
+#include <mm/slab.h>
 #include <fs/procfs.h>
 #include <fs/devfs.h>
 #include <fs/tmpfs.h>
@@ -669,6 +671,186 @@ size_t get_sysstat(char **buf)
 }
 
 
+/*
+ * Read /proc/schedstat.
+ */
+size_t get_schedstat(char **buf)
+{
+    struct runqueue_t *rq;
+    size_t bufsz = 64 + (processor_count * 96);
+    char *p;
+    int i;
+
+    PR_MALLOC(*buf, bufsz);
+    p = *buf;
+
+    ksprintf(p, 64, "cpu   queued   switches   pulled   pushed\n");
+    p += strlen(p);
+
+    for(i = 0; i < processor_count; i++)
+    {
+        rq = &runqueues[i];
+        ksprintf(p, 96, "cpu%-2d %6d %10lu %8lu %8lu\n", i,
+                        runqueue_length(rq), rq->nr_switches,
+                        rq->nr_pulled, rq->nr_pushed);
+        p += strlen(p);
+    }
+
+    return (p - *buf);
+}
+
+
+/*
+ * Read /proc/buddyinfo.
+ */
+size_t get_buddyinfo(char **buf)
+{
+    size_t nr_free[BUDDY_MAX_ORDER];
+    size_t bufsz = 64 + (BUDDY_MAX_ORDER * 24);
+    char *p;
+    int i;
+
+    (void)pmmngr_get_buddyinfo(nr_free);
+
+    PR_MALLOC(*buf, bufsz);
+    p = *buf;
+
+    ksprintf(p, 32, "Node 0, zone   Normal ");
+    p += strlen(p);
+
+    for(i = 0; i < BUDDY_MAX_ORDER; i++)
+    {
+        ksprintf(p, 24, "%6lu ", (unsigned long)nr_free[i]);
+        p += strlen(p);
+    }
+
+    *p++ = '\n';
+    *p = '\0';
+
+    return (p - *buf);
+}
+
+
+/*
+ * Read /proc/slabinfo.
+ */
+size_t get_slabinfo(char **buf)
+{
+    struct kmem_cache_t *cache;
+    size_t bufsz = 256, len;
+    int count = 0;
+    char *p;
+
+    kernel_mutex_lock(&kmem_caches_lock);
+
+    for(cache = kmem_caches; cache != NULL; cache = cache->next)
+    {
+        count++;
+    }
+
+    kernel_mutex_unlock(&kmem_caches_lock);
+
+    bufsz += (count * 128);
+    PR_MALLOC(*buf, bufsz);
+    p = *buf;
+
+    ksprintf(p, 256, "slabinfo - version: 2.1\n"
+                     "# name            <active_objs> <num_objs> <objsize> "
+                     "<objperslab> <pagesperslab> : slabdata <active_slabs> "
+                     "<num_slabs>\n");
+    p += strlen(p);
+    len = p - *buf;
+
+    // caches created since we counted them are not shown
+    kernel_mutex_lock(&kmem_caches_lock);
+
+    for(cache = kmem_caches;
+        cache != NULL && len + 128 <= bufsz;
+        cache = cache->next)
+    {
+        ksprintf(p, 128, "%-17s %6lu %6lu %6lu %4d %4d : slabdata %6d %6d\n",
+                         cache->name, cache->nr_active,
+                         (unsigned long)(cache->nr_slabs *
+                                                cache->objs_per_slab),
+                         (unsigned long)cache->objsize,
+                         cache->objs_per_slab,
+                         (int)(cache->slab_size / PAGE_SIZE),
+                         cache->nr_slabs - cache->nr_empty, cache->nr_slabs);
+        p += strlen(p);
+        len = p - *buf;
+    }
+
+    kernel_mutex_unlock(&kmem_caches_lock);
+
+    return len;
+}
+
+
+/*
+ * Read /proc/diskstats.
+ */
+size_t get_diskstats(char **buf)
+{
+    struct blk_queue_t *q;
+    size_t bufsz = 256, len;
+    int i, count = 0;
+    char *p;
+
+    kernel_mutex_lock(&blk_queues_lock);
+
+    for(i = 0; i < BLK_QUEUE_HASH_SIZE; i++)
+    {
+        for(q = blk_queues[i]; q != NULL; q = q->next)
+        {
+            count++;
+        }
+    }
+
+    kernel_mutex_unlock(&blk_queues_lock);
+
+    bufsz += (count * 192);
+    PR_MALLOC(*buf, bufsz);
+    p = *buf;
+
+    ksprintf(p, 256, "# major minor : reads merged bytes errors expired "
+                     ": writes merged bytes errors expired "
+                     ": queued in_flight\n");
+    p += strlen(p);
+    len = p - *buf;
+
+    // queues created since we counted them are not shown
+    kernel_mutex_lock(&blk_queues_lock);
+
+    for(i = 0; i < BLK_QUEUE_HASH_SIZE; i++)
+    {
+        for(q = blk_queues[i]; q != NULL && len + 192 <= bufsz; q = q->next)
+        {
+            ksprintf(p, 192, "%4d %4d : %lu %lu %llu %lu %lu "
+                             ": %lu %lu %llu %lu %lu : %d %d\n",
+                             (int)MAJOR(q->dev), (int)MINOR(q->dev),
+                             q->stats.reqs[BLK_READ],
+                             q->stats.merges[BLK_READ],
+                             q->stats.bytes[BLK_READ],
+                             q->stats.errors[BLK_READ],
+                             q->stats.expired[BLK_READ],
+                             q->stats.reqs[BLK_WRITE],
+                             q->stats.merges[BLK_WRITE],
+                             q->stats.bytes[BLK_WRITE],
+                             q->stats.errors[BLK_WRITE],
+                             q->stats.expired[BLK_WRITE],
+                             q->queued[BLK_READ] + q->queued[BLK_WRITE],
+                             q->in_flight);
+            p += strlen(p);
+            len = p - *buf;
+        }
+    }
+
+    kernel_mutex_unlock(&blk_queues_lock);
+
+    return len;
+}
+
+
 /*
  * Read /proc/bus/pci/devices.
  */
@@ -32,6 +32,7 @@
 #include <kernel/net/socket.h>
 #include <kernel/net/protocol.h>
 #include <kernel/net/raw.h>
+#include <kernel/net/tcp.h>
 #include <mm/kheap.h>
 #include <fs/procfs.h>
 
@@ -129,6 +130,86 @@ size_t get_net_tcp(char **buf)
 }
 
 
+/*
+ * Read /proc/net/tcpstat (per-connection congestion control state).
+ */
+size_t get_net_tcpstat(char **buf)
+{
+    struct socket_t *so;
+    struct socket_tcp_t *tsock;
+    size_t len, count = 0, bufsz = 2048;
+    char tmp[192];
+    char *p;
+    int i = 0;
+
+    PR_MALLOC(*buf, bufsz);
+    p = *buf;
+
+    ksprintf(p, 192, "Num  LocalAddr     RemoteAddr    St Cong       "
+                     "Cwnd     Ssthresh SRTT  RTTVar RTO   MinRTT "
+                     "Retrans FastRetr Timeouts\n");
+    len = strlen(p);
+    count += len;
+    p += len;
+
+    kernel_mutex_lock(&sock_lock);
+
+    for(so = sock_head.next; so != NULL; so = so->next)
+    {
+        if(SOCK_PROTO(so) != IPPROTO_TCP)
+        {
+            continue;
+        }
+
+        tsock = (struct socket_tcp_t *)so;
+
+        ksprintf(tmp, 192, "%3d: ", i++);
+
+        print_addr(tmp + 5, 192 - 5,
+                       so->local_addr.ipv4, so->local_port);
+        len = strlen(tmp);
+
+        print_addr(tmp + len, 192 - len,
+                       so->remote_addr.ipv4, so->remote_port);
+        len = strlen(tmp);
+
+        ksprintf(tmp + len, 192 - len, "%02x %-10s %08x %08x ",
+                       tsock->tcpstate,
+                       tsock->cong ? tsock->cong->name : "-",
+                       tsock->cwnd, tsock->ssthresh);
+        len = strlen(tmp);
+
+        ksprintf(tmp + len, 192 - len, "%-5d %-6d %-5u %-6d %-7u %-8u %u\n",
+                       tsock->srtt, tsock->rttvar, tsock->rto,
+                       tsock->rtt_min, tsock->retrans,
+                       tsock->fast_retrans, tsock->timeouts);
+        len = strlen(tmp);
+
+        if(count + len >= bufsz)
+        {
+            char *tmp;
+
+            if(!(tmp = krealloc(*buf, bufsz * 2)))
+            {
+                kernel_mutex_unlock(&sock_lock);
+                return count;
+            }
+
+            bufsz *= 2;
+            *buf = tmp;
+            p = *buf + count;
+        }
+
+        count += len;
+        strcpy(p, tmp);
+        p += len;
+    }
+
+    kernel_mutex_unlock(&sock_lock);
+    return count;
+}
+
+
 /*
  * Read /proc/net/udp.
  */
@@ -360,7 +360,7 @@ size_t get_task_status(struct task_t *task, char **_buf)
 
     BUF_SPRINTF("Uid:    %u\t%u\t%u\n", task->uid, task->euid, task->ssuid);
     BUF_SPRINTF("Gid:    %u\t%u\t%u\n", task->gid, task->egid, task->ssgid);
-    BUF_SPRINTF("FDSize: %d\n", task->ofiles ? NR_OPEN : 0);
+    BUF_SPRINTF("FDSize: %d\n", task->ofiles ? task->ofiles->max_fds : 0);
 
     strcpy(buf, "Groups: ");
     buf += 8;
@@ -0,0 +1,223 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: readahead.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file readahead.c
+ *
+ *  Sequential readahead. Each open file tracks the pages its reader has
+ *  read. When the reads are sequential, the file gets a readahead window
+ *  that doubles in size with each step. The first window is read
+ *  synchronously (the reader needs it right away), while the following
+ *  windows are read by the readahead task before the reader gets to them.
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <kernel/laylaos.h>
+#include <kernel/task.h>
+#include <kernel/vfs.h>
+#include <kernel/pcache.h>
+#include <mm/kheap.h>
+#include <fs/procfs.h>
+#include <fs/readahead.h>
+
+struct ra_req_t
+{
+    struct fs_node_t *node;
+    off_t offset;
+    size_t count;
+    struct ra_req_t *next;
+};
+
+static struct ra_req_t *ra_head = NULL, *ra_tail = NULL;
+static int ra_queued = 0;
+static volatile struct kernel_mutex_t ra_lock = { 0, };
+
+volatile struct task_t *readahead_task = NULL;
+
+
+void queue_readahead(struct fs_node_t *node, off_t offset, size_t count)
+{
+    struct ra_req_t *req;
+
+    // too early in boot to have a readahead task, do it ourselves
+    if(!readahead_task)
+    {
+        readahead_cached_pages(node, offset, count);
+        return;
+    }
+
+    if(!(req = kmalloc(sizeof(struct ra_req_t))))
+    {
+        return;
+    }
+
+    req->node = node;
+    req->offset = offset;
+    req->count = count;
+    req->next = NULL;
+
+    kernel_mutex_lock(&ra_lock);
+
+    if(ra_queued >= RA_QUEUE_MAX)
+    {
+        kernel_mutex_unlock(&ra_lock);
+        kfree(req);
+        return;
+    }
+
+    // the request holds a reference to the node until it is done
+    __sync_fetch_and_add(&node->refs, 1);
+
+    if(ra_tail)
+    {
+        ra_tail->next = req;
+    }
+    else
+    {
+        ra_head = req;
+    }
+
+    ra_tail = req;
+    ra_queued++;
+    kernel_mutex_unlock(&ra_lock);
+
+    unblock_tasks(&ra_head);
+}
+
+
+void readahead_task_func(void *arg)
+{
+    struct ra_req_t *req;
+
+    UNUSED(arg);
+
+    for(;;)
+    {
+        kernel_mutex_lock(&ra_lock);
+
+        if(!(req = ra_head))
+        {
+            block_task_and_unlock(&ra_head, 0, &ra_lock);
+            continue;
+        }
+
+        if(!(ra_head = req->next))
+        {
+            ra_tail = NULL;
+        }
+
+        ra_queued--;
+        kernel_mutex_unlock(&ra_lock);
+
+        KDEBUG("readahead: dev 0x%x, ino 0x%x, off 0x%lx, count %lu\n",
+               req->node->dev, req->node->inode, req->offset, req->count);
+
+        readahead_cached_pages(req->node, req->offset, req->count);
+        release_node(req->node);
+        kfree(req);
+    }
+}
+
+
+/*
+ * Called before reading from a regular file.
+ */
+void file_readahead(struct file_t *f, off_t pos, size_t count)
+{
+    struct fs_node_t *node = f->node;
+    struct file_ra_t *ra = &f->ra;
+    off_t first, last;
+    size_t pages, max;
+
+    if(!node || !count || !S_ISREG(node->mode) ||
+       node->dev == PROCFS_DEVID || ra->advice == POSIX_FADV_RANDOM ||
+       pos < 0 || (size_t)pos >= node->size)
+    {
+        return;
+    }
+
+    first = pos / PAGE_SIZE;
+    last = (pos + count - 1) / PAGE_SIZE;
+    pages = last - first + 1;
+    max = (ra->advice == POSIX_FADV_SEQUENTIAL) ? RA_MAX_PAGES * 2 :
+                                                  RA_MAX_PAGES;
+
+    // a random read kills the window, but we still read the pages the
+    // caller wants in as few requests as we can
+    if(first != ra->prev && first != ra->prev + 1 &&
+       !(first >= ra->start && first < ra->start + (off_t)ra->size))
+    {
+        ra->start = first;
+        ra->size = 0;
+        ra->async_size = 0;
+        ra->prev = last;
+
+        if(pages > 1)
+        {
+            readahead_cached_pages(node, first * PAGE_SIZE, pages);
+        }
+
+        return;
+    }
+
+    ra->prev = last;
+
+    // the first sequential read, start a new window and read it now
+    if(ra->size == 0)
+    {
+        ra->start = first;
+        ra->size = (pages * 2 < RA_INIT_PAGES) ? RA_INIT_PAGES : pages * 2;
+
+        if(ra->size > max)
+        {
+            ra->size = max;
+        }
+
+        ra->async_size = (ra->size > pages) ? ra->size - pages : 0;
+        readahead_cached_pages(node, first * PAGE_SIZE,
+                               (pages > ra->size) ? pages : ra->size);
+        return;
+    }
+
+    // the reader is close to the end of the window, read the next window
+    // in the background
+    if(last >= ra->start + (off_t)(ra->size - ra->async_size))
+    {
+        ra->start += ra->size;
+
+        // the reader got past the window (e.g. with one big read)
+        if(ra->start <= last)
+        {
+            ra->start = last + 1;
+        }
+
+        ra->size = (ra->size * 2 > max) ? max : ra->size * 2;
+        ra->async_size = ra->size;
+
+        if((size_t)(ra->start * PAGE_SIZE) < node->size)
+        {
+            queue_readahead(node, ra->start * PAGE_SIZE, ra->size);
+        }
+    }
+}
+
@@ -126,6 +126,7 @@ static void rootfs_add_node(char *name, struct fs_node_t *localroot,
     
     node->inode = last_node_num++;
     node->dev = system_root_node->dev;
+    hash_node(node);
     node->mode = S_IFDIR | 0555;
     node->links = 1;
     node->refs = 1;
@@ -171,7 +172,13 @@ static void rootfs_add_node(char *name, struct fs_node_t *localroot,
 
 struct fs_node_t *rootfs_init(void)
 {
-    fs_register("rootfs", &rootfs_ops);
+    struct fs_info_t *fs;
+
+    // root entries are added without going through vfs_addir()
+    if((fs = fs_register("rootfs", &rootfs_ops)))
+    {
+        fs->flags |= FSINFO_FLAG_NODCACHE;
+    }
 
     if(!(system_root_node = get_empty_node()))
     {
@@ -182,6 +189,7 @@ struct fs_node_t *rootfs_init(void)
     system_root_node->inode = 2;
     // use one of the reserved dev ids
     system_root_node->dev = ROOT_DEVID = TO_DEVID(240, 1);
+    hash_node(system_root_node);
     system_root_node->ops = &rootfs_ops;
     system_root_node->mode = S_IFDIR | 0555;
     system_root_node->links = 1;
@@ -150,6 +150,7 @@ ssize_t sockfs_write(struct file_t *f, off_t *pos,
 	msg.msg_iov = &aiov;
 	msg.msg_iovlen = 1;
 	msg.msg_control = 0;
+	msg.msg_flags = 0;
 	aiov.iov_base = (char *)buf;
 	aiov.iov_len = count;
 
@@ -276,7 +277,7 @@ long sockfs_select(struct file_t *f, int which)
                 return 1;
             }
 
-    		//selrecord(&so->sendsel);
+    		selrecord(&so->sleep);
     		break;
 
     	case 0:
@@ -322,6 +323,11 @@ long sockfs_poll(struct file_t *f, struct pollfd *pfd)
         selrecord(&so->selrecv);
     }
 
+    if((pfd->events & POLLOUT) && !(so->poll_events & POLLOUT))
+    {
+        selrecord(&so->sleep);
+    }
+
     if(pfd->revents > 0)
     {
         res = 1;
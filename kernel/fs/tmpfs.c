@@ -37,6 +37,7 @@
 #include <kernel/vfs.h>
 #include <kernel/clock.h>
 #include <kernel/dev.h>
+#include <kernel/blk_queue.h>
 #include <kernel/user.h>
 #include <mm/kheap.h>
 #include <fs/tmpfs.h>
@@ -405,7 +406,7 @@ static void fill_zero_block(struct fs_node_t *node, size_t lblock,
     req.blockno = lblock;
     req.write = 1;
 
-    bdev_tab[MAJOR(node->dev)].strategy(&req);
+    blk_submit(&req);
 
     node->ctime = now();
     node->flags |= FS_NODE_DIRTY;
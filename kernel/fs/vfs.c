@@ -48,9 +48,6 @@
 #include <fs/dummy.h>
 
 
-struct file_t ftab[NR_FILE];
-
-
 /*
  * Get a kalloc()'d copy of the path and remove any trailing'/'s.
  * Used to sanitize pathnames we pass to get_parent_dir().
@@ -147,9 +144,6 @@ long get_parent_dir(char *pathname, int dirfd, char **filename,
     long len, res;
     dev_t dev;
     ino_t n;
-    struct dirent *entry;
-    struct cached_page_t *dbuf;
-    size_t dbuf_off;
     int symlinks = 0;
     
     if(!pathname || !*pathname)
@@ -194,7 +188,8 @@ long get_parent_dir(char *pathname, int dirfd, char **filename,
     }
     else if(dirfd != AT_FDCWD)
     {
-        if(!this_core->cur_task->ofiles || dirfd < 0 || dirfd >= NR_OPEN ||
+        if(!this_core->cur_task->ofiles || dirfd < 0 ||
+           dirfd >= this_core->cur_task->ofiles->max_fds ||
            this_core->cur_task->ofiles->ofile[dirfd] == NULL ||
            (node = this_core->cur_task->ofiles->ofile[dirfd]->node) == NULL)
         {
@@ -316,7 +311,7 @@ long get_parent_dir(char *pathname, int dirfd, char **filename,
         KDEBUG("get_parent_dir: tmp = %s\n", tmp);
 
         // find this path segment in the current directory
-        if((res = vfs_finddir(node, tmp, &entry, &dbuf, &dbuf_off)) < 0)
+        if((res = vfs_lookup(node, tmp, &n)) < 0)
         {
             kfree(tmp);
             release_node(node);
@@ -324,12 +319,8 @@ long get_parent_dir(char *pathname, int dirfd, char **filename,
             return res;
         }
         
-        release_cached_page(dbuf);
-        //brelse(dbuf);
         dev = node->dev;
-        n = entry->d_ino;
         kfree(tmp);
-        kfree(entry);
         release_node(node);
 
         KDEBUG("filename @ 0x%x\n", filename);
@@ -446,11 +437,8 @@ long vfs_open_internal(char *path, int dirfd,
     struct fs_node_t *node, *node2, *parent;
     dev_t dev;
     ino_t n;
-    struct dirent *entry;
     char *filename;
     char *p2 = path_remove_trailing_slash(path, kernel, &trailing_slash);
-    struct cached_page_t *dbuf;
-    size_t dbuf_off;
     
     *filenode = NULL;
     
@@ -470,8 +458,8 @@ long vfs_open_internal(char *path, int dirfd,
             return -EINVAL;
         }
 
-    	if(dirfd < 0 || dirfd >= NR_OPEN || 
-    	   !this_core->cur_task->ofiles ||
+    	if(dirfd < 0 || !this_core->cur_task->ofiles ||
+    	   dirfd >= this_core->cur_task->ofiles->max_fds ||
     	   !this_core->cur_task->ofiles->ofile[dirfd])
     	{
             return -EINVAL;
@@ -508,20 +496,16 @@ long vfs_open_internal(char *path, int dirfd,
         return 0;
     }
 
-    // get the file entry
-    if((res = vfs_finddir(node, filename, &entry, &dbuf, &dbuf_off)) < 0)
+    // get the file's inode number
+    if((res = vfs_lookup(node, filename, &n)) < 0)
     {
         kfree(p2);
         release_node(node);
         return res;
     }
     
-    release_cached_page(dbuf);
-
     // and the file's node
     dev = node->dev;
-    n = entry->d_ino;
-    kfree(entry);
     parent = node;
 
     KDEBUG("vfs_open_internal - 5 (path '%s', dev 0x%x, n 0x%x)\n", path, dev, n);
@@ -600,9 +584,6 @@ long vfs_open(char *path, int flags, mode_t mode, int dirfd,
     dev_t dev;
     ino_t n;
     struct fs_node_t *dnode, *fnode, *fnode2;
-    struct dirent *entry;
-    struct cached_page_t *dbuf;
-    size_t dbuf_off;
     int follow_mpoints, rootdir;
     int kernel = (open_flags & OPEN_KERNEL_CALLER);
 
@@ -669,13 +650,9 @@ long vfs_open(char *path, int flags, mode_t mode, int dirfd,
     KDEBUG("vfs_open: filename = '%s'\n", filename);
 
     // find the file in the parent directory
-    if(vfs_finddir(dnode, filename, &entry, &dbuf, &dbuf_off) == 0)
+    if(vfs_lookup(dnode, filename, &n) == 0)
     {
-        release_cached_page(dbuf);
         dev = dnode->dev;
-        n = entry->d_ino;
-
-        kfree(entry);
 
         // get the file's node
         if(!(fnode = get_node(dev, n, follow_mpoints)))
@@ -902,6 +879,60 @@ long vfs_finddir(struct fs_node_t *dir, char *filename, struct dirent **entry,
 }
 
 
+/*
+ * Find the inode number of the given filename in the parent directory,
+ * using the name cache if possible. This is used during path walking, where
+ * we only need the inode number and not the directory entry itself.
+ *
+ * Returns:
+ *    0 on success, -errno on failure
+ *    ino: the file's inode number
+ */
+long vfs_lookup(struct fs_node_t *dir, char *filename, ino_t *ino)
+{
+    struct dirent *entry;
+    struct cached_page_t *dbuf;
+    size_t dbuf_off;
+    unsigned int seq;
+    long res;
+
+    if(!dir || !filename || !ino)
+    {
+        return -EINVAL;
+    }
+
+    // not a directory
+    if(!S_ISDIR(dir->mode))
+    {
+        return -ENOTDIR;
+    }
+
+    if(namecache_lookup(dir, filename, ino, &seq))
+    {
+        update_atime(dir);
+        return *ino ? 0 : -ENOENT;
+    }
+
+    if((res = vfs_finddir(dir, filename, &entry, &dbuf, &dbuf_off)) < 0)
+    {
+        // remember names that don't exist
+        if(res == -ENOENT)
+        {
+            namecache_enter(dir, filename, 0, seq);
+        }
+
+        return res;
+    }
+
+    release_cached_page(dbuf);
+    *ino = entry->d_ino;
+    kfree(entry);
+    namecache_enter(dir, filename, *ino, seq);
+
+    return 0;
+}
+
+
 /*
  * Find the given inode in the parent directory.
  * Called during pathname resolution when constructing the absolute pathname
@@ -980,6 +1011,12 @@ long vfs_addir(struct fs_node_t *dir, struct fs_node_t *file, char *filename)
     if(dir->ops && dir->ops->addir)
     {
         res = dir->ops->addir(dir, file, filename);
+
+        if(res == 0 && file)
+        {
+            namecache_update(dir, filename, file->inode);
+        }
+
         dir->mtime = now();
         //dir->atime = dir->mtime;
         update_atime(dir);
@@ -1619,6 +1656,12 @@ long vfs_deldir(struct fs_node_t *dir, struct dirent *entry, int is_dir)
     if(dir->ops && dir->ops->deldir)
     {
         res = dir->ops->deldir(dir, entry, is_dir);
+
+        if(res == 0)
+        {
+            namecache_update(dir, entry->d_name, 0);
+        }
+
         dir->mtime = now();
         //dir->atime = dir->mtime;
         dir->flags |= FS_NODE_DIRTY;
@@ -31,6 +31,9 @@
 #include <kernel/vfs.h>
 #include <kernel/mutex.h>
 
+#define NR_NAMECACHE_HASH       1024    /**< buckets in the name cache hash
+                                             table (must be a power of 2) */
+#define NR_NAMECACHE            8192    /**< max entries in the name cache */
 
 /**
  * @struct dentry_t
@@ -168,4 +171,127 @@ void remove_old_dentries(unsigned long long older_than_ticks);
  */
 int getpath(struct fs_node_t *dir, char **res);
 
+
+/**************************************
+ * Functions defined in namecache.c
+ **************************************/
+
+/**
+ * @brief Initialize the name cache.
+ *
+ * Called from init_dentries().
+ *
+ * @return  nothing.
+ */
+void init_namecache(void);
+
+/**
+ * @brief Look up a name in the name cache.
+ *
+ * Find the inode number the given filename points to in the given parent
+ * directory. If the name is not cached, the caller should ask the
+ * filesystem and pass the result to namecache_enter(), along with the
+ * sequence number returned in seq.
+ *
+ * @param   dir     parent directory node
+ * @param   name    filename
+ * @param   ino     the inode number is returned here, or zero if the
+ *                    name is known not to exist (a negative entry)
+ * @param   seq     sequence number to pass to namecache_enter()
+ *
+ * @return  1 if the name is cached, 0 if not.
+ */
+int namecache_lookup(struct fs_node_t *dir, char *name, ino_t *ino,
+                     unsigned int *seq);
+
+/**
+ * @brief Cache the result of a lookup.
+ *
+ * Add the result of a filesystem lookup to the name cache. Nothing is
+ * cached if the directory was changed since namecache_lookup() was called.
+ *
+ * @param   dir     parent directory node
+ * @param   name    filename
+ * @param   ino     inode number, or zero if the name does not exist
+ * @param   seq     sequence number returned by namecache_lookup()
+ *
+ * @return  nothing.
+ */
+void namecache_enter(struct fs_node_t *dir, char *name, ino_t ino,
+                     unsigned int seq);
+
+/**
+ * @brief Update the name cache after a directory change.
+ *
+ * Called after a name is added to (ino is non-zero) or removed from
+ * (ino is zero) a directory.
+ *
+ * @param   dir     parent directory node
+ * @param   name    filename
+ * @param   ino     new inode number, or zero if the name was removed
+ *
+ * @return  nothing.
+ */
+void namecache_update(struct fs_node_t *dir, char *name, ino_t ino);
+
+/**
+ * @brief Remove a directory's names from the name cache.
+ *
+ * Called when a directory's inode is freed, so that a new directory
+ * reusing the inode number does not inherit its names.
+ *
+ * @param   dev     device id
+ * @param   dir     directory's inode number
+ *
+ * @return  nothing.
+ */
+void namecache_purge_dir(dev_t dev, ino_t dir);
+
+/**
+ * @brief Invalidate a device's names.
+ *
+ * Remove all the names on a device from the name cache. This is used when
+ * the device is being unmounted.
+ *
+ * @param   dev     device id
+ *
+ * @return  nothing.
+ */
+void invalidate_dev_names(dev_t dev);
+
+/**
+ * @brief Shrink the name cache.
+ *
+ * Free up to count of the least recently used names. Used when memory
+ * is running low.
+ *
+ * @param   count   number of entries to free
+ *
+ * @return  number of entries freed.
+ */
+size_t shrink_namecache(size_t count);
+
+/**
+ * @brief Remove old names.
+ *
+ * Remove the names that were not used for the given time.
+ *
+ * @param   older_than_ticks    time in ticks
+ *
+ * @return  nothing.
+ */
+void remove_old_names(unsigned long long older_than_ticks);
+
+/**
+ * @brief Get name cache statistics.
+ *
+ * @param   total       total number of cached names
+ * @param   negative    number of negative entries
+ * @param   itemsz      size of each entry
+ *
+ * @return  nothing.
+ */
+void namecache_stats(unsigned long *total, unsigned long *negative,
+                     size_t *itemsz);
+
 #endif      /* __KERNEL_DENTRY_H__ */
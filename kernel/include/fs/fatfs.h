@@ -166,6 +166,39 @@ struct fat_cacheent_t
     struct fat_cacheent_t *next;
 };
 
+#define FAT_CACHEENT_HASH       256     /* parent cache buckets */
+#define FAT_EXTCACHE_HASH       64      /* extent cache buckets */
+#define FAT_MAX_EXTCACHE        256     /* files with cached extents */
+#define FAT_EXTENTS             8       /* extents cached per file */
+
+/*
+ * A run of physically contiguous clusters in a file's cluster chain.
+ */
+struct fat_extent_t
+{
+    size_t lcluster;        // first logical cluster in the run
+    size_t pcluster;        // first physical cluster in the run
+    size_t count;           // clusters in the run
+};
+
+/*
+ * To avoid walking the cluster chain from the start every time we map a
+ * file block, we cache the first few runs of each file's cluster chain,
+ * keyed by the file's first cluster (i.e. its inode number). The runs
+ * cover the start of the file with no holes. Past the cached runs, we
+ * remember the last cluster we found, so reading big fragmented files
+ * sequentially only needs one FAT lookup per cluster.
+ */
+struct fat_extcache_t
+{
+    size_t first_cluster;
+    int nextents;
+    struct fat_extent_t extents[FAT_EXTENTS];
+    size_t last_lcluster, last_pcluster;
+    struct fat_extcache_t *hnext;
+    struct fat_extcache_t *lru_next, *lru_prev;
+};
+
 /**
  * @struct fat_private_t
  * @brief The fat_private_t structure.
@@ -185,7 +218,12 @@ struct fat_private_t
     size_t first_fat_sector, first_data_sector;
     int fattype;
     dev_t dev;
-    struct fat_cacheent_t *cacheent;
+    struct fat_cacheent_t *cacheent[FAT_CACHEENT_HASH];
+    struct fat_extcache_t *extcache[FAT_EXTCACHE_HASH];
+    struct fat_extcache_t *ext_lru_head, *ext_lru_tail;
+    int nextcache;
+    unsigned long *free_map;        // free cluster bitmap (bit set if used)
+    size_t next_free;               // no free clusters below this one
     volatile struct kernel_mutex_t lock;
 };
 
@@ -31,13 +31,92 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <poll.h>
+#include <kernel/mutex.h>
+
+/**
+ * \def PIPE_BUFFERS
+ *
+ * Default number of page buffers in a pipe (i.e. the default pipe capacity
+ * is 16 pages, the same as Linux).
+ */
+#define PIPE_BUFFERS            16
+
+/**
+ * \def PIPE_MAX_SIZE
+ *
+ * Maximum capacity (in bytes) an unprivileged task can set on a pipe
+ * using fcntl(F_SETPIPE_SZ).
+ */
+#define PIPE_MAX_SIZE           (1024 * 1024)
+
+struct cached_page_t;
+
+
+/**
+ * @struct pipe_buf_t
+ * @brief The pipe_buf_t structure.
+ *
+ * A page of data in a pipe. This is either a page allocated by the pipe, or
+ * a page cache page that was spliced into the pipe, in which case we hold a
+ * reference to the page's frame until the data is consumed.
+ */
+struct pipe_buf_t
+{
+    struct cached_page_t *pcache;   /**< spliced page, NULL if the data is
+                                         in a page allocated by the pipe */
+    unsigned char *page;            /**< page data */
+    unsigned int offset;            /**< offset of data in page */
+    unsigned int len;               /**< length of data */
+};
+
+
+/**
+ * @struct pipe_t
+ * @brief The pipe_t structure.
+ *
+ * A structure to represent a pipe. Data is kept in a ring of page buffers.
+ * Pages are allocated as data is written, and freed as it is read (except
+ * for one spare page we keep to avoid allocating a page on every write).
+ * The pipe struct is stored in the \a data field of the pipe's file node.
+ *
+ * Readers sleep on \a rd_waiting and writers on \a wr_waiting. Sleepers
+ * are only woken when the pipe goes from empty to non-empty (readers) or
+ * from full to non-full (writers).
+ */
+struct pipe_t
+{
+    volatile struct kernel_mutex_t lock;    /**< struct lock */
+    int nbufs;                  /**< number of buffers (a power of 2) */
+    int head;                   /**< first buffer with data */
+    int count;                  /**< count of buffers with data */
+    size_t bytes;               /**< count of bytes in the pipe */
+    struct pipe_buf_t *bufs;    /**< the buffers */
+    unsigned char *spare;       /**< spare page */
+    int rd_waiting;             /**< count of sleeping readers */
+    int wr_waiting;             /**< count of sleeping writers */
+
+#define PIPE_WAKE_READERS       0x01
+#define PIPE_WAKE_WRITERS       0x02
+    int wake;                   /**< pending wakeups */
+};
+
+
+/**
+ * @var pipe_actor_t
+ * @brief Pipe actor function.
+ *
+ * Function called by pipefs_splice_read() to consume data from a pipe.
+ * Returns the number of bytes consumed, or -(errno) on failure.
+ */
+typedef ssize_t (*pipe_actor_t)(void *arg, unsigned char *data, size_t len);
 
 
 /**
  * @brief Free a pipe.
  *
- * Free a pipe, i.e. release the memory page used to implement the pipe and
- * set the file's size to zero.
+ * Free a pipe, i.e. release the memory pages used to implement the pipe and
+ * drop the references to any page cache pages still in the pipe.
+ * Called when the last end of the pipe is closed.
  *
  * @param   node        file node referring to the open pipe
  *
@@ -49,13 +128,51 @@ void pipefs_free_node(struct fs_node_t *node);
  * @brief Create a new pipe node.
  *
  * Create a new file node that can be used as a pipe. This function allocates
- * a memory page (usually 4096 bytes) to be used as the pipe's First-In
- * First-Out (FIFO) queue and sets the appropriate file node fields.
+ * the pipe's First-In First-Out (FIFO) queue of PIPE_BUFFERS page buffers
+ * and sets the appropriate file node fields. Memory pages are allocated
+ * later as data is written to the pipe.
  *
  * @return  new file node on success, NULL on failure.
  */
 struct fs_node_t *pipefs_get_node(void);
 
+/**
+ * @brief Wake up a pipe's sleepers.
+ *
+ * Called when one end of the pipe is closed, so that tasks sleeping on the
+ * other end can see the EOF (readers) or get SIGPIPE (writers).
+ *
+ * @param   node        file node referring to the open pipe
+ *
+ * @return  nothing.
+ */
+void pipefs_hangup(struct fs_node_t *node);
+
+/**
+ * @brief Get a pipe's capacity.
+ *
+ * Handler for fcntl(F_GETPIPE_SZ).
+ *
+ * @param   node        file node referring to the open pipe
+ *
+ * @return  pipe capacity in bytes.
+ */
+long pipefs_get_size(struct fs_node_t *node);
+
+/**
+ * @brief Set a pipe's capacity.
+ *
+ * Handler for fcntl(F_SETPIPE_SZ). The size is rounded up to a power of 2
+ * number of pages. Unprivileged tasks cannot set sizes larger than
+ * PIPE_MAX_SIZE.
+ *
+ * @param   node        file node referring to the open pipe
+ * @param   size        requested capacity in bytes
+ *
+ * @return  new capacity in bytes on success, -(errno) on failure.
+ */
+long pipefs_set_size(struct fs_node_t *node, int size);
+
 /**
  * @brief Read from a pipe.
  *
@@ -90,6 +207,94 @@ ssize_t pipefs_read(struct file_t *f, off_t *pos,
 ssize_t pipefs_write(struct file_t *f, off_t *pos,
                      unsigned char *buf, size_t count, int kernel);
 
+/**
+ * @brief Copy data into a pipe.
+ *
+ * Same as pipefs_write(), except the caller decides if we should block.
+ *
+ * @param   f           open file struct
+ * @param   buf         buffer to write data from
+ * @param   count       maximum amount of bytes to write from \a buf
+ * @param   kernel      0 if call is coming from userland, non-zero if from kernel
+ * @param   nonblock    non-zero if we should not block
+ *
+ * @return number of bytes written on success, -(errno) on failure
+ */
+ssize_t pipefs_copy_in(struct file_t *f, unsigned char *buf, size_t count,
+                       int kernel, int nonblock);
+
+/**
+ * @brief Copy data out of a pipe.
+ *
+ * Same as pipefs_read(), except the caller decides if we should block.
+ *
+ * @param   f           open file struct
+ * @param   buf         buffer to read data into
+ * @param   count       maximum amount of bytes to read into \a buf
+ * @param   kernel      0 if call is coming from userland, non-zero if from kernel
+ * @param   nonblock    non-zero if we should not block
+ *
+ * @return number of bytes read on success, -(errno) on failure
+ */
+ssize_t pipefs_copy_out(struct file_t *f, unsigned char *buf, size_t count,
+                        int kernel, int nonblock);
+
+/**
+ * @brief Splice a cached page into a pipe.
+ *
+ * Add \a len bytes starting at \a offset in the given page cache page to
+ * the pipe, without copying the data. The caller must hold a reference to
+ * the page (see get_cached_page_ref()), which is handed to the pipe on
+ * success. On failure, the reference is still owned by the caller.
+ *
+ * @param   f           open file struct (the pipe's writing end)
+ * @param   pcache      referenced page cache page
+ * @param   offset      offset of data in page
+ * @param   len         length of data
+ * @param   nonblock    non-zero if we should not wait for a free buffer
+ *
+ * @return number of bytes spliced on success, -(errno) on failure
+ */
+ssize_t pipefs_splice_page(struct file_t *f, struct cached_page_t *pcache,
+                           size_t offset, size_t len, int nonblock);
+
+/**
+ * @brief Splice data out of a pipe.
+ *
+ * Pass at most \a count bytes from the pipe to the given \a actor, page
+ * by page, without copying the data. Whatever the actor consumes is removed
+ * from the pipe.
+ *
+ * @param   f           open file struct (the pipe's reading end)
+ * @param   count       maximum amount of bytes to splice
+ * @param   nonblock    non-zero if we should not block
+ * @param   actor       function to consume the data
+ * @param   arg         argument to pass to \a actor
+ *
+ * @return number of bytes spliced on success, -(errno) on failure
+ */
+ssize_t pipefs_splice_read(struct file_t *f, size_t count, int nonblock,
+                           pipe_actor_t actor, void *arg);
+
+/**
+ * @brief Splice data between two pipes.
+ *
+ * Move (or duplicate, if \a move is zero) at most \a count bytes from one
+ * pipe to another. Spliced page cache pages are passed by reference, while
+ * the contents of the pipe's own pages are copied.
+ *
+ * @param   in          open file struct (input pipe's reading end)
+ * @param   out         open file struct (output pipe's writing end)
+ * @param   count       maximum amount of bytes to splice
+ * @param   nonblock    non-zero if we should not block
+ * @param   move        non-zero to consume the input (splice), zero to
+ *                        leave it untouched (tee)
+ *
+ * @return number of bytes spliced on success, -(errno) on failure
+ */
+ssize_t pipefs_splice_pipe(struct file_t *in, struct file_t *out,
+                           size_t count, int nonblock, int move);
+
 /**
  * @brief Perform a select operation on a pipe.
  *
@@ -57,7 +57,7 @@
  * macro to extract the dir bits from a procfs inode number (see procfs.c
  * for the structure of a procfs inode number)
  */
-#define INODE_DIR_BITS(i)           ((i) & 0xff)
+#define INODE_DIR_BITS(i)           ((i) & 0xf)
 
 /**
  * \def INODE_SUBDIR_BITS
@@ -65,7 +65,7 @@
  * macro to extract the subdir bits from a procfs inode number (see procfs.c
  * for the structure of a procfs inode number)
  */
-#define INODE_SUBDIR_BITS(i)        (((i) >> 8) & 0xff)
+#define INODE_SUBDIR_BITS(i)        (((i) >> 4) & 0x1fff)
 
 /**
  * \def INODE_FILE_BITS
@@ -73,7 +73,7 @@
  * macro to extract the file bits from a procfs inode number (see procfs.c
  * for the structure of a procfs inode number)
  */
-#define INODE_FILE_BITS(i)          (((i) >> 16) & 0xffff)
+#define INODE_FILE_BITS(i)          (((i) >> 17) & 0x7fff)
 
 /**
  * \def MAKE_PROCFS_INODE
@@ -82,7 +82,7 @@
  * \a file number (see procfs.c for the structure of a procfs inode number)
  */
 #define MAKE_PROCFS_INODE(dir, subdir, file)   \
-            (((file) << 16) | ((subdir) << 8) | (dir))
+            (((file) << 17) | ((subdir) << 4) | (dir))
 
 /**
  * \enum dir_proc_enum
@@ -453,6 +453,10 @@ size_t get_meminfo(char **buf);
 size_t get_modules(char **buf);
 size_t get_mounts(char **buf);
 size_t get_sysstat(char **buf);
+size_t get_schedstat(char **buf);
+size_t get_buddyinfo(char **buf);
+size_t get_slabinfo(char **buf);
+size_t get_diskstats(char **buf);
 size_t get_pci_device_list(char **_buf);
 size_t get_pci_device_config_space(struct pci_dev_t *pci, char **_buf);
 size_t get_interrupt_info(char **_buf);
@@ -472,6 +476,7 @@ size_t get_net_dev_stats(char **buf);   // net/netif.c
  * Functions defined in procfs_sock.c
  **************************************/
 size_t get_net_tcp(char **buf);
+size_t get_net_tcpstat(char **buf);
 size_t get_net_udp(char **buf);
 size_t get_net_unix(char **buf);
 size_t get_net_raw(char **buf);
@@ -0,0 +1,101 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: readahead.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file readahead.h
+ *
+ *  Functions and macros for reading file pages ahead of their readers.
+ */
+
+#ifndef __FS_READAHEAD_H__
+#define __FS_READAHEAD_H__
+
+#include <kernel/vfs.h>
+#include <kernel/pcache.h>
+
+#ifndef POSIX_FADV_NORMAL
+#define POSIX_FADV_NORMAL       0
+#define POSIX_FADV_RANDOM       1
+#define POSIX_FADV_SEQUENTIAL   2
+#define POSIX_FADV_WILLNEED     3
+#define POSIX_FADV_DONTNEED     4
+#define POSIX_FADV_NOREUSE      5
+#endif
+
+/**
+ * \def RA_INIT_PAGES
+ *
+ * Size (in pages) of the first readahead window of a sequentially read
+ * file. Each following window is double the size of the previous one, up
+ * to RA_MAX_PAGES (or double that if the file was advised as sequential).
+ */
+#define RA_INIT_PAGES           4
+#define RA_MAX_PAGES            PCACHE_READAHEAD_MAX
+
+/**
+ * \def RA_QUEUE_MAX
+ *
+ * Maximum number of background readahead requests waiting for the
+ * readahead task. Requests are dropped when the queue is full.
+ */
+#define RA_QUEUE_MAX            32
+
+
+/**
+ * @var readahead_task
+ * @brief readahead task.
+ *
+ * Kernel task that reads readahead windows in the background.
+ */
+extern volatile struct task_t *readahead_task;
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Queue background readahead.
+ *
+ * Ask the readahead task to read \a count pages of the given \a node into
+ * the page cache, starting at \a offset. The caller does not wait for the
+ * pages to be read.
+ *
+ * @param   node        file node
+ * @param   offset      offset in file
+ * @param   count       number of pages to read
+ *
+ * @return  nothing.
+ */
+void queue_readahead(struct fs_node_t *node, off_t offset, size_t count);
+
+/**
+ * @brief Readahead task function.
+ *
+ * Function that runs the readahead kernel task.
+ *
+ * @param   arg         unused
+ *
+ * @return  never returns.
+ */
+void readahead_task_func(void *arg);
+
+#endif      /* __FS_READAHEAD_H__ */
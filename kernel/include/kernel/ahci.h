@@ -459,6 +459,38 @@ typedef struct
 } HBA_CMD_TBL;
 
 
+/**
+ * \def AHCI_PRDT_ENTRIES
+ *
+ * Number of PRDT entries in each command table. Physically contiguous pages
+ * share one entry, so a single command transfers at least
+ * AHCI_PRDT_ENTRIES pages. Bigger buffers are split across command slots.
+ */
+#define AHCI_PRDT_ENTRIES       56
+#define AHCI_CMD_TBL_SIZE       (0x80 + (AHCI_PRDT_ENTRIES * sizeof(HBA_PRDT_ENTRY)))
+
+
+/**
+ * @struct ahci_port_t
+ * @brief The ahci_port_t structure.
+ *
+ * A structure to represent the command queue of an AHCI port. A slot is
+ * claimed by the task submitting a request, issued to the HBA, and marked
+ * completed by the IRQ handler, after which the task releases it. The
+ * structure is protected by a spinlock as it is used in IRQ context.
+ */
+struct ahci_port_t
+{
+    volatile int holding_cpu;   /**< cpu holding the lock, -1 if unlocked */
+    volatile uint32_t busy;     /**< slots claimed by a request */
+    volatile uint32_t issued;   /**< slots issued and not yet completed */
+    volatile uint32_t failed;   /**< completed slots that returned errors */
+    uint32_t slot_mask;         /**< command slots we can use */
+    int ncq;                    /**< non-zero if using native command
+                                     queueing (READ/WRITE FPDMA QUEUED) */
+};
+
+
 /**
  * @struct ahci_dev_t
  * @brief The ahci_dev_t structure.
@@ -474,7 +506,7 @@ struct ahci_dev_t
                                      port's command list base address */
     uintptr_t port_fb[32];      /**< Same for port's FIS base address */
     uintptr_t port_ctba[32];    /**< Same for port's command list buffer */
-    volatile struct kernel_mutex_t port_lock[32];    /**< Port lock */
+    struct ahci_port_t portq[32];       /**< Port command queues */
     struct pci_dev_t *pci;      /**< Pointer to PCI device struct */
     struct task_t *task;        /**< Pointer to IRQ handler task */
     struct ahci_dev_t *next;    /**< Next AHCI device */
@@ -69,6 +69,8 @@
 extern uintptr_t lapic_virt;
 extern uintptr_t lapic_phys;
 extern volatile int apic_running;
+extern unsigned long lapic_timer_hz;
+extern unsigned long long tsc_hz;
 
 
 /***********************
@@ -78,5 +80,8 @@ extern volatile int apic_running;
 void apic_init(void);
 int lapic_cur_cpu(void);
 void lapic_timer_init(int timer_irq);
+void lapic_timer_oneshot(int timer_irq);
+void lapic_timer_arm(uint32_t count);
+void lapic_send_wakeup(int lapicid);
 
 #endif      /* KERNEL_APIC_H */
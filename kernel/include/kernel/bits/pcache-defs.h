@@ -38,12 +38,16 @@
 #define PCACHE_FLAG_BUSY            0x04
 #define PCACHE_FLAG_ALWAYS_DIRTY    0x08
 #define PCACHE_FLAG_STALE           0x10
+#define PCACHE_FLAG_ACTIVE          0x20    /* on the active LRU list */
 
 // values for the flags parameter of function get_cached_page()
 #define PCACHE_AUTO_ALLOC           0x01
 #define PCACHE_PEEK_ONLY            0x02
 #define PCACHE_IGNORE_STALE         0x04
 
+// maximum number of pages read by one readahead batch
+#define PCACHE_READAHEAD_MAX        32
+
 #define ONE_MINUTE                  (1 * 60 * PIT_FREQUENCY)
 #define TWO_MINUTES                 (2 * 60 * PIT_FREQUENCY)
 #define THREE_MINUTES               (3 * 60 * PIT_FREQUENCY)
@@ -69,7 +73,11 @@ struct cached_page_t
     int flags;          /**< cache flags */
     pid_t pid;          /**< last task to access the page */
     unsigned long long last_accessed;   /**< last access time in ticks */
-    struct cached_page_t *next; /**< next page in cache list */
+    struct cached_page_t *next; /**< next page in hash bucket */
+    struct cached_page_t *lru_prev,     /**< previous page in LRU list */
+                         *lru_next;     /**< next page in LRU list */
+    struct cached_page_t *node_prev,    /**< previous page of the same node */
+                         *node_next;    /**< next page of the same node */
 };
 
 /**
@@ -88,6 +96,26 @@ struct disk_req_t
 	                                or write */
     unsigned long fs_blocksz;   /**< filesystem (logical) block size */
     int write;          /**< 1 = write op; 0 = read op */
+
+    /*
+     * The fields below are used by the block layer (see blk_queue.c) and
+     * are set when the request is submitted. If \a next is not NULL, this
+     * request was merged with the requests in the \a next chain, which
+     * follow it contiguously on disk, and drivers that accept merged
+     * requests (BDEV_FLAG_MERGE) must transfer all of them.
+     */
+    struct disk_req_t *next;        /**< next segment of a merged request */
+    struct disk_req_t *tail;        /**< last segment of a merged request */
+    struct disk_req_t *sort_prev,   /**< prev request in sorted list */
+                      *sort_next;   /**< next request in sorted list */
+    struct disk_req_t *fifo_prev,   /**< prev request in fifo list */
+                      *fifo_next;   /**< next request in fifo (or plug) list */
+    struct blk_queue_t *queue;      /**< queue this request is on */
+    unsigned long long pos;         /**< byte offset on the device */
+    unsigned long nbytes;           /**< total bytes of a merged request */
+    unsigned long long deadline;    /**< dispatch deadline (in ticks) */
+    long res;                       /**< bytes transferred or -(errno) */
+    volatile int done;              /**< set when the request completes */
 };
 
 /**
@@ -104,12 +132,4 @@ struct pcache_key_t
     off_t offset;       /**< page offset in file */
 };
 
-/**
- * @var pcachetab_lock
- * @brief pcache lock.
- *
- * A lock used to regulate access to the page cache.
- */
-extern volatile struct kernel_mutex_t pcachetab_lock;
-
 #endif      /* __KERNEL_PCACHE_DEFS_H__ */
@@ -73,18 +73,26 @@
 #define PROPERTY_HANDLING_PAGEFAULT (1 << 13)   /**< task is handling a 
                                                      page fault */
 #define PROPERTY_DYNAMICALLY_LOADED (1 << 14)   /**< dynamically loaded */
+#define PROPERTY_EXCLUSIVE_WAIT     (1 << 15)   /**< task is an exclusive
+                                                     waiter */
 
 /* thread group flags */
 #define TG_FLAG_EXITING             (1 << 0)
 
 
-#define NR_TASKS                    256         /**< max system tasks 
-                                                     (i.e. task table size) */
+#define NR_TASKS_DEFAULT            256         /**< initial task table size,
+                                                     the table is expanded
+                                                     on demand up to
+                                                     MAX_NR_TASKS */
 
-#if (NR_TASKS > MAX_NR_TASKS)
-# error "NR_TASKS is higher than the maximum allowed in MAX_NR_TASKS"
+#if (NR_TASKS_DEFAULT > MAX_NR_TASKS)
+# error "NR_TASKS_DEFAULT is higher than the maximum allowed in MAX_NR_TASKS"
 #endif
 
+#define PID_MAX                     32768       /**< pids are allocated in
+                                                     the range [1, PID_MAX) */
+#define NR_PID_HASH                 1024        /**< pid hash buckets */
+
 //#include <sys/syslimits.h>      // NGROUPS_MAX
 #include <limits.h>      // NGROUPS_MAX
 
@@ -108,15 +116,32 @@
 #include <kernel/vfs.h>
 
 
+#define FD_BITS_PER_LONG        (sizeof(unsigned long) * 8)
+#define FD_BITMAP_LONGS(n)      (((n) + FD_BITS_PER_LONG - 1) / FD_BITS_PER_LONG)
+
 /**
  * @struct task_files_t
  * @brief The task_files_t structure.
  *
- * A structure to represent a task's open files.
+ * A structure to represent a task's open files. The file table starts with
+ * NR_OPEN_DEFAULT slots and is expanded on demand, up to the task's
+ * RLIMIT_NOFILE. Tables replaced by expanding are kept until the struct is
+ * freed, as other threads might still be looking at them without holding
+ * the lock.
  */
 struct task_files_t
 {
-    struct file_t *ofile[NR_OPEN];  /**< open files */
+    struct file_t **ofile;          /**< open files */
+    unsigned long *open_fds;        /**< bitmap of used (or reserved) fds */
+    unsigned long *cloexec_fds;     /**< bitmap of close-on-exec fds */
+    int max_fds;                    /**< number of slots in the tables */
+    int next_fd;                    /**< there are no free fds below this */
+    void *tables;                   /**< kmalloc'd tables (NULL if using the
+                                         initial tables below) */
+    void *old_tables;               /**< tables replaced by expanding */
+    struct file_t *ofile_init[NR_OPEN_DEFAULT];     /**< initial tables */
+    unsigned long open_fds_init[FD_BITMAP_LONGS(NR_OPEN_DEFAULT)];
+    unsigned long cloexec_init[FD_BITMAP_LONGS(NR_OPEN_DEFAULT)];
     volatile struct kernel_mutex_t mutex;    /**< struct lock */
 };
 
@@ -289,6 +314,7 @@ struct task_t
 
     volatile struct task_t *next,       /**< pointer to next task */
                            *prev;       /**< pointer to previous task */
+    struct task_queue_t *queue;         /**< queue the task is on */
 
     struct task_t *parent;              /**< pointer to parent task */
 
@@ -304,6 +330,8 @@ struct task_t
     struct task_threads_t *threads;     /**< thread info */
     struct task_t *thread_group_next;   /**< next thread in group */
 
+    volatile struct task_t *pid_hash_next;  /**< next task in pid hash */
+
     struct
     {
         uintptr_t base;
@@ -312,9 +340,10 @@ struct task_t
 
     struct task_files_t *ofiles;        /**< open files handlers */
 
-    uint32_t cloexec;               /**< which files are closed on exec() */
 
     int32_t cpuid;                  /**< id of the cpu the task is running on */
+    int32_t last_cpu;               /**< id of the cpu whose run queue the
+                                           task is on (or was last on) */
   
     struct task_vm_t *mem;          /**< task memory map */
 
@@ -335,6 +364,16 @@ struct task_t
     volatile int woke_by_signal;        /**< set when task gets woken up by
                                                a signal */
 
+    struct selrec_t *selrec;            /**< if set, selrecord() passes
+                                               select channels here (see
+                                               select.h) */
+
+    struct selinfo signalfd_sel;        /**< select channel for signalfds
+                                               polled or read by the task */
+#define SIGNALFD_USED           0x01    /* task uses a signalfd */
+#define SIGNALFD_DEFERRED       0x02    /* selwakeup() deferred from IRQ */
+    volatile int signalfd_flags;        /**< signalfd flags */
+
     dev_t ctty;                         /**< the controlling terminal */
   
     int nice;                           /**< nice value */
@@ -59,6 +59,7 @@ struct fs_node_t;
 struct file_t;
 struct dirent;
 struct mount_info_t;
+struct cached_page_t;
 
 
 struct superblock_t
@@ -146,6 +147,10 @@ struct fs_info_t
     char name[8];           /**< filesystem name */
     unsigned int index;     /**< index in filesystem table */
     struct fs_ops_t *ops;   /**< pointer to filesystem operations struct */
+
+#define FSINFO_FLAG_NOCACHE     0x01    /**< don't keep unused nodes incore */
+#define FSINFO_FLAG_NODCACHE    0x02    /**< don't cache directory lookups */
+    unsigned int flags;     /**< filesystem flags */
 };
 
 
@@ -215,12 +220,10 @@ struct fs_node_t
     time_t mtime;       /**< modification time */
     time_t atime;       /**< access time */
     time_t ctime;       /**< creation time */
-    size_t size;        /**< file size (for pipes, the pipe's virtual 
-                             memory address) */
+    size_t size;        /**< file size */
     unsigned int links; /**< hard link count */
     gid_t gid;          /**< group id */
-    unsigned long blocks[15];   /**< pointer to disk blocks (for pipes, 
-                                     [0] and [1] point to pipe head/tail */
+    unsigned long blocks[15];   /**< pointer to disk blocks */
 
     uint32_t disk_sectors;  /**<  count of disk sectors (not Ext2 blocks) in
                                   use by this inode, not counting the actual
@@ -238,6 +241,11 @@ struct fs_node_t
 #define FS_NODE_KEEP_INCORE     0x20
 #define FS_NODE_STALE           0x40
 #define FS_NODE_LOOP_BACKING    0x80
+#define FS_NODE_EPOLL           0x100
+#define FS_NODE_EVENTFD         0x200
+#define FS_NODE_TIMERFD         0x400
+#define FS_NODE_SIGNALFD        0x800
+#define FS_NODE_UNUSED          0x1000
 //#define FS_NODE_WANTED          0x80
     unsigned int flags;     /**< node flags */
     struct fs_ops_t *ops;   /**< pointer to filesystem operations struct */
@@ -245,7 +253,8 @@ struct fs_node_t
     struct fs_node_t *next; /**< used by tmpfs to find next node in a
                                  tmpfs device */
     
-    void *data;             /**< used by sockets (ptr to struct socket) */
+    void *data;             /**< used by sockets (ptr to struct socket)
+                                 and pipes (ptr to struct pipe_t) */
 
     long (*poll)(struct file_t *, struct pollfd *);  /**< polling function */
     long (*select)(struct file_t *f, int which);     /**< select function */
@@ -257,6 +266,18 @@ struct fs_node_t
     struct selinfo select_channel;  /**< used by pipes to select/poll */
     
     struct alock_t *alocks;         /**< queue of advisory locks */
+
+    struct cached_page_t *cached_pages; /**< pages of this node in the page
+                                             cache (protected by the page
+                                             cache) */
+    unsigned long nr_cached_pages;      /**< count of the above */
+
+    /* node cache links (protected by the hash bucket lock) */
+    struct fs_node_t *hnext;            /**< next node in hash bucket */
+    struct fs_node_t **hpprev;          /**< pointer to previous hnext */
+    struct node_bucket_t *hbucket;      /**< hash bucket we are on */
+    struct fs_node_t *lru_next,         /**< next unused node */
+                     *lru_prev;         /**< previous unused node */
 };
 
 struct fs_node_header_t
@@ -266,6 +287,24 @@ struct fs_node_header_t
     struct mount_info_t *minfo;     /**< device mount info for quick access */
 };
 
+/**
+ * @struct file_ra_t
+ * @brief The file_ra_t structure.
+ *
+ * A structure to hold the readahead state of an open file. All offsets
+ * and sizes are in pages.
+ */
+struct file_ra_t
+{
+    off_t start;        /**< first page of the current readahead window */
+    size_t size;        /**< number of pages in the window, zero if there
+                             is no window (i.e. the file is read randomly) */
+    size_t async_size;  /**< the next window is read in the background when
+                             the reader is this far from the window's end */
+    off_t prev;         /**< last page read */
+    int advice;         /**< advice given by posix_fadvise() */
+};
+
 /**
  * @struct file_t
  * @brief The file_t structure.
@@ -283,6 +322,11 @@ struct file_t
     struct fs_node_t *node;     /**< pointer to incore node */
     off_t pos;                  /**< read/write position in file */
     volatile struct kernel_mutex_t lock; /**< struct lock */
+    struct file_ra_t ra;        /**< readahead state */
+    struct epitem_t *epitems;   /**< epoll items watching this file
+                                     (protected by epoll_mutex) */
+    struct file_t *next,        /**< next open file */
+                  *prev;        /**< previous open file */
 };
 
 #endif      /* __VFS_DEFS__ */
@@ -0,0 +1,215 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: blk_queue.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file blk_queue.h
+ *
+ *  Functions and macros for working with block device request queues.
+ */
+
+#ifndef __BLK_QUEUE_H__
+#define __BLK_QUEUE_H__
+
+#include <sys/types.h>
+#include <kernel/mutex.h>
+#include <kernel/timer.h>
+#include <kernel/bits/pcache-defs.h>
+
+/**
+ * \def BLK_QUEUE_HASH_SIZE
+ *
+ * Request queues are created on demand (one per device), and are kept in a
+ * hash table of BLK_QUEUE_HASH_SIZE buckets, hashed by device id.
+ */
+#define BLK_QUEUE_HASH_SIZE         64
+
+/**
+ * \def BLK_READ_EXPIRE
+ *
+ * Requests are dispatched in disk order, unless the oldest request has
+ * waited for more than BLK_READ_EXPIRE (reads) or BLK_WRITE_EXPIRE (writes)
+ * ticks. Reads are preferred, but pending writes are not passed over for
+ * more than BLK_WRITES_STARVED read batches. A batch is at most
+ * BLK_FIFO_BATCH requests in the same direction.
+ */
+#define BLK_READ_EXPIRE             (PIT_FREQUENCY / 2)
+#define BLK_WRITE_EXPIRE            (PIT_FREQUENCY * 5)
+#define BLK_WRITES_STARVED          2
+#define BLK_FIFO_BATCH              16
+
+/**
+ * \def BLK_MAX_MERGE_BYTES
+ *
+ * Maximum size of a merged request.
+ */
+#define BLK_MAX_MERGE_BYTES         (256 * 1024)
+
+/**
+ * \def BLK_MAX_IN_FLIGHT
+ *
+ * Maximum number of requests dispatched to a device at the same time.
+ * Requests submitted while the device is busy are queued, which gives the
+ * elevator something to sort and merge.
+ */
+#define BLK_MAX_IN_FLIGHT           4
+
+#define BLK_READ                    0
+#define BLK_WRITE                   1
+
+
+/**
+ * @struct blk_queue_stats_t
+ * @brief The blk_queue_stats_t structure.
+ *
+ * Request queue statistics (shown in /proc/diskstats). Each field is
+ * indexed by BLK_READ or BLK_WRITE.
+ */
+struct blk_queue_stats_t
+{
+    unsigned long reqs[2];          /**< requests submitted */
+    unsigned long merges[2];        /**< requests merged with others */
+    unsigned long dispatched[2];    /**< requests sent to the driver */
+    unsigned long long bytes[2];    /**< bytes transferred */
+    unsigned long errors[2];        /**< failed requests */
+    unsigned long expired[2];       /**< requests dispatched on deadline */
+};
+
+
+/**
+ * @struct blk_queue_t
+ * @brief The blk_queue_t structure.
+ *
+ * A structure to represent a block device request queue. Queued requests
+ * are kept in two lists per direction: one sorted by disk position, and
+ * one in submission (deadline) order.
+ */
+struct blk_queue_t
+{
+    dev_t dev;                          /**< device id */
+    volatile struct kernel_mutex_t lock;    /**< protects the queue */
+    struct disk_req_t *sort_head[2];    /**< requests in disk order */
+    struct disk_req_t *fifo_head[2],    /**< oldest request */
+                      *fifo_tail[2];    /**< newest request */
+    int queued[2];                      /**< requests on the lists */
+    int in_flight;                      /**< requests in the driver */
+    int starved;                        /**< read batches run while writes
+                                             were pending */
+    int batch;                          /**< requests left in this batch */
+    int batch_dir;                      /**< direction of this batch */
+    unsigned long long head_pos;        /**< where the last request ended */
+    struct blk_queue_stats_t stats;     /**< queue statistics */
+    struct blk_queue_t *next;           /**< next queue in hash bucket */
+};
+
+
+/**
+ * @struct blk_plug_t
+ * @brief The blk_plug_t structure.
+ *
+ * A structure to hold requests that are submitted together, so that they
+ * can be merged and sorted before any of them is dispatched.
+ */
+struct blk_plug_t
+{
+    struct disk_req_t *head,    /**< first plugged request */
+                      *tail;    /**< last plugged request */
+};
+
+
+/**
+ * @var blk_queues
+ * @brief request queue hash table.
+ *
+ * Request queues of the devices on the system (protected by
+ * blk_queues_lock).
+ */
+extern struct blk_queue_t *blk_queues[BLK_QUEUE_HASH_SIZE];
+extern volatile struct kernel_mutex_t blk_queues_lock;
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Submit a disk request and wait for it.
+ *
+ * Queue the request on its device's request queue, and wait for it to
+ * complete. This is what filesystems and the page cache should call instead
+ * of calling the device's strategy function directly.
+ *
+ * @param   req     disk request
+ *
+ * @return  the result of the device's strategy function (bytes transferred
+ *            or -(errno)).
+ */
+long blk_submit(struct disk_req_t *req);
+
+/**
+ * @brief Start a plug.
+ *
+ * Initialize a plug to collect requests with blk_plug_req().
+ *
+ * @param   plug    request plug
+ *
+ * @return  nothing.
+ */
+void blk_start_plug(struct blk_plug_t *plug);
+
+/**
+ * @brief Add a request to a plug.
+ *
+ * The request is not queued until blk_finish_plug() is called.
+ *
+ * @param   plug    request plug
+ * @param   req     disk request
+ *
+ * @return  nothing.
+ */
+void blk_plug_req(struct blk_plug_t *plug, struct disk_req_t *req);
+
+/**
+ * @brief Finish a plug.
+ *
+ * Queue all the requests collected in the plug, merging adjacent requests
+ * where the device allows it. The caller must then call blk_wait_req() on
+ * each request.
+ *
+ * @param   plug    request plug
+ *
+ * @return  nothing.
+ */
+void blk_finish_plug(struct blk_plug_t *plug);
+
+/**
+ * @brief Wait for a request.
+ *
+ * Wait for a queued request to complete. While waiting, the caller
+ * dispatches queued requests to the driver if the device is not busy.
+ *
+ * @param   req     disk request
+ *
+ * @return  the result of the device's strategy function (bytes transferred
+ *            or -(errno)).
+ */
+long blk_wait_req(struct disk_req_t *req);
+
+#endif      /* __BLK_QUEUE_H__ */
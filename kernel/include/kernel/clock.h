@@ -48,7 +48,8 @@
  */
 struct clock_waiter_t
 {
-    int64_t delta;                  /**< time delta in ticks */
+    unsigned long long expires;     /**< expiry time in nanoseconds (on
+                                         the clock hrtimer_now() reads) */
     pid_t pid;                      /**< waiter task */
     ktimer_t timerid;               /**< timer id */
     struct clock_waiter_t *next;    /**< next waiter task in list */
@@ -108,8 +109,41 @@ extern time_t startup_time;
 extern struct clock_waiter_t waiter_head[];
 
 
+/**
+ * @brief Wait on a clock.
+ *
+ * Add a waiter for task \a pid and sleep until \a timeout_ns nanoseconds
+ * expire or we are woken by a signal. If \a timerid is non-zero, the
+ * waiter is added without blocking the caller.
+ *
+ * @param   head        clock waiter queue head
+ * @param   pid         task id
+ * @param   timeout_ns  timeout in nanoseconds
+ * @param   timerid     POSIX timer id, or 0 if this is a plain sleep
+ *
+ * @return  the remaining time in nanoseconds (zero if the timeout expired).
+ */
 long clock_wait(struct clock_waiter_t *head, pid_t pid,
-                int64_t delta, ktimer_t timerid);
+                int64_t timeout_ns, ktimer_t timerid);
+
+/**
+ * @brief Add a clock waiter.
+ *
+ * Insert a waiter for task \a pid in the queue of the clock whose queue
+ * head is \a head, without blocking the caller. When \a timeout_ns
+ * nanoseconds expire, the task is woken up (or the timer \a timerid is fired, if
+ * \a timerid is non-zero). The caller is responsible for removing the
+ * waiter by calling get_waiter() and waiter_free().
+ *
+ * @param   head        clock waiter queue head
+ * @param   pid         task id
+ * @param   timeout_ns  timeout in nanoseconds
+ * @param   timerid     POSIX timer id, or 0 if this is a plain sleep
+ *
+ * @return  the new waiter on success, NULL if the waiter table is full.
+ */
+struct clock_waiter_t *clock_add_waiter(struct clock_waiter_t *head, pid_t pid,
+                                        int64_t timeout_ns, ktimer_t timerid);
 
 
 /**
@@ -198,19 +232,6 @@ long do_clock_settime(clockid_t clock_id, struct timespec *tp);
 long syscall_clock_settime(clockid_t clock_id, struct timespec *tp);
 
 
-/**
- * @brief Check expired timers.
- *
- * Called by the timer IRQ handler. Checks for expired timers and, if there
- * are any, schedules a soft interrupt (\ref SOFTINT_SLEEP) to handle them.
- *
- * @return  nothing.
- *
- * @see     SOFTINT_SLEEP, softsleep()
- */
-void clock_check_waiters(void);
-
-
 /**
  * @brief Get the clock_waiter_t struct for a task.
  *
@@ -221,8 +242,9 @@ void clock_check_waiters(void);
  * @param   pid                 the waiting task's pid
  * @param   timerid             timer id of the POSIX timer the task is
  *                                waiting on
- * @param   remaining_ticks     if the timer has not expired yet, the 
- *                                remaining time (in ticks) is returned here
+ * @param   remaining_ns        if the timer has not expired yet, the 
+ *                                remaining time (in nanoseconds) is
+ *                                returned here (zero if it has expired)
  * @param   unlink              if non-zero, the task is removed from the
  *                                waiters queue
  *
@@ -230,7 +252,7 @@ void clock_check_waiters(void);
  */
 struct clock_waiter_t *get_waiter(volatile struct clock_waiter_t *head,
                                   pid_t pid, ktimer_t timerid,
-                                  int64_t *remaining_ticks, int unlink);
+                                  int64_t *remaining_ns, int unlink);
 
 void waiter_free(struct clock_waiter_t *w);
 
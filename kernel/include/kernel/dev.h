@@ -104,8 +104,15 @@ struct bdev_ops_t
     struct dentry_list_t *dentry_list;  /**< list of dentries representing
                                              files and dirs accessed on this
                                              device */
+    int flags;                  /**< BDEV_FLAG_* flags (see below) */
 };
 
+/*
+ * Flags for the flags field of struct bdev_ops_t.
+ */
+#define BDEV_FLAG_MERGE         0x01    /* strategy() accepts merged requests
+                                           (see struct disk_req_t) */
+
 
 /**
  * @var bdev_tab
@@ -0,0 +1,226 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: epoll.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file epoll.h
+ *
+ *  Functions and structure definitions for the kernel's epoll
+ *  implementation.
+ */
+
+#ifndef __KERNEL_EPOLL_H__
+#define __KERNEL_EPOLL_H__
+
+#include <sys/epoll.h>
+#include <kernel/mutex.h>
+#include <kernel/select.h>
+#include <kernel/vfs.h>
+
+/**
+ * \def EPOLL_ITEM_HOOKS
+ *
+ * The maximum number of select channels an epoll item can watch. Files
+ * wait on one channel for reading and (possibly) another for writing.
+ */
+#define EPOLL_ITEM_HOOKS        2
+
+/**
+ * \def EPOLL_INIT_HASHSZ
+ *
+ * Initial size of an epoll instance's item hash table. The table is
+ * doubled as items are added.
+ */
+#define EPOLL_INIT_HASHSZ       16
+
+/* event bits that are not reported back to the user */
+#define EP_PRIVATE_BITS         (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | \
+                                 EPOLLEXCLUSIVE)
+
+struct epitem_t;
+
+
+/**
+ * @struct ephook_t
+ * @brief The ephook_t structure.
+ *
+ * A select hook that links a select channel to an epoll item.
+ */
+struct ephook_t
+{
+    struct selhook_t hook;      /**< the hook (must be the first field) */
+    struct epitem_t *item;      /**< the item to queue on wakeup */
+};
+
+
+/**
+ * @struct epitem_t
+ * @brief The epitem_t structure.
+ *
+ * A structure to represent a file descriptor on an epoll instance's
+ * interest list.
+ */
+struct epitem_t
+{
+    struct selrec_t rec;        /**< used to record the file's select
+                                     channels (must be the first field) */
+    struct epoll_t *ep;         /**< the epoll instance */
+    struct file_t *file;        /**< the watched file */
+    int fd;                     /**< the watched file descriptor */
+    struct epoll_event event;   /**< requested events and user data */
+
+#define EPITEM_READY            0x01    /* on the ready list */
+#define EPITEM_DEAD             0x02    /* being removed */
+    int flags;                  /**< item flags */
+
+    int nhooks;                 /**< count of hooks in use */
+    struct ephook_t hooks[EPOLL_ITEM_HOOKS];    /**< select channel hooks */
+
+    struct epitem_t *next;      /**< next item in hash bucket */
+    struct epitem_t *fnext,     /**< next item watching the same file */
+                    **fpprev;   /**< pointer to us in the previous item */
+    struct epitem_t *rdnext,    /**< next item on the ready list */
+                    *rdprev;    /**< previous item on the ready list */
+};
+
+
+/**
+ * @struct epoll_t
+ * @brief The epoll_t structure.
+ *
+ * A structure to represent an epoll instance.
+ *
+ * The mtx lock serializes epoll_ctl() and the scanning of the ready list
+ * by epoll_wait(), and is held while calling the files' poll functions.
+ * The lock field protects the ready list, and is taken by select hooks
+ * when a watched file becomes ready. If both are needed, mtx is taken
+ * first.
+ */
+struct epoll_t
+{
+    volatile struct kernel_mutex_t mtx;     /**< interest list lock */
+    volatile struct kernel_mutex_t lock;    /**< ready list lock */
+    struct epitem_t *rdhead,    /**< first ready item */
+                    *rdtail;    /**< last ready item */
+    struct epitem_t **hash;     /**< items hashed by file descriptor */
+    int hashsz;                 /**< hash table size (a power of 2) */
+    int nitems;                 /**< count of items on the interest list */
+    int nr_nested;              /**< count of epoll instances on our
+                                     interest list */
+    struct selinfo sel;         /**< select channel for polling us */
+    struct fs_node_t *node;     /**< our file node */
+};
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Initialise epoll.
+ *
+ * Initialise the epoll item cache and lock. Called once during boot.
+ *
+ * @return  nothing.
+ */
+void epoll_init(void);
+
+/**
+ * @brief Close an epoll instance.
+ *
+ * Remove all the items on the interest list and free the epoll instance
+ * referred to by the given node. Called on the last close of the epoll
+ * file descriptor.
+ *
+ * @param   node        epoll file node
+ *
+ * @return  nothing.
+ */
+void epoll_close(struct fs_node_t *node);
+
+/**
+ * @brief Release a closed file.
+ *
+ * Remove the given file from the interest lists of all the epoll instances
+ * that are watching it. Called on the last close of the file.
+ *
+ * @param   f           file being closed
+ *
+ * @return  nothing.
+ */
+void epoll_release_file(struct file_t *f);
+
+/**
+ * @brief Handler for syscall epoll_create().
+ *
+ * @param   size        ignored, but must be greater than zero
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long syscall_epoll_create(int size);
+
+/**
+ * @brief Handler for syscall epoll_create1().
+ *
+ * @param   flags       zero or EPOLL_CLOEXEC
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long syscall_epoll_create1(int flags);
+
+/**
+ * @brief Handler for syscall epoll_ctl().
+ *
+ * @param   epfd        epoll file descriptor
+ * @param   op          EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param   fd          target file descriptor
+ * @param   event       requested events (ignored for EPOLL_CTL_DEL)
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long syscall_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/**
+ * @brief Handler for syscall epoll_wait().
+ *
+ * @param   epfd        epoll file descriptor
+ * @param   events      ready events are returned here
+ * @param   maxevents   maximum number of events to return
+ * @param   timeout     timeout in milliseconds (-1 to wait indefinitely,
+ *                        0 to return immediately)
+ *
+ * @return  number of ready events on success, -(errno) on failure.
+ */
+long syscall_epoll_wait(int epfd, struct epoll_event *events,
+                        int maxevents, int timeout);
+
+/**
+ * @brief Handler for syscall epoll_pwait().
+ *
+ * Same as epoll_wait(), except that the given signal mask is set while
+ * waiting.
+ *
+ * @param   __args      packed syscall arguments (see syscall.h)
+ *
+ * @return  number of ready events on success, -(errno) on failure.
+ */
+long syscall_epoll_pwait(struct syscall_args *__args);
+
+#endif      /* __KERNEL_EPOLL_H__ */
@@ -0,0 +1,98 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: eventfd.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file eventfd.h
+ *
+ *  Functions and structure definitions for the kernel's eventfd
+ *  implementation.
+ */
+
+#ifndef __KERNEL_EVENTFD_H__
+#define __KERNEL_EVENTFD_H__
+
+#include <stdint.h>
+#include <kernel/mutex.h>
+#include <kernel/select.h>
+#include <kernel/vfs.h>
+
+/**
+ * \def EVENTFD_MAX
+ *
+ * The largest value an eventfd counter can hold.
+ */
+#define EVENTFD_MAX             0xFFFFFFFFFFFFFFFEULL
+
+
+/**
+ * @struct eventfd_t
+ * @brief The eventfd_t structure.
+ *
+ * A structure to represent an eventfd counter. Readers sleep on the
+ * structure's address while the counter is zero, and writers sleep on it
+ * while adding to the counter would overflow it.
+ */
+struct eventfd_t
+{
+    volatile struct kernel_mutex_t lock;    /**< struct lock */
+    uint64_t count;                         /**< the counter */
+    int flags;                              /**< EFD_SEMAPHORE or zero */
+    struct selinfo sel;                     /**< select channel */
+};
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Close an eventfd.
+ *
+ * Free the eventfd referred to by the given node. Called on the last close
+ * of the eventfd file descriptor.
+ *
+ * @param   node        eventfd file node
+ *
+ * @return  nothing.
+ */
+void eventfd_close(struct fs_node_t *node);
+
+/**
+ * @brief Handler for syscall eventfd().
+ *
+ * @param   initval     initial counter value
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long syscall_eventfd(unsigned int initval);
+
+/**
+ * @brief Handler for syscall eventfd2().
+ *
+ * @param   initval     initial counter value
+ * @param   flags       zero or a combination of EFD_CLOEXEC, EFD_NONBLOCK
+ *                        and EFD_SEMAPHORE
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long syscall_eventfd2(unsigned int initval, int flags);
+
+#endif      /* __KERNEL_EVENTFD_H__ */
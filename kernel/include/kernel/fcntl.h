@@ -41,6 +41,11 @@
 #define	FWRITE		0x0002	/* write enabled */
 #endif
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ    1031
+#define F_GETPIPE_SZ    1032
+#endif
+
 
 /**
  * @struct alock_t
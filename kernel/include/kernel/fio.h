@@ -54,7 +54,7 @@ static inline int fdnode(int fd, struct task_t *t,
         return -EBADF;
     }
 
-    if(fd < 0 || fd >= NR_OPEN ||
+    if(fd < 0 || fd >= t->ofiles->max_fds ||
        !(*f = t->ofiles->ofile[fd]) || !(*node = (*f)->node))
     {
         return -EBADF;
@@ -79,7 +79,8 @@ int fdnode(int fd, volatile struct task_t *t, struct file_t **f, struct fs_node_
  */
 static inline int validfd(int fd, volatile struct task_t *ct)
 {
-	if(fd < 0 || fd >= NR_OPEN || !ct->ofiles || !ct->ofiles->ofile[fd])
+	if(fd < 0 || !ct->ofiles || fd >= ct->ofiles->max_fds ||
+	   !ct->ofiles->ofile[fd])
 	{
 		return 0;
 	}
@@ -0,0 +1,149 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: futex.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file futex.h
+ *
+ *  Functions and macros for working with fast userspace mutexes (futexes).
+ */
+
+#ifndef __KERNEL_FUTEX_H__
+#define __KERNEL_FUTEX_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <kernel/mutex.h>
+#include "bits/syscall-defs.h"
+
+/*
+ * Futex operations (the same values used by Linux).
+ */
+#define FUTEX_WAIT                  0
+#define FUTEX_WAKE                  1
+#define FUTEX_REQUEUE               3
+#define FUTEX_CMP_REQUEUE           4
+#define FUTEX_WAKE_OP               5
+#define FUTEX_WAIT_BITSET           9
+#define FUTEX_WAKE_BITSET           10
+
+#define FUTEX_PRIVATE_FLAG          128
+#define FUTEX_CLOCK_REALTIME        256
+#define FUTEX_CMD_MASK              ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME)
+
+#define FUTEX_BITSET_MATCH_ANY      0xffffffff
+
+/*
+ * Operations and comparisons for FUTEX_WAKE_OP.
+ */
+#define FUTEX_OP_SET                0   /* uaddr2 = oparg */
+#define FUTEX_OP_ADD                1   /* uaddr2 += oparg */
+#define FUTEX_OP_OR                 2   /* uaddr2 |= oparg */
+#define FUTEX_OP_ANDN               3   /* uaddr2 &= ~oparg */
+#define FUTEX_OP_XOR                4   /* uaddr2 ^= oparg */
+
+#define FUTEX_OP_OPARG_SHIFT        8   /* use (1 << oparg) as operand */
+
+#define FUTEX_OP_CMP_EQ             0   /* if (oldval == cmparg) wake */
+#define FUTEX_OP_CMP_NE             1   /* if (oldval != cmparg) wake */
+#define FUTEX_OP_CMP_LT             2   /* if (oldval < cmparg) wake */
+#define FUTEX_OP_CMP_LE             3   /* if (oldval <= cmparg) wake */
+#define FUTEX_OP_CMP_GT             4   /* if (oldval > cmparg) wake */
+#define FUTEX_OP_CMP_GE             5   /* if (oldval >= cmparg) wake */
+
+/**
+ * \def FUTEX_HASH_BITS
+ *
+ * Waiters are kept in a fixed table of (1 << FUTEX_HASH_BITS) buckets,
+ * hashed by futex key. Each bucket has its own lock.
+ */
+#define FUTEX_HASH_BITS             8
+#define NR_FUTEX_BUCKETS            (1 << FUTEX_HASH_BITS)
+
+
+/**
+ * @struct futex_key_t
+ * @brief The futex_key_t structure.
+ *
+ * A structure to uniquely identify a futex word. Private futexes are
+ * identified by the address space and the virtual address of the word.
+ * Shared futexes (those in MAP_SHARED mappings) are identified by the
+ * physical address of the word, with \a mem set to NULL.
+ */
+struct futex_key_t
+{
+    uintptr_t word;             /**< virtual or physical address */
+    void *mem;                  /**< task_vm_t of private futexes */
+};
+
+
+/**
+ * @struct futex_waiter_t
+ * @brief The futex_waiter_t structure.
+ *
+ * A structure to represent a task waiting on a futex. The struct lives on
+ * the waiting task's kernel stack for the duration of the wait.
+ */
+struct futex_waiter_t
+{
+    struct futex_key_t key;             /**< futex we are waiting on */
+    volatile struct task_t *task;       /**< waiting task */
+    uint32_t bitset;                    /**< FUTEX_WAIT_BITSET mask */
+    volatile int woken;                 /**< set by the waker */
+    struct futex_bucket_t *bucket;      /**< bucket we are queued in */
+    struct futex_waiter_t *prev,        /**< previous waiter in bucket */
+                          *next;        /**< next waiter in bucket */
+};
+
+
+/**
+ * @struct futex_bucket_t
+ * @brief The futex_bucket_t structure.
+ *
+ * A structure to represent a futex hash bucket.
+ */
+struct futex_bucket_t
+{
+    volatile struct kernel_mutex_t lock;    /**< bucket lock */
+    struct futex_waiter_t *head,            /**< first waiter */
+                          *tail;            /**< last waiter */
+};
+
+
+/**
+ * @brief Handler for syscall futex().
+ *
+ * Wait on, wake up or requeue tasks waiting on a futex. As futex() takes
+ * six arguments, they are passed in a \a syscall_args struct in the order:
+ * uaddr, futex_op, val, timeout (or val2), uaddr2, val3.
+ *
+ * Supported operations are FUTEX_WAIT, FUTEX_WAKE, FUTEX_REQUEUE,
+ * FUTEX_CMP_REQUEUE, FUTEX_WAKE_OP, FUTEX_WAIT_BITSET and FUTEX_WAKE_BITSET,
+ * optionally ORed with FUTEX_PRIVATE_FLAG and FUTEX_CLOCK_REALTIME.
+ *
+ * @param   __args  packed syscall arguments (see syscall.h)
+ *
+ * @return  zero or a positive count on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/futex.2.html
+ */
+long syscall_futex(struct syscall_args *__args);
+
+#endif      /* __KERNEL_FUTEX_H__ */
@@ -0,0 +1,254 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: hrtimer.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file hrtimer.h
+ *
+ *  Functions and macros for working with high-resolution kernel timers.
+ */
+
+#ifndef __HRTIMER_H__
+#define __HRTIMER_H__
+
+#include <stdint.h>
+#include <kernel/smp.h>
+
+/**
+ * \def HRTIMER_MIN_DELTA
+ *
+ * The shortest interval (in nanoseconds) we program the local timer for.
+ * Timers that expire sooner than this are run on the next interrupt.
+ */
+#define HRTIMER_MIN_DELTA           2000
+
+/**
+ * \def HRTIMER_TSC_SHIFT
+ *
+ * Precision of the fixed-point multiplier used to convert TSC cycles to
+ * nanoseconds (and nanoseconds to local APIC timer counts).
+ */
+#define HRTIMER_TSC_SHIFT           26
+
+/* values returned by timer callbacks */
+#define HRTIMER_NORESTART           0
+#define HRTIMER_RESTART             1
+
+
+/**
+ * @struct hrtimer_t
+ * @brief The hrtimer_t structure.
+ *
+ * A structure to represent a high-resolution timer. Pending timers are kept
+ * in a per-cpu pairing heap, ordered by expiry time. The callback runs in
+ * interrupt context on the cpu the timer was started on, and can re-arm the
+ * timer by updating its expiry time (e.g. with hrtimer_forward()) and
+ * returning HRTIMER_RESTART.
+ */
+struct hrtimer_t
+{
+    unsigned long long expires;         /**< expiry time in nanoseconds */
+    int (*func)(struct hrtimer_t *);    /**< timer callback */
+    void *arg;                          /**< callback argument */
+    struct hrtimer_t *child,            /**< first child in heap */
+                     *sibling,          /**< next sibling in heap */
+                     *prev;             /**< previous sibling, or parent if
+                                             this is the first child */
+    volatile int queued;                /**< non-zero if timer is pending */
+    volatile int cpu;                   /**< cpu of the queue holding this
+                                             timer */
+};
+
+
+/**
+ * @struct hrtimer_cpu_t
+ * @brief The hrtimer_cpu_t structure.
+ *
+ * A structure to represent a cpu's queue of pending timers.
+ */
+struct hrtimer_cpu_t
+{
+    volatile int holding_cpu;           /**< cpu holding the lock, -1 if
+                                             unlocked */
+    struct hrtimer_t *root;             /**< timer that expires first */
+    struct hrtimer_t *volatile running; /**< timer whose callback is
+                                             running */
+    unsigned long long next_event;      /**< when the local timer fires */
+    unsigned long nr_events;            /**< local timer interrupts */
+    unsigned long nr_expired;           /**< timer callbacks run */
+};
+
+
+/**
+ * @var hrtimer_hres_active
+ * @brief high resolution mode flag.
+ *
+ * Non-zero if timers are run from one-shot local APIC timer interrupts.
+ * If zero, timers are run from the periodic timer interrupt, and have
+ * tick resolution.
+ */
+extern volatile int hrtimer_hres_active;
+
+/**
+ * @var hrtimer_tsc_invariant
+ * @brief invariant TSC flag.
+ *
+ * Non-zero if the TSC runs at a constant rate in all power states, which
+ * makes it safe for userspace to read the time from it (see vdso.h).
+ */
+extern int hrtimer_tsc_invariant;
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Initialise timer queues.
+ *
+ * Initialise the per-cpu timer queues. Called once during boot, before the
+ * timer interrupt is enabled. Until hrtimer_init_clock() is called, timers
+ * have tick resolution.
+ *
+ * @return  nothing.
+ */
+void hrtimer_init(void);
+
+/**
+ * @brief Initialise high resolution mode.
+ *
+ * Set up the clock we measure time with, and switch to high resolution
+ * mode if we can. Called once during boot, after the local APIC timer (if
+ * there is one) has been calibrated.
+ *
+ * @return  nothing.
+ */
+void hrtimer_init_clock(void);
+
+/**
+ * @brief Get the TSC clocksource parameters.
+ *
+ * The time returned by hrtimer_now() is
+ * offset + (((rdtsc() - base) * mult) >> HRTIMER_TSC_SHIFT).
+ *
+ * @param   base        TSC reading at time \a offset is returned here
+ * @param   offset      time (in nanoseconds) at \a base is returned here
+ * @param   mult        cycles to nanoseconds multiplier is returned here
+ *
+ * @return  1 if we are using the TSC as our clock, 0 if not.
+ */
+int hrtimer_clocksource(unsigned long long *base, unsigned long long *offset,
+                        unsigned long long *mult);
+
+/**
+ * @brief Switch this cpu to one-shot mode.
+ *
+ * Called on each cpu from its timer interrupt handler the first time it
+ * runs. If high resolution mode is active, the cpu's local APIC timer is
+ * switched from periodic to one-shot mode.
+ *
+ * @param   vector      the local APIC timer's interrupt vector
+ *
+ * @return  nothing.
+ */
+void hrtimer_init_cpu(int vector);
+
+/**
+ * @brief Get current time.
+ *
+ * @return  nanoseconds since boot (on the clock all timers use).
+ */
+unsigned long long hrtimer_now(void);
+
+/**
+ * @brief Initialise a timer.
+ *
+ * @param   timer       timer to initialise
+ * @param   func        timer callback
+ * @param   arg         callback argument
+ *
+ * @return  nothing.
+ */
+void hrtimer_setup(struct hrtimer_t *timer,
+                   int (*func)(struct hrtimer_t *), void *arg);
+
+/**
+ * @brief Start a timer.
+ *
+ * Queue the timer on the current cpu to expire at the given time. If the
+ * timer is already pending, it is moved to its new expiry time.
+ *
+ * @param   timer       timer to start
+ * @param   expires     absolute expiry time (see hrtimer_now())
+ *
+ * @return  nothing.
+ */
+void hrtimer_start(struct hrtimer_t *timer, unsigned long long expires);
+
+/**
+ * @brief Cancel a timer.
+ *
+ * Remove the timer from its queue. If its callback is running on another
+ * cpu, wait for it to finish, and remove the timer again if the callback
+ * restarted it. Once this function returns, the timer is neither queued
+ * nor running, and can be freed. This function must not be called from
+ * the timer's own callback.
+ *
+ * @param   timer       timer to cancel
+ *
+ * @return  1 if the timer was pending, 0 otherwise.
+ */
+int hrtimer_cancel(struct hrtimer_t *timer);
+
+/**
+ * @brief Forward a timer.
+ *
+ * Move the timer's expiry time forward by whole intervals, until it is in
+ * the future. Used by periodic timers to re-arm themselves without drift.
+ *
+ * @param   timer       timer to forward
+ * @param   now         current time
+ * @param   interval    timer period in nanoseconds
+ *
+ * @return  the number of intervals the timer was moved by.
+ */
+unsigned long hrtimer_forward(struct hrtimer_t *timer, unsigned long long now,
+                              unsigned long long interval);
+
+/**
+ * @brief Get the next timer event.
+ *
+ * @return  expiry time of the first pending timer on this cpu, or ~0ULL if
+ *          there is none.
+ */
+unsigned long long hrtimer_next_event(void);
+
+/**
+ * @brief Handle a timer interrupt.
+ *
+ * Run the callbacks of expired timers on this cpu, and program the local
+ * timer for the next one. Called from the timer interrupt handlers with
+ * interrupts disabled.
+ *
+ * @return  nothing.
+ */
+void hrtimer_interrupt(void);
+
+#endif      /* __HRTIMER_H__ */
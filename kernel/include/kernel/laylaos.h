@@ -36,7 +36,7 @@
 #define STATIC_INLINE           static inline __attribute__((always_inline))
 
 // define some system-wide upper limits
-#define MAX_NR_TASKS            4096
+#define MAX_NR_TASKS            8192    // limited by procfs inode numbers
 //#define MAX_NR_DISK_BUFFERS     1024
 
 // for debugging
@@ -28,20 +28,62 @@
 #ifndef NET_TIMER_H
 #define NET_TIMER_H
 
+#include <stdint.h>
+#include <kernel/mutex.h>
+
+/*
+ * Network timers are kept in per-cpu hierarchical timing wheels with a
+ * resolution of 1 millisecond. The first level has NETTIMER_TVR_SIZE slots
+ * of 1ms each. Each of the other NETTIMER_LEVELS - 1 levels has
+ * NETTIMER_TVN_SIZE slots, each covering a whole round of the level below.
+ * Timers are cascaded down a level when the level below wraps around.
+ */
+#define NETTIMER_TVR_BITS       8
+#define NETTIMER_TVN_BITS       6
+#define NETTIMER_TVR_SIZE       (1 << NETTIMER_TVR_BITS)
+#define NETTIMER_TVN_SIZE       (1 << NETTIMER_TVN_BITS)
+#define NETTIMER_TVR_MASK       (NETTIMER_TVR_SIZE - 1)
+#define NETTIMER_TVN_MASK       (NETTIMER_TVN_SIZE - 1)
+#define NETTIMER_LEVELS         5
+#define NETTIMER_SLOTS          (NETTIMER_TVR_SIZE + \
+                                 ((NETTIMER_LEVELS - 1) * NETTIMER_TVN_SIZE))
+
+/* the longest timeout we support (about 49 days) */
+#define NETTIMER_MAX_MSECS      0xFFFFFFFFULL
+
+
 struct nettimer_t
 {
-    int refs;
-    int cancelled;
-    unsigned long long expires;
+    int refs;                   /* references held by the timer's owner */
+    int cancelled;              /* set when the timer fires or is released */
+    int running;                /* handler is running */
+    int cpu;                    /* wheel the timer is on */
+    int slot;                   /* wheel slot, -1 if not queued */
+    unsigned long long expires; /* expiry time in ms (see nettimer_now()) */
     void (*handler)(void *);
     void *arg;
-    struct nettimer_t *next;
+    struct nettimer_t *next,    /* next timer in slot */
+                      **pprev;  /* pointer to us in the previous timer (or
+                                   the slot head) */
+};
+
+
+struct nettimer_wheel_t
+{
+    volatile struct kernel_mutex_t lock;
+    unsigned long long clk;     /* next millisecond to process */
+    int count;                  /* queued timers */
+    int level_count[NETTIMER_LEVELS];   /* queued timers per level */
+    uint32_t bitmap[NETTIMER_TVR_SIZE / 32];    /* non-empty first level
+                                                   slots */
+    struct nettimer_t *slots[NETTIMER_SLOTS];
 };
 
 
 void nettimer_init(void);
-struct nettimer_t *nettimer_add(uint32_t expire, void (*handler)(void *), void *arg);
-void nettimer_oneshot(uint32_t expire, void (*handler)(void *), void *arg);
+unsigned long long nettimer_now(void);
+struct nettimer_t *nettimer_add(uint32_t msecs, void (*handler)(void *), void *arg);
+void nettimer_oneshot(uint32_t msecs, void (*handler)(void *), void *arg);
 void nettimer_release(struct nettimer_t *t);
 
 #endif      /* NET_TIMER_H */
@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <kernel/laylaos.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
 
 #define ETHER_HLEN              14
 #define IPv4_HLEN               20
@@ -41,6 +42,13 @@
 #define PACKET_SIZE_TCP(s)      (ETHER_HLEN + IPv4_HLEN + TCP_HLEN + (s))
 #define PACKET_SIZE_UDP(s)      (ETHER_HLEN + IPv4_HLEN + UDP_HLEN + (s))
 
+/*
+ * Packets (header and data) up to these sizes come from the packet slab
+ * caches. Bigger packets are allocated on the kernel heap.
+ */
+#define PACKET_CACHE_SMALL_SIZE 256
+#define PACKET_CACHE_LARGE_SIZE 2048
+
 #define PACKET_FLAG_BROADCAST   0x01
 #define PACKET_FLAG_HDRINCLUDED 0x02    /* for RAW sockets */
 
@@ -61,10 +69,40 @@ struct packet_t
     uint32_t seq, end_seq;      /**< Starting and ending sequence numbers */
     struct netif_t *ifp;        /**< network interface */
     void (*free_packet)(struct packet_t *p);    /**< free function */
+    struct kmem_cache_t *cache; /**< slab cache, NULL if on the heap */
     struct packet_t *next;      /**< next packet buffer */
 };
 
 
+extern struct kmem_cache_t *small_packet_cache;
+extern struct kmem_cache_t *large_packet_cache;
+
+
+/*
+ * Allocate memory for a packet of the given total size, from the smallest
+ * packet cache that fits it, or the kernel heap.
+ */
+STATIC_INLINE struct packet_t *__alloc_packet_mem(size_t tlen,
+                                                  struct kmem_cache_t **cache)
+{
+    if(tlen <= PACKET_CACHE_SMALL_SIZE && small_packet_cache)
+    {
+        *cache = small_packet_cache;
+    }
+    else if(tlen <= PACKET_CACHE_LARGE_SIZE && large_packet_cache)
+    {
+        *cache = large_packet_cache;
+    }
+    else
+    {
+        *cache = NULL;
+        return kmalloc(tlen);
+    }
+
+    return kmem_cache_alloc(*cache);
+}
+
+
 /**
  * @brief Allocate packet.
  *
@@ -77,13 +115,15 @@ struct packet_t
 STATIC_INLINE struct packet_t *alloc_packet(size_t len)
 {
     struct packet_t *p;
+    struct kmem_cache_t *cache;
 
-    if(!(p = kmalloc(sizeof(struct packet_t) + len)))
+    if(!(p = __alloc_packet_mem(sizeof(struct packet_t) + len, &cache)))
     {
         return NULL;
     }
 
     A_memset(p, 0, sizeof(struct packet_t) + len);
+    p->cache = cache;
     p->data = ((uint8_t *)p + sizeof(struct packet_t));
     p->head = p->data;
     p->end = p->data + len;
@@ -106,9 +146,10 @@ STATIC_INLINE struct packet_t *alloc_packet(size_t len)
 STATIC_INLINE struct packet_t *dup_packet(struct packet_t *p)
 {
     struct packet_t *p2;
+    struct kmem_cache_t *cache;
     size_t tlen = p->end - (uint8_t *)p;
 
-    if(!(p2 = kmalloc(tlen)))
+    if(!(p2 = __alloc_packet_mem(tlen, &cache)))
     {
         return NULL;
     }
@@ -120,6 +161,7 @@ STATIC_INLINE struct packet_t *dup_packet(struct packet_t *p)
     p2->refs = 1;
     p2->next = NULL;
     p2->free_packet = NULL;
+    p2->cache = cache;
 
     return p2;
 }
@@ -150,6 +192,10 @@ STATIC_INLINE void free_packet(struct packet_t *p)
         {
             p->free_packet(p);
         }
+        else if(p->cache)
+        {
+            kmem_cache_free(p->cache, p);
+        }
         else
         {
             kfree(p);
@@ -121,6 +121,17 @@ struct socket_t
 #endif
 
     struct socket_t *next;          /**< Pointer to next socket */
+    struct socket_t **pprev;        /**< Pointer to previous socket's next */
+
+    /* demultiplexing hash tables (AF_INET sockets only) */
+    struct socket_t *anext;         /**< Next socket in the all-sockets hash */
+    struct socket_t *hnext;         /**< Next socket in the connected or
+                                         listening hash */
+    struct socket_t **hpprev;       /**< Pointer to previous hnext */
+    struct socket_t *bnext;         /**< Next socket in the bound port hash */
+    struct socket_t **bpprev;       /**< Pointer to previous bnext */
+    struct sock_hash_bucket_t *hbucket; /**< Connected or listening hash 
+                                             bucket we are on */
 
     struct socket_t *pairedsock;    /**< Pointer to paired socket */
 
@@ -168,6 +179,32 @@ struct sockops_t
 };
 
 
+/**
+ * @struct sock_hash_bucket_t
+ * @brief The sock_hash_bucket_t structure.
+ *
+ * A bucket in one of the socket demultiplexing hash tables.
+ */
+struct sock_hash_bucket_t
+{
+    struct socket_t *head;              /**< First socket in the bucket */
+    volatile struct kernel_mutex_t lock;    /**< Bucket lock */
+};
+
+/*
+ * Sizes of the socket hash tables (must be powers of 2).
+ *
+ * Connected sockets are hashed by (proto, remote addr, remote port,
+ * local port), sockets with no remote address (listening and unconnected
+ * UDP sockets) by (proto, local port), and all sockets with a local port
+ * by (proto, local port) for bind() conflict checks.
+ */
+#define SOCK_EHASH_SIZE         4096
+#define SOCK_LHASH_SIZE         256
+#define SOCK_BHASH_SIZE         256
+#define SOCK_AHASH_SIZE         1024
+
+
 /*******************************************
  * External definitions (socket.c)
  *******************************************/
@@ -201,7 +238,10 @@ void socket_delete(struct socket_t *so, uint32_t expiry);
 void sock_connected(struct socket_t *so);
 
 struct socket_t *sock_find(struct socket_t *find);
-struct socket_t *sock_lookup(uint16_t proto, uint16_t remoteport, uint16_t localport);
+struct socket_t *sock_lookup(uint16_t proto, 
+                             uint32_t remoteaddr, uint16_t remoteport,
+                             uint32_t localaddr, uint16_t localport);
+void sock_rehash(struct socket_t *so);
 
 void socket_copy_remoteaddr(struct socket_t *so, struct msghdr *msg);
 
@@ -31,6 +31,7 @@
 #include <netinet/tcp.h>
 #include <kernel/net/socket.h>
 #include <kernel/net/netif.h>
+#include <kernel/net/tcp_cong.h>
 
 // Length of the TCP header, excluding options
 #define TCP_HLEN                20
@@ -56,11 +57,29 @@
 #define TCPSTATE_LAST_ACK       10
 #define TCPSTATE_TIME_WAIT      11
 
-#define TCP_SYN_BACKOFF         500
+#define TCP_SYN_BACKOFF         5000                        /* msecs */
 #define TCP_CONN_RETRIES        3
 
-#define TCP_2MSL_TICKS          (PIT_FREQUENCY * 60 * 2)    /* 2 mins */
-#define TCP_USER_TIMEOUT_TICKS  (PIT_FREQUENCY * 60 * 3)    /* 3 mins */
+#define TCP_2MSL_MSECS          (1000 * 60 * 2)             /* 2 mins */
+#define TCP_USER_TIMEOUT_MSECS  (1000 * 60 * 3)             /* 3 mins */
+
+// Congestion control states
+#define TCPCA_OPEN              0   /* normal operation */
+#define TCPCA_RECOVERY          1   /* fast recovery after 3 dupacks */
+#define TCPCA_LOSS              2   /* recovery after a retransmit timeout */
+
+// Duplicate ACKs needed to trigger fast retransmit
+#define TCP_DUPTHRESH           3
+
+// Flags of segments on the retransmission queue
+#define TCP_PKT_SACKED          0x100   /* selectively acknowledged */
+#define TCP_PKT_RETRANS         0x200   /* retransmitted during recovery */
+
+// Modular sequence number comparisons
+#define SEQ_LT(a, b)            ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b)           ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)            ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b)           ((int32_t)((a) - (b)) >= 0)
 
 #define TCP_STATE(so)           ((struct socket_tcp_t *)so)->tcpstate
 
@@ -141,8 +160,8 @@ struct socket_tcp_t
     uint8_t flags;
     uint8_t tsopt;
     uint8_t backoff;
-    int32_t srtt, rttvar;
-    uint32_t rto;
+    int32_t srtt, rttvar;       /* msecs */
+    uint32_t rto;               /* msecs */
 
     struct nettimer_t *retransmit;
     struct nettimer_t *delack;
@@ -151,10 +170,31 @@ struct socket_tcp_t
 
     uint8_t delacks;
     uint16_t rmss, smss;
-    uint16_t cwnd;
-    uint32_t inflight;
-
-    unsigned long long linger_ticks;
+    uint32_t inflight;          /* segments sent but not acknowledged */
+    struct packet_t *snd_head;  /* first segment on outq not sent yet */
+
+    /* congestion control */
+    uint32_t cwnd;              /* congestion window (bytes) */
+    uint32_t ssthresh;          /* slow start threshold (bytes) */
+    uint8_t ca_state;           /* TCPCA_* state */
+    uint8_t dupacks;            /* consecutive duplicate ACKs */
+    uint32_t recover;           /* snd_nxt when recovery started */
+    uint32_t high_sacked;       /* highest SACKed sequence number */
+    uint32_t sacked_bytes;      /* SACKed bytes on the outq */
+    struct tcp_cong_ops_t *cong;    /* congestion control algorithm */
+    uint64_t cong_priv[TCP_CONG_PRIV_SIZE];   /* algorithm private data */
+
+    /* RTT sampling (one segment timed at a time) */
+    uint32_t rtt_seq;           /* ACK that ends the current sample */
+    unsigned long long rtt_start;   /* when the timed segment was sent, or 0 */
+    int32_t rtt_min;            /* lowest RTT seen (msecs) */
+
+    /* statistics */
+    uint32_t retrans;           /* retransmitted segments */
+    uint32_t fast_retrans;      /* fast retransmits / recovery episodes */
+    uint32_t timeouts;          /* retransmit timeouts */
+
+    unsigned long long linger_msecs;
 
     uint8_t sackok, sacks_allowed, sacklen;
     struct tcp_sack_block_t sacks[4];
@@ -0,0 +1,163 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: tcp_cong.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file tcp_cong.h
+ *
+ *  Functions and structure definitions for TCP congestion control
+ *  algorithms.
+ */
+
+#ifndef NET_TCP_CONG_H
+#define NET_TCP_CONG_H
+
+#include <stdint.h>
+
+#ifndef TCP_CONGESTION
+#define TCP_CONGESTION          13
+#endif
+
+#ifndef TCP_CA_NAME_MAX
+#define TCP_CA_NAME_MAX         16
+#endif
+
+/**
+ * \def TCP_CONG_PRIV_SIZE
+ *
+ * Size (in 64-bit words) of the per-socket private area available to
+ * congestion control algorithms.
+ */
+#define TCP_CONG_PRIV_SIZE      8
+
+/**
+ * \def TCP_CONG_DEFAULT
+ *
+ * Name of the algorithm given to new sockets.
+ */
+#define TCP_CONG_DEFAULT        "cubic"
+
+#define TCP_CONG_PRIV(tsock)    ((void *)(tsock)->cong_priv)
+
+struct socket_tcp_t;
+
+
+/**
+ * @struct tcp_cong_ops_t
+ * @brief The tcp_cong_ops_t structure.
+ *
+ * A congestion control algorithm. The TCP layer handles slow start
+ * thresholds, fast retransmit and loss recovery, and calls the algorithm
+ * to decide how the congestion window grows and how far it is cut on loss.
+ * All functions are called with the socket locked.
+ */
+struct tcp_cong_ops_t
+{
+    char name[TCP_CA_NAME_MAX];     /**< algorithm name */
+
+    /** initialise private data (optional) */
+    void (*init)(struct socket_tcp_t *tsock);
+
+    /** return the slow start threshold to use after a loss */
+    uint32_t (*ssthresh)(struct socket_tcp_t *tsock);
+
+    /** grow cwnd after an ACK of new data outside of recovery */
+    void (*cong_avoid)(struct socket_tcp_t *tsock, uint32_t acked);
+
+    /** called for each new RTT sample in msecs (optional) */
+    void (*rtt_sample)(struct socket_tcp_t *tsock, int32_t rtt);
+
+    /** called when the congestion state changes (optional) */
+    void (*set_state)(struct socket_tcp_t *tsock, int newstate);
+
+    struct tcp_cong_ops_t *next;    /**< next registered algorithm */
+};
+
+
+/**************************************
+ * Functions defined in network/tcp_cong.c
+ **************************************/
+
+/**
+ * @brief Register a congestion control algorithm.
+ *
+ * @param   ops     algorithm to register
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long tcp_cong_register(struct tcp_cong_ops_t *ops);
+
+/**
+ * @brief Find a congestion control algorithm by name.
+ *
+ * @param   name    algorithm name
+ *
+ * @return  the algorithm, or NULL if not found.
+ */
+struct tcp_cong_ops_t *tcp_cong_find(char *name);
+
+/**
+ * @brief Select the congestion control algorithm of a socket.
+ *
+ * @param   tsock   TCP socket
+ * @param   name    algorithm name (NULL for the default)
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long tcp_cong_select(struct socket_tcp_t *tsock, char *name);
+
+/**
+ * @brief Reset a socket's congestion window.
+ *
+ * Set the initial window (RFC 6928) once the connection is established
+ * and the sender's MSS is known.
+ *
+ * @param   tsock   TCP socket
+ *
+ * @return  nothing.
+ */
+void tcp_cong_init_window(struct socket_tcp_t *tsock);
+
+/**
+ * @brief Standard slow start.
+ *
+ * Grow cwnd by the number of bytes acknowledged, up to 2 segments per
+ * ACK (RFC 3465) and no further than ssthresh.
+ *
+ * @param   tsock   TCP socket
+ * @param   acked   bytes newly acknowledged
+ *
+ * @return  bytes of the ACK that were not used by slow start.
+ */
+uint32_t tcp_slow_start(struct socket_tcp_t *tsock, uint32_t acked);
+
+/**
+ * @brief Standard Reno slow start threshold.
+ *
+ * @param   tsock   TCP socket
+ *
+ * @return  half the flight size, but no less than 2 segments.
+ */
+uint32_t tcp_reno_ssthresh(struct socket_tcp_t *tsock);
+
+extern struct tcp_cong_ops_t tcp_newreno;
+extern struct tcp_cong_ops_t tcp_cubic;
+
+#endif      /* NET_TCP_CONG_H */
@@ -29,6 +29,66 @@
 #define UNIXSOCK_H
 
 #include <kernel/net/netif.h>
+#include <kernel/net/socket.h>
+
+/**
+ * \def UNIX_STREAM_BUFSZ
+ *
+ * Size of the receive ring of a Unix stream socket (must be a power of 2).
+ * The ring is allocated on the first write to the socket.
+ */
+#define UNIX_STREAM_BUFSZ       (64 * 1024)
+
+/**
+ * \def UNIX_MAX_RIGHTS
+ *
+ * Maximum number of file descriptors that can be passed in one message.
+ */
+#define UNIX_MAX_RIGHTS         64
+
+
+/**
+ * @struct unix_rights_t
+ * @brief The unix_rights_t structure.
+ *
+ * Files passed in an SCM_RIGHTS control message, waiting for the receiver
+ * to read the data they were sent with.
+ */
+struct unix_rights_t
+{
+    size_t pos;                 /**< stream position of the first byte of
+                                     data sent with the files */
+    int nfds;                   /**< count of files */
+    struct unix_rights_t *next; /**< next set of files in the queue */
+    struct file_t *files[];     /**< the files (each holds a reference) */
+};
+
+
+/**
+ * @struct socket_unix_t
+ * @brief The socket_unix_t structure.
+ *
+ * A structure to represent a Unix socket. Data written to a stream socket
+ * is copied directly to the receive ring of the peer socket. Datagram
+ * sockets use the packet input queue of the socket struct.
+ */
+struct socket_unix_t
+{
+    struct socket_t sock;       /**< the socket (must be the first field) */
+
+    unsigned char *buf;         /**< receive ring */
+    size_t head;                /**< offset of the first unread byte */
+    size_t count;               /**< count of unread bytes */
+    size_t rpos;                /**< stream position of the first unread
+                                     byte */
+
+    struct unix_rights_t *rights_head,  /**< first set of passed files */
+                         *rights_tail;  /**< last set of passed files */
+
+    int rd_waiting;             /**< wait channel for blocked readers */
+    int wr_waiting;             /**< wait channel for writers blocked on
+                                     a full ring */
+};
 
 // externs defined in unix.c
 extern struct sockops_t unix_sockops;
@@ -43,4 +103,8 @@ long socket_unix_bind(struct socket_t *so,
 long socket_unix_connect(struct socket_t *so, 
                          struct sockaddr *name, socklen_t namelen);
 
+void socket_unix_wakeup(struct socket_t *so);
+
+void socket_unix_cleanup(struct socket_t *so);
+
 #endif      /* UNIXSOCK_H */
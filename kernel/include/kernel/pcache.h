@@ -44,6 +44,14 @@
 #define NODEV                   (dev_t)(-1)
 #endif
 
+/**
+ * \def PCACHE_MAX_REFS
+ *
+ * Maximum share count of a cached page's frame before dup_cached_page_ref()
+ * refuses to take another reference (the count is 8 bits wide).
+ */
+#define PCACHE_MAX_REFS         240
+
 
 /***********************
  * Function prototypes
@@ -96,18 +104,69 @@ void release_cached_page(struct cached_page_t *pcache);
 struct cached_page_t *get_cached_page(struct fs_node_t *node, 
                                       off_t offset, int flags);
 
+/**
+ * @brief Wakeup cached page waiters.
+ *
+ * Similar to release_cached_page(), except the caller's reference to the
+ * page's physical frame is not dropped. Used when the frame is kept mapped
+ * in a task's address space.
+ *
+ * @param   pcache      page to release
+ *
+ * @return  nothing.
+ */
+void wakeup_cached_page_waiters(struct cached_page_t *pcache);
+
+/**
+ * @brief Get a reference to a cached page.
+ *
+ * Same as get_cached_page(), except the page is released before returning,
+ * while the caller keeps a reference to the page's physical frame. This
+ * stops the page from being evicted while it is being used outside of the
+ * page cache (e.g. when it is spliced into a pipe). The reference must be
+ * dropped by calling put_cached_page_ref().
+ *
+ * @param   node        file node
+ * @param   offset      offset in file (must be page-aligned)
+ *
+ * @return  referenced page on success, NULL on failure.
+ */
+struct cached_page_t *get_cached_page_ref(struct fs_node_t *node,
+                                          off_t offset);
+
+/**
+ * @brief Duplicate a reference to a cached page.
+ *
+ * Take another reference to a page the caller already holds a reference to.
+ *
+ * @param   pcache      referenced page
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+int dup_cached_page_ref(struct cached_page_t *pcache);
+
+/**
+ * @brief Drop a reference to a cached page.
+ *
+ * Drop a reference taken by get_cached_page_ref() or dup_cached_page_ref().
+ *
+ * @param   pcache      referenced page
+ *
+ * @return  nothing.
+ */
+void put_cached_page_ref(struct cached_page_t *pcache);
+
 /**
  * @brief Free cached page.
  *
- * Release the cached page identified with the given \a pkey and free its 
+ * Remove the given cached page from the page cache and free its 
  * memory page.
  *
- * @param   pkey        hash key
  * @param   pcache      page to release
  *
  * @return  nothing.
  */
-void free_cached_page(struct pcache_key_t *pkey, struct cached_page_t *pcache);
+void free_cached_page(struct cached_page_t *pcache);
 
 /**
  * @brief Flush cached pages.
@@ -236,4 +295,36 @@ size_t get_busy_cached_block_count(void);
  */
 long node_has_cached_pages(struct fs_node_t *node);
 
+/**
+ * @brief Read pages ahead.
+ *
+ * Read at most \a count pages of the given file into the page cache,
+ * starting at the given \a offset. Pages that are already cached are
+ * skipped, and runs of missing pages are read with as few disk requests
+ * as possible (up to PCACHE_READAHEAD_MAX pages at a time). The pages are
+ * not referenced on return.
+ *
+ * @param   node        file node
+ * @param   offset      offset in file
+ * @param   count       number of pages to read
+ *
+ * @return  number of pages read into the cache.
+ */
+long readahead_cached_pages(struct fs_node_t *node, off_t offset, size_t count);
+
+/**
+ * @brief Drop cached node pages.
+ *
+ * Remove the clean, unreferenced pages of the given \a node that fall
+ * between \a start (inclusive) and \a end (exclusive) from the page cache.
+ * Pages that are in use or dirty are left alone.
+ *
+ * @param   node        file node
+ * @param   start       start offset in file
+ * @param   end         end offset in file
+ *
+ * @return  nothing.
+ */
+void drop_cached_node_pages(struct fs_node_t *node, off_t start, off_t end);
+
 #endif      /* __KERNEL_PCACHE_H__ */
@@ -44,6 +44,46 @@ struct selinfo
 };
 
 
+/**
+ * @struct selhook_t
+ * @brief The selhook_t structure.
+ *
+ * A structure used to get a callback (instead of a task wakeup) when a
+ * selectable event occurs on a select channel. Unlike waiting tasks, hooks
+ * stay on the channel until they are removed by selhook_remove().
+ */
+struct selhook_t
+{
+    struct selinfo *sip;        /**< the channel we are hooked on */
+    int (*func)(struct selhook_t *);    /**< called by selwakeup(), should
+                                             return the number of tasks
+                                             it woke up */
+
+#define SELHOOK_EXCLUSIVE       0x01
+    int flags;                  /**< if SELHOOK_EXCLUSIVE is set, only one
+                                     exclusive hook that wakes up a task is
+                                     called on each wakeup */
+    struct selhook_t *next,     /**< next hook on the channel */
+                     **pprev;   /**< pointer to us in the previous hook */
+};
+
+
+/**
+ * @struct selrec_t
+ * @brief The selrec_t structure.
+ *
+ * If a task's selrec field points to one of these structures, selrecord()
+ * passes the select channels to the record function instead of adding the
+ * task to the channels' waiters. This is used by epoll to find out which
+ * channels a file's select or poll function waits on.
+ */
+struct selrec_t
+{
+    void (*record)(struct selrec_t *, struct selinfo *);    /**< record
+                                                                 function */
+};
+
+
 /***********************
  * Function prototypes
  ***********************/
@@ -107,6 +147,31 @@ void selrecord(struct selinfo *sip);
  */
 void selwakeup(struct selinfo *sip);
 
+/**
+ * @brief Add a select hook.
+ *
+ * Add the given hook to the select channel. The hook's func and flags
+ * fields should be set by the caller.
+ *
+ * @param   sip     a select channel struct
+ * @param   hook    the hook to add
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+int selhook_add(struct selinfo *sip, struct selhook_t *hook);
+
+/**
+ * @brief Remove a select hook.
+ *
+ * Remove the given hook from its select channel. Once this function
+ * returns, the hook's func will not be called again.
+ *
+ * @param   hook    the hook to remove
+ *
+ * @return  nothing.
+ */
+void selhook_remove(struct selhook_t *hook);
+
 //extern int ffs(int mask);
 
 #endif /* __SYS_SELECT_H__ */
@@ -0,0 +1,121 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: signalfd.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file signalfd.h
+ *
+ *  Functions and structure definitions for the kernel's signalfd
+ *  implementation.
+ */
+
+#ifndef __KERNEL_SIGNALFD_H__
+#define __KERNEL_SIGNALFD_H__
+
+#include <signal.h>
+#include <kernel/mutex.h>
+#include <kernel/vfs.h>
+
+
+/**
+ * @struct signalfd_t
+ * @brief The signalfd_t structure.
+ *
+ * A structure to represent a signalfd. Like on Linux, reading a signalfd
+ * returns the signals pending for the reading task, so the only state we
+ * keep is the signal mask. Readers sleep (and pollers record) on the task's
+ * signalfd_sel channel, which add_task_signal() wakes up.
+ */
+struct signalfd_t
+{
+    sigset_t mask;                          /**< signals to accept */
+    volatile struct kernel_mutex_t lock;    /**< struct lock */
+};
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Notify signalfd readers.
+ *
+ * Called by add_task_signal() when a signal is added to a task that has
+ * used a signalfd. If called with interrupts disabled (e.g. from an IRQ
+ * handler), waking up the task's pollers is deferred until the task
+ * checks its pending signals.
+ *
+ * @param   task        the task that got a new signal
+ *
+ * @return  nothing.
+ */
+void signalfd_notify(struct task_t *task);
+
+/**
+ * @brief Run deferred signalfd notifications.
+ *
+ * Called from check_pending_signals() to wake up the current task's
+ * signalfd pollers if signalfd_notify() could not do it.
+ *
+ * @param   task        the current task
+ *
+ * @return  nothing.
+ */
+void signalfd_deferred_notify(struct task_t *task);
+
+/**
+ * @brief Close a signalfd.
+ *
+ * Free the signalfd referred to by the given node. Called on the last close
+ * of the signalfd file descriptor.
+ *
+ * @param   node        signalfd file node
+ *
+ * @return  nothing.
+ */
+void signalfd_close(struct fs_node_t *node);
+
+/**
+ * @brief Handler for syscall signalfd().
+ *
+ * @param   fd          -1 to create a new signalfd, or an existing
+ *                        signalfd whose mask is to be changed
+ * @param   mask        signals to accept
+ * @param   sizemask    size of the signal mask in bytes
+ *
+ * @return  file descriptor on success, -(errno) on failure.
+ */
+long syscall_signalfd(int fd, sigset_t *mask, size_t sizemask);
+
+/**
+ * @brief Handler for syscall signalfd4().
+ *
+ * @param   fd          -1 to create a new signalfd, or an existing
+ *                        signalfd whose mask is to be changed
+ * @param   mask        signals to accept
+ * @param   sizemask    size of the signal mask in bytes
+ * @param   flags       zero or a combination of SFD_CLOEXEC and
+ *                        SFD_NONBLOCK
+ *
+ * @return  file descriptor on success, -(errno) on failure.
+ */
+long syscall_signalfd4(int fd, sigset_t *mask, size_t sizemask, int flags);
+
+#endif      /* __KERNEL_SIGNALFD_H__ */
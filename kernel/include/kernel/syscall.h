@@ -746,6 +746,48 @@ long syscall_execveat(int dirfd, char *path,
                       char **argv, char **env, int flags);
 
 
+/**********************************
+ * Functions defined in fadvise.c
+ **********************************/
+
+/**
+ * @brief Handler for syscall readahead().
+ *
+ * Read the given range of a regular file into the page cache. The call
+ * returns after the pages have been read.
+ *
+ * @param   fd          file descriptor
+ * @param   offset      offset in file
+ * @param   count       number of bytes to read
+ *
+ * @return  zero on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/readahead.2.html
+ */
+long syscall_readahead(int fd, off_t offset, size_t count);
+
+/**
+ * @brief Handler for syscall fadvise64().
+ *
+ * Give advice on how the given range of a file is going to be accessed.
+ * POSIX_FADV_NORMAL, POSIX_FADV_RANDOM and POSIX_FADV_SEQUENTIAL change
+ * the file's readahead behaviour (for the whole file), POSIX_FADV_WILLNEED
+ * starts reading the range in the background, and POSIX_FADV_DONTNEED
+ * drops the range's clean pages from the page cache. A \a len of zero
+ * means up to the end of the file.
+ *
+ * @param   fd          file descriptor
+ * @param   offset      offset in file
+ * @param   len         length of range in bytes
+ * @param   advice      one of the POSIX_FADV_* values
+ *
+ * @return  zero on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/posix_fadvise.2.html
+ */
+long syscall_fadvise64(int fd, off_t offset, off_t len, int advice);
+
+
 /**********************************
  * Functions defined in flock.c
  **********************************/
@@ -1402,6 +1444,77 @@ long syscall_sched_get_priority_min(int policy);
 long syscall_sched_yield(void);
 
 
+/**********************************
+ * Functions defined in splice.c
+ **********************************/
+
+/**
+ * @brief Handler for syscall sendfile().
+ *
+ * Copy data from a regular file to another file, socket or pipe. The data
+ * is taken straight from the page cache, and pipes get references to the
+ * cached pages instead of copies.
+ *
+ * @param   out_fd      output file descriptor
+ * @param   in_fd       input file descriptor
+ * @param   offset      if not NULL, the offset to read from (updated on
+ *                        return), otherwise the file's position is used
+ * @param   count       number of bytes to copy
+ *
+ * @return  number of bytes copied on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/sendfile.2.html
+ */
+long syscall_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+
+/**
+ * @brief Handler for syscall splice().
+ *
+ * Move data between two file descriptors, one of which must be a pipe.
+ *
+ * @param   __args      packed syscall arguments (see syscall.h)
+ *
+ * @return  number of bytes moved on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/splice.2.html
+ */
+long syscall_splice(struct syscall_args *__args);
+
+/**
+ * @brief Handler for syscall tee().
+ *
+ * Duplicate data from one pipe to another, without consuming the input.
+ *
+ * @param   fd_in       input pipe
+ * @param   fd_out      output pipe
+ * @param   len         number of bytes to duplicate
+ * @param   flags       zero or a combination of SPLICE_F_* flags
+ *
+ * @return  number of bytes duplicated on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/tee.2.html
+ */
+long syscall_tee(int fd_in, int fd_out, size_t len, unsigned int flags);
+
+/**
+ * @brief Handler for syscall vmsplice().
+ *
+ * Copy user memory into a pipe (if \a fd is the writing end) or data from
+ * a pipe into user memory (if \a fd is the reading end).
+ *
+ * @param   fd          pipe file descriptor
+ * @param   iov         user buffers
+ * @param   nr_segs     count of buffers in \a iov
+ * @param   flags       zero or a combination of SPLICE_F_* flags
+ *
+ * @return  number of bytes copied on success, -(errno) on failure.
+ *
+ * @see     https://man7.org/linux/man-pages/man2/vmsplice.2.html
+ */
+long syscall_vmsplice(int fd, struct iovec *iov, unsigned long nr_segs,
+                      unsigned int flags);
+
+
 /**************************************
  * Functions defined in stat.c
  **************************************/
@@ -51,15 +51,87 @@
  * @struct task_queue_t
  * @brief The task_queue_t structure.
  *
- * A structure to represent a queue of tasks.
+ * A structure to represent a queue of tasks. Tasks are linked through their
+ * next and prev fields, and each queued task points back to its queue.
  */
 struct task_queue_t
 {
-    volatile struct task_t head;    /**< pointer to queue head */
-    int has_ready_tasks;   /**< non-zero if queue has ready-to-run tasks */
+    volatile struct task_t *head,   /**< first task in queue */
+                           *tail;   /**< last task in queue */
 };
 
 
+/**
+ * \def NR_QUEUE
+ *
+ * Number of ready queues per processor (one per priority level).
+ */
+#define NR_QUEUE                100
+
+
+/**
+ * @struct runqueue_t
+ * @brief The runqueue_t structure.
+ *
+ * A structure to represent a processor's run queues. Each processor has
+ * one ready queue per priority level, protected by the run queue's own lock.
+ * The running task stays on its processor's queue while it runs. Woken
+ * tasks go back to the queue of the processor they last ran on, and a
+ * processor that has nothing to run pulls a task from the busiest queue.
+ */
+struct runqueue_t
+{
+    volatile int holding_cpu;   /**< cpu holding the lock, -1 if unlocked */
+    int cpuid;                  /**< cpu this run queue belongs to */
+    struct task_queue_t queue[NR_QUEUE];    /**< ready queues */
+    int nr_user,                /**< queued SCHED_OTHER tasks */
+        nr_fifo,                /**< queued SCHED_FIFO tasks */
+        nr_rr;                  /**< queued SCHED_RR tasks */
+    unsigned long nr_switches;  /**< context switches on this cpu */
+    unsigned long nr_pulled;    /**< tasks this cpu stole from others */
+    unsigned long nr_pushed;    /**< tasks other cpus stole from this one */
+};
+
+
+/**
+ * \def WAIT_HASH_BITS
+ *
+ * Sleeping tasks are kept in a fixed table of (1 << WAIT_HASH_BITS) wait
+ * queues, hashed by wait channel.
+ */
+#define WAIT_HASH_BITS          7
+#define NR_WAIT_QUEUES          (1 << WAIT_HASH_BITS)
+
+
+/**
+ * @struct wait_queue_t
+ * @brief The wait_queue_t structure.
+ *
+ * A structure to represent a wait queue. Tasks sleeping on wait channels
+ * that hash to the same wait queue are kept in one FIFO list, in the order
+ * they went to sleep, protected by the wait queue's own lock.
+ */
+struct wait_queue_t
+{
+    volatile int holding_cpu;   /**< cpu holding the lock, -1 if unlocked */
+    struct task_queue_t queue;  /**< sleeping tasks */
+};
+
+/**
+ * \def runqueue_length
+ *
+ * Number of ready and running tasks on a run queue.
+ */
+#define runqueue_length(rq)     ((rq)->nr_user + (rq)->nr_fifo + (rq)->nr_rr)
+
+/**
+ * \def task_runqueue
+ *
+ * The run queue a task is on (or goes back to when it is woken up).
+ */
+#define task_runqueue(t)        (&runqueues[(t)->last_cpu])
+
+
 /*
  * Set/unset the close-on-exec flag for a given fd.
  * We do it this way so that if we change the implementation of the cloexec
@@ -67,17 +139,24 @@ struct task_queue_t
  */
 static inline void cloexec_set(volatile struct task_t *t, int fd)
 {
-    t->cloexec |= (1 << fd);
+    kernel_mutex_lock(&t->ofiles->mutex);
+    t->ofiles->cloexec_fds[fd / FD_BITS_PER_LONG] |=
+                                        (1UL << (fd % FD_BITS_PER_LONG));
+    kernel_mutex_unlock(&t->ofiles->mutex);
 }
 
 static inline void cloexec_clear(volatile struct task_t *t, int fd)
 {
-    t->cloexec &= ~(1 << fd);
+    kernel_mutex_lock(&t->ofiles->mutex);
+    t->ofiles->cloexec_fds[fd / FD_BITS_PER_LONG] &=
+                                        ~(1UL << (fd % FD_BITS_PER_LONG));
+    kernel_mutex_unlock(&t->ofiles->mutex);
 }
 
 static inline int is_cloexec(volatile struct task_t *t, int fd)
 {
-    return (t->cloexec & (1 << fd));
+    return !!(t->ofiles->cloexec_fds[fd / FD_BITS_PER_LONG] &
+                                        (1UL << (fd % FD_BITS_PER_LONG)));
 }
 
 
@@ -93,22 +172,34 @@ static inline int is_cloexec(volatile struct task_t *t, int fd)
 #define tgid(t)             ((t)->threads ? (t)->threads->tgid : (t)->pid)
 
 
-// a short-hand for all the code that traverses the master task table
-#define for_each_taskptr(t)                              \
-    volatile struct task_t **t;                          \
-    volatile struct task_t **lt = &task_table[NR_TASKS]; \
-    for(t = task_table; t < lt; t++)
+/*
+ * A short-hand for all the code that traverses the master task table.
+ * The table can be replaced by a bigger one at any time, so we read the
+ * size before the table pointer (the table is published before its size).
+ * Use (t - ft) to get the index of a task in the table.
+ */
+#define for_each_taskptr(t)                                             \
+    volatile struct task_t **t;                                         \
+    int nt = __atomic_load_n(&task_table_size, __ATOMIC_ACQUIRE);       \
+    volatile struct task_t **ft =                                       \
+        (volatile struct task_t **)__atomic_load_n(&task_table,         \
+                                                   __ATOMIC_ACQUIRE);   \
+    volatile struct task_t **lt = ft + nt;                              \
+    for(t = ft; t < lt; t++)
+
+#define pid_hashfn(pid)     ((pid) & (NR_PID_HASH - 1))
 
 
 //extern struct task_t *idle_task;    /**< pointer to the idle task (pid 0) */
 //extern struct task_t *cur_task;     /**< pointer to the current task */
 extern struct task_t *init_task;    /**< pointer to the init task (pid 1) */
 
-extern volatile struct task_t *task_table[];/**< the master task table */
-extern struct task_queue_t ready_queue[];   /**< pointers to the 
-                                                   ready-to-run queues */
-extern struct task_queue_t blocked_queue;   /**< pointer to the queue of 
-                                                   blocked tasks */
+extern volatile struct task_t **volatile task_table; /**< the master task
+                                                          table */
+extern volatile int task_table_size;        /**< task table slots */
+extern volatile struct task_t *pid_hash[];  /**< tasks hashed by pid */
+extern struct runqueue_t runqueues[];       /**< per-cpu run queues */
+extern struct wait_queue_t wait_queues[];   /**< hashed wait queues */
 extern struct task_queue_t zombie_queue;    /**< pointer to the queue of
                                                    zombie tasks */
 
@@ -272,6 +363,31 @@ struct task_t *task_alloc(void);
  */
 void task_free(volatile struct task_t *task);
 
+/**
+ * @brief Add a task to the pid hash.
+ *
+ * Called once the new task is fully set up, after which it can be found
+ * by get_task_by_id().
+ *
+ * @param   task            pointer to task
+ *
+ * @return  nothing.
+ */
+void hash_task(volatile struct task_t *task);
+
+/**
+ * @brief Change a task's pid.
+ *
+ * Used by execve() to give a thread the thread group id as its pid. The
+ * pid is only changed if it is not used by another task.
+ *
+ * @param   task            pointer to task
+ * @param   pid             the new pid
+ *
+ * @return  zero on success, -EEXIST if the pid is in use.
+ */
+long task_change_pid(volatile struct task_t *task, pid_t pid);
+
 /**
  * @brief Blocked task callback.
  *
@@ -290,6 +406,9 @@ void block_task_callback(void *arg);
  * Send the calling task to sleep until an event occurs, it is woken up by
  * a signal, or the given \a timeout (in ticks) expires.
  *
+ * The task sleeps on \a wait_channel, so it can be woken early by
+ * unblock_tasks() and friends.
+ *
  * @param   wait_channel    wait channel to sleep on
  * @param   timeout         timeout in ticks (if 0, task sleeps until a signal
  *                            is delivered or an I/O event occurs)
@@ -299,6 +418,46 @@ void block_task_callback(void *arg);
  */
 int block_task2(void *wait_channel, int timeout);
 
+/**
+ * @brief Block task with timeout and release lock.
+ *
+ * Same as block_task2(), except that the calling task is put on the wait
+ * queue before \a lock is released (see block_task_and_unlock()).
+ *
+ * @param   wait_channel    wait channel to sleep on
+ * @param   timeout         timeout in ticks (if 0, task sleeps until a signal
+ *                            is delivered or an I/O event occurs)
+ * @param   lock            lock held by the caller, released by this function
+ *
+ * @return  EWOULDBLOCK if \a timeout expired, EINTR if woken up by a signal,
+ *            zero if woken by some other event.
+ */
+int block_task2_and_unlock(void *wait_channel, int timeout,
+                           volatile struct kernel_mutex_t *lock);
+
+/**
+ * @brief Block task with timeout unless a condition is met.
+ *
+ * Same as block_task2(), except that \a done is called once the calling
+ * task is on the wait queue, and the task does not sleep if it returns
+ * non-zero. This lets callers that cannot hold a kernel mutex (e.g. when
+ * the wakeup comes from an IRQ handler) check their wakeup condition
+ * without losing a wakeup that comes in before they sleep. \a done is
+ * called with interrupts disabled and the wait queue locked, so it should
+ * only read the condition and return.
+ *
+ * @param   wait_channel    wait channel to sleep on
+ * @param   timeout         timeout in ticks (if 0, task sleeps until a signal
+ *                            is delivered or an I/O event occurs)
+ * @param   done            returns non-zero if there is no need to sleep
+ * @param   arg             argument passed to \a done
+ *
+ * @return  EWOULDBLOCK if \a timeout expired, EINTR if woken up by a signal,
+ *            zero if woken by some other event or \a done returned non-zero.
+ */
+int block_task2_unless(void *wait_channel, int timeout,
+                       int (*done)(void *), void *arg);
+
 /**
  * @brief Block task.
  *
@@ -312,10 +471,41 @@ int block_task2(void *wait_channel, int timeout);
  */
 int block_task(void *wait_channel, int interruptible);
 
+/**
+ * @brief Block task as an exclusive waiter.
+ *
+ * Same as block_task(), except that unblock_tasks() wakes only one exclusive
+ * waiter on \a wait_channel at a time. This avoids waking up a herd of tasks
+ * when only one of them can consume the event.
+ *
+ * @param   wait_channel    wait channel to sleep on
+ * @param   interruptible   non-zero for interruptible sleep
+ *
+ * @return  1 if interruptible sleep and woken by a signal, zero otherwise.
+ */
+int block_task_exclusive(void *wait_channel, int interruptible);
+
+/**
+ * @brief Block task and release lock.
+ *
+ * Same as block_task(), except that the calling task is put on the wait
+ * queue before \a lock is released. This allows callers to check a wakeup
+ * condition under \a lock without racing with the task that will wake them.
+ *
+ * @param   wait_channel    wait channel to sleep on
+ * @param   interruptible   non-zero for interruptible sleep
+ * @param   lock            lock held by the caller, released by this function
+ *
+ * @return  1 if interruptible sleep, zero otherwise.
+ */
+int block_task_and_unlock(void *wait_channel, int interruptible,
+                          volatile struct kernel_mutex_t *lock);
+
 /**
  * @brief Unblock tasks.
  *
- * Unblock all the tasks sleeping on the given \a wait_channel.
+ * Unblock all the tasks sleeping on the given \a wait_channel, except for
+ * exclusive waiters, of which only the first one is woken up.
  *
  * @param   wait_channel    wait channel
  *
@@ -323,6 +513,30 @@ int block_task(void *wait_channel, int interruptible);
  */
 void unblock_tasks(void *wait_channel);
 
+/**
+ * @brief Unblock all tasks.
+ *
+ * Unblock all the tasks sleeping on the given \a wait_channel, including
+ * exclusive waiters.
+ *
+ * @param   wait_channel    wait channel
+ *
+ * @return  number of tasks woken up.
+ */
+int unblock_all_tasks(void *wait_channel);
+
+/**
+ * @brief Unblock one task.
+ *
+ * Unblock the task that has been sleeping the longest on the given
+ * \a wait_channel.
+ *
+ * @param   wait_channel    wait channel
+ *
+ * @return  number of tasks woken up (zero or one).
+ */
+int unblock_one_task(void *wait_channel);
+
 /**
  * @brief Unblock task.
  *
@@ -406,6 +620,7 @@ void append_to_ready_queue_locked(volatile struct task_t *task, int move_queue);
 void move_to_queue_end_locked(volatile struct task_t *task);
 void task_change_priority(volatile struct task_t *t, int new_prio, int new_policy);
 void schedule_and_block(volatile struct task_t *tracer, volatile struct task_t *tracee);
+void unlock_scheduler_no_sti(void);
 
 
 /**************************************
@@ -83,11 +83,6 @@
     }
 
 
-#ifdef SMP
-//extern struct kernel_mutex_t scheduler_lock;
-extern volatile int scheduler_holding_cpu;
-#endif
-
 extern volatile int IRQ_disable_counter;
 
 #if 0
@@ -31,7 +31,7 @@
 #include <kernel/task.h>
 #include <kernel/ids.h>
 
-#define THREADS_PER_PROCESS         512     /**< max threads per task */
+#define THREADS_PER_PROCESS         4096    /**< max threads per task */
 
 /************************
  * Function prototypes
@@ -183,6 +183,19 @@ static inline unsigned long long timespec_to_ticks(struct timespec *ts)
 }
 
 
+static inline int64_t timespec_to_ns(struct timespec *ts)
+{
+    return ((int64_t)ts->tv_sec * NSEC_PER_SEC) + ts->tv_nsec;
+}
+
+
+static inline void ns_to_timespec(int64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+
 /**********************************
  * Functions defined in timer.c
  **********************************/
@@ -207,6 +220,55 @@ void timer_init(void);
  */
 void switch_timer(void);
 
+/**
+ * @brief Set the realtime clock.
+ *
+ * Set the system startup time and reset the monotonic clock, so that
+ * CLOCK_REALTIME reads \a sec seconds and \a nsec nanoseconds, and publish
+ * the new time to the vdso.
+ *
+ * @param   sec     seconds since the Epoch
+ * @param   nsec    nanoseconds
+ *
+ * @return  nothing.
+ */
+void timekeeping_settime(time_t sec, long nsec);
+
+/**
+ * @brief Stop the tick on an idle cpu.
+ *
+ * Called by the idle task with interrupts disabled before it halts the cpu.
+ * In high resolution mode, the cpu's scheduler tick is stopped, and the cpu
+ * is only woken up by its pending timers, device interrupts, or a wakeup
+ * IPI from tick_nohz_kick(). Call tick_nohz_idle_exit() after waking up.
+ *
+ * @return  1 if the cpu can halt, 0 if there is work to do.
+ */
+int tick_nohz_idle_enter(void);
+
+/**
+ * @brief Restart the tick on a cpu that is leaving idle.
+ *
+ * Called by the idle task with interrupts disabled. Catches up on the time
+ * that passed while the tick was stopped.
+ *
+ * @return  nothing.
+ */
+void tick_nohz_idle_exit(void);
+
+/**
+ * @brief Wake up idle cpus.
+ *
+ * Called after a task is queued on \a cpu's run queue. If \a cpu is idle
+ * with its tick stopped, it is sent a wakeup IPI. If it is busy, we wake
+ * another idle cpu (if there is one), which can steal the task.
+ *
+ * @param   cpu     cpu whose run queue the task was added to
+ *
+ * @return  nothing.
+ */
+void tick_nohz_kick(int cpu);
+
 
 /**********************************
  * Functions defined in itimer.c
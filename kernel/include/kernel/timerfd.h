@@ -0,0 +1,148 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: timerfd.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file timerfd.h
+ *
+ *  Functions and structure definitions for the kernel's timerfd
+ *  implementation.
+ */
+
+#ifndef __KERNEL_TIMERFD_H__
+#define __KERNEL_TIMERFD_H__
+
+#include <signal.h>
+#include <kernel/mutex.h>
+#include <kernel/select.h>
+#include <kernel/vfs.h>
+#include <kernel/bits/timert-def.h>
+#include <kernel/bits/posixtimer-def.h>
+
+/**
+ * \def TIMERFD_TGID
+ *
+ * Timerfds are armed on the POSIX timer clock waiter lists under this
+ * reserved thread group id, so they do not belong to any task (a timerfd
+ * can outlive the task that created it, and can be shared between
+ * processes).
+ */
+#define TIMERFD_TGID            (-1)
+
+
+/**
+ * @struct timerfd_t
+ * @brief The timerfd_t structure.
+ *
+ * A structure to represent a timerfd. The lock field serializes
+ * timerfd_settime() calls, while wait_lock protects the expiration count
+ * and is used to sleep on the timerfd.
+ */
+struct timerfd_t
+{
+    struct posix_timer_t timer;             /**< the timer (must be the
+                                                 first field) */
+    volatile struct kernel_mutex_t lock;    /**< settime lock */
+    volatile struct kernel_mutex_t wait_lock;   /**< expirations lock */
+    unsigned long long expirations;         /**< expirations since the last
+                                                 read */
+    struct selinfo sel;                     /**< select channel */
+    struct timerfd_t *next;                 /**< next timerfd in hash
+                                                 bucket */
+};
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Get a timerfd's timer.
+ *
+ * Called by the clock code to find the timer of an expired timerfd
+ * waiter (those have \ref TIMERFD_TGID as their thread group id).
+ *
+ * @param   timerid     timer id
+ *
+ * @return  the timer on success, NULL if the timerfd was closed.
+ */
+struct posix_timer_t *timerfd_get_timer(ktimer_t timerid);
+
+/**
+ * @brief Timerfd expiration.
+ *
+ * Called by the clock code when a timerfd's timer expires. Increments the
+ * expiration count and wakes up readers.
+ *
+ * @param   timer       the expired timer
+ *
+ * @return  nothing.
+ */
+void timerfd_expired(struct posix_timer_t *timer);
+
+/**
+ * @brief Close a timerfd.
+ *
+ * Disarm and free the timerfd referred to by the given node. Called on the
+ * last close of the timerfd file descriptor.
+ *
+ * @param   node        timerfd file node
+ *
+ * @return  nothing.
+ */
+void timerfd_close(struct fs_node_t *node);
+
+/**
+ * @brief Handler for syscall timerfd_create().
+ *
+ * @param   clockid     CLOCK_REALTIME or CLOCK_MONOTONIC
+ * @param   flags       zero or a combination of TFD_CLOEXEC and
+ *                        TFD_NONBLOCK
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long syscall_timerfd_create(clockid_t clockid, int flags);
+
+/**
+ * @brief Handler for syscall timerfd_settime().
+ *
+ * @param   fd          timerfd file descriptor
+ * @param   flags       zero or a combination of TFD_TIMER_ABSTIME and
+ *                        TFD_TIMER_CANCEL_ON_SET
+ * @param   new_value   new timer value
+ * @param   old_value   if not NULL, the old timer value is returned here
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long syscall_timerfd_settime(int fd, int flags,
+                             struct itimerspec *new_value,
+                             struct itimerspec *old_value);
+
+/**
+ * @brief Handler for syscall timerfd_gettime().
+ *
+ * @param   fd          timerfd file descriptor
+ * @param   curr_value  current timer value is returned here
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long syscall_timerfd_gettime(int fd, struct itimerspec *curr_value);
+
+#endif      /* __KERNEL_TIMERFD_H__ */
@@ -49,12 +49,17 @@
 #define	LINK_MAX		        32767	/**< max file link count */
 #endif
 
-#define NR_INODE                4096    /**< max inodes cached in memory */
+#define NR_INODE_HASH           1024    /**< buckets in the incore node hash
+                                             table (must be a power of 2) */
 
-#define NR_FILE                 512     /**< max files open on the system */
+#define NR_UNUSED_INODE         4096    /**< max unused inodes kept incore */
 
-#define NR_OPEN                 OPEN_MAX    /**< max files open per task 
-                                                 (currently 32) */
+#define NR_OPEN                 1024    /**< max files open per task (the
+                                             RLIMIT_NOFILE hard limit) */
+
+#define NR_OPEN_DEFAULT         OPEN_MAX    /**< file descriptor slots
+                                                 embedded in each task's
+                                                 file table (currently 32) */
 
 //#define NR_BUFFERS              128     /**< max buffers */
 
@@ -148,6 +153,41 @@
  */
 #define IS_PIPE(node)           ((node)->flags & FS_NODE_PIPE)
 
+/**
+ * \def IS_EPOLL
+ * Check if a file node refers to an epoll instance
+ */
+#define IS_EPOLL(node)          ((node)->flags & FS_NODE_EPOLL)
+
+/**
+ * \def IS_EVENTFD
+ * Check if a file node refers to an eventfd
+ */
+#define IS_EVENTFD(node)        ((node)->flags & FS_NODE_EVENTFD)
+
+/**
+ * \def IS_TIMERFD
+ * Check if a file node refers to a timerfd
+ */
+#define IS_TIMERFD(node)        ((node)->flags & FS_NODE_TIMERFD)
+
+/**
+ * \def IS_SIGNALFD
+ * Check if a file node refers to a signalfd
+ */
+#define IS_SIGNALFD(node)       ((node)->flags & FS_NODE_SIGNALFD)
+
+/**
+ * \def IS_PSEUDO_NODE
+ * Check if a file node is a pseudo-file that exists only in memory and whose
+ * data is freed when its last file is closed (epoll, eventfd, timerfd and
+ * signalfd nodes)
+ */
+#define IS_PSEUDO_NODE(node)    ((node)->flags & (FS_NODE_EPOLL |       \
+                                                  FS_NODE_EVENTFD |     \
+                                                  FS_NODE_TIMERFD |     \
+                                                  FS_NODE_SIGNALFD))
+
 /**
  * \def INC_NODE_REFS
  * Increment incore node references
@@ -235,20 +275,28 @@ extern dev_t TMPFS_DEVID;       // block (241, x)
 extern dev_t PROCFS_DEVID;      // block (243, 0)
 
 /**
- * @var ftab
- * @brief file table.
+ * @var nr_files
+ * @brief open file count.
+ *
+ * Number of allocated file structs (defined in fio.c).
+ */
+extern volatile unsigned long nr_files;
+
+/**
+ * @var nr_nodes
+ * @brief incore node count.
  *
- * The master file table (defined in vfs.c).
+ * Number of nodes in the incore node cache (defined in node.c).
  */
-extern struct file_t ftab[];
+extern volatile unsigned long nr_nodes;
 
 /**
- * @var node_table
- * @brief node table.
+ * @var nr_unused_nodes
+ * @brief unused node count.
  *
- * The master node table (defined in node.c).
+ * Number of cached nodes that are not used by anyone (defined in node.c).
  */
-extern struct fs_node_t *node_table[];
+extern volatile unsigned long nr_unused_nodes;
 
 /**
  * @var fstab
@@ -288,20 +336,168 @@ extern struct fs_node_t *system_root_node;
  * Functions defined in fio.c
  **********************************/
 
+struct task_files_t;
+
+/**
+ * @brief Initialise file structs.
+ *
+ * Create the slab cache used to allocate file structs.
+ *
+ * @return  nothing.
+ */
+void init_files(void);
+
+/**
+ * @brief Allocate a file struct.
+ *
+ * Allocate a zeroed file struct with a reference count of 1.
+ *
+ * @return  the new file struct, NULL if out of memory.
+ */
+struct file_t *file_alloc(void);
+
+/**
+ * @brief Free a file struct.
+ *
+ * Free a file struct that is no longer referenced. This is called by
+ * closef(), and on error paths after file_alloc().
+ *
+ * @param   f       file struct
+ *
+ * @return  nothing.
+ */
+void file_free(struct file_t *f);
+
+/**
+ * @brief Iterate over open files.
+ *
+ * Call the given function for each allocated file struct, until it returns
+ * non-zero. The function is called with the file list locked, so it must
+ * not open or close files.
+ *
+ * @param   func    function to call
+ * @param   arg     argument to pass to func
+ *
+ * @return  the file for which func returned non-zero, NULL otherwise.
+ */
+struct file_t *for_each_file(int (*func)(struct file_t *, void *), void *arg);
+
+/**
+ * @brief Initialise a task's file table.
+ *
+ * @param   files   file table
+ *
+ * @return  nothing.
+ */
+void task_files_init(struct task_files_t *files);
+
+/**
+ * @brief Copy a task's file table.
+ *
+ * Initialise dest as a copy of src (used by fork). The files' reference
+ * counts are not changed.
+ *
+ * @param   dest    destination file table
+ * @param   src     source file table
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long task_files_copy(struct task_files_t *dest, struct task_files_t *src);
+
+/**
+ * @brief Free a task's file table.
+ *
+ * Free the memory used by the file table (but not the struct itself).
+ * Open files should have been closed before calling this function.
+ *
+ * @param   files   file table
+ *
+ * @return  nothing.
+ */
+void task_files_free(struct task_files_t *files);
+
+/**
+ * @brief Allocate a file descriptor.
+ *
+ * Reserve the lowest free file descriptor that is not less than start in
+ * the current task's file table, expanding the table if needed (up to the
+ * task's RLIMIT_NOFILE). The descriptor's close-on-exec flag is cleared.
+ * The caller should call fdassign() or fdfree() afterwards.
+ *
+ * @param   start   lowest acceptable file descriptor
+ * @param   res     the file descriptor is returned here
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long fdalloc(int start, int *res);
+
+/**
+ * @brief Point a file descriptor at a file.
+ *
+ * @param   fd      file descriptor reserved by fdalloc()
+ * @param   f       open file
+ *
+ * @return  nothing.
+ */
+void fdassign(int fd, struct file_t *f);
+
+/**
+ * @brief Free a file descriptor.
+ *
+ * Clear the given slot in the current task's file table, so the file
+ * descriptor can be reused. The file itself is not closed.
+ *
+ * @param   fd      file descriptor
+ *
+ * @return  nothing.
+ */
+void fdfree(int fd);
+
 /**
  * @brief Allocate file descriptor.
  *
  * Allocate a user file descriptor and a file struct, with the descriptor 
  * pointing at the struct.
  *
- * @param   _fd     file descriptor in the range 0..NR_OPEN is returned here
- * @param   _f      pointer to file struct in the master file table is 
- *                    returned here
+ * @param   _fd     file descriptor is returned here
+ * @param   _f      pointer to the new file struct is returned here
  *
  * @return  zero on success, -(errno) on failure.
  */
 long falloc(int *_fd, struct file_t **_f);
 
+/**
+ * @brief Allocate a pseudo-file.
+ *
+ * Allocate a user file descriptor, a file struct and an incore node for
+ * a pseudo-file that exists only in memory (e.g. an epoll instance or an
+ * eventfd). The node's flags, data and functions should be set by the
+ * caller. Read and write default to the dummyfs functions.
+ *
+ * @param   _fd     file descriptor is returned here
+ * @param   _f      pointer to file struct is returned here
+ * @param   _node   pointer to the new node is returned here
+ * @param   flags   file flags (only O_CLOEXEC and O_NONBLOCK are used)
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long falloc_pseudo(int *_fd, struct file_t **_f, struct fs_node_t **_node,
+                   int flags);
+
+/**
+ * @brief Install an open file.
+ *
+ * Install the given file in the first free slot of the current task's file
+ * table. The caller's reference on the file becomes the new descriptor's
+ * reference.
+ *
+ * @param   f       open file
+ * @param   flags   zero or O_CLOEXEC
+ *
+ * @return  new file descriptor on success, -(errno) on failure.
+ */
+long fdinstall(struct file_t *f, int flags);
+
 /**
  * @brief Close file.
  *
@@ -503,6 +699,16 @@ long vfs_path_to_devid(char *source, char *fstype, dev_t *dev);
  */
 void sync_nodes(dev_t dev);
 
+/**
+ * @brief Initialise nodes.
+ *
+ * Create the slab cache used to allocate incore node structs. Called once
+ * during boot.
+ *
+ * @return  nothing.
+ */
+void init_nodes(void);
+
 /**
  * @brief Release file node.
  *
@@ -531,12 +737,73 @@ int node_is_incore(dev_t dev, ino_t n);
 /**
  * @brief Get an empty node.
  *
- * Get an empty node struct from the master node table.
+ * Allocate an empty node struct and add it to the node cache. The node is
+ * not hashed until it is given an inode number (see hash_node()).
  *
- * @return  node pointer on success, NULL if the master node table is full.
+ * @return  node pointer on success, NULL if we are out of memory.
  */
 struct fs_node_t *get_empty_node(void);
 
+/**
+ * @brief Hash a node.
+ *
+ * Add a node returned by get_empty_node() to the node hash table after the
+ * caller has set its  dev and  inode fields, so that get_node() can
+ * find it.
+ *
+ * @param   node    file node
+ *
+ * @return  nothing.
+ */
+void hash_node(struct fs_node_t *node);
+
+/**
+ * @brief Shrink the node cache.
+ *
+ * Free up to  count unused nodes, oldest first. Called when memory is low.
+ *
+ * @param   count   maximum number of nodes to free
+ *
+ * @return  number of nodes freed.
+ */
+size_t shrink_node_cache(size_t count);
+
+/**
+ * @brief Release a device's nodes.
+ *
+ * Release the nodes of a device that are still in use, except for its 
+ *  root node. Called when unmounting a filesystem.
+ *
+ * @param   dev     device id
+ * @param   root    the filesystem's root node
+ * @param   force   if zero, fail instead of releasing used nodes
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long release_dev_nodes(dev_t dev, struct fs_node_t *root, int force);
+
+/**
+ * @brief Invalidate a device's nodes.
+ *
+ * Free the cached unused nodes of an unmounted device, and clear the
+ * mount info pointer of the remaining ones.
+ *
+ * @param   dev     device id
+ *
+ * @return  nothing.
+ */
+void invalidate_dev_nodes(dev_t dev);
+
+/**
+ * @brief Node cache statistics.
+ *
+ * @param   total   the number of nodes in the cache is returned here
+ * @param   active  the number of nodes in use is returned here
+ *
+ * @return  nothing.
+ */
+void node_cache_stats(unsigned long *total, unsigned long *active);
+
 /**
  * @brief Read a node.
  *
@@ -730,6 +997,22 @@ long vfs_open(char *pathname, int flags, mode_t mode, int dirfd,
 long vfs_finddir(struct fs_node_t *dir, char *filename, struct dirent **entry,
                  struct cached_page_t **dbuf, size_t *dbuf_off);
 
+/**
+ * @brief Look up a file in a directory.
+ *
+ * Find the inode number of the file with the given \a filename in the
+ * parent directory represented by the given \a dir node. The name cache
+ * is checked first, and the result of calling vfs_finddir() is cached
+ * for future lookups (including names that do not exist).
+ *
+ * @param   dir         the parent directory's node
+ * @param   filename    the searched-for filename
+ * @param   ino         the file's inode number is returned here
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+long vfs_lookup(struct fs_node_t *dir, char *filename, ino_t *ino);
+
 /**
  * @brief Find an inode in a directory.
  *
@@ -992,6 +1275,23 @@ struct fs_node_t *rootfs_init(void);
  * Inlined functions
  **********************************/
 
+/**
+ * @brief Read ahead of a file reader.
+ *
+ * Called before reading \a count bytes from the given file at offset
+ * \a pos. If the file is being read sequentially, a readahead window is
+ * set up and grown, and the next window is read into the page cache in the
+ * background while the reader consumes the current one. Defined in
+ * readahead.c.
+ *
+ * @param   f           file struct
+ * @param   pos         file offset the caller is about to read from
+ * @param   count       number of bytes the caller is about to read
+ *
+ * @return  nothing.
+ */
+void file_readahead(struct file_t *f, off_t pos, size_t count);
+
 /**
  * @brief Generic function to read from a file.
  *
@@ -1012,6 +1312,7 @@ struct fs_node_t *rootfs_init(void);
 STATIC_INLINE ssize_t vfs_read(struct file_t *f, off_t *pos,
                                unsigned char *buf, size_t count, int kernel)
 {
+    file_readahead(f, *pos, count);
     return vfs_read_node(f->node, pos, buf, count, kernel);
 }
 
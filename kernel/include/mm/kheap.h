@@ -138,6 +138,19 @@ void kheap_init(void);
  */
 void *kcalloc(size_t m, size_t n);
 
+/**
+ * @brief Allocate aligned dynamic memory.
+ *
+ * Allocate a region of memory on the kernel heap, whose address is a
+ * multiple of \a align. It can be freed later by calling kfree().
+ *
+ * @param   align   alignment (must be a power of two)
+ * @param   sz      number of bytes to allocate
+ *
+ * @return  pointer to allocated memory on success, NULL on failure.
+ */
+void *kmemalign(size_t align, size_t sz);
+
 /**
  * @brief Resize kernel heap.
  *
@@ -65,6 +65,12 @@
 #define MEMREGION_TYPE_LOWEST       MEMREGION_TYPE_TEXT
 #define MEMREGION_TYPE_HIGHEST      MEMREGION_TYPE_KERNEL
 
+/* region tree node colors */
+#define RB_RED                      0
+#define RB_BLACK                    1
+
+#define REGION_END(m)               ((m)->addr + ((m)->size * PAGE_SIZE))
+
 
 /**********************************
  * Structure definitions
@@ -92,6 +98,12 @@ struct memregion_t
     struct memregion_t *next_free;  /**< next region in the free list */
     struct memregion_t *next;       /**< next region in task mappings */
     struct memregion_t *prev;       /**< previous region in task mappings */
+    struct memregion_t *rb_parent,  /**< parent in the task's region tree */
+                       *rb_left,    /**< left child (lower addresses) */
+                       *rb_right;   /**< right child (higher addresses) */
+    int rb_color;                   /**< RB_RED or RB_BLACK */
+    virtual_addr gap;               /**< unmapped space below this region */
+    virtual_addr max_gap;           /**< largest gap in this subtree */
 };
 
 
@@ -105,6 +117,9 @@ struct task_vm_t
 {
     struct memregion_t *first_region;   /**< pointer to first memory region */
     struct memregion_t *last_region;    /**< pointer to last memory region */
+    struct memregion_t *rb_root;        /**< root of the region tree */
+    struct memregion_t *mmap_cache;     /**< last region found by
+                                             memregion_containing() */
     volatile struct kernel_mutex_t mutex;        /**< struct lock */
 
     uintptr_t vdso_code_start;          /**< start of vdso code */
@@ -464,6 +479,85 @@ size_t memregion_stack_pagecount(volatile struct task_t *task);
 size_t memregion_kernel_pagecount(volatile struct task_t *task);
 
 
+/**
+ * @brief Add a memory region to the task's region tree.
+ *
+ * Besides the address-ordered region list, each task keeps its regions in
+ * a red-black tree keyed by address. Each node also records the unmapped
+ * gap below its region, and the largest such gap in its subtree, so that
+ * free address ranges can be found without walking the whole list.
+ *
+ * NOTES:
+ *   - The region must have been linked into the region list first.
+ *   - The caller must have locked mem->mutex before calling us.
+ *
+ * @param   mem         task memory map
+ * @param   memregion   memory region
+ *
+ * @return  nothing.
+ */
+void memregion_tree_insert(struct task_vm_t *mem,
+                           struct memregion_t *memregion);
+
+/**
+ * @brief Remove a memory region from the task's region tree.
+ *
+ * NOTES:
+ *   - The region must have been unlinked from the region list first, but
+ *     its next field must still point to the region that followed it.
+ *   - The caller must have locked mem->mutex before calling us.
+ *
+ * @param   mem         task memory map
+ * @param   memregion   memory region
+ *
+ * @return  nothing.
+ */
+void memregion_tree_remove(struct task_vm_t *mem,
+                           struct memregion_t *memregion);
+
+/**
+ * @brief Update the task's region tree after resizing a region.
+ *
+ * Must be called after a region's addr or size fields are changed in place
+ * (without changing the order of regions), so the gaps recorded in the tree
+ * are kept up to date.
+ *
+ * @param   mem         task memory map
+ * @param   memregion   memory region
+ *
+ * @return  nothing.
+ */
+void memregion_tree_update(struct task_vm_t *mem,
+                           struct memregion_t *memregion);
+
+/**
+ * @brief Find the first region that ends above the given address.
+ *
+ * @param   mem         task memory map
+ * @param   addr        address to search
+ *
+ * @return  the lowest memregion with an end address above \a addr, NULL if
+ *          there is none.
+ */
+struct memregion_t *memregion_tree_lower_bound(struct task_vm_t *mem,
+                                               virtual_addr addr);
+
+/**
+ * @brief Find a free address range.
+ *
+ * Find the lowest unmapped range of at least \a size bytes that lies
+ * between \a min and \a max.
+ *
+ * @param   mem         task memory map
+ * @param   size        range size in bytes (page-aligned)
+ * @param   min         lowest acceptable address
+ * @param   max         highest acceptable end address
+ *
+ * @return  the start of the free range on success, zero on failure.
+ */
+virtual_addr memregion_find_gap(struct task_vm_t *mem, virtual_addr size,
+                                virtual_addr min, virtual_addr max);
+
 /**
  * @brief Check for, and remove, overlapping memory mapped regions.
  *
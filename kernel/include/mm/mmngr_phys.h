@@ -53,6 +53,59 @@ typedef	uint64_t physical_addr;     /**< 64-bit physical address */
 typedef	uint32_t physical_addr;     /**< 32-bit physical address */
 #endif
 
+/**
+ * \def BUDDY_MAX_ORDER
+ *
+ * The buddy allocator keeps free memory in naturally aligned blocks of
+ * (1 << order) pages, for orders 0 to (BUDDY_MAX_ORDER - 1).
+ */
+#define BUDDY_MAX_ORDER         11
+
+/**
+ * \def PCP_HIGH
+ *
+ * Maximum number of free pages kept in a per-cpu page magazine. When a
+ * magazine grows past this, PCP_BATCH of its coldest pages are given back
+ * to the buddy allocator. An empty magazine is refilled with PCP_BATCH pages.
+ */
+#define PCP_HIGH                64
+#define PCP_BATCH               16
+
+
+/**
+ * @struct free_area_t
+ * @brief The free_area_t structure.
+ *
+ * A structure to represent the list of free blocks of one order. Blocks are
+ * linked by their first page frame number.
+ */
+struct free_area_t
+{
+    uint32_t head,          /**< first free block */
+             tail;          /**< last free block */
+    size_t nr_free;         /**< number of free blocks */
+};
+
+
+/**
+ * @struct pcp_magazine_t
+ * @brief The pcp_magazine_t structure.
+ *
+ * A structure to represent a per-cpu page magazine. Single page allocations
+ * and frees go through the magazine of the current cpu, which only takes the
+ * global physical memory lock when it needs refilling or draining. Recently
+ * freed (cache-hot) pages are kept at the head of the list and handed out
+ * first, while cold pages are added at the tail and drained first.
+ */
+struct pcp_magazine_t
+{
+    volatile int holding_cpu;   /**< cpu holding the lock, -1 if unlocked */
+    uint32_t head,              /**< hottest page */
+             tail;              /**< coldest page */
+    int count;                  /**< pages in the magazine */
+};
+
+
 /**
  * @var frame_shares
  * @brief frame shares.
@@ -153,6 +206,18 @@ void pmmngr_init_region(physical_addr base, size_t size);
  */
 void pmmngr_deinit_region(physical_addr base, size_t size);
 
+/**
+ * @brief Initialize the buddy allocator.
+ *
+ * Called once the kernel heap is ready, to allocate the buddy allocator's
+ * page frame tables and move all the free pages from the boot-time memory
+ * bitmap to the buddy free lists. All allocations after this go through
+ * the buddy allocator.
+ *
+ * @return  nothing.
+ */
+void pmmngr_init_buddy(void);
+
 /**
  * @brief Allocate physical memory page.
  *
@@ -175,6 +240,19 @@ void *pmmngr_alloc_block(void);
  */
 void pmmngr_free_block(void *p);
 
+/**
+ * @brief Free cold physical memory page.
+ *
+ * Same as pmmngr_free_block(), except the page is assumed not to be in the
+ * processor's cache (e.g. an evicted page cache page), so it is put at the
+ * cold end of the per-cpu magazine, where it will be reused last.
+ *
+ * @param   p       physical page address
+ *
+ * @return  nothing.
+ */
+void pmmngr_free_block_cold(void *p);
+
 /**
  * @brief Allocate physical memory pages.
  *
@@ -263,4 +341,16 @@ size_t pmmngr_get_free_block_count(void);
  */
 void pmmngr_load_PDBR(physical_addr addr);
 
+/**
+ * @brief Get buddy allocator info.
+ *
+ * Fill \a nr_free with the number of free blocks of each order, and return
+ * the number of free pages cached in the per-cpu magazines.
+ *
+ * @param   nr_free     array of BUDDY_MAX_ORDER items
+ *
+ * @return  pages in the per-cpu magazines.
+ */
+size_t pmmngr_get_buddyinfo(size_t *nr_free);
+
 #endif      /* __MMNGR_PHYS_H__ */
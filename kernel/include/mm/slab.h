@@ -0,0 +1,195 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: slab.h
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file slab.h
+ *
+ *  Functions and macros for working with slab object caches.
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/pagesize.h>
+#include <kernel/mutex.h>
+#include <kernel/smp.h>
+
+#define KMEM_CACHE_NAME_LEN         32
+
+/**
+ * \def KMEM_MAGAZINE_SIZE
+ *
+ * Maximum number of free objects kept in a per-cpu object magazine. An
+ * empty magazine is refilled with KMEM_BATCH objects from the cache's slabs,
+ * and a full magazine gives KMEM_BATCH objects back to the slabs.
+ */
+#define KMEM_MAGAZINE_SIZE          16
+#define KMEM_BATCH                  (KMEM_MAGAZINE_SIZE / 2)
+
+/**
+ * \def KMEM_MAX_SLAB_SIZE
+ *
+ * Slabs are big enough to hold at least KMEM_MIN_OBJS_PER_SLAB objects,
+ * but no bigger than KMEM_MAX_SLAB_SIZE bytes.
+ */
+#define KMEM_MAX_SLAB_SIZE          (PAGE_SIZE * 16)
+#define KMEM_MIN_OBJS_PER_SLAB      8
+
+
+/**
+ * @struct kmem_slab_t
+ * @brief The kmem_slab_t structure.
+ *
+ * A structure to represent a slab. A slab is a block of memory aligned to
+ * its size, which starts with this header, followed by the slab's free
+ * object index stack, followed by the objects themselves. Keeping free
+ * object indices outside the objects means objects keep the state set by
+ * the cache's constructor while they are free.
+ */
+struct kmem_slab_t
+{
+    struct kmem_cache_t *cache;         /**< cache this slab belongs to */
+    struct kmem_slab_t *prev,           /**< previous slab in list */
+                       *next;           /**< next slab in list */
+    void *objs;                         /**< first object in the slab */
+    int inuse;                          /**< objects handed out */
+    int nfree;                          /**< free indices on the stack */
+    uint16_t free[];                    /**< free object indices */
+};
+
+
+/**
+ * @struct kmem_magazine_t
+ * @brief The kmem_magazine_t structure.
+ *
+ * A structure to represent a per-cpu object magazine. Objects are allocated
+ * from and freed to the current cpu's magazine without taking the cache
+ * lock. The most recently freed object is the first to be reused.
+ */
+struct kmem_magazine_t
+{
+    volatile int holding_cpu;           /**< cpu holding the lock, -1 if
+                                             unlocked */
+    int count;                          /**< objects in the magazine */
+    void *objs[KMEM_MAGAZINE_SIZE];     /**< free objects */
+};
+
+
+/**
+ * @struct kmem_cache_t
+ * @brief The kmem_cache_t structure.
+ *
+ * A structure to represent a cache of fixed-size objects.
+ */
+struct kmem_cache_t
+{
+    char name[KMEM_CACHE_NAME_LEN];     /**< cache name (for slabinfo) */
+    size_t objsize;                     /**< requested object size */
+    size_t size;                        /**< object size with alignment */
+    size_t align;                       /**< object alignment */
+    size_t slab_size;                   /**< size of each slab */
+    int objs_per_slab;                  /**< objects in each slab */
+    void (*ctor)(void *obj);            /**< object constructor */
+
+    volatile struct kernel_mutex_t lock;    /**< protects the slab lists */
+    struct kmem_slab_t *partial,        /**< slabs with some free objects */
+                       *full,           /**< slabs with no free objects */
+                       *empty;          /**< slabs with no used objects */
+    int nr_slabs;                       /**< number of slabs */
+    int nr_empty;                       /**< number of empty slabs */
+    unsigned long nr_active;            /**< objects not in the slabs */
+
+    struct kmem_magazine_t magazines[MAX_CORES];    /**< per-cpu magazines */
+    struct kmem_cache_t *next;          /**< next cache in the cache list */
+};
+
+
+/**
+ * @var kmem_caches
+ * @brief list of caches.
+ *
+ * The list of all slab caches on the system (protected by kmem_caches_lock).
+ */
+extern struct kmem_cache_t *kmem_caches;
+extern volatile struct kernel_mutex_t kmem_caches_lock;
+
+
+/**********************************
+ * Function prototypes
+ **********************************/
+
+/**
+ * @brief Create a slab cache.
+ *
+ * Create a cache of objects of the given \a size. If \a ctor is not NULL,
+ * it is called on each object when the slab containing it is first
+ * allocated, and not when the object is allocated. Users of such caches
+ * must return objects to their constructed state before freeing them.
+ *
+ * @param   name    cache name (shown in /proc/slabinfo)
+ * @param   size    object size
+ * @param   align   object alignment (zero for pointer alignment)
+ * @param   ctor    object constructor (can be NULL)
+ *
+ * @return  the new cache on success, NULL on failure.
+ */
+struct kmem_cache_t *kmem_cache_create(char *name, size_t size, size_t align,
+                                       void (*ctor)(void *));
+
+/**
+ * @brief Allocate an object.
+ *
+ * Allocate an object from the given cache. The object's contents are
+ * undefined, unless the cache has a constructor.
+ *
+ * @param   cache   slab cache
+ *
+ * @return  the new object on success, NULL on failure.
+ */
+void *kmem_cache_alloc(struct kmem_cache_t *cache);
+
+/**
+ * @brief Free an object.
+ *
+ * Return an object to the cache it was allocated from.
+ *
+ * @param   cache   slab cache
+ * @param   obj     object to free
+ *
+ * @return  nothing.
+ */
+void kmem_cache_free(struct kmem_cache_t *cache, void *obj);
+
+/**
+ * @brief Destroy a slab cache.
+ *
+ * Release all the memory used by the given cache and free the cache.
+ * All the objects allocated from the cache must have been freed.
+ *
+ * @param   cache   slab cache
+ *
+ * @return  zero on success, -(errno) on failure.
+ */
+int kmem_cache_destroy(struct kmem_cache_t *cache);
+
+#endif      /* __SLAB_H__ */
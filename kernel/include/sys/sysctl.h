@@ -142,6 +142,12 @@ struct __sysctl_args {
 #define HW_CPU_FREQ 11      /* int: cpu frequency */
 #define	HW_MAXID	12		/* number of valid hw ids */
 
+/*
+ * CTL_NET identifiers
+ */
+#define	NET_LOOPBACK_DROP	 1	/* int: loopback packets dropped per 1000 */
+#define	NET_MAXID		 2	/* number of valid net ids */
+
 
 #ifdef	KERNEL
 
@@ -41,6 +41,11 @@ uintptr_t lapic_phys = 0;
 uintptr_t lapic_virt = 0;
 volatile int apic_running = 0;
 
+// local APIC timer counts per second (with a divide value of 16), and TSC
+// cycles per second, as measured when calibrating the timer
+unsigned long lapic_timer_hz = 0;
+unsigned long long tsc_hz = 0;
+
 int spurious_callback(struct regs *r, int arg);
 
 
@@ -65,6 +70,7 @@ void lapic_timer_init(int timer_irq)
 {
     uint32_t i;
     uint64_t j;
+    unsigned long long tsc_start, tsc_end;
     volatile uint8_t k;
 
     // Initialize LAPIC to a well known state
@@ -127,6 +133,7 @@ void lapic_timer_init(int timer_irq)
 
     // Reset APIC timer (set counter to -1)
     *((volatile uint32_t *)(lapic_virt + LAPIC_REG_INIT_COUNT)) = 0xFFFFFFFF;
+    tsc_start = rdtsc();
 
     // Now wait until PIT counter reaches zero
     //printk("apic: loop -- k 0x%x\n", k);
@@ -152,6 +159,7 @@ void lapic_timer_init(int timer_irq)
 
     // Stop APIC timer
     *((volatile uint32_t *)(lapic_virt + LAPIC_REG_LVT_TIMER)) = APIC_DISABLE;
+    tsc_end = rdtsc();
 
     // Now do the math...
     // Get current counter value
@@ -162,6 +170,16 @@ void lapic_timer_init(int timer_irq)
     i = (0xFFFFFFFF - i) + 1;
     printk("apic: counter value +ve %u\n", i);
 
+    // Remember the timer and TSC frequencies for high resolution timers
+    // (see hrtimer.c). All cores share the same bus and TSC frequency, so
+    // we only do this once.
+    if(!lapic_timer_hz)
+    {
+        lapic_timer_hz = (unsigned long)i * 100;
+        tsc_hz = (tsc_end - tsc_start) * 100;
+        printk("apic: timer %lu Hz, tsc %llu Hz\n", lapic_timer_hz, tsc_hz);
+    }
+
     // We used divide value different than 1, so now we have to multiply 
     // the result by 16
     i <<= 4;
@@ -207,6 +225,45 @@ void lapic_timer_init(int timer_irq)
 }
 
 
+/*
+ * Switch the local APIC timer to one-shot mode. The timer is left stopped
+ * until lapic_timer_arm() is called.
+ */
+void lapic_timer_oneshot(int timer_irq)
+{
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_INIT_COUNT)) = 0;
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_DIVIDE_CONFIG)) = 3;
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_LVT_TIMER)) = timer_irq;
+}
+
+
+/*
+ * Fire the local APIC timer (in one-shot mode) after the given number of
+ * counts. Zero stops the timer.
+ */
+void lapic_timer_arm(uint32_t count)
+{
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_INIT_COUNT)) = count;
+}
+
+
+/*
+ * Send an IPI to wake the given cpu up from the idle task.
+ */
+void lapic_send_wakeup(int lapicid)
+{
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_ICRH)) = (lapicid << 24);
+    *((volatile uint32_t *)(lapic_virt + LAPIC_REG_ICRL)) = 
+           (*((volatile uint32_t *)(lapic_virt + LAPIC_REG_ICRL)) & 0xfff00000) | 126;
+
+    // wait for delivery
+    while(*((volatile uint32_t *)(lapic_virt + LAPIC_REG_ICRL)) & (1 << 12))
+    {
+        __asm__ __volatile__("pause" ::: "memory");
+    }
+}
+
+
 int lapic_cur_cpu(void)
 {
     if(!lapic_virt)
@@ -40,15 +40,18 @@
 #include <kernel/clock.h>
 #include <kernel/task.h>
 #include <kernel/timer.h>
+#include <kernel/hrtimer.h>
 #include <kernel/ksignal.h>
 #include <kernel/user.h>
 #include <kernel/asm.h>
 #include <kernel/softint.h>
+#include <kernel/timerfd.h>
 #include <kernel/mutex.h>
 #include <kernel/user.h>
 #include <mm/kheap.h>
 
 #include "task_funcs.c"
+#include "../../vdso/vdso.h"
 #include "../syscall/posix_timers_inlines.h"
 
 #define NWAITERS            1024
@@ -58,14 +61,17 @@ time_t startup_time = 0;
 struct sys_clock monotonic_time;
 struct task_t *sleep_task = NULL;
 volatile struct kernel_mutex_t waiter_mutex = { 0, };
-volatile int waiter_list_busy = 0;
 volatile int waiter_mutex_locks = 0;
 
+// fires when the first waiter expires
+static struct hrtimer_t waiter_timer;
+
 volatile struct task_t *softsleep_task = NULL;
 struct clock_waiter_t *waiter_table = NULL;
 struct clock_waiter_t *last_used_waiter = NULL;
 
 void softsleep_task_func(void *unused);
+static int waiter_timer_func(struct hrtimer_t *timer);
 
 
 /*
@@ -91,6 +97,7 @@ void init_clock_waiters(void)
 
     A_memset(waiter_table, 0, NWAITERS * sizeof(struct clock_waiter_t));
     last_used_waiter = waiter_table;
+    hrtimer_setup(&waiter_timer, waiter_timer_func, NULL);
 
     (void)start_kernel_task("softsleep", softsleep_task_func, NULL,
                             &softsleep_task, 0);
@@ -155,6 +162,60 @@ retry:
 }
 
 
+/*
+ * Wake the softsleep task when the first waiter expires. If the task is
+ * busy, it might have already looked at the waiter lists, so we try again
+ * a bit later instead of losing the wakeup.
+ */
+static int waiter_timer_func(struct hrtimer_t *timer)
+{
+    volatile struct task_t *task = softsleep_task;
+
+    if(!task)
+    {
+        return HRTIMER_NORESTART;
+    }
+
+    if(task->state == TASK_WAITING)
+    {
+        unblock_task_no_preempt(task);
+        return HRTIMER_NORESTART;
+    }
+
+    timer->expires += NSEC_PER_MSEC;
+
+    return HRTIMER_RESTART;
+}
+
+
+/*
+ * Arm the waiter timer for the first waiter on either list. The caller must
+ * hold waiter_mutex.
+ */
+static void rearm_waiter_timer(void)
+{
+    unsigned long long expires = ~0ULL;
+    int i;
+
+    for(i = 0; i < 2; i++)
+    {
+        if(waiter_head[i].next && waiter_head[i].next->expires < expires)
+        {
+            expires = waiter_head[i].next->expires;
+        }
+    }
+
+    if(expires == ~0ULL)
+    {
+        hrtimer_cancel(&waiter_timer);
+    }
+    else if(!waiter_timer.queued || waiter_timer.expires > expires)
+    {
+        hrtimer_start(&waiter_timer, expires);
+    }
+}
+
+
 /*
  * Timers soft interrupt function.
  */
@@ -163,19 +224,22 @@ void softsleep_task_func(void *unused)
 	UNUSED(unused);
     volatile struct clock_waiter_t *w, *prev, *next;
     struct posix_timer_t *timer;
-    volatile int i;
+    unsigned long long now, expires;
+    volatile int i, sleepers;
 	
 	for(;;)
 	{
         elevated_priority_lock_recursive(&waiter_mutex, waiter_mutex_locks);
-        waiter_list_busy = 1;
+        now = hrtimer_now();
+        expires = ~0ULL;
+        sleepers = 0;
 
         for(i = 0; i < 2; i++)
         {
             prev = &waiter_head[i];
             w = prev->next;
         
-            while(w != NULL && w->delta <= 0)
+            while(w != NULL && w->expires <= now)
             {
             	next = w->next;
 
@@ -194,6 +258,7 @@ void softsleep_task_func(void *unused)
             	else
             	{
                 	prev = w;
+                	sleepers = 1;
                 	unblock_task_no_preempt(get_task_by_id(w->pid));
             	}
 
@@ -201,7 +266,39 @@ void softsleep_task_func(void *unused)
             }
         }
 
-        waiter_list_busy = 0;
+        // find the first waiter that has not expired (resetting periodic
+        // timers above might have added new ones)
+        for(i = 0; i < 2; i++)
+        {
+            for(w = waiter_head[i].next; w != NULL; w = w->next)
+            {
+                if(w->expires > now)
+                {
+                    if(w->expires < expires)
+                    {
+                        expires = w->expires;
+                    }
+
+                    break;
+                }
+            }
+        }
+
+        /*
+         * Expired sleepers stay on the list until they remove themselves.
+         * Keep waking them (once a tick) in case they were not asleep yet
+         * when we woke them.
+         */
+        if(sleepers && expires > now + NSECS_PER_TICK)
+        {
+            expires = now + NSECS_PER_TICK;
+        }
+
+        if(expires != ~0ULL)
+        {
+            hrtimer_start(&waiter_timer, expires);
+        }
+
         elevated_priority_unlock_recursive(&waiter_mutex, waiter_mutex_locks);
 
         block_task(waiter_table, 0);
@@ -221,13 +318,28 @@ long syscall_clock_getres(clockid_t clock_id, struct timespec *res)
 
     if((clock_id == CLOCK_REALTIME          ) ||
        (clock_id == CLOCK_MONOTONIC         ) ||
+       (clock_id == CLOCK_MONOTONIC_RAW     ) ||
+       (clock_id == CLOCK_BOOTTIME          ))
+    {
+        struct timespec tm =
+        {
+            .tv_sec  = 0,
+            .tv_nsec = (vdso_data->clock_mode == VDSO_CLOCK_TSC) ?
+                                                    1 : NSECS_PER_TICK,
+        };
+
+        return copy_to_user(res, &tm, sizeof(struct timespec));
+    }
+
+    if((clock_id == CLOCK_REALTIME_COARSE   ) ||
+       (clock_id == CLOCK_MONOTONIC_COARSE  ) ||
        (clock_id == CLOCK_PROCESS_CPUTIME_ID) ||
        (clock_id == CLOCK_THREAD_CPUTIME_ID ))
     {
         struct timespec tm =
         {
             .tv_sec  = 0,
-            .tv_nsec = NSECS_PER_TICK,  // CLOCK_RESOLUTION,
+            .tv_nsec = NSECS_PER_TICK,
         };
 
         return copy_to_user(res, &tm, sizeof(struct timespec));
@@ -247,19 +359,17 @@ long do_clock_gettime(clockid_t clock_id, struct timespec *tp)
      *       since the Epoch.  When its time is changed, timers for a
      *       relative interval are unaffected, but timers for an absolute
      *       point in time are affected.
+     *
+     *       The realtime, monotonic and boottime clocks (and their coarse
+     *       versions) are read from the same data the vdso uses.
      */
-    if(clock_id == CLOCK_REALTIME)
+    if(vdso_read_clock(vdso_data, clock_id, tp) == 0)
     {
-        tp->tv_sec  = monotonic_time.tv_sec + startup_time;
-        tp->tv_nsec = monotonic_time.tv_nsec;
-    }
-    else if(clock_id == CLOCK_MONOTONIC)
-    {
-        tp->tv_sec  = monotonic_time.tv_sec;
-        tp->tv_nsec = monotonic_time.tv_nsec;
+        return 0;
     }
-    else if(clock_id == CLOCK_PROCESS_CPUTIME_ID ||
-            clock_id == CLOCK_THREAD_CPUTIME_ID)
+
+    if(clock_id == CLOCK_PROCESS_CPUTIME_ID ||
+       clock_id == CLOCK_THREAD_CPUTIME_ID)
     {
         time_t t = (this_core->cur_task->user_time + this_core->cur_task->sys_time);
 
@@ -322,40 +432,30 @@ long do_clock_settime(clockid_t clock_id, struct timespec *tp)
 
         time_t old_secs = monotonic_time.tv_sec + startup_time;
         
-        startup_time = tp->tv_sec;
-        monotonic_time.tv_sec = 0;
-        monotonic_time.tv_nsec = tp->tv_nsec;
+        timekeeping_settime(tp->tv_sec, tp->tv_nsec);
         
         /* check for any timers that would expire under the new clock value */
         if(old_secs > tp->tv_sec)
         {
             struct clock_waiter_t *w;
+            unsigned long long diff, now = hrtimer_now();
             int i;
 
+            diff = (unsigned long long)(old_secs - tp->tv_sec) * NSEC_PER_SEC;
+
             elevated_priority_lock_recursive(&waiter_mutex, waiter_mutex_locks);
-            waiter_list_busy = 1;
 
+            // moving every waiter by the same amount keeps the lists sorted
             for(i = 0; i < 2; i++)
             {
-                int64_t diff = old_secs - tp->tv_sec;
-                
             	for(w = waiter_head[i].next; w != NULL; w = w->next)
         	    {
-        	        if(w->delta >= diff)
-        	        {
-        	            w->delta -= diff;
-        	            break;
-        	        }
-        	        
-        	        if(w->delta != 0)
-        	        {
-        	            diff -= w->delta;
-        	            w->delta = 0;
-        	        }
+        	        w->expires = (w->expires > now + diff) ?
+        	                                w->expires - diff : now;
         	    }
         	}
-        	
-            waiter_list_busy = 0;
+
+            rearm_waiter_timer();
             elevated_priority_unlock_recursive(&waiter_mutex, waiter_mutex_locks);
         }
 
@@ -400,167 +500,113 @@ long syscall_clock_settime(clockid_t clock_id, struct timespec *tp)
 }
 
 
-/*
- * Check expired timers.
- */
-void clock_check_waiters(void)
-{
-	/* volatile */ int i, unblock = 0;
-
-    /* volatile */ struct clock_waiter_t *w;
-
-    if(waiter_list_busy || softsleep_task == NULL)
-    {
-        return;
-    }
-
-    for(i = 0; i < 2; i++)
-    {
-    	for(w = waiter_head[i].next; w != NULL; w = w->next)
-	    {
-	        if(--w->delta > 0)
-	        {
-	            break;
-	        }
-		
-	    	unblock = 1;
-		
-	        if(w->delta == 0)
-	    	{
-	    		break;
-	    	}
-	    }
-	}
-
-	if(unblock)
-	{
-        unblock_task_no_preempt(softsleep_task);
-#if 0
-        /*
-         * This is the code from unblock_kernel_task(). We inline it
-         * here for performance, as this function is called repeatedly
-         * from timer_callback().
-         */
-        if(softsleep_task->state == TASK_WAITING)
-        {
-            softsleep_task->state = TASK_READY;
-    
-            remove_from_queue(softsleep_task);
-            append_to_ready_queue(softsleep_task);
-        }
-#endif
-	}
-}
-
-
 /*
  * Get clock_waiter_t struct for a task.
  */
 struct clock_waiter_t *get_waiter(volatile struct clock_waiter_t *head,
                                   pid_t pid, ktimer_t timerid,
-                                  int64_t *remaining_ticks, int unlink)
+                                  int64_t *remaining_ns, int unlink)
 {
     volatile struct clock_waiter_t *prev, *next;
-    int64_t delta = 0;
+    unsigned long long now;
     
     elevated_priority_lock_recursive(&waiter_mutex, waiter_mutex_locks);
-    waiter_list_busy = 1;
 
 	for(prev = head; (next = prev->next) != NULL; prev = next)
 	{
-	    delta += prev->delta;
-	    
-		if(next && next->pid == pid && next->timerid == timerid)
+		if(next->pid == pid && next->timerid == timerid)
 		{
-			if(remaining_ticks)
+			if(remaining_ns)
 			{
-			    *remaining_ticks = next->delta + delta;
+			    now = hrtimer_now();
+			    *remaining_ns = (next->expires > now) ?
+			                        (int64_t)(next->expires - now) : 0;
 			}
 
 			if(unlink)
 			{
-    			if(next->next && next->delta > 0)
-    			{
-    				next->next->delta += next->delta;
-    			}
-
     			prev->next = next->next;
     			next->next = NULL;
-    			next->delta += delta;
+    			
+    			if(prev == head)
+    			{
+    			    rearm_waiter_timer();
+    			}
 			}
 			
 			break;
 		}
 	}
 	
-    waiter_list_busy = 0;
     elevated_priority_unlock_recursive(&waiter_mutex, waiter_mutex_locks);
 	
 	return (struct clock_waiter_t *)next;
 }
 
 
-long clock_wait(struct clock_waiter_t *head, pid_t pid,
-                int64_t delta, ktimer_t timerid)
+/*
+ * Add a waiter to the given clock's queue.
+ */
+struct clock_waiter_t *clock_add_waiter(struct clock_waiter_t *head, pid_t pid,
+                                        int64_t timeout_ns, ktimer_t timerid)
 {
     struct clock_waiter_t *w, *prev, *next;
-    //struct task_t *task;
     
     elevated_priority_lock_recursive(&waiter_mutex, waiter_mutex_locks);
-    waiter_list_busy = 1;
 
     if(!(w = waiter_malloc()))
     {
-        waiter_list_busy = 0;
         elevated_priority_unlock_recursive(&waiter_mutex, waiter_mutex_locks);
 
-        return delta;
+        return NULL;
     }
     
-    w->delta = 0;
+    w->expires = hrtimer_now() + ((timeout_ns > 0) ? timeout_ns : 0);
     w->next = NULL;
     w->pid = pid;
     w->timerid = timerid;
     
     /*
-     * Store waiting tasks in a delta queue, where every task's delta is the 
-     * difference between the task's waiting time and the previous task's
-     * waiting time. We walk down the list to find a task who's delta is
-     * smaller than the current delta and we insert ourselves before it.
-     * We correct the delta value as we walk down the list.
+     * Waiters are kept sorted by expiry time, so the softsleep task only
+     * needs to look at the head of the list. Waiters with the same expiry
+     * time are woken in the order they were added.
      */
 	for(prev = head;
-	    (next = prev->next) != NULL && delta > next->delta;
+	    (next = prev->next) != NULL && next->expires <= w->expires;
 	    prev = next)
 	{
-	    if(next->delta > 0)
-	    {
-			delta -= next->delta;
-		}
+	    ;
 	}
 	
-	/*
-	 * Store the new delta, and fix the next task's delta (if we are not the
-	 * last task in queue).
-	 */
-	w->delta = delta;
-	
-	if(next != NULL)
-	{
-		next->delta -= delta;
-	}
-
-    /* Fix the pointers */
 	prev->next = w;
 	w->next = next;
 
-    waiter_list_busy = 0;
+    if(prev == head)
+    {
+        rearm_waiter_timer();
+    }
+
     elevated_priority_unlock_recursive(&waiter_mutex, waiter_mutex_locks);
 
+    return w;
+}
+
+
+long clock_wait(struct clock_waiter_t *head, pid_t pid,
+                int64_t timeout_ns, ktimer_t timerid)
+{
+    struct clock_waiter_t *w;
+    int64_t remaining = 0;
+
+    if(!(w = clock_add_waiter(head, pid, timeout_ns, timerid)))
+    {
+        return timeout_ns;
+    }
+
 	/* return if this is a call from timer_settime() */
 	if(timerid)
 	{
-        return w->delta;
+        return timeout_ns;
 	}
 	
 	/* Block until time expires or we are woken by a signal */
@@ -568,20 +614,12 @@ long clock_wait(struct clock_waiter_t *head, pid_t pid,
 	
 	/*
 	 * Remove us from the queue. If we were woken by a signal, this call will
-	 * also store the remaining time in struct w's delta field, which we return
-	 * to the caller.
+	 * also give us the remaining time, which we return to the caller.
 	 */
-    (void)get_waiter(head, w->pid, w->timerid, NULL, 1);
-	
-	/*
-	task = get_task_by_id(pid);
-    delta = (task && task->woke_by_signal) ? w->delta : 0;
-    */
-    delta = (w->delta > 0) ? w->delta : 0;
-
+    (void)get_waiter(head, w->pid, w->timerid, &remaining, 1);
     waiter_free(w);
 
-    return delta;
+    return remaining;
 }
 
 
@@ -600,7 +638,6 @@ long do_clock_nanosleep(pid_t pid, clockid_t clock_id, int flags,
     struct timespec rqtp;
     struct timespec rmtp;
     struct clock_waiter_t *head;
-    unsigned long long nticks;
 
     /* NOTE: Linux supports CLOCK_PROCESS_CPUTIME_ID in this function */
     if(clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC)
@@ -630,50 +667,34 @@ long do_clock_nanosleep(pid_t pid, clockid_t clock_id, int flags,
     }
     
     
-    time_t clock_secs = monotonic_time.tv_sec;
-    uint64_t clock_nsecs = monotonic_time.tv_nsec;
-    time_t my_secs = rqtp.tv_sec;
-    uint64_t res_nticks, my_nsecs = rqtp.tv_nsec;
+    int64_t nsecs, res_nsecs;
     
-    if(clock_id == CLOCK_REALTIME)
-    {
-        clock_secs += startup_time;
-    }
+    nsecs = timespec_to_ns(&rqtp);
 
     if(flags & TIMER_ABSTIME)
     {
-        if(my_secs <= clock_secs && my_nsecs <= clock_nsecs)
+        int64_t clock_nsecs = (int64_t)monotonic_time.tv_sec * NSEC_PER_SEC +
+                              monotonic_time.tv_nsec;
+
+        if(clock_id == CLOCK_REALTIME)
         {
-            return 0;
+            clock_nsecs += (int64_t)startup_time * NSEC_PER_SEC;
         }
-        
-        my_secs -= clock_secs;
-    }
 
-    if(flags & TIMER_ABSTIME)
-    {
-        if(my_nsecs <= monotonic_time.tv_nsec)
+        if(nsecs <= clock_nsecs)
         {
             return 0;
         }
         
-        my_nsecs -= monotonic_time.tv_nsec;
-    }
-    
-    if(my_nsecs && my_nsecs % NSECS_PER_TICK)
-    {
-        my_nsecs += NSECS_PER_TICK;
+        nsecs -= clock_nsecs;
     }
-    
-    nticks = (my_secs * PIT_FREQUENCY) + (my_nsecs / NSECS_PER_TICK);
+
     head = &waiter_head[(clock_id == CLOCK_REALTIME) ? 1 : 0];
     
-    KDEBUG("do_clock_nanosleep: secs %ld\n", my_secs);
-    KDEBUG("do_clock_nanosleep: nsecs %ld\n", my_nsecs);
-    KDEBUG("do_clock_nanosleep: nticks %ld\n", nticks);
+    KDEBUG("do_clock_nanosleep: nsecs %ld\n", nsecs);
     KDEBUG("do_clock_nanosleep: id %d\n", timerid);
 
-    if(nticks && (res_nticks = clock_wait(head, pid, nticks, timerid)) != 0)
+    if(nsecs && (res_nsecs = clock_wait(head, pid, nsecs, timerid)) != 0)
     {
     	volatile struct task_t *task = get_task_by_id(pid);
 
@@ -681,7 +702,7 @@ long do_clock_nanosleep(pid_t pid, clockid_t clock_id, int flags,
         {
             if(__rmtp)
             {
-                ticks_to_timespec(res_nticks, &rmtp);
+                ns_to_timespec(res_nsecs, &rmtp);
                 A_memcpy(__rmtp, &rmtp, sizeof(struct timespec));
             }
 
@@ -739,12 +760,13 @@ time_t get_startup_time(void)
 
 /*
  * Get current time in microseconds.
- *
- * TODO: This function doesn't calculate time properly.
  */
 void microtime(struct timeval *tvp)
 {
-	tvp->tv_sec = startup_time + monotonic_time.tv_sec;
-	tvp->tv_usec = monotonic_time.tv_nsec / 1000;
+    struct timespec ts;
+
+    (void)vdso_read_clock(vdso_data, CLOCK_REALTIME, &ts);
+	tvp->tv_sec = ts.tv_sec;
+	tvp->tv_usec = ts.tv_nsec / 1000;
 }
 
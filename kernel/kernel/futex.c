@@ -0,0 +1,636 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: futex.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file futex.c
+ *
+ *  Fast userspace mutexes (futexes).
+ *
+ *  Waiting tasks are kept in a fixed hash table of buckets, where each bucket
+ *  has its own lock and a FIFO list of waiters. A waiter checks the futex
+ *  word and queues itself while holding the bucket lock, and it only releases
+ *  the lock after it has been put on the blocked queue (see
+ *  block_task_and_unlock()), so a wakeup cannot slip in between the check
+ *  and the sleep. Wakers remove waiters from the bucket and wake the waiting
+ *  tasks directly, without scanning the scheduler's blocked queue.
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <kernel/laylaos.h>
+#include <kernel/task.h>
+#include <kernel/clock.h>
+#include <kernel/timer.h>
+#include <kernel/user.h>
+#include <kernel/futex.h>
+#include <mm/memregion.h>
+#include <mm/mmngr_virtual.h>
+
+static struct futex_bucket_t futex_buckets[NR_FUTEX_BUCKETS];
+
+
+#define KEY_MATCH(k1, k2)       \
+    ((k1)->word == (k2)->word && (k1)->mem == (k2)->mem)
+
+
+static inline struct futex_bucket_t *futex_hash(struct futex_key_t *key)
+{
+    uintptr_t h = (key->word >> 2) ^ ((uintptr_t)key->mem >> 4);
+
+    h ^= (h >> FUTEX_HASH_BITS) ^ (h >> (FUTEX_HASH_BITS * 2));
+
+    return &futex_buckets[h & (NR_FUTEX_BUCKETS - 1)];
+}
+
+
+/*
+ * Get the key identifying the futex at the given user address, and read
+ * the futex word. Reading the word also faults in the page (if needed), so
+ * that we can find the physical address of shared futexes.
+ */
+static long futex_get_key(int *uaddr, int op, struct futex_key_t *key,
+                          int *val)
+{
+    volatile struct task_t *ct = this_core->cur_task;
+    struct memregion_t *memregion;
+    int shared = 0;
+
+    if(!uaddr || ((uintptr_t)uaddr & (sizeof(int) - 1)))
+    {
+        return -EINVAL;
+    }
+
+    COPY_FROM_USER(val, uaddr, sizeof(int));
+
+    if(!(op & FUTEX_PRIVATE_FLAG))
+    {
+        kernel_mutex_lock(&(ct->mem->mutex));
+
+        if((memregion = memregion_containing(ct, (virtual_addr)uaddr)))
+        {
+            shared = !!(memregion->flags & MEMREGION_FLAG_SHARED);
+        }
+
+        kernel_mutex_unlock(&(ct->mem->mutex));
+    }
+
+    if(shared)
+    {
+        key->word = get_phys_addr((virtual_addr)uaddr) +
+                        ((uintptr_t)uaddr & (PAGE_SIZE - 1));
+        key->mem = NULL;
+    }
+    else
+    {
+        key->word = (uintptr_t)uaddr;
+        key->mem = ct->mem;
+    }
+
+    return 0;
+}
+
+
+static inline void futex_enqueue(struct futex_bucket_t *bucket,
+                                 struct futex_waiter_t *w)
+{
+    w->bucket = bucket;
+    w->next = NULL;
+
+    if((w->prev = bucket->tail))
+    {
+        bucket->tail->next = w;
+    }
+    else
+    {
+        bucket->head = w;
+    }
+
+    bucket->tail = w;
+}
+
+
+static inline void futex_dequeue(struct futex_bucket_t *bucket,
+                                 struct futex_waiter_t *w)
+{
+    if(w->prev)
+    {
+        w->prev->next = w->next;
+    }
+    else
+    {
+        bucket->head = w->next;
+    }
+
+    if(w->next)
+    {
+        w->next->prev = w->prev;
+    }
+    else
+    {
+        bucket->tail = w->prev;
+    }
+
+    w->prev = NULL;
+    w->next = NULL;
+}
+
+
+/*
+ * Wake up to nr waiters on the given key. The caller must hold the bucket
+ * lock. The waiter struct lives on the waiter's stack, but the waiter cannot
+ * return before it reacquires the bucket lock, which we still hold.
+ */
+static int futex_wake_locked(struct futex_bucket_t *bucket,
+                             struct futex_key_t *key, int nr, uint32_t bitset)
+{
+    struct futex_waiter_t *w, *next;
+    int woken = 0;
+
+    for(w = bucket->head; w && woken < nr; w = next)
+    {
+        next = w->next;
+
+        if(!KEY_MATCH(&w->key, key) || !(w->bitset & bitset))
+        {
+            continue;
+        }
+
+        futex_dequeue(bucket, w);
+        w->woken = 1;
+        unblock_task_no_preempt(w->task);
+        woken++;
+    }
+
+    return woken;
+}
+
+
+static inline void futex_lock_two(struct futex_bucket_t *b1,
+                                  struct futex_bucket_t *b2)
+{
+    if(b1 == b2)
+    {
+        kernel_mutex_lock(&b1->lock);
+    }
+    else if(b1 < b2)
+    {
+        kernel_mutex_lock(&b1->lock);
+        kernel_mutex_lock(&b2->lock);
+    }
+    else
+    {
+        kernel_mutex_lock(&b2->lock);
+        kernel_mutex_lock(&b1->lock);
+    }
+}
+
+
+static inline void futex_unlock_two(struct futex_bucket_t *b1,
+                                    struct futex_bucket_t *b2)
+{
+    kernel_mutex_unlock(&b1->lock);
+
+    if(b1 != b2)
+    {
+        kernel_mutex_unlock(&b2->lock);
+    }
+}
+
+
+/*
+ * Convert the user-supplied timeout to nanoseconds. FUTEX_WAIT timeouts are
+ * relative, while FUTEX_WAIT_BITSET timeouts are absolute, measured against
+ * CLOCK_MONOTONIC or, if FUTEX_CLOCK_REALTIME is set, CLOCK_REALTIME.
+ */
+static long futex_timeout_ns(struct timespec *__timeout, int op,
+                             int64_t *nsecs_out)
+{
+    struct timespec ts;
+    time_t secs;
+    long nsecs;
+
+    COPY_FROM_USER(&ts, __timeout, sizeof(struct timespec));
+
+    if(ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= NSEC_PER_SEC)
+    {
+        return -EINVAL;
+    }
+
+    if((op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET)
+    {
+        secs = monotonic_time.tv_sec;
+        nsecs = monotonic_time.tv_nsec;
+
+        if(op & FUTEX_CLOCK_REALTIME)
+        {
+            secs += startup_time;
+        }
+
+        if(ts.tv_sec < secs || (ts.tv_sec == secs && ts.tv_nsec <= nsecs))
+        {
+            *nsecs_out = 0;
+            return 0;
+        }
+
+        ts.tv_sec -= secs;
+        ts.tv_nsec -= nsecs;
+
+        if(ts.tv_nsec < 0)
+        {
+            ts.tv_sec--;
+            ts.tv_nsec += NSEC_PER_SEC;
+        }
+    }
+
+    *nsecs_out = timespec_to_ns(&ts);
+
+    return 0;
+}
+
+
+static long futex_wait(int *uaddr, int op, int val,
+                       struct timespec *__timeout, uint32_t bitset)
+{
+    volatile struct task_t *ct = this_core->cur_task;
+    struct futex_waiter_t waiter;
+    struct futex_bucket_t *bucket;
+    struct clock_waiter_t *cw = NULL, *head = NULL;
+    int64_t nsecs = 0, remaining = 0;
+    int uval;
+    long res;
+
+    if(!bitset)
+    {
+        return -EINVAL;
+    }
+
+    if(__timeout)
+    {
+        if((res = futex_timeout_ns(__timeout, op, &nsecs)) != 0)
+        {
+            return res;
+        }
+    }
+
+    if((res = futex_get_key(uaddr, op, &waiter.key, &uval)) != 0)
+    {
+        return res;
+    }
+
+    if(__timeout && nsecs == 0)
+    {
+        return (uval == val) ? -ETIMEDOUT : -EAGAIN;
+    }
+
+    waiter.task = ct;
+    waiter.bitset = bitset;
+    waiter.woken = 0;
+
+    /*
+     * Arm the timeout before queueing ourselves. If it expires before we
+     * get to sleep, the softsleep task will keep trying to wake us on each
+     * tick until we remove the clock waiter below.
+     */
+    if(__timeout)
+    {
+        head = &waiter_head[(op & FUTEX_CLOCK_REALTIME) ? 1 : 0];
+
+        if(!(cw = clock_add_waiter(head, ct->pid, nsecs, 0)))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    bucket = futex_hash(&waiter.key);
+    kernel_mutex_lock(&bucket->lock);
+
+    // re-read the futex word now that we hold the bucket lock
+    if(copy_from_user(&uval, uaddr, sizeof(int)) != 0)
+    {
+        res = -EFAULT;
+    }
+    else if(uval != val)
+    {
+        res = -EAGAIN;
+    }
+    else
+    {
+        futex_enqueue(bucket, &waiter);
+        block_task_and_unlock(&waiter, 1, &bucket->lock);
+
+        /*
+         * The waker dequeues us before waking us up. If we were not woken
+         * by FUTEX_WAKE, remove ourselves from whatever bucket we are in
+         * now (we might have been requeued by FUTEX_REQUEUE).
+         */
+        for(;;)
+        {
+            bucket = waiter.bucket;
+            kernel_mutex_lock(&bucket->lock);
+
+            if(bucket == waiter.bucket)
+            {
+                break;
+            }
+
+            kernel_mutex_unlock(&bucket->lock);
+        }
+
+        if(waiter.woken)
+        {
+            res = 0;
+        }
+        else
+        {
+            futex_dequeue(bucket, &waiter);
+            res = ct->woke_by_signal ? -EINTR : -ETIMEDOUT;
+        }
+    }
+
+    kernel_mutex_unlock(&bucket->lock);
+
+    if(cw)
+    {
+        (void)get_waiter(head, ct->pid, 0, &remaining, 1);
+        waiter_free(cw);
+    }
+
+    /*
+     * Not woken by FUTEX_WAKE nor by a signal. If our timeout has not
+     * expired yet, this is a spurious wakeup and userspace will recheck
+     * the futex word and call us again.
+     */
+    if(res == -ETIMEDOUT && (!cw || remaining > 0))
+    {
+        res = 0;
+    }
+
+    return res;
+}
+
+
+static long futex_wake(int *uaddr, int op, int nr, uint32_t bitset)
+{
+    struct futex_key_t key;
+    struct futex_bucket_t *bucket;
+    int uval, woken;
+    long res;
+
+    if(!bitset)
+    {
+        return -EINVAL;
+    }
+
+    if((res = futex_get_key(uaddr, op, &key, &uval)) != 0)
+    {
+        return res;
+    }
+
+    bucket = futex_hash(&key);
+    kernel_mutex_lock(&bucket->lock);
+    woken = futex_wake_locked(bucket, &key, nr, bitset);
+    kernel_mutex_unlock(&bucket->lock);
+
+    return woken;
+}
+
+
+static long futex_requeue(int *uaddr, int op, int nr_wake, int nr_requeue,
+                          int *uaddr2, int cmpval, int cmp)
+{
+    struct futex_key_t key1, key2;
+    struct futex_bucket_t *b1, *b2;
+    struct futex_waiter_t *w, *next;
+    int uval, woken, requeued = 0;
+    long res;
+
+    if(nr_wake < 0 || nr_requeue < 0)
+    {
+        return -EINVAL;
+    }
+
+    if((res = futex_get_key(uaddr, op, &key1, &uval)) != 0 ||
+       (res = futex_get_key(uaddr2, op, &key2, &uval)) != 0)
+    {
+        return res;
+    }
+
+    b1 = futex_hash(&key1);
+    b2 = futex_hash(&key2);
+    futex_lock_two(b1, b2);
+
+    if(cmp)
+    {
+        if(copy_from_user(&uval, uaddr, sizeof(int)) != 0)
+        {
+            futex_unlock_two(b1, b2);
+            return -EFAULT;
+        }
+
+        if(uval != cmpval)
+        {
+            futex_unlock_two(b1, b2);
+            return -EAGAIN;
+        }
+    }
+
+    woken = futex_wake_locked(b1, &key1, nr_wake, FUTEX_BITSET_MATCH_ANY);
+
+    for(w = b1->head; w && requeued < nr_requeue; w = next)
+    {
+        next = w->next;
+
+        if(!KEY_MATCH(&w->key, &key1))
+        {
+            continue;
+        }
+
+        // the waiter stays asleep, it is just moved to the other futex
+        futex_dequeue(b1, w);
+        w->key = key2;
+        futex_enqueue(b2, w);
+        requeued++;
+    }
+
+    futex_unlock_two(b1, b2);
+
+    return cmp ? (woken + requeued) : woken;
+}
+
+
+/*
+ * Atomically perform the FUTEX_WAKE_OP operation on the word at uaddr,
+ * returning the old value in oldval.
+ */
+static long futex_atomic_op(int *uaddr, int encoded_op, int *oldval)
+{
+    int op = (encoded_op >> 28) & 7;
+    int oparg = (encoded_op << 8) >> 20;
+    int old, new;
+
+    if((encoded_op >> 28) & FUTEX_OP_OPARG_SHIFT)
+    {
+        if(oparg < 0 || oparg > 31)
+        {
+            return -EINVAL;
+        }
+
+        oparg = 1 << oparg;
+    }
+
+    do
+    {
+        old = __atomic_load_n(uaddr, __ATOMIC_SEQ_CST);
+
+        switch(op)
+        {
+            case FUTEX_OP_SET : new = oparg; break;
+            case FUTEX_OP_ADD : new = old + oparg; break;
+            case FUTEX_OP_OR  : new = old | oparg; break;
+            case FUTEX_OP_ANDN: new = old & ~oparg; break;
+            case FUTEX_OP_XOR : new = old ^ oparg; break;
+            default           : return -ENOSYS;
+        }
+    } while(!__atomic_compare_exchange_n(uaddr, &old, new, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    *oldval = old;
+
+    return 0;
+}
+
+
+static long futex_wake_op(int *uaddr, int op, int nr_wake, int nr_wake2,
+                          int *uaddr2, int encoded_op)
+{
+    struct futex_key_t key1, key2;
+    struct futex_bucket_t *b1, *b2;
+    int cmp = (encoded_op >> 24) & 15;
+    int cmparg = (encoded_op << 20) >> 20;
+    int uval, oldval, woken;
+    long res;
+
+    if((res = futex_get_key(uaddr, op, &key1, &uval)) != 0 ||
+       (res = futex_get_key(uaddr2, op, &key2, &uval)) != 0)
+    {
+        return res;
+    }
+
+    b1 = futex_hash(&key1);
+    b2 = futex_hash(&key2);
+    futex_lock_two(b1, b2);
+
+    if((res = futex_atomic_op(uaddr2, encoded_op, &oldval)) != 0)
+    {
+        futex_unlock_two(b1, b2);
+        return res;
+    }
+
+    woken = futex_wake_locked(b1, &key1, nr_wake, FUTEX_BITSET_MATCH_ANY);
+
+    switch(cmp)
+    {
+        case FUTEX_OP_CMP_EQ: res = (oldval == cmparg); break;
+        case FUTEX_OP_CMP_NE: res = (oldval != cmparg); break;
+        case FUTEX_OP_CMP_LT: res = (oldval <  cmparg); break;
+        case FUTEX_OP_CMP_LE: res = (oldval <= cmparg); break;
+        case FUTEX_OP_CMP_GT: res = (oldval >  cmparg); break;
+        case FUTEX_OP_CMP_GE: res = (oldval >= cmparg); break;
+        default             : res = 0; break;
+    }
+
+    if(res)
+    {
+        woken += futex_wake_locked(b2, &key2, nr_wake2,
+                                   FUTEX_BITSET_MATCH_ANY);
+    }
+
+    futex_unlock_two(b1, b2);
+
+    return woken;
+}
+
+
+/*
+ * Handler for syscall futex().
+ */
+long syscall_futex(struct syscall_args *__args)
+{
+    struct syscall_args a;
+    long res;
+
+    // syscall args
+    int *uaddr;
+    int op;
+    int val;
+    struct timespec *timeout;
+    int *uaddr2;
+    int val3;
+
+    // get the args
+    COPY_SYSCALL6_ARGS(a, __args);
+    uaddr = (int *)(a.args[0]);
+    op = (int)(a.args[1]);
+    val = (int)(a.args[2]);
+    timeout = (struct timespec *)(a.args[3]);
+    uaddr2 = (int *)(a.args[4]);
+    val3 = (int)(a.args[5]);
+
+    if((op & FUTEX_CLOCK_REALTIME) &&
+       (op & FUTEX_CMD_MASK) != FUTEX_WAIT_BITSET)
+    {
+        return -ENOSYS;
+    }
+
+    KDEBUG("syscall_futex: uaddr %p, op %d, val %d\n", uaddr, op, val);
+
+    switch(op & FUTEX_CMD_MASK)
+    {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, op, val, timeout, FUTEX_BITSET_MATCH_ANY);
+
+        case FUTEX_WAIT_BITSET:
+            return futex_wait(uaddr, op, val, timeout, (uint32_t)val3);
+
+        case FUTEX_WAKE:
+            return futex_wake(uaddr, op, val, FUTEX_BITSET_MATCH_ANY);
+
+        case FUTEX_WAKE_BITSET:
+            return futex_wake(uaddr, op, val, (uint32_t)val3);
+
+        case FUTEX_REQUEUE:
+            return futex_requeue(uaddr, op, val, (int)(uintptr_t)timeout,
+                                 uaddr2, 0, 0);
+
+        case FUTEX_CMP_REQUEUE:
+            return futex_requeue(uaddr, op, val, (int)(uintptr_t)timeout,
+                                 uaddr2, val3, 1);
+
+        case FUTEX_WAKE_OP:
+            return futex_wake_op(uaddr, op, val, (int)(uintptr_t)timeout,
+                                 uaddr2, val3);
+
+        default:
+            return -ENOSYS;
+    }
+}
@@ -0,0 +1,615 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: hrtimer.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file hrtimer.c
+ *
+ *  High resolution timers. Each cpu keeps its pending timers in a pairing
+ *  heap ordered by expiry time, and programs its local APIC timer in
+ *  one-shot mode to fire when the first one expires. Time is measured in
+ *  nanoseconds since boot using the TSC, which we calibrate against the PIT.
+ *  If there is no local APIC, timers are run from the periodic PIT interrupt
+ *  and have tick resolution.
+ */
+
+#include <kernel/laylaos.h>
+#include <kernel/apic.h>
+#include <kernel/asm.h>
+#include <kernel/io.h>
+#include <kernel/timer.h>
+#include <kernel/hrtimer.h>
+
+struct hrtimer_cpu_t hrtimer_cpus[MAX_CORES];
+volatile int hrtimer_hres_active = 0;
+int hrtimer_tsc_invariant = 0;
+
+// TSC to nanoseconds and nanoseconds to local APIC timer counts
+static unsigned long long tsc_base = 0;
+static unsigned long long tsc_offset = 0;
+static unsigned long long tsc_mult = 0;
+static unsigned long long lapic_mult = 0;
+static unsigned long long lapic_max_ns = 0;
+
+// the clock we use if there is no TSC to read (advanced by the PIT)
+static volatile unsigned long long lowres_now = 0;
+
+
+#define cpuid(in, a, b, c, d)   \
+    __asm__ __volatile__ ("cpuid": "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (in));
+
+// how long we calibrate the TSC for (in milliseconds)
+#define TSC_CALIBRATE_MS        50
+
+
+static inline void lock_base(struct hrtimer_cpu_t *base)
+{
+    while(!__sync_bool_compare_and_swap(&base->holding_cpu, -1,
+                                        this_core->cpuid))
+    {
+        __asm__ __volatile__("pause":::"memory");
+    }
+}
+
+static inline void unlock_base(struct hrtimer_cpu_t *base)
+{
+    __sync_bool_compare_and_swap(&base->holding_cpu, this_core->cpuid, -1);
+}
+
+
+/*
+ * Initialise timer queues.
+ */
+void hrtimer_init(void)
+{
+    int i;
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        hrtimer_cpus[i].holding_cpu = -1;
+        hrtimer_cpus[i].next_event = ~0ULL;
+    }
+}
+
+
+/*
+ * Measure the TSC frequency by counting cycles while PIT channel 2 counts
+ * down. This is longer (and so more accurate) than the window the local
+ * APIC timer is calibrated with, which matters as the TSC is our clock.
+ */
+static unsigned long long tsc_calibrate(void)
+{
+    unsigned long long start, end;
+    uint32_t latch = (1193182 * TSC_CALIBRATE_MS) / 1000;
+    uintptr_t s;
+
+    s = int_off();
+
+    // gate channel 2 on, speaker off
+    outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+
+    // channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(0x43, 0xB0);
+    outb(0x42, latch & 0xff);
+    outb(0x42, (latch >> 8) & 0xff);
+
+    start = rdtsc();
+
+    // wait for the output to go high
+    while(!(inb(0x61) & 0x20))
+    {
+        ;
+    }
+
+    end = rdtsc();
+    int_on(s);
+
+    return ((end - start) * 1000) / TSC_CALIBRATE_MS;
+}
+
+
+// check for a TSC that runs at a constant rate in all power states
+static int tsc_is_invariant(void)
+{
+    unsigned long eax, ebx, ecx, edx;
+
+    if(!has_cpuid())
+    {
+        return 0;
+    }
+
+    cpuid(0x80000000, eax, ebx, ecx, edx);
+
+    if(eax < 0x80000007)
+    {
+        return 0;
+    }
+
+    cpuid(0x80000007, eax, ebx, ecx, edx);
+
+    return !!(edx & (1 << 8));
+}
+
+
+/*
+ * Initialise high resolution mode.
+ */
+void hrtimer_init_clock(void)
+{
+    if(!apic_running || !lapic_timer_hz || !tsc_hz)
+    {
+        printk("hrtimer: no local APIC timer, using periodic ticks\n");
+        return;
+    }
+
+    tsc_hz = tsc_calibrate();
+    hrtimer_tsc_invariant = tsc_is_invariant();
+    printk("hrtimer: tsc %llu Hz (%s)\n", tsc_hz,
+           hrtimer_tsc_invariant ? "invariant" : "not invariant");
+
+    lapic_mult = ((unsigned long long)lapic_timer_hz << HRTIMER_TSC_SHIFT) /
+                                                                NSEC_PER_SEC;
+    lapic_max_ns = (0xFFFFFFFFULL / lapic_timer_hz) * NSEC_PER_SEC;
+
+    // keep the conversion from overflowing
+    if(lapic_max_ns > (~0ULL >> 1) / lapic_mult)
+    {
+        lapic_max_ns = (~0ULL >> 1) / lapic_mult;
+    }
+
+    // carry on from where the periodic clock got to
+    tsc_offset = lowres_now;
+    tsc_base = rdtsc();
+    tsc_mult = ((unsigned long long)NSEC_PER_SEC << HRTIMER_TSC_SHIFT) /
+                                                                    tsc_hz;
+    hrtimer_hres_active = 1;
+
+    printk("hrtimer: using one-shot local APIC timer\n");
+}
+
+
+/*
+ * Get current time.
+ */
+unsigned long long hrtimer_now(void)
+{
+    unsigned long long cycles;
+
+    if(!tsc_mult)
+    {
+        return lowres_now;
+    }
+
+    cycles = rdtsc() - tsc_base;
+
+    return tsc_offset +
+           (((cycles >> 32) * tsc_mult) << (32 - HRTIMER_TSC_SHIFT)) +
+           (((cycles & 0xFFFFFFFFULL) * tsc_mult) >> HRTIMER_TSC_SHIFT);
+}
+
+
+/*
+ * Get the TSC clocksource parameters.
+ */
+int hrtimer_clocksource(unsigned long long *base, unsigned long long *offset,
+                        unsigned long long *mult)
+{
+    if(!tsc_mult)
+    {
+        return 0;
+    }
+
+    *base = tsc_base;
+    *offset = tsc_offset;
+    *mult = tsc_mult;
+
+    return 1;
+}
+
+
+/*
+ * Switch this cpu to one-shot mode.
+ */
+void hrtimer_init_cpu(int vector)
+{
+    if(!hrtimer_hres_active)
+    {
+        return;
+    }
+
+    lapic_timer_oneshot(vector);
+
+    // the boot processor's PIT is not needed anymore, so stop it by
+    // putting it in one-shot mode without giving it a count
+    if(this_core->cpuid == 0)
+    {
+        outb(0x43, 0x30);
+    }
+}
+
+
+/*
+ * Pairing heap helpers. The caller must hold the base lock.
+ */
+static inline struct hrtimer_t *heap_meld(struct hrtimer_t *a,
+                                          struct hrtimer_t *b)
+{
+    struct hrtimer_t *tmp;
+
+    if(!a)
+    {
+        return b;
+    }
+
+    if(!b)
+    {
+        return a;
+    }
+
+    if(b->expires < a->expires)
+    {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    // b becomes a's first child
+    b->prev = a;
+    b->sibling = a->child;
+
+    if(a->child)
+    {
+        a->child->prev = b;
+    }
+
+    a->child = b;
+    a->sibling = NULL;
+    a->prev = NULL;
+
+    return a;
+}
+
+
+// two-pass merge of a list of siblings into one heap
+static struct hrtimer_t *heap_merge_pairs(struct hrtimer_t *first)
+{
+    struct hrtimer_t *a, *b, *next, *pairs = NULL;
+
+    // first pass: meld pairs from left to right, keeping the results
+    // in a list (in reverse order)
+    while(first)
+    {
+        a = first;
+        b = a->sibling;
+        next = b ? b->sibling : NULL;
+        a->sibling = NULL;
+        a->prev = NULL;
+
+        if(b)
+        {
+            b->sibling = NULL;
+            b->prev = NULL;
+        }
+
+        a = heap_meld(a, b);
+        a->sibling = pairs;
+        pairs = a;
+        first = next;
+    }
+
+    // second pass: meld the results from right to left
+    for(first = NULL; pairs; pairs = next)
+    {
+        next = pairs->sibling;
+        pairs->sibling = NULL;
+        first = heap_meld(first, pairs);
+    }
+
+    return first;
+}
+
+
+static void heap_remove(struct hrtimer_cpu_t *base, struct hrtimer_t *timer)
+{
+    struct hrtimer_t *sub;
+
+    if(timer == base->root)
+    {
+        base->root = heap_merge_pairs(timer->child);
+    }
+    else
+    {
+        // unlink from the sibling list
+        if(timer->prev->child == timer)
+        {
+            timer->prev->child = timer->sibling;
+        }
+        else
+        {
+            timer->prev->sibling = timer->sibling;
+        }
+
+        if(timer->sibling)
+        {
+            timer->sibling->prev = timer->prev;
+        }
+
+        sub = heap_merge_pairs(timer->child);
+        base->root = heap_meld(base->root, sub);
+    }
+
+    timer->child = NULL;
+    timer->sibling = NULL;
+    timer->prev = NULL;
+    timer->queued = 0;
+}
+
+
+static inline void heap_insert(struct hrtimer_cpu_t *base,
+                               struct hrtimer_t *timer)
+{
+    timer->child = NULL;
+    timer->sibling = NULL;
+    timer->prev = NULL;
+    timer->queued = 1;
+    base->root = heap_meld(base->root, timer);
+}
+
+
+/*
+ * Program this cpu's local timer for the first pending timer. The caller
+ * must hold the base lock and have interrupts disabled.
+ */
+static void hrtimer_reprogram(struct hrtimer_cpu_t *base)
+{
+    unsigned long long now, delta;
+
+    if(!hrtimer_hres_active)
+    {
+        return;
+    }
+
+    if(!base->root)
+    {
+        base->next_event = ~0ULL;
+        lapic_timer_arm(0);
+        return;
+    }
+
+    if(base->root->expires == base->next_event)
+    {
+        return;
+    }
+
+    now = hrtimer_now();
+    base->next_event = base->root->expires;
+    delta = (base->next_event > now) ? base->next_event - now : 0;
+
+    if(delta < HRTIMER_MIN_DELTA)
+    {
+        delta = HRTIMER_MIN_DELTA;
+    }
+    else if(delta > lapic_max_ns)
+    {
+        // we will check again when the timer fires
+        delta = lapic_max_ns;
+    }
+
+    lapic_timer_arm((uint32_t)((delta * lapic_mult) >> HRTIMER_TSC_SHIFT));
+}
+
+
+/*
+ * Initialise a timer.
+ */
+void hrtimer_setup(struct hrtimer_t *timer,
+                   int (*func)(struct hrtimer_t *), void *arg)
+{
+    A_memset(timer, 0, sizeof(struct hrtimer_t));
+    timer->func = func;
+    timer->arg = arg;
+    timer->cpu = -1;
+}
+
+
+// remove a timer from whatever queue it is on
+static int __hrtimer_dequeue(struct hrtimer_t *timer)
+{
+    struct hrtimer_cpu_t *base;
+    int cpu, res = 0;
+
+    if((cpu = timer->cpu) < 0)
+    {
+        return 0;
+    }
+
+    base = &hrtimer_cpus[cpu];
+    lock_base(base);
+
+    // the timer is not going to move while we hold the lock, but it might
+    // have expired or been restarted before we got it
+    if(timer->queued && timer->cpu == cpu)
+    {
+        heap_remove(base, timer);
+        res = 1;
+    }
+
+    unlock_base(base);
+
+    return res;
+}
+
+
+/*
+ * Start a timer.
+ */
+void hrtimer_start(struct hrtimer_t *timer, unsigned long long expires)
+{
+    struct hrtimer_cpu_t *base;
+    uintptr_t s;
+
+    s = int_off();
+    __hrtimer_dequeue(timer);
+
+    base = &hrtimer_cpus[this_core->cpuid];
+    lock_base(base);
+    timer->expires = expires;
+    timer->cpu = this_core->cpuid;
+    heap_insert(base, timer);
+
+    if(base->root == timer)
+    {
+        hrtimer_reprogram(base);
+    }
+
+    unlock_base(base);
+    int_on(s);
+}
+
+
+/*
+ * Cancel a timer.
+ */
+int hrtimer_cancel(struct hrtimer_t *timer)
+{
+    struct hrtimer_cpu_t *base;
+    uintptr_t s;
+    int res = 0, cpu;
+
+    /*
+     * If the callback is running on another cpu, wait for it to finish.
+     * It might have restarted the timer, so go round again until the timer
+     * is neither queued nor running. Once it is off the queue, it can only
+     * start running again if someone restarts it.
+     */
+    for(;;)
+    {
+        s = int_off();
+        res |= __hrtimer_dequeue(timer);
+        int_on(s);
+
+        if((cpu = timer->cpu) < 0 || cpu == this_core->cpuid)
+        {
+            break;
+        }
+
+        base = &hrtimer_cpus[cpu];
+
+        if(base->running != timer)
+        {
+            break;
+        }
+
+        while(base->running == timer)
+        {
+            __asm__ __volatile__("pause":::"memory");
+        }
+    }
+
+    return res;
+}
+
+
+/*
+ * Forward a timer.
+ */
+unsigned long hrtimer_forward(struct hrtimer_t *timer, unsigned long long now,
+                              unsigned long long interval)
+{
+    unsigned long long n;
+
+    if(now < timer->expires || !interval)
+    {
+        return 0;
+    }
+
+    n = ((now - timer->expires) / interval) + 1;
+    timer->expires += n * interval;
+
+    return (unsigned long)n;
+}
+
+
+/*
+ * Get the next timer event.
+ */
+unsigned long long hrtimer_next_event(void)
+{
+    struct hrtimer_cpu_t *base = &hrtimer_cpus[this_core->cpuid];
+    unsigned long long res;
+    uintptr_t s;
+
+    s = int_off();
+    lock_base(base);
+    res = base->root ? base->root->expires : ~0ULL;
+    unlock_base(base);
+    int_on(s);
+
+    return res;
+}
+
+
+/*
+ * Handle a timer interrupt.
+ */
+void hrtimer_interrupt(void)
+{
+    struct hrtimer_cpu_t *base = &hrtimer_cpus[this_core->cpuid];
+    struct hrtimer_t *timer;
+    unsigned long long now;
+    int res;
+
+    // without a TSC, the boot processor's periodic interrupt is our clock
+    if(!tsc_mult && this_core->cpuid == 0)
+    {
+        lowres_now += NSECS_PER_TICK;
+    }
+
+    lock_base(base);
+    base->nr_events++;
+    base->next_event = ~0ULL;
+    now = hrtimer_now();
+
+    while((timer = base->root) && timer->expires <= now)
+    {
+        heap_remove(base, timer);
+        base->running = timer;
+        base->nr_expired++;
+        unlock_base(base);
+
+        res = timer->func(timer);
+
+        lock_base(base);
+
+        // the callback (or someone else) might have restarted the timer
+        if(res == HRTIMER_RESTART && !timer->queued)
+        {
+            heap_insert(base, timer);
+        }
+
+        base->running = NULL;
+
+        // don't let a slow callback keep us here forever
+        now = hrtimer_now();
+    }
+
+    hrtimer_reprogram(base);
+    unlock_base(base);
+}
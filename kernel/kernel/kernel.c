@@ -64,11 +64,14 @@
 #include <kernel/kparam.h>
 #include <kernel/smp.h>
 #include <kernel/apic.h>
+#include <kernel/hrtimer.h>
+#include <kernel/epoll.h>
 #include <kernel/ksymtab.h>
 #include <mm/mmngr_virtual.h>
 #include <mm/mmngr_phys.h>
 #include <mm/kheap.h>
 #include <fs/procfs.h>
+#include <fs/readahead.h>
 #include <kernel/net/protocol.h>
 #include <gui/vbe.h>
 #include <gui/fb.h>
@@ -317,6 +320,9 @@ void kernel_main(unsigned long magic, unsigned long addr)
     printk("Initializing APICs..\n");
     apic_init();
 
+    printk("Initializing high resolution timers..\n");
+    hrtimer_init_clock();
+
     printk("Initializing SMP..\n");
     smp_init();
     
@@ -358,7 +364,6 @@ void do_init(void)
 
     sti();
     
-    printk("cpu[%d]: %d\n", this_core->cpuid, scheduler_holding_cpu);
     // init the soft interrupt table before anyone schedules a softint
     //printk("Initializing soft interrupts..\n");
     //softint_init();
@@ -367,7 +372,10 @@ void do_init(void)
     init_clock_waiters();
     //init_itimers();
     init_seltab();
+    epoll_init();
     init_pcache();
+    init_nodes();
+    init_files();
     
     // fork the soft interrupts task
     //(void)start_kernel_task("softint", softint_task_func, NULL,
@@ -402,6 +410,10 @@ void do_init(void)
     (void)start_kernel_task("disk", disk_task_func, NULL,
                             &disk_task, KERNEL_TASK_ELEVATED_PRIORITY);
 
+    // fork the page cache readahead task
+    (void)start_kernel_task("readahead", readahead_task_func, NULL,
+                            &readahead_task, 0);
+
     printk("cpu[%d]: Initializing filesystems..\n", this_core->cpuid);
     init_fstab();
 
@@ -79,6 +79,8 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
     new_task->sig = sig;
     new_task->threads = threads;
     new_task->common = common;
+    new_task->pid = pid;
+    new_task->pid_hash_next = NULL;
     
     init_kernel_mutex(&new_task->task_mutex);
 
@@ -114,8 +116,6 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
     {
         new_task->parent = parent;
 
-        A_memcpy(new_task->ofiles, parent->ofiles, 
-                                sizeof(struct task_files_t));
         A_memcpy(new_task->fs, parent->fs, sizeof(struct task_fs_t));
         A_memcpy(new_task->sig, parent->sig, sizeof(struct task_sig_t));
         A_memcpy(new_task->common, parent->common, 
@@ -131,7 +131,12 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
             return NULL;
         }
 
-        init_kernel_mutex(&new_task->ofiles->mutex);
+        if(task_files_copy(new_task->ofiles, parent->ofiles) != 0)
+        {
+            task_free(new_task);
+            return NULL;
+        }
+
         init_kernel_mutex(&new_task->fs->mutex);
         init_kernel_mutex(&new_task->threads->mutex);
 
@@ -153,7 +158,7 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
         }
 
         /* increment open file refs */
-        for(i = 0; i < NR_OPEN; i++)
+        for(i = 0; i < new_task->ofiles->max_fds; i++)
         {
             /* TODO: this call should take care of releasing file locks */
             if(new_task->ofiles->ofile[i])
@@ -184,8 +189,9 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
     new_task->children = 0;
     new_task->first_child = 0;
     new_task->first_sibling = 0;
-    new_task->pid = pid;
     new_task->next = NULL;
+    new_task->prev = NULL;
+    new_task->queue = NULL;
     //A_memset(&new_task->next, 0, sizeof(new_task->next));
     new_task->minflt = 0;
     new_task->majflt = 0;
@@ -203,6 +209,8 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
     ksigemptyset((sigset_t *)&new_task->signal_pending);
     ksigemptyset(&new_task->signal_caught);
     new_task->woke_by_signal = 0;
+    new_task->selrec = NULL;
+    new_task->signalfd_flags = 0;
     
     /* reset counters */
     new_task->read_count = 0;
@@ -216,6 +224,7 @@ static struct task_t *dup_task(struct task_t *parent, int share_parent_structs)
     /* get rid of uninheritable properties */
     __sync_and_and_fetch(&new_task->properties, ~(PROPERTY_VFORK|PROPERTY_IDLE));
     task_add_child(new_task->parent, new_task);
+    hash_task(new_task);
     
     return new_task;
 }
@@ -41,6 +41,7 @@
 #include <kernel/ksigset.h>
 #include <kernel/timer.h>
 #include <kernel/fpu.h>
+#include <kernel/signalfd.h>
 #include <kernel/asm.h>
 #include <signal.h>
 
@@ -495,6 +496,11 @@ void check_pending_signals(struct regs *r)
     sigset_t permitted_signals;
     sigset_t deliverable_signals;
 
+    if(ct->signalfd_flags & SIGNALFD_DEFERRED)
+    {
+        signalfd_deferred_notify(ct);
+    }
+
     while(!ksigisemptyset((sigset_t *)&ct->signal_pending))
     {
         /* determine which signals are not blocked */
@@ -1245,6 +1251,11 @@ long add_task_signal(struct task_t *task, int signum,
     }
     
     task->siginfo[signum].si_signo = signum;
+
+    if(task->signalfd_flags & SIGNALFD_USED)
+    {
+        signalfd_notify(task);
+    }
     
 
 out:
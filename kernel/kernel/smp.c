@@ -73,8 +73,6 @@ static volatile int ap_startup_flag = 0;
 uintptr_t ap_stack_base_virt = 0;
 uintptr_t ap_stack_base = 0;        // not actually used
 
-volatile int scheduler_holding_cpu = -1;
-
 //volatile uintptr_t address_for_invlpg = 0;
 ///volatile int cpus_pending_invlpg = 0;
 
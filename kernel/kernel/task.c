@@ -64,7 +64,7 @@
 #include "tty_inlines.h"
 
 static struct task_t *task_alloc_internal(int alloc_vm_struct);
-STATIC_INLINE volatile struct task_t *get_next_runnable(void);
+STATIC_INLINE volatile struct task_t *get_next_runnable(struct runqueue_t *rq);
 
 /* next pid for creating new tasks */
 pid_t next_pid = 0;
@@ -74,23 +74,35 @@ pid_t next_pid = 0;
 //struct task_t *idle_task = 0;
 struct task_t *init_task = 0;
 
-/* task run queues and master task table */
-#define NR_QUEUE                100
-
-struct task_queue_t ready_queue[NR_QUEUE];
-struct task_queue_t blocked_queue;
+/* per-cpu run queues, wait queues, zombie queue, and master task table */
+struct runqueue_t runqueues[MAX_CORES];
+struct wait_queue_t wait_queues[NR_WAIT_QUEUES];
 struct task_queue_t zombie_queue;
 
+/* id of the cpu holding the zombie queue, -1 if unlocked */
+static volatile int zombie_queue_holding_cpu = -1;
+
 volatile struct kernel_mutex_t task_table_lock;
 volatile struct kernel_mutex_t scheduler_lock;
-volatile struct task_t *task_table[NR_TASKS];
+volatile int task_table_size = NR_TASKS_DEFAULT;
 int total_tasks = 0;
 
-struct task_t placeholder_task;
+/*
+ * The task table starts with NR_TASKS_DEFAULT slots and is doubled when
+ * full, up to MAX_NR_TASKS.
+ */
+static volatile struct task_t *task_table_init[NR_TASKS_DEFAULT];
+volatile struct task_t **volatile task_table = task_table_init;
+
+/* tasks hashed by pid, and a bitmap of pids in use */
+volatile struct task_t *pid_hash[NR_PID_HASH];
 
-int user_has_ready_tasks = 0;
-int rr_has_ready_tasks = 0;
-int fifo_has_ready_tasks = 0;
+#define PIDMAP_BITS             (sizeof(unsigned long) * 8)
+#define PIDMAP_LONGS            (PID_MAX / PIDMAP_BITS)
+
+static unsigned long pidmap[PIDMAP_LONGS];
+
+struct task_t placeholder_task;
 
 volatile int IRQ_disable_counter = 0;
 
@@ -99,7 +111,7 @@ struct task_t *get_cpu_idle_task(int cpuid)
 {
     int i;
 
-    for(i = 0; i < NR_TASKS; i++)
+    for(i = 0; i < task_table_size; i++)
     {
         if(task_table[i] == NULL)
         {
@@ -126,7 +138,7 @@ void create_idle_task(int taskid)
 
     // we don't need to lock the task table here as we now we are the only
     // code accessing it during boot time
-    for(i = 0; i < NR_TASKS; i++)
+    for(i = 0; i < task_table_size; i++)
     {
         if(task_table[i] == NULL)
         {
@@ -135,6 +147,8 @@ void create_idle_task(int taskid)
         }
     }
 
+    pidmap[taskid / PIDMAP_BITS] |= (1UL << (taskid % PIDMAP_BITS));
+
     __atomic_fetch_add(&total_tasks, 1, __ATOMIC_SEQ_CST);
 
     //sti();
@@ -168,6 +182,10 @@ void create_idle_task(int taskid)
     cur_task->threads->tgid = cur_task->pid;
     cur_task->thread_group_next = NULL;
 
+    // no need to lock, see above
+    cur_task->pid_hash_next = pid_hash[pid_hashfn(cur_task->pid)];
+    pid_hash[pid_hashfn(cur_task->pid)] = cur_task;
+
     cur_task->ldt.base = 0;
     cur_task->ldt.limit = 0xFFFFFFFF;
 
@@ -189,6 +207,7 @@ void create_idle_task(int taskid)
     }
 
     cur_task->cpuid = this_core->cpuid; // we will fix this later in ap_main()
+    cur_task->last_cpu = taskid - 2;
     cur_task->state = TASK_RUNNING;
     
     set_task_rlimits(cur_task);
@@ -202,22 +221,27 @@ void tasking_init(void)
 {
     int i;
 
-    A_memset(&ready_queue, 0, sizeof(ready_queue));
-    A_memset(&blocked_queue, 0, sizeof(blocked_queue));
+    A_memset(&runqueues, 0, sizeof(runqueues));
+    A_memset(&wait_queues, 0, sizeof(wait_queues));
     A_memset(&zombie_queue, 0, sizeof(zombie_queue));
-    A_memset((void *)task_table, 0, sizeof(struct task_t *) * NR_TASKS);
+    A_memset((void *)task_table_init, 0, sizeof(task_table_init));
+    A_memset((void *)pid_hash, 0, sizeof(pid_hash));
+    A_memset(pidmap, 0, sizeof(pidmap));
     A_memset(&placeholder_task, 0, sizeof(struct task_t));
 
-    for(i = 0; i < NR_QUEUE; i++)
+    // pid 0 is never handed out
+    pidmap[0] = 1;
+
+    for(i = 0; i < MAX_CORES; i++)
     {
-        ready_queue[i].head.next = &ready_queue[i].head;
-        ready_queue[i].head.prev = &ready_queue[i].head;
+        runqueues[i].holding_cpu = -1;
+        runqueues[i].cpuid = i;
     }
 
-    blocked_queue.head.next = &blocked_queue.head;
-    blocked_queue.head.prev = &blocked_queue.head;
-    zombie_queue.head.next = &zombie_queue.head;
-    zombie_queue.head.prev = &zombie_queue.head;
+    for(i = 0; i < NR_WAIT_QUEUES; i++)
+    {
+        wait_queues[i].holding_cpu = -1;
+    }
   
     init_kernel_mutex(&task_table_lock);
     init_kernel_mutex(&scheduler_lock);
@@ -244,72 +268,166 @@ void tasking_init(void)
 
 
 /**
- * @brief Lock the scheduler.
+ * @brief Lock a scheduler queue.
  *
- * Lock the scheduler.
+ * Spin until we get the given queue lock, which holds the id of the cpu
+ * holding it (or -1 if unlocked). Interrupts should be disabled by the caller.
  *
- * The following function is taken from:
+ * The following function is based on the scheduler lock from:
  *    https://wiki.osdev.org/Brendan%27s_Multi-tasking_Tutorial
  *
+ * @param   lock    the lock
+ *
  * @return  nothing.
  */
-static inline void __lock_scheduler(void)
+static inline void __spin_lock(volatile int *lock)
 {
-    __set_cpu_flag(SMP_FLAG_SCHEDULER_BUSY);
-    //this_core->flags |= SMP_FLAG_SCHEDULER_BUSY;
-
-    while(!__sync_bool_compare_and_swap(&scheduler_holding_cpu, -1, this_core->cpuid))
+    while(!__sync_bool_compare_and_swap(lock, -1, this_core->cpuid))
     {
-        if(scheduler_holding_cpu == this_core->cpuid)
+        if(*lock == this_core->cpuid)
         {
             __asm__ __volatile__("xchg %%bx, %%bx":::);
             break;
         }
+
+        __asm__ __volatile__("pause":::"memory");
     }
 }
 
+static inline void __spin_unlock(volatile int *lock)
+{
+    __sync_bool_compare_and_swap(lock, this_core->cpuid, -1);
+}
+
+/*
+ * Lock/unlock a run queue.
+ */
+static inline void __lock_runqueue(struct runqueue_t *rq)
+{
+    __set_cpu_flag(SMP_FLAG_SCHEDULER_BUSY);
+    __spin_lock(&rq->holding_cpu);
+}
+
+static inline void __unlock_runqueue(struct runqueue_t *rq)
+{
+    __spin_unlock(&rq->holding_cpu);
+    __clear_cpu_flag(SMP_FLAG_SCHEDULER_BUSY);
+}
+
+/*
+ * Lock the run queue the given task is on. The task might be pulled to
+ * another cpu's run queue while we wait for the lock, so check again once
+ * we have it.
+ */
+static inline struct runqueue_t *__lock_task_runqueue(volatile struct task_t *t)
+{
+    struct runqueue_t *rq;
+
+    for(;;)
+    {
+        rq = task_runqueue(t);
+        __lock_runqueue(rq);
+
+        if(rq == task_runqueue(t))
+        {
+            return rq;
+        }
+
+        __unlock_runqueue(rq);
+    }
+}
+
+/*
+ * Lock/unlock the wait queue of the given wait channel. If we need a run
+ * queue lock as well, the wait queue lock must be taken first.
+ */
+static inline struct wait_queue_t *__lock_wait_queue(void *wait_channel)
+{
+    uintptr_t h = (uintptr_t)wait_channel >> 3;
+    struct wait_queue_t *wq;
+
+    h ^= (h >> WAIT_HASH_BITS) ^ (h >> (WAIT_HASH_BITS * 2));
+    wq = &wait_queues[h & (NR_WAIT_QUEUES - 1)];
+    __spin_lock(&wq->holding_cpu);
+
+    return wq;
+}
+
+static inline void __unlock_wait_queue(struct wait_queue_t *wq)
+{
+    __spin_unlock(&wq->holding_cpu);
+}
+
+/*
+ * Lock/unlock this cpu's run queue.
+ */
+static inline void __lock_scheduler(void)
+{
+    __lock_runqueue(&runqueues[this_core->cpuid]);
+}
+
 static inline uintptr_t lock_scheduler(void)
 {
     uintptr_t s = int_off();
     __lock_scheduler();
     return s;
-
-    /*
-    __asm__ __volatile__ ("cli");
-    IRQ_disable_counter++;
-    */
 }
 
-/**
- * @brief Unlock the scheduler.
- *
- * Unlock the scheduler.
- *
- * The following function is taken from:
- *    https://wiki.osdev.org/Brendan%27s_Multi-tasking_Tutorial
- *
- * @return  nothing.
- */
 static inline void __unlock_scheduler(void)
 {
-    __sync_bool_compare_and_swap(&scheduler_holding_cpu, this_core->cpuid, -1);
-    __clear_cpu_flag(SMP_FLAG_SCHEDULER_BUSY);
-    //this_core->flags &= ~SMP_FLAG_SCHEDULER_BUSY;
+    __unlock_runqueue(&runqueues[this_core->cpuid]);
 }
 
 static inline void unlock_scheduler(uintptr_t s)
 {
     __unlock_scheduler();
     int_on(s);
+}
 
-    /*
-    IRQ_disable_counter--;
+/*
+ * Called by a newly forked task when it first runs (see resume_user in
+ * syscall_dispatcher.S), to release the run queue lock taken by the
+ * scheduler before it switched to us.
+ */
+void unlock_scheduler_no_sti(void)
+{
+    __unlock_scheduler();
+}
+
+/*
+ * Lock the wait queue and the run queue of the given task, in that order.
+ * If the task is blocked, we get the wait queue it is sleeping in. As the
+ * task can go to sleep on another wait channel while we wait for the locks,
+ * check again once we have them. Tasks that are not on any wait queue
+ * cannot move onto one while we hold their run queue lock.
+ */
+static inline struct wait_queue_t *__lock_task_queues(volatile struct task_t *t)
+{
+    struct wait_queue_t *wq;
+    struct runqueue_t *rq;
 
-    if(IRQ_disable_counter == 0)
+    for(;;)
     {
-        __asm__ __volatile__ ("sti");
+        wq = __lock_wait_queue(t->wait_channel);
+        rq = __lock_task_runqueue(t);
+
+        if(t->queue == &wq->queue ||
+           (uintptr_t)t->queue < (uintptr_t)&wait_queues[0] ||
+           (uintptr_t)t->queue >= (uintptr_t)&wait_queues[NR_WAIT_QUEUES])
+        {
+            return wq;
+        }
+
+        __unlock_runqueue(rq);
+        __unlock_wait_queue(wq);
     }
-    */
+}
+
+static inline void __unlock_task_queues(volatile struct task_t *t,
+                                        struct wait_queue_t *wq)
+{
+    __unlock_runqueue(task_runqueue(t));
+    __unlock_wait_queue(wq);
 }
 
 
@@ -321,6 +439,7 @@ void scheduler(void)
     cli();
     __lock_scheduler();
 
+    struct runqueue_t *rq = &runqueues[this_core->cpuid];
     volatile struct task_t *t = this_core->cur_task;
 
     if(t->state == TASK_RUNNING)
@@ -351,7 +470,7 @@ void scheduler(void)
         }
         else if(t->sched_policy == SCHED_OTHER)
         {
-            if(t->next)
+            if(t->queue)
             {
                 move_to_queue_end(t);
             }
@@ -375,7 +494,7 @@ void scheduler(void)
     }
 
 
-    volatile struct task_t *next = get_next_runnable();
+    volatile struct task_t *next = get_next_runnable(rq);
 
     // XXX: task selected too soon, wait for the other processor to release it
     if(next->state != TASK_READY ||
@@ -393,6 +512,7 @@ void scheduler(void)
     {
         t->cpuid = -1;
         system_context_switches++;
+        rq->nr_switches++;
 
 #ifdef __x86_64__
         fpu_state_save(t);
@@ -583,7 +703,7 @@ static struct task_t *task_alloc_internal(int alloc_vm_struct)
         return NULL;
     }
 
-    A_memset(new_task->ofiles, 0, sizeof(struct task_files_t));
+    task_files_init(new_task->ofiles);
     A_memset(new_task->fs, 0, sizeof(struct task_fs_t));
     A_memset(new_task->sig, 0, sizeof(struct task_sig_t));
     A_memset(new_task->threads, 0, sizeof(struct task_threads_t));
@@ -602,54 +722,210 @@ static struct task_t *task_alloc_internal(int alloc_vm_struct)
 
 
 /*
- * Allocate a new task struct.
+ * Find a free pid, starting after the last one we handed out, and mark it
+ * as used. Pids wrap around to 1 when we reach PID_MAX.
+ * Must be called with task_table_lock held.
+ */
+static pid_t alloc_pid(void)
+{
+    unsigned long bits;
+    int pid = next_pid + 1;
+    int i, j;
+
+    if(pid <= 0 || pid >= PID_MAX)
+    {
+        pid = 1;
+    }
+
+    // the first word is checked twice, as we might have started midway
+    for(i = 0; i <= (int)PIDMAP_LONGS; i++)
+    {
+        j = pid / PIDMAP_BITS;
+        bits = ~pidmap[j] & (~0UL << (pid % PIDMAP_BITS));
+
+        if(bits)
+        {
+            pid = (j * PIDMAP_BITS) + __builtin_ctzl(bits);
+            pidmap[j] |= (1UL << (pid % PIDMAP_BITS));
+            next_pid = pid;
+            return pid;
+        }
+
+        // pid 0 is always marked as used, so this is safe
+        pid = ((j + 1) % PIDMAP_LONGS) * PIDMAP_BITS;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Must be called with task_table_lock held.
+ */
+static void free_pid(pid_t pid)
+{
+    if(pid > 0 && pid < PID_MAX)
+    {
+        pidmap[pid / PIDMAP_BITS] &= ~(1UL << (pid % PIDMAP_BITS));
+    }
+}
+
+
+/*
+ * Must be called with task_table_lock held.
+ */
+static void unhash_task(volatile struct task_t *task)
+{
+    volatile struct task_t *volatile *p = &pid_hash[pid_hashfn(task->pid)];
+
+    for( ; *p != NULL; p = &((*p)->pid_hash_next))
+    {
+        if(*p == task)
+        {
+            *p = task->pid_hash_next;
+            break;
+        }
+    }
+
+    task->pid_hash_next = NULL;
+}
+
+
+void hash_task(volatile struct task_t *task)
+{
+    volatile struct task_t **p = &pid_hash[pid_hashfn(task->pid)];
+
+    elevated_priority_lock(&task_table_lock);
+    task->pid_hash_next = *p;
+    *p = task;
+    elevated_priority_unlock(&task_table_lock);
+}
+
+
+long task_change_pid(volatile struct task_t *task, pid_t pid)
+{
+    elevated_priority_lock(&task_table_lock);
+
+    if(pid <= 0 || pid >= PID_MAX ||
+       (pidmap[pid / PIDMAP_BITS] & (1UL << (pid % PIDMAP_BITS))))
+    {
+        elevated_priority_unlock(&task_table_lock);
+        return -EEXIST;
+    }
+
+    unhash_task(task);
+    free_pid(task->pid);
+
+    pidmap[pid / PIDMAP_BITS] |= (1UL << (pid % PIDMAP_BITS));
+    task->pid = pid;
+    task->pid_hash_next = pid_hash[pid_hashfn(pid)];
+    pid_hash[pid_hashfn(pid)] = task;
+
+    elevated_priority_unlock(&task_table_lock);
+
+    return 0;
+}
+
+
+/*
+ * Double the size of the task table. The old table is not freed, as other
+ * code might still be walking it without holding task_table_lock (the
+ * memory lost this way is less than the size of the final table).
  *
- * As this function is only called during fork/clone, we don't bother 
- * allocating memory for the new task's vm struct, as fork/clone will
- * free the vm struct and make a copy (fork) or use the parent's vm
- * struct (clone).
+ * Returns 1 if the table was expanded (by us or someone else), 0 if it is
+ * already at its maximum size or we are out of memory.
  */
-struct task_t *task_alloc(void)
+static int task_table_expand(void)
 {
-    if(total_tasks >= NR_TASKS)
+    volatile struct task_t **newtab;
+    int oldsize = task_table_size;
+    int newsize = oldsize * 2;
+
+    if(oldsize >= MAX_NR_TASKS)
     {
-        return NULL;
+        return 0;
     }
 
-retry:
+    if(newsize > MAX_NR_TASKS)
+    {
+        newsize = MAX_NR_TASKS;
+    }
 
-    __sync_fetch_and_add(&next_pid, 1);
-    
-    /* account for pid roundup */
-    if(next_pid < 0)
+    if(!(newtab = kmalloc(newsize * sizeof(struct task_t *))))
     {
-        __atomic_store_n(&next_pid, 1, __ATOMIC_SEQ_CST);
+        return 0;
     }
 
-    /* find an empty slot in the task table */
+    A_memset((void *)newtab, 0, newsize * sizeof(struct task_t *));
+
+    elevated_priority_lock(&task_table_lock);
+
+    if(task_table_size != oldsize)
+    {
+        elevated_priority_unlock(&task_table_lock);
+        kfree((void *)newtab);
+        return 1;
+    }
+
+    A_memcpy((void *)newtab, (void *)task_table,
+             oldsize * sizeof(struct task_t *));
+
+    // publish the new table before its size (see for_each_taskptr)
+    __atomic_store_n(&task_table, newtab, __ATOMIC_RELEASE);
+    __atomic_store_n(&task_table_size, newsize, __ATOMIC_RELEASE);
+
+    elevated_priority_unlock(&task_table_lock);
+
+    return 1;
+}
+
+
+/*
+ * Allocate a new task struct.
+ *
+ * As this function is only called during fork/clone, we don't bother 
+ * allocating memory for the new task's vm struct, as fork/clone will
+ * free the vm struct and make a copy (fork) or use the parent's vm
+ * struct (clone).
+ *
+ * The new task is not added to the pid hash until the caller calls
+ * hash_task().
+ */
+struct task_t *task_alloc(void)
+{
+    struct task_t *new_task;
     volatile int i;
+    pid_t pid;
 
+    /* find an empty slot in the task table */
     elevated_priority_lock(&task_table_lock);
 
-    for(i = 0; i < NR_TASKS; i++)
+    while(1)
     {
-        /* account for reused pids */
-        if(task_table[i] && task_table[i]->pid == next_pid)
+        for(i = 1; i < task_table_size; i++)
         {
-            elevated_priority_unlock(&task_table_lock);
-            goto retry;
+            if(task_table[i] == NULL)
+            {
+                break;
+            }
         }
-    }
 
-    for(i = 1; i < NR_TASKS; i++)
-    {
-        if(task_table[i] == NULL)
+        if(i < task_table_size)
         {
             break;
         }
+
+        elevated_priority_unlock(&task_table_lock);
+
+        if(!task_table_expand())
+        {
+            return NULL;
+        }
+
+        elevated_priority_relock(&task_table_lock);
     }
-    
-    if(i == NR_TASKS)
+
+    if(!(pid = alloc_pid()))
     {
         elevated_priority_unlock(&task_table_lock);
         return NULL;
@@ -658,20 +934,24 @@ retry:
     // mark as used so we can unlock the table
     task_table[i] = &placeholder_task;
     elevated_priority_unlock(&task_table_lock);
-        
-    /* try to find a previously allocated task struct in the cache */
-    struct task_t *new_task;
 
     if(!(new_task = task_alloc_internal(0)))
     {
+        elevated_priority_relock(&task_table_lock);
         task_table[i] = NULL;
+        free_pid(pid);
+        elevated_priority_unlock(&task_table_lock);
         return NULL;
     }
 
+    new_task->pid = pid;
+
+    // the table might have been expanded, so use the current one
+    elevated_priority_relock(&task_table_lock);
     task_table[i] = new_task;
-    __atomic_fetch_add(&total_tasks, 1, __ATOMIC_SEQ_CST);
+    elevated_priority_unlock(&task_table_lock);
 
-    new_task->pid = next_pid;
+    __atomic_fetch_add(&total_tasks, 1, __ATOMIC_SEQ_CST);
 
     return new_task;
 }
@@ -686,7 +966,7 @@ void task_free(volatile struct task_t *task)
 
     elevated_priority_lock(&task_table_lock);
 
-    for(i = 0; i < NR_TASKS; i++)
+    for(i = 0; i < task_table_size; i++)
     {
         if(task_table[i] == task)
         {
@@ -696,10 +976,14 @@ void task_free(volatile struct task_t *task)
         }
     }
 
+    unhash_task(task);
+    free_pid(task->pid);
+
     elevated_priority_unlock(&task_table_lock);
 
     if(task->ofiles)
     {
+        task_files_free(task->ofiles);
         kfree(task->ofiles);
     }
 
@@ -732,25 +1016,84 @@ void task_free(volatile struct task_t *task)
 }
 
 
+static int __block_task(void *wait_channel, int interruptible, int exclusive,
+                        volatile struct kernel_mutex_t *lock,
+                        int (*done)(void *), void *arg);
+static int __block_task2(void *wait_channel, int timeout_ticks,
+                         volatile struct kernel_mutex_t *lock,
+                         int (*done)(void *), void *arg);
+
+
 /*
  * Block task with timeout.
  */
 int block_task2(void *wait_channel, int timeout_ticks)
+{
+    return __block_task2(wait_channel, timeout_ticks, NULL, NULL, NULL);
+}
+
+
+/*
+ * Block task with timeout and release the given lock.
+ */
+int block_task2_and_unlock(void *wait_channel, int timeout_ticks,
+                           volatile struct kernel_mutex_t *lock)
+{
+    return __block_task2(wait_channel, timeout_ticks, lock, NULL, NULL);
+}
+
+
+/*
+ * Block task with timeout, unless the given condition is already true
+ * once we are on the wait queue.
+ */
+int block_task2_unless(void *wait_channel, int timeout_ticks,
+                       int (*done)(void *), void *arg)
+{
+    return __block_task2(wait_channel, timeout_ticks, NULL, done, arg);
+}
+
+
+static int __block_task2(void *wait_channel, int timeout_ticks,
+                         volatile struct kernel_mutex_t *lock,
+                         int (*done)(void *), void *arg)
 {
     volatile struct task_t *t = this_core->cur_task;
-    
+    struct clock_waiter_t *w = NULL;
+    int64_t remaining = 0;
+
+    /*
+     * Arm a clock waiter to wake us up when the timeout expires. The
+     * softsleep task wakes us by pid, so we can still sleep on our wait
+     * channel and be woken early by unblock_tasks().
+     */
     if(timeout_ticks)
     {
-        if(clock_wait(&waiter_head[0], t->pid, timeout_ticks, 0) == 0)
+        if(!(w = clock_add_waiter(&waiter_head[0], t->pid,
+                                  (int64_t)timeout_ticks * NSECS_PER_TICK, 0)))
         {
-            return EWOULDBLOCK;
+            if(lock)
+            {
+                kernel_mutex_unlock(lock);
+            }
+
+            return 0;
         }
     }
-    else
+
+    __block_task(wait_channel, 1, 0, lock, done, arg);
+
+    if(w)
     {
-        block_task(wait_channel, 1);
+        (void)get_waiter(&waiter_head[0], t->pid, 0, &remaining, 1);
+        waiter_free(w);
+
+        if(remaining <= 0)
+        {
+            return EWOULDBLOCK;
+        }
     }
-    
+
 	if(t->woke_by_signal /* && t->woke_by_signal != SIGCONT */)
 	{
 	    return EINTR;
@@ -802,14 +1145,65 @@ static inline int has_pending_signals(volatile struct task_t *task)
 }
 
 
+STATIC_INLINE void unblock_task_unlocked(volatile struct task_t *task)
+{
+    if(task == NULL ||
+       task->state == TASK_READY || task->state == TASK_RUNNING ||
+       task->state == TASK_ZOMBIE)
+    {
+        // task is already unblocked or dead
+        return;
+    }
+
+    task->state = TASK_READY;
+    task->wait_channel = NULL;
+    __sync_and_and_fetch(&task->properties, ~PROPERTY_EXCLUSIVE_WAIT);
+    remove_from_queue(task);
+
+    /*
+     * The sched (7) manpage says:
+     *    When a blocked SCHED_FIFO thread becomes runnable, it will be
+     *    inserted at the end of the list for its priority.
+     */
+    append_to_ready_queue(task);
+}
+
+
 /*
- * Block task.
+ * Move the current task to the wait queue of the given wait channel, and
+ * sleep. If lock is not NULL, it is released once we are on the wait queue.
+ * If done is not NULL, it is called once we are on the wait queue, and we
+ * don't sleep if it returns non-zero.
  */
-int block_task(void *wait_channel, int interruptible)
+static int __block_task(void *wait_channel, int interruptible, int exclusive,
+                        volatile struct kernel_mutex_t *lock,
+                        int (*done)(void *), void *arg)
 {
-    uintptr_t s = lock_scheduler();
-
     volatile struct task_t *t = this_core->cur_task;
+    uintptr_t s = int_off();
+    struct wait_queue_t *wq = __lock_wait_queue(wait_channel);
+    struct runqueue_t *rq = __lock_task_runqueue(t);
+
+    t->wait_channel = wait_channel;
+    t->state = interruptible ? TASK_SLEEPING : TASK_WAITING;
+
+    if(exclusive)
+    {
+        __sync_or_and_fetch(&t->properties, PROPERTY_EXCLUSIVE_WAIT);
+    }
+
+    remove_from_ready_queue(t);
+    append_to_queue(t, &wq->queue);
+
+    /*
+     * Release the caller's lock only after we are on the wait queue.
+     * A waker that grabs the lock after this point will find us sleeping
+     * and can unblock us, so the wakeup cannot be lost in between.
+     */
+    if(lock)
+    {
+        kernel_mutex_unlock(lock);
+    }
 
     if(t->lock_held /* != &scheduler_lock */)
     {
@@ -817,12 +1211,25 @@ int block_task(void *wait_channel, int interruptible)
         kpanic("task sleeping with a held lock!\n");
     }
 
-    t->wait_channel = wait_channel;
-    t->state = interruptible ? TASK_SLEEPING : TASK_WAITING;
+    /*
+     * A waker that changed the condition before we got here has either
+     * found us on the wait queue, or its change is visible to us now.
+     */
+    if(done && done(arg))
+    {
+        t->woke_by_signal = 0;
+        unblock_task_unlocked(t);
+        t->state = TASK_RUNNING;
+        __unlock_runqueue(rq);
+        __unlock_wait_queue(wq);
+        int_on(s);
 
-    remove_from_ready_queue(t);
-    append_to_queue(t, &blocked_queue);
-    unlock_scheduler(s);
+        return interruptible;
+    }
+
+    __unlock_runqueue(rq);
+    __unlock_wait_queue(wq);
+    int_on(s);
 
     if(interruptible)
     {
@@ -846,60 +1253,80 @@ int block_task(void *wait_channel, int interruptible)
 }
 
 
-STATIC_INLINE void unblock_task_unlocked(volatile struct task_t *task)
+/*
+ * Block task.
+ */
+int block_task(void *wait_channel, int interruptible)
 {
-    if(task == NULL ||
-       task->state == TASK_READY || task->state == TASK_RUNNING ||
-       task->state == TASK_ZOMBIE)
-    {
-        // task is already unblocked or dead
-        return;
-    }
+    return __block_task(wait_channel, interruptible, 0, NULL, NULL, NULL);
+}
 
-    task->state = TASK_READY;
-    task->wait_channel = NULL;
-    remove_from_queue(task);
 
-    /*
-     * The sched (7) manpage says:
-     *    When a blocked SCHED_FIFO thread becomes runnable, it will be
-     *    inserted at the end of the list for its priority.
-     */
-    append_to_ready_queue(task);
+/*
+ * Block task as an exclusive waiter.
+ */
+int block_task_exclusive(void *wait_channel, int interruptible)
+{
+    return __block_task(wait_channel, interruptible, 1, NULL, NULL, NULL);
 }
 
 
 /*
- * Unblock tasks.
+ * Block task and release the given lock.
  */
-void unblock_tasks(void *wait_channel)
+int block_task_and_unlock(void *wait_channel, int interruptible,
+                          volatile struct kernel_mutex_t *lock)
 {
-    uintptr_t s = lock_scheduler();
+    return __block_task(wait_channel, interruptible, 0, lock, NULL, NULL);
+}
 
-    //volatile struct task_t *ct = this_core->cur_task;
-    volatile struct task_t *t = blocked_queue.head.next, *next;
-    //int runrun = 0;
 
-    while(t != &blocked_queue.head)
+/*
+ * Wake up tasks sleeping on the given wait channel, in the order they went
+ * to sleep. All non-exclusive waiters are woken, along with up to
+ * nr_exclusive exclusive waiters (all of them if nr_exclusive is negative).
+ * If wake_one is non-zero, only the first waiter is woken.
+ */
+static int __unblock_tasks(void *wait_channel, int nr_exclusive, int wake_one)
+{
+    uintptr_t s = int_off();
+    struct wait_queue_t *wq = __lock_wait_queue(wait_channel);
+    struct runqueue_t *rq;
+    volatile struct task_t *t, *next;
+    int woken = 0;
+
+    for(t = wq->queue.head; t != NULL; t = next)
     {
-        next = (struct task_t *)t->next;
+        next = t->next;
 
-        if(t->wait_channel == wait_channel && t->state != TASK_ZOMBIE)
+        if(t->wait_channel != wait_channel || t->state == TASK_ZOMBIE)
         {
-            unblock_task_unlocked(t);
+            continue;
+        }
 
-            /*
-            if(t->priority > ct->priority)
+        if(t->properties & PROPERTY_EXCLUSIVE_WAIT)
+        {
+            if(nr_exclusive == 0)
             {
-                runrun++;
+                continue;
             }
-            */
+
+            nr_exclusive--;
         }
 
-        t = next;
+        rq = __lock_task_runqueue(t);
+        unblock_task_unlocked(t);
+        __unlock_runqueue(rq);
+        woken++;
+
+        if(wake_one)
+        {
+            break;
+        }
     }
 
-    unlock_scheduler(s);
+    __unlock_wait_queue(wq);
+    int_on(s);
 
     /*
      * The sched (7) manpage says:
@@ -907,13 +1334,38 @@ void unblock_tasks(void *wait_channel)
      *    thread of higher priority will stay at the head of the list
      *    for its priority and will resume execution as soon as all
      *    threads of higher priority are blocked again.
+     *
+     * So we don't preempt the current task here.
      */
-    /*
-    if(runrun)
-    {
-        scheduler();
-    }
-    */
+
+    return woken;
+}
+
+
+/*
+ * Unblock tasks.
+ */
+void unblock_tasks(void *wait_channel)
+{
+    __unblock_tasks(wait_channel, 1, 0);
+}
+
+
+/*
+ * Unblock all tasks, including exclusive waiters.
+ */
+int unblock_all_tasks(void *wait_channel)
+{
+    return __unblock_tasks(wait_channel, -1, 0);
+}
+
+
+/*
+ * Unblock the task that has been waiting the longest.
+ */
+int unblock_one_task(void *wait_channel)
+{
+    return __unblock_tasks(wait_channel, -1, 1);
 }
 
 
@@ -922,16 +1374,28 @@ void unblock_tasks(void *wait_channel)
  */
 void unblock_task_no_preempt(volatile struct task_t *task)
 {
-    if(this_core->cpuid == scheduler_holding_cpu)
+    uintptr_t s;
+    struct wait_queue_t *wq;
+
+    if(task == NULL)
     {
-        unblock_task_unlocked(task);
+        return;
     }
-    else
+
+    s = int_off();
+
+    // the wait queue lock must be taken before the run queue lock
+    if(task_runqueue(task)->holding_cpu == this_core->cpuid)
     {
-        uintptr_t s = lock_scheduler();
-        unblock_task_unlocked(task);
-        unlock_scheduler(s);
+        __asm__ __volatile__("xchg %%bx, %%bx"::);
+        kpanic("unblocking a task with its run queue held!\n");
     }
+
+    wq = __lock_task_queues(task);
+    unblock_task_unlocked(task);
+    __unlock_task_queues(task, wq);
+
+    int_on(s);
 }
 
 
@@ -940,9 +1404,19 @@ void unblock_task_no_preempt(volatile struct task_t *task)
  */
 void unblock_task(volatile struct task_t *task)
 {
-    uintptr_t s = lock_scheduler();
+    uintptr_t s;
+    struct wait_queue_t *wq;
+
+    if(task == NULL)
+    {
+        return;
+    }
+
+    s = int_off();
+    wq = __lock_task_queues(task);
     unblock_task_unlocked(task);
-    unlock_scheduler(s);
+    __unlock_task_queues(task, wq);
+    int_on(s);
 
     /*
      * The sched (7) manpage says:
@@ -960,7 +1434,8 @@ void unblock_task(volatile struct task_t *task)
 
 void append_to_ready_queue_locked(volatile struct task_t *task, int move_queue)
 {
-    uintptr_t s = lock_scheduler();
+    uintptr_t s = int_off();
+    struct wait_queue_t *wq = __lock_task_queues(task);
 
     if(move_queue)
     {
@@ -969,15 +1444,19 @@ void append_to_ready_queue_locked(volatile struct task_t *task, int move_queue)
 
     append_to_ready_queue(task);
 
-    unlock_scheduler(s);
+    __unlock_task_queues(task, wq);
+    int_on(s);
 }
 
 
 void move_to_queue_end_locked(volatile struct task_t *task)
 {
-    uintptr_t s = lock_scheduler();
+    uintptr_t s = int_off();
+    struct runqueue_t *rq = __lock_task_runqueue(task);
+
     move_to_queue_end(task);
-    unlock_scheduler(s);
+    __unlock_runqueue(rq);
+    int_on(s);
 }
 
 
@@ -985,7 +1464,8 @@ void task_change_priority(volatile struct task_t *t, int new_prio, int new_polic
 {
     int old_prio = t->priority;
 
-    uintptr_t s = lock_scheduler();
+    uintptr_t s = int_off();
+    struct runqueue_t *rq = __lock_task_runqueue(t);
 
     t->sched_policy = new_policy;
     
@@ -1028,7 +1508,8 @@ void task_change_priority(volatile struct task_t *t, int new_prio, int new_polic
         t->priority = new_prio;
     }
 
-    unlock_scheduler(s);
+    __unlock_runqueue(rq);
+    int_on(s);
 }
 
 
@@ -1056,26 +1537,26 @@ void schedule_and_block(volatile struct task_t *tracer, volatile struct task_t *
     // Ensure we don't get scheduled as we need the tracer to be scheduled
     // to run before we go to sleep, waiting for it. This is why we do this
     // manually, instead of calling block_task() and unblock_task().
-    uintptr_t s = lock_scheduler();
-
-    // unblock the tracer
-    if(tracer->state != TASK_READY && tracer->state != TASK_RUNNING)
-    {
-        tracer->state = TASK_READY;
-        tracer->wait_channel = NULL;
-
-        KDEBUG("%s: pid %d\n", __func__, tracer->pid);
-        remove_from_queue(tracer);
-        append_to_ready_queue(tracer);
-    }
+    uintptr_t s = int_off();
+    struct wait_queue_t *wq = __lock_wait_queue(NULL);
+    struct runqueue_t *rq;
 
-    // block the tracee
+    // block the tracee first, so the tracer can't wake us up before we
+    // are on the wait queue
+    rq = __lock_task_runqueue(tracee);
     tracee->state = TASK_WAITING;
+    tracee->wait_channel = NULL;
 
     KDEBUG("%s: pid %d\n", __func__, tracee->pid);
     remove_from_ready_queue(tracee);
-    append_to_queue(tracee, &blocked_queue);
-    unlock_scheduler(s);
+    append_to_queue(tracee, &wq->queue);
+    __unlock_runqueue(rq);
+    __unlock_wait_queue(wq);
+
+    // unblock the tracer
+    KDEBUG("%s: pid %d\n", __func__, tracer->pid);
+    unblock_task_no_preempt(tracer);
+    int_on(s);
 
     scheduler();
 }
@@ -1085,7 +1566,7 @@ STATIC_INLINE volatile struct task_t *next_queue_runnable(struct task_queue_t *q
 {
     volatile struct task_t *task, *cur = this_core->cur_task;
 
-    for(task = queue->head.next; task != &queue->head; task = task->next)
+    for(task = queue->head; task != NULL; task = task->next)
     {
         if(task != cur && task->state == TASK_READY && task->cpuid == -1)
         {
@@ -1097,23 +1578,79 @@ STATIC_INLINE volatile struct task_t *next_queue_runnable(struct task_queue_t *q
 }
 
 
-STATIC_INLINE volatile struct task_t *get_next_runnable(void)
+/*
+ * Pull a ready task from the busiest cpu's run queue onto ours. Called with
+ * our run queue locked when we have nothing else to run.
+ */
+STATIC_INLINE volatile struct task_t *steal_task(struct runqueue_t *rq)
 {
-    /* search queues, in turn, for a ready-to-run task */
+    struct runqueue_t *victim = NULL, *tmp;
     struct task_queue_t *queue;
-    volatile struct task_t *task;
+    volatile struct task_t *task = NULL;
+    int i, len, busiest = 1;
 
-    if(rr_has_ready_tasks)
+    /*
+     * The busiest cpu is the one with the most queued tasks. A queue with
+     * one task is not worth looking at, as that is probably the task running
+     * on that cpu.
+     */
+    for(i = 0; i < processor_count; i++)
     {
-        for(queue = &ready_queue[MAX_RR_PRIO];
-            queue >= &ready_queue[MIN_RR_PRIO]; queue--)
+        tmp = &runqueues[i];
+
+        if(tmp != rq && (len = runqueue_length(tmp)) > busiest)
         {
-            /*
-            if(queue->head.next != &queue->head)
+            busiest = len;
+            victim = tmp;
+        }
+    }
+
+    /*
+     * Don't spin on the other cpu's lock while we hold ours, as it might be
+     * trying to do the same thing. If it is busy, we will try again on the
+     * next tick.
+     */
+    if(!victim ||
+       !__sync_bool_compare_and_swap(&victim->holding_cpu, -1, this_core->cpuid))
+    {
+        return NULL;
+    }
+
+    for(queue = &victim->queue[NR_QUEUE - 1]; queue >= victim->queue; queue--)
+    {
+        for(task = queue->head; task != NULL; task = task->next)
+        {
+            if(task->state == TASK_READY && task->cpuid == -1)
             {
-                return queue->head.next;
+                remove_from_ready_queue(task);
+                task->last_cpu = rq->cpuid;
+                append_to_ready_queue(task);
+                victim->nr_pushed++;
+                rq->nr_pulled++;
+                goto fin;
             }
-            */
+        }
+    }
+
+fin:
+
+    __sync_bool_compare_and_swap(&victim->holding_cpu, this_core->cpuid, -1);
+
+    return task;
+}
+
+
+STATIC_INLINE volatile struct task_t *get_next_runnable(struct runqueue_t *rq)
+{
+    /* search queues, in turn, for a ready-to-run task */
+    struct task_queue_t *queue;
+    volatile struct task_t *task, *cur = this_core->cur_task;
+
+    if(rq->nr_rr)
+    {
+        for(queue = &rq->queue[MAX_RR_PRIO];
+            queue >= &rq->queue[MIN_RR_PRIO]; queue--)
+        {
             if((task = next_queue_runnable(queue)) != NULL)
             {
                 return task;
@@ -1121,17 +1658,11 @@ STATIC_INLINE volatile struct task_t *get_next_runnable(void)
         }
     }
 
-    if(fifo_has_ready_tasks)
+    if(rq->nr_fifo)
     {
-        for(queue = &ready_queue[MAX_FIFO_PRIO];
-            queue >= &ready_queue[MIN_FIFO_PRIO]; queue--)
+        for(queue = &rq->queue[MAX_FIFO_PRIO];
+            queue >= &rq->queue[MIN_FIFO_PRIO]; queue--)
         {
-            /*
-            if(queue->head.next != &queue->head)
-            {
-                return queue->head.next;
-            }
-            */
             if((task = next_queue_runnable(queue)) != NULL)
             {
                 return task;
@@ -1139,22 +1670,25 @@ STATIC_INLINE volatile struct task_t *get_next_runnable(void)
         }
     }
 
-    /*
-    if(ready_queue[0].head.next != &(ready_queue[0].head))
+    if(rq->nr_user)
     {
-        return ready_queue[0].head.next;
+        if((task = next_queue_runnable(&rq->queue[0])) != NULL)
+        {
+            return task;
+        }
     }
-    */
-    if((task = next_queue_runnable(&ready_queue[0])) != NULL)
+
+    /* current task is the only runnable task? */
+    if((cur->state == TASK_RUNNING || cur->state == TASK_READY) &&
+       !(cur->properties & PROPERTY_IDLE))
     {
-        return task;
+        return cur;
     }
 
-    /* current task is the only runnable task? */
-    if(this_core->cur_task->state == TASK_RUNNING ||
-       this_core->cur_task->state == TASK_READY)
+    /* we are about to go idle, see if another cpu has work for us */
+    if((task = steal_task(rq)) != NULL)
     {
-        return this_core->cur_task;
+        return task;
     }
 
     /* Running queues are empty? run idle task */
@@ -1248,9 +1782,11 @@ void reap_zombie(volatile struct task_t *task)
     task_remove_child(task->parent, task);
     ptrace_clear_state(task);
     
-    uintptr_t s = lock_scheduler();
+    uintptr_t s = int_off();
+    __spin_lock(&zombie_queue_holding_cpu);
     remove_from_queue(task);
-    unlock_scheduler(s);
+    __spin_unlock(&zombie_queue_holding_cpu);
+    int_on(s);
 
     /* free task kernel-stack memory */
     free_kstack(task->kstack_virt);
@@ -1344,10 +1880,16 @@ static void zombify(struct task_t *t)
     t->state = TASK_ZOMBIE;
     t->time_left = 0;
 
-    uintptr_t s = lock_scheduler();
+    uintptr_t s = int_off();
+    struct runqueue_t *rq;
+
+    __spin_lock(&zombie_queue_holding_cpu);
+    rq = __lock_task_runqueue(t);
     remove_from_ready_queue(t);
     append_to_queue(t, &zombie_queue);
-    unlock_scheduler(s);
+    __unlock_runqueue(rq);
+    __spin_unlock(&zombie_queue_holding_cpu);
+    int_on(s);
 }
 
 
@@ -1589,7 +2131,7 @@ void terminate_task(int code)
     
     /* close open files */
     int i;
-    for(i = 0; i < NR_OPEN; i++)
+    for(i = 0; i < t->ofiles->max_fds; i++)
     {
         /* NOTE: this call takes care of releasing file locks */
         if(t->ofiles->ofile[i])
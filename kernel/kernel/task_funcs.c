@@ -39,11 +39,6 @@
 #define TIMESLICE_FIFO(t)       (0)
 
 
-extern int user_has_ready_tasks;
-extern int rr_has_ready_tasks;
-extern int fifo_has_ready_tasks;
-
-
 STATIC_INLINE int get_task_timeslice(volatile struct task_t *task)
 {
     if(task->sched_policy == SCHED_RR)
@@ -69,86 +64,137 @@ STATIC_INLINE void reset_task_timeslice(volatile struct task_t *task)
 
 STATIC_INLINE void append_to_queue(volatile struct task_t *t, struct task_queue_t *queue)
 {
-    t->prev = queue->head.prev;
-    queue->head.prev = t;
-    t->prev->next = t;
-    t->next = &queue->head;
+    t->next = NULL;
+    t->prev = queue->tail;
+    t->queue = queue;
+
+    if(queue->tail)
+    {
+        queue->tail->next = t;
+    }
+    else
+    {
+        queue->head = t;
+    }
+
+    queue->tail = t;
 }
 
 
 STATIC_INLINE void prepend_to_queue(volatile struct task_t *t, struct task_queue_t *queue)
 {
-    t->next = queue->head.next;
-    queue->head.next = t;
-    t->next->prev = t;
-    t->prev = &queue->head;
+    t->prev = NULL;
+    t->next = queue->head;
+    t->queue = queue;
+
+    if(queue->head)
+    {
+        queue->head->prev = t;
+    }
+    else
+    {
+        queue->tail = t;
+    }
+
+    queue->head = t;
 }
 
 
 STATIC_INLINE void remove_from_queue(volatile struct task_t *task)
 {
-    task->prev->next = task->next;
-    task->next->prev = task->prev;
+    struct task_queue_t *queue = task->queue;
+
+    if(!queue)
+    {
+        return;
+    }
+
+    if(task->prev)
+    {
+        task->prev->next = task->next;
+    }
+    else
+    {
+        queue->head = task->next;
+    }
+
+    if(task->next)
+    {
+        task->next->prev = task->prev;
+    }
+    else
+    {
+        queue->tail = task->prev;
+    }
+
     task->next = NULL;
     task->prev = NULL;
+    task->queue = NULL;
 }
 
 
+/*
+ * Get the counter of queued tasks in the scheduling class of the given
+ * priority level.
+ */
+STATIC_INLINE int *runqueue_counter(struct runqueue_t *rq, int prio)
+{
+    return (prio == 0) ? &rq->nr_user :
+           (prio < MIN_RR_PRIO) ? &rq->nr_fifo : &rq->nr_rr;
+}
+
+
+/*
+ * The functions below operate on the run queue of the cpu the task last
+ * ran on. The caller must hold that run queue's lock.
+ */
 STATIC_INLINE void append_to_ready_queue(volatile struct task_t *t)
 {
-    struct task_queue_t *queue = &ready_queue[t->priority];
+    struct runqueue_t *rq = task_runqueue(t);
 
-    append_to_queue(t, queue);
-    
-    int *p = (t->priority == 0) ? &user_has_ready_tasks :
-             (t->priority < MIN_RR_PRIO) ? &fifo_has_ready_tasks :
-                                           &rr_has_ready_tasks;
-    *p = 1;
-    //wakeup_other_processors();
+    append_to_queue(t, &rq->queue[t->priority]);
+    (*runqueue_counter(rq, t->priority))++;
+    tick_nohz_kick(rq->cpuid);
 }
 
 
 STATIC_INLINE void prepend_to_ready_queue(volatile struct task_t *t)
 {
-    struct task_queue_t *queue = &ready_queue[t->priority];
-
-    prepend_to_queue(t, queue);
+    struct runqueue_t *rq = task_runqueue(t);
 
-    int *p = (t->priority == 0) ? &user_has_ready_tasks :
-             (t->priority < MIN_RR_PRIO) ? &fifo_has_ready_tasks :
-                                           &rr_has_ready_tasks;
-    *p = 1;
-    //wakeup_other_processors();
+    prepend_to_queue(t, &rq->queue[t->priority]);
+    (*runqueue_counter(rq, t->priority))++;
+    tick_nohz_kick(rq->cpuid);
 }
 
 
 STATIC_INLINE void remove_from_ready_queue(volatile struct task_t *t)
 {
-    struct task_queue_t *queue = &ready_queue[t->priority];
+    struct runqueue_t *rq = task_runqueue(t);
 
-    remove_from_queue(t);
-
-    if(queue->head.next == &queue->head)
+    if(t->queue < rq->queue || t->queue >= &rq->queue[NR_QUEUE])
     {
-        int *p = (t->priority == 0) ? &user_has_ready_tasks :
-                 (t->priority < MIN_RR_PRIO) ? &fifo_has_ready_tasks :
-                                               &rr_has_ready_tasks;
-        *p = 0;
+        return;
     }
+
+    /*
+     * Use the queue the task is actually on, in case its priority was
+     * changed while it was queued.
+     */
+    (*runqueue_counter(rq, (int)(t->queue - rq->queue)))--;
+    remove_from_queue(t);
 }
 
 
 STATIC_INLINE void move_to_queue_end(volatile struct task_t *task)
 {
-    struct task_queue_t *queue = &ready_queue[task->priority];
+    struct task_queue_t *queue = task->queue;
 
-    remove_from_queue(task);
-    append_to_queue(task, queue);
-    
-    int *p = (task->priority == 0) ? &user_has_ready_tasks :
-             (task->priority < MIN_RR_PRIO) ? &fifo_has_ready_tasks :
-                                              &rr_has_ready_tasks;
-    *p = 1;
+    if(queue)
+    {
+        remove_from_queue(task);
+        append_to_queue(task, queue);
+    }
 }
 
 
@@ -180,15 +226,19 @@ STATIC_INLINE void update_task_times(volatile struct task_t *t)
  */
 STATIC_INLINE volatile struct task_t *get_task_by_id(pid_t pid)
 {
-    volatile struct task_t *res = NULL;
+    volatile struct task_t *res;
+
+    if(pid < 0)
+    {
+        return NULL;
+    }
 
     elevated_priority_lock(&task_table_lock);
 
-    for_each_taskptr(t)
+    for(res = pid_hash[pid_hashfn(pid)]; res != NULL; res = res->pid_hash_next)
     {
-        if(*t && (*t)->pid == pid)
+        if(res->pid == pid)
         {
-            res = *t;
             break;
         }
     }
@@ -204,8 +254,20 @@ STATIC_INLINE volatile struct task_t *get_task_by_id(pid_t pid)
  */
 STATIC_INLINE volatile struct task_t *get_task_by_tgid(pid_t tgid)
 {
-    volatile struct task_t *res = NULL;
+    volatile struct task_t *res;
+
+    /*
+     * The thread group leader's pid is the tgid, so try the pid hash first.
+     * If the leader has exited and is waiting to be reaped, find one of
+     * the other threads the slow way.
+     */
+    if((res = get_task_by_id(tgid)) && res->threads &&
+       res->threads->tgid == tgid)
+    {
+        return res;
+    }
 
+    res = NULL;
     elevated_priority_lock(&task_table_lock);
 
     for_each_taskptr(t)
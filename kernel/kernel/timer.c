@@ -23,6 +23,10 @@
  *  \file timer.c
  *
  *  Timer IRQ callback function.
+ *
+ *  Each cpu runs a periodic scheduler tick as a high resolution timer. The
+ *  tick keeps track of time and time slices, and is stopped while the cpu
+ *  is idle, so idle cpus are only woken up when they have work to do.
  */
 
 //#define __DEBUG
@@ -38,6 +42,8 @@
 #include <kernel/task.h>
 #include <kernel/clock.h>
 #include <kernel/timer.h>
+#include <kernel/hrtimer.h>
+#include <kernel/apic.h>
 #include <kernel/ksignal.h>
 #include <kernel/softint.h>
 #include <kernel/user.h>
@@ -52,6 +58,21 @@ unsigned long long ticks = 0;
 unsigned long long prev_ticks = 0;
 unsigned long avenrun[3];
 
+// per-cpu scheduler tick
+static struct
+{
+    struct hrtimer_t timer;
+    volatile int started;       // tick timer is running
+    volatile int oneshot;       // local timer switched to one-shot mode
+    volatile int stopped;       // tick stopped while idle
+    volatile int resched;       // time slice used up
+} tick_cpus[MAX_CORES];
+
+// protects ticks, monotonic_time, startup_time, tick_last_ns and the vdso
+// time data
+static volatile int tick_holding_cpu = -1;
+static unsigned long long tick_last_ns = 0;
+
 
 /* define some interrupt handlers and map them to their functions */
 #define TIMER_HANDLER(which)                            \
@@ -79,11 +100,11 @@ TIMER_HANDLER(ap)
  * The code and a commentary can be found at:
  *   https://en.wikipedia.org/wiki/Load_(computing)
  */
-INLINE void calc_load(void)
+INLINE void calc_load(unsigned long long n)
 {
-    static int count = 0;
+    static unsigned long long count = 0;
 
-    if(++count >= LOAD_FREQ)
+    if((count += n) >= LOAD_FREQ)
     {
         int running = get_running_task_count() +
                       get_blocked_task_count();
@@ -103,11 +124,6 @@ INLINE void calc_load(void)
         monotonic_time.tv_nsec -= 1000000000;       \
     }
 
-#define FIX_VDSO_MONOTONIC()                        \
-    vdso_monotonic->tv_sec = monotonic_time.tv_sec; \
-    vdso_monotonic->tv_nsec = monotonic_time.tv_nsec;
-
-
 int early_timer_callback(struct regs *r, int arg)
 {
     UNUSED(r);
@@ -119,7 +135,7 @@ int early_timer_callback(struct regs *r, int arg)
     
     pic_send_eoi(IRQ_TIMER);
     FIX_MONOTONIC();
-    FIX_VDSO_MONOTONIC();
+    vdso_update_time(0);
     return 1;
 }
 
@@ -183,36 +199,110 @@ STATIC_INLINE void fix_limits_and_schedule(void)
 }
 
 
-int bsp_timer_callback(struct regs *r, int arg)
+/*
+ * Account for the ticks that elapsed since we last updated the time. Any cpu
+ * whose tick is running can do this, so time keeps going as long as one cpu
+ * is not idle. If another cpu is at it, we leave it to do the work.
+ */
+static void tick_do_update(unsigned long long now)
 {
-    UNUSED(r);
-    UNUSED(arg);
+    unsigned long long n;
 
-	int schedule;
+    if(!__sync_bool_compare_and_swap(&tick_holding_cpu, -1, this_core->cpuid))
+    {
+        return;
+    }
 
-    ticks++;
+    if(now >= tick_last_ns + NSECS_PER_TICK)
+    {
+        n = (now - tick_last_ns) / NSECS_PER_TICK;
+        tick_last_ns += n * NSECS_PER_TICK;
+        ticks += n;
+        monotonic_time.tv_nsec += n * NSECS_PER_TICK;
+        FIX_MONOTONIC();
+        vdso_update_time(tick_last_ns);
 
-    monotonic_time.tv_nsec += NSECS_PER_TICK;
+        /* calculate the load average (every 5 seconds) */
+        calc_load(n);
+    }
+
+    __sync_bool_compare_and_swap(&tick_holding_cpu, this_core->cpuid, -1);
+}
 
-    /* calculate the load average (every 5 seconds) */
-    calc_load();
 
-    /* wakeup nanosleepers */
-    clock_check_waiters();
-    
-    /* decrement virtual timers */
-    //dec_itimers();
+static int tick_timer_func(struct hrtimer_t *timer)
+{
+    unsigned long long now = hrtimer_now();
 
-    schedule = need_schedule();
-    pic_send_eoi(IRQ_TIMER);
+    tick_do_update(now);
 
-    if(schedule)
+    if(need_schedule())
     {
-        FIX_MONOTONIC();
+        tick_cpus[this_core->cpuid].resched = 1;
+    }
+
+    hrtimer_forward(timer, now, NSECS_PER_TICK);
+
+    return HRTIMER_RESTART;
+}
+
+
+STATIC_INLINE void tick_start(int vector)
+{
+    int cpu = this_core->cpuid;
+    unsigned long long now;
+
+    if(hrtimer_hres_active && !tick_cpus[cpu].oneshot)
+    {
+        hrtimer_init_cpu(vector);
+        tick_cpus[cpu].oneshot = 1;
+    }
+
+    if(tick_cpus[cpu].started)
+    {
+        return;
+    }
+
+    now = hrtimer_now();
+
+    if(cpu == 0)
+    {
+        tick_last_ns = now;
+    }
+
+    hrtimer_setup(&tick_cpus[cpu].timer, tick_timer_func, NULL);
+    hrtimer_start(&tick_cpus[cpu].timer, now + NSECS_PER_TICK);
+    tick_cpus[cpu].started = 1;
+}
+
+
+STATIC_INLINE void timer_interrupt(int vector)
+{
+    int cpu = this_core->cpuid;
+
+    if(!tick_cpus[cpu].started || 
+       (hrtimer_hres_active && !tick_cpus[cpu].oneshot))
+    {
+        tick_start(vector);
+    }
+
+    hrtimer_interrupt();
+    pic_send_eoi((vector == 32) ? IRQ_TIMER : vector);
+
+    if(tick_cpus[cpu].resched)
+    {
+        tick_cpus[cpu].resched = 0;
         fix_limits_and_schedule();
     }
+}
+
+
+int bsp_timer_callback(struct regs *r, int arg)
+{
+    UNUSED(r);
+    UNUSED(arg);
 
-    FIX_VDSO_MONOTONIC();
+    timer_interrupt(32);
 
     return 1;
 }
@@ -223,30 +313,141 @@ int ap_timer_callback(struct regs *r, int arg)
     UNUSED(r);
     UNUSED(arg);
 
-    //printk("cpu[%d]: timer callback\n", this_core->cpuid);
+    timer_interrupt(123);
 
-	int schedule = need_schedule();
-    //printk("cpu[%d]: schedule %d\n", this_core->cpuid, schedule);
+    return 1;
+}
 
-    pic_send_eoi(123);
 
-    if(schedule)
+/*
+ * Set the realtime clock.
+ */
+void timekeeping_settime(time_t sec, long nsec)
+{
+    uintptr_t s = int_off();
+
+    while(!__sync_bool_compare_and_swap(&tick_holding_cpu, -1,
+                                        this_core->cpuid))
     {
-        fix_limits_and_schedule();
+        __asm__ __volatile__("pause":::"memory");
+    }
+
+    startup_time = sec;
+    monotonic_time.tv_sec = 0;
+    monotonic_time.tv_nsec = nsec;
+    tick_last_ns = hrtimer_now();
+    vdso_update_time(tick_last_ns);
+
+    __sync_bool_compare_and_swap(&tick_holding_cpu, this_core->cpuid, -1);
+    int_on(s);
+}
+
+
+/*
+ * Stop the tick on an idle cpu.
+ */
+int tick_nohz_idle_enter(void)
+{
+    int i, cpu = this_core->cpuid;
+
+    if(!tick_cpus[cpu].oneshot)
+    {
+        return 1;
+    }
+
+    if(!tick_cpus[cpu].stopped)
+    {
+        hrtimer_cancel(&tick_cpus[cpu].timer);
+        tick_cpus[cpu].stopped = 1;
     }
 
-    //printk("cpu[%d]: schedule done\n", this_core->cpuid);
+    /*
+     * Make sure no one queued work for us while we were stopping the tick.
+     * Whoever queues a task after this point sees we are stopped and sends
+     * us a wakeup IPI (see tick_nohz_kick()).
+     */
+    __sync_synchronize();
+
+    if(runqueue_length(&runqueues[cpu]))
+    {
+        return 0;
+    }
+
+    for(i = 0; i < processor_count; i++)
+    {
+        if(runqueue_length(&runqueues[i]) > 1)
+        {
+            return 0;
+        }
+    }
 
     return 1;
 }
 
 
+/*
+ * Restart the tick on a cpu that is leaving idle.
+ */
+void tick_nohz_idle_exit(void)
+{
+    int cpu = this_core->cpuid;
+    unsigned long long now;
+
+    if(!tick_cpus[cpu].stopped)
+    {
+        return;
+    }
+
+    now = hrtimer_now();
+    tick_do_update(now);
+    hrtimer_forward(&tick_cpus[cpu].timer, now, NSECS_PER_TICK);
+    hrtimer_start(&tick_cpus[cpu].timer, tick_cpus[cpu].timer.expires);
+    tick_cpus[cpu].stopped = 0;
+}
+
+
+/*
+ * Wake up idle cpus after queueing a task on a cpu's run queue.
+ */
+void tick_nohz_kick(int cpu)
+{
+    int i;
+
+    if(!hrtimer_hres_active)
+    {
+        return;
+    }
+
+    __sync_synchronize();
+
+    if(cpu != this_core->cpuid && tick_cpus[cpu].stopped)
+    {
+        lapic_send_wakeup(processor_local_data[cpu].lapicid);
+        return;
+    }
+
+    // the cpu is busy, so wake an idle cpu to come and steal the task
+    if(runqueue_length(&runqueues[cpu]) > 1)
+    {
+        for(i = 0; i < processor_count; i++)
+        {
+            if(i != this_core->cpuid && tick_cpus[i].stopped)
+            {
+                lapic_send_wakeup(processor_local_data[i].lapicid);
+                return;
+            }
+        }
+    }
+}
+
+
 /*
  * Initialise system clock.
  */
 void timer_init(void)
 {
     printk("Initializing clock..\n");
+    hrtimer_init();
     register_irq_handler(IRQ_TIMER, &early_timer_handler);
     enable_irq(IRQ_TIMER);
     
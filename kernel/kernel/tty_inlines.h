@@ -77,7 +77,8 @@ STATIC_INLINE int sleep_if_empty(/* struct tty_t *tty, */ struct kqueue_t *q, in
 
         if(timeout_ticks)
         {
-            if(clock_wait(&waiter_head[0], this_core->cur_task->pid, timeout_ticks, 0) == 0)
+            if(clock_wait(&waiter_head[0], this_core->cur_task->pid,
+                          (int64_t)timeout_ticks * NSECS_PER_TICK, 0) == 0)
             {
                 empty = ttybuf_is_empty(q);
                 return empty ? -ETIMEDOUT : 0;
@@ -28,6 +28,8 @@
 #include <errno.h>
 #include <kernel/laylaos.h>
 #include <kernel/user.h>
+#include <kernel/clock.h>
+#include <kernel/hrtimer.h>
 #include <mm/mmngr_virtual.h>
 #include <mm/mmap.h>
 #include "../../vdso/vdso.h"
@@ -36,11 +38,11 @@ virtual_addr vdso_code_start = 0;
 virtual_addr vdso_code_end = 0;
 virtual_addr vdso_data_addr = 0;
 
-static struct timespec dummy_monotonic;
-static time_t dummy_startup_time;
+// the kernel reads the time from here too, so make sure there is something
+// to read before the vdso is loaded
+static struct vdso_data_t dummy_data;
 
-struct timespec *vdso_monotonic = &dummy_monotonic;
-time_t *vdso_startup_time = &dummy_startup_time;
+volatile struct vdso_data_t *vdso_data = &dummy_data;
 
 /*
  * Initialise kernel-side support for vdso.
@@ -88,14 +90,48 @@ int vdso_stub_init(virtual_addr start, virtual_addr end)
 
     A_memset((void *)vdso_data_addr, 0, PAGE_SIZE);
 
-    vdso_monotonic = (struct timespec *)(vdso_data_addr + VDSO_OFFSET_CLOCK_GETTIME);
-    vdso_startup_time = (time_t *)(vdso_data_addr + VDSO_OFFSET_STARTUP_TIME);
-    *vdso_startup_time = startup_time;
+    A_memcpy((void *)vdso_data_addr, &dummy_data, sizeof(struct vdso_data_t));
+    vdso_data = (volatile struct vdso_data_t *)vdso_data_addr;
 
     return 0;
 }
 
 
+/*
+ * Publish the current time to the vdso. The caller must hold the timekeeping
+ * lock (see timer.c). The monotonic time is valid at clock_ns, as returned
+ * by hrtimer_now().
+ */
+void vdso_update_time(unsigned long long clock_ns)
+{
+    volatile struct vdso_data_t *vd = vdso_data;
+    unsigned long long base, offset, mult;
+
+    vd->seq++;
+    __asm__ __volatile__("" ::: "memory");
+
+    if(hrtimer_tsc_invariant && hrtimer_clocksource(&base, &offset, &mult))
+    {
+        vd->clock_mode = VDSO_CLOCK_TSC;
+        vd->tsc_base = base;
+        vd->tsc_mult = mult;
+        vd->tsc_shift = HRTIMER_TSC_SHIFT;
+        vd->ns_base = (int64_t)(clock_ns - offset);
+    }
+    else
+    {
+        vd->clock_mode = VDSO_CLOCK_NONE;
+    }
+
+    vd->mono_sec = monotonic_time.tv_sec;
+    vd->mono_nsec = monotonic_time.tv_nsec;
+    vd->startup_time = startup_time;
+
+    __asm__ __volatile__("" ::: "memory");
+    vd->seq++;
+}
+
+
 /*
  * Map the vdso code and data pages to the newly created task.
  */
@@ -95,6 +95,21 @@ void *krealloc(void *addr, size_t sz)
 }
 
 
+void *kmemalign(size_t align, size_t sz)
+{
+    int old_prio = 0, old_policy = 0;
+    elevate_priority(this_core->cur_task, &old_prio, &old_policy);
+
+    kernel_mutex_lock(&kheap_lock);
+    void *res = dlmemalign(align, sz);
+    kernel_mutex_unlock(&kheap_lock);
+
+    restore_priority(this_core->cur_task, old_prio, old_policy);
+
+    return res;
+}
+
+
 void *kcalloc(size_t m, size_t n)
 {
     size_t sz = m * n;
@@ -148,6 +148,8 @@ void memregion_insert_leftto(struct task_t *task,
     {
         task->mem->first_region = memregion;
     }
+
+    memregion_tree_insert(task->mem, memregion);
 }
 
 
@@ -169,6 +171,8 @@ void memregion_insert_rightto(struct task_t *task,
     {
         task->mem->last_region = memregion;
     }
+
+    memregion_tree_insert(task->mem, memregion);
 }
 
 
@@ -280,7 +284,7 @@ long memregion_change_prot(struct task_t *task,
                            virtual_addr start, virtual_addr end,
                            int prot, int detach)
 {
-    struct memregion_t *tmp, *memregion = task->mem->first_region;
+    struct memregion_t *tmp, *memregion;
     //size_t sz = (end - start);
     //size_t pages = sz / PAGE_SIZE;
     int found = 0;
@@ -298,6 +302,9 @@ long memregion_change_prot(struct task_t *task,
                     (end <= USER_MEM_END)) ? I86_PTE_USER : 0);
     }
 
+    // skip the regions below the target range
+    memregion = memregion_tree_lower_bound(task->mem, start);
+
     while(memregion)
     {
         start2 = memregion->addr;
@@ -372,7 +379,12 @@ long memregion_change_prot(struct task_t *task,
          */
 
         // no overlap
-        if(end <= start2 || start >= end2)
+        if(end <= start2)
+        {
+            break;
+        }
+
+        if(start >= end2)
         {
             memregion = memregion->next;
             continue;
@@ -479,6 +491,7 @@ long memregion_change_prot(struct task_t *task,
 
             memregion->addr = start;
             memregion->size -= tmp->size;
+            memregion_tree_update(task->mem, memregion);
             
             // adjust the newly alloc'd region's file pos
             if(memregion->inode)
@@ -512,6 +525,7 @@ long memregion_change_prot(struct task_t *task,
             }
 
             memregion->size -= tmp->size;
+            memregion_tree_update(task->mem, memregion);
 
             // adjust the newly alloc'd region's file pos
             if(memregion->inode)
@@ -678,33 +692,24 @@ long memregion_attach(struct task_t *task, struct memregion_t *memregion,
     if(task->mem->first_region == NULL)
     {
         //printk("memregion_attach: inserting first\n");
+        memregion->prev = NULL;
+        memregion->next = NULL;
         task->mem->first_region = memregion;
         task->mem->last_region = memregion;
+        memregion_tree_insert(task->mem, memregion);
     }
     else
     {
-        for(tmp = task->mem->first_region; tmp != NULL; tmp = tmp->next)
+        // there are no overlaps, so the first region ending above our
+        // start address is the one we go before
+        if((tmp = memregion_tree_lower_bound(task->mem, attachat)))
         {
-            if(tmp->addr < attachat && tmp->next)
-            {
-                continue;
-            }
-
-            if(tmp->addr < attachat)
-            {
-                memregion_insert_rightto(task, memregion, tmp);
-            }
-            else
-            {
-                memregion_insert_leftto(task, memregion, tmp);
-            }
-            
-            break;
+            memregion_insert_leftto(task, memregion, tmp);
         }
-        
-        if(tmp == NULL)
+        else
         {
-            kpanic("cannot add memregion to task (in memregion_attach)\n");
+            memregion_insert_rightto(task, memregion,
+                                     task->mem->last_region);
         }
 
         /*
@@ -759,6 +764,8 @@ static void memregion_detach_from_task(struct task_t *task,
     {
         task->mem->last_region = memregion->prev;
     }
+
+    memregion_tree_remove(task->mem, memregion);
 }
 
 
@@ -1042,6 +1049,9 @@ bailout:
         tmp->refs = 1;
         tmp->next = NULL;
         tmp->prev = prev;
+        tmp->rb_parent = NULL;
+        tmp->rb_left = NULL;
+        tmp->rb_right = NULL;
 
         if(tmp->inode)
         {
@@ -1058,6 +1068,7 @@ bailout:
             prev->next = tmp;
         }
         
+        memregion_tree_insert(copy, tmp);
         prev = tmp;
     }
     
@@ -1091,6 +1102,9 @@ void task_mem_free(struct task_vm_t *mem)
     }
     
     mem->first_region = NULL;
+    mem->last_region = NULL;
+    mem->rb_root = NULL;
+    mem->mmap_cache = NULL;
 
     kernel_mutex_unlock(&(mem->mutex));
 }
@@ -1157,6 +1171,9 @@ void memregion_consolidate(struct task_t *task)
                     task->mem->last_region = memregion;
                 }
 
+                memregion_tree_remove(task->mem, tmp);
+                memregion_tree_update(task->mem, memregion);
+
                 // add region to free list
                 //tmp->refs--;
                 __sync_fetch_and_sub(&tmp->refs, 1);
@@ -1189,26 +1206,6 @@ void memregion_consolidate(struct task_t *task)
 }
 
 
-/*
- * This is similar to release_cached_page() except it does not decrement
- * the physical frame's share count as we need it to stay as is, but we
- * still need to wakeup any waiters.
- */
-static inline void release_and_wakeup_waiters(struct cached_page_t *pcache)
-{
-    int wanted = (pcache->flags & PCACHE_FLAG_WANTED);
-    
-    kernel_mutex_lock(&pcachetab_lock);
-    __sync_and_and_fetch(&pcache->flags, ~(PCACHE_FLAG_BUSY | PCACHE_FLAG_WANTED));
-    kernel_mutex_unlock(&pcachetab_lock);
-
-    if(wanted)
-    {
-        unblock_tasks(pcache);
-    }
-}
-
-
 /*
  * Load a memory page from the file node referenced in the given memregion,
  * or zero-out the page is the memregion has no file backing. The function
@@ -1334,7 +1331,7 @@ long memregion_load_page(struct memregion_t *memregion, pdirectory *pd,
                 }
 
                 //pcache->flags &= ~PCACHE_FLAG_BUSY;
-                release_and_wakeup_waiters(pcache);
+                wakeup_cached_page_waiters(pcache);
                 
                 goto fin;
             }
@@ -1417,48 +1414,40 @@ fin:
 
 struct memregion_t *memregion_containing(volatile struct task_t *task, virtual_addr addr)
 {
-    volatile struct memregion_t *memregion;
+    struct task_vm_t *mem = task->mem;
+    struct memregion_t *memregion;
     virtual_addr start = align_down(addr);
     virtual_addr end = start + PAGE_SIZE - 1;
-    
-    for(memregion = task->mem->first_region; 
-        memregion != NULL; 
-        memregion = memregion->next)
+
+    // page faults tend to hit the same region over and over
+    if((memregion = mem->mmap_cache) &&
+       memregion->addr <= start && REGION_END(memregion) > start)
     {
-        virtual_addr start2 = memregion->addr;
-        virtual_addr end2 = start2 + (memregion->size * PAGE_SIZE) - 1;
+        return memregion;
+    }
 
-        // no overlap
-        if(end < start2 || start > end2)
-        {
-            continue;
-        }
-        
-        return (struct memregion_t *)memregion;
+    if(!(memregion = memregion_tree_lower_bound(mem, start)) ||
+       memregion->addr > end)
+    {
+        return NULL;
     }
-    
-    return NULL;
+
+    mem->mmap_cache = memregion;
+
+    return memregion;
 }
 
 
 long memregion_check_overlaps(struct task_t *task,
                               virtual_addr start, virtual_addr end)
 {
-    volatile struct memregion_t *memregion = task->mem->first_region;
-    end--;
+    struct memregion_t *memregion;
 
-    while(memregion)
+    // the first region ending above start is the only one that can overlap
+    // the range without another region overlapping it before
+    if((memregion = memregion_tree_lower_bound(task->mem, start)) &&
+       memregion->addr < end)
     {
-        virtual_addr start2 = memregion->addr;
-        virtual_addr end2 = start2 + (memregion->size * PAGE_SIZE) - 1;
-                
-        // no overlap
-        if(end < start2 || start > end2)
-        {
-            memregion = memregion->next;
-            continue;
-        }
-
         return -EEXIST;
     }
 
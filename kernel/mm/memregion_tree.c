@@ -0,0 +1,584 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: memregion_tree.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file memregion_tree.c
+ *
+ *  The task memory region tree. Regions are kept in a red-black tree keyed
+ *  by address, in addition to the address-ordered region list (which is
+ *  still used to walk all of a task's regions). Each node records the size
+ *  of the unmapped gap between its region and the one before it (in the
+ *  list), as well as the largest gap in its subtree. This allows us to find
+ *  the region containing an address, and free address ranges for mmap(),
+ *  in O(log n) time.
+ */
+
+#include <mm/memregion.h>
+
+
+static inline virtual_addr memregion_gap(struct memregion_t *memregion)
+{
+    virtual_addr start = memregion->prev ? REGION_END(memregion->prev) : 0;
+
+    return (memregion->addr > start) ? memregion->addr - start : 0;
+}
+
+
+// recalculate the largest gap in the node's subtree
+static inline int augment(struct memregion_t *node)
+{
+    virtual_addr max_gap = node->gap;
+
+    if(node->rb_left && node->rb_left->max_gap > max_gap)
+    {
+        max_gap = node->rb_left->max_gap;
+    }
+
+    if(node->rb_right && node->rb_right->max_gap > max_gap)
+    {
+        max_gap = node->rb_right->max_gap;
+    }
+
+    if(node->max_gap == max_gap)
+    {
+        return 0;
+    }
+
+    node->max_gap = max_gap;
+    return 1;
+}
+
+
+// update the largest gaps from the given node up to the root
+static inline void propagate(struct memregion_t *node, int full)
+{
+    for( ; node != NULL; node = node->rb_parent)
+    {
+        if(!augment(node) && !full)
+        {
+            break;
+        }
+    }
+}
+
+
+static void rotate_left(struct task_vm_t *mem, struct memregion_t *node)
+{
+    struct memregion_t *right = node->rb_right;
+
+    if((node->rb_right = right->rb_left))
+    {
+        right->rb_left->rb_parent = node;
+    }
+
+    right->rb_left = node;
+    right->rb_parent = node->rb_parent;
+
+    if(!node->rb_parent)
+    {
+        mem->rb_root = right;
+    }
+    else if(node == node->rb_parent->rb_left)
+    {
+        node->rb_parent->rb_left = right;
+    }
+    else
+    {
+        node->rb_parent->rb_right = right;
+    }
+
+    node->rb_parent = right;
+    augment(node);
+    augment(right);
+}
+
+
+static void rotate_right(struct task_vm_t *mem, struct memregion_t *node)
+{
+    struct memregion_t *left = node->rb_left;
+
+    if((node->rb_left = left->rb_right))
+    {
+        left->rb_right->rb_parent = node;
+    }
+
+    left->rb_right = node;
+    left->rb_parent = node->rb_parent;
+
+    if(!node->rb_parent)
+    {
+        mem->rb_root = left;
+    }
+    else if(node == node->rb_parent->rb_right)
+    {
+        node->rb_parent->rb_right = left;
+    }
+    else
+    {
+        node->rb_parent->rb_left = left;
+    }
+
+    node->rb_parent = left;
+    augment(node);
+    augment(left);
+}
+
+
+#define IS_RED(n)       ((n) && (n)->rb_color == RB_RED)
+#define IS_BLACK(n)     (!(n) || (n)->rb_color == RB_BLACK)
+
+
+static void insert_fixup(struct task_vm_t *mem, struct memregion_t *node)
+{
+    struct memregion_t *parent, *gparent, *uncle, *tmp;
+
+    while((parent = node->rb_parent) && parent->rb_color == RB_RED)
+    {
+        gparent = parent->rb_parent;
+
+        if(parent == gparent->rb_left)
+        {
+            uncle = gparent->rb_right;
+
+            if(IS_RED(uncle))
+            {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if(parent->rb_right == node)
+            {
+                rotate_left(mem, parent);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rotate_right(mem, gparent);
+        }
+        else
+        {
+            uncle = gparent->rb_left;
+
+            if(IS_RED(uncle))
+            {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if(parent->rb_left == node)
+            {
+                rotate_right(mem, parent);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rotate_left(mem, gparent);
+        }
+    }
+
+    mem->rb_root->rb_color = RB_BLACK;
+}
+
+
+static void remove_fixup(struct task_vm_t *mem, struct memregion_t *node,
+                         struct memregion_t *parent)
+{
+    struct memregion_t *other;
+
+    while(IS_BLACK(node) && node != mem->rb_root)
+    {
+        if(parent->rb_left == node)
+        {
+            other = parent->rb_right;
+
+            if(other->rb_color == RB_RED)
+            {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rotate_left(mem, parent);
+                other = parent->rb_right;
+            }
+
+            if(IS_BLACK(other->rb_left) && IS_BLACK(other->rb_right))
+            {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            }
+            else
+            {
+                if(IS_BLACK(other->rb_right))
+                {
+                    other->rb_left->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    rotate_right(mem, other);
+                    other = parent->rb_right;
+                }
+
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_right->rb_color = RB_BLACK;
+                rotate_left(mem, parent);
+                node = mem->rb_root;
+                break;
+            }
+        }
+        else
+        {
+            other = parent->rb_left;
+
+            if(other->rb_color == RB_RED)
+            {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rotate_right(mem, parent);
+                other = parent->rb_left;
+            }
+
+            if(IS_BLACK(other->rb_left) && IS_BLACK(other->rb_right))
+            {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            }
+            else
+            {
+                if(IS_BLACK(other->rb_left))
+                {
+                    other->rb_right->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    rotate_left(mem, other);
+                    other = parent->rb_left;
+                }
+
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_left->rb_color = RB_BLACK;
+                rotate_right(mem, parent);
+                node = mem->rb_root;
+                break;
+            }
+        }
+    }
+
+    if(node)
+    {
+        node->rb_color = RB_BLACK;
+    }
+}
+
+
+/*
+ * Update the task's region tree after resizing a region. The gap below the
+ * region, as well as the one below the next region, might have changed.
+ */
+void memregion_tree_update(struct task_vm_t *mem,
+                           struct memregion_t *memregion)
+{
+    UNUSED(mem);
+
+    memregion->gap = memregion_gap(memregion);
+    propagate(memregion, 0);
+
+    if(memregion->next)
+    {
+        memregion->next->gap = memregion_gap(memregion->next);
+        propagate(memregion->next, 0);
+    }
+}
+
+
+/*
+ * Add a memory region to the task's region tree. The region has already
+ * been linked into the region list, so we place it right after its list
+ * predecessor instead of comparing addresses (while a region is being
+ * split, the two halves briefly share the same start address).
+ */
+void memregion_tree_insert(struct task_vm_t *mem,
+                           struct memregion_t *memregion)
+{
+    struct memregion_t **link, *parent;
+
+    if(memregion->prev && !memregion->prev->rb_right)
+    {
+        parent = memregion->prev;
+        link = &parent->rb_right;
+    }
+    else if(memregion->next)
+    {
+        // the next region is the leftmost node of the subtree to the
+        // right of our predecessor, so it has no left child
+        parent = memregion->next;
+        link = &parent->rb_left;
+    }
+    else
+    {
+        parent = NULL;
+        link = &mem->rb_root;
+    }
+
+    memregion->rb_parent = parent;
+    memregion->rb_left = NULL;
+    memregion->rb_right = NULL;
+    memregion->rb_color = RB_RED;
+    memregion->gap = memregion_gap(memregion);
+    memregion->max_gap = memregion->gap;
+    *link = memregion;
+
+    propagate(parent, 0);
+    insert_fixup(mem, memregion);
+
+    // the next region's gap shrinks
+    if(memregion->next)
+    {
+        memregion->next->gap = memregion_gap(memregion->next);
+        propagate(memregion->next, 1);
+    }
+}
+
+
+/*
+ * Remove a memory region from the task's region tree.
+ */
+void memregion_tree_remove(struct task_vm_t *mem,
+                           struct memregion_t *memregion)
+{
+    struct memregion_t *node = memregion, *child, *parent, *next;
+    int color;
+
+    if(mem->mmap_cache == memregion)
+    {
+        mem->mmap_cache = NULL;
+    }
+
+    if(!node->rb_left)
+    {
+        child = node->rb_right;
+    }
+    else if(!node->rb_right)
+    {
+        child = node->rb_left;
+    }
+    else
+    {
+        // put the next node (in tree order) in the removed node's place
+        for(node = node->rb_right; node->rb_left; node = node->rb_left)
+        {
+            ;
+        }
+
+        if(!memregion->rb_parent)
+        {
+            mem->rb_root = node;
+        }
+        else if(memregion->rb_parent->rb_left == memregion)
+        {
+            memregion->rb_parent->rb_left = node;
+        }
+        else
+        {
+            memregion->rb_parent->rb_right = node;
+        }
+
+        child = node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+
+        if(parent == memregion)
+        {
+            parent = node;
+        }
+        else
+        {
+            if(child)
+            {
+                child->rb_parent = parent;
+            }
+
+            parent->rb_left = child;
+            node->rb_right = memregion->rb_right;
+            memregion->rb_right->rb_parent = node;
+        }
+
+        node->rb_parent = memregion->rb_parent;
+        node->rb_color = memregion->rb_color;
+        node->rb_left = memregion->rb_left;
+        memregion->rb_left->rb_parent = node;
+
+        goto fixup;
+    }
+
+    parent = node->rb_parent;
+    color = node->rb_color;
+
+    if(child)
+    {
+        child->rb_parent = parent;
+    }
+
+    if(!parent)
+    {
+        mem->rb_root = child;
+    }
+    else if(parent->rb_left == node)
+    {
+        parent->rb_left = child;
+    }
+    else
+    {
+        parent->rb_right = child;
+    }
+
+fixup:
+
+    propagate(parent, 1);
+
+    if(color == RB_BLACK)
+    {
+        remove_fixup(mem, child, parent);
+    }
+
+    memregion->rb_parent = NULL;
+    memregion->rb_left = NULL;
+    memregion->rb_right = NULL;
+
+    // the next region's gap grows
+    if((next = memregion->next))
+    {
+        next->gap = memregion_gap(next);
+        propagate(next, 1);
+    }
+}
+
+
+/*
+ * Find the first region that ends above the given address.
+ */
+struct memregion_t *memregion_tree_lower_bound(struct task_vm_t *mem,
+                                               virtual_addr addr)
+{
+    struct memregion_t *node = mem->rb_root, *res = NULL;
+
+    while(node)
+    {
+        if(REGION_END(node) > addr)
+        {
+            res = node;
+            node = node->rb_left;
+        }
+        else
+        {
+            node = node->rb_right;
+        }
+    }
+
+    return res;
+}
+
+
+/*
+ * Find the lowest region in the subtree whose gap has room for size bytes
+ * between min and max. We skip subtrees whose largest gap is too small, and
+ * those that lie completely below min.
+ */
+static struct memregion_t *gap_search(struct memregion_t *node,
+                                      virtual_addr size,
+                                      virtual_addr min, virtual_addr max)
+{
+    struct memregion_t *res;
+    virtual_addr start, end;
+
+    if(!node || node->max_gap < size)
+    {
+        return NULL;
+    }
+
+    if(node->addr > min && (res = gap_search(node->rb_left, size, min, max)))
+    {
+        return res;
+    }
+
+    start = node->addr - node->gap;
+
+    // gaps to the right start even higher
+    if(start >= max)
+    {
+        return NULL;
+    }
+
+    if(start < min)
+    {
+        start = min;
+    }
+
+    end = (node->addr < max) ? node->addr : max;
+
+    if(end > start && end - start >= size)
+    {
+        return node;
+    }
+
+    return gap_search(node->rb_right, size, min, max);
+}
+
+
+/*
+ * Find a free address range.
+ */
+virtual_addr memregion_find_gap(struct task_vm_t *mem, virtual_addr size,
+                                virtual_addr min, virtual_addr max)
+{
+    struct memregion_t *memregion;
+    virtual_addr start;
+
+    if(!size || min >= max || max - min < size)
+    {
+        return 0;
+    }
+
+    if((memregion = gap_search(mem->rb_root, size, min, max)))
+    {
+        start = memregion->addr - memregion->gap;
+        return (start < min) ? min : start;
+    }
+
+    // try the space above the last region
+    start = mem->last_region ? REGION_END(mem->last_region) : 0;
+
+    if(start < min)
+    {
+        start = min;
+    }
+
+    return (start < max && max - start >= size) ? start : 0;
+}
@@ -56,103 +56,59 @@
                              MAP_FIXED_NOREPLACE)
 
 
-#define REGION_END(m)       ((m)->addr + ((m)->size * PAGE_SIZE))
 
 /*
  * Reserve memory in userspace.
  */
 virtual_addr get_user_addr(virtual_addr size, virtual_addr min, virtual_addr max)
 {
-    virtual_addr end, diff;
-    struct memregion_t *memregion = this_core->cur_task->mem->first_region;
+    virtual_addr end;
 
-    while(memregion)
+    // find the lowest free range that fits (the region tree keeps track of
+    // the largest gap in each subtree, so we don't need to walk the list)
+    if(!(end = memregion_find_gap(this_core->cur_task->mem, size, min, max)))
     {
-        //printk("get_user_addr: addr 0x%lx\n", memregion->addr);
+        return 0;
+    }
 
-        if(memregion->addr < min)
-        {
-            memregion = memregion->next;
-            continue;
-        }
+    pt_entry *e = get_page_entry_pd((pdirectory *)this_core->cur_task->pd_virt, 
+                                    (void *)end);
 
+    if(e && PTE_FRAME(*e))
+    {
         /*
-        if(memregion->addr > max)
-        {
-            return min;
-        }
-        */
-
-        end = REGION_END(memregion);
-
-        if(end > max)
-        {
-            if(memregion->prev)
-            {
-                return (REGION_END(memregion->prev) < min) ? min : 0;
-            }
-            else
-            {
-                return min;
-            }
-        }
+        switch_tty(1);
 
-        if(memregion->next->addr > max)
-        {
-            diff = max - end;
-        }
-        else
-        {
-            diff = memregion->next->addr - end;
-        }
+        printk("Current process: pid %d, comm %s\n",
+               cur_task->pid, cur_task->command);
 
-        if(diff >= size)
+        for(struct memregion_t *tmp = cur_task->mem->first_region; tmp != NULL; tmp = tmp->next)
         {
-            pt_entry *e = get_page_entry_pd((pdirectory *)this_core->cur_task->pd_virt, 
-                                            (void *)end);
-
-            if(e && PTE_FRAME(*e))
+            char *path;
+            struct dentry_t *dent;
+        
+            path = "*";
+        
+            if(tmp->inode && get_dentry(tmp->inode, &dent) == 0)
             {
-                /*
-                switch_tty(1);
-
-                printk("Current process: pid %d, comm %s\n",
-                       cur_task->pid, cur_task->command);
-
-                for(struct memregion_t *tmp = cur_task->mem->first_region; tmp != NULL; tmp = tmp->next)
+                if(dent->path)
                 {
-                    char *path;
-                    struct dentry_t *dent;
-                
-                    path = "*";
-                
-                    if(tmp->inode && get_dentry(tmp->inode, &dent) == 0)
-                    {
-                        if(dent->path)
-                        {
-                            path = dent->path;
-                        }
-                    }
-
-                    printk("memregion: addr %lx - %lx (type %d, prot %x, fl %x, %s)\n", tmp->addr, tmp->addr + (tmp->size * PAGE_SIZE), tmp->type, tmp->prot, tmp->flags, path);
+                    path = dent->path;
                 }
-
-                screen_refresh(NULL);
-                */
-
-                __asm__ __volatile__("xchg %%bx, %%bx"::);
-                printk("mmap: addr %lx in use but not in a memregion\n", end);
-                kpanic("mmap error\n");
             }
 
-            //if(cur_task->pid >= 59) __asm__ __volatile__("xchg %%bx, %%bx"::);
-            return end;
+            printk("memregion: addr %lx - %lx (type %d, prot %x, fl %x, %s)\n", tmp->addr, tmp->addr + (tmp->size * PAGE_SIZE), tmp->type, tmp->prot, tmp->flags, path);
         }
 
-        memregion = memregion->next;
+        screen_refresh(NULL);
+        */
+
+        __asm__ __volatile__("xchg %%bx, %%bx"::);
+        printk("mmap: addr %lx in use but not in a memregion\n", end);
+        kpanic("mmap error\n");
     }
 
-    return 0;
+    return end;
 }
 
 
@@ -243,7 +199,8 @@ long syscall_mmap(struct syscall_args *__args)
     
     // check fd and file offset are valid for file mapping
     if(!anon && 
-       (fd < 0 || fd >= NR_OPEN || offset < 0 || !PAGE_ALIGNED(offset)))
+       (fd < 0 || fd >= ct->ofiles->max_fds || offset < 0 ||
+        !PAGE_ALIGNED(offset)))
     {
         return -EINVAL;
     }
@@ -792,6 +749,7 @@ long syscall_mremap(struct syscall_args *__args)
         {
             new_size = ((virtual_addr)old_address + new_size) - memregion->addr;
             memregion->size = new_size / PAGE_SIZE;
+            memregion_tree_update(this_core->cur_task->mem, memregion);
 
             if(memregion->inode)
             {
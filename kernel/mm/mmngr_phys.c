@@ -28,12 +28,16 @@
 //#define __DEBUG
 
 #include <kernel/laylaos.h>
+#include <kernel/asm.h>
 #include <kernel/mutex.h>
 #include <kernel/modules.h>
 #include <kernel/vga.h>
 #include <kernel/pcache.h>
+#include <kernel/vfs.h>
+#include <fs/dentry.h>
 #include <mm/mmngr_phys.h>
 #include <mm/mmngr_virtual.h>
+#include <mm/kheap.h>
 #include <mm/mmap.h>
 #include <gui/vbe.h>
 #include <string.h>
@@ -90,6 +94,13 @@ static volatile size_t _mmngr_memory_map_size = 0;
 // Index of the lowest available frame address (to speed lookups)
 static volatile uintptr_t lowest_available_index = 0;
 
+// DMA buffers must be below 4GB
+#ifdef __x86_64__
+#define DMA_LIMIT_FRAME         (0x100000000UL / PMMNGR_BLOCK_SIZE)
+#else
+#define DMA_LIMIT_FRAME         BUDDY_NIL
+#endif
+
 // set any bit (frame) within the memory map bit array
 static void mmap_set(uintptr_t bit)
 {
@@ -196,6 +207,511 @@ static uintptr_t mmap_first_free_s(size_t size)
 }
 
 
+/*
+ * Buddy allocator. Until pmmngr_init_buddy() is called, the functions below
+ * use the memory bitmap above. Once the kernel heap is ready, free memory
+ * moves to per-order lists of naturally aligned blocks, and the bitmap is
+ * no longer used.
+ */
+
+// page frame number used to terminate free lists
+#define BUDDY_NIL               0xffffffff
+
+// values for buddy_state[] (any value below BUDDY_MAX_ORDER means the frame
+// heads a free block of that order)
+#define BUDDY_IN_USE            0xff    /* frame in use or inside a block */
+#define BUDDY_IN_PCP            0x80    /* ORed with the magazine's cpu id */
+
+struct buddy_link_t
+{
+    uint32_t next, prev;
+};
+
+static volatile int buddy_ready = 0;
+
+// number of page frames managed by the buddy allocator
+static size_t buddy_frames = 0;
+
+// free list links and state of each page frame
+static struct buddy_link_t *buddy_links = NULL;
+static volatile unsigned char *buddy_state = NULL;
+
+// free lists (protected by physmem_lock)
+static struct free_area_t free_area[BUDDY_MAX_ORDER];
+static volatile size_t buddy_free_blocks = 0;
+
+// per-cpu page magazines
+static struct pcp_magazine_t pcp_magazines[MAX_CORES];
+
+
+static inline void frame_list_add(uint32_t *head, uint32_t *tail,
+                                  uint32_t frame, int at_tail)
+{
+    struct buddy_link_t *l = &buddy_links[frame];
+
+    if(*head == BUDDY_NIL)
+    {
+        l->next = BUDDY_NIL;
+        l->prev = BUDDY_NIL;
+        *head = frame;
+        *tail = frame;
+    }
+    else if(at_tail)
+    {
+        l->next = BUDDY_NIL;
+        l->prev = *tail;
+        buddy_links[*tail].next = frame;
+        *tail = frame;
+    }
+    else
+    {
+        l->next = *head;
+        l->prev = BUDDY_NIL;
+        buddy_links[*head].prev = frame;
+        *head = frame;
+    }
+}
+
+
+static inline void frame_list_remove(uint32_t *head, uint32_t *tail,
+                                     uint32_t frame)
+{
+    struct buddy_link_t *l = &buddy_links[frame];
+
+    if(l->prev == BUDDY_NIL)
+    {
+        *head = l->next;
+    }
+    else
+    {
+        buddy_links[l->prev].next = l->next;
+    }
+
+    if(l->next == BUDDY_NIL)
+    {
+        *tail = l->prev;
+    }
+    else
+    {
+        buddy_links[l->next].prev = l->prev;
+    }
+}
+
+
+// smallest order with at least 'size' pages
+static inline int buddy_order(size_t size)
+{
+    int order = 0;
+
+    while(((size_t)1 << order) < size)
+    {
+        order++;
+    }
+
+    return order;
+}
+
+
+/*
+ * The functions below must be called with physmem_lock held.
+ */
+
+static inline void __buddy_add_free(uint32_t frame, int order)
+{
+    buddy_state[frame] = order;
+    frame_list_add(&free_area[order].head, &free_area[order].tail, frame, 0);
+    free_area[order].nr_free++;
+}
+
+
+static inline void __buddy_del_free(uint32_t frame, int order)
+{
+    frame_list_remove(&free_area[order].head, &free_area[order].tail, frame);
+    free_area[order].nr_free--;
+    buddy_state[frame] = BUDDY_IN_USE;
+}
+
+
+// free a block, merging it with its buddies as far as possible
+static void __buddy_free(uint32_t frame, int order)
+{
+    uint32_t buddy;
+
+    buddy_free_blocks += ((size_t)1 << order);
+
+    while(order < BUDDY_MAX_ORDER - 1)
+    {
+        buddy = frame ^ ((uint32_t)1 << order);
+
+        if(buddy >= buddy_frames || buddy_state[buddy] != order)
+        {
+            break;
+        }
+
+        __buddy_del_free(buddy, order);
+        frame &= ~((uint32_t)1 << order);
+        order++;
+    }
+
+    __buddy_add_free(frame, order);
+}
+
+
+// free a range of pages as the largest aligned blocks that fit in it
+static void __buddy_free_range(uint32_t frame, size_t count)
+{
+    int order;
+
+    while(count)
+    {
+        order = 0;
+
+        while(order < BUDDY_MAX_ORDER - 1 &&
+              !(frame & ((uint32_t)1 << order)) &&
+              ((size_t)2 << order) <= count)
+        {
+            order++;
+        }
+
+        __buddy_free(frame, order);
+        frame += ((uint32_t)1 << order);
+        count -= ((size_t)1 << order);
+    }
+}
+
+
+// take free block 'frame' off the order 'i' list, and split it down to
+// the wanted order, returning the upper halves to the free lists
+static void __buddy_take_block(uint32_t frame, int i, int order)
+{
+    __buddy_del_free(frame, i);
+    buddy_free_blocks -= ((size_t)1 << i);
+
+    while(i > order)
+    {
+        i--;
+        __buddy_add_free(frame + ((uint32_t)1 << i), i);
+        buddy_free_blocks += ((size_t)1 << i);
+    }
+}
+
+
+static uint32_t __buddy_alloc(int order)
+{
+    uint32_t frame;
+    int i;
+
+    for(i = order; i < BUDDY_MAX_ORDER; i++)
+    {
+        if((frame = free_area[i].head) != BUDDY_NIL)
+        {
+            __buddy_take_block(frame, i, order);
+            return frame;
+        }
+    }
+
+    return BUDDY_NIL;
+}
+
+
+// allocate a block that ends below the given page frame (for DMA buffers),
+// preferring the lowest address we can find
+static uint32_t __buddy_alloc_below(int order, uint32_t limit)
+{
+    uint32_t frame, best = BUDDY_NIL;
+    int i, best_order = 0;
+
+    for(i = order; i < BUDDY_MAX_ORDER; i++)
+    {
+        for(frame = free_area[i].head; frame != BUDDY_NIL;
+            frame = buddy_links[frame].next)
+        {
+            if(frame < best &&
+               frame + ((uint32_t)1 << order) <= limit)
+            {
+                best = frame;
+                best_order = i;
+            }
+        }
+    }
+
+    if(best != BUDDY_NIL)
+    {
+        __buddy_take_block(best, best_order, order);
+    }
+
+    return best;
+}
+
+
+// allocate more pages than fit in a single block, by looking for a run of
+// adjacent free blocks of the highest order
+static uint32_t __buddy_alloc_huge(size_t size)
+{
+    int order = BUDDY_MAX_ORDER - 1;
+    uint32_t step = (uint32_t)1 << order;
+    size_t blocks = (size + step - 1) / step;
+    uint32_t frame, i;
+
+    for(frame = 0; frame + blocks * step <= buddy_frames; frame += step)
+    {
+        for(i = 0; i < blocks; i++)
+        {
+            if(buddy_state[frame + i * step] != order)
+            {
+                break;
+            }
+        }
+
+        if(i == blocks)
+        {
+            for(i = 0; i < blocks; i++)
+            {
+                __buddy_take_block(frame + i * step, order, order);
+            }
+
+            return frame;
+        }
+
+        frame += i * step;
+    }
+
+    return BUDDY_NIL;
+}
+
+
+// take a single page out of the free block containing it (if any)
+static void __buddy_take_frame(uint32_t frame)
+{
+    uint32_t head, end;
+    int order;
+
+    for(order = 0; order < BUDDY_MAX_ORDER; order++)
+    {
+        head = frame & ~(((uint32_t)1 << order) - 1);
+
+        if(buddy_state[head] == order)
+        {
+            end = head + ((uint32_t)1 << order);
+            __buddy_del_free(head, order);
+            buddy_free_blocks -= ((size_t)1 << order);
+            __buddy_free_range(head, frame - head);
+            __buddy_free_range(frame + 1, end - frame - 1);
+            return;
+        }
+    }
+}
+
+
+/*
+ * Lock/unlock a per-cpu page magazine. The caller must disable interrupts,
+ * and must not sleep while holding the lock. If physmem_lock is needed as
+ * well, it must be taken first.
+ */
+static inline struct pcp_magazine_t *lock_pcp(int cpu)
+{
+    struct pcp_magazine_t *pcp = &pcp_magazines[cpu];
+
+    while(!__sync_bool_compare_and_swap(&pcp->holding_cpu, -1,
+                                        this_core->cpuid))
+    {
+        __asm__ __volatile__("pause":::"memory");
+    }
+
+    return pcp;
+}
+
+static inline void unlock_pcp(struct pcp_magazine_t *pcp)
+{
+    __sync_bool_compare_and_swap(&pcp->holding_cpu, this_core->cpuid, -1);
+}
+
+
+// move up to 'count' of the coldest pages from a magazine to the buddy
+// free lists (called with physmem_lock held)
+static void __pcp_drain(int cpu, int count)
+{
+    uintptr_t s = int_off();
+    struct pcp_magazine_t *pcp = lock_pcp(cpu);
+    uint32_t frame;
+
+    while(count-- > 0 && (frame = pcp->tail) != BUDDY_NIL)
+    {
+        frame_list_remove(&pcp->head, &pcp->tail, frame);
+        pcp->count--;
+        buddy_state[frame] = BUDDY_IN_USE;
+        __buddy_free(frame, 0);
+    }
+
+    unlock_pcp(pcp);
+    int_on(s);
+}
+
+
+static void pcp_drain_all(void)
+{
+    int i;
+
+    elevated_priority_lock(&physmem_lock);
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        if(pcp_magazines[i].count)
+        {
+            __pcp_drain(i, pcp_magazines[i].count);
+        }
+    }
+
+    elevated_priority_unlock(&physmem_lock);
+}
+
+
+static void pcp_refill(void)
+{
+    struct pcp_magazine_t *pcp;
+    uintptr_t s;
+    uint32_t frame;
+    int i, cpu;
+
+    elevated_priority_lock(&physmem_lock);
+    s = int_off();
+    cpu = this_core->cpuid;
+    pcp = lock_pcp(cpu);
+
+    for(i = pcp->count; i < PCP_BATCH; i++)
+    {
+        if((frame = __buddy_alloc(0)) == BUDDY_NIL)
+        {
+            break;
+        }
+
+        buddy_state[frame] = BUDDY_IN_PCP | cpu;
+        frame_list_add(&pcp->head, &pcp->tail, frame, 1);
+        pcp->count++;
+    }
+
+    unlock_pcp(pcp);
+    int_on(s);
+    elevated_priority_unlock(&physmem_lock);
+}
+
+
+static uint32_t pcp_alloc(void)
+{
+    struct pcp_magazine_t *pcp;
+    uintptr_t s;
+    uint32_t frame;
+
+    s = int_off();
+    pcp = lock_pcp(this_core->cpuid);
+
+    if(pcp->count == 0)
+    {
+        unlock_pcp(pcp);
+        int_on(s);
+        pcp_refill();
+        s = int_off();
+        pcp = lock_pcp(this_core->cpuid);
+    }
+
+    if((frame = pcp->head) != BUDDY_NIL)
+    {
+        frame_list_remove(&pcp->head, &pcp->tail, frame);
+        pcp->count--;
+        buddy_state[frame] = BUDDY_IN_USE;
+    }
+
+    unlock_pcp(pcp);
+    int_on(s);
+
+    return frame;
+}
+
+
+static void pcp_free(uint32_t frame, int cold)
+{
+    struct pcp_magazine_t *pcp;
+    uintptr_t s;
+    int cpu, count;
+
+    s = int_off();
+    cpu = this_core->cpuid;
+    pcp = lock_pcp(cpu);
+
+    if(buddy_state[frame] != BUDDY_IN_USE)
+    {
+        // double free
+        unlock_pcp(pcp);
+        int_on(s);
+        return;
+    }
+
+    buddy_state[frame] = BUDDY_IN_PCP | cpu;
+    frame_list_add(&pcp->head, &pcp->tail, frame, cold);
+    count = ++pcp->count;
+    unlock_pcp(pcp);
+    int_on(s);
+
+    if(count > PCP_HIGH)
+    {
+        elevated_priority_lock(&physmem_lock);
+        __pcp_drain(cpu, PCP_BATCH);
+        elevated_priority_unlock(&physmem_lock);
+    }
+}
+
+
+// take a page out of whichever magazine it is cached in
+// (called with physmem_lock held)
+static int __pcp_take_frame(uint32_t frame)
+{
+    unsigned char state = buddy_state[frame];
+    struct pcp_magazine_t *pcp;
+    uintptr_t s;
+    int res = 0;
+
+    if(state == BUDDY_IN_USE || !(state & BUDDY_IN_PCP))
+    {
+        return 0;
+    }
+
+    s = int_off();
+    pcp = lock_pcp(state & ~BUDDY_IN_PCP);
+
+    if(buddy_state[frame] == state)
+    {
+        frame_list_remove(&pcp->head, &pcp->tail, frame);
+        pcp->count--;
+        buddy_state[frame] = BUDDY_IN_USE;
+        res = 1;
+    }
+
+    unlock_pcp(pcp);
+    int_on(s);
+
+    return res;
+}
+
+
+// drop one reference to a page, returning 1 if this was the last one
+static inline int frame_put(uintptr_t frame)
+{
+    unsigned char shares;
+
+    while((shares = frame_shares[frame]) != 0)
+    {
+        if(__sync_bool_compare_and_swap(&frame_shares[frame],
+                                        shares, shares - 1))
+        {
+            /* frame is shared. don't release it yet */
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 #ifdef MULTIBOOT2_BOOTLOADER_MAGIC
 
 static void multiboot2_check_boot_modules(unsigned long addr)
@@ -523,6 +1039,23 @@ void pmmngr_init_region(physical_addr base, size_t size)
 	    blocks++;
 	}
 
+	if(buddy_ready)
+	{
+        elevated_priority_lock(&physmem_lock);
+
+    	for( ; blocks > 0; blocks--, align++)
+    	{
+    	    if(align && align < buddy_frames &&
+    	       buddy_state[align] == BUDDY_IN_USE)
+    	    {
+    	        __buddy_free(align, 0);
+    	    }
+    	}
+
+        elevated_priority_unlock(&physmem_lock);
+        return;
+	}
+
 	for( ; blocks > 0; blocks--)
 	{
 		mmap_unset(align++);
@@ -546,6 +1079,22 @@ void pmmngr_deinit_region(physical_addr base, size_t size)
 	    blocks++;
 	}
 
+	if(buddy_ready)
+	{
+        elevated_priority_lock(&physmem_lock);
+
+    	for( ; blocks > 0; blocks--, align++)
+    	{
+    	    if(align < buddy_frames && !__pcp_take_frame(align))
+    	    {
+    	        __buddy_take_frame(align);
+    	    }
+    	}
+
+        elevated_priority_unlock(&physmem_lock);
+        return;
+	}
+
 	for( ; blocks > 0; blocks--)
 	{
 	    is_set = mmap_test(align);
@@ -561,6 +1110,86 @@ void pmmngr_deinit_region(physical_addr base, size_t size)
 }
 
 
+/*
+ * Initialize the buddy allocator.
+ */
+void pmmngr_init_buddy(void)
+{
+    uint32_t frame, count;
+    int i;
+
+    buddy_frames = highest_usable_addr / PMMNGR_BLOCK_SIZE;
+
+    if(buddy_frames > _mmngr_max_blocks)
+    {
+        buddy_frames = _mmngr_max_blocks;
+    }
+
+    // these come from the bitmap, so allocate them before we read it
+    buddy_links = kmalloc(buddy_frames * sizeof(struct buddy_link_t));
+    buddy_state = kmalloc(buddy_frames);
+
+    if(!buddy_links || !buddy_state)
+    {
+        kpanic("pmm: failed to alloc buddy allocator tables\n");
+        empty_loop();
+    }
+
+    A_memset((void *)buddy_state, BUDDY_IN_USE, buddy_frames);
+
+    for(i = 0; i < BUDDY_MAX_ORDER; i++)
+    {
+        free_area[i].head = BUDDY_NIL;
+        free_area[i].tail = BUDDY_NIL;
+        free_area[i].nr_free = 0;
+    }
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        pcp_magazines[i].holding_cpu = -1;
+        pcp_magazines[i].head = BUDDY_NIL;
+        pcp_magazines[i].tail = BUDDY_NIL;
+        pcp_magazines[i].count = 0;
+    }
+
+    elevated_priority_lock(&physmem_lock);
+
+    // move each run of free frames to the free lists
+    for(frame = 0; frame < buddy_frames; )
+    {
+        if(_mmngr_memory_map[frame / 32] == 0xffffffff)
+        {
+            frame = (frame + 32) & ~31;
+            continue;
+        }
+
+        if(mmap_test(frame))
+        {
+            frame++;
+            continue;
+        }
+
+        for(count = 1; frame + count < buddy_frames; count++)
+        {
+            if(mmap_test(frame + count))
+            {
+                break;
+            }
+        }
+
+        __buddy_free_range(frame, count);
+        frame += count;
+    }
+
+    buddy_ready = 1;
+    __asm__ __volatile__("":::"memory");
+    elevated_priority_unlock(&physmem_lock);
+
+    printk("pmm: buddy allocator has %lu free pages\n",
+           (unsigned long)buddy_free_blocks);
+}
+
+
 static void pmmngr_reclaim_memory(size_t count)
 {
     size_t ten_percent = _mmngr_available_blocks / 10;
@@ -575,8 +1204,22 @@ static void pmmngr_reclaim_memory(size_t count)
     }
     */
 
+    // give back the pages cached in the per-cpu magazines, so they can be
+    // merged into bigger blocks
+    if(buddy_ready)
+    {
+        pcp_drain_all();
+
+        if(pmmngr_get_free_block_count() >= sz)
+        {
+            return;
+        }
+    }
+
     remove_unreferenced_cached_pages(NULL);
     remove_old_cached_pages(-1, TWO_MINUTES);
+    shrink_node_cache(NR_UNUSED_INODE / 4);
+    shrink_namecache(NR_NAMECACHE / 4);
     lowest_available_index = 0;
 
     if(pmmngr_get_free_block_count() >= sz)
@@ -601,6 +1244,22 @@ void *pmmngr_alloc_block(void)
     volatile uintptr_t frame;
     volatile int tries = 0;
 
+    if(buddy_ready)
+    {
+        while((frame = pcp_alloc()) == BUDDY_NIL)
+        {
+            if(++tries > 2)
+            {
+                kpanic("pmm: out of memory (pmmngr_alloc_block 2)!\n");
+        		return 0;	//out of memory
+    		}
+
+            pmmngr_reclaim_memory(1);
+        }
+
+    	return (void *)(frame * PMMNGR_BLOCK_SIZE);
+    }
+
 try: ;
 
     elevated_priority_lock(&physmem_lock);
@@ -630,10 +1289,20 @@ try: ;
 }
 
 
-void pmmngr_free_block(void *p)
+static void __pmmngr_free_block(void *p, int cold)
 {
 	volatile uintptr_t frame = (uintptr_t)p / PMMNGR_BLOCK_SIZE;
 
+    if(buddy_ready)
+    {
+        if(frame_put(frame) && frame && frame < buddy_frames)
+        {
+            pcp_free(frame, cold);
+        }
+
+        return;
+    }
+
     elevated_priority_lock(&physmem_lock);
 
     if(frame_shares[frame] == 0)
@@ -658,11 +1327,84 @@ void pmmngr_free_block(void *p)
 }
 
 
+void pmmngr_free_block(void *p)
+{
+    __pmmngr_free_block(p, 0);
+}
+
+
+void pmmngr_free_block_cold(void *p)
+{
+    __pmmngr_free_block(p, 1);
+}
+
+
+// allocate 'size' contiguous pages from the buddy allocator, giving back
+// whatever is left over from the power-of-two block
+static uintptr_t buddy_alloc_blocks(size_t size, int min_order, uint32_t limit)
+{
+    size_t step = (size_t)1 << (BUDDY_MAX_ORDER - 1);
+    int order = buddy_order(size);
+    uintptr_t frame;
+    size_t taken;
+
+    if(order < min_order)
+    {
+        order = min_order;
+    }
+
+    elevated_priority_lock(&physmem_lock);
+
+    if(order >= BUDDY_MAX_ORDER)
+    {
+        // too big for one block, take a run of whole top-order blocks
+        frame = __buddy_alloc_huge(size);
+        taken = ((size + step - 1) / step) * step;
+    }
+    else
+    {
+        frame = limit ? __buddy_alloc_below(order, limit) :
+                        __buddy_alloc(order);
+        taken = (size_t)1 << order;
+    }
+
+    if(frame != BUDDY_NIL && taken > size)
+    {
+        __buddy_free_range(frame + size, taken - size);
+    }
+
+    elevated_priority_unlock(&physmem_lock);
+
+    return (frame == BUDDY_NIL) ? 0 : frame;
+}
+
+
 void *pmmngr_alloc_blocks(size_t size)
 {
     volatile uintptr_t frame;
     volatile int tries = 0;
 
+    if(buddy_ready && size)
+    {
+        if(size == 1)
+        {
+            return pmmngr_alloc_block();
+        }
+
+        while((frame = buddy_alloc_blocks(size, 0, 0)) == 0)
+        {
+            if(++tries > 2)
+            {
+                kpanic("pmm: out of memory (pmmngr_alloc_blocks 2)!\n");
+        		return 0;	//not enough space
+    		}
+
+            pmmngr_reclaim_memory(size);
+        }
+
+    	return (void*)(frame * PMMNGR_BLOCK_SIZE);
+    }
+
 try: ;
 
     elevated_priority_lock(&physmem_lock);
@@ -697,6 +1439,30 @@ try: ;
 
 void *pmmngr_alloc_dma_blocks(size_t size)
 {
+    if(buddy_ready && size)
+    {
+        /*
+         * DMA requires memory buffers to be 64kb-aligned, which is what
+         * we get from a block of order 4 or higher. The buffer also has to
+         * be below 4GB.
+         */
+        uintptr_t frame;
+        volatile int tries = 0;
+
+        while((frame = buddy_alloc_blocks(size, 4, DMA_LIMIT_FRAME)) == 0)
+        {
+            if(++tries > 2)
+            {
+                kpanic("pmm: out of memory (pmmngr_alloc_dma_blocks)!\n");
+        		return 0;	//not enough space
+    		}
+
+            pmmngr_reclaim_memory(size);
+        }
+
+    	return (void *)(frame * PMMNGR_BLOCK_SIZE);
+    }
+
     elevated_priority_lock(&physmem_lock);
 
 	uintptr_t frame = 0;
@@ -816,6 +1582,43 @@ done:
 void pmmngr_free_blocks(void *p, size_t size)
 {
 	uintptr_t frame = (uintptr_t)p / PMMNGR_BLOCK_SIZE;
+	uintptr_t start;
+
+    if(buddy_ready)
+    {
+        if(size == 1)
+        {
+            pmmngr_free_block(p);
+            return;
+        }
+
+        elevated_priority_lock(&physmem_lock);
+
+        // free each run of pages that are not shared as one range
+        for(start = frame; size; frame++, size--)
+        {
+            if(frame_put(frame) && frame && frame < buddy_frames &&
+               buddy_state[frame] == BUDDY_IN_USE)
+            {
+                continue;
+            }
+
+            if(frame > start)
+            {
+                __buddy_free_range(start, frame - start);
+            }
+
+            start = frame + 1;
+        }
+
+        if(frame > start)
+        {
+            __buddy_free_range(start, frame - start);
+        }
+
+        elevated_priority_unlock(&physmem_lock);
+        return;
+    }
 
     elevated_priority_lock(&physmem_lock);
 
@@ -862,6 +1665,18 @@ size_t pmmngr_get_free_block_count(void)
     volatile size_t i;
     size_t unused = 0, count = _mmngr_memory_map_size;
 
+    if(buddy_ready)
+    {
+        unused = buddy_free_blocks;
+
+        for(i = 0; i < MAX_CORES; i++)
+        {
+            unused += pcp_magazines[i].count;
+        }
+
+        return unused;
+    }
+
 	for(i = 0; i < count; i++)
 	{
 		if(_mmngr_memory_map[i] != 0xffffffff)
@@ -900,3 +1715,26 @@ void pmmngr_load_PDBR(physical_addr addr)
 
 }
 
+
+
+/*
+ * Get buddy allocator info.
+ */
+size_t pmmngr_get_buddyinfo(size_t *nr_free)
+{
+    size_t pcp = 0;
+    int i;
+
+    for(i = 0; i < BUDDY_MAX_ORDER; i++)
+    {
+        nr_free[i] = free_area[i].nr_free;
+    }
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        pcp += pcp_magazines[i].count;
+    }
+
+    return pcp;
+}
+
@@ -0,0 +1,488 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: slab.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file slab.c
+ *
+ *  Slab object caches. Hot fixed-size kernel objects are allocated from
+ *  per-cpu magazines, which are refilled from (and drained to) slabs under
+ *  the cache's own lock. Slabs are carved out of the kernel heap, so the
+ *  heap lock is only taken when a cache grows or shrinks.
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <string.h>
+#include <kernel/laylaos.h>
+#include <kernel/asm.h>
+#include <kernel/task.h>
+#include <mm/kheap.h>
+#include <mm/slab.h>
+
+struct kmem_cache_t *kmem_caches = NULL;
+volatile struct kernel_mutex_t kmem_caches_lock = { 0, };
+
+
+/*
+ * Lock/unlock a per-cpu magazine. The caller must disable interrupts,
+ * and must not sleep while holding the lock. If the cache lock is needed
+ * as well, it must be taken first.
+ */
+static inline struct kmem_magazine_t *lock_magazine(struct kmem_cache_t *cache,
+                                                    int cpu)
+{
+    struct kmem_magazine_t *mag = &cache->magazines[cpu];
+
+    while(!__sync_bool_compare_and_swap(&mag->holding_cpu, -1,
+                                        this_core->cpuid))
+    {
+        __asm__ __volatile__("pause":::"memory");
+    }
+
+    return mag;
+}
+
+static inline void unlock_magazine(struct kmem_magazine_t *mag)
+{
+    __sync_bool_compare_and_swap(&mag->holding_cpu, this_core->cpuid, -1);
+}
+
+
+static inline void slab_list_add(struct kmem_slab_t **list,
+                                 struct kmem_slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+
+    if(*list)
+    {
+        (*list)->prev = slab;
+    }
+
+    *list = slab;
+}
+
+
+static inline void slab_list_remove(struct kmem_slab_t **list,
+                                    struct kmem_slab_t *slab)
+{
+    if(slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+
+    if(slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+
+/*
+ * The functions below must be called with the cache lock held.
+ */
+
+static struct kmem_slab_t *__kmem_cache_grow(struct kmem_cache_t *cache)
+{
+    struct kmem_slab_t *slab;
+    uintptr_t objs;
+    int i;
+
+    if(!(slab = kmemalign(cache->slab_size, cache->slab_size)))
+    {
+        return NULL;
+    }
+
+    objs = (uintptr_t)&slab->free[cache->objs_per_slab];
+    objs = (objs + cache->align - 1) & ~(cache->align - 1);
+
+    slab->cache = cache;
+    slab->objs = (void *)objs;
+    slab->inuse = 0;
+    slab->nfree = cache->objs_per_slab;
+
+    // hand out the objects in address order
+    for(i = 0; i < cache->objs_per_slab; i++)
+    {
+        slab->free[i] = cache->objs_per_slab - i - 1;
+
+        if(cache->ctor)
+        {
+            cache->ctor((void *)(objs + (i * cache->size)));
+        }
+    }
+
+    slab_list_add(&cache->empty, slab);
+    cache->nr_slabs++;
+    cache->nr_empty++;
+
+    return slab;
+}
+
+
+static void *__slab_get(struct kmem_cache_t *cache)
+{
+    struct kmem_slab_t *slab;
+    void *obj;
+
+    if(!(slab = cache->partial))
+    {
+        if(!(slab = cache->empty) && !(slab = __kmem_cache_grow(cache)))
+        {
+            return NULL;
+        }
+
+        slab_list_remove(&cache->empty, slab);
+        slab_list_add(&cache->partial, slab);
+        cache->nr_empty--;
+    }
+
+    obj = (void *)((uintptr_t)slab->objs +
+                            (slab->free[--slab->nfree] * cache->size));
+    slab->inuse++;
+    cache->nr_active++;
+
+    if(slab->nfree == 0)
+    {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    return obj;
+}
+
+
+static void __slab_put(struct kmem_cache_t *cache, void *obj)
+{
+    struct kmem_slab_t *slab;
+
+    slab = (struct kmem_slab_t *)((uintptr_t)obj & ~(cache->slab_size - 1));
+    slab->free[slab->nfree++] = ((uintptr_t)obj - (uintptr_t)slab->objs) /
+                                                                cache->size;
+    slab->inuse--;
+    cache->nr_active--;
+
+    if(slab->nfree == 1)
+    {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    if(slab->inuse == 0)
+    {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->empty, slab);
+        cache->nr_empty++;
+    }
+}
+
+
+// release empty slabs, keeping at most 'keep' of them for future use
+static void __kmem_cache_trim(struct kmem_cache_t *cache, int keep)
+{
+    struct kmem_slab_t *slab;
+
+    while(cache->nr_empty > keep && (slab = cache->empty))
+    {
+        slab_list_remove(&cache->empty, slab);
+        cache->nr_empty--;
+        cache->nr_slabs--;
+        kfree(slab);
+    }
+}
+
+
+/*
+ * Create a slab cache.
+ */
+struct kmem_cache_t *kmem_cache_create(char *name, size_t size, size_t align,
+                                       void (*ctor)(void *))
+{
+    struct kmem_cache_t *cache;
+    size_t slab_size, hdr;
+    int i, n;
+
+    if(!name || !size)
+    {
+        return NULL;
+    }
+
+    if(align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+
+    if(!(cache = kmalloc(sizeof(struct kmem_cache_t))))
+    {
+        return NULL;
+    }
+
+    A_memset(cache, 0, sizeof(struct kmem_cache_t));
+    strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+    cache->objsize = size;
+    cache->size = (size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->ctor = ctor;
+
+    // find the smallest slab that fits enough objects
+    for(slab_size = PAGE_SIZE; ; slab_size <<= 1)
+    {
+        n = (slab_size - sizeof(struct kmem_slab_t)) /
+                                (cache->size + sizeof(uint16_t));
+
+        // account for aligning the first object
+        while(n > 0)
+        {
+            hdr = sizeof(struct kmem_slab_t) + (n * sizeof(uint16_t));
+            hdr = (hdr + align - 1) & ~(align - 1);
+
+            if(hdr + (n * cache->size) <= slab_size)
+            {
+                break;
+            }
+
+            n--;
+        }
+
+        if(n >= KMEM_MIN_OBJS_PER_SLAB || slab_size >= KMEM_MAX_SLAB_SIZE)
+        {
+            break;
+        }
+    }
+
+    if(n <= 0)
+    {
+        kfree(cache);
+        return NULL;
+    }
+
+    cache->slab_size = slab_size;
+    cache->objs_per_slab = (n > 0xffff) ? 0xffff : n;
+    init_kernel_mutex(&cache->lock);
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        cache->magazines[i].holding_cpu = -1;
+    }
+
+    kernel_mutex_lock(&kmem_caches_lock);
+    cache->next = kmem_caches;
+    kmem_caches = cache;
+    kernel_mutex_unlock(&kmem_caches_lock);
+
+    return cache;
+}
+
+
+/*
+ * Get objects from the slabs when the magazine is empty. We return one of
+ * them, and put the rest in the magazine.
+ */
+static void *kmem_cache_refill(struct kmem_cache_t *cache)
+{
+    struct kmem_magazine_t *mag;
+    void *objs[KMEM_BATCH];
+    void *obj;
+    uintptr_t s;
+    int n = 0;
+
+    elevated_priority_lock(&cache->lock);
+
+    while(n < KMEM_BATCH && (objs[n] = __slab_get(cache)))
+    {
+        n++;
+    }
+
+    if(n == 0)
+    {
+        elevated_priority_unlock(&cache->lock);
+        return NULL;
+    }
+
+    obj = objs[--n];
+    s = int_off();
+    mag = lock_magazine(cache, this_core->cpuid);
+
+    while(n && mag->count < KMEM_MAGAZINE_SIZE)
+    {
+        mag->objs[mag->count++] = objs[--n];
+    }
+
+    unlock_magazine(mag);
+    int_on(s);
+
+    // someone filled the magazine while we were waiting for the lock
+    while(n)
+    {
+        __slab_put(cache, objs[--n]);
+    }
+
+    elevated_priority_unlock(&cache->lock);
+
+    return obj;
+}
+
+
+/*
+ * Allocate an object.
+ */
+void *kmem_cache_alloc(struct kmem_cache_t *cache)
+{
+    struct kmem_magazine_t *mag;
+    void *obj = NULL;
+    uintptr_t s;
+
+    s = int_off();
+    mag = lock_magazine(cache, this_core->cpuid);
+
+    if(mag->count)
+    {
+        obj = mag->objs[--mag->count];
+    }
+
+    unlock_magazine(mag);
+    int_on(s);
+
+    return obj ? obj : kmem_cache_refill(cache);
+}
+
+
+/*
+ * Free an object.
+ */
+void kmem_cache_free(struct kmem_cache_t *cache, void *obj)
+{
+    struct kmem_magazine_t *mag;
+    void *objs[KMEM_BATCH];
+    uintptr_t s;
+    int n = 0;
+
+    if(!obj)
+    {
+        return;
+    }
+
+    s = int_off();
+    mag = lock_magazine(cache, this_core->cpuid);
+
+    // if the magazine is full, give its older half back to the slabs
+    if(mag->count == KMEM_MAGAZINE_SIZE)
+    {
+        for(n = 0; n < KMEM_BATCH; n++)
+        {
+            objs[n] = mag->objs[n];
+        }
+
+        for( ; n < KMEM_MAGAZINE_SIZE; n++)
+        {
+            mag->objs[n - KMEM_BATCH] = mag->objs[n];
+        }
+
+        mag->count -= KMEM_BATCH;
+        n = KMEM_BATCH;
+    }
+
+    mag->objs[mag->count++] = obj;
+    unlock_magazine(mag);
+    int_on(s);
+
+    if(n)
+    {
+        elevated_priority_lock(&cache->lock);
+
+        while(n)
+        {
+            __slab_put(cache, objs[--n]);
+        }
+
+        __kmem_cache_trim(cache, 1);
+        elevated_priority_unlock(&cache->lock);
+    }
+}
+
+
+/*
+ * Destroy a slab cache.
+ */
+int kmem_cache_destroy(struct kmem_cache_t *cache)
+{
+    struct kmem_cache_t **c;
+    struct kmem_magazine_t *mag;
+    uintptr_t s;
+    int i;
+
+    if(!cache)
+    {
+        return -EINVAL;
+    }
+
+    elevated_priority_lock(&cache->lock);
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        s = int_off();
+        mag = lock_magazine(cache, i);
+
+        while(mag->count)
+        {
+            __slab_put(cache, mag->objs[--mag->count]);
+        }
+
+        unlock_magazine(mag);
+        int_on(s);
+    }
+
+    if(cache->nr_active)
+    {
+        printk("slab: destroying cache '%s' with %lu objects in use\n",
+               cache->name, cache->nr_active);
+        elevated_priority_unlock(&cache->lock);
+        return -EBUSY;
+    }
+
+    __kmem_cache_trim(cache, 0);
+    elevated_priority_unlock(&cache->lock);
+
+    kernel_mutex_lock(&kmem_caches_lock);
+
+    for(c = &kmem_caches; *c; c = &(*c)->next)
+    {
+        if(*c == cache)
+        {
+            *c = cache->next;
+            break;
+        }
+    }
+
+    kernel_mutex_unlock(&kmem_caches_lock);
+    kfree(cache);
+
+    return 0;
+}
+
@@ -140,6 +140,7 @@ void dhcp_init(void)
         dhcp_sock->remote_addr.ipv4 = 0;
         dhcp_sock->local_port = DHCP_CLIENT_PORT;
         dhcp_sock->remote_port = DHCP_SERVER_PORT;
+        sock_rehash(dhcp_sock);
 
         (void)start_kernel_task("dhcp", dhcp_sock_func, NULL, &dhcp_sock_task, 0);
     }
@@ -564,7 +565,7 @@ int dhcp_state_transition(struct dhcp_binding_t *binding, int req_state)
         {
             nettimer_release(binding->dhcp_renewing_timer);
             binding->dhcp_renewing_timer = 
-                    nettimer_add(secs * PIT_FREQUENCY, dhcp_renewing_timeout, binding);
+                    nettimer_add(secs * 1000, dhcp_renewing_timeout, binding);
         }
     }
     else if(req_state == DHCP_REBINDING && tries == 1)
@@ -579,7 +580,7 @@ int dhcp_state_transition(struct dhcp_binding_t *binding, int req_state)
         {
             nettimer_release(binding->dhcp_rebinding_timer);
             binding->dhcp_rebinding_timer = 
-                    nettimer_add(secs * PIT_FREQUENCY, dhcp_rebinding_timeout, binding);
+                    nettimer_add(secs * 1000, dhcp_rebinding_timeout, binding);
         }
     }
     else if(req_state == DHCP_DECLINING)
@@ -592,7 +593,7 @@ int dhcp_state_transition(struct dhcp_binding_t *binding, int req_state)
         {
             nettimer_release(binding->dhcp_declining_timer);
             binding->dhcp_declining_timer = 
-                    nettimer_add(secs * PIT_FREQUENCY, dhcp_declining_timeout, binding);
+                    nettimer_add(secs * 1000, dhcp_declining_timeout, binding);
         }
     }
     else if(req_state == DHCP_RELEASING)
@@ -616,7 +617,7 @@ int dhcp_state_transition(struct dhcp_binding_t *binding, int req_state)
         {
             nettimer_release(binding->dhcp_requesting_timer);
             binding->dhcp_requesting_timer = 
-                    nettimer_add(secs * PIT_FREQUENCY, dhcp_requesting_timeout, binding);
+                    nettimer_add(secs * 1000, dhcp_requesting_timeout, binding);
         }
     }
     
@@ -642,7 +643,7 @@ int dhcp_state_transition(struct dhcp_binding_t *binding, int req_state)
 
 void dhcp_check(struct dhcp_binding_t *binding)
 {
-    int ticks;
+    int msecs;
 
     printk("dhcp: sending APR request for ip 0x%x\n", htonl(binding->ipaddr));
     arp_request(binding->ifp, 0x00, binding->ipaddr);
@@ -657,10 +658,10 @@ void dhcp_check(struct dhcp_binding_t *binding)
     }
 
     // wait in 500ms increments
-    ticks = MIN(binding->tries, DHCP_CAP_TRIES) * 1 * (PIT_FREQUENCY / 2);
+    msecs = MIN(binding->tries, DHCP_CAP_TRIES) * 500;
 
     nettimer_release(binding->dhcp_checking_timer);
-    binding->dhcp_checking_timer = nettimer_add(ticks, dhcp_checking_timeout, binding);
+    binding->dhcp_checking_timer = nettimer_add(msecs, dhcp_checking_timeout, binding);
 }
 
 
@@ -674,17 +675,17 @@ void dhcp_bind(struct dhcp_binding_t *binding)
     // and its not infinity, then start a timer for each
     if(binding->t1 != 0 && binding->t1 != 0xFFFFFFFF)
     {
-        nettimer_add(binding->t1 * PIT_FREQUENCY, dhcp_t1_timeout, binding);
+        nettimer_add(binding->t1 * 1000, dhcp_t1_timeout, binding);
     }
 
     if(binding->t2 != 0 && binding->t2 != 0xFFFFFFFF)
     {
-        nettimer_add(binding->t2 * PIT_FREQUENCY, dhcp_t2_timeout, binding);
+        nettimer_add(binding->t2 * 1000, dhcp_t2_timeout, binding);
     }
 
     if(binding->lease != 0 && binding->lease != 0xFFFFFFFF)
     {
-        nettimer_add(binding->lease * PIT_FREQUENCY, dhcp_lease_timeout, binding);
+        nettimer_add(binding->lease * 1000, dhcp_lease_timeout, binding);
     }
 
     netmask = binding->netmask;
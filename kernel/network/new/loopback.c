@@ -49,6 +49,12 @@ static struct netif_t loop_netif = { 0, };
 static struct netif_t *loifp = &loop_netif;
 static volatile struct task_t *loopback_task = NULL;
 
+/*
+ * Packets to drop out of every 1000 we send, set by the NET_LOOPBACK_DROP
+ * sysctl. Used to test how protocols recover from packet loss.
+ */
+volatile int loopback_drop_rate = 0;
+
 
 void loop_attach(void)
 {
@@ -135,6 +141,16 @@ static int loopback_transmit(struct netif_t *ifp, struct packet_t *p)
 
     packet_add_header(p, ETHER_HLEN);
 
+    // simulate a lossy link
+    if(loopback_drop_rate &&
+       (int)(genrand_int32() % 1000) < loopback_drop_rate)
+    {
+        ifp->stats.tx_dropped++;
+        netstats.link.drop++;
+        free_packet(p);
+        return 0;
+    }
+
     ifp->stats.rx_packets++;
     ifp->stats.rx_bytes += p->count;
 
@@ -23,19 +23,50 @@
  *  \file nettimer.c
  *
  *  Network timer implementation.
- */
+ *
+ *  Timers are kept in per-cpu hierarchical timing wheels (see nettimer.h),
+ *  which makes adding and removing a timer O(1). A single kernel task runs
+ *  the expired timers on all wheels, and sleeps on a high-resolution timer
+ *  until the next timer expires.
+  */
 
 #include <kernel/laylaos.h>
 #include <kernel/mutex.h>
 #include <kernel/task.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+#include <kernel/hrtimer.h>
 #include <kernel/net/nettimer.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
+
+#define TVN_START(level)        (NETTIMER_TVR_SIZE + \
+                                    (((level) - 1) * NETTIMER_TVN_SIZE))
+#define TVN_INDEX(clk, level)   (((clk) >> (NETTIMER_TVR_BITS + \
+                                    ((level) - 1) * NETTIMER_TVN_BITS)) & \
+                                        NETTIMER_TVN_MASK)
+
+#define SLOT_LEVEL(slot)        (((slot) < NETTIMER_TVR_SIZE) ? 0 :     \
+                                    1 + (((slot) - NETTIMER_TVR_SIZE) >> \
+                                            NETTIMER_TVN_BITS))
 
-struct nettimer_t timers_head = { 0, };
-volatile struct kernel_mutex_t nettimer_lock;
+static struct nettimer_wheel_t wheels[MAX_CORES];
 volatile struct task_t *nettimer_task = NULL;
 
+static struct kmem_cache_t *nettimer_cache = NULL;
+
+/*
+ * The wakeup timer wakes the nettimer task when the first timer expires.
+ * wakeup_expires is the time (in ms) the wakeup timer is armed for, and
+ * only ever moves backwards between runs of the task, so that timers added
+ * while the task is busy are not missed.
+ */
+static struct hrtimer_t wakeup_timer;
+static volatile struct kernel_mutex_t wakeup_lock;
+static unsigned long long wakeup_expires = ~0ULL;
+
 static void nettimer_func(void *arg);
+static int wakeup_timer_func(struct hrtimer_t *timer);
 
 
 /*
@@ -43,14 +74,41 @@ static void nettimer_func(void *arg);
  */
 void nettimer_init(void)
 {
-    init_kernel_mutex(&nettimer_lock);
+    unsigned long long now = nettimer_now();
+    int i;
+
+    for(i = 0; i < MAX_CORES; i++)
+    {
+        A_memset(&wheels[i], 0, sizeof(struct nettimer_wheel_t));
+        init_kernel_mutex(&wheels[i].lock);
+        wheels[i].clk = now;
+    }
+
+    init_kernel_mutex(&wakeup_lock);
+    hrtimer_setup(&wakeup_timer, wakeup_timer_func, NULL);
+
+    if(!(nettimer_cache = kmem_cache_create("nettimer",
+                                    sizeof(struct nettimer_t), 0, NULL)))
+    {
+        kpanic("Failed to create network timer cache\n");
+    }
+
     (void)start_kernel_task("nettimer", nettimer_func, NULL, &nettimer_task, 0);
 }
 
 
+/*
+ * Get the current time in milliseconds.
+ */
+unsigned long long nettimer_now(void)
+{
+    return hrtimer_now() / NSEC_PER_MSEC;
+}
+
+
 STATIC_INLINE void nettimer_free(volatile struct nettimer_t *t)
 {
-    kfree((void *)t);
+    kmem_cache_free(nettimer_cache, (void *)t);
 }
 
 
@@ -58,118 +116,443 @@ STATIC_INLINE struct nettimer_t *nettimer_alloc(void)
 {
     struct nettimer_t *t;
 
-    if((t = kmalloc(sizeof(struct nettimer_t))))
+    if((t = kmem_cache_alloc(nettimer_cache)))
     {
         A_memset(t, 0, sizeof(struct nettimer_t));
+        t->slot = -1;
     }
 
     return t;
 }
 
 
-static void nettimer_func(void *arg)
+/*
+ * Queue a timer on the wheel. The caller must hold the wheel's lock.
+ */
+static void wheel_add(struct nettimer_wheel_t *w, struct nettimer_t *t)
 {
-    volatile struct nettimer_t *t, *prev;
+    unsigned long long expires = t->expires;
+    unsigned long long delta;
+    int slot;
 
-    UNUSED(arg);
+    if(expires < w->clk)
+    {
+        // already expired, run it next time around
+        slot = w->clk & NETTIMER_TVR_MASK;
+    }
+    else if((delta = expires - w->clk) < NETTIMER_TVR_SIZE)
+    {
+        slot = expires & NETTIMER_TVR_MASK;
+    }
+    else if(delta < (1ULL << (NETTIMER_TVR_BITS + NETTIMER_TVN_BITS)))
+    {
+        slot = TVN_START(1) + TVN_INDEX(expires, 1);
+    }
+    else if(delta < (1ULL << (NETTIMER_TVR_BITS + 2 * NETTIMER_TVN_BITS)))
+    {
+        slot = TVN_START(2) + TVN_INDEX(expires, 2);
+    }
+    else if(delta < (1ULL << (NETTIMER_TVR_BITS + 3 * NETTIMER_TVN_BITS)))
+    {
+        slot = TVN_START(3) + TVN_INDEX(expires, 3);
+    }
+    else
+    {
+        if(delta > NETTIMER_MAX_MSECS)
+        {
+            expires = w->clk + NETTIMER_MAX_MSECS;
+            t->expires = expires;
+        }
 
-    while(1)
+        slot = TVN_START(4) + TVN_INDEX(expires, 4);
+    }
+
+    if((t->next = w->slots[slot]))
+    {
+        t->next->pprev = &t->next;
+    }
+
+    w->slots[slot] = t;
+    t->pprev = &w->slots[slot];
+    t->slot = slot;
+
+    if(slot < NETTIMER_TVR_SIZE)
+    {
+        w->bitmap[slot >> 5] |= (1U << (slot & 31));
+    }
+
+    w->level_count[SLOT_LEVEL(slot)]++;
+    w->count++;
+}
+
+
+/*
+ * Remove a timer from the wheel. The caller must hold the wheel's lock.
+ */
+static void wheel_del(struct nettimer_wheel_t *w, struct nettimer_t *t)
+{
+    int slot = t->slot;
+
+    if(slot < 0)
+    {
+        return;
+    }
+
+    if((*t->pprev = t->next))
+    {
+        t->next->pprev = t->pprev;
+    }
+
+    if(slot < NETTIMER_TVR_SIZE && !w->slots[slot])
+    {
+        w->bitmap[slot >> 5] &= ~(1U << (slot & 31));
+    }
+
+    w->level_count[SLOT_LEVEL(slot)]--;
+    w->count--;
+    t->next = NULL;
+    t->pprev = NULL;
+    t->slot = -1;
+}
+
+
+/*
+ * Move the timers in a slot of a higher level down the wheel.
+ * Returns the slot index within the level.
+ */
+static int wheel_cascade(struct nettimer_wheel_t *w, int level)
+{
+    int index = TVN_INDEX(w->clk, level);
+    int slot = TVN_START(level) + index;
+    struct nettimer_t *t, *next;
+
+    if(!(t = w->slots[slot]))
+    {
+        return index;
+    }
+
+    w->slots[slot] = NULL;
+
+    for( ; t != NULL; t = next)
+    {
+        next = t->next;
+        w->level_count[level]--;
+        w->count--;
+        wheel_add(w, t);
+    }
+
+    return index;
+}
+
+
+/*
+ * Find the next first level slot (at or after the wheel's clock) with
+ * queued timers. Returns the slot's time, or ~0ULL if there is none.
+ */
+static unsigned long long wheel_next_slot(struct nettimer_wheel_t *w)
+{
+    int idx = w->clk & NETTIMER_TVR_MASK;
+    int i, slot;
+    uint32_t bits;
+
+    if(!w->level_count[0])
     {
-        block_task2(&nettimer_task, PIT_FREQUENCY / 5);
+        return ~0ULL;
+    }
 
-        kernel_mutex_lock(&nettimer_lock);
+    for(i = 0; i <= NETTIMER_TVR_SIZE / 32; i++)
+    {
+        slot = ((idx >> 5) + i) % (NETTIMER_TVR_SIZE / 32);
+        bits = w->bitmap[slot];
 
-        for(prev = &timers_head, t = timers_head.next; 
-            t != NULL; 
-            t = prev->next)
+        // on the first word, ignore slots behind the clock (they belong
+        // to the next round, which we look at on the last iteration)
+        if(i == 0)
         {
-            if(!t->cancelled && t->expires < ticks)
-            {
-                t->cancelled = 1;
-                kernel_mutex_unlock(&nettimer_lock);
-                t->handler(t->arg);
-                kernel_mutex_lock(&nettimer_lock);
-            }
+            bits &= ~((1U << (idx & 31)) - 1);
+        }
+        else if(i == NETTIMER_TVR_SIZE / 32)
+        {
+            bits &= ((1U << (idx & 31)) - 1);
+        }
 
-            if(t->cancelled && t->refs == 0)
+        if(bits)
+        {
+            slot = (slot << 5) + __builtin_ctz(bits);
+
+            return w->clk + ((slot - idx) & NETTIMER_TVR_MASK);
+        }
+    }
+
+    return ~0ULL;
+}
+
+
+/*
+ * Get the time (in ms) the wheel needs to be looked at next, which is
+ * either when its first timer expires, or when the higher levels need to
+ * be cascaded down. Returns ~0ULL if the wheel is empty. The caller must
+ * hold the wheel's lock.
+ */
+static unsigned long long wheel_next(struct nettimer_wheel_t *w)
+{
+    unsigned long long next, cascade;
+
+    if(!w->count)
+    {
+        return ~0ULL;
+    }
+
+    next = wheel_next_slot(w);
+
+    if(w->count != w->level_count[0])
+    {
+        cascade = (w->clk & NETTIMER_TVR_MASK) ? 
+                        (w->clk | NETTIMER_TVR_MASK) + 1 : w->clk;
+
+        if(cascade < next)
+        {
+            next = cascade;
+        }
+    }
+
+    return next;
+}
+
+
+/*
+ * Run the expired timers on a wheel. Handlers are called without the
+ * wheel's lock held, so they can add and release timers.
+ */
+static void wheel_run(struct nettimer_wheel_t *w, unsigned long long now)
+{
+    struct nettimer_t *t;
+    unsigned long long next;
+    int index, slot;
+
+    kernel_mutex_lock(&w->lock);
+
+    while(w->clk <= now)
+    {
+        if(!w->count)
+        {
+            w->clk = now + 1;
+            break;
+        }
+
+        index = w->clk & NETTIMER_TVR_MASK;
+
+        if(!index &&
+           !wheel_cascade(w, 1) &&
+           !wheel_cascade(w, 2) &&
+           !wheel_cascade(w, 3))
+        {
+            wheel_cascade(w, 4);
+        }
+
+        slot = index;
+
+        while((t = w->slots[slot]))
+        {
+            wheel_del(w, t);
+            t->cancelled = 1;
+            t->running = 1;
+            kernel_mutex_unlock(&w->lock);
+
+            t->handler(t->arg);
+
+            kernel_mutex_lock(&w->lock);
+            t->running = 0;
+
+            if(t->refs == 0)
             {
-                prev->next = t->next;
                 nettimer_free(t);
             }
-            else
-            {
-                prev = t;
-            }
         }
 
-        kernel_mutex_unlock(&nettimer_lock);
+        // skip empty slots, but stop at the next cascade
+        w->clk++;
+
+        if((next = wheel_next(w)) > now + 1)
+        {
+            next = now + 1;
+        }
+
+        if(next > w->clk)
+        {
+            w->clk = next;
+        }
     }
+
+    kernel_mutex_unlock(&w->lock);
 }
 
 
-struct nettimer_t *nettimer_add(uint32_t expire, void (*handler)(void *), void *arg)
+/*
+ * Make sure the nettimer task wakes up by the given time (in ms).
+ */
+static void nettimer_kick(unsigned long long expires)
 {
-    struct nettimer_t *t, *nt = nettimer_alloc();
+    kernel_mutex_lock(&wakeup_lock);
 
-    if(!nt)
+    if(expires < wakeup_expires)
     {
-        return NULL;
+        wakeup_expires = expires;
+        hrtimer_start(&wakeup_timer, expires * NSEC_PER_MSEC);
     }
 
-    nt->refs = 1;
-    nt->expires = ticks + expire;
-    nt->handler = handler;
-    nt->arg = arg;
+    kernel_mutex_unlock(&wakeup_lock);
+}
+
 
-    kernel_mutex_lock(&nettimer_lock);
+/*
+ * Wake the nettimer task. If the task is busy, it might have already looked
+ * at the wheels, so we try again a bit later instead of losing the wakeup.
+ */
+static int wakeup_timer_func(struct hrtimer_t *timer)
+{
+    volatile struct task_t *task = nettimer_task;
 
-    for(t = &timers_head; t->next != NULL; t = t->next)
+    if(!task)
     {
-        ;
+        return HRTIMER_NORESTART;
     }
 
-    t->next = nt;
-    kernel_mutex_unlock(&nettimer_lock);
+    if(task->state == TASK_WAITING)
+    {
+        unblock_task_no_preempt(task);
+        return HRTIMER_NORESTART;
+    }
+
+    timer->expires += NSEC_PER_MSEC;
 
-    return nt;
+    return HRTIMER_RESTART;
 }
 
 
-void nettimer_oneshot(uint32_t expire, void (*handler)(void *), void *arg)
+static void nettimer_func(void *arg)
 {
-    struct nettimer_t *t, *nt = nettimer_alloc();
+    unsigned long long now, next, expires;
+    int i;
 
-    if(!nt)
+    UNUSED(arg);
+
+    while(1)
     {
-        return;
+        kernel_mutex_lock(&wakeup_lock);
+        wakeup_expires = ~0ULL;
+        kernel_mutex_unlock(&wakeup_lock);
+
+        now = nettimer_now();
+        expires = ~0ULL;
+
+        for(i = 0; i < processor_count; i++)
+        {
+            wheel_run(&wheels[i], now);
+
+            kernel_mutex_lock(&wheels[i].lock);
+            next = wheel_next(&wheels[i]);
+            kernel_mutex_unlock(&wheels[i].lock);
+
+            if(next < expires)
+            {
+                expires = next;
+            }
+        }
+
+        if(expires != ~0ULL)
+        {
+            nettimer_kick(expires);
+        }
+
+        block_task(&nettimer_task, 0);
     }
+}
 
-    nt->expires = ticks + expire;
-    nt->handler = handler;
-    nt->arg = arg;
 
-    kernel_mutex_lock(&nettimer_lock);
+static struct nettimer_t *nettimer_queue(uint32_t msecs,
+                                         void (*handler)(void *), void *arg,
+                                         int refs)
+{
+    struct nettimer_t *t = nettimer_alloc();
+    struct nettimer_wheel_t *w;
+    unsigned long long now;
 
-    for(t = &timers_head; t->next != NULL; t = t->next)
+    if(!t)
     {
-        ;
+        return NULL;
     }
 
-    t->next = nt;
-    kernel_mutex_unlock(&nettimer_lock);
+    now = nettimer_now();
+    t->refs = refs;
+    t->cpu = this_core->cpuid;
+    t->expires = now + msecs;
+    t->handler = handler;
+    t->arg = arg;
+
+    w = &wheels[t->cpu];
+    kernel_mutex_lock(&w->lock);
+
+    // an empty wheel's clock might be lagging behind, bring it up to date
+    // so we don't have to walk it forward to get to this timer
+    if(!w->count && w->clk < now)
+    {
+        w->clk = now;
+    }
+
+    wheel_add(w, t);
+    kernel_mutex_unlock(&w->lock);
+
+    nettimer_kick(t->expires);
+
+    return t;
 }
 
 
+/*
+ * Add a timer to expire after the given number of milliseconds. The caller
+ * holds a reference to the timer, and must call nettimer_release() when it
+ * is done with it (whether the timer has fired or not).
+ */
+struct nettimer_t *nettimer_add(uint32_t msecs, void (*handler)(void *), void *arg)
+{
+    return nettimer_queue(msecs, handler, arg, 1);
+}
+
+
+/*
+ * Add a timer to expire after the given number of milliseconds. The timer
+ * is freed after it fires.
+ */
+void nettimer_oneshot(uint32_t msecs, void (*handler)(void *), void *arg)
+{
+    (void)nettimer_queue(msecs, handler, arg, 0);
+}
+
+
+/*
+ * Cancel a timer (if it has not fired yet) and release the caller's
+ * reference to it.
+ */
 void nettimer_release(struct nettimer_t *t)
 {
+    struct nettimer_wheel_t *w;
+
     if(!t)
     {
         return;
     }
 
-    kernel_mutex_lock(&nettimer_lock);
+    w = &wheels[t->cpu];
+    kernel_mutex_lock(&w->lock);
+    wheel_del(w, t);
     t->refs--;
     t->cancelled = 1;
-    kernel_mutex_unlock(&nettimer_lock);
-}
 
+    if(t->refs == 0 && !t->running)
+    {
+        nettimer_free(t);
+    }
+
+    kernel_mutex_unlock(&w->lock);
+}
@@ -42,6 +42,7 @@
 #include <kernel/net/raw.h>
 #include <kernel/net/unix.h>
 #include <kernel/net/nettimer.h>
+#include <kernel/net/packet.h>
 
 extern void loop_attach(void);
 
@@ -62,12 +63,25 @@ struct proto_t internet_protocols[5] =
 };
 
 
+struct kmem_cache_t *small_packet_cache = NULL;
+struct kmem_cache_t *large_packet_cache = NULL;
+
+
 /*
  * Initialize network protocols.
  */
 void network_init(void)
 {
     printk("Initializing network protocols..\n");
+
+    if(!(small_packet_cache = kmem_cache_create("packet-small",
+                                            PACKET_CACHE_SMALL_SIZE, 0, NULL)) ||
+       !(large_packet_cache = kmem_cache_create("packet-large",
+                                            PACKET_CACHE_LARGE_SIZE, 0, NULL)))
+    {
+        kpanic("Failed to create network packet caches\n");
+    }
+
     netif_init();
     route_init();
     nettimer_init();
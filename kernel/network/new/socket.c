@@ -92,6 +92,32 @@ static long (*sockops_table[18])() =
 struct socket_t sock_head = { 0, };
 volatile struct kernel_mutex_t sock_lock = { 0, };
 
+/*
+ * Socket demultiplexing tables. The connected (ehash) and listening (lhash)
+ * tables are searched for every incoming segment, and each bucket has its
+ * own lock so lookups do not need sock_lock. The bound port (bhash) and
+ * all-sockets (ahash) tables are only changed and searched with sock_lock
+ * held. Changes to any table are done with sock_lock held, which is
+ * always taken before a bucket lock.
+ */
+static struct sock_hash_bucket_t sock_ehash[SOCK_EHASH_SIZE];
+static struct sock_hash_bucket_t sock_lhash[SOCK_LHASH_SIZE];
+static struct socket_t *sock_bhash[SOCK_BHASH_SIZE];
+static struct socket_t *sock_ahash[SOCK_AHASH_SIZE];
+
+#define sock_ehashfn(proto, raddr, rport, lport)            \
+    (sock_hashfn((raddr), ((uint32_t)(rport) << 16) | (lport), (proto)) & \
+                                            (SOCK_EHASH_SIZE - 1))
+
+#define sock_lhashfn(proto, lport)                          \
+    (sock_hashfn((lport), (proto), 0) & (SOCK_LHASH_SIZE - 1))
+
+#define sock_bhashfn(proto, lport)                          \
+    (sock_hashfn((lport), (proto), 0) & (SOCK_BHASH_SIZE - 1))
+
+#define sock_ahashfn(so)                                    \
+    (((uintptr_t)(so) >> 6) & (SOCK_AHASH_SIZE - 1))
+
 
 /*
  * Handler for syscall socketcall().
@@ -141,24 +167,192 @@ static void socket_clean_queue(struct netif_queue_t *q)
 }
 
 
-struct socket_t *sock_lookup(uint16_t proto, uint16_t remoteport, uint16_t localport)
+STATIC_INLINE uint32_t sock_hashfn(uint32_t a, uint32_t b, uint32_t c)
 {
-    struct socket_t *so;
+    uint32_t h = a * 0x9e3779b1;
+
+    h ^= b + 0x7f4a7c15 + (h << 6) + (h >> 2);
+    h ^= c + 0x7f4a7c15 + (h << 6) + (h >> 2);
+
+    return h ^ (h >> 16);
+}
+
+
+/*
+ * Remove the socket from the demultiplexing tables.
+ * Caller must hold sock_lock.
+ */
+static void sock_unhash_locked(struct socket_t *so)
+{
+    struct sock_hash_bucket_t *bucket;
+
+    if((bucket = so->hbucket))
+    {
+        kernel_mutex_lock(&bucket->lock);
+
+        if((*so->hpprev = so->hnext))
+        {
+            so->hnext->hpprev = so->hpprev;
+        }
+
+        so->hnext = NULL;
+        so->hpprev = NULL;
+        so->hbucket = NULL;
+        kernel_mutex_unlock(&bucket->lock);
+    }
+
+    if(so->bpprev)
+    {
+        if((*so->bpprev = so->bnext))
+        {
+            so->bnext->bpprev = so->bpprev;
+        }
+
+        so->bnext = NULL;
+        so->bpprev = NULL;
+    }
+}
+
+
+/*
+ * Add the socket to the demultiplexing tables according to its current
+ * addresses. Caller must hold sock_lock.
+ */
+static void sock_hash_locked(struct socket_t *so)
+{
+    struct sock_hash_bucket_t *bucket;
+    struct socket_t **head;
+    uint16_t proto;
+
+    if(so->domain != AF_INET || !so->proto || RAW_SOCKET(so) ||
+       so->local_port == 0)
+    {
+        return;
+    }
+
+    proto = SOCK_PROTO(so);
+
+    head = &sock_bhash[sock_bhashfn(proto, so->local_port)];
+
+    if((so->bnext = *head))
+    {
+        so->bnext->bpprev = &so->bnext;
+    }
+
+    *head = so;
+    so->bpprev = head;
+
+    if(so->remote_port && so->remote_addr.ipv4 != INADDR_ANY)
+    {
+        bucket = &sock_ehash[sock_ehashfn(proto, so->remote_addr.ipv4,
+                                          so->remote_port, so->local_port)];
+    }
+    else
+    {
+        bucket = &sock_lhash[sock_lhashfn(proto, so->local_port)];
+    }
+
+    kernel_mutex_lock(&bucket->lock);
+
+    if((so->hnext = bucket->head))
+    {
+        so->hnext->hpprev = &so->hnext;
+    }
+
+    bucket->head = so;
+    so->hpprev = &bucket->head;
+    so->hbucket = bucket;
+    kernel_mutex_unlock(&bucket->lock);
+}
 
+
+static void sock_rehash_locked(struct socket_t *so)
+{
+    // ignore sockets that are being freed
+    if(!so->pprev)
+    {
+        return;
+    }
+
+    sock_unhash_locked(so);
+    sock_hash_locked(so);
+}
+
+
+/*
+ * Move the socket to the right demultiplexing tables after its local or
+ * remote address/port has changed.
+ */
+void sock_rehash(struct socket_t *so)
+{
     kernel_mutex_lock(&sock_lock);
+    sock_rehash_locked(so);
+    kernel_mutex_unlock(&sock_lock);
+}
+
+
+/*
+ * Find the socket an incoming segment belongs to. Connected sockets are
+ * matched on the full address/port tuple first. Otherwise, we look for a
+ * socket bound to the local port and not connected to another peer,
+ * preferring one bound to the exact local address over a wildcard one.
+ * All addresses and ports are in network byte order.
+ */
+struct socket_t *sock_lookup(uint16_t proto, 
+                             uint32_t remoteaddr, uint16_t remoteport,
+                             uint32_t localaddr, uint16_t localport)
+{
+    struct sock_hash_bucket_t *bucket;
+    struct socket_t *so, *best = NULL;
 
-    for(so = sock_head.next; so != NULL; so = so->next)
+    bucket = &sock_ehash[sock_ehashfn(proto, remoteaddr, 
+                                      remoteport, localport)];
+    kernel_mutex_lock(&bucket->lock);
+
+    for(so = bucket->head; so != NULL; so = so->hnext)
     {
         if(so->local_port == localport && so->remote_port == remoteport &&
-           so->proto && so->proto->protocol == proto)
+           so->remote_addr.ipv4 == remoteaddr &&
+           (so->local_addr.ipv4 == INADDR_ANY ||
+            so->local_addr.ipv4 == localaddr) &&
+           SOCK_PROTO(so) == proto)
         {
-            kernel_mutex_unlock(&sock_lock);
+            kernel_mutex_unlock(&bucket->lock);
             return so;
         }
     }
 
-    kernel_mutex_unlock(&sock_lock);
-    return NULL;
+    kernel_mutex_unlock(&bucket->lock);
+
+    bucket = &sock_lhash[sock_lhashfn(proto, localport)];
+    kernel_mutex_lock(&bucket->lock);
+
+    for(so = bucket->head; so != NULL; so = so->hnext)
+    {
+        if(so->local_port != localport || SOCK_PROTO(so) != proto)
+        {
+            continue;
+        }
+
+        if(so->remote_port && so->remote_port != remoteport)
+        {
+            continue;
+        }
+
+        if(so->local_addr.ipv4 == localaddr)
+        {
+            best = so;
+            break;
+        }
+
+        if(so->local_addr.ipv4 == INADDR_ANY && !best)
+        {
+            best = so;
+        }
+    }
+
+    kernel_mutex_unlock(&bucket->lock);
+    return best;
 }
 
 
@@ -168,7 +362,7 @@ struct socket_t *sock_find(struct socket_t *find)
 
     kernel_mutex_lock(&sock_lock);
 
-    for(so = sock_head.next; so != NULL; so = so->next)
+    for(so = sock_ahash[sock_ahashfn(find)]; so != NULL; so = so->anext)
     {
         if(so == find)
         {
@@ -182,38 +376,64 @@ struct socket_t *sock_find(struct socket_t *find)
 }
 
 
+static void socket_garbage_collect(void *arg);
+
 static void sock_free(struct socket_t *find)
 {
-    struct socket_t *so;
+    struct socket_t **pso;
 
     kernel_mutex_lock(&sock_lock);
 
-    for(so = &sock_head; so->next != NULL; so = so->next)
+    if(!find->pprev)
+    {
+        kernel_mutex_unlock(&sock_lock);
+        return;
+    }
+
+    // someone is still using the socket (e.g. a unix peer writing to it),
+    // try again later
+    if(find->refs != 0)
     {
-        if(so->next == find)
+        kernel_mutex_unlock(&sock_lock);
+
+        if(find->state == SOCKSTATE_DISCONNECTING)
         {
-            if(find->refs == 0)
-            {
-                so->next = find->next;
-                find->next = NULL;
-
-                kernel_mutex_unlock(&sock_lock);
-
-                SOCKET_LOCK(find);
-                socket_clean_queue(&find->inq);
-                socket_clean_queue(&find->outq);
-                socket_tcp_cleanup(find);
-                selwakeup(&find->sleep);
-                SOCKET_UNLOCK(find);
-                kfree(find);
-                return;
-            }
+            nettimer_oneshot(1000, &socket_garbage_collect, find);
+        }
+
+        return;
+    }
+
+    // remove from the socket list
+    if((*find->pprev = find->next))
+    {
+        find->next->pprev = find->pprev;
+    }
+
+    find->next = NULL;
+    find->pprev = NULL;
 
+    // and from the hash tables
+    for(pso = &sock_ahash[sock_ahashfn(find)]; *pso; pso = &(*pso)->anext)
+    {
+        if(*pso == find)
+        {
+            *pso = find->anext;
             break;
         }
     }
 
+    sock_unhash_locked(find);
     kernel_mutex_unlock(&sock_lock);
+
+    SOCKET_LOCK(find);
+    socket_clean_queue(&find->inq);
+    socket_clean_queue(&find->outq);
+    socket_tcp_cleanup(find);
+    socket_unix_cleanup(find);
+    selwakeup(&find->sleep);
+    SOCKET_UNLOCK(find);
+    kfree(find);
 }
 
 
@@ -287,7 +507,8 @@ STATIC_INLINE long getsock(int fd, struct socket_t **so)
     
     *so = NULL;
     
-    if(fd >= (int)NR_OPEN || !this_core->cur_task->ofiles || 
+    if(fd < 0 || !this_core->cur_task->ofiles || 
+       fd >= this_core->cur_task->ofiles->max_fds ||
        (fp = this_core->cur_task->ofiles->ofile[fd]) == NULL)
     {
         return -EBADF;
@@ -313,7 +534,7 @@ STATIC_INLINE int is_ipv4_port_free(uint16_t proto, uint16_t port, uint32_t addr
         return 1;
     }
 
-    for(so = sock_head.next; so != NULL; so = so->next)
+    for(so = sock_bhash[sock_bhashfn(proto, port)]; so != NULL; so = so->bnext)
     {
         if(so->domain == AF_INET &&
            so->proto && so->proto->protocol == proto &&
@@ -412,8 +633,17 @@ long sock_create(int domain, int type, int protocol, struct socket_t **res)
     init_kernel_mutex(&so->lock);
 
     kernel_mutex_lock(&sock_lock);
-    so->next = sock_head.next;
+
+    if((so->next = sock_head.next))
+    {
+        so->next->pprev = &so->next;
+    }
+
     sock_head.next = so;
+    so->pprev = &sock_head.next;
+    so->anext = sock_ahash[sock_ahashfn(so)];
+    sock_ahash[sock_ahashfn(so)] = so;
+
     kernel_mutex_unlock(&sock_lock);
 
 	*res = so;
@@ -449,8 +679,8 @@ static long sock_createf(int domain, int type, int protocol,
 
     if(!(node = sockfs_get_node()))
     {
-    	this_core->cur_task->ofiles->ofile[fd] = NULL;
-    	f->refs = 0;
+    	fdfree(fd);
+    	file_free(f);
     	return -ENOSPC;
     }
 
@@ -490,8 +720,8 @@ static long sock_createf(int domain, int type, int protocol,
 
 err:
 
-    this_core->cur_task->ofiles->ofile[fd] = NULL;
-    f->refs = 0;
+    fdfree(fd);
+    file_free(f);
     release_node(node);
     return res;
 }
@@ -626,6 +856,7 @@ long syscall_bind(int s, struct sockaddr *_name, socklen_t namelen)
         so->local_port = port;
         so->local_addr.ipv4 = sin->sin_addr.s_addr;
         so->err = 0;
+        sock_rehash_locked(so);
         kernel_mutex_unlock(&sock_lock);
 	}
 
@@ -752,7 +983,8 @@ long syscall_connect(int fd, struct sockaddr *_name, socklen_t namelen)
         	goto err;
 	    }
 	}
-	
+
+	sock_rehash(so);
 	kfree(name);
     SOCKET_LOCK(so);
 
@@ -921,10 +1153,20 @@ long sendto_pre_checks(struct socket_t *so,
 
     	if(so->domain == AF_INET)
     	{
+    	    struct sockaddr_in *sin = (struct sockaddr_in *)dest_namebuf;
+    	    int changed;
+
     	    SOCKET_LOCK(so);
-            so->remote_addr.ipv4 = ((struct sockaddr_in *)dest_namebuf)->sin_addr.s_addr;
-            so->remote_port = ((struct sockaddr_in *)dest_namebuf)->sin_port;
+    	    changed = (so->remote_addr.ipv4 != sin->sin_addr.s_addr ||
+    	               so->remote_port != sin->sin_port);
+            so->remote_addr.ipv4 = sin->sin_addr.s_addr;
+            so->remote_port = sin->sin_port;
             SOCKET_UNLOCK(so);
+
+            if(changed)
+            {
+                sock_rehash(so);
+            }
         }
     }
 	
@@ -940,8 +1182,6 @@ static long syscall_sendto_internal(int s, void *buf, size_t len, int flags,
 	struct socket_t *so;
 	long res;
 
-    UNUSED(flags);
-
     if(!buf)
     {
         return -EINVAL;
@@ -963,6 +1203,7 @@ static long syscall_sendto_internal(int s, void *buf, size_t len, int flags,
 	msg.msg_iov = &aiov;
 	msg.msg_iovlen = 1;
 	msg.msg_control = 0;
+	msg.msg_flags = flags;
 	aiov.iov_base = buf;
 	aiov.iov_len = len;
 
@@ -1014,8 +1255,6 @@ long syscall_sendmsg(int s, struct msghdr *_msg, int flags)
 	long res;
 	struct socket_t *so;
 
-    UNUSED(flags);
-
     if(!_msg)
     {
         return -EINVAL;
@@ -1038,6 +1277,8 @@ long syscall_sendmsg(int s, struct msghdr *_msg, int flags)
         return so->err;
     }
 
+    msg.msg_flags = flags;
+
     if((res = sendto_pre_checks(so, msg.msg_name, msg.msg_namelen)) != 0)
     {
     	kfree(msg.msg_iov);
@@ -1232,6 +1473,14 @@ long syscall_recvmsg(int s, struct msghdr *_msg, int flags)
 
 	msg.msg_namelen = sizeof(namebuf);
 	msg.msg_name = namebuf;
+	msg.msg_flags = 0;
+
+    // only Unix sockets pass back control data (SCM_RIGHTS)
+	if(so->domain != AF_UNIX)
+	{
+	    msg.msg_control = NULL;
+	    msg.msg_controllen = 0;
+	}
 
     SOCKET_LOCK(so);
     res = so->proto->sockops->read(so, &msg, flags);
@@ -1256,6 +1505,18 @@ long syscall_recvmsg(int s, struct msghdr *_msg, int flags)
         }
     }
 
+    if(res >= 0)
+    {
+        if(copy_to_user(&_msg->msg_controllen, &msg.msg_controllen,
+                        sizeof(msg.msg_controllen)) != 0 ||
+           copy_to_user(&_msg->msg_flags, &msg.msg_flags, 
+                        sizeof(msg.msg_flags)) != 0)
+        {
+            kfree(msg.msg_iov);
+            SYSCALL_EFAULT(_msg);
+        }
+    }
+
 	kfree(msg.msg_iov);
 
 	if(res == -EFAULT)
@@ -1335,20 +1596,36 @@ void socket_close(struct socket_t *so)
 
     SOCKET_LOCK(so);
     socket_shutdown(so, SHUT_RDWR);
-    so->refs--;
+    __sync_fetch_and_sub(&so->refs, 1);
 
     if(so->pairedsock)
     {
         struct socket_t *so2 = so->pairedsock;
 
         so->pairedsock = NULL;
+
+        if(so->domain == AF_UNIX)
+        {
+            socket_unix_wakeup(so);
+        }
+
         SOCKET_UNLOCK(so);
 
         SOCKET_LOCK(so2);
         so2->pairedsock = NULL;
         //so2->poll_events |= POLLHUP;
         __sync_or_and_fetch(&so2->poll_events, POLLHUP);
+
+        if(so2->domain == AF_UNIX)
+        {
+            socket_unix_wakeup(so2);
+        }
+
         SOCKET_UNLOCK(so2);
+
+        // wake up the peer's readers and pollers so they see the hangup
+        selwakeup(&so2->selrecv);
+        selwakeup(&so2->sleep);
     }
     else
     {
@@ -1357,7 +1634,7 @@ void socket_close(struct socket_t *so)
 
     if(so->proto->protocol != IPPROTO_TCP)
     {
-        socket_delete(so, PIT_FREQUENCY * 5);
+        socket_delete(so, 5000);
     }
 }
 
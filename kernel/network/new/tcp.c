@@ -50,6 +50,9 @@ static void tcp_linger(void *arg);
 
 static int tcp_queue_tansmit(struct socket_tcp_t *tsock, struct packet_t *p);
 static int tcp_transmit(struct socket_tcp_t *tsock, struct packet_t *p, uint32_t seqno);
+static int tcp_push(struct socket_tcp_t *tsock);
+static void tcp_retransmit_seg(struct socket_tcp_t *tsock, struct packet_t *p);
+static void tcp_set_ca_state(struct socket_tcp_t *tsock, int state);
 
 static void tcp_rearm_rto_timer(struct socket_tcp_t *tsock);
 static void tcp_rearm_user_timeout(struct socket_tcp_t *tsock);
@@ -80,9 +83,12 @@ static struct socket_t *tcp_socket(void)
     tsock->rmss = 1460;
     tsock->smss = 536;
     tsock->tcpstate = TCPSTATE_CLOSE;
-    tsock->linger_ticks = TCP_2MSL_TICKS;
+    tsock->linger_msecs = TCP_2MSL_MSECS;
     tsock->ofoq.max = SOCKET_DEFAULT_QUEUE_SIZE;
 
+    tcp_cong_select(tsock, NULL);
+    tcp_cong_init_window(tsock);
+
     return (struct socket_t *)tsock;
 }
 
@@ -100,9 +106,11 @@ static long tcp_connect(struct socket_t *so)
     tsock->snd_nxt = tsock->iss;
     tsock->rcv_nxt = 0;
     tsock->rcv_wnd = 44477;
+    tsock->recover = tsock->iss;
+    tsock->high_sacked = tsock->iss;
 
+    // tcp_push() accounts for the sequence number taken by the SYN
     res = tcp_send_syn(tsock);
-    tsock->snd_nxt++;
 
     return res;
 }
@@ -389,6 +397,19 @@ static long tcp_getsockopt(struct socket_t *so, int level, int optname,
                 *(int *)optval = !!(so->flags & SOCKET_FLAG_TCPNODELAY);
                 *optlen = sizeof(int);
                 return 0;
+
+            case TCP_CONGESTION:
+            {
+                struct socket_tcp_t *tsock = (struct socket_tcp_t *)so;
+
+                if(*optlen > TCP_CA_NAME_MAX)
+                {
+                    *optlen = TCP_CA_NAME_MAX;
+                }
+
+                A_memcpy(optval, tsock->cong->name, *optlen);
+                return 0;
+            }
         }
     }
 
@@ -406,6 +427,27 @@ static long tcp_setsockopt(struct socket_t *so, int level, int optname,
     {
         return -EINVAL;
     }
+
+    // the algorithm name is a string, not an int
+    if(level == IPPROTO_TCP && optname == TCP_CONGESTION)
+    {
+        char name[TCP_CA_NAME_MAX];
+
+        if(!optval || optlen <= 0)
+        {
+            return -EINVAL;
+        }
+
+        if(optlen > TCP_CA_NAME_MAX - 1)
+        {
+            optlen = TCP_CA_NAME_MAX - 1;
+        }
+
+        A_memcpy(name, optval, optlen);
+        name[optlen] = '\0';
+
+        return tcp_cong_select(tsock, name);
+    }
     
     if(!optval || optlen < (int)sizeof(int))
     {
@@ -434,12 +476,12 @@ static long tcp_setsockopt(struct socket_t *so, int level, int optname,
                 
                 if(li->l_onoff)
                 {
-                    // convert seconds to ticks
-                    tsock->linger_ticks = li->l_linger * PIT_FREQUENCY;
+                    // convert seconds to milliseconds
+                    tsock->linger_msecs = li->l_linger * 1000;
                 }
                 else
                 {
-                    tsock->linger_ticks = TCP_2MSL_TICKS /* 0 */;
+                    tsock->linger_msecs = TCP_2MSL_MSECS /* 0 */;
                 }
 
                 return 0;
@@ -536,13 +578,21 @@ static void tcp_clean_rto_queue(struct socket_tcp_t *tsock, uint32_t una)
 {
     struct packet_t *p;
     struct socket_t *so = (struct socket_t *)tsock;
+    int acked = 0;
 
     p = so->outq.head;
 
     while(p)
     {
-        if(p->seq > 0 && p->end_seq <= una)
+        // stop at the first segment that has not been sent yet
+        if(p != tsock->snd_head && SEQ_LEQ(p->end_seq, una))
         {
+            if(p->flags & TCP_PKT_SACKED)
+            {
+                tsock->sacked_bytes -= (p->end_seq - p->seq);
+            }
+
+            acked = 1;
             so->outq.head = p->next;
             so->outq.count--;
             p->next = NULL;
@@ -566,10 +616,16 @@ static void tcp_clean_rto_queue(struct socket_tcp_t *tsock, uint32_t una)
         }
     }
     
-    if(!p || tsock->inflight == 0)
+    if(!p || p == tsock->snd_head || tsock->inflight == 0)
     {
         // No unacknowledged packets, stop rto timer
         tcp_release_rto_timer(tsock);
+        tsock->sacked_bytes = 0;
+    }
+    else if(acked && tsock->tcpstate != TCPSTATE_SYN_SENT)
+    {
+        // RFC 6298 (5.3): restart the timer when new data is acknowledged
+        tcp_rearm_rto_timer(tsock);
     }
 }
 
@@ -637,7 +693,7 @@ STATIC_INLINE void tcp_done(struct socket_tcp_t *tsock)
     tcp_clear_timers(tsock);
     tcp_clear_queues(tsock);
     selwakeup(&(tsock->sock.sleep));
-    socket_delete((struct socket_t *)tsock, PIT_FREQUENCY * 60 * 2);
+    socket_delete((struct socket_t *)tsock, 1000 * 60 * 2);
 }
 
 
@@ -652,7 +708,7 @@ STATIC_INLINE void tcp_enter_time_wait(struct socket_tcp_t *tsock)
 {
     tsock->tcpstate = TCPSTATE_TIME_WAIT;
     tcp_clear_timers(tsock);
-    tsock->linger = nettimer_add(tsock->linger_ticks /* TCP_2MSL */, &tcp_linger, tsock);
+    tsock->linger = nettimer_add(tsock->linger_msecs /* TCP_2MSL */, &tcp_linger, tsock);
 }
 
 
@@ -745,6 +801,47 @@ static void tcp_reconnect_rto(void *arg)
 }
 
 
+static void tcp_set_ca_state(struct socket_tcp_t *tsock, int state)
+{
+    tsock->ca_state = state;
+
+    if(tsock->cong->set_state)
+    {
+        tsock->cong->set_state(tsock, state);
+    }
+}
+
+
+/*
+ * A retransmit timeout means everything in flight is presumed lost.
+ * Go back to slow start from one segment, and resend the lost segments
+ * as the window opens up again (RFC 5681, section 3.1).
+ */
+static void tcp_enter_loss(struct socket_tcp_t *tsock)
+{
+    struct packet_t *p;
+
+    // don't cut ssthresh again if the retransmission is lost too
+    if(tsock->backoff == 0)
+    {
+        tsock->ssthresh = tsock->cong->ssthresh(tsock);
+    }
+
+    tsock->cwnd = tsock->smss;
+    tsock->recover = tsock->snd_nxt;
+    tsock->dupacks = 0;
+    tsock->rtt_start = 0;
+    tsock->timeouts++;
+
+    for(p = tsock->sock.outq.head; p && p != tsock->snd_head; p = p->next)
+    {
+        p->flags &= ~TCP_PKT_RETRANS;
+    }
+
+    tcp_set_ca_state(tsock, TCPCA_LOSS);
+}
+
+
 static void tcp_retransmission_timeout(void *arg)
 {
     struct socket_tcp_t *tsock = (struct socket_tcp_t *)arg;
@@ -759,21 +856,23 @@ static void tcp_retransmission_timeout(void *arg)
     SOCKET_LOCK(&(tsock->sock));
     tcp_release_rto_timer(tsock);
 
-    if(!(p = tsock->sock.outq.head))
+    if(!(p = tsock->sock.outq.head) || p == tsock->snd_head)
     {
         tsock->backoff = 0;
         printk("tcp: RTO queue empty\n");
         tcp_notify_user(tsock);
+        tcp_push(tsock);
         SOCKET_UNLOCK(&(tsock->sock));
         return;
     }
 
     h = TCP_HDR(p);
+    tcp_enter_loss(tsock);
     //reset_packet_header(p);
-    tcp_transmit(tsock, p, tsock->snd_una);
+    tcp_retransmit_seg(tsock, p);
 
     // time out after 3 mins
-    if(tsock->rto > PIT_FREQUENCY * 60 * 3)
+    if(tsock->rto > 1000 * 60 * 3)
     {
         tcp_done(tsock);
         tsock->sock.err = -ETIMEDOUT;
@@ -785,7 +884,7 @@ static void tcp_retransmission_timeout(void *arg)
 
     tsock->rto *= 2;
     tsock->backoff++;
-    tsock->retransmit = nettimer_add(tsock->rto, &tcp_retransmission_timeout, tsock);
+    tcp_rearm_rto_timer(tsock);
 
     if(h->fin)
     {
@@ -833,7 +932,7 @@ static void tcp_rearm_user_timeout(struct socket_tcp_t *tsock)
     }
 
     nettimer_release(tsock->linger);
-    tsock->linger = nettimer_add(tsock->linger_ticks /* TCP_USER_TIMEOUT */, &tcp_user_timeout, tsock);
+    tsock->linger = nettimer_add(tsock->linger_msecs /* TCP_USER_TIMEOUT */, &tcp_user_timeout, tsock);
 }
 
 
@@ -937,45 +1036,205 @@ static int tcp_transmit(struct socket_tcp_t *tsock, struct packet_t *p, uint32_t
 }
 
 
-static int tcp_queue_tansmit(struct socket_tcp_t *tsock, struct packet_t *p)
+/*
+ * Is the given segment (which has been sent) considered lost?
+ */
+static int tcp_seg_lost(struct socket_tcp_t *tsock, struct packet_t *p)
+{
+    if(p->flags & TCP_PKT_SACKED)
+    {
+        return 0;
+    }
+
+    switch(tsock->ca_state)
+    {
+        case TCPCA_LOSS:
+            // everything sent before the timeout
+            return SEQ_LT(p->seq, tsock->recover);
+
+        case TCPCA_RECOVERY:
+            // with SACK, the holes below the highest SACKed segment,
+            // otherwise the first unacknowledged segment (NewReno)
+            if(tsock->sackok)
+            {
+                return SEQ_LT(p->seq, tsock->high_sacked);
+            }
+
+            return (p == tsock->sock.outq.head);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Estimate the number of bytes still in the network (the "pipe" of
+ * RFC 6675): segments that are neither SACKed nor presumed lost, plus
+ * the lost segments we have retransmitted.
+ */
+static uint32_t tcp_pipe(struct socket_tcp_t *tsock)
+{
+    struct packet_t *p;
+    uint32_t pipe = 0, dup;
+
+    if(tsock->ca_state == TCPCA_OPEN && !tsock->sacked_bytes &&
+       !tsock->dupacks)
+    {
+        return tsock->snd_nxt - tsock->snd_una;
+    }
+
+    for(p = tsock->sock.outq.head; p && p != tsock->snd_head; p = p->next)
+    {
+        if(p->flags & TCP_PKT_SACKED)
+        {
+            continue;
+        }
+
+        if(tcp_seg_lost(tsock, p) && !(p->flags & TCP_PKT_RETRANS))
+        {
+            continue;
+        }
+
+        pipe += (p->end_seq - p->seq);
+    }
+
+    // without SACK, each duplicate ACK means a segment has left the network
+    if(!tsock->sackok)
+    {
+        dup = tsock->dupacks * tsock->smss;
+        pipe = (pipe > dup) ? pipe - dup : 0;
+    }
+
+    return pipe;
+}
+
+
+static void tcp_retransmit_seg(struct socket_tcp_t *tsock, struct packet_t *p)
 {
-    struct tcp_hdr_t *h = TCP_HDR(p);
-    int res = 0;
+    tcp_transmit(tsock, p, p->seq);
+    p->flags |= TCP_PKT_RETRANS;
+    tsock->retrans++;
+
+    // Karn's algorithm: don't time retransmitted segments
+    tsock->rtt_start = 0;
 
-    if(tsock->sock.outq.head == NULL)
+    if(!tsock->retransmit)
     {
         tcp_rearm_rto_timer(tsock);
     }
+}
 
-    if(tsock->inflight == 0)
+
+/*
+ * Resend the segments presumed lost, as far as the congestion window
+ * allows. Returns the number of segments sent.
+ */
+static int tcp_retransmit_lost(struct socket_tcp_t *tsock)
+{
+    struct packet_t *p;
+    uint32_t pipe = tcp_pipe(tsock), len;
+    int sent = 0;
+
+    for(p = tsock->sock.outq.head; p && p != tsock->snd_head; p = p->next)
     {
-        res = tcp_transmit(tsock, p, tsock->snd_nxt);
-        tsock->inflight++;
+        if(!tcp_seg_lost(tsock, p) || (p->flags & TCP_PKT_RETRANS))
+        {
+            continue;
+        }
+
+        len = p->end_seq - p->seq;
+
+        if(pipe + len > tsock->cwnd)
+        {
+            break;
+        }
+
+        tcp_retransmit_seg(tsock, p);
+        pipe += len;
+        sent++;
+    }
+
+    return sent;
+}
+
+
+/*
+ * Send as many new segments as the congestion window and the peer's
+ * receive window allow. Returns the number of segments sent.
+ */
+static int tcp_push(struct socket_tcp_t *tsock)
+{
+    struct packet_t *p;
+    struct tcp_hdr_t *h;
+    uint32_t wnd, pipe, len;
+    int sent = 0;
+
+    wnd = (tsock->cwnd < tsock->snd_wnd) ? tsock->cwnd : tsock->snd_wnd;
+    pipe = tcp_pipe(tsock);
+
+    while((p = tsock->snd_head))
+    {
+        h = TCP_HDR(p);
+        len = p->count + ((h->syn || h->fin) ? 1 : 0);
+
+        // with nothing in flight, always send one segment so that a zero
+        // window gets probed by the retransmit timer
+        if(pipe && pipe + len > wnd)
+        {
+            break;
+        }
+
+        tcp_transmit(tsock, p, tsock->snd_nxt);
+
         p->seq = tsock->snd_nxt;
-        tsock->snd_nxt += p->count;
+        tsock->snd_nxt += len;
         p->end_seq = tsock->snd_nxt;
+        p->flags &= ~(TCP_PKT_SACKED | TCP_PKT_RETRANS);
+
+        tsock->snd_head = p->next;
+        tsock->inflight++;
+        pipe += len;
+        sent++;
 
-        if(h->fin)
+        // time one segment per round trip
+        if(!tsock->rtt_start)
         {
-            tsock->snd_nxt++;
+            tsock->rtt_start = nettimer_now();
+            tsock->rtt_seq = tsock->snd_nxt;
+        }
+
+        if(!tsock->retransmit)
+        {
+            tcp_rearm_rto_timer(tsock);
         }
     }
 
+    return sent;
+}
+
+
+static int tcp_queue_tansmit(struct socket_tcp_t *tsock, struct packet_t *p)
+{
     //kernel_mutex_lock(&tsock->sock.outq.lock);
 
     if(IFQ_FULL(&tsock->sock.outq))
     {
         //kernel_mutex_unlock(&tsock->sock.outq.lock);
         free_packet(p);
-        res = -ENOBUFS;
+        return -ENOBUFS;
     }
-    else
+
+    IFQ_ENQUEUE(&tsock->sock.outq, p);
+    //kernel_mutex_unlock(&tsock->sock.outq.lock);
+
+    if(!tsock->snd_head)
     {
-        IFQ_ENQUEUE(&tsock->sock.outq, p);
-        //kernel_mutex_unlock(&tsock->sock.outq.lock);
+        tsock->snd_head = p;
     }
 
-    return res;
+    tcp_push(tsock);
+
+    return 0;
 }
 
 
@@ -1250,7 +1509,8 @@ static void tcp_parse_timestamp(struct socket_tcp_t *tsock, struct tcp_hdr_t *tc
     uint8_t *p = tcph->data;
     int optlen = (tcph->hlen * 4) - 20;
 
-    while(optlen > 0 && optlen < 20)
+    // ACKs carrying SACK blocks can have up to 40 bytes of options
+    while(optlen > 0)
     {
         switch(*p)
         {
@@ -1270,9 +1530,28 @@ static void tcp_parse_timestamp(struct socket_tcp_t *tsock, struct tcp_hdr_t *tc
                 optlen -= TCPOLEN_TIMESTAMP;
                 break;
 
+            case TCPOPT_SACK:
+                // handled by tcp_parse_sacks()
+                if(optlen < 2 || p[1] < 2)
+                {
+                    optlen = 0;
+                    break;
+                }
+
+                optlen -= p[1];
+                p += p[1];
+                break;
+
             default:
                 printk("tcp: unrecognised option 0x%x\n", *p);
+
                 // the 'kind' byte is followed by a 'len' byte
+                if(optlen < 2 || p[1] < 2)
+                {
+                    optlen = 0;
+                    break;
+                }
+
                 optlen -= p[1];
                 p += p[1];
                 break;
@@ -1420,10 +1699,14 @@ static void tcp_synsent(struct socket_tcp_t *tsock, struct tcp_hdr_t *tcph, stru
         tsock->snd_una = tsock->snd_nxt;
         tsock->backoff = 0;
         // RFC 6298: Sender SHOULD set RTO <- 1 second
-        tsock->rto = PIT_FREQUENCY;
+        tsock->rto = 1000;
+        tsock->snd_wnd = tcph->wnd;
+        tsock->snd_wl1 = tcph->seqno;
+        tsock->snd_wl2 = tcph->ackno;
         tcp_send_ack(tsock);
         tcp_rearm_user_timeout(tsock);
         tcp_parse_opts(tsock, tcph);
+        tcp_cong_init_window(tsock);
         sock_connected((struct socket_t *)tsock);
     }
     else
@@ -1508,23 +1791,34 @@ static void tcp_consume_ofo_queue(struct socket_tcp_t *tsock)
 }
 
 
-static void tcp_rtt(struct socket_tcp_t *tsock)
+static void tcp_rtt(struct socket_tcp_t *tsock, uint32_t ackno)
 {
     int r, k;
 
-    if(tsock->backoff > 0 || !tsock->retransmit)
+    // Karn's Algorithm: the timing is cancelled if we retransmit
+    if(!tsock->rtt_start || SEQ_LT(ackno, tsock->rtt_seq))
     {
-        // Karn's Algorithm: Don't measure retransmissions
         return;
     }
 
-    r = ticks - (tsock->retransmit->expires - tsock->rto);
+    r = nettimer_now() - tsock->rtt_start;
+    tsock->rtt_start = 0;
 
     if(r < 0)
     {
         return;
     }
 
+    if(!tsock->rtt_min || r < tsock->rtt_min)
+    {
+        tsock->rtt_min = r;
+    }
+
+    if(tsock->cong->rtt_sample)
+    {
+        tsock->cong->rtt_sample(tsock, r);
+    }
+
     if(!tsock->srtt)
     {
         // RFC6298 2.2 first measurement is made
@@ -1543,11 +1837,10 @@ static void tcp_rtt(struct socket_tcp_t *tsock)
 
     k = 4 * tsock->rttvar;
 
-    // RFC6298 says RTO should be at least 1 second. Linux uses 200ms,
-    // which is equal to 20 ticks
-    if(k < 20)
+    // RFC6298 says RTO should be at least 1 second. Linux uses 200ms
+    if(k < 200)
     {
-        k = 20;
+        k = 200;
     }
 
     tsock->rto = tsock->srtt + k;
@@ -1648,34 +1941,193 @@ static void tcp_data_queue(struct socket_tcp_t *tsock, struct tcp_hdr_t *tcph, s
 }
 
 
-static void tcp_send_next(struct socket_tcp_t *tsock, int amount)
+/*
+ * Mark the segments covered by a SACK block received from the peer.
+ */
+static void tcp_sack_mark(struct socket_tcp_t *tsock,
+                          uint32_t left, uint32_t right)
 {
     struct packet_t *p;
-    struct tcp_hdr_t *tcph;
-    struct ipv4_hdr_t *iph;
-    int i = 0;
 
-    for(p = tsock->sock.outq.head; p != NULL; p = p->next)
+    // ignore D-SACKs and blocks outside of what we have sent
+    if(SEQ_LEQ(right, tsock->snd_una) || SEQ_GT(right, tsock->snd_nxt) ||
+       SEQ_GEQ(left, right))
     {
-        if(++i > amount)
+        return;
+    }
+
+    for(p = tsock->sock.outq.head; p && p != tsock->snd_head; p = p->next)
+    {
+        if((p->flags & TCP_PKT_SACKED) ||
+           SEQ_LT(p->seq, left) || SEQ_GT(p->end_seq, right))
         {
-            break;
+            continue;
         }
 
-        tcp_transmit(tsock, p, tsock->snd_nxt);
+        p->flags |= TCP_PKT_SACKED;
+        tsock->sacked_bytes += (p->end_seq - p->seq);
 
-        p->seq = tsock->snd_nxt;
-        tsock->snd_nxt += p->count;
-        p->end_seq = tsock->snd_nxt;
+        if(SEQ_GT(p->end_seq, tsock->high_sacked))
+        {
+            tsock->high_sacked = p->end_seq;
+        }
+    }
+}
 
-        iph = IPv4_HDR(p);
-        //tcph = (struct tcp_hdr_t *)iph->data;
-        tcph = (struct tcp_hdr_t *)((char *)iph + (iph->hlen * 4));
 
-        if(tcph->fin)
+static void tcp_parse_sacks(struct socket_tcp_t *tsock, struct tcp_hdr_t *tcph)
+{
+    struct tcp_sack_block_t *sb;
+    uint8_t *p = tcph->data;
+    int optlen = (tcph->hlen * 4) - TCP_HLEN;
+    int i, n;
+
+    if(SEQ_LT(tsock->high_sacked, tsock->snd_una))
+    {
+        tsock->high_sacked = tsock->snd_una;
+    }
+
+    while(optlen > 0)
+    {
+        if(*p == TCPOPT_EOL)
         {
-            tsock->snd_nxt++;
+            break;
+        }
+
+        if(*p == TCPOPT_NOP)
+        {
+            p++;
+            optlen--;
+            continue;
         }
+
+        if(optlen < 2 || p[1] < 2 || p[1] > optlen)
+        {
+            break;
+        }
+
+        if(*p == TCPOPT_SACK)
+        {
+            n = (p[1] - 2) / sizeof(struct tcp_sack_block_t);
+            sb = (struct tcp_sack_block_t *)(p + 2);
+
+            for(i = 0; i < n; i++)
+            {
+                tcp_sack_mark(tsock, ntohl(sb[i].left), ntohl(sb[i].right));
+            }
+        }
+
+        optlen -= p[1];
+        p += p[1];
+    }
+}
+
+
+/*
+ * Fast retransmit, then enter fast recovery (RFC 5681, RFC 6582 and
+ * RFC 6675 when SACK is in use).
+ */
+static void tcp_enter_recovery(struct socket_tcp_t *tsock)
+{
+    struct packet_t *p = tsock->sock.outq.head;
+
+    tsock->ssthresh = tsock->cong->ssthresh(tsock);
+    tsock->cwnd = tsock->ssthresh;
+    tsock->recover = tsock->snd_nxt;
+    tsock->fast_retrans++;
+    tcp_set_ca_state(tsock, TCPCA_RECOVERY);
+
+    if(p && p != tsock->snd_head)
+    {
+        tcp_retransmit_seg(tsock, p);
+    }
+
+    tcp_retransmit_lost(tsock);
+}
+
+
+/*
+ * Handle a duplicate ACK.
+ */
+static void tcp_ack_dup(struct socket_tcp_t *tsock)
+{
+    if(tsock->dupacks < 0xff)
+    {
+        tsock->dupacks++;
+    }
+
+    if(tsock->ca_state != TCPCA_OPEN)
+    {
+        tcp_retransmit_lost(tsock);
+        return;
+    }
+
+    // RFC 6582: don't start a new recovery for losses in the last window
+    if(SEQ_LT(tsock->snd_una, tsock->recover))
+    {
+        return;
+    }
+
+    if(tsock->dupacks >= TCP_DUPTHRESH ||
+       (tsock->sackok &&
+        tsock->sacked_bytes > (TCP_DUPTHRESH - 1) * tsock->smss))
+    {
+        tcp_enter_recovery(tsock);
+    }
+
+    // otherwise, tcp_push() sends new data as the dupacks shrink the pipe
+    // (limited transmit, RFC 3042)
+}
+
+
+/*
+ * Handle an ACK of new data.
+ */
+static void tcp_ack_new(struct socket_tcp_t *tsock, uint32_t acked)
+{
+    struct packet_t *p;
+
+    switch(tsock->ca_state)
+    {
+        case TCPCA_OPEN:
+            tsock->dupacks = 0;
+            tsock->cong->cong_avoid(tsock, acked);
+            break;
+
+        case TCPCA_RECOVERY:
+            tsock->dupacks = 0;
+
+            if(SEQ_GEQ(tsock->snd_una, tsock->recover))
+            {
+                // full ACK, deflate the window and leave recovery
+                tsock->cwnd = tsock->ssthresh;
+                tcp_set_ca_state(tsock, TCPCA_OPEN);
+                break;
+            }
+
+            // partial ACK, resend the next unacknowledged segment
+            p = tsock->sock.outq.head;
+
+            if(!tsock->sackok && p && p != tsock->snd_head &&
+               !(p->flags & TCP_PKT_RETRANS))
+            {
+                tcp_retransmit_seg(tsock, p);
+            }
+
+            tcp_retransmit_lost(tsock);
+            break;
+
+        case TCPCA_LOSS:
+            tsock->cong->cong_avoid(tsock, acked);
+
+            if(SEQ_GEQ(tsock->snd_una, tsock->recover))
+            {
+                tcp_set_ca_state(tsock, TCPCA_OPEN);
+                break;
+            }
+
+            tcp_retransmit_lost(tsock);
+            break;
     }
 }
 
@@ -1683,7 +2135,7 @@ static void tcp_send_next(struct socket_tcp_t *tsock, int amount)
 static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct packet_t *p)
 {
     struct socket_tcp_t *tsock = (struct socket_tcp_t *)so;
-    int expected, do_free = 1;
+    int expected, do_free = 1, sent = 0;
 
     switch(tsock->tcpstate)
     {
@@ -1765,9 +2217,13 @@ static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct
         case TCPSTATE_CLOSE_WAIT:
         case TCPSTATE_CLOSING:
         case TCPSTATE_LAST_ACK:
-            if(tsock->snd_una < tcph->ackno && tcph->ackno <= tsock->snd_nxt)
+            if(SEQ_LT(tsock->snd_una, tcph->ackno) &&
+               SEQ_LEQ(tcph->ackno, tsock->snd_nxt))
             {
+                uint32_t acked = tcph->ackno - tsock->snd_una;
+
                 tsock->snd_una = tcph->ackno;
+                tsock->backoff = 0;
 
                 // parse timestamps if this is enabled for the connection
                 if(tsock->tsopt)
@@ -1775,27 +2231,52 @@ static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct
                     tcp_parse_timestamp(tsock, tcph);
                 }
 
-                tcp_rtt(tsock);
+                tcp_rtt(tsock, tcph->ackno);
 
                 // clear retransmission queue from acknowledged segments
                 tcp_clean_rto_queue(tsock, tsock->snd_una);
+
+                if(tsock->sackok)
+                {
+                    tcp_parse_sacks(tsock, tcph);
+                }
+
+                tcp_ack_new(tsock, acked);
+            }
+            else if(tcph->ackno == tsock->snd_una &&
+                    tsock->snd_nxt != tsock->snd_una &&
+                    p->end_seq == p->seq && !tcph->fin &&
+                    tcph->wnd == tsock->snd_wnd)
+            {
+                // RFC 5681: a duplicate ACK
+                if(tsock->sackok)
+                {
+                    tcp_parse_sacks(tsock, tcph);
+                }
+
+                tcp_ack_dup(tsock);
             }
 
-            if(tcph->ackno < tsock->snd_una)
+            if(SEQ_LT(tcph->ackno, tsock->snd_una))
             {
                 // ignore duplicate ACK
                 DROP_AND_RETURN(p);
             }
 
-            if(tcph->ackno > tsock->snd_nxt)
+            if(SEQ_GT(tcph->ackno, tsock->snd_nxt))
             {
                 // ACK for segment not sent yet
                 DROP_AND_RETURN(p);
             }
 
-            if(tsock->snd_una < tcph->ackno && tcph->ackno <= tsock->snd_nxt)
+            // update send window
+            if(SEQ_LT(tsock->snd_wl1, tcph->seqno) ||
+               (tsock->snd_wl1 == tcph->seqno &&
+                SEQ_LEQ(tsock->snd_wl2, tcph->ackno)))
             {
-                // TODO: update send window
+                tsock->snd_wnd = tcph->wnd;
+                tsock->snd_wl1 = tcph->seqno;
+                tsock->snd_wl2 = tcph->ackno;
             }
 
             break;
@@ -1942,12 +2423,20 @@ static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct
         }
     }
 
-    // congestion control and delacks
+    // send what the windows allow now, then handle delacks
     switch(tsock->tcpstate)
     {
+        case TCPSTATE_CLOSE_WAIT:
+        case TCPSTATE_CLOSING:
+        case TCPSTATE_LAST_ACK:
+            tcp_push(tsock);
+            break;
+
         case TCPSTATE_ESTABLISHED:
         case TCPSTATE_FIN_WAIT_1:
         case TCPSTATE_FIN_WAIT_2:
+            sent = tcp_push(tsock);
+
             if(expected)
             {
                 tcp_release_delack_timer(tsock);
@@ -1959,13 +2448,10 @@ static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct
                  * segments there SHOULD be an ACK for at least every second
                  * segment
                  */
-                int pending = MIN(so->outq.count, 3);
-
-                if(tsock->inflight == 0 && pending > 0)
+                if(sent > 0)
                 {
-                    tcp_send_next(tsock, pending);
-                    tsock->inflight += pending;
-                    tcp_rearm_rto_timer(tsock);
+                    // the data we have just sent carries the ACK
+                    tsock->delacks = 0;
                 }
                 else if(tcph->psh ||
                         ((p->end_seq - p->seq) > 1000 && ++tsock->delacks > 1))
@@ -1975,7 +2461,7 @@ static void tcp_input_state(struct socket_t *so, struct tcp_hdr_t *tcph, struct
                 }
                 else if((p->end_seq - p->seq) > 0)
                 {
-                    tsock->delack = nettimer_add(20, &tcp_send_delack, tsock);
+                    tsock->delack = nettimer_add(200, &tcp_send_delack, tsock);
                 }
             }
             break;
@@ -2020,7 +2506,8 @@ void tcp_input(struct packet_t *p)
     p->seq = tcph->seqno;
     p->end_seq = p->seq + dlen;
 
-    if(!(so = sock_lookup(IPPROTO_TCP, tcph->srcp, tcph->destp)))
+    if(!(so = sock_lookup(IPPROTO_TCP, iph->src, tcph->srcp,
+                                          iph->dest, tcph->destp)))
     {
         printk("tcp: cannot find socket for src %d and dest %d\n", tcph->srcp, tcph->destp);
         DROP_PACKET(p);
@@ -0,0 +1,214 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: tcp_cong.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file tcp_cong.c
+ *
+ *  TCP congestion control framework and the NewReno algorithm (RFC 5681,
+ *  RFC 6582). Fast retransmit and loss recovery are done in tcp.c, the
+ *  algorithms here only decide how the congestion window changes.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <kernel/laylaos.h>
+#include <kernel/net/tcp.h>
+#include <kernel/net/tcp_cong.h>
+
+static volatile struct kernel_mutex_t cong_lock = { 0, };
+
+// registered algorithms (the built-in ones are linked statically)
+static struct tcp_cong_ops_t *cong_head = &tcp_cubic;
+
+
+long tcp_cong_register(struct tcp_cong_ops_t *ops)
+{
+    if(!ops || !ops->name[0] || !ops->ssthresh || !ops->cong_avoid)
+    {
+        return -EINVAL;
+    }
+
+    if(tcp_cong_find(ops->name))
+    {
+        return -EEXIST;
+    }
+
+    kernel_mutex_lock(&cong_lock);
+    ops->next = cong_head;
+    cong_head = ops;
+    kernel_mutex_unlock(&cong_lock);
+
+    return 0;
+}
+
+
+struct tcp_cong_ops_t *tcp_cong_find(char *name)
+{
+    struct tcp_cong_ops_t *ops;
+
+    kernel_mutex_lock(&cong_lock);
+
+    for(ops = cong_head; ops != NULL; ops = ops->next)
+    {
+        if(strncmp(ops->name, name, TCP_CA_NAME_MAX) == 0)
+        {
+            break;
+        }
+    }
+
+    kernel_mutex_unlock(&cong_lock);
+
+    return ops;
+}
+
+
+long tcp_cong_select(struct socket_tcp_t *tsock, char *name)
+{
+    struct tcp_cong_ops_t *ops;
+
+    if(!(ops = tcp_cong_find(name ? name : TCP_CONG_DEFAULT)))
+    {
+        return -ENOENT;
+    }
+
+    tsock->cong = ops;
+    A_memset(tsock->cong_priv, 0, sizeof(tsock->cong_priv));
+
+    if(ops->init)
+    {
+        ops->init(tsock);
+    }
+
+    return 0;
+}
+
+
+void tcp_cong_init_window(struct socket_tcp_t *tsock)
+{
+    uint32_t iw = 10 * tsock->smss;
+
+    // RFC 6928: IW = min(10*MSS, max(2*MSS, 14600))
+    if(iw > 14600)
+    {
+        iw = (14600 > 2 * tsock->smss) ? 14600 : 2 * tsock->smss;
+    }
+
+    tsock->cwnd = iw;
+    tsock->ssthresh = 0xffffffff;
+    tsock->ca_state = TCPCA_OPEN;
+    tsock->dupacks = 0;
+}
+
+
+uint32_t tcp_slow_start(struct socket_tcp_t *tsock, uint32_t acked)
+{
+    uint32_t inc = acked;
+
+    // RFC 3465: limit the increase to 2 segments per ACK
+    if(inc > 2U * tsock->smss)
+    {
+        inc = 2U * tsock->smss;
+    }
+
+    if(tsock->cwnd + inc > tsock->ssthresh)
+    {
+        inc = (tsock->ssthresh > tsock->cwnd) ?
+                    tsock->ssthresh - tsock->cwnd : 0;
+    }
+
+    tsock->cwnd += inc;
+
+    return acked - inc;
+}
+
+
+uint32_t tcp_reno_ssthresh(struct socket_tcp_t *tsock)
+{
+    uint32_t flight = tsock->snd_nxt - tsock->snd_una;
+
+    // RFC 5681 (4)
+    flight /= 2;
+
+    return (flight > 2U * tsock->smss) ? flight : 2U * tsock->smss;
+}
+
+
+/*
+ * NewReno congestion avoidance, counting acknowledged bytes (RFC 3465)
+ * so that cwnd grows by one segment per window of data.
+ */
+struct newreno_t
+{
+    uint32_t bytes_acked;
+};
+
+
+static void newreno_init(struct socket_tcp_t *tsock)
+{
+    struct newreno_t *ca = TCP_CONG_PRIV(tsock);
+
+    ca->bytes_acked = 0;
+}
+
+
+static void newreno_cong_avoid(struct socket_tcp_t *tsock, uint32_t acked)
+{
+    struct newreno_t *ca = TCP_CONG_PRIV(tsock);
+
+    if(tsock->cwnd < tsock->ssthresh)
+    {
+        if(!(acked = tcp_slow_start(tsock, acked)))
+        {
+            return;
+        }
+    }
+
+    ca->bytes_acked += acked;
+
+    if(ca->bytes_acked >= tsock->cwnd)
+    {
+        ca->bytes_acked -= tsock->cwnd;
+        tsock->cwnd += tsock->smss;
+    }
+}
+
+
+static void newreno_set_state(struct socket_tcp_t *tsock, int newstate)
+{
+    struct newreno_t *ca = TCP_CONG_PRIV(tsock);
+
+    if(newstate != TCPCA_OPEN)
+    {
+        ca->bytes_acked = 0;
+    }
+}
+
+
+struct tcp_cong_ops_t tcp_newreno =
+{
+    .name = "newreno",
+    .init = newreno_init,
+    .ssthresh = tcp_reno_ssthresh,
+    .cong_avoid = newreno_cong_avoid,
+    .rtt_sample = NULL,
+    .set_state = newreno_set_state,
+    .next = NULL,
+};
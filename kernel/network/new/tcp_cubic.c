@@ -0,0 +1,284 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: tcp_cubic.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file tcp_cubic.c
+ *
+ *  The CUBIC congestion control algorithm (RFC 8312). Window sizes are
+ *  worked out in segments and times in milliseconds, using integer
+ *  arithmetic only.
+ */
+
+#include <kernel/laylaos.h>
+#include <kernel/net/tcp.h>
+#include <kernel/net/tcp_cong.h>
+#include <kernel/net/nettimer.h>
+
+// beta = 0.7, scaled by 1024
+#define CUBIC_BETA              717
+#define CUBIC_BETA_SCALE        1024
+
+// the largest time distance from K we compute the cubic function for
+#define CUBIC_MAX_DELTA         100000      /* msecs */
+
+struct cubic_t
+{
+    uint32_t cnt;           /* segments to ACK before cwnd grows by one */
+    uint32_t w_max;         /* cwnd before the last reduction (segments) */
+    uint32_t origin;        /* origin point of the cubic function */
+    uint32_t k;             /* time to reach the origin (msecs) */
+    uint32_t w_est;         /* Reno-friendly window estimate (segments) */
+    uint32_t est_acked;     /* segments acked towards w_est */
+    uint32_t bytes_acked;   /* bytes acked towards the next increase */
+    uint32_t delay_min;     /* lowest RTT seen (msecs) */
+    unsigned long long epoch_start;     /* start of the current epoch */
+};
+
+
+/*
+ * Integer cube root (one result bit at a time).
+ */
+static uint32_t cubic_root(uint64_t a)
+{
+    uint64_t x = 0, y;
+    int b;
+
+    for(b = 20; b >= 0; b--)
+    {
+        y = x | (1ULL << b);
+
+        if(y * y * y <= a)
+        {
+            x = y;
+        }
+    }
+
+    return (uint32_t)x;
+}
+
+
+static void cubic_reset(struct cubic_t *ca)
+{
+    ca->cnt = 0;
+    ca->w_max = 0;
+    ca->origin = 0;
+    ca->k = 0;
+    ca->w_est = 0;
+    ca->est_acked = 0;
+    ca->bytes_acked = 0;
+    ca->epoch_start = 0;
+}
+
+
+static void cubic_init(struct socket_tcp_t *tsock)
+{
+    struct cubic_t *ca = TCP_CONG_PRIV(tsock);
+
+    cubic_reset(ca);
+    ca->delay_min = 0;
+}
+
+
+/*
+ * Work out how many segments must be acked before cwnd grows by one.
+ */
+static void cubic_update(struct socket_tcp_t *tsock, struct cubic_t *ca,
+                         uint32_t acked_segs)
+{
+    uint32_t cwnd = tsock->cwnd / tsock->smss;
+    unsigned long long now = nettimer_now();
+    int64_t d, target;
+    uint32_t max_cnt, delta;
+
+    if(cwnd == 0)
+    {
+        cwnd = 1;
+    }
+
+    if(!ca->epoch_start)
+    {
+        ca->epoch_start = now;
+        ca->est_acked = 0;
+        ca->w_est = cwnd;
+
+        if(cwnd < ca->w_max)
+        {
+            // K = cbrt((W_max - cwnd) / C) secs, with C = 0.4
+            ca->k = cubic_root((uint64_t)(ca->w_max - cwnd) * 2500000000ULL);
+            ca->origin = ca->w_max;
+        }
+        else
+        {
+            ca->k = 0;
+            ca->origin = cwnd;
+        }
+    }
+
+    // W(t) = C * (t - K)^3 + W_max, looking one RTT ahead
+    d = (int64_t)(now - ca->epoch_start + ca->delay_min) - ca->k;
+
+    if(d > CUBIC_MAX_DELTA)
+    {
+        d = CUBIC_MAX_DELTA;
+    }
+    else if(d < -CUBIC_MAX_DELTA)
+    {
+        d = -CUBIC_MAX_DELTA;
+    }
+
+    target = (int64_t)ca->origin + (4 * d * d * d) / 10000000000LL;
+
+    if(target > (int64_t)cwnd)
+    {
+        ca->cnt = cwnd / (uint32_t)(target - cwnd);
+    }
+    else
+    {
+        // grow very slowly around the plateau
+        ca->cnt = 100 * cwnd;
+    }
+
+    /*
+     * Reno-friendly region: grow at least as fast as Reno would with the
+     * same beta, i.e. 3 * (1 - beta) / (1 + beta) segments per RTT.
+     */
+    ca->est_acked += acked_segs;
+    delta = (cwnd * 17) / 9;
+
+    if(delta == 0)
+    {
+        delta = 1;
+    }
+
+    while(ca->est_acked > delta)
+    {
+        ca->est_acked -= delta;
+        ca->w_est++;
+    }
+
+    if(ca->w_est > cwnd)
+    {
+        max_cnt = cwnd / (ca->w_est - cwnd);
+
+        if(ca->cnt > max_cnt)
+        {
+            ca->cnt = max_cnt;
+        }
+    }
+
+    // never grow faster than 1.5 times per RTT
+    if(ca->cnt < 2)
+    {
+        ca->cnt = 2;
+    }
+}
+
+
+static void cubic_cong_avoid(struct socket_tcp_t *tsock, uint32_t acked)
+{
+    struct cubic_t *ca = TCP_CONG_PRIV(tsock);
+    uint32_t step;
+
+    if(tsock->cwnd < tsock->ssthresh)
+    {
+        if(!(acked = tcp_slow_start(tsock, acked)))
+        {
+            return;
+        }
+    }
+
+    cubic_update(tsock, ca, (acked + tsock->smss - 1) / tsock->smss);
+
+    ca->bytes_acked += acked;
+    step = ca->cnt * tsock->smss;
+
+    while(ca->bytes_acked >= step)
+    {
+        ca->bytes_acked -= step;
+        tsock->cwnd += tsock->smss;
+    }
+}
+
+
+static uint32_t cubic_ssthresh(struct socket_tcp_t *tsock)
+{
+    struct cubic_t *ca = TCP_CONG_PRIV(tsock);
+    uint32_t cwnd = tsock->cwnd / tsock->smss;
+    uint32_t ss;
+
+    ca->epoch_start = 0;
+    ca->bytes_acked = 0;
+
+    // fast convergence: release bandwidth to newer flows
+    if(cwnd < ca->w_max)
+    {
+        ca->w_max = (cwnd * (CUBIC_BETA_SCALE + CUBIC_BETA)) /
+                                                (2 * CUBIC_BETA_SCALE);
+    }
+    else
+    {
+        ca->w_max = cwnd;
+    }
+
+    ss = (uint32_t)(((uint64_t)tsock->cwnd * CUBIC_BETA) / CUBIC_BETA_SCALE);
+
+    return (ss > 2U * tsock->smss) ? ss : 2U * tsock->smss;
+}
+
+
+static void cubic_rtt_sample(struct socket_tcp_t *tsock, int32_t rtt)
+{
+    struct cubic_t *ca = TCP_CONG_PRIV(tsock);
+
+    if(rtt <= 0)
+    {
+        rtt = 1;
+    }
+
+    if(ca->delay_min == 0 || (uint32_t)rtt < ca->delay_min)
+    {
+        ca->delay_min = rtt;
+    }
+}
+
+
+static void cubic_set_state(struct socket_tcp_t *tsock, int newstate)
+{
+    struct cubic_t *ca = TCP_CONG_PRIV(tsock);
+
+    // start over after a retransmit timeout
+    if(newstate == TCPCA_LOSS)
+    {
+        cubic_reset(ca);
+    }
+}
+
+
+struct tcp_cong_ops_t tcp_cubic =
+{
+    .name = "cubic",
+    .init = cubic_init,
+    .ssthresh = cubic_ssthresh,
+    .cong_avoid = cubic_cong_avoid,
+    .rtt_sample = cubic_rtt_sample,
+    .set_state = cubic_set_state,
+    .next = &tcp_newreno,
+};
@@ -217,7 +217,8 @@ void udp_input(struct packet_t *p)
     udph->len = ntohs(udph->len);
     */
 
-    if(!(so = sock_lookup(IPPROTO_UDP, udph->srcp, udph->destp)))
+    if(!(so = sock_lookup(IPPROTO_UDP, iph->src, udph->srcp,
+                                          iph->dest, udph->destp)))
     {
         printk("udp: cannot find socket for src %d and dest %d\n", udph->srcp, udph->destp);
         DROP_PACKET(p);
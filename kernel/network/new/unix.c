@@ -35,30 +35,344 @@
 #include <kernel/net/socket.h>
 #include <kernel/net/protocol.h>
 #include <kernel/net/unix.h>
+#include <kernel/fio.h>
 #include <mm/kheap.h>
 
 #include "iovec.c"
 #include "../../kernel/task_funcs.c"
 
+// maximum length of the control data we accept with a message
+#define UNIX_CONTROL_MAX        1024
+
 
 static struct socket_t *unix_socket(void)
 {
-    struct socket_t *so;
+    struct socket_unix_t *us;
     
-    if(!(so = kmalloc(sizeof(struct socket_t))))
+    if(!(us = kmalloc(sizeof(struct socket_unix_t))))
     {
         return NULL;
     }
 	    
-    A_memset(so, 0, sizeof(struct socket_t));
+    A_memset(us, 0, sizeof(struct socket_unix_t));
+
+    return &us->sock;
+}
+
+
+static void unix_free_rights(struct unix_rights_t *r)
+{
+    int i;
+
+    for(i = 0; i < r->nfds; i++)
+    {
+        if(r->files[i])
+        {
+            closef(r->files[i]);
+        }
+    }
+
+    kfree(r);
+}
+
+
+/*
+ * Take a reference on each file passed in the SCM_RIGHTS control messages
+ * of the given message.
+ */
+static long unix_get_rights(struct msghdr *msg, int kernel,
+                            struct unix_rights_t **res)
+{
+    struct unix_rights_t *r;
+    struct msghdr kmsg;
+    struct cmsghdr *cmsg;
+    struct file_t *f;
+    struct fs_node_t *node;
+    size_t len = msg->msg_controllen;
+    int *fds, i, n;
+    long err = 0;
+
+    *res = NULL;
+
+    if(len < sizeof(struct cmsghdr))
+    {
+        return -EINVAL;
+    }
+
+    if(len > UNIX_CONTROL_MAX)
+    {
+        return -ENOBUFS;
+    }
+
+    if(!(r = kmalloc(sizeof(struct unix_rights_t) + len +
+                     UNIX_MAX_RIGHTS * sizeof(struct file_t *))))
+    {
+        return -ENOMEM;
+    }
+
+    r->pos = 0;
+    r->nfds = 0;
+    r->next = NULL;
+
+    // work on a copy of the control data, which we keep after the files
+    kmsg.msg_control = &r->files[UNIX_MAX_RIGHTS];
+    kmsg.msg_controllen = len;
+
+    if(kernel)
+    {
+        A_memcpy(kmsg.msg_control, msg->msg_control, len);
+    }
+    else if(copy_from_user(kmsg.msg_control, msg->msg_control, len) != 0)
+    {
+        kfree(r);
+        return -EFAULT;
+    }
+
+    for(cmsg = CMSG_FIRSTHDR(&kmsg); cmsg; cmsg = CMSG_NXTHDR(&kmsg, cmsg))
+    {
+        if(cmsg->cmsg_len < CMSG_LEN(0) ||
+           cmsg->cmsg_len > len - ((char *)cmsg - (char *)kmsg.msg_control))
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds = (int *)CMSG_DATA(cmsg);
+
+        if(r->nfds + n > UNIX_MAX_RIGHTS)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        for(i = 0; i < n; i++)
+        {
+            if(fdnode(fds[i], this_core->cur_task, &f, &node) != 0)
+            {
+                err = -EBADF;
+                break;
+            }
+
+            __sync_fetch_and_add(&(f->refs), 1);
+            r->files[r->nfds++] = f;
+        }
+
+        if(err)
+        {
+            break;
+        }
+    }
+
+    if(err || r->nfds == 0)
+    {
+        unix_free_rights(r);
+        return err;
+    }
 
-    return so;
+    *res = r;
+    return 0;
+}
+
+
+/*
+ * Install the passed files in the reader's file table and return them in
+ * an SCM_RIGHTS control message. Files that do not fit in the reader's
+ * control buffer are closed. Called without the socket lock, as closing
+ * a file might need to lock a paired socket.
+ */
+static void unix_put_rights(struct msghdr *msg, struct unix_rights_t *r,
+                            size_t room, unsigned int flags)
+{
+    char buf[CMSG_SPACE(UNIX_MAX_RIGHTS * sizeof(int))];
+    struct cmsghdr *cmsg = (struct cmsghdr *)buf;
+    int *fds = (int *)CMSG_DATA(cmsg);
+    size_t max = (room < CMSG_LEN(0)) ? 0 :
+                        (room - CMSG_LEN(0)) / sizeof(int);
+    int i, n = 0;
+    long fd;
+
+    for(i = 0; i < r->nfds; i++)
+    {
+        if((size_t)n < max &&
+           (fd = fdinstall(r->files[i],
+                    (flags & MSG_CMSG_CLOEXEC) ? O_CLOEXEC : 0)) >= 0)
+        {
+            // the reference now belongs to the new descriptor
+            fds[n++] = fd;
+            r->files[i] = NULL;
+        }
+        else
+        {
+            msg->msg_flags |= MSG_CTRUNC;
+        }
+    }
+
+    unix_free_rights(r);
+
+    if(n == 0)
+    {
+        return;
+    }
+
+    cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+
+    if(copy_to_user(msg->msg_control, buf, cmsg->cmsg_len) == 0)
+    {
+        msg->msg_controllen = (CMSG_SPACE(n * sizeof(int)) > room) ?
+                                    room : CMSG_SPACE(n * sizeof(int));
+    }
+}
+
+
+/*
+ * Copy data directly to the receive ring of the peer stream socket,
+ * blocking while the ring is full.
+ */
+static long unix_stream_write(struct socket_t *so, struct socket_t *so2,
+                              struct msghdr *msg, size_t total,
+                              struct unix_rights_t *rights, int kernel)
+{
+    struct socket_unix_t *us2 = (struct socket_unix_t *)so2;
+    size_t written = 0, len, first, tail;
+    int nonblock = (so->flags & SOCKET_FLAG_NONBLOCK) ||
+                   (msg->msg_flags & MSG_DONTWAIT);
+    int wake = 0;
+    long res = 0;
+
+    /*
+     * We might sleep for a long time with no lock held on the peer, so hold
+     * a reference to stop it being freed under us if it is closed. It is
+     * still paired with us, so it hasn't been closed yet.
+     */
+    __sync_fetch_and_add(&so2->refs, 1);
+
+    SOCKET_UNLOCK(so);
+    SOCKET_LOCK(so2);
+
+    if(!us2->buf && !(us2->buf = kmalloc(UNIX_STREAM_BUFSZ)))
+    {
+        printk("unix: insufficient memory for socket buffer\n");
+        res = -ENOMEM;
+    }
+
+    while(!res && written < total)
+    {
+        // peer has disconnected
+        if(so2->pairedsock != so)
+        {
+            res = -EPIPE;
+            break;
+        }
+
+        if(us2->count == UNIX_STREAM_BUFSZ)
+        {
+            __sync_and_and_fetch(&so->poll_events,
+                                 ~(POLLOUT | POLLWRNORM | POLLWRBAND));
+
+            if(nonblock)
+            {
+                res = -EAGAIN;
+                break;
+            }
+
+            if(block_task2_and_unlock(&us2->wr_waiting, 0,
+                                      &so2->lock) == EINTR)
+            {
+                SOCKET_LOCK(so2);
+                res = -EINTR;
+                break;
+            }
+
+            SOCKET_LOCK(so2);
+            continue;
+        }
+
+        // the passed files go with the first byte we write
+        if(rights)
+        {
+            rights->pos = us2->rpos + us2->count;
+
+            if(us2->rights_tail)
+            {
+                us2->rights_tail->next = rights;
+            }
+            else
+            {
+                us2->rights_head = rights;
+            }
+
+            us2->rights_tail = rights;
+            rights = NULL;
+        }
+
+        len = UNIX_STREAM_BUFSZ - us2->count;
+
+        if(len > total - written)
+        {
+            len = total - written;
+        }
+
+        tail = (us2->head + us2->count) & (UNIX_STREAM_BUFSZ - 1);
+        first = UNIX_STREAM_BUFSZ - tail;
+
+        if(first > len)
+        {
+            first = len;
+        }
+
+        read_iovec(msg->msg_iov, msg->msg_iovlen, us2->buf + tail, 
+                   first, kernel);
+
+        if(len > first)
+        {
+            read_iovec(msg->msg_iov, msg->msg_iovlen, us2->buf, 
+                       len - first, kernel);
+        }
+
+        // readers only sleep on an empty ring
+        if(us2->count == 0)
+        {
+            __sync_or_and_fetch(&so2->poll_events, POLLIN);
+            unblock_all_tasks(&us2->rd_waiting);
+            wake = 1;
+        }
+
+        us2->count += len;
+        written += len;
+    }
+
+    SOCKET_UNLOCK(so2);
+    SOCKET_LOCK(so);
+
+    if(wake)
+    {
+        selwakeup(&so2->selrecv);
+    }
+
+    __sync_fetch_and_sub(&so2->refs, 1);
+
+    if(rights)
+    {
+        unix_free_rights(rights);
+    }
+
+    return written ? (long)written : res;
 }
 
 
 static long unix_write(struct socket_t *so, struct msghdr *msg, int kernel)
 {
     struct socket_t *so2;
+    struct unix_rights_t *rights = NULL;
     struct packet_t *p;
     long total, res;
 
@@ -72,6 +386,26 @@ static long unix_write(struct socket_t *so, struct msghdr *msg, int kernel)
         return -EINVAL;
     }
 
+    if(msg->msg_control && msg->msg_controllen)
+    {
+        if((res = unix_get_rights(msg, kernel, &rights)) != 0)
+        {
+            return res;
+        }
+    }
+
+    if(so->type == SOCK_STREAM)
+    {
+        return unix_stream_write(so, so2, msg, total, rights, kernel);
+    }
+
+    // we only pass files over stream sockets
+    if(rights)
+    {
+        unix_free_rights(rights);
+        return -EOPNOTSUPP;
+    }
+
     if(!(p = alloc_packet(total)))
     {
         printk("unix: insufficient memory for sending packet\n");
@@ -99,17 +433,149 @@ static long unix_write(struct socket_t *so, struct msghdr *msg, int kernel)
 }
 
 
+/*
+ * Copy data out of our receive ring. A read never returns data from
+ * before and after a set of passed files, so that the files are returned
+ * with the data they were sent with.
+ */
+static long unix_stream_read(struct socket_t *so, struct msghdr *msg,
+                             size_t size, size_t room, unsigned int flags)
+{
+    struct socket_unix_t *us = (struct socket_unix_t *)so;
+    struct unix_rights_t *r, *rights = NULL;
+    struct socket_t *so2;
+    size_t len, first;
+    int wake = 0;
+
+    while(us->count == 0)
+    {
+        // don't wait if peer has disconnected
+        if(!so->pairedsock)
+        {
+            return 0;
+        }
+
+        if((flags & MSG_DONTWAIT) || (so->flags & SOCKET_FLAG_NONBLOCK))
+        {
+            return -EAGAIN;
+        }
+
+        if(block_task2_and_unlock(&us->rd_waiting, 0, &so->lock) == EINTR)
+        {
+            SOCKET_LOCK(so);
+            return -EINTR;
+        }
+
+        SOCKET_LOCK(so);
+    }
+
+    len = us->count;
+
+    if((r = us->rights_head))
+    {
+        if(r->pos == us->rpos)
+        {
+            if(!(flags & MSG_PEEK))
+            {
+                if(!(us->rights_head = r->next))
+                {
+                    us->rights_tail = NULL;
+                }
+
+                rights = r;
+            }
+
+            r = r->next;
+        }
+
+        if(r && r->pos - us->rpos < len)
+        {
+            len = r->pos - us->rpos;
+        }
+    }
+
+    if(len > size)
+    {
+        len = size;
+    }
+
+    first = UNIX_STREAM_BUFSZ - us->head;
+
+    if(first > len)
+    {
+        first = len;
+    }
+
+    write_iovec(msg->msg_iov, msg->msg_iovlen, us->buf + us->head, first, 0);
+
+    if(len > first)
+    {
+        write_iovec(msg->msg_iov, msg->msg_iovlen, us->buf, len - first, 0);
+    }
+
+    socket_copy_remoteaddr(so, msg);
+
+    if(!(flags & MSG_PEEK))
+    {
+        // writers only sleep on a full ring
+        wake = (us->count == UNIX_STREAM_BUFSZ);
+
+        us->head = (us->head + len) & (UNIX_STREAM_BUFSZ - 1);
+        us->count -= len;
+        us->rpos += len;
+
+        if(us->count == 0)
+        {
+            __sync_and_and_fetch(&so->poll_events, ~POLLIN);
+        }
+
+        if(wake)
+        {
+            unblock_all_tasks(&us->wr_waiting);
+
+            if((so2 = so->pairedsock))
+            {
+                __sync_or_and_fetch(&so2->poll_events,
+                                    (POLLOUT | POLLWRNORM | POLLWRBAND));
+                selwakeup(&so2->sleep);
+            }
+        }
+    }
+
+    if(rights)
+    {
+        SOCKET_UNLOCK(so);
+        unix_put_rights(msg, rights, room, flags);
+        SOCKET_LOCK(so);
+    }
+
+    return len;
+}
+
+
 static long unix_read(struct socket_t *so, struct msghdr *msg, unsigned int flags)
 {
     struct packet_t *p;
     size_t size, read = 0;
-    size_t plen;
+    size_t plen, room = 0;
 
     if((size = get_iovec_size(msg->msg_iov, msg->msg_iovlen)) == 0)
     {
         return -EINVAL;
     }
 
+    // we return the length of the control data we pass back (if any)
+    if(msg->msg_control)
+    {
+        room = msg->msg_controllen;
+        msg->msg_controllen = 0;
+    }
+
+    if(so->type == SOCK_STREAM)
+    {
+        return unix_stream_read(so, msg, size, room, flags);
+    }
+
 try:
 
     p = so->inq.head;
@@ -471,6 +937,51 @@ long socket_unix_connect(struct socket_t *so,
 }
 
 
+/*
+ * Wake up tasks blocked reading from or writing to the given socket.
+ * Called with the socket locked, after it has been unpaired.
+ */
+void socket_unix_wakeup(struct socket_t *so)
+{
+    struct socket_unix_t *us = (struct socket_unix_t *)so;
+
+    unblock_all_tasks(&us->rd_waiting);
+    unblock_all_tasks(&us->wr_waiting);
+}
+
+
+/*
+ * Free the receive ring and release any files passed to the given socket
+ * that were never received. Called when the socket is freed.
+ */
+void socket_unix_cleanup(struct socket_t *so)
+{
+    struct socket_unix_t *us = (struct socket_unix_t *)so;
+    struct unix_rights_t *r;
+
+    if(!so || so->domain != AF_UNIX)
+    {
+        return;
+    }
+
+    while((r = us->rights_head))
+    {
+        us->rights_head = r->next;
+        unix_free_rights(r);
+    }
+
+    us->rights_tail = NULL;
+
+    if(us->buf)
+    {
+        kfree(us->buf);
+        us->buf = NULL;
+    }
+
+    us->count = 0;
+}
+
+
 struct sockops_t unix_sockops =
 {
     .connect = NULL,
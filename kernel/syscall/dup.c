@@ -40,35 +40,25 @@
  */
 long do_dup(int fd, int arg)
 {
+	struct file_t *f;
+	long res;
+
 	if(arg < 0 || arg >= NR_OPEN)
 	{
 		return -EINVAL;
 	}
-	
-	while(arg < NR_OPEN)
-	{
-		if(this_core->cur_task->ofiles->ofile[arg])    // fd in use
-		{
-			arg++;
-		}
-		else                        // free fd
-		{
-			break;
-		}
-	}
-	
-	if(arg >= NR_OPEN)
+
+	// find the lowest free fd >= arg (this also clears the close-on-exec
+	// flag)
+	if((res = fdalloc(arg, &arg)) != 0)
 	{
-		return -EMFILE;
+		return res;
 	}
 
-	// clear the close-on-exec flag
-	cloexec_clear(this_core->cur_task, arg);
-
-    // duplicate fd
-	this_core->cur_task->ofiles->ofile[arg] = this_core->cur_task->ofiles->ofile[fd];
-	//ct->ofiles->ofile[arg]->refs++;
-    __sync_fetch_and_add(&(this_core->cur_task->ofiles->ofile[arg]->refs), 1);
+	// duplicate fd
+	f = this_core->cur_task->ofiles->ofile[fd];
+	__sync_fetch_and_add(&(f->refs), 1);
+	fdassign(arg, f);
 
 	return arg;
 }
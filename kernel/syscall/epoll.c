@@ -0,0 +1,1022 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: epoll.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file epoll.c
+ *
+ *  The kernel's epoll implementation.
+ *
+ *  Each epoll instance keeps its interest list in a hash table (keyed by
+ *  file descriptor), and a list of ready items. When a watched file is
+ *  polled and found not ready, the select channels it records are hooked
+ *  (see selhook_add()), so that a later selwakeup() on the channel queues
+ *  the item on the ready list and wakes up the waiters. epoll_wait() only
+ *  looks at the items on the ready list, instead of polling the whole
+ *  interest list like poll() and select() do.
+ *
+ *  Locks are taken in this order: epoll_mutex, an epoll instance's mtx,
+ *  the select table's channel locks, and an epoll instance's ready list
+ *  lock.
+ *
+ *  See: https://man7.org/linux/man-pages/man7/epoll.7.html
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <kernel/laylaos.h>
+#include <kernel/syscall.h>
+#include <kernel/epoll.h>
+#include <kernel/vfs.h>
+#include <kernel/fio.h>
+#include <kernel/user.h>
+#include <kernel/task.h>
+#include <kernel/timer.h>
+#include <kernel/hrtimer.h>
+#include <kernel/ksignal.h>
+#include <kernel/fcntl.h>
+#include <mm/kheap.h>
+#include <mm/slab.h>
+#include <fs/dummy.h>
+
+#include "../kernel/task_funcs.c"
+
+// protects the files' epitems lists
+volatile struct kernel_mutex_t epoll_mutex = { 0, };
+static struct kmem_cache_t *epitem_cache = NULL;
+
+static long epollfs_poll(struct file_t *f, struct pollfd *pfd);
+static long epollfs_select(struct file_t *f, int which);
+
+
+/*
+ * Initialise epoll.
+ */
+void epoll_init(void)
+{
+    if(!(epitem_cache = kmem_cache_create("epitem",
+                                          sizeof(struct epitem_t), 0, NULL)))
+    {
+        kpanic("Failed to create epoll item cache\n");
+    }
+}
+
+
+STATIC_INLINE int ep_hash(struct epoll_t *ep, int fd)
+{
+    return fd & (ep->hashsz - 1);
+}
+
+
+STATIC_INLINE struct epitem_t *ep_find(struct epoll_t *ep, int fd,
+                                       struct file_t *f)
+{
+    struct epitem_t *item;
+
+    for(item = ep->hash[ep_hash(ep, fd)]; item != NULL; item = item->next)
+    {
+        if(item->fd == fd && item->file == f)
+        {
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Add an item to the tail of the ready list if it is not already there.
+ * Must be called with ep->lock held.
+ */
+STATIC_INLINE void __ep_queue_item(struct epoll_t *ep, struct epitem_t *item)
+{
+    if(item->flags & EPITEM_READY)
+    {
+        return;
+    }
+
+    item->flags |= EPITEM_READY;
+    item->rdnext = NULL;
+
+    if((item->rdprev = ep->rdtail))
+    {
+        ep->rdtail->rdnext = item;
+    }
+    else
+    {
+        ep->rdhead = item;
+    }
+
+    ep->rdtail = item;
+}
+
+
+/*
+ * Remove an item from the ready list. Must be called with ep->lock held.
+ */
+STATIC_INLINE void __ep_dequeue_item(struct epoll_t *ep, struct epitem_t *item)
+{
+    if(!(item->flags & EPITEM_READY))
+    {
+        return;
+    }
+
+    if(item->rdprev)
+    {
+        item->rdprev->rdnext = item->rdnext;
+    }
+    else
+    {
+        ep->rdhead = item->rdnext;
+    }
+
+    if(item->rdnext)
+    {
+        item->rdnext->rdprev = item->rdprev;
+    }
+    else
+    {
+        ep->rdtail = item->rdprev;
+    }
+
+    item->flags &= ~EPITEM_READY;
+    item->rdnext = NULL;
+    item->rdprev = NULL;
+}
+
+
+/*
+ * Queue a ready item and wake up the epoll instance's waiters.
+ * Returns the number of waiting tasks we woke up.
+ */
+static int ep_wakeup(struct epoll_t *ep, struct epitem_t *item)
+{
+    int woken;
+
+    kernel_mutex_lock(&ep->lock);
+
+    // ignore dead items and oneshot items that have already fired
+    if((item->flags & EPITEM_DEAD) ||
+       !(item->event.events & ~EP_PRIVATE_BITS))
+    {
+        kernel_mutex_unlock(&ep->lock);
+        return 0;
+    }
+
+    __ep_queue_item(ep, item);
+    woken = unblock_all_tasks(ep);
+    kernel_mutex_unlock(&ep->lock);
+
+    // wake up anyone polling the epoll instance itself
+    selwakeup(&ep->sel);
+
+    return woken;
+}
+
+
+/*
+ * Select hook, called by selwakeup() when one of the channels of a watched
+ * file is woken up.
+ */
+static int ep_hook_func(struct selhook_t *hook)
+{
+    struct epitem_t *item = ((struct ephook_t *)hook)->item;
+
+    return ep_wakeup(item->ep, item);
+}
+
+
+/*
+ * Called by selrecord() while we are polling a watched file, to tell us
+ * which select channels the file waits on.
+ */
+static void ep_record(struct selrec_t *rec, struct selinfo *sip)
+{
+    struct epitem_t *item = (struct epitem_t *)rec;
+    struct ephook_t *hook;
+    int i;
+
+    for(i = 0; i < item->nhooks; i++)
+    {
+        if(item->hooks[i].hook.sip == sip)
+        {
+            return;
+        }
+    }
+
+    if(item->nhooks >= EPOLL_ITEM_HOOKS)
+    {
+        printk("epoll: too many select channels for fd %d\n", item->fd);
+        return;
+    }
+
+    hook = &item->hooks[item->nhooks];
+    hook->item = item;
+    hook->hook.func = ep_hook_func;
+    hook->hook.flags = (item->event.events & EPOLLEXCLUSIVE) ?
+                                                SELHOOK_EXCLUSIVE : 0;
+    hook->hook.next = NULL;
+    hook->hook.pprev = NULL;
+
+    if(selhook_add(sip, &hook->hook) == 0)
+    {
+        item->nhooks++;
+    }
+}
+
+
+/*
+ * Poll a watched file. Any select channels the file records are hooked.
+ * Must be called with ep->mtx held.
+ */
+static unsigned int ep_item_poll(struct epitem_t *item)
+{
+    volatile struct task_t *ct = this_core->cur_task;
+    struct file_t *f = item->file;
+    struct pollfd pfd;
+    int nhooks = item->nhooks;
+
+    if(!f->node || !f->node->poll)
+    {
+        return 0;
+    }
+
+    pfd.fd = item->fd;
+    pfd.events = (item->event.events & ~EP_PRIVATE_BITS) | POLLERR | POLLHUP;
+    pfd.revents = 0;
+
+    ct->selrec = &item->rec;
+    f->node->poll(f, &pfd);
+
+    /*
+     * If we have just hooked the file, it might have become ready after it
+     * checked its state but before the hook was added, so check again.
+     */
+    if(!pfd.revents && item->nhooks != nhooks)
+    {
+        f->node->poll(f, &pfd);
+    }
+
+    ct->selrec = NULL;
+
+    return pfd.revents & (pfd.events | POLLNVAL);
+}
+
+
+/*
+ * Collect ready events. Must be called with ep->mtx held.
+ * Returns the number of events copied to the user buffer.
+ */
+static int ep_scan(struct epoll_t *ep, struct epoll_event *events,
+                   int maxevents)
+{
+    struct epitem_t *tx, *txtail, *item;
+    struct epoll_event ev;
+    unsigned int revents;
+    int n = 0;
+
+    // take the whole ready list, so that items which become ready while
+    // we are scanning are queued for the next round
+    kernel_mutex_lock(&ep->lock);
+    tx = ep->rdhead;
+    txtail = ep->rdtail;
+    ep->rdhead = NULL;
+    ep->rdtail = NULL;
+    kernel_mutex_unlock(&ep->lock);
+
+    while(tx && n < maxevents)
+    {
+        item = tx;
+
+        if((tx = item->rdnext))
+        {
+            tx->rdprev = NULL;
+        }
+
+        kernel_mutex_lock(&ep->lock);
+        item->flags &= ~EPITEM_READY;
+        item->rdnext = NULL;
+        item->rdprev = NULL;
+        kernel_mutex_unlock(&ep->lock);
+
+        if(!(revents = ep_item_poll(item)))
+        {
+            continue;
+        }
+
+        ev.events = revents;
+        ev.data = item->event.data;
+
+        if(copy_to_user(&events[n], &ev, sizeof(struct epoll_event)) != 0)
+        {
+            kernel_mutex_lock(&ep->lock);
+            __ep_queue_item(ep, item);
+            kernel_mutex_unlock(&ep->lock);
+
+            if(n == 0)
+            {
+                n = -EFAULT;
+            }
+
+            break;
+        }
+
+        n++;
+
+        kernel_mutex_lock(&ep->lock);
+
+        if(item->event.events & EPOLLONESHOT)
+        {
+            // disabled until rearmed by EPOLL_CTL_MOD
+            item->event.events &= EP_PRIVATE_BITS;
+        }
+        else if(!(item->event.events & EPOLLET) || !item->nhooks)
+        {
+            /*
+             * Level-triggered items stay on the ready list until a scan
+             * finds them not ready. So do files we have no hooks on (i.e.
+             * that have been ready every time we polled them), as we
+             * would otherwise never hear from them again.
+             */
+            __ep_queue_item(ep, item);
+        }
+
+        kernel_mutex_unlock(&ep->lock);
+    }
+
+    // put back whatever we did not get to
+    if(tx)
+    {
+        kernel_mutex_lock(&ep->lock);
+
+        if((txtail->rdnext = ep->rdhead))
+        {
+            ep->rdhead->rdprev = txtail;
+        }
+        else
+        {
+            ep->rdtail = txtail;
+        }
+
+        ep->rdhead = tx;
+        kernel_mutex_unlock(&ep->lock);
+    }
+
+    return n;
+}
+
+
+/* epoll_wait() timeout */
+struct ep_timeout_t
+{
+    struct hrtimer_t timer;
+    struct epoll_t *ep;
+    volatile int expired;
+};
+
+
+/*
+ * Timeout callback. Runs in interrupt context, so it can't take the ready
+ * list lock. We flag the timeout and wake up the epoll instance's waiters,
+ * who check the flag once they are on the wait queue (see below).
+ */
+static int ep_timeout_func(struct hrtimer_t *timer)
+{
+    struct ep_timeout_t *to = (struct ep_timeout_t *)timer->arg;
+
+    to->expired = 1;
+    unblock_tasks(to->ep);
+
+    return HRTIMER_NORESTART;
+}
+
+
+/*
+ * Called by block_task2_unless() once we are on the wait queue. Both
+ * ep_wakeup() and the timeout callback change what we check here before
+ * they wake the wait queue, so if we sleep, we can't miss their wakeup.
+ */
+static int ep_poll_done(void *arg)
+{
+    struct ep_timeout_t *to = (struct ep_timeout_t *)arg;
+
+    return to->expired || *(struct epitem_t * volatile *)&to->ep->rdhead;
+}
+
+
+/*
+ * Wait for events on an epoll instance. The timeout is in milliseconds.
+ */
+static long ep_poll(struct epoll_t *ep, struct epoll_event *events,
+                    int maxevents, int timeout)
+{
+    struct ep_timeout_t to;
+    long res;
+
+    to.ep = ep;
+    to.expired = 0;
+
+    if(timeout > 0)
+    {
+        hrtimer_setup(&to.timer, ep_timeout_func, &to);
+        hrtimer_start(&to.timer, hrtimer_now() +
+                                 (unsigned long long)timeout * NSEC_PER_MSEC);
+    }
+
+    while(1)
+    {
+        kernel_mutex_lock(&ep->mtx);
+
+        if((res = ep_scan(ep, events, maxevents)) != 0 ||
+           timeout == 0 || to.expired)
+        {
+            kernel_mutex_unlock(&ep->mtx);
+            break;
+        }
+
+        kernel_mutex_unlock(&ep->mtx);
+
+        if(block_task2_unless(ep, 0, ep_poll_done, &to) == EINTR)
+        {
+            res = -EINTR;
+            break;
+        }
+    }
+
+    // once this returns, the timer can't touch our stack frame
+    if(timeout > 0)
+    {
+        hrtimer_cancel(&to.timer);
+    }
+
+    return res;
+}
+
+
+/*
+ * Grow an epoll instance's hash table. Must be called with ep->mtx held.
+ */
+static void ep_grow_hash(struct epoll_t *ep)
+{
+    struct epitem_t **hash, *item, *next;
+    int i, j, sz = ep->hashsz * 2;
+
+    // not fatal, we will just have longer hash chains
+    if(!(hash = kmalloc(sz * sizeof(struct epitem_t *))))
+    {
+        return;
+    }
+
+    A_memset(hash, 0, sz * sizeof(struct epitem_t *));
+
+    for(i = 0; i < ep->hashsz; i++)
+    {
+        for(item = ep->hash[i]; item != NULL; item = next)
+        {
+            next = item->next;
+            j = item->fd & (sz - 1);
+            item->next = hash[j];
+            hash[j] = item;
+        }
+    }
+
+    kfree(ep->hash);
+    ep->hash = hash;
+    ep->hashsz = sz;
+}
+
+
+/*
+ * Add a file to the interest list. Must be called with epoll_mutex and
+ * ep->mtx held.
+ */
+static long ep_insert(struct epoll_t *ep, struct epoll_event *event,
+                      struct file_t *f, int fd)
+{
+    struct epitem_t *item;
+    int h;
+
+    if(!(item = kmem_cache_alloc(epitem_cache)))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(item, 0, sizeof(struct epitem_t));
+    item->rec.record = ep_record;
+    item->ep = ep;
+    item->file = f;
+    item->fd = fd;
+    item->event = *event;
+
+    if(ep->nitems >= ep->hashsz * 2)
+    {
+        ep_grow_hash(ep);
+    }
+
+    h = ep_hash(ep, fd);
+    item->next = ep->hash[h];
+    ep->hash[h] = item;
+    ep->nitems++;
+
+    if((item->fnext = f->epitems))
+    {
+        f->epitems->fpprev = &item->fnext;
+    }
+
+    f->epitems = item;
+    item->fpprev = &f->epitems;
+
+    if(IS_EPOLL(f->node))
+    {
+        ep->nr_nested++;
+    }
+
+    // the file might be ready already
+    if(ep_item_poll(item))
+    {
+        ep_wakeup(ep, item);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Change the events of an item on the interest list. Must be called with
+ * ep->mtx held.
+ */
+static long ep_modify(struct epoll_t *ep, struct epitem_t *item,
+                      struct epoll_event *event)
+{
+    kernel_mutex_lock(&ep->lock);
+    item->event.events = event->events;
+    item->event.data = event->data;
+    kernel_mutex_unlock(&ep->lock);
+
+    if(ep_item_poll(item))
+    {
+        ep_wakeup(ep, item);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Remove an item from the interest list and free it. Must be called with
+ * epoll_mutex and ep->mtx held.
+ */
+static void ep_remove(struct epoll_t *ep, struct epitem_t *item)
+{
+    struct epitem_t **pitem;
+    int i;
+
+    for(pitem = &ep->hash[ep_hash(ep, item->fd)];
+        *pitem != NULL;
+        pitem = &(*pitem)->next)
+    {
+        if(*pitem == item)
+        {
+            *pitem = item->next;
+            ep->nitems--;
+            break;
+        }
+    }
+
+    if((*item->fpprev = item->fnext))
+    {
+        item->fnext->fpprev = item->fpprev;
+    }
+
+    kernel_mutex_lock(&ep->lock);
+    item->flags |= EPITEM_DEAD;
+    __ep_dequeue_item(ep, item);
+    kernel_mutex_unlock(&ep->lock);
+
+    // once these return, our hooks cannot be called again
+    for(i = 0; i < item->nhooks; i++)
+    {
+        selhook_remove(&item->hooks[i].hook);
+    }
+
+    if(item->file->node && IS_EPOLL(item->file->node))
+    {
+        ep->nr_nested--;
+    }
+
+    kmem_cache_free(epitem_cache, item);
+}
+
+
+/*
+ * Release a closed file.
+ */
+void epoll_release_file(struct file_t *f)
+{
+    struct epitem_t *item;
+    struct epoll_t *ep;
+
+    kernel_mutex_lock(&epoll_mutex);
+
+    while((item = f->epitems))
+    {
+        ep = item->ep;
+        kernel_mutex_lock(&ep->mtx);
+        ep_remove(ep, item);
+        kernel_mutex_unlock(&ep->mtx);
+    }
+
+    kernel_mutex_unlock(&epoll_mutex);
+}
+
+
+/*
+ * Close an epoll instance.
+ */
+void epoll_close(struct fs_node_t *node)
+{
+    struct epoll_t *ep = (struct epoll_t *)node->data;
+    struct epitem_t *item;
+    int i;
+
+    if(!ep)
+    {
+        return;
+    }
+
+    kernel_mutex_lock(&epoll_mutex);
+    kernel_mutex_lock(&ep->mtx);
+
+    for(i = 0; i < ep->hashsz; i++)
+    {
+        while((item = ep->hash[i]))
+        {
+            ep_remove(ep, item);
+        }
+    }
+
+    kernel_mutex_unlock(&ep->mtx);
+    kernel_mutex_unlock(&epoll_mutex);
+
+    // wake up anyone still polling us
+    selwakeup(&ep->sel);
+
+    node->data = NULL;
+    kfree(ep->hash);
+    kfree(ep);
+}
+
+
+/*
+ * Poll an epoll instance (i.e. one that is on another epoll instance's
+ * interest list, or is passed to poll()).
+ */
+static long epollfs_poll(struct file_t *f, struct pollfd *pfd)
+{
+    struct epoll_t *ep = (struct epoll_t *)f->node->data;
+
+    if(!ep)
+    {
+        pfd->revents |= POLLNVAL;
+        return 1;
+    }
+
+    if(pfd->events & POLLIN)
+    {
+        if(ep->rdhead)
+        {
+            pfd->revents |= POLLIN;
+            return 1;
+        }
+
+        selrecord(&ep->sel);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Perform a select operation on an epoll instance.
+ */
+static long epollfs_select(struct file_t *f, int which)
+{
+    struct epoll_t *ep = (struct epoll_t *)f->node->data;
+
+    if(!ep || which != FREAD)
+    {
+        return 0;
+    }
+
+    if(ep->rdhead)
+    {
+        return 1;
+    }
+
+    selrecord(&ep->sel);
+
+    return 0;
+}
+
+
+/*
+ * Handler for syscall epoll_create1().
+ */
+long syscall_epoll_create1(int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    struct epoll_t *ep = NULL;
+    long res;
+    int fd;
+
+    if(flags & ~EPOLL_CLOEXEC)
+    {
+        return -EINVAL;
+    }
+
+    if(!(ep = kmalloc(sizeof(struct epoll_t))))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(ep, 0, sizeof(struct epoll_t));
+    ep->hashsz = EPOLL_INIT_HASHSZ;
+
+    if(!(ep->hash = kmalloc(ep->hashsz * sizeof(struct epitem_t *))))
+    {
+        kfree(ep);
+        return -ENOMEM;
+    }
+
+    A_memset(ep->hash, 0, ep->hashsz * sizeof(struct epitem_t *));
+
+    if((res = falloc_pseudo(&fd, &f, &node,
+                            (flags & EPOLL_CLOEXEC) ? O_CLOEXEC : 0)) != 0)
+    {
+        kfree(ep->hash);
+        kfree(ep);
+        return res;
+    }
+
+    ep->node = node;
+
+    node->flags |= FS_NODE_EPOLL;
+    node->data = ep;
+    node->select = epollfs_select;
+    node->poll = epollfs_poll;
+
+    return fd;
+}
+
+
+/*
+ * Handler for syscall epoll_create().
+ */
+long syscall_epoll_create(int size)
+{
+    if(size <= 0)
+    {
+        return -EINVAL;
+    }
+
+    return syscall_epoll_create1(0);
+}
+
+
+/*
+ * Handler for syscall epoll_ctl().
+ */
+long syscall_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    struct epoll_event ev;
+    struct file_t *epf, *f;
+    struct fs_node_t *epnode, *node;
+    struct epoll_t *ep;
+    struct epitem_t *item;
+    volatile struct task_t *ct = this_core->cur_task;
+    long res;
+
+    if(op != EPOLL_CTL_ADD && op != EPOLL_CTL_MOD && op != EPOLL_CTL_DEL)
+    {
+        return -EINVAL;
+    }
+
+    if(op != EPOLL_CTL_DEL)
+    {
+        if(!event)
+        {
+            return -EFAULT;
+        }
+
+        COPY_FROM_USER(&ev, event, sizeof(struct epoll_event));
+    }
+    else
+    {
+        A_memset(&ev, 0, sizeof(struct epoll_event));
+    }
+
+    if(fdnode(epfd, ct, &epf, &epnode) != 0 || fdnode(fd, ct, &f, &node) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(!IS_EPOLL(epnode) || !(ep = (struct epoll_t *)epnode->data) ||
+       epf == f)
+    {
+        return -EINVAL;
+    }
+
+    // files we cannot wait on (e.g. regular files) are not allowed
+    if(!node->poll || node->poll == dummyfs_poll)
+    {
+        return -EPERM;
+    }
+
+    if(ev.events & EPOLLEXCLUSIVE)
+    {
+        if(op != EPOLL_CTL_ADD || IS_EPOLL(node) ||
+           (ev.events & ~(EPOLLEXCLUSIVE | EPOLLIN | EPOLLOUT | EPOLLERR |
+                          EPOLLHUP | EPOLLWAKEUP | EPOLLET)))
+        {
+            return -EINVAL;
+        }
+    }
+
+    // epoll_mutex keeps the files' item lists stable while we add or remove
+    if(op != EPOLL_CTL_MOD)
+    {
+        kernel_mutex_lock(&epoll_mutex);
+    }
+
+    kernel_mutex_lock(&ep->mtx);
+    item = ep_find(ep, fd, f);
+
+    switch(op)
+    {
+        case EPOLL_CTL_ADD:
+            if(item)
+            {
+                res = -EEXIST;
+                break;
+            }
+
+            /*
+             * An epoll instance that is watched by another one cannot watch
+             * an epoll instance that watches other epoll instances. This is
+             * enough to keep us from creating loops.
+             */
+            if(IS_EPOLL(node) && ((struct epoll_t *)node->data)->nr_nested &&
+               epf->epitems)
+            {
+                res = -ELOOP;
+                break;
+            }
+
+            res = ep_insert(ep, &ev, f, fd);
+            break;
+
+        case EPOLL_CTL_MOD:
+            if(!item)
+            {
+                res = -ENOENT;
+            }
+            else if(item->event.events & EPOLLEXCLUSIVE)
+            {
+                res = -EINVAL;
+            }
+            else
+            {
+                res = ep_modify(ep, item, &ev);
+            }
+
+            break;
+
+        default:
+            if(!item)
+            {
+                res = -ENOENT;
+            }
+            else
+            {
+                ep_remove(ep, item);
+                res = 0;
+            }
+
+            break;
+    }
+
+    kernel_mutex_unlock(&ep->mtx);
+
+    if(op != EPOLL_CTL_MOD)
+    {
+        kernel_mutex_unlock(&epoll_mutex);
+    }
+
+    return res;
+}
+
+
+/*
+ * Handler for syscall epoll_wait().
+ */
+long syscall_epoll_wait(int epfd, struct epoll_event *events,
+                        int maxevents, int timeout)
+{
+    struct file_t *f;
+    struct fs_node_t *node;
+    long res;
+
+    if(maxevents <= 0 || maxevents > (INT_MAX / (int)sizeof(struct epoll_event)))
+    {
+        return -EINVAL;
+    }
+
+    if(!events)
+    {
+        return -EFAULT;
+    }
+
+    if(fdnode(epfd, this_core->cur_task, &f, &node) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(!IS_EPOLL(node) || !node->data)
+    {
+        return -EINVAL;
+    }
+
+    // hold a reference so the instance is not freed if another thread
+    // closes the file descriptor while we wait
+    __sync_fetch_and_add(&f->refs, 1);
+    res = ep_poll((struct epoll_t *)node->data, events, maxevents, timeout);
+    closef(f);
+
+    return res;
+}
+
+
+/*
+ * Handler for syscall epoll_pwait().
+ */
+long syscall_epoll_pwait(struct syscall_args *__args)
+{
+    struct syscall_args a;
+    long res;
+
+    // syscall args
+    int epfd;
+    struct epoll_event *events;
+    int maxevents;
+    int timeout;
+    sigset_t *sigmask;
+    sigset_t newsigmask, origmask;
+
+    // get the args
+    COPY_SYSCALL6_ARGS(a, __args);
+    epfd = (int)(a.args[0]);
+    events = (struct epoll_event *)(a.args[1]);
+    maxevents = (int)(a.args[2]);
+    timeout = (int)(a.args[3]);
+    sigmask = (sigset_t *)(a.args[4]);
+
+    if(sigmask)
+    {
+        COPY_FROM_USER(&newsigmask, sigmask, sizeof(sigset_t));
+        syscall_sigprocmask_internal((struct task_t *)this_core->cur_task,
+                                     SIG_SETMASK, &newsigmask, &origmask, 1);
+    }
+
+    res = syscall_epoll_wait(epfd, events, maxevents, timeout);
+
+    if(sigmask)
+    {
+        syscall_sigprocmask_internal((struct task_t *)this_core->cur_task,
+                                     SIG_SETMASK, &origmask, NULL, 1);
+    }
+
+    return res;
+}
@@ -0,0 +1,307 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: eventfd.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file eventfd.c
+ *
+ *  The kernel's eventfd implementation.
+ *
+ *  See: https://man7.org/linux/man-pages/man2/eventfd.2.html
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <kernel/laylaos.h>
+#include <kernel/eventfd.h>
+#include <kernel/vfs.h>
+#include <kernel/user.h>
+#include <kernel/task.h>
+#include <kernel/fcntl.h>
+#include <mm/kheap.h>
+
+#include "../kernel/task_funcs.c"
+
+
+/*
+ * Read from an eventfd.
+ */
+static ssize_t efd_read(struct file_t *f, off_t *pos,
+                        unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    struct eventfd_t *efd = (struct eventfd_t *)f->node->data;
+    uint64_t val;
+
+    if(count < sizeof(uint64_t))
+    {
+        return -EINVAL;
+    }
+
+    kernel_mutex_lock(&efd->lock);
+
+    while(efd->count == 0)
+    {
+        if(f->flags & O_NONBLOCK)
+        {
+            kernel_mutex_unlock(&efd->lock);
+            return -EAGAIN;
+        }
+
+        if(block_task2_and_unlock(efd, 0, &efd->lock) == EINTR)
+        {
+            return -EINTR;
+        }
+
+        kernel_mutex_lock(&efd->lock);
+    }
+
+    val = (efd->flags & EFD_SEMAPHORE) ? 1 : efd->count;
+    efd->count -= val;
+
+    // wake up writers waiting for room
+    unblock_all_tasks(efd);
+    kernel_mutex_unlock(&efd->lock);
+    selwakeup(&efd->sel);
+
+    if(kernel)
+    {
+        A_memcpy(buf, &val, sizeof(uint64_t));
+    }
+    else if(copy_to_user(buf, &val, sizeof(uint64_t)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    return sizeof(uint64_t);
+}
+
+
+/*
+ * Write to an eventfd.
+ */
+static ssize_t efd_write(struct file_t *f, off_t *pos,
+                         unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    struct eventfd_t *efd = (struct eventfd_t *)f->node->data;
+    uint64_t val;
+
+    if(count < sizeof(uint64_t))
+    {
+        return -EINVAL;
+    }
+
+    if(kernel)
+    {
+        A_memcpy(&val, buf, sizeof(uint64_t));
+    }
+    else if(copy_from_user(&val, buf, sizeof(uint64_t)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    if(val > EVENTFD_MAX)
+    {
+        return -EINVAL;
+    }
+
+    kernel_mutex_lock(&efd->lock);
+
+    while(EVENTFD_MAX - efd->count < val)
+    {
+        if(f->flags & O_NONBLOCK)
+        {
+            kernel_mutex_unlock(&efd->lock);
+            return -EAGAIN;
+        }
+
+        if(block_task2_and_unlock(efd, 0, &efd->lock) == EINTR)
+        {
+            return -EINTR;
+        }
+
+        kernel_mutex_lock(&efd->lock);
+    }
+
+    efd->count += val;
+
+    // wake up readers
+    if(val)
+    {
+        unblock_all_tasks(efd);
+    }
+
+    kernel_mutex_unlock(&efd->lock);
+
+    if(val)
+    {
+        selwakeup(&efd->sel);
+    }
+
+    return sizeof(uint64_t);
+}
+
+
+/*
+ * Perform a poll operation on an eventfd.
+ */
+static long efd_poll(struct file_t *f, struct pollfd *pfd)
+{
+    struct eventfd_t *efd = (struct eventfd_t *)f->node->data;
+    long res = 0;
+
+    kernel_mutex_lock(&efd->lock);
+
+    if((pfd->events & POLLIN) && efd->count)
+    {
+        pfd->revents |= POLLIN;
+        res = 1;
+    }
+
+    if((pfd->events & POLLOUT) && efd->count < EVENTFD_MAX)
+    {
+        pfd->revents |= POLLOUT;
+        res = 1;
+    }
+
+    if(!res)
+    {
+        selrecord(&efd->sel);
+    }
+
+    kernel_mutex_unlock(&efd->lock);
+
+    return res;
+}
+
+
+/*
+ * Perform a select operation on an eventfd.
+ */
+static long efd_select(struct file_t *f, int which)
+{
+    struct eventfd_t *efd = (struct eventfd_t *)f->node->data;
+    long res = 0;
+
+    kernel_mutex_lock(&efd->lock);
+
+    switch(which)
+    {
+        case FREAD:
+            res = (efd->count != 0);
+            break;
+
+        case FWRITE:
+            res = (efd->count < EVENTFD_MAX);
+            break;
+
+        default:
+            kernel_mutex_unlock(&efd->lock);
+            return 0;
+    }
+
+    if(!res)
+    {
+        selrecord(&efd->sel);
+    }
+
+    kernel_mutex_unlock(&efd->lock);
+
+    return res;
+}
+
+
+/*
+ * Close an eventfd.
+ */
+void eventfd_close(struct fs_node_t *node)
+{
+    struct eventfd_t *efd = (struct eventfd_t *)node->data;
+
+    if(!efd)
+    {
+        return;
+    }
+
+    // wake up anyone still polling us
+    selwakeup(&efd->sel);
+
+    node->data = NULL;
+    kfree(efd);
+}
+
+
+/*
+ * Handler for syscall eventfd2().
+ */
+long syscall_eventfd2(unsigned int initval, int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    struct eventfd_t *efd;
+    long res;
+    int fd;
+
+    if(flags & ~(EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE))
+    {
+        return -EINVAL;
+    }
+
+    if(!(efd = kmalloc(sizeof(struct eventfd_t))))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(efd, 0, sizeof(struct eventfd_t));
+    efd->count = initval;
+    efd->flags = flags & EFD_SEMAPHORE;
+
+    if((res = falloc_pseudo(&fd, &f, &node,
+                            flags & (EFD_CLOEXEC | EFD_NONBLOCK))) != 0)
+    {
+        kfree(efd);
+        return res;
+    }
+
+    node->flags |= FS_NODE_EVENTFD;
+    node->data = efd;
+    node->select = efd_select;
+    node->poll = efd_poll;
+    node->read = efd_read;
+    node->write = efd_write;
+
+    return fd;
+}
+
+
+/*
+ * Handler for syscall eventfd().
+ */
+long syscall_eventfd(unsigned int initval)
+{
+    return syscall_eventfd2(initval, 0);
+}
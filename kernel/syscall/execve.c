@@ -486,6 +486,7 @@ long syscall_execveat(int dirfd, char *path,
     struct cached_page_t *buf = NULL;
     struct mount_info_t *dinfo;
     pid_t oldtid;
+    int found;
     int followlink = !(flags & AT_SYMLINK_NOFOLLOW);
     
     // init exec is a special case as path is in kernel space not user space.
@@ -735,27 +736,14 @@ long syscall_execveat(int dirfd, char *path,
     __sync_and_and_fetch(&this_core->cur_task->properties, ~PROPERTY_DYNAMICALLY_LOADED);
 
     /*
-     * Reset the task's tid.
+     * Reset the task's tid (if the thread group id is not used by
+     * another task).
      */
-    int found = 0;
     oldtid = this_core->cur_task->pid;
 
-    elevated_priority_lock(&task_table_lock);
-
-    for_each_taskptr(t)
+    if(this_core->cur_task->pid != tgid(this_core->cur_task))
     {
-        if(*t && *t != this_core->cur_task && (*t)->pid == this_core->cur_task->pid)
-        {
-            found = 1;
-            break;
-        }
-    }
-    
-    elevated_priority_unlock(&task_table_lock);
-
-    if(!found && this_core->cur_task->pid != tgid(this_core->cur_task))
-    {
-        this_core->cur_task->pid = tgid(this_core->cur_task);
+        task_change_pid(this_core->cur_task, tgid(this_core->cur_task));
     }
 
     set_task_comm((struct task_t *)this_core->cur_task, invk[1]);
@@ -1009,7 +997,7 @@ long syscall_execveat(int dirfd, char *path,
     A_memset((void *)&this_core->cur_task->signal_stack, 0, sizeof(stack_t));
 
     // close open files that are marked close-on-exec
-    for(i = 0; i < NR_OPEN; i++)
+    for(i = 0; i < this_core->cur_task->ofiles->max_fds; i++)
     {
         if(is_cloexec(this_core->cur_task, i))
         {
@@ -1017,8 +1005,6 @@ long syscall_execveat(int dirfd, char *path,
         }
     }
 
-    this_core->cur_task->cloexec = 0;
-
     this_core->cur_task->end_stack = (uintptr_t)stack;
 
 #ifdef __x86_64__
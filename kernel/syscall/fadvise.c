@@ -0,0 +1,147 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: fadvise.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file fadvise.c
+ *
+ *  Functions for giving the kernel advice on file access patterns.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <kernel/task.h>
+#include <kernel/syscall.h>
+#include <kernel/fio.h>
+#include <kernel/pcache.h>
+#include <fs/readahead.h>
+
+
+/*
+ * Convert a byte range to a page range, clipped to the file's size.
+ * A zero length means 'to the end of the file'.
+ */
+static inline int file_page_range(struct fs_node_t *node, off_t offset,
+                                  off_t len, off_t *start, off_t *end)
+{
+    if(offset < 0 || len < 0)
+    {
+        return -EINVAL;
+    }
+
+    *start = offset & ~(PAGE_SIZE - 1);
+    *end = (len == 0 || offset + len > (off_t)node->size) ?
+                (off_t)node->size : offset + len;
+    *end = (*end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    return 0;
+}
+
+
+/*
+ * Handler for syscall readahead().
+ */
+long syscall_readahead(int fd, off_t offset, size_t count)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    off_t start, end;
+
+    if(fdnode(fd, this_core->cur_task, &f, &node) != 0 ||
+       (f->flags & O_ACCMODE) == O_WRONLY)
+    {
+        return -EBADF;
+    }
+
+    if(!S_ISREG(node->mode) ||
+       file_page_range(node, offset, (off_t)count, &start, &end) != 0)
+    {
+        return -EINVAL;
+    }
+
+    // count == 0 reads nothing (unlike fadvise, where it means up to EOF)
+    if(count && start < end)
+    {
+        readahead_cached_pages(node, start, (end - start) / PAGE_SIZE);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Handler for syscall fadvise64().
+ */
+long syscall_fadvise64(int fd, off_t offset, off_t len, int advice)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    off_t start, end;
+
+    if(fdnode(fd, this_core->cur_task, &f, &node) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(IS_PIPE(node) || IS_SOCKET(node))
+    {
+        return -ESPIPE;
+    }
+
+    if(file_page_range(node, offset, len, &start, &end) != 0)
+    {
+        return -EINVAL;
+    }
+
+    switch(advice)
+    {
+        case POSIX_FADV_NORMAL:
+        case POSIX_FADV_RANDOM:
+        case POSIX_FADV_SEQUENTIAL:
+            // forget the current window, the next read starts a new one
+            f->ra.advice = advice;
+            f->ra.size = 0;
+            f->ra.async_size = 0;
+            return 0;
+
+        case POSIX_FADV_WILLNEED:
+            if(S_ISREG(node->mode) && start < end)
+            {
+                queue_readahead(node, start, (end - start) / PAGE_SIZE);
+            }
+
+            return 0;
+
+        case POSIX_FADV_DONTNEED:
+            if(S_ISREG(node->mode) && start < end)
+            {
+                drop_cached_node_pages(node, start, end);
+            }
+
+            return 0;
+
+        case POSIX_FADV_NOREUSE:
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
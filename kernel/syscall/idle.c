@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <kernel/asm.h>
 #include <kernel/task.h>
+#include <kernel/timer.h>
 #include <kernel/dev.h>
 
 
@@ -47,9 +48,24 @@ int syscall_idle(void)
         return -EPERM;
     }
 
+    /*
+     * Stop the tick and halt until we are woken up. The sti/hlt pair is
+     * atomic, so an interrupt that arrives after we checked for work wakes
+     * us up instead of being missed.
+     */
 idle_loop:
+    cli();
+
+    if(tick_nohz_idle_enter())
+    {
+        __asm__ __volatile__("sti\n"
+                             "hlt" ::: "memory");
+        cli();
+    }
+
+    tick_nohz_idle_exit();
     sti();
-    hlt();
+    scheduler();
     goto idle_loop;
 }
 
@@ -250,16 +250,12 @@ void dec_itimers(void)
 	if(needsoft)
 	{
         /*
-         * This is the code from unblock_kernel_task(). We inline it
-         * here for performance, as this function is called repeatedly
-         * from timer_callback().
+         * Check the state before taking the scheduler locks, as this
+         * function is called repeatedly from timer_callback().
          */
         if(softitimer_task->state == TASK_WAITING)
         {
-            softitimer_task->state = TASK_READY;
-    
-            remove_from_queue(softitimer_task);
-            append_to_ready_queue(softitimer_task);
+            unblock_task_no_preempt(softitimer_task);
         }
 	}
 
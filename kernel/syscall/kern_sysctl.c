@@ -57,14 +57,17 @@
 
 sysctlfn kern_sysctl;
 sysctlfn hw_sysctl;
+sysctlfn net_sysctl;
 
 /*
 extern sysctlfn vm_sysctl;
 extern sysctlfn fs_sysctl;
-extern sysctlfn net_sysctl;
 extern sysctlfn cpu_sysctl;
 */
 
+// defined in network/loopback.c
+extern volatile int loopback_drop_rate;
+
 volatile struct kernel_mutex_t sysctl_lock = { 0, };
 
 
@@ -114,15 +117,15 @@ int syscall_sysctl(struct __sysctl_args *__args)
             fn = hw_sysctl;
             break;
 
+        case CTL_NET:
+            fn = net_sysctl;
+            break;
+
         /*
         case CTL_VM:
             fn = vm_sysctl;
             break;
 
-        case CTL_NET:
-            fn = net_sysctl;
-            break;
-
         case CTL_FS:
             fn = fs_sysctl;
             break;
@@ -196,10 +199,11 @@ int kern_sysctl(int *name, int namelen, void *oldp, size_t *oldlenp,
             return (sysctl_rdstring(oldp, oldlenp, newp, version));
 
         case KERN_MAXPROC:
-            return (sysctl_rdint(oldp, oldlenp, newp, NR_TASKS));
+            return (sysctl_rdint(oldp, oldlenp, newp, MAX_NR_TASKS));
 
         case KERN_MAXFILES:
-            return (sysctl_rdint(oldp, oldlenp, newp, NR_FILE));
+            // there is no system-wide limit apart from the per-task limit
+            return (sysctl_rdint(oldp, oldlenp, newp, MAX_NR_TASKS * NR_OPEN));
 
         case KERN_ARGMAX:
             return (sysctl_rdint(oldp, oldlenp, newp, ARG_MAX));
@@ -296,6 +300,46 @@ int hw_sysctl(int *name, int namelen, void *oldp, size_t *oldlenp,
 }
 
 
+/*
+ * network related system variables.
+ */
+int net_sysctl(int *name, int namelen, void *oldp, size_t *oldlenp, 
+               void *newp, size_t newlen)
+{
+    int error, val;
+
+    /* all sysctl names at this level are terminal */
+    if(namelen != 1)
+    {
+        return -ENOTDIR;        /* overloaded */
+    }
+
+    switch(name[0])
+    {
+        case NET_LOOPBACK_DROP:
+            val = loopback_drop_rate;
+
+            if((error = sysctl_int(oldp, oldlenp, newp, newlen, &val)))
+            {
+                return error;
+            }
+
+            if(val < 0 || val > 1000)
+            {
+                return -EINVAL;
+            }
+
+            loopback_drop_rate = val;
+            return 0;
+
+        default:
+            return -EOPNOTSUPP;
+    }
+
+    /* NOTREACHED */
+}
+
+
 /*
  * Validate parameters and get old / set new parameters
  * for an integer-valued sysctl function.
@@ -98,11 +98,13 @@ long syscall_kill(pid_t pid, int signum)
     }
     else if(pid > 0)
     {
-        for_each_taskptr(t)
+        volatile struct task_t *t;
+
+        for(t = pid_hash[pid_hashfn(pid)]; t != NULL; t = t->pid_hash_next)
         {
-            if(*t && (*t)->pid == pid)
+            if(t->pid == pid)
             {
-                SEND_SIGNAL(*t, signum, force);
+                SEND_SIGNAL(t, signum, force);
                 break;
             }
         }
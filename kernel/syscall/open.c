@@ -105,8 +105,8 @@ long syscall_openat(int dirfd, char *filename, int flags, mode_t mode)
                      OPEN_USER_CALLER | OPEN_CREATE_DENTRY)) != 0)
     {
         KDEBUG("syscall_openat: 4 - i %d\n", i);
-    	this_core->cur_task->ofiles->ofile[fd] = NULL;
-    	f->refs = 0;
+    	fdfree(fd);
+    	file_free(f);
 		return i;
 	}
 
@@ -195,8 +195,8 @@ long syscall_openat(int dirfd, char *filename, int flags, mode_t mode)
     
 error:
 	release_node(node);
-	this_core->cur_task->ofiles->ofile[fd] = NULL;
-	f->refs = 0;
+	fdfree(fd);
+	file_free(f);
 	return res;
 }
 
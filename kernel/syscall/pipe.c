@@ -44,7 +44,7 @@ long syscall_pipe2(int *fildes, int flags)
     struct fs_node_t *node;
     struct file_t *f[2];
     int fd[2];
-    int i, j = 0;
+    long res;
     
     // TODO: add support for this flag
     if(flags & O_DIRECT)
@@ -52,61 +52,25 @@ long syscall_pipe2(int *fildes, int flags)
         return -EINVAL;
     }
 
-    // try to find 2 fds in the master file table
-    for(i = 0; j < 2 && i < NR_FILE; i++)
+    // get 2 fds and file structs
+    if((res = falloc(&fd[0], &f[0])) != 0)
     {
-    	kernel_mutex_lock(&ftab[i].lock);
-        if(ftab[i].refs == 0)
-        {
-            f[j++] = &ftab[i];
-            //ftab[i].refs++;
-            __sync_fetch_and_add(&(ftab[i].refs), 1);
-        }
-    	kernel_mutex_unlock(&ftab[i].lock);
+        return res;
     }
-    
-    // found only 1 - cancel it
-    if(j == 1)
-    {
-        f[0]->refs = 0;
-    }
-    
-    // bail out
-    if(j < 2)
-    {
-        return -ENFILE;
-    }
-    
-    // try to find 2 fds in the task's file table
-    for(i = 0, j = 0; j < 2 && i < NR_OPEN; i++)
-    {
-        if(this_core->cur_task->ofiles->ofile[i] == NULL)
-        {
-            fd[j] = i;
-            this_core->cur_task->ofiles->ofile[i] = f[j++];
-        }
-    }
-    
-    // found only 1 - cancel it
-    if(j == 1)
-    {
-        this_core->cur_task->ofiles->ofile[fd[0]] = NULL;
-    }
-    
-    // bail out
-    if(j < 2)
+
+    if((res = falloc(&fd[1], &f[1])) != 0)
     {
-        f[0]->refs = 0;
-        f[1]->refs = 0;
-        return -EMFILE;
+        fdfree(fd[0]);
+        file_free(f[0]);
+        return res;
     }
     
     if(!(node = pipefs_get_node()))
     {
-        this_core->cur_task->ofiles->ofile[fd[0]] = NULL;
-        this_core->cur_task->ofiles->ofile[fd[1]] = NULL;
-        f[0]->refs = 0;
-        f[1]->refs = 0;
+        fdfree(fd[0]);
+        fdfree(fd[1]);
+        file_free(f[0]);
+        file_free(f[1]);
         return -ENFILE;
     }
     
@@ -55,7 +55,8 @@ static int pollscan(struct pollfd *fds, nfds_t nfds)
             continue;
         }
         
-        f = this_core->cur_task->ofiles->ofile[fd];
+        f = (fd < this_core->cur_task->ofiles->max_fds) ?
+                        this_core->cur_task->ofiles->ofile[fd] : NULL;
 
         if(f == NULL || !f->node || !f->node->poll)
         {
@@ -40,6 +40,7 @@
 #include <kernel/timer.h>
 #include <kernel/ksignal.h>
 #include <kernel/user.h>
+#include <kernel/timerfd.h>
 #include <mm/kheap.h>
 
 #include "../kernel/task_funcs.c"
@@ -52,7 +53,15 @@
 struct posix_timer_t *get_posix_timer(pid_t tgid, ktimer_t timerid)
 {
     struct posix_timer_t *timer;
-    volatile struct task_t *task = get_task_by_tgid(tgid);
+    volatile struct task_t *task;
+
+    // timerfds do not belong to a task
+    if(tgid == TIMERFD_TGID)
+    {
+        return timerfd_get_timer(timerid);
+    }
+
+    task = get_task_by_tgid(tgid);
     
     if(!task || !task->common)
     {
@@ -168,7 +177,7 @@ long timer_gettime_internal(ktimer_t timerid, struct itimerspec *curr_value, int
     struct itimerspec oldval;
     struct posix_timer_t *timer;
     struct clock_waiter_t *head;
-    int64_t remaining_ticks;
+    int64_t remaining_ns;
 	volatile struct task_t *ct = this_core->cur_task;
 
     if(!timerid)
@@ -187,9 +196,9 @@ long timer_gettime_internal(ktimer_t timerid, struct itimerspec *curr_value, int
     A_memset(&oldval, 0, sizeof(struct itimerspec));
     head = &waiter_head[(timer->clockid == CLOCK_REALTIME) ? 1 : 0];
 
-    if(get_waiter(head, tgid(ct), timerid, &remaining_ticks, 0))
+    if(get_waiter(head, tgid(ct), timerid, &remaining_ns, 0))
     {
-        ticks_to_timespec(remaining_ticks, &oldval.it_value);
+        ns_to_timespec(remaining_ns, &oldval.it_value);
     }
     
     A_memcpy(&oldval.it_interval, &timer->val.it_interval,
@@ -51,7 +51,15 @@ INLINE void timer_reset(pid_t tgid, struct posix_timer_t *timer)
  */
 INLINE void timer_notify_expired(pid_t tgid, struct posix_timer_t *timer)
 {
-    volatile struct task_t *task = get_task_by_tgid(tgid);
+    volatile struct task_t *task;
+
+    if(tgid == TIMERFD_TGID)
+    {
+        timerfd_expired(timer);
+        return;
+    }
+
+    task = get_task_by_tgid(tgid);
 
     if(task && timer)
     {
@@ -48,7 +48,7 @@ struct task_rlimit_t default_rlimits[] =
     { "Max stack size", "bytes", { 1024 * 1024 /* 1024K */, RLIM_INFINITY, } },
     { "Max core file size", "bytes", { 0, RLIM_INFINITY, } },
     { "Max resident set", "bytes", { RLIM_INFINITY, RLIM_INFINITY, } },
-    { "Max processes", "processes", { NR_TASKS, NR_TASKS, } },
+    { "Max processes", "processes", { MAX_NR_TASKS, MAX_NR_TASKS, } },
     { "Max open files", "files", { NR_OPEN, NR_OPEN, } },
     { "Max locked memory", "bytes", { 0, 0, } },
     { "Max address space", "bytes", { RLIM_INFINITY, RLIM_INFINITY, } },
@@ -238,7 +238,7 @@ long syscall_prlimit(pid_t pid, int resource, struct rlimit *new_limit,
 
         if(resource == RLIMIT_NOFILE)
         {
-            if(tmp.rlim_max > FOPEN_MAX || tmp.rlim_cur > FOPEN_MAX)
+            if(tmp.rlim_max > NR_OPEN || tmp.rlim_cur > NR_OPEN)
             {
                 return -EPERM;
             }
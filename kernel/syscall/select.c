@@ -48,6 +48,7 @@
 #include <kernel/ksignal.h>
 #include <kernel/fcntl.h>
 #include <mm/kheap.h>
+#include <mm/slab.h>
 
 #include "../kernel/task_funcs.c"
 
@@ -65,12 +66,14 @@ struct seltab_entry_t
     volatile struct kernel_mutex_t lock; // to synchronize access
     struct seltab_entry_t *next;// link to next struct seltab_entry_t
     struct task_t **waiters;    // array of waiters on the above channel
+    struct selhook_t *hooks;    // hooks on the above channel (see epoll)
 };
 
 
 #define INIT_HASHSZ             256
 struct hashtab_t *seltab = NULL;
 volatile struct kernel_mutex_t seltab_lock = { 0, };
+static struct kmem_cache_t *seltab_entry_cache = NULL;
 
 static long selscan(fd_set *, fd_set *, int);
 
@@ -85,6 +88,12 @@ void init_seltab(void)
     {
         kpanic("Failed to initialise kernel select table\n");
     }
+
+    if(!(seltab_entry_cache = kmem_cache_create("seltab_entry",
+                                    sizeof(struct seltab_entry_t), 0, NULL)))
+    {
+        kpanic("Failed to create select table cache\n");
+    }
 }
 
 
@@ -113,6 +122,75 @@ STATIC_INLINE struct seltab_entry_t *get_seltab_entry(void *channel)
 }
 
 
+/*
+ * Same as get_seltab_entry(), except that a new entry is created and added
+ * to the table if there is none. In case of error, NULL is returned.
+ */
+static struct seltab_entry_t *get_or_add_seltab_entry(void *channel)
+{
+    struct hashtab_item_t *hitem, *found;
+    struct seltab_entry_t *se;
+    size_t sz;
+
+    if((se = get_seltab_entry(channel)))
+    {
+        return se;
+    }
+
+    if(!(se = kmem_cache_alloc(seltab_entry_cache)))
+    {
+        return NULL;
+    }
+
+    //A_memset(se, 0, sizeof(struct seltab_entry_t));
+    se->nwaiters = 0;
+    se->lock.lock = 0;
+    se->lock.recursive_count = 0;
+    se->hooks = NULL;
+
+    se->channel = channel;
+    se->waiters_size = INIT_WAITERS_SIZE;
+    sz = INIT_WAITERS_SIZE * sizeof(struct task_t *);
+
+    if(!(se->waiters = kmalloc(sz)))
+    {
+        kmem_cache_free(seltab_entry_cache, se);
+        return NULL;
+    }
+
+    //A_memset(se->waiters, 0, sz);
+    for(int z = 0; z < INIT_WAITERS_SIZE; z++)
+    {
+        se->waiters[z] = 0;
+    }
+
+    if(!(hitem = hashtab_fast_alloc_hitem(channel, se)))
+    {
+        kfree(se->waiters);
+        kmem_cache_free(seltab_entry_cache, se);
+        KDEBUG("Failed to alloc hash item: insufficient memory\n");
+        return NULL;
+    }
+
+    elevated_priority_lock(&seltab_lock);
+
+    // someone might have added the channel while we were allocating ours
+    if((found = hashtab_fast_lookup(seltab, channel)))
+    {
+        elevated_priority_unlock(&seltab_lock);
+        kfree(hitem);
+        kfree(se->waiters);
+        kmem_cache_free(seltab_entry_cache, se);
+        return found->val;
+    }
+
+    hashtab_fast_add_hitem(seltab, channel, hitem);
+    elevated_priority_unlock(&seltab_lock);
+
+    return se;
+}
+
+
 /*
  * Cancel all select() requests by the given task.
  * Called on task termination.
@@ -160,11 +238,8 @@ void task_cancel_select(struct task_t *task)
 }
 
 
-#if FD_SETSIZE > NR_OPEN
+// nd is never more than FD_SETSIZE (see below)
 #define FDS_BITS_ELEMENTS       _howmany(FD_SETSIZE, _NFDBITS)
-#else
-#define FDS_BITS_ELEMENTS       _howmany(NR_OPEN, _NFDBITS)
-#endif
 
 /*
 static inline int validate_fds(fd_set *ibits, int nfd)
@@ -249,9 +324,9 @@ static long select_internal(u_int nd, fd_set *in, fd_set *ou, fd_set *ex,
         return -EINVAL;
     }
     
-    if(nd > NR_OPEN)
+    if(nd > (u_int)this_core->cur_task->ofiles->max_fds)
     {
-        nd = NR_OPEN;
+        nd = this_core->cur_task->ofiles->max_fds;
     }
     
     /*
@@ -613,47 +688,16 @@ void selrecord(struct selinfo *sip)
         return;
     }
 
-    if(!(se = get_seltab_entry(sip)))
+    // epoll wants to know the channel, it will do its own waiting
+    if(ct && ct->selrec)
     {
-        struct hashtab_item_t *hitem;
-        size_t sz;
-
-        if(!(se = kmalloc(sizeof(struct seltab_entry_t))))
-        {
-            return;
-        }
-    
-        //A_memset(se, 0, sizeof(struct seltab_entry_t));
-        se->nwaiters = 0;
-        se->lock.lock = 0;
-        se->lock.recursive_count = 0;
-
-        se->channel = sip;
-        se->waiters_size = INIT_WAITERS_SIZE;
-        sz = INIT_WAITERS_SIZE * sizeof(struct task_t *);
-
-        if(!(se->waiters = kmalloc(sz)))
-        {
-            kfree(se);
-            return;
-        }
-
-        //A_memset(se->waiters, 0, sz);
-        for(int z = 0; z < INIT_WAITERS_SIZE; z++)
-        {
-            se->waiters[z] = 0;
-        }
-
-        if(!(hitem = hashtab_fast_alloc_hitem(sip, se)))
-        {
-            kfree(se);
-            KDEBUG("Failed to alloc hash item: insufficient memory\n");
-            return;
-        }
+        ct->selrec->record(ct->selrec, sip);
+        return;
+    }
 
-        elevated_priority_lock(&seltab_lock);
-        hashtab_fast_add_hitem(seltab, sip, hitem);
-        elevated_priority_unlock(&seltab_lock);
+    if(!(se = get_or_add_seltab_entry(sip)))
+    {
+        return;
     }
 
     elevated_priority_lock(&se->lock);
@@ -707,6 +751,8 @@ void selwakeup(struct selinfo *sip)
 {
     struct seltab_entry_t *se;
     struct task_t **w, **lw, *t;
+    struct selhook_t *h;
+    int woken_exclusive = 0;
     
     if(!sip)
     {
@@ -720,13 +766,15 @@ void selwakeup(struct selinfo *sip)
 
     elevated_priority_lock(&se->lock);
     
-    if(!se->nwaiters)
+    if(!se->nwaiters && !se->hooks)
     {
         elevated_priority_unlock(&se->lock);
         return;
     }
 
-    for(w = se->waiters, lw = &se->waiters[se->waiters_size]; w < lw; w++)
+    for(w = se->waiters, lw = &se->waiters[se->waiters_size]; 
+        se->nwaiters && w < lw; 
+        w++)
     {
         //KDEBUG("selwakeup: pid %d\n", *w ? (*w)->pid : -1);
         
@@ -743,13 +791,93 @@ void selwakeup(struct selinfo *sip)
                 continue;
             }
 
-            t->state = TASK_READY;
-            t->wait_channel = NULL;
+            unblock_task_no_preempt(t);
+        }
+    }
 
-            append_to_ready_queue_locked(t, 1);
+    // hooks stay on the channel, and only the first exclusive hook that
+    // wakes someone up gets the event
+    for(h = se->hooks; h != NULL; h = h->next)
+    {
+        if(h->flags & SELHOOK_EXCLUSIVE)
+        {
+            if(!woken_exclusive && h->func(h) > 0)
+            {
+                woken_exclusive = 1;
+            }
+        }
+        else
+        {
+            h->func(h);
         }
     }
 
     elevated_priority_unlock(&se->lock);
 }
 
+
+/*
+ * Add a select hook.
+ */
+int selhook_add(struct selinfo *sip, struct selhook_t *hook)
+{
+    struct seltab_entry_t *se;
+
+    if(!sip || !hook)
+    {
+        return -EINVAL;
+    }
+
+    if(!(se = get_or_add_seltab_entry(sip)))
+    {
+        return -ENOMEM;
+    }
+
+    hook->sip = sip;
+
+    elevated_priority_lock(&se->lock);
+
+    if((hook->next = se->hooks))
+    {
+        se->hooks->pprev = &hook->next;
+    }
+
+    se->hooks = hook;
+    hook->pprev = &se->hooks;
+
+    elevated_priority_unlock(&se->lock);
+
+    return 0;
+}
+
+
+/*
+ * Remove a select hook.
+ */
+void selhook_remove(struct selhook_t *hook)
+{
+    struct seltab_entry_t *se;
+
+    if(!hook || !hook->pprev)
+    {
+        return;
+    }
+
+    if(!(se = get_seltab_entry(hook->sip)))
+    {
+        return;
+    }
+
+    elevated_priority_lock(&se->lock);
+
+    if((*hook->pprev = hook->next))
+    {
+        hook->next->pprev = hook->pprev;
+    }
+
+    hook->next = NULL;
+    hook->pprev = NULL;
+
+    elevated_priority_unlock(&se->lock);
+}
+
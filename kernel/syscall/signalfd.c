@@ -0,0 +1,390 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: signalfd.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file signalfd.c
+ *
+ *  The kernel's signalfd implementation.
+ *
+ *  See: https://man7.org/linux/man-pages/man2/signalfd.2.html
+ */
+
+//#define __DEBUG
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/signalfd.h>
+#include <kernel/laylaos.h>
+#include <kernel/signalfd.h>
+#include <kernel/vfs.h>
+#include <kernel/user.h>
+#include <kernel/task.h>
+#include <kernel/fio.h>
+#include <kernel/timer.h>
+#include <kernel/ksignal.h>
+#include <kernel/ksigset.h>
+#include <kernel/fcntl.h>
+#include <kernel/asm.h>
+#include <mm/kheap.h>
+
+#include "../kernel/task_funcs.c"
+
+
+/*
+ * Notify signalfd readers.
+ */
+void signalfd_notify(struct task_t *task)
+{
+    uintptr_t flags = int_off();
+
+    // waking up sleeping readers is IRQ-safe
+    unblock_all_tasks(&task->signalfd_sel);
+
+    // but selwakeup() is not, as it takes mutexes
+    if(flags & 0x200)
+    {
+        int_on(flags);
+        __sync_and_and_fetch(&task->signalfd_flags, ~SIGNALFD_DEFERRED);
+        selwakeup(&task->signalfd_sel);
+    }
+    else
+    {
+        __sync_or_and_fetch(&task->signalfd_flags, SIGNALFD_DEFERRED);
+        int_on(flags);
+    }
+}
+
+
+/*
+ * Run deferred signalfd notifications.
+ */
+void signalfd_deferred_notify(struct task_t *task)
+{
+    uintptr_t flags = int_off();
+
+    int_on(flags);
+
+    // try again later if we are still not allowed to sleep
+    if(!(flags & 0x200))
+    {
+        return;
+    }
+
+    if(__sync_fetch_and_and(&task->signalfd_flags, ~SIGNALFD_DEFERRED) &
+                                                    SIGNALFD_DEFERRED)
+    {
+        selwakeup(&task->signalfd_sel);
+    }
+}
+
+
+/*
+ * Get the first pending signal that is in the given mask, or 0.
+ */
+static inline int sfd_pending(struct task_t *ct, sigset_t *mask)
+{
+    int signum;
+
+    for(signum = 1; signum < NSIG; signum++)
+    {
+        if(ksigismember((sigset_t *)&ct->signal_pending, signum) &&
+           ksigismember(mask, signum))
+        {
+            return signum;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Dequeue a pending signal and fill in its info.
+ */
+static void sfd_dequeue(struct task_t *ct, int signum,
+                        struct signalfd_siginfo *ssi)
+{
+    siginfo_t *info = &ct->siginfo[signum];
+    struct posix_timer_t *timer;
+
+    A_memset(ssi, 0, sizeof(struct signalfd_siginfo));
+    ssi->ssi_signo = signum;
+    ssi->ssi_errno = info->si_errno;
+    ssi->ssi_code = info->si_code;
+    ssi->ssi_pid = info->si_pid;
+    ssi->ssi_uid = info->si_uid;
+    ssi->ssi_status = info->si_status;
+    ssi->ssi_int = info->si_value.sival_int;
+    ssi->ssi_ptr = (uintptr_t)info->si_value.sival_ptr;
+    ssi->ssi_addr = (uintptr_t)info->si_addr;
+
+    // signal from a POSIX timer (see handle_signal())
+    if(ksigismember(&ct->signal_timer, signum))
+    {
+        ssi->ssi_tid = info->si_value.sival_int;
+
+        if((timer = get_posix_timer(tgid(ct), ssi->ssi_tid)))
+        {
+            ssi->ssi_ptr = (uintptr_t)timer->sigev.sigev_value.sival_ptr;
+            ssi->ssi_overrun = timer->cur_overruns ?
+                                    timer->cur_overruns - 1 : 0;
+            timer->cur_overruns = 0;
+        }
+
+        ksigdelset(&ct->signal_timer, signum);
+    }
+
+    ksigdelset((sigset_t *)&ct->signal_pending, signum);
+}
+
+
+/*
+ * Read from a signalfd.
+ */
+static ssize_t sfd_read(struct file_t *f, off_t *pos,
+                        unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    struct signalfd_t *sfd = (struct signalfd_t *)f->node->data;
+	struct task_t *ct = (struct task_t *)this_core->cur_task;
+    struct signalfd_siginfo ssi;
+    sigset_t mask;
+    ssize_t res = 0;
+    int signum;
+
+    if(count < sizeof(struct signalfd_siginfo))
+    {
+        return -EINVAL;
+    }
+
+    __sync_or_and_fetch(&ct->signalfd_flags, SIGNALFD_USED);
+
+    kernel_mutex_lock(&sfd->lock);
+    copy_sigset(&mask, &sfd->mask);
+    kernel_mutex_unlock(&sfd->lock);
+
+    while(!(signum = sfd_pending(ct, &mask)))
+    {
+        if(f->flags & O_NONBLOCK)
+        {
+            return -EAGAIN;
+        }
+
+        // signalfd_notify() wakes us up when a signal arrives. The timeout
+        // covers the (small) window between checking and going to sleep
+        if(block_task2(&ct->signalfd_sel, PIT_FREQUENCY) == EINTR)
+        {
+            return -EINTR;
+        }
+    }
+
+    do
+    {
+        sfd_dequeue(ct, signum, &ssi);
+
+        if(kernel)
+        {
+            A_memcpy(buf + res, &ssi, sizeof(struct signalfd_siginfo));
+        }
+        else if(copy_to_user(buf + res, &ssi,
+                                sizeof(struct signalfd_siginfo)) != 0)
+        {
+            return res ? res : -EFAULT;
+        }
+
+        res += sizeof(struct signalfd_siginfo);
+    } while(res + sizeof(struct signalfd_siginfo) <= count &&
+            (signum = sfd_pending(ct, &mask)));
+
+    return res;
+}
+
+
+/*
+ * Signalfds are not writable.
+ */
+static ssize_t sfd_write(struct file_t *f, off_t *pos,
+                         unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(f);
+    UNUSED(pos);
+    UNUSED(buf);
+    UNUSED(count);
+    UNUSED(kernel);
+
+    return -EINVAL;
+}
+
+
+/*
+ * Perform a poll operation on a signalfd.
+ */
+static long sfd_poll(struct file_t *f, struct pollfd *pfd)
+{
+    struct signalfd_t *sfd = (struct signalfd_t *)f->node->data;
+	struct task_t *ct = (struct task_t *)this_core->cur_task;
+    long res = 0;
+
+    __sync_or_and_fetch(&ct->signalfd_flags, SIGNALFD_USED);
+    kernel_mutex_lock(&sfd->lock);
+
+    if((pfd->events & POLLIN) && sfd_pending(ct, &sfd->mask))
+    {
+        pfd->revents |= POLLIN;
+        res = 1;
+    }
+    else
+    {
+        selrecord(&ct->signalfd_sel);
+    }
+
+    kernel_mutex_unlock(&sfd->lock);
+
+    return res;
+}
+
+
+/*
+ * Perform a select operation on a signalfd.
+ */
+static long sfd_select(struct file_t *f, int which)
+{
+    struct signalfd_t *sfd = (struct signalfd_t *)f->node->data;
+	struct task_t *ct = (struct task_t *)this_core->cur_task;
+    long res = 0;
+
+    if(which != FREAD)
+    {
+        return 0;
+    }
+
+    __sync_or_and_fetch(&ct->signalfd_flags, SIGNALFD_USED);
+    kernel_mutex_lock(&sfd->lock);
+
+    if(!(res = (sfd_pending(ct, &sfd->mask) != 0)))
+    {
+        selrecord(&ct->signalfd_sel);
+    }
+
+    kernel_mutex_unlock(&sfd->lock);
+
+    return res;
+}
+
+
+/*
+ * Close a signalfd.
+ */
+void signalfd_close(struct fs_node_t *node)
+{
+    if(node->data)
+    {
+        kfree(node->data);
+        node->data = NULL;
+    }
+}
+
+
+/*
+ * Handler for syscall signalfd4().
+ */
+long syscall_signalfd4(int fd, sigset_t *mask, size_t sizemask, int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    struct signalfd_t *sfd;
+    sigset_t newmask;
+    long res;
+
+    if(!mask || sizemask != _NSIG / 8)
+    {
+        return -EINVAL;
+    }
+
+    if(flags & ~(SFD_CLOEXEC | SFD_NONBLOCK))
+    {
+        return -EINVAL;
+    }
+
+    if(copy_sigset_from_user(&newmask, mask) != 0)
+    {
+        return -EFAULT;
+    }
+
+    // SIGKILL and SIGSTOP cannot be read
+    ksigdelset(&newmask, SIGKILL);
+    ksigdelset(&newmask, SIGSTOP);
+
+    // change the mask of an existing signalfd
+    if(fd != -1)
+    {
+        if(fdnode(fd, this_core->cur_task, &f, &node) != 0)
+        {
+            return -EBADF;
+        }
+
+        if(!IS_SIGNALFD(node) || !node->data)
+        {
+            return -EINVAL;
+        }
+
+        sfd = (struct signalfd_t *)node->data;
+        kernel_mutex_lock(&sfd->lock);
+        copy_sigset(&sfd->mask, &newmask);
+        kernel_mutex_unlock(&sfd->lock);
+
+        return fd;
+    }
+
+    if(!(sfd = kmalloc(sizeof(struct signalfd_t))))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(sfd, 0, sizeof(struct signalfd_t));
+    copy_sigset(&sfd->mask, &newmask);
+
+    if((res = falloc_pseudo(&fd, &f, &node, flags)) != 0)
+    {
+        kfree(sfd);
+        return res;
+    }
+
+    node->flags |= FS_NODE_SIGNALFD;
+    node->data = sfd;
+    node->select = sfd_select;
+    node->poll = sfd_poll;
+    node->read = sfd_read;
+    node->write = sfd_write;
+
+    return fd;
+}
+
+
+/*
+ * Handler for syscall signalfd().
+ */
+long syscall_signalfd(int fd, sigset_t *mask, size_t sizemask)
+{
+    return syscall_signalfd4(fd, mask, sizemask, 0);
+}
@@ -179,7 +179,7 @@ INLINE int getsock(int fd, struct socket_t **so)
     
     *so = NULL;
     
-    if(fd >= (int)NR_OPEN || !ct->ofiles || 
+    if(fd < 0 || !ct->ofiles || fd >= ct->ofiles->max_fds ||
        (fp = ct->ofiles->ofile[fd]) == NULL)
     {
         return -EBADF;
@@ -282,8 +282,8 @@ static int sock_createf(int domain, int type, int protocol,
 
     if(!(node = sockfs_get_node()))
     {
-    	ct->ofiles->ofile[fd] = NULL;
-    	f->refs = 0;
+    	fdfree(fd);
+    	file_free(f);
     	return -ENOSPC;
     }
 
@@ -325,8 +325,8 @@ static int sock_createf(int domain, int type, int protocol,
 
 err:
 
-    ct->ofiles->ofile[fd] = NULL;
-    f->refs = 0;
+    fdfree(fd);
+    file_free(f);
     release_node(node);
     return res;
 }
@@ -2888,7 +2888,7 @@ int syscall_shutdown(int s, int how)
     struct file_t *fp;
     struct task_t *ct = cur_task;
     
-    if(s < 0 || s >= (int)NR_OPEN || !ct->ofiles || 
+    if(s < 0 || !ct->ofiles || s >= ct->ofiles->max_fds ||
        (fp = ct->ofiles->ofile[s]) == NULL)
     {
         return -EBADF;
@@ -0,0 +1,571 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: splice.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file splice.c
+ *
+ *  Functions for moving data between files without copying it to and from
+ *  userspace. Regular file data is taken straight from the page cache, and
+ *  page cache pages are passed to pipes by reference.
+ *
+ *  See: https://man7.org/linux/man-pages/man2/sendfile.2.html
+ *       https://man7.org/linux/man-pages/man2/splice.2.html
+ *       https://man7.org/linux/man-pages/man2/tee.2.html
+ *       https://man7.org/linux/man-pages/man2/vmsplice.2.html
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <kernel/laylaos.h>
+#include <kernel/syscall.h>
+#include <kernel/vfs.h>
+#include <kernel/task.h>
+#include <kernel/fio.h>
+#include <kernel/user.h>
+#include <kernel/clock.h>
+#include <kernel/pcache.h>
+#include <mm/kheap.h>
+#include <fs/pipefs.h>
+
+
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE           0x01
+#define SPLICE_F_NONBLOCK       0x02
+#define SPLICE_F_MORE           0x04
+#define SPLICE_F_GIFT           0x08
+#endif
+
+#define SPLICE_F_ALL            (SPLICE_F_MOVE | SPLICE_F_NONBLOCK | \
+                                 SPLICE_F_MORE | SPLICE_F_GIFT)
+
+// same limit Linux places on a single read/write
+#define SPLICE_MAX_COUNT        0x7ffff000
+
+#define CAN_READ(f)             (((f)->flags & O_ACCMODE) != O_WRONLY)
+#define CAN_WRITE(f)            (((f)->flags & O_ACCMODE) != O_RDONLY)
+
+
+struct splice_out_t
+{
+    struct file_t *f;
+    off_t *pos;
+};
+
+
+/*
+ * Can we take the file's data straight from the page cache?
+ */
+static inline int splice_from_pcache(struct fs_node_t *node)
+{
+    return S_ISREG(node->mode) && node->dev != PROCFS_DEVID;
+}
+
+
+/*
+ * Check we can splice into the given file (pipes are checked by pipefs).
+ */
+static inline long splice_check_out(struct file_t *f)
+{
+    if(!CAN_WRITE(f) || !f->node->write)
+    {
+        return -EBADF;
+    }
+
+    if(f->flags & O_APPEND)
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+
+static inline void splice_update_out(struct file_t *f)
+{
+    if(S_ISREG(f->node->mode))
+    {
+        f->node->mtime = now();
+        f->node->flags |= FS_NODE_DIRTY;
+    }
+}
+
+
+/*
+ * Pipe actor that writes data to a file or socket.
+ */
+static ssize_t splice_write_actor(void *arg, unsigned char *data, size_t len)
+{
+    struct splice_out_t *out = (struct splice_out_t *)arg;
+
+    return out->f->node->write(out->f, out->pos, data, len, 1);
+}
+
+
+/*
+ * Send a regular file's data to a pipe, file or socket, straight from the
+ * page cache. Pipes get references to the cached pages, everything else
+ * gets a single copy from the cached page.
+ */
+static ssize_t splice_file_pages(struct file_t *in, off_t *pos, size_t count,
+                                 struct file_t *out, off_t *opos,
+                                 int nonblock)
+{
+    struct fs_node_t *node = in->node;
+    struct cached_page_t *pcache;
+    size_t done = 0, n, off;
+    ssize_t res = 0;
+    off_t pgoff;
+    int topipe = IS_PIPE(out->node);
+
+    if(*pos < 0)
+    {
+        return -EINVAL;
+    }
+
+    file_readahead(in, *pos, count);
+
+    while(done < count && *pos < (off_t)node->size)
+    {
+        pgoff = *pos & ~(PAGE_SIZE - 1);
+        off = *pos - pgoff;
+        n = PAGE_SIZE - off;
+
+        if(n > count - done)
+        {
+            n = count - done;
+        }
+
+        if((off_t)n > (off_t)node->size - *pos)
+        {
+            n = node->size - *pos;
+        }
+
+        if(!(pcache = get_cached_page_ref(node, pgoff)))
+        {
+            res = -EIO;
+            break;
+        }
+
+        if(topipe)
+        {
+            // the pipe takes over our reference to the page, but we don't
+            // wait for room if we have already spliced something
+            if((res = pipefs_splice_page(out, pcache, off, n,
+                                         nonblock || done)) <= 0)
+            {
+                put_cached_page_ref(pcache);
+            }
+        }
+        else
+        {
+            res = out->node->write(out, opos,
+                                   (unsigned char *)pcache->virt + off, n, 1);
+            put_cached_page_ref(pcache);
+        }
+
+        if(res <= 0)
+        {
+            break;
+        }
+
+        done += res;
+        *pos += res;
+
+        if((size_t)res < n)
+        {
+            break;
+        }
+    }
+
+    return done ? (ssize_t)done : res;
+}
+
+
+/*
+ * Copy data from a file that is not in the page cache (e.g. a character
+ * device) into a pipe, one page at a time.
+ */
+static ssize_t splice_copy_to_pipe(struct file_t *in, off_t *pos,
+                                   size_t count, struct file_t *out)
+{
+    unsigned char *buf;
+    ssize_t res;
+
+    if(count > PAGE_SIZE)
+    {
+        count = PAGE_SIZE;
+    }
+
+    if(!(buf = kmalloc(count)))
+    {
+        return -ENOMEM;
+    }
+
+    // once the data is read, we have to wait for room in the pipe
+    if((res = in->node->read(in, pos, buf, count, 1)) > 0)
+    {
+        res = pipefs_copy_in(out, buf, res, 1, 0);
+    }
+
+    kfree(buf);
+
+    return res;
+}
+
+
+/*
+ * Handler for syscall sendfile().
+ */
+long syscall_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    struct file_t *in = NULL, *out = NULL;
+    struct fs_node_t *inode = NULL, *onode = NULL;
+    off_t pos;
+    ssize_t res;
+
+    if(fdnode(in_fd, this_core->cur_task, &in, &inode) != 0 ||
+       fdnode(out_fd, this_core->cur_task, &out, &onode) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(!CAN_READ(in))
+    {
+        return -EBADF;
+    }
+
+    // the input must be something we can find in the page cache
+    if(!splice_from_pcache(inode))
+    {
+        return -EINVAL;
+    }
+
+    if(!IS_PIPE(onode) && (res = splice_check_out(out)) != 0)
+    {
+        return res;
+    }
+
+    if(offset)
+    {
+        COPY_VAL_FROM_USER(&pos, offset);
+    }
+    else
+    {
+        pos = in->pos;
+    }
+
+    if(count > SPLICE_MAX_COUNT)
+    {
+        count = SPLICE_MAX_COUNT;
+    }
+
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    res = splice_file_pages(in, &pos, count, out, &out->pos,
+                            (out->flags & O_NONBLOCK));
+
+    if(res > 0)
+    {
+        splice_update_out(out);
+    }
+
+    if(offset)
+    {
+        COPY_VAL_TO_USER(offset, &pos);
+    }
+    else
+    {
+        in->pos = pos;
+    }
+
+    return res;
+}
+
+
+/*
+ * Handler for syscall splice().
+ */
+long syscall_splice(struct syscall_args *__args)
+{
+    struct syscall_args a;
+    struct file_t *in = NULL, *out = NULL;
+    struct fs_node_t *inode = NULL, *onode = NULL;
+    struct splice_out_t arg;
+    off_t pos, *ppos;
+    long res;
+    int nonblock;
+
+    // syscall args
+    int fd_in;
+    off_t *off_in;
+    int fd_out;
+    off_t *off_out;
+    size_t len;
+    unsigned int flags;
+
+    // get the args
+    COPY_SYSCALL6_ARGS(a, __args);
+    fd_in = (int)(a.args[0]);
+    off_in = (off_t *)(a.args[1]);
+    fd_out = (int)(a.args[2]);
+    off_out = (off_t *)(a.args[3]);
+    len = (size_t)(a.args[4]);
+    flags = (unsigned int)(a.args[5]);
+
+    if(fdnode(fd_in, this_core->cur_task, &in, &inode) != 0 ||
+       fdnode(fd_out, this_core->cur_task, &out, &onode) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(flags & ~SPLICE_F_ALL)
+    {
+        return -EINVAL;
+    }
+
+    if(len > SPLICE_MAX_COUNT)
+    {
+        len = SPLICE_MAX_COUNT;
+    }
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    nonblock = !!(flags & SPLICE_F_NONBLOCK);
+
+    // pipe to pipe
+    if(IS_PIPE(inode) && IS_PIPE(onode))
+    {
+        if(off_in || off_out)
+        {
+            return -ESPIPE;
+        }
+
+        return pipefs_splice_pipe(in, out, len, nonblock, 1);
+    }
+
+    // pipe to file or socket
+    if(IS_PIPE(inode))
+    {
+        if(off_in)
+        {
+            return -ESPIPE;
+        }
+
+        if((res = splice_check_out(out)) != 0)
+        {
+            return res;
+        }
+
+        if(off_out)
+        {
+            if(IS_SOCKET(onode))
+            {
+                return -ESPIPE;
+            }
+
+            COPY_VAL_FROM_USER(&pos, off_out);
+            ppos = &pos;
+        }
+        else
+        {
+            ppos = &out->pos;
+        }
+
+        arg.f = out;
+        arg.pos = ppos;
+
+        if((res = pipefs_splice_read(in, len, nonblock,
+                                     splice_write_actor, &arg)) > 0)
+        {
+            splice_update_out(out);
+        }
+
+        if(off_out)
+        {
+            COPY_VAL_TO_USER(off_out, &pos);
+        }
+
+        return res;
+    }
+
+    // file to pipe
+    if(IS_PIPE(onode))
+    {
+        if(off_out)
+        {
+            return -ESPIPE;
+        }
+
+        if(!CAN_READ(in) || !inode->read)
+        {
+            return -EBADF;
+        }
+
+        // sockets read into user memory only
+        if(IS_SOCKET(inode))
+        {
+            return -EINVAL;
+        }
+
+        if(off_in)
+        {
+            if(!splice_from_pcache(inode))
+            {
+                return -ESPIPE;
+            }
+
+            COPY_VAL_FROM_USER(&pos, off_in);
+            ppos = &pos;
+        }
+        else
+        {
+            ppos = &in->pos;
+        }
+
+        if(splice_from_pcache(inode))
+        {
+            res = splice_file_pages(in, ppos, len, out, NULL, nonblock);
+        }
+        else
+        {
+            res = splice_copy_to_pipe(in, ppos, len, out);
+        }
+
+        if(off_in)
+        {
+            COPY_VAL_TO_USER(off_in, &pos);
+        }
+
+        return res;
+    }
+
+    // one end must be a pipe
+    return -EINVAL;
+}
+
+
+/*
+ * Handler for syscall tee().
+ */
+long syscall_tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+    struct file_t *in = NULL, *out = NULL;
+    struct fs_node_t *inode = NULL, *onode = NULL;
+
+    if(fdnode(fd_in, this_core->cur_task, &in, &inode) != 0 ||
+       fdnode(fd_out, this_core->cur_task, &out, &onode) != 0)
+    {
+        return -EBADF;
+    }
+
+    if((flags & ~SPLICE_F_ALL) || !IS_PIPE(inode) || !IS_PIPE(onode))
+    {
+        return -EINVAL;
+    }
+
+    if(len > SPLICE_MAX_COUNT)
+    {
+        len = SPLICE_MAX_COUNT;
+    }
+
+    return pipefs_splice_pipe(in, out, len, (flags & SPLICE_F_NONBLOCK), 0);
+}
+
+
+/*
+ * Handler for syscall vmsplice().
+ *
+ * NOTE: We do not map the user's pages into the pipe (or the other way
+ *       round), the data is copied instead. SPLICE_F_GIFT is ignored.
+ */
+long syscall_vmsplice(int fd, struct iovec *iov, unsigned long nr_segs,
+                      unsigned int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    void *iov_base;
+    size_t iov_len;
+    ssize_t res = 0, total = 0;
+    unsigned long i;
+    int nonblock;
+
+    if(fdnode(fd, this_core->cur_task, &f, &node) != 0)
+    {
+        return -EBADF;
+    }
+
+    if((flags & ~SPLICE_F_ALL) || !IS_PIPE(node))
+    {
+        return -EINVAL;
+    }
+
+    if(nr_segs > IOV_MAX)
+    {
+        return -EINVAL;
+    }
+
+    nonblock = (flags & SPLICE_F_NONBLOCK) || (f->flags & O_NONBLOCK);
+
+    for(i = 0; i < nr_segs; i++)
+    {
+        COPY_VAL_FROM_USER(&iov_base, &iov[i].iov_base);
+        COPY_VAL_FROM_USER(&iov_len, &iov[i].iov_len);
+
+        if(iov_len == 0)
+        {
+            continue;
+        }
+
+        if(f->mode & PWRITE_MODE)
+        {
+            res = pipefs_copy_in(f, iov_base, iov_len, 0, nonblock);
+        }
+        else
+        {
+            // don't wait for more data once we have read something
+            res = pipefs_copy_out(f, iov_base, iov_len, 0,
+                                  nonblock || total);
+        }
+
+        if(res <= 0)
+        {
+            break;
+        }
+
+        total += res;
+
+        if((size_t)res < iov_len)
+        {
+            break;
+        }
+    }
+
+    return total ? total : res;
+}
+
@@ -65,6 +65,11 @@
 #include <kernel/fio.h>
 #include <kernel/reboot.h>
 #include <kernel/fcntl.h>
+#include <kernel/futex.h>
+#include <kernel/epoll.h>
+#include <kernel/eventfd.h>
+#include <kernel/timerfd.h>
+#include <kernel/signalfd.h>
 #include <mm/kheap.h>
 #include <mm/mmap.h>
 #include <mm/mmngr_virtual.h>
@@ -269,7 +274,7 @@ syscall_func syscalls[] =
     __SYSCALL_NOSYS,                // capget
     __SYSCALL_NOSYS,                // capset
     syscall_signaltstack,           // signal.c
-    __SYSCALL_NOSYS,                // sendfile - TODO
+    syscall_sendfile,               // splice.c
     __SYSCALL_NOSYS,                // getpmsg - unimplemented in Linux
     __SYSCALL_NOSYS,                // putmsg - unimplemented in Linux
     syscall_fork,       // fork will handle vfork as well
@@ -307,7 +312,7 @@ syscall_func syscalls[] =
     __SYSCALL_NOSYS,                // unimplemented in Linux
     __SYSCALL_NOSYS,                // unimplemented in Linux
     syscall_gettid,                 // thread.c
-    __SYSCALL_NOSYS,                // readahead - TODO
+    syscall_readahead,              // fadvise.c
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
@@ -322,7 +327,7 @@ syscall_func syscalls[] =
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,                // tkill - obsolete Linux syscall
     __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
+    syscall_futex,                  // futex.c
     __SYSCALL_NOSYS,                // sched_setaffinity - TODO
     __SYSCALL_NOSYS,                // sched_getaffinity - TODO
     syscall_set_thread_area,        // gdt.c
@@ -332,13 +337,13 @@ syscall_func syscalls[] =
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
+    syscall_fadvise64,              // fadvise.c
     __SYSCALL_NOSYS,                // unimplemented in Linux
     syscall_exit_group,
     __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
+    syscall_epoll_create,           // epoll.c
+    syscall_epoll_ctl,              // epoll.c
+    syscall_epoll_wait,             // epoll.c
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
     syscall_timer_create,           // posix_timers.c
@@ -395,23 +400,23 @@ syscall_func syscalls[] =
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,                // splice - TODO
+    syscall_splice,                 // splice.c
     __SYSCALL_NOSYS,                // sync_file_range - TODO
-    __SYSCALL_NOSYS,                // tee - TODO
-    __SYSCALL_NOSYS,                // vmsplice - TODO
-    __SYSCALL_NOSYS,
+    syscall_tee,                    // splice.c
+    syscall_vmsplice,               // splice.c
     __SYSCALL_NOSYS,
     __SYSCALL_NOSYS,
+    syscall_epoll_pwait,            // epoll.c
     syscall_utimensat,              // utimensat - TODO
-    __SYSCALL_NOSYS,                // signalfd - TODO
-    __SYSCALL_NOSYS,                // timerfd_create - TODO
-    __SYSCALL_NOSYS,                // eventfd - TODO
+    syscall_signalfd,               // signalfd.c
+    syscall_timerfd_create,         // timerfd.c
+    syscall_eventfd,                // eventfd.c
     __SYSCALL_NOSYS,                // fallocate - TODO
-    __SYSCALL_NOSYS,                // timerfd_settime - TODO
-    __SYSCALL_NOSYS,                // timerfd_gettime - TODO
-    __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
-    __SYSCALL_NOSYS,
+    syscall_timerfd_settime,        // timerfd.c
+    syscall_timerfd_gettime,        // timerfd.c
+    syscall_signalfd4,              // signalfd.c
+    syscall_eventfd2,               // eventfd.c
+    syscall_epoll_create1,          // epoll.c
     syscall_dup3,                   // dup.c
     syscall_pipe2,                  // pipe.c
     __SYSCALL_NOSYS,
@@ -819,11 +824,10 @@ long syscall_close(int fd)
         return -EBADF;
     }
 	
-	cloexec_clear(this_core->cur_task, fd);
-
     remove_task_locks((struct task_t *)this_core->cur_task, f);
 
-	this_core->cur_task->ofiles->ofile[fd] = NULL;
+	// this also clears the close-on-exec flag
+	fdfree(fd);
 	
 	return closef(f);
 }
@@ -1308,6 +1312,7 @@ long syscall_brk(long incr, volatile uintptr_t *res)
             if(memregion)
             {
                 memregion->size = (end - memregion->addr) / PAGE_SIZE;
+                memregion_tree_update(t->mem, memregion);
             }
         }
     }
@@ -1329,6 +1334,7 @@ long syscall_brk(long incr, volatile uintptr_t *res)
         if(memregion)
         {
             memregion->size = (start - memregion->addr) / PAGE_SIZE;
+            memregion_tree_update(t->mem, memregion);
         }
     }
     
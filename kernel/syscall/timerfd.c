@@ -0,0 +1,503 @@
+/*
+ *    Programmed By: Mohammed Isam [mohammed_isam1984@yahoo.com]
+ *    Copyright 2025 (c)
+ *
+ *    file: timerfd.c
+ *    This file is part of LaylaOS.
+ *
+ *    LaylaOS is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LaylaOS is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LaylaOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ *  \file timerfd.c
+ *
+ *  The kernel's timerfd implementation.
+ *
+ *  Timerfds are armed on the same clock waiter lists as POSIX timers, under
+ *  the reserved \ref TIMERFD_TGID thread group id. When a timerfd's waiter
+ *  expires, the softsleep task finds the timer via timerfd_get_timer() and
+ *  calls timerfd_expired() (see timer_notify_expired()), which counts the
+ *  expiration and wakes up readers.
+ *
+ *  See: https://man7.org/linux/man-pages/man2/timerfd_create.2.html
+ */
+
+//#define __DEBUG
+
+#define _POSIX_MONOTONIC_CLOCK
+#define DEFINE_POSIX_TIMER_INLINES
+
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <kernel/laylaos.h>
+#include <kernel/timerfd.h>
+#include <kernel/clock.h>
+#include <kernel/vfs.h>
+#include <kernel/user.h>
+#include <kernel/task.h>
+#include <kernel/fio.h>
+#include <kernel/timer.h>
+#include <kernel/ksignal.h>
+#include <kernel/fcntl.h>
+#include <mm/kheap.h>
+
+#include "../kernel/task_funcs.c"
+#include "posix_timers_inlines.h"
+
+#define TIMERFD_HASHSZ          64
+#define timerfd_hashfn(id)      ((unsigned int)(id) & (TIMERFD_HASHSZ - 1))
+
+// open timerfds, hashed by timer id
+static struct timerfd_t *timerfd_hash[TIMERFD_HASHSZ] = { 0, };
+static volatile struct kernel_mutex_t timerfd_lock = { 0, };
+static ktimer_t timerfd_last_id = 0;
+
+
+static inline struct timerfd_t *timerfd_lookup(ktimer_t timerid)
+{
+    struct timerfd_t *tfd;
+
+    for(tfd = timerfd_hash[timerfd_hashfn(timerid)];
+        tfd != NULL;
+        tfd = tfd->next)
+    {
+        if(tfd->timer.timerid == timerid)
+        {
+            return tfd;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Get a timerfd's timer.
+ *
+ * This is called by the softsleep task with waiter_mutex held. As
+ * timerfd_close() disarms the timer (which needs waiter_mutex) before
+ * freeing the timerfd, the timer stays valid until the caller releases
+ * the mutex.
+ */
+struct posix_timer_t *timerfd_get_timer(ktimer_t timerid)
+{
+    struct timerfd_t *tfd;
+
+    kernel_mutex_lock(&timerfd_lock);
+    tfd = timerfd_lookup(timerid);
+    kernel_mutex_unlock(&timerfd_lock);
+
+    return tfd ? &tfd->timer : NULL;
+}
+
+
+/*
+ * Timerfd expiration.
+ */
+void timerfd_expired(struct posix_timer_t *timer)
+{
+    struct timerfd_t *tfd = (struct timerfd_t *)timer;
+
+    kernel_mutex_lock(&tfd->wait_lock);
+    tfd->expirations++;
+    unblock_all_tasks(tfd);
+    kernel_mutex_unlock(&tfd->wait_lock);
+
+    selwakeup(&tfd->sel);
+}
+
+
+/*
+ * Read from a timerfd.
+ */
+static ssize_t tfd_read(struct file_t *f, off_t *pos,
+                        unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(pos);
+
+    struct timerfd_t *tfd = (struct timerfd_t *)f->node->data;
+    uint64_t val;
+
+    if(count < sizeof(uint64_t))
+    {
+        return -EINVAL;
+    }
+
+    kernel_mutex_lock(&tfd->wait_lock);
+
+    while(tfd->expirations == 0)
+    {
+        if(f->flags & O_NONBLOCK)
+        {
+            kernel_mutex_unlock(&tfd->wait_lock);
+            return -EAGAIN;
+        }
+
+        if(block_task2_and_unlock(tfd, 0, &tfd->wait_lock) == EINTR)
+        {
+            return -EINTR;
+        }
+
+        kernel_mutex_lock(&tfd->wait_lock);
+    }
+
+    val = tfd->expirations;
+    tfd->expirations = 0;
+    kernel_mutex_unlock(&tfd->wait_lock);
+
+    if(kernel)
+    {
+        A_memcpy(buf, &val, sizeof(uint64_t));
+    }
+    else if(copy_to_user(buf, &val, sizeof(uint64_t)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    return sizeof(uint64_t);
+}
+
+
+/*
+ * Timerfds are not writable.
+ */
+static ssize_t tfd_write(struct file_t *f, off_t *pos,
+                         unsigned char *buf, size_t count, int kernel)
+{
+    UNUSED(f);
+    UNUSED(pos);
+    UNUSED(buf);
+    UNUSED(count);
+    UNUSED(kernel);
+
+    return -EINVAL;
+}
+
+
+/*
+ * Perform a poll operation on a timerfd.
+ */
+static long tfd_poll(struct file_t *f, struct pollfd *pfd)
+{
+    struct timerfd_t *tfd = (struct timerfd_t *)f->node->data;
+    long res = 0;
+
+    kernel_mutex_lock(&tfd->wait_lock);
+
+    if((pfd->events & POLLIN) && tfd->expirations)
+    {
+        pfd->revents |= POLLIN;
+        res = 1;
+    }
+    else
+    {
+        selrecord(&tfd->sel);
+    }
+
+    kernel_mutex_unlock(&tfd->wait_lock);
+
+    return res;
+}
+
+
+/*
+ * Perform a select operation on a timerfd.
+ */
+static long tfd_select(struct file_t *f, int which)
+{
+    struct timerfd_t *tfd = (struct timerfd_t *)f->node->data;
+    long res = 0;
+
+    if(which != FREAD)
+    {
+        return 0;
+    }
+
+    kernel_mutex_lock(&tfd->wait_lock);
+
+    if(!(res = (tfd->expirations != 0)))
+    {
+        selrecord(&tfd->sel);
+    }
+
+    kernel_mutex_unlock(&tfd->wait_lock);
+
+    return res;
+}
+
+
+/*
+ * Close a timerfd.
+ */
+void timerfd_close(struct fs_node_t *node)
+{
+    struct timerfd_t *tfd = (struct timerfd_t *)node->data;
+    struct timerfd_t **p;
+    struct clock_waiter_t *head;
+
+    if(!tfd)
+    {
+        return;
+    }
+
+    // disarm the timer first. The softsleep task holds waiter_mutex while
+    // it expires (and re-arms) timers, so it cannot find us after this
+    head = &waiter_head[(tfd->timer.clockid == CLOCK_REALTIME) ? 1 : 0];
+    timer_unwait(head, TIMERFD_TGID, tfd->timer.timerid);
+
+    kernel_mutex_lock(&timerfd_lock);
+
+    for(p = &timerfd_hash[timerfd_hashfn(tfd->timer.timerid)];
+        *p != NULL;
+        p = &(*p)->next)
+    {
+        if(*p == tfd)
+        {
+            *p = tfd->next;
+            break;
+        }
+    }
+
+    kernel_mutex_unlock(&timerfd_lock);
+
+    selwakeup(&tfd->sel);
+
+    node->data = NULL;
+    kfree(tfd);
+}
+
+
+/*
+ * Handler for syscall timerfd_create().
+ */
+long syscall_timerfd_create(clockid_t clockid, int flags)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+    struct timerfd_t *tfd;
+    long res;
+    int fd;
+
+    /* NOTE: for now, we only support those two */
+    if(clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+    {
+        return -EINVAL;
+    }
+
+    if(flags & ~(TFD_CLOEXEC | TFD_NONBLOCK))
+    {
+        return -EINVAL;
+    }
+
+    if(!(tfd = kmalloc(sizeof(struct timerfd_t))))
+    {
+        return -ENOMEM;
+    }
+
+    A_memset(tfd, 0, sizeof(struct timerfd_t));
+    tfd->timer.clockid = clockid;
+    tfd->timer.sigev.sigev_notify = SIGEV_NONE;
+
+    if((res = falloc_pseudo(&fd, &f, &node, flags)) != 0)
+    {
+        kfree(tfd);
+        return res;
+    }
+
+    // get a free timer id (zero is invalid)
+    kernel_mutex_lock(&timerfd_lock);
+
+    do
+    {
+        if(++timerfd_last_id <= 0)
+        {
+            timerfd_last_id = 1;
+        }
+    } while(timerfd_lookup(timerfd_last_id));
+
+    tfd->timer.timerid = timerfd_last_id;
+    tfd->next = timerfd_hash[timerfd_hashfn(timerfd_last_id)];
+    timerfd_hash[timerfd_hashfn(timerfd_last_id)] = tfd;
+
+    kernel_mutex_unlock(&timerfd_lock);
+
+    node->flags |= FS_NODE_TIMERFD;
+    node->data = tfd;
+    node->select = tfd_select;
+    node->poll = tfd_poll;
+    node->read = tfd_read;
+    node->write = tfd_write;
+
+    return fd;
+}
+
+
+static long timerfd_get(int fd, struct timerfd_t **tfd)
+{
+    struct file_t *f = NULL;
+    struct fs_node_t *node = NULL;
+
+    if(fdnode(fd, this_core->cur_task, &f, &node) != 0)
+    {
+        return -EBADF;
+    }
+
+    if(!IS_TIMERFD(node) || !node->data)
+    {
+        return -EINVAL;
+    }
+
+    *tfd = (struct timerfd_t *)node->data;
+
+    return 0;
+}
+
+
+/*
+ * Get the timer's current value. Caller must hold tfd->lock.
+ */
+static void timerfd_curval(struct timerfd_t *tfd, struct itimerspec *val)
+{
+    struct clock_waiter_t *head;
+    int64_t remaining_ns;
+
+    A_memset(val, 0, sizeof(struct itimerspec));
+    head = &waiter_head[(tfd->timer.clockid == CLOCK_REALTIME) ? 1 : 0];
+
+    if(get_waiter(head, TIMERFD_TGID, tfd->timer.timerid, &remaining_ns, 0))
+    {
+        ns_to_timespec(remaining_ns, &val->it_value);
+    }
+
+    A_memcpy(&val->it_interval, &tfd->timer.val.it_interval,
+                sizeof(struct timespec));
+}
+
+
+/*
+ * Handler for syscall timerfd_settime().
+ */
+long syscall_timerfd_settime(int fd, int flags,
+                             struct itimerspec *new_value,
+                             struct itimerspec *old_value)
+{
+    struct itimerspec newval, oldval;
+    struct timerfd_t *tfd;
+    struct clock_waiter_t *head;
+    int64_t nsecs, clock_nsecs;
+    long res;
+
+    if((res = timerfd_get(fd, &tfd)) != 0)
+    {
+        return res;
+    }
+
+    if(flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET))
+    {
+        return -EINVAL;
+    }
+
+    if(!new_value)
+    {
+        return -EFAULT;
+    }
+
+    COPY_FROM_USER(&newval, new_value, sizeof(struct itimerspec));
+
+    if(newval.it_value.tv_nsec < 0 ||
+       newval.it_value.tv_nsec >= 1000000000 ||
+       newval.it_interval.tv_nsec < 0 ||
+       newval.it_interval.tv_nsec >= 1000000000 ||
+       newval.it_value.tv_sec < 0 || newval.it_interval.tv_sec < 0)
+    {
+        return -EINVAL;
+    }
+
+    kernel_mutex_lock(&tfd->lock);
+
+    // remove old timer if it was active
+    timerfd_curval(tfd, &oldval);
+    head = &waiter_head[(tfd->timer.clockid == CLOCK_REALTIME) ? 1 : 0];
+    timer_unwait(head, TIMERFD_TGID, tfd->timer.timerid);
+
+    kernel_mutex_lock(&tfd->wait_lock);
+    tfd->expirations = 0;
+    kernel_mutex_unlock(&tfd->wait_lock);
+
+    // intervals are always relative, so timer_reset() re-arms the timer
+    // with zero flags
+    A_memcpy(&tfd->timer.val, &newval, sizeof(struct itimerspec));
+    tfd->timer.flags = 0;
+
+    // arm the new timer if needed
+    if(newval.it_value.tv_sec || newval.it_value.tv_nsec)
+    {
+        nsecs = timespec_to_ns(&newval.it_value);
+
+        if(flags & TFD_TIMER_ABSTIME)
+        {
+            clock_nsecs = (int64_t)monotonic_time.tv_sec * NSEC_PER_SEC +
+                          monotonic_time.tv_nsec;
+
+            if(tfd->timer.clockid == CLOCK_REALTIME)
+            {
+                clock_nsecs += (int64_t)startup_time * NSEC_PER_SEC;
+            }
+
+            // time has already passed, expire as soon as possible
+            nsecs = (nsecs > clock_nsecs) ? (nsecs - clock_nsecs) : 0;
+        }
+
+        if(!clock_add_waiter(head, TIMERFD_TGID, nsecs, tfd->timer.timerid))
+        {
+            A_memset(&tfd->timer.val, 0, sizeof(struct itimerspec));
+            kernel_mutex_unlock(&tfd->lock);
+            return -ENOMEM;
+        }
+    }
+
+    kernel_mutex_unlock(&tfd->lock);
+
+    if(old_value)
+    {
+        COPY_TO_USER(old_value, &oldval, sizeof(struct itimerspec));
+    }
+
+    return 0;
+}
+
+
+/*
+ * Handler for syscall timerfd_gettime().
+ */
+long syscall_timerfd_gettime(int fd, struct itimerspec *curr_value)
+{
+    struct itimerspec val;
+    struct timerfd_t *tfd;
+    long res;
+
+    if((res = timerfd_get(fd, &tfd)) != 0)
+    {
+        return res;
+    }
+
+    kernel_mutex_lock(&tfd->lock);
+    timerfd_curval(tfd, &val);
+    kernel_mutex_unlock(&tfd->lock);
+
+    return copy_to_user(curr_value, &val, sizeof(struct itimerspec));
+}
@@ -60,7 +60,7 @@ static long do_utime(int dirfd, char *filename,
          */
         if(dirfd != AT_FDCWD)
         {
-            if(!ct->ofiles || dirfd < 0 || dirfd >= NR_OPEN ||
+            if(!ct->ofiles || dirfd < 0 || dirfd >= ct->ofiles->max_fds ||
                ct->ofiles->ofile[dirfd] == NULL ||
                (node = ct->ofiles->ofile[dirfd]->node) == NULL)
             {
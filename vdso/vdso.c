@@ -1,6 +1,7 @@
 #include <limits.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/time.h>
 #include <syscall.h>
 #include "vdso.h"
 
@@ -10,11 +11,9 @@
 int __vdso_clock_gettime(uintptr_t vdso_base, clockid_t clock_id, struct timespec *tp)
 {
     unsigned long res;
-    struct timespec *vdso_monotonic;
+    volatile struct vdso_data_t *vd;
 
-    vdso_base += VDSO_STATIC_CODE_SIZE;
-
-    vdso_monotonic = (struct timespec *)(vdso_base + VDSO_OFFSET_CLOCK_GETTIME);
+    vd = (volatile struct vdso_data_t *)(vdso_base + VDSO_OFFSET_DATA);
 
     /*
      * NOTE: CLOCK_REALTIME: Its time represents seconds and nanoseconds
@@ -22,25 +21,51 @@ int __vdso_clock_gettime(uintptr_t vdso_base, clockid_t clock_id, struct timespe
      *       relative interval are unaffected, but timers for an absolute
      *       point in time are affected.
      */
-    if(clock_id == CLOCK_REALTIME)
-    {
-        time_t startup_time = *(time_t *)(vdso_base + VDSO_OFFSET_STARTUP_TIME);
-
-        tp->tv_sec  = vdso_monotonic->tv_sec + startup_time;
-        tp->tv_nsec = vdso_monotonic->tv_nsec;
-        return 0;
-    }
-    else if(clock_id == CLOCK_MONOTONIC)
+    if(vdso_read_clock(vd, clock_id, tp) == 0)
     {
-        tp->tv_sec  = vdso_monotonic->tv_sec;
-        tp->tv_nsec = vdso_monotonic->tv_nsec;
         return 0;
     }
 
-    __asm__ __volatile__ ("syscall" : 
+    __asm__ __volatile__ ("syscall" :
                           "=a"(res) :
                           "a"(__NR_clock_gettime), "D"(clock_id), "S"(tp) :
                           "rcx", "r9", "r11", "memory");
     return res;
 }
 
+
+int __vdso_gettimeofday(uintptr_t vdso_base, struct timeval *tv, void *tz)
+{
+    volatile struct vdso_data_t *vd;
+    struct timespec ts;
+
+    (void)tz;
+
+    if(tv)
+    {
+        vd = (volatile struct vdso_data_t *)(vdso_base + VDSO_OFFSET_DATA);
+        vdso_read_clock(vd, CLOCK_REALTIME, &ts);
+        tv->tv_sec = ts.tv_sec;
+        tv->tv_usec = ts.tv_nsec / 1000;
+    }
+
+    return 0;
+}
+
+
+time_t __vdso_time(uintptr_t vdso_base, time_t *tloc)
+{
+    volatile struct vdso_data_t *vd;
+    struct timespec ts;
+
+    vd = (volatile struct vdso_data_t *)(vdso_base + VDSO_OFFSET_DATA);
+    vdso_read_clock(vd, CLOCK_REALTIME_COARSE, &ts);
+
+    if(tloc)
+    {
+        *tloc = ts.tv_sec;
+    }
+
+    return ts.tv_sec;
+}
+
@@ -3,16 +3,149 @@
 
 #define VDSO_STATIC_CODE_SIZE           (2 * PAGE_SIZE)
 
-#define VDSO_OFFSET_STARTUP_TIME        0
-#define VDSO_OFFSET_CLOCK_GETTIME       16
+/*
+ * The shared data page is mapped right after the vdso code pages, and
+ * starts with a struct vdso_data_t.
+ */
+#define VDSO_OFFSET_DATA                VDSO_STATIC_CODE_SIZE
+
+/* how the vdso reads the time between ticks */
+#define VDSO_CLOCK_NONE                 0   /* coarse (tick) resolution */
+#define VDSO_CLOCK_TSC                  1   /* invariant TSC */
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW             4
+#endif
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE           5
+#endif
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE          6
+#endif
+
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME                  7
+#endif
+
+
+/*
+ * Time data shared between the kernel and the vdso. The kernel updates it
+ * on each tick and when the clock is set. Readers retry if seq is odd or
+ * changes while they read.
+ *
+ * The monotonic time is mono_sec:mono_nsec at the moment the TSC (converted
+ * to nanoseconds since tsc_base) reads ns_base. The realtime clock is the
+ * monotonic time plus startup_time.
+ */
+struct vdso_data_t
+{
+    volatile uint32_t seq;          /* odd while the kernel is updating */
+    uint32_t clock_mode;            /* VDSO_CLOCK_NONE or VDSO_CLOCK_TSC */
+    uint64_t tsc_base;              /* TSC reading at time zero */
+    uint64_t tsc_mult;              /* TSC cycles to nanoseconds ... */
+    uint32_t tsc_shift;             /* ... as (cycles * mult) >> shift */
+    uint32_t pad;
+    int64_t ns_base;                /* nanoseconds since tsc_base at the
+                                       last update */
+    int64_t mono_sec;               /* monotonic time at the last update */
+    uint64_t mono_nsec;
+    int64_t startup_time;           /* realtime minus monotonic time */
+};
+
+
+static inline uint64_t vdso_rdtsc(void)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+/*
+ * Read a clock from the shared time data. Returns 0 on success, or -1 if
+ * the clock is not one we can read here (the caller should ask the kernel).
+ *
+ * We avoid 64-bit division, as there is no libgcc in the vdso on i686.
+ */
+static inline int vdso_read_clock(volatile struct vdso_data_t *vd,
+                                  clockid_t clock_id, struct timespec *tp)
+{
+    uint32_t seq;
+    uint64_t cycles, ns, nsec;
+    int64_t sec;
+    int coarse;
+
+    if(clock_id == CLOCK_REALTIME_COARSE || clock_id == CLOCK_MONOTONIC_COARSE)
+    {
+        coarse = 1;
+    }
+    else if(clock_id == CLOCK_REALTIME || clock_id == CLOCK_MONOTONIC ||
+            clock_id == CLOCK_MONOTONIC_RAW || clock_id == CLOCK_BOOTTIME)
+    {
+        coarse = 0;
+    }
+    else
+    {
+        return -1;
+    }
+
+    do
+    {
+        while((seq = vd->seq) & 1)
+        {
+            __asm__ __volatile__("pause" ::: "memory");
+        }
+
+        __asm__ __volatile__("" ::: "memory");
+
+        sec = vd->mono_sec;
+        nsec = vd->mono_nsec;
+        ns = 0;
+
+        if(!coarse && vd->clock_mode == VDSO_CLOCK_TSC)
+        {
+            cycles = vdso_rdtsc() - vd->tsc_base;
+            ns = (((cycles >> 32) * vd->tsc_mult) << (32 - vd->tsc_shift)) +
+                 (((cycles & 0xFFFFFFFFULL) * vd->tsc_mult) >> vd->tsc_shift);
+
+            // another cpu's TSC might be slightly behind the updater's
+            ns = ((int64_t)ns > vd->ns_base) ? ns - vd->ns_base : 0;
+        }
+
+        if(clock_id == CLOCK_REALTIME || clock_id == CLOCK_REALTIME_COARSE)
+        {
+            sec += vd->startup_time;
+        }
+
+        __asm__ __volatile__("" ::: "memory");
+    } while(seq != vd->seq);
+
+    nsec += ns;
+
+    while(nsec >= 1000000000ULL)
+    {
+        nsec -= 1000000000ULL;
+        sec++;
+    }
+
+    tp->tv_sec = (time_t)sec;
+    tp->tv_nsec = (long)nsec;
+
+    return 0;
+}
+
 
 #ifdef KERNEL
 
-extern struct timespec *vdso_monotonic;
-extern time_t *vdso_startup_time;
+extern volatile struct vdso_data_t *vdso_data;
 
 int vdso_stub_init(virtual_addr start, virtual_addr end);
 int map_vdso(virtual_addr *resaddr);
+void vdso_update_time(unsigned long long clock_ns);
 
 #endif      /* KERNEL */
 